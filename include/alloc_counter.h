@@ -0,0 +1,57 @@
+/**
+ * alloc_counter.h - Debug counter of heap allocations made after init
+ *
+ * The firmware is meant to reach a steady state in which loop() and the metering
+ * task never touch the heap: months of String/JSON churn every few seconds is
+ * what fragments an ESP32 heap. This counter makes that checkable. Built with
+ * ALLOC_COUNTER_ENABLED=1 and the linker wrapping malloc/calloc/realloc
+ * (-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc), every allocation after
+ * allocCounterArm() is counted with its size and caller address (resolve it with
+ * addr2line against the firmware ELF).
+ *
+ *   - Device (the esp32dev-alloc environment): only allocations from watched
+ *     FreeRTOS tasks count, so WiFi, lwIP and the push channel's task, which
+ *     allocate on their own, do not drown the result. setup() watches the loop
+ *     task and the metering task and arms at its end; "alloc" on the serial
+ *     console prints the counts.
+ *   - Host (the native environment): operator new is routed through the wrapped
+ *     malloc too, and everything counts; `program --check-alloc` fails when the
+ *     simulation allocates once it is running.
+ *
+ * Without ALLOC_COUNTER_ENABLED the functions exist and do nothing, so call sites
+ * need no #if. Allocations made inside libc itself (fopen buffers) and direct
+ * heap_caps_malloc() calls bypass the wrapper and are not seen.
+ */
+
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef ALLOC_COUNTER_ENABLED
+#define ALLOC_COUNTER_ENABLED 0
+#endif
+
+#define ALLOC_COUNTER_MAX_TASKS 2
+
+struct AllocCounterStats {
+  uint32_t count;          // allocations since allocCounterArm()
+  uint32_t bytes;
+  uint32_t largest;
+  const void* firstCaller; // return address of the first one, NULL when none
+  uint32_t firstSize;
+  const void* lastCaller;
+  uint32_t lastSize;
+};
+
+// Device: count allocations made by this FreeRTOS task (TaskHandle_t), up to
+// ALLOC_COUNTER_MAX_TASKS. NULL = the calling task. Ignored on a host.
+void allocCounterWatch(void* task);
+// Start counting from zero
+void allocCounterArm();
+void allocCounterDisarm();
+bool allocCounterArmed();
+AllocCounterStats allocCounterStats();
+
+#endif // ALLOC_COUNTER_H
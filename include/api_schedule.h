@@ -0,0 +1,52 @@
+/**
+ * api_schedule.h - When loop() talks to the API: task periods, batching, deadlines
+ *
+ * The request pattern every meter puts on the backend follows from these
+ * numbers (see registerLoopTasks() and drainTelemetryLog() in main.cpp):
+ *   - session check every SESSION_CHECK_MS: ReportPolicy decides whether the
+ *     current reading is logged (deadbands and heartbeat in config.h);
+ *   - telemetry drain every TELEMETRY_DRAIN_INTERVAL_MS: one POST
+ *     /energy-data/bin of up to TELEMETRY_BATCH_MAX logged readings, held back
+ *     until TELEMETRY_BATCH_MIN are waiting unless one was urgent or the oldest
+ *     is TELEMETRY_BATCH_MAX_WAIT_MS old; TELEMETRY_DRAIN_BACKOFF_MS after a failure;
+ *   - pending-token GET every TOKEN_CHECK_INTERVAL_MS, only while the push
+ *     channel is down;
+ *   - after an outage, the backlog the flash log kept (TELEMETRY_LOG_BUDGET_BYTES)
+ *     goes out in full batches at the drain pace.
+ *
+ * Kept apart from main.cpp so tools/loadgen replays exactly this schedule.
+ */
+
+#ifndef API_SCHEDULE_H
+#define API_SCHEDULE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+#include "report_policy.h"
+
+const ReportPolicyConfig REPORT_POLICY_CONFIG = {
+  REPORT_POWER_DEADBAND_DW, REPORT_POWER_DEADBAND_PCT, REPORT_VOLTAGE_DEADBAND_DV,
+  REPORT_BALANCE_DEADBAND_MWH, REPORT_MIN_INTERVAL_MS, REPORT_HEARTBEAT_MIN_MS, REPORT_HEARTBEAT_MAX_MS
+};
+// Reasons that upload at once instead of waiting for a fuller batch (balance drift can wait)
+const uint8_t REPORT_URGENT = REPORT_FIRST | REPORT_POWER | REPORT_VOLTAGE | REPORT_SENSOR | REPORT_FORCED;
+
+const unsigned long SESSION_CHECK_MS = 50;            // exhausted transition + report policy
+const unsigned long TOKEN_CHECK_INTERVAL_MS = 30000;  // fallback poll for pending tokens
+const unsigned long WIFI_WATCH_INTERVAL_MS = 1000;
+const unsigned long WIFI_RECONNECT_INTERVAL_MS = 10000;
+
+const uint32_t API_SEND_DEADLINE_MS = 10000;     // telemetry POST incl. TLS connect
+const uint32_t TOKEN_POLL_DEADLINE_MS = 6000;    // pending-token GET
+const uint32_t TOKEN_CONFIRM_DEADLINE_MS = 10000;
+
+const uint32_t TELEMETRY_LOG_BUDGET_BYTES = 512 * 1024;  // ~4600 records, ~39 h of outage at 30 s
+const unsigned long TELEMETRY_DRAIN_INTERVAL_MS = 1500;  // backfill pace after reconnect
+const unsigned long TELEMETRY_DRAIN_BACKOFF_MS = 15000;  // pause after a failed upload
+const size_t TELEMETRY_BATCH_MAX = 8;                    // readings per upload request
+const size_t TELEMETRY_BATCH_MIN = 4;                    // wait for this many readings...
+const unsigned long TELEMETRY_BATCH_MAX_WAIT_MS = 120000; // ...or until the oldest is this old
+const size_t TELEMETRY_FRAME_MAX = 1024;                 // binary frame, worst case: full identity + 8 sessions + 8 windows + latency
+
+#endif // API_SCHEDULE_H
@@ -0,0 +1,104 @@
+/**
+ * bench.h - Fixed-seed micro benchmarks for the firmware hot paths
+ *
+ * The same cases run on the device ("bench" on the serial console) and on a
+ * host (`program --bench all` from the native environment), so a regression
+ * shows up as a number that moved between two commits rather than as a
+ * feeling that the meter got slower.
+ *
+ * A case is one iteration of a hot path over inputs drawn from a xorshift32
+ * generator seeded with BENCH_SEED, so every build times exactly the same work.
+ * Each case runs twice over the same inputs: once timed as a whole (mean_ns,
+ * no clock reads inside the loop) and once timed per iteration into a
+ * LatencyHistogram (p50/p99/max, microsecond buckets). The result is one JSON
+ * object per line:
+ *
+ *   {"bench":"ledger.sample","target":"native","seed":1592639215,"iters":20000,
+ *    "mean_ns":38,"p50_us":1,"p99_us":1,"max_us":12,"check":"9c1e0f3a"}
+ *
+ * "check" folds the values the iterations returned: when it differs between two
+ * runs the case did different work, and its timings are not comparable. A case
+ * may append its own fields (sizes, footprints) after "check" with a BenchInfo.
+ * scripts/bench-compare.mjs diffs two such files.
+ *
+ * Core cases (benchAddCore) only use the portable code and keep their own state,
+ * so they never touch the live ledger, journal or token partition; setup()
+ * allocates what a case needs and teardown() frees it again. Device-only paths
+ * (JSON payload, timestamps, GFX screens) are added by main.cpp.
+ *
+ * Not thread-safe; run() blocks the caller for the whole run (a few seconds on
+ * the device - metering keeps running on the other core).
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BENCH_SEED       0x5EEDBEEFUL
+#define BENCH_MAX_CASES  24
+#define BENCH_LINE_MAX   320
+
+// xorshift32: same sequence on every target
+struct BenchRng {
+  explicit BenchRng(uint32_t seed = BENCH_SEED) : s(seed) {}
+  uint32_t next() {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return s;
+  }
+  uint32_t below(uint32_t n) { return next() % n; }
+  // n random decimal digits (first one non-zero) and a terminating NUL
+  void digits(char* out, uint8_t n);
+
+  uint32_t s;
+};
+
+// One iteration; the result is folded into "check" (and keeps the work from being optimised out)
+typedef uint32_t (*BenchFn)(void* ctx, BenchRng& rng);
+// Prepare ctx before the first pass; false skips the case (reported as "skipped")
+typedef bool (*BenchSetup)(void* ctx);
+typedef void (*BenchTeardown)(void* ctx);
+// Extra result fields, written as ',"key":value,...' into out (after both passes, before teardown)
+typedef void (*BenchInfo)(void* ctx, char* out, size_t len);
+// Receives each result line (no newline)
+typedef void (*BenchSink)(const char* line, void* ctx);
+
+struct BenchCase {
+  const char* name;
+  BenchFn fn;
+  void* ctx;
+  uint32_t iters;
+  BenchSetup setup;
+  BenchTeardown teardown;
+  BenchInfo info;
+};
+
+class BenchRunner {
+ public:
+  // target ends up in every line ("esp32", "native")
+  explicit BenchRunner(const char* target);
+
+  // False when BENCH_MAX_CASES are registered already
+  bool add(const char* name, BenchFn fn, void* ctx, uint32_t iters, BenchSetup setup = NULL,
+           BenchTeardown teardown = NULL, BenchInfo info = NULL);
+  // Run the cases whose name starts with prefix ("" = all), one line each; returns cases run
+  uint8_t run(const char* prefix, BenchSink sink, void* sinkCtx);
+
+  uint8_t count() const { return count_; }
+  const char* name(uint8_t i) const { return i < count_ ? cases_[i].name : NULL; }
+
+ private:
+  const char* target_;
+  BenchCase cases_[BENCH_MAX_CASES];
+  uint8_t count_;
+};
+
+// Energy integration, metering period, EEPROM checkpoint and journal commits,
+// token lookup (3, 1k and 100k tokens, with their footprint), offline crypto token decoding,
+// window statistics and the binary telemetry frame (with its bytes per reading)
+void benchAddCore(BenchRunner& runner);
+
+#endif // BENCH_H
@@ -0,0 +1,90 @@
+/**
+ * billing_checkpoint.h - Versioned, CRC-sealed snapshot of the persistent billing state
+ *
+ * One record holds everything a token application changes (purchased,
+ * consumed, PZEM baseline, token, replay window of the offline crypto tokens,
+ * the last server purchases credited), so it is written in a single commit and
+ * can never be seen half old / half new. Used as the full record of the flash
+ * journal (persist_journal.h) and, on devices without the journal partition, in
+ * two alternating EEPROM slots (A/B): a save always overwrites the older slot,
+ * restore takes the valid slot with the newer sequence number, so a power cut
+ * mid-write leaves the previous checkpoint intact.
+ */
+
+#ifndef BILLING_CHECKPOINT_H
+#define BILLING_CHECKPOINT_H
+
+#include <stdint.h>
+#include "crypto_token.h"
+
+#define CHECKPOINT_VERSION        3   // 1: no replay window, 1-2: no purchases (both read as empty)
+#define CHECKPOINT_HAVE_BASELINE  0x01
+#define CHECKPOINT_PURCHASES      4   // server purchases remembered as already credited
+
+// Server purchases already credited, newest first (purchaseIdHash(), 0 = empty slot).
+// A purchase pushed or polled again after a reboot is only confirmed, not credited twice.
+struct PurchaseHistory {
+  uint64_t ids[CHECKPOINT_PURCHASES];
+};
+
+// 64-bit FNV-1a of a purchase id, never 0 (0 marks "no purchase")
+uint64_t purchaseIdHash(const char* id);
+bool purchaseHistoryContains(const PurchaseHistory& h, uint64_t id);
+// Remember id as the newest; the oldest one drops out
+void purchaseHistoryAdd(PurchaseHistory& h, uint64_t id);
+
+// Logical state (what the ledger/billing code reads and writes)
+struct PersistState {
+  int64_t purchasedUwh;
+  int64_t consumedUwh;
+  uint32_t baselineWh;
+  bool haveBaseline;
+  char token[21];
+  TokenReplayWindow replay;
+  PurchaseHistory purchases;
+};
+
+// On-media layout (96 bytes, little-endian, no implicit padding)
+struct BillingCheckpoint {
+  uint8_t version;
+  uint8_t flags;
+  uint16_t replayHighest;  // TokenReplayWindow (zero in version 1)
+  uint32_t seq;            // +1 per checkpoint; newest wins (wrap-safe compare)
+  int64_t purchasedUwh;
+  int64_t consumedUwh;
+  uint32_t baselineWh;
+  char token[20];          // digits, no terminator
+  uint32_t replaySeen;
+  uint8_t reserved[4];
+  uint64_t purchases[CHECKPOINT_PURCHASES];  // PurchaseHistory
+  uint8_t pad[6];
+  uint16_t crc;            // CRC-16/MODBUS over the preceding bytes
+};
+static_assert(sizeof(BillingCheckpoint) == 96, "BillingCheckpoint layout changed");
+
+// Layout of versions 1 and 2 (56 bytes): same fields up to replaySeen, no purchases
+struct BillingCheckpointV2 {
+  uint8_t version;
+  uint8_t flags;
+  uint16_t replayHighest;
+  uint32_t seq;
+  int64_t purchasedUwh;
+  int64_t consumedUwh;
+  uint32_t baselineWh;
+  char token[20];
+  uint32_t replaySeen;
+  uint8_t pad[2];
+  uint16_t crc;
+};
+static_assert(sizeof(BillingCheckpointV2) == 56, "BillingCheckpointV2 layout changed");
+
+// Fill cp from s with sequence number seq, and seal it (version + CRC).
+void checkpointPack(const PersistState& s, uint32_t seq, BillingCheckpoint& cp);
+// False when cp is not a sealed checkpoint of a known version (torn, blank, corrupt).
+bool checkpointUnpack(const BillingCheckpoint& cp, PersistState& s);
+// Same for a checkpoint written before version 3 (journal records and EEPROM slots of 56 bytes)
+bool checkpointUnpackV2(const BillingCheckpointV2& cp, PersistState& s);
+// The newer of two valid checkpoints' sequence numbers
+inline bool checkpointNewer(uint32_t a, uint32_t b) { return (int32_t)(a - b) > 0; }
+
+#endif // BILLING_CHECKPOINT_H
@@ -16,6 +16,26 @@
 // 13-digit meter number (e.g. "0215002079873")
 #define METER_NUMBER "0215002079873"
 
+// ==================== SECRETS ====================
+// Per-meter credentials are provisioned outside the repository: copy include/secrets.example.h
+// to include/secrets.h (git-ignored) and fill it in. What is not set there stays empty and
+// turns off the feature that needs it.
+#if __has_include("secrets.h")
+#include "secrets.h"
+#endif
+
+// Token push channel credential (32 hex characters, server/scripts/meterKey.js).
+// Empty: no push channel, purchased tokens arrive by HTTP polling only.
+#ifndef METER_SOCKET_KEY
+#define METER_SOCKET_KEY ""
+#endif
+
+// Offline crypto token key (32 hex characters, crypto_token.h; server/scripts/meterKey.js).
+// The server issues this meter's tokens with the same key. Empty: crypto tokens are rejected.
+#ifndef METER_TOKEN_KEY
+#define METER_TOKEN_KEY ""
+#endif
+
 // ==================== CLIENT DETAILS ====================
 #define CLIENT_NAME    "YUMVUHORE"
 #define CLIENT_TIN     "1200000"              // Optional, leave empty if not available
@@ -34,4 +54,21 @@
 // Production:  https://smartmeter-jdw0.onrender.com/api
 #define API_BASE_URL "https://smartmeter-jdw0.onrender.com/api"
 
+// ==================== REPORTING ====================
+// A reading is sent when one of these changes by more than its deadband since the last
+// report, otherwise on a heartbeat that backs off from MIN to MAX while readings are flat.
+#define REPORT_POWER_DEADBAND_DW     200      // 20 W ...
+#define REPORT_POWER_DEADBAND_PCT    10       // ... or 10% of the last reported power, whichever is larger
+#define REPORT_VOLTAGE_DEADBAND_DV   50       // 5 V
+#define REPORT_BALANCE_DEADBAND_MWH  20000    // 0.02 kWh remaining
+#define REPORT_MIN_INTERVAL_MS       5000     // never report more often than this
+#define REPORT_HEARTBEAT_MIN_MS      30000
+#define REPORT_HEARTBEAT_MAX_MS      600000   // 10 minutes
+
+// ==================== PERSISTENCE ====================
+// Billing state journal: consumption is committed to flash at most this often (token
+// application and cutoff are written at once). Energy used in between is recovered from
+// the PZEM energy register after a power cut, so this trades only flash wear.
+#define PERSIST_COMMIT_INTERVAL_MS   60000
+
 #endif // CONFIG_H
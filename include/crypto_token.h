@@ -0,0 +1,69 @@
+/**
+ * crypto_token.h - Meter-bound 20-digit credit tokens, decoded and verified offline
+ *
+ * In the spirit of STS prepaid tokens: the 20 digits are a 64-bit block printed in
+ * decimal (leading zeros kept), so the meter can apply a credit without asking the
+ * server. The block is
+ *
+ *   bits 63..30  data, 34 bits, whitened:  class (4) | sequence (16) | amount (14, 0.1 kWh)
+ *   bits 29..0   MAC, 30 bits: SipHash-2-4(meter key, meter number | data)
+ *
+ * The data field is XORed with a keystream derived from the MAC (SipHash of the MAC
+ * under the same key), so consecutive tokens look unrelated and sequence/amount are
+ * not readable from the digits. The 128-bit key is per meter, and the meter number
+ * is part of the MAC input, so a token is only valid for the meter it was issued
+ * for. A random 20-digit server token passes the MAC with odds of 1 in 2^30.
+ *
+ * Replay: every token carries a sequence number (1..65535). The meter accepts a
+ * sequence above the highest seen, or one of the 32 below it that has not been
+ * used yet (out-of-order delivery); the window is persisted with the billing
+ * checkpoint, so a token applies at most once, across reboots included.
+ *
+ * Portable C++ without Arduino dependencies: the same file builds the host
+ * encoder (tools/tokengen).
+ */
+
+#ifndef CRYPTO_TOKEN_H
+#define CRYPTO_TOKEN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CRYPTO_TOKEN_KEY_BYTES     16
+#define CRYPTO_TOKEN_CLASS_CREDIT  1        // amount is energy credit
+#define CRYPTO_TOKEN_MAX_DECI_KWH  0x3FFF   // 1638.3 kWh
+#define CRYPTO_TOKEN_WINDOW        32       // out-of-order sequence numbers still accepted
+
+struct CryptoToken {
+  uint8_t tokenClass;
+  uint16_t seq;        // 1..65535, per meter
+  uint16_t deciKwh;    // amount in 0.1 kWh, 1..CRYPTO_TOKEN_MAX_DECI_KWH
+};
+
+enum CryptoTokenResult {
+  CRYPTO_TOKEN_OK,
+  CRYPTO_TOKEN_NOT_CRYPTO,  // not 20 digits, above 2^64 or MAC mismatch: not one of ours
+  CRYPTO_TOKEN_BAD_FIELDS,  // authentic but unknown class / zero sequence or amount
+};
+
+// Sequence numbers already applied (persisted with the billing checkpoint)
+struct TokenReplayWindow {
+  uint16_t highest;    // highest sequence applied, 0 = none
+  uint32_t seen;       // bit i: sequence highest - 1 - i was applied
+};
+
+// 32 hex characters -> key; false on malformed input
+bool cryptoTokenParseKey(const char* hex, uint8_t key[CRYPTO_TOKEN_KEY_BYTES]);
+
+// Encode t for meterNumber into 20 digits + terminator. False when a field is out of range.
+bool cryptoTokenEncode(const uint8_t key[CRYPTO_TOKEN_KEY_BYTES], const char* meterNumber,
+                       const CryptoToken& t, char out[21]);
+CryptoTokenResult cryptoTokenDecode(const uint8_t key[CRYPTO_TOKEN_KEY_BYTES], const char* meterNumber,
+                                    const char* digits, CryptoToken& t);
+
+// True when seq has not been applied yet (and is not too old to tell)
+bool replayWindowAllows(const TokenReplayWindow& w, uint16_t seq);
+// Record seq as applied; false (window unchanged) when replayWindowAllows() is false
+bool replayWindowAccept(TokenReplayWindow& w, uint16_t seq);
+
+#endif // CRYPTO_TOKEN_H
@@ -0,0 +1,77 @@
+/**
+ * energy_ledger.h - Exact integer energy ledger for prepaid billing
+ *
+ * All quantities are int64 micro-watt-hours (µWh), so a 100 W load sampled every
+ * 200 ms (~5.6 µWh per tick) is billed exactly even with tens of kWh remaining,
+ * which a 32-bit float cannot do. Consumption is integrated with the trapezoidal
+ * rule over timestamped PZEM samples using the raw integer power register
+ * (0.1 W units); the sub-µWh remainder is carried, never dropped.
+ *
+ * The PZEM keeps its own cumulative energy register (1 Wh resolution, integrated
+ * internally at a much higher rate). reconcile() keeps the ledger inside that
+ * register's 1 Wh quantisation window and reports how far it had drifted.
+ */
+
+#ifndef ENERGY_LEDGER_H
+#define ENERGY_LEDGER_H
+
+#include <stdint.h>
+
+#define LEDGER_UWH_PER_WH   1000000LL
+#define LEDGER_UWH_PER_KWH  1000000000LL
+
+class EnergyLedger {
+ public:
+  EnergyLedger();
+
+  // Fresh session: purchased = uwh, consumed = 0. baselineWh = PZEM energy register now
+  // (pass haveBaseline = false when no reading is available yet; taken from the next sample).
+  void reset(int64_t purchasedUwh, uint32_t baselineWh, bool haveBaseline);
+  // Top-up: add to purchased, keep baseline and consumed
+  void topUp(int64_t uwh);
+  // Restore persisted state (integration series restarts with the next sample)
+  void restore(int64_t purchasedUwh, int64_t consumedUwh, uint32_t baselineWh, bool haveBaseline);
+
+  // Integrate one sample: trapezoid between the previous sample and this one.
+  // Gaps longer than maxGapMs restart the series (reconcile() covers the gap).
+  void addSample(uint32_t tMs, uint32_t powerDw);
+  void breakSeries() { havePrev_ = false; }
+
+  // Clamp consumed into the register's [reg, reg + 1 Wh) window.
+  // Returns the correction applied in µWh (+ = ledger was behind, - = ahead; 0 = in window).
+  int64_t reconcile(uint32_t energyWh);
+
+  int64_t purchasedUwh() const { return purchased_; }
+  int64_t consumedUwh() const { return consumed_; }
+  int64_t remainingUwh() const { return consumed_ >= purchased_ ? 0 : purchased_ - consumed_; }
+  uint32_t baselineWh() const { return baselineWh_; }
+  bool hasBaseline() const { return haveBaseline_; }
+
+  // Drift diagnostics
+  int64_t lastCorrectionUwh() const { return lastCorrection_; }
+  int64_t maxCorrectionUwh() const { return maxCorrection_; }
+  uint32_t corrections() const { return corrections_; }
+
+  void setMaxGapMs(uint32_t ms) { maxGapMs_ = ms; }
+
+  static float toKwh(int64_t uwh) { return (float)((double)uwh / (double)LEDGER_UWH_PER_KWH); }
+  static int64_t fromKwh(float kwh) { return (int64_t)((double)kwh * (double)LEDGER_UWH_PER_KWH + 0.5); }
+
+ private:
+  int64_t purchased_;
+  int64_t consumed_;
+  uint32_t baselineWh_;
+  bool haveBaseline_;
+
+  bool havePrev_;
+  uint32_t prevT_;
+  uint32_t prevP_;
+  uint64_t residue_;      // trapezoid area not yet converted to whole µWh
+  uint32_t maxGapMs_;
+
+  int64_t lastCorrection_;
+  int64_t maxCorrection_;
+  uint32_t corrections_;
+};
+
+#endif // ENERGY_LEDGER_H
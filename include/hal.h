@@ -0,0 +1,121 @@
+/**
+ * hal.h - Thin hardware abstraction for the portable firmware core
+ *
+ * Metering, billing, persistence, tokens and time only talk to hardware through
+ * these interfaces, so the same code builds for the ESP32 and for the `native`
+ * PlatformIO environment (src/native/), which runs it on Linux against a
+ * simulated meter, an in-memory panel, scripted keys and file-backed flash.
+ *
+ * The clock is two free functions resolved at link time (hal_esp32.cpp on the
+ * device, the virtual clock in src/native/ on a host): it is read on every
+ * tick and every scheduler run, so it does not go through a vtable.
+ *
+ * Everything else is a small abstract class; the device drivers implement
+ * them directly (PzemSnapshot, Pcd8544, KeypadInput) and the rest have one-line
+ * adapters in hal_esp32.h.
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pzem_reading.h"
+#include "key_debouncer.h"
+
+// ------ Clock ------
+// halMillis() is the time everything is scheduled and timestamped by; halMicros()
+// only measures how long code takes (budgets, latency, commit times). On the device
+// both are the esp_timer clock; the native build runs halMillis() on virtual time
+// and keeps halMicros() on the host clock, so measurements stay real CPU costs.
+uint32_t halMillis();
+uint32_t halMicros();
+
+// ------ Energy meter (PZEM-004T) ------
+class HalMeter {
+ public:
+  virtual ~HalMeter() {}
+  // Start a read; false while the previous one is still outstanding
+  virtual bool request(uint32_t nowMs) = 0;
+  // Pick up the reply to the last request: PZEM_* result code (pzem_reading.h)
+  virtual int collect(uint32_t nowMs) = 0;
+  virtual const PzemReading& last() const = 0;
+};
+
+// ------ Serial line (PZEM-004T Modbus, 9600 8N1) ------
+// The UART as the PZEM driver uses it: whatever has arrived in the RX buffer,
+// and a short frame handed to the TX FIFO. Neither call waits on the line.
+class HalSerial {
+ public:
+  virtual ~HalSerial() {}
+  // Bytes waiting in the RX buffer
+  virtual int available() = 0;
+  // Next received byte, -1 when none is waiting
+  virtual int read() = 0;
+  virtual size_t write(const uint8_t* buf, size_t len) = 0;
+};
+
+// ------ Load relay ------
+class HalRelay {
+ public:
+  virtual ~HalRelay() {}
+  virtual void set(bool on) = 0;
+};
+
+// ------ Keypad ------
+class HalKeys {
+ public:
+  virtual ~HalKeys() {}
+  // Next debounced key press, false when none is queued
+  virtual bool next(KeyEvent& out) = 0;
+};
+
+// ------ Display ------
+// Retained-mode text rows (PCD8544_TEXT_ROWS x PCD8544_TEXT_COLS on the device)
+class HalPanel {
+ public:
+  virtual ~HalPanel() {}
+  virtual void textRow(uint8_t row, const char* text) = 0;
+  virtual void display() = 0;
+};
+
+// ------ Small byte store (EEPROM emulation) ------
+class HalStore {
+ public:
+  virtual ~HalStore() {}
+  virtual void read(uint32_t addr, void* buf, size_t len) = 0;
+  virtual void write(uint32_t addr, const void* buf, size_t len) = 0;
+  // Make the writes since the last commit durable
+  virtual bool commit() = 0;
+
+  template <typename T> void get(uint32_t addr, T& v) { read(addr, &v, sizeof(T)); }
+  template <typename T> void put(uint32_t addr, const T& v) { write(addr, &v, sizeof(T)); }
+};
+
+// ------ Raw flash partition ------
+// NOR semantics: erase sets bytes to 0xFF, write can only clear bits.
+class HalFlash {
+ public:
+  virtual ~HalFlash() {}
+  virtual uint32_t size() const = 0;
+  virtual bool read(uint32_t offset, void* buf, size_t len) = 0;
+  virtual bool write(uint32_t offset, const void* buf, size_t len) = 0;
+  // offset and len multiples of the 4 KB sector
+  virtual bool erase(uint32_t offset, size_t len) = 0;
+  // Read-only view of [offset, offset + len), NULL when it cannot be mapped
+  virtual const void* map(uint32_t offset, size_t len) = 0;
+  virtual void unmap(const void* ptr) = 0;
+};
+
+// ------ UDP (NTP) ------
+class HalUdp {
+ public:
+  virtual ~HalUdp() {}
+  // Send one datagram to host:port without blocking; false when it cannot go out
+  // now (no link, host name still being resolved)
+  virtual bool send(const char* host, uint16_t port, const void* buf, size_t len) = 0;
+  // Next received datagram, truncated to cap; 0 when none is waiting
+  virtual size_t receive(void* buf, size_t cap) = 0;
+};
+
+#endif // HAL_H
@@ -0,0 +1,102 @@
+/**
+ * hal_esp32.h - ESP32 backends of the hardware abstraction (see hal.h)
+ *
+ * The PZEM driver, the panel and the keypad implement their interfaces
+ * themselves; these are the adapters for the pieces that are plain ESP-IDF or
+ * Arduino calls. Device build only (excluded from the native environment).
+ */
+
+#ifndef HAL_ESP32_H
+#define HAL_ESP32_H
+
+#include <Arduino.h>
+#include "esp_partition.h"
+#include "lwip/dns.h"
+#include "hal.h"
+
+#define UDP_LOCAL_PORT   4123
+#define UDP_DNS_SLOTS    4         // one per NTP server
+#define UDP_DNS_TTL_MS   3600000   // pool names rotate; re-resolve hourly
+
+// A HardwareSerial (Serial2 for the PZEM)
+class UartSerial : public HalSerial {
+ public:
+  explicit UartSerial(Stream& port) : port_(port) {}
+  int available() override { return port_.available(); }
+  int read() override { return port_.read(); }
+  size_t write(const uint8_t* buf, size_t len) override { return port_.write(buf, len); }
+
+ private:
+  Stream& port_;
+};
+
+// A data partition found by label
+class EspPartitionFlash : public HalFlash {
+ public:
+  EspPartitionFlash() : part_(NULL), map_(0) {}
+
+  // False when the partition table has no data partition with this label
+  bool begin(const char* label);
+
+  uint32_t size() const override { return part_ ? part_->size : 0; }
+  bool read(uint32_t offset, void* buf, size_t len) override;
+  bool write(uint32_t offset, const void* buf, size_t len) override;
+  bool erase(uint32_t offset, size_t len) override;
+  // One mapping at a time (the token table maps once at boot)
+  const void* map(uint32_t offset, size_t len) override;
+  void unmap(const void* ptr) override;
+
+ private:
+  const esp_partition_t* part_;
+  spi_flash_mmap_handle_t map_;
+};
+
+class GpioRelay : public HalRelay {
+ public:
+  explicit GpioRelay(uint8_t pin) : pin_(pin) {}
+  void begin() { pinMode(pin_, OUTPUT); }
+  void set(bool on) override { digitalWrite(pin_, on ? HIGH : LOW); }
+
+ private:
+  uint8_t pin_;
+};
+
+// The Arduino EEPROM emulation (one flash sector rewritten per commit)
+class EepromStore : public HalStore {
+ public:
+  void read(uint32_t addr, void* buf, size_t len) override;
+  void write(uint32_t addr, const void* buf, size_t len) override;
+  bool commit() override;
+};
+
+// One non-blocking lwIP UDP socket for the NTP client. Not WiFiUDP: its parsePacket()
+// mallocs a 1460-byte buffer on every call, and receive() is polled every few ms while
+// replies are due. WiFi.hostByName() waits for the answer, so names go through lwIP's
+// asynchronous lookup instead: send() returns false until the address is in, and a
+// failed refresh keeps using the last known one.
+class WiFiUdpLink : public HalUdp {
+ public:
+  WiFiUdpLink() : sock_(-1), dnsUsed_(0) {}
+
+  bool send(const char* host, uint16_t port, const void* buf, size_t len) override;
+  size_t receive(void* buf, size_t cap) override;
+
+ private:
+  struct DnsSlot {
+    const char* host;
+    volatile uint32_t addr;      // 0 = never resolved
+    volatile uint32_t resolvedMs;
+    volatile bool pending;       // lookup out, answer comes on the lwIP thread
+  };
+
+  static void onDnsFound(const char* name, const ip_addr_t* ip, void* arg);
+  uint32_t resolve(const char* host);
+
+  bool open();
+
+  int sock_;
+  DnsSlot dns_[UDP_DNS_SLOTS];
+  uint8_t dnsUsed_;
+};
+
+#endif // HAL_ESP32_H
@@ -0,0 +1,50 @@
+/**
+ * host_cache.h - Cached IPv4 address of one host name
+ *
+ * AsyncHttp resolves the API host before every connect. A lookup over WiFi
+ * takes one round trip to the resolver (tens of ms, seconds when it is slow),
+ * so the address is kept for a TTL and only looked up again once that has run
+ * out or a connect to it failed. When the lookup itself fails, the last known
+ * address is used rather than failing the request.
+ *
+ * The resolver is a callback (WiFi.hostByName() on the device, getaddrinfo()
+ * or a fake on a host). Not thread-safe: AsyncHttp calls it from its connect
+ * helper task only.
+ */
+
+#ifndef HOST_CACHE_H
+#define HOST_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Look host up now; true with addr (network byte order, as IPAddress stores it) on success
+typedef bool (*HostResolver)(const char* host, uint32_t& addr, void* ctx);
+
+class HostCache {
+ public:
+  HostCache(uint32_t ttlMs, HostResolver resolve, void* ctx = NULL);
+
+  // Address of host at nowMs: the cached one while younger than the TTL, else a fresh
+  // lookup, else the last known address. False when no address was ever resolved.
+  bool lookup(const char* host, uint32_t nowMs, uint32_t& addr);
+
+  // A connect to the cached address failed: resolve again on the next lookup
+  // (the old address stays as the fallback)
+  void invalidate() { fresh_ = false; }
+
+  uint32_t lookups() const { return lookups_; }
+  uint32_t hits() const { return hits_; }
+
+ private:
+  uint32_t ttlMs_;
+  HostResolver resolve_;
+  void* ctx_;
+  uint32_t addr_;           // 0 = never resolved
+  uint32_t resolvedMs_;
+  bool fresh_;
+  uint32_t lookups_;
+  uint32_t hits_;
+};
+
+#endif // HOST_CACHE_H
@@ -0,0 +1,177 @@
+/**
+ * http_async.h - Non-blocking HTTP/1.1 request engine for the API calls
+ *
+ * Replaces the blocking HTTPClient calls in main.cpp. Requests go into a small
+ * bounded FIFO; loop() calls poll() every pass and the active request is advanced
+ * through CONNECTING -> SENDING -> AWAIT_HEADERS -> READ_BODY -> DONE in slices of
+ * a few milliseconds. Only the TCP/TLS connect cannot be sliced with the Arduino
+ * WiFiClient API, so it runs in a small helper task on core 0 while loop() keeps going.
+ *
+ * One connection is shared by all requests: it is kept alive after a delimited
+ * response (Content-Length or chunked) unless the server says Connection: close,
+ * and closed after HTTP_KEEPALIVE_IDLE_MS without use. A request that fails on a
+ * reused connection before any response byte arrived (server closed it while idle)
+ * is retried at once on a fresh one without using up a retry. The host address is
+ * cached for HTTP_DNS_TTL_MS (host_cache.h) and HTTPS reconnects resume the
+ * previous TLS session (see tls_session_client.h).
+ *
+ * Every request carries a deadline (ms from enqueue) and an optional retry count;
+ * transport errors are retried, except for a non-idempotent request (POST) that
+ * was already sent in full: the server may have acted on it. The same goes for
+ * the free retry after an idle close above. The completion callback is invoked
+ * exactly once, from poll(), with either the HTTP status (> 0) or one of the
+ * negative HTTP_ERR_* codes below.
+ */
+
+#ifndef HTTP_ASYNC_H
+#define HTTP_ASYNC_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <atomic>
+#include "tls_session_client.h"
+#include "host_cache.h"
+
+// Transport error codes (same values as HTTPClient's HTTPC_ERROR_* so logs stay comparable)
+#define HTTP_ERR_CONNECT       (-1)
+#define HTTP_ERR_SEND          (-3)
+#define HTTP_ERR_NOT_CONNECTED (-4)
+#define HTTP_ERR_CONN_LOST     (-5)
+#define HTTP_ERR_QUEUE_FULL    (-6)
+#define HTTP_ERR_TIMEOUT       (-11)
+
+#define HTTP_QUEUE_LEN        4
+#define HTTP_MAX_PATH         96
+#define HTTP_MAX_REQ_BODY     3072  // room for an 8-reading telemetry batch
+#define HTTP_MAX_RESP         1024
+#define HTTP_RETRY_BACKOFF_MS 1000
+#define HTTP_KEEPALIVE_IDLE_MS 30000  // below the usual 60 s server/proxy idle timeout
+#define HTTP_DNS_TTL_MS       300000
+
+// status > 0: HTTP status code, body is NUL-terminated (may be truncated to HTTP_MAX_RESP-1)
+typedef void (*HttpDoneCallback)(int status, const char* body, size_t len, void* ctx);
+
+class AsyncHttp {
+ public:
+  enum Phase { IDLE, CONNECTING, SENDING, AWAIT_HEADERS, READ_BODY, DONE };
+
+  AsyncHttp();
+
+  // Parse base URL ("https://host[:port]/prefix") once and start the connect helper task.
+  bool begin(const char* baseUrl);
+
+  // Queue a request. path is appended to the base URL prefix. body may be NULL (GET).
+  // Returns false (callback NOT called) when the queue is full or arguments do not fit.
+  bool enqueue(const char* method, const char* path, const char* body,
+               uint32_t deadlineMs, uint8_t retries,
+               HttpDoneCallback cb, void* ctx = NULL);
+  // Same with a binary body of len bytes. contentType must be a string literal (not copied).
+  bool enqueue(const char* method, const char* path, const uint8_t* body, size_t len,
+               const char* contentType, uint32_t deadlineMs, uint8_t retries,
+               HttpDoneCallback cb, void* ctx = NULL);
+
+  // Advance the active request for at most sliceMs. Call from loop() every pass.
+  void poll(uint32_t sliceMs = 3);
+
+  bool busy() const { return count_ > 0 || phase_ != IDLE; }
+  size_t queued() const { return count_; }
+  Phase phase() const { return phase_; }
+  const char* host() const { return host_; }
+  uint16_t port() const { return port_; }
+  bool secure() const { return secure_; }
+  const char* prefix() const { return prefix_; }
+
+  // Diagnostics
+  uint32_t completed() const { return completed_; }
+  uint32_t failed() const { return failed_; }
+  uint32_t maxPollUs() const { return maxPollUs_; }
+  bool lastTruncated() const { return truncated_; }
+  uint32_t connectsOpened() const { return connectsOpened_; }
+  uint32_t connectsReused() const { return connectsReused_; }
+  uint32_t fullHandshakes() const { return tls_.fullHandshakes(); }
+  uint32_t resumedHandshakes() const { return tls_.resumedHandshakes(); }
+  uint32_t lastHandshakeMs() const { return tls_.lastHandshakeMs(); }
+  uint32_t dnsLookups() const { return dns_.lookups(); }
+  uint32_t dnsCacheHits() const { return dns_.hits(); }
+
+ private:
+  struct Request {
+    char method[8];
+    char path[HTTP_MAX_PATH];
+    char body[HTTP_MAX_REQ_BODY];
+    uint16_t bodyLen;
+    const char* contentType;
+    uint32_t enqueuedMs;
+    uint32_t deadlineMs;
+    uint32_t notBeforeMs;   // retry backoff
+    uint8_t retriesLeft;
+    HttpDoneCallback cb;
+    void* ctx;
+  };
+
+  static void connectWorker(void* arg);
+  bool resolveHost(IPAddress& ip);
+  Client& client();
+  bool startNext(uint32_t now);
+  bool stepSend();
+  bool stepHeaders();
+  bool stepBody();
+  void finish(int status);
+  void closeConnection();
+  void trackChunkEnd(const uint8_t* data, size_t len);
+  size_t dechunk(char* buf, size_t len);
+
+  // URL parts
+  bool secure_;
+  char host_[64];
+  uint16_t port_;
+  char prefix_[32];
+
+  WiFiClient plain_;
+  TlsSessionClient tls_;
+
+  // Keep-alive: connection left open after the last response
+  bool idleConn_;
+  uint32_t idleSinceMs_;
+  bool reused_;             // active request runs on a kept-alive connection
+
+  HostCache dns_;           // helper task only
+
+  // FIFO of pending requests; slot head_ is the active one while phase_ != IDLE
+  Request queue_[HTTP_QUEUE_LEN];
+  uint8_t head_;
+  uint8_t count_;
+  Phase phase_;
+
+  // Active request progress
+  char header_[256];
+  size_t headerLen_;
+  size_t headerSent_;
+  size_t bodySent_;
+  char resp_[HTTP_MAX_RESP];
+  size_t respLen_;
+  long bodyTotal_;          // body bytes received (before truncation)
+  int status_;
+  long contentLength_;      // -1 = unknown (read until close)
+  bool chunked_;
+  bool keepAlive_;          // HTTP/1.1 response without Connection: close
+  bool complete_;           // whole body received (connection can be reused)
+  char chunkTail_[7];       // last raw body bytes, to spot the final "\r\n0\r\n\r\n"
+  bool truncated_;
+  uint32_t lastRxMs_;
+
+  // Connect helper task handshake: 0 = running, 1 = connected, -1 = failed
+  TaskHandle_t worker_;
+  std::atomic<int> connectResult_;
+  std::atomic<bool> connectInFlight_;
+  uint32_t connectTimeoutMs_;
+  bool abandoned_;          // request finished (timeout) while connect still in flight
+
+  uint32_t completed_;
+  uint32_t failed_;
+  uint32_t maxPollUs_;
+  uint32_t connectsOpened_;
+  uint32_t connectsReused_;
+};
+
+#endif // HTTP_ASYNC_H
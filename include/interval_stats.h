@@ -0,0 +1,109 @@
+/**
+ * interval_stats.h - Streaming statistics of the metering samples between two reports
+ *
+ * A logged reading used to carry only the sample taken at capture time, so a sag
+ * or a load spike between two reports never reached the server. loop() feeds
+ * every sample of the metering task (one per METER_PERIOD_MS) into an
+ * IntervalStats, and close() turns the window since the previous record into a
+ * TelemetryWindow: per channel (voltage, current, power, power factor) the
+ * minimum, maximum, mean, standard deviation and p95.
+ *
+ *   - Mean and variance use Welford's update, which stays accurate in float
+ *     over thousands of samples of nearly the same value (no sum of squares).
+ *   - p95 only depends on the top 5% of the samples: the ISTATS_TOP_SAMPLES
+ *     largest are kept sorted, which makes it exact (nearest rank) for windows of
+ *     fewer than 20 times that many samples (~2 min at 200 ms). Longer windows
+ *     fall back to a P-square estimate (Jain & Chlamtac, 1985) that runs
+ *     alongside: five markers whose heights follow the quantile by parabolic
+ *     interpolation, within ~2% of rank from there on. Memory and cost per
+ *     sample stay fixed however long the window gets.
+ *
+ * Samples without a valid reading (NaN voltage or current) are not counted; a
+ * window without any closes with samples = 0. No heap, O(1) per sample.
+ *
+ * Not thread-safe: add() and close() from the same task (loop()).
+ */
+
+#ifndef INTERVAL_STATS_H
+#define INTERVAL_STATS_H
+
+#include <stdint.h>
+#include "pzem_reading.h"
+#include "telemetry_record.h"
+
+#define ISTATS_QUANTILE     0.95f
+#define ISTATS_TOP_SAMPLES  32   // largest samples kept per channel: p95 exact below 640 samples
+
+// Running estimate of one quantile of a stream (P-square, five markers)
+class P2Quantile {
+ public:
+  explicit P2Quantile(float p) : p_(p), n_(0) {}
+
+  void add(float x);
+  void reset() { n_ = 0; }
+  uint32_t count() const { return n_; }
+  // Current estimate: exact (nearest rank) below five samples, 0 when empty
+  float value() const;
+
+ private:
+  float parabolic(int i, int d) const;
+  float linear(int i, int d) const;
+
+  float p_;
+  uint32_t n_;
+  float q_[5];      // marker heights; the first samples, sorted, until there are five
+  int32_t pos_[5];  // marker positions (1-based ranks)
+  float want_[5];   // desired marker positions
+};
+
+// Count, extremes, Welford mean/variance and p95 of one channel
+class ChannelStats {
+ public:
+  ChannelStats() : p95Estimate_(ISTATS_QUANTILE) { reset(); }
+
+  void add(float x);
+  void reset();
+
+  uint32_t count() const { return n_; }
+  float min() const { return min_; }
+  float max() const { return max_; }
+  float mean() const { return mean_; }
+  float stddev() const;  // population
+  float p95() const;
+
+ private:
+  uint32_t n_;
+  float min_;
+  float max_;
+  float mean_;
+  float m2_;  // sum of squared deviations from the running mean
+  float top_[ISTATS_TOP_SAMPLES];  // largest samples, descending
+  uint32_t topCount_;
+  P2Quantile p95Estimate_;         // once the top samples no longer reach the 95th percentile
+};
+
+class IntervalStats {
+ public:
+  IntervalStats() : startMs_(0) {}
+
+  // Drop what was collected and start a new window at nowMs
+  void reset(uint32_t nowMs);
+  void add(const PzemReading& r);
+  // Summary of the window, then start the next one at nowMs
+  void close(uint32_t nowMs, TelemetryWindow& out);
+
+  uint32_t samples() const { return voltage_.count(); }
+  const ChannelStats& voltage() const { return voltage_; }
+  const ChannelStats& current() const { return current_; }
+  const ChannelStats& power() const { return power_; }
+  const ChannelStats& pf() const { return pf_; }
+
+ private:
+  ChannelStats voltage_;  // V
+  ChannelStats current_;  // A
+  ChannelStats power_;    // W
+  ChannelStats pf_;
+  uint32_t startMs_;
+};
+
+#endif // INTERVAL_STATS_H
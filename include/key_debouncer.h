@@ -0,0 +1,66 @@
+/**
+ * key_debouncer.h - Keypad press events and the scan debouncer
+ *
+ * Hardware-free half of the keypad: the PCF8574 driver (keypad_input.h) feeds
+ * it raw scans on the device, the scripted keypad of the native build feeds it
+ * key-down intervals from a script. keyScanPass() is one pass of the driver's
+ * scan task, so test/test_keypad can run it against simulated key bursts.
+ */
+
+#ifndef KEY_DEBOUNCER_H
+#define KEY_DEBOUNCER_H
+
+#include <stdint.h>
+#include "spsc_ring.h"
+
+#define KEYPAD_NO_KEY          0xFF
+#define KEYPAD_DEBOUNCE_MS     20     // raw scan must be stable this long
+#define KEYPAD_SCAN_MS         5      // rescan period while a key is down / settling
+#define KEYPAD_IDLE_POLL_MS    1000   // safety scan when INT stays quiet
+#define KEYPAD_QUEUE           32     // power of two
+
+struct KeyEvent {
+  uint8_t index;     // 0..15
+  uint32_t atMs;     // millis() when the press was accepted
+};
+
+// Turns raw scans (key index or KEYPAD_NO_KEY) into one press per key-down.
+class KeyDebouncer {
+ public:
+  KeyDebouncer() : candidate_(KEYPAD_NO_KEY), since_(0), stable_(KEYPAD_NO_KEY) {}
+
+  // Returns the key index when a press has just become stable, else KEYPAD_NO_KEY
+  uint8_t update(uint8_t raw, uint32_t nowMs) {
+    if (raw != candidate_) {
+      candidate_ = raw;
+      since_ = nowMs;
+      return KEYPAD_NO_KEY;
+    }
+    if (candidate_ == stable_ || nowMs - since_ < KEYPAD_DEBOUNCE_MS) return KEYPAD_NO_KEY;
+    stable_ = candidate_;
+    return stable_;  // KEYPAD_NO_KEY for a release
+  }
+
+  // Nothing down and nothing settling: safe to sleep until the next INT
+  bool idle() const { return candidate_ == KEYPAD_NO_KEY && stable_ == KEYPAD_NO_KEY; }
+
+ private:
+  uint8_t candidate_;
+  uint32_t since_;
+  uint8_t stable_;
+};
+
+typedef SpscRing<KeyEvent, KEYPAD_QUEUE> KeyQueue;
+
+// One pass of the scan task: debounce the raw scan and queue an accepted press (a full
+// queue drops it and counts it). Returns how long to wait for INT before the next pass.
+inline uint32_t keyScanPass(KeyDebouncer& debouncer, KeyQueue& events, uint8_t raw, uint32_t nowMs) {
+  uint8_t key = debouncer.update(raw, nowMs);
+  if (key != KEYPAD_NO_KEY) {
+    KeyEvent ev = {key, nowMs};
+    events.push(ev);
+  }
+  return debouncer.idle() ? KEYPAD_IDLE_POLL_MS : KEYPAD_SCAN_MS;
+}
+
+#endif // KEY_DEBOUNCER_H
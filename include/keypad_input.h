@@ -0,0 +1,68 @@
+/**
+ * keypad_input.h - Interrupt-driven 4x4 keypad on a PCF8574(T) I2C expander
+ *
+ * P0..P3 drive the rows, P4..P7 read the columns (key index = row * 4 + column).
+ * At rest all rows are pulled low and the columns float high, so any press pulls
+ * a column low and the expander's INT line (open drain, active low) falls. That
+ * edge wakes a small scan task; nothing polls the bus while no key is down.
+ *
+ * The scan task runs on loop()'s core at a higher priority, so keys are scanned,
+ * debounced and queued even while loop() is stuck in a blocking call (WiFi
+ * portal, NTP, a slow TLS write). loop() drains the queue with next() whenever it
+ * gets there; key order and count are preserved (KEYPAD_QUEUE deep).
+ *
+ * While a key is down the task rescans every KEYPAD_SCAN_MS until it is released,
+ * then goes back to waiting for INT (with a slow safety poll in case an edge is
+ * lost). Every scan ends by reading the port at rest, which releases INT.
+ */
+
+#ifndef KEYPAD_INPUT_H
+#define KEYPAD_INPUT_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "spsc_ring.h"
+#include "hal.h"
+
+#define KEYPAD_I2C_FAST_HZ     400000
+#define KEYPAD_I2C_STD_HZ      100000 // PCF8574 datasheet rating; fallback if fast mode fails
+
+class KeypadInput : public HalKeys {
+ public:
+  KeypadInput(TwoWire& wire, uint8_t addr, int8_t intPin);
+
+  // Probe the expander (fast mode, else standard mode), arm INT and start the
+  // scan task. False when the expander does not answer.
+  bool begin(uint8_t sda, uint8_t scl);
+
+  // loop() side: next key press, false when none is queued
+  bool next(KeyEvent& out) override { return events_.pop(out); }
+
+  // Diagnostics
+  uint32_t busHz() const { return busHz_; }
+  uint32_t interrupts() const { return interrupts_; }
+  uint32_t scans() const { return scans_; }
+  uint32_t busErrors() const { return busErrors_; }
+  uint32_t dropped() const { return events_.dropped(); }   // queue full (loop() stalled > 32 keys)
+
+ private:
+  static void IRAM_ATTR onInt(void* arg);
+  static void task(void* arg);
+  bool writePort(uint8_t v);
+  bool readPort(uint8_t& v);
+  uint8_t scan();
+
+  TwoWire& wire_;
+  uint8_t addr_;
+  int8_t intPin_;
+  uint32_t busHz_;
+  TaskHandle_t task_;
+  KeyDebouncer debouncer_;
+  KeyQueue events_;
+
+  volatile uint32_t interrupts_;
+  uint32_t scans_;
+  uint32_t busErrors_;
+};
+
+#endif // KEYPAD_INPUT_H
@@ -0,0 +1,60 @@
+/**
+ * keypad_ui.h - Keypad state machine of the meter UI (token entry, info screens)
+ *
+ * Pure logic: key() updates the UI state and the token being typed and returns
+ * what the caller has to do about it - draw a screen, submit the token, restart
+ * a screen timer. Drawing, timers and token checks stay with the caller
+ * (main.cpp on the device, the simulator in src/native/), so the transitions
+ * are the same on both.
+ *
+ * Keys (4x4 pad, keyFor() maps the scan index):
+ *   READY      A = enter token, C = energy, B = previous token, # * 0 = meter number,
+ *              a digit starts entry with that digit
+ *   ENTERING   digits (auto-submit at 20), D / * = backspace, A = cancel
+ *   RUNNING    * / # = next / previous screen, C = energy
+ *   EXHAUSTED  A = back to READY
+ *   INFO       any key leaves
+ *   VALIDATING A = cancel the server check
+ */
+
+#ifndef KEYPAD_UI_H
+#define KEYPAD_UI_H
+
+#include <stdint.h>
+
+#define UI_TOKEN_DIGITS      20
+#define UI_RUNNING_SCREENS   5    // energy, voltage+current, power+register, freq+PF, time
+
+enum UiState { STATE_READY, STATE_ENTERING, STATE_RUNNING, STATE_EXHAUSTED, STATE_BADTOKEN,
+               STATE_WIFI_CONNECTING, STATE_INFO_SCREEN, STATE_VALIDATING };
+
+enum UiInfoScreen { UI_INFO_METER, UI_INFO_ENERGY, UI_INFO_PREVIOUS_TOKEN };
+
+enum UiAction {
+  UI_NONE,
+  UI_SHOW_READY,
+  UI_SHOW_ENTERING,
+  UI_SUBMIT,             // 20 digits typed: show them, then check/apply input
+  UI_SHOW_RUNNING,       // runningScreen changed: draw it, restart the swap timer
+  UI_SHOW_INFO,          // state is STATE_INFO_SCREEN: draw infoScreen, start its timeout
+  UI_LEAVE_INFO,         // back to RUNNING or READY, depending on the relay
+  UI_CANCEL_VALIDATION,  // state is READY: drop the pending server check
+};
+
+struct KeypadUi {
+  UiState state;
+  UiInfoScreen infoScreen;
+  uint8_t runningScreen;
+  char input[UI_TOKEN_DIGITS + 1];  // digits only, spaces added for display
+  uint8_t inputLen;
+
+  KeypadUi();
+
+  UiAction key(char k);
+  void clearInput();
+
+  // Character of key index 0..15 (row * 4 + column)
+  static char keyFor(uint8_t index);
+};
+
+#endif // KEYPAD_UI_H
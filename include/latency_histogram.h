@@ -0,0 +1,44 @@
+/**
+ * latency_histogram.h - Log-bucketed latency histogram (microseconds)
+ *
+ * Two buckets per power of two: [4,5] [6,7] [8,11] [12,15] ... so a percentile is
+ * known to within 50% whatever the scale, from 1 us up to ~12 s (larger values land
+ * in the last bucket; max() stays exact). record() is a few shifts and an add,
+ * cheap enough to run around every scheduler task and every loop() pass.
+ *
+ * Not thread-safe: record and read from the same task (loop()).
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+#define LHIST_BUCKETS  48   // bucket 2e + half covers [2^e + half * 2^(e-1), ...]; e <= 23
+
+class LatencyHistogram {
+ public:
+  LatencyHistogram() { reset(); }
+
+  void record(uint32_t us);
+  void reset();
+
+  uint32_t count() const { return count_; }
+  uint32_t max() const { return max_; }
+  // Upper bound of the bucket holding the pct-th percentile (capped at max()), 0 when empty
+  uint32_t percentile(uint8_t pct) const;
+
+  // Raw buckets for dumps
+  uint32_t bucketCount(uint8_t b) const { return b < LHIST_BUCKETS ? buckets_[b] : 0; }
+  static uint32_t bucketLow(uint8_t b);
+  static uint32_t bucketHigh(uint8_t b);
+
+ private:
+  static uint8_t bucketOf(uint32_t us);
+
+  uint32_t buckets_[LHIST_BUCKETS];
+  uint32_t count_;
+  uint32_t max_;
+};
+
+#endif // LATENCY_HISTOGRAM_H
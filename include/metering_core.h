@@ -0,0 +1,133 @@
+/**
+ * metering_core.h - Metering, billing and persistence, free of any hardware
+ *
+ * Everything the metering task does once per period, behind the HAL (hal.h):
+ * pick up the meter reading, apply queued token commands, integrate power into
+ * the energy ledger, cut the relay when the credit runs out, and persist the
+ * ledger (flash journal, or EEPROM A/B checkpoints without the journal
+ * partition). The FreeRTOS task and the cross-core queues stay in main.cpp;
+ * the native build drives the same object from a virtual clock.
+ *
+ * One period:
+ *   bool fresh = core.poll(now);            // collect last reply, send next request
+ *   core.apply(cmd, now);                   // for each queued BillingCommand
+ *   if (core.settle(now, fresh, sample))    // integrate, cutoff, persist
+ *     publish(sample);
+ *   publish(core.billing());
+ *
+ * Not thread-safe: owned by the metering task once setup() has finished.
+ */
+
+#ifndef METERING_CORE_H
+#define METERING_CORE_H
+
+#include <stdint.h>
+#include "hal.h"
+#include "energy_ledger.h"
+#include "persist_journal.h"
+#include "billing_checkpoint.h"
+#include "crypto_token.h"
+
+#define METER_PERIOD_MS          200    // fixed integration cadence
+#define PZEM_STALE_MS            1000   // no valid reply for this long -> readings shown as "--"
+#define EEPROM_SAVE_INTERVAL_MS  5000   // periodic ledger save without the journal
+#define EXHAUSTED_UWH            10     // 0.00001 kWh, same cutoff as before
+
+// EEPROM layout (HalStore addresses)
+#define EEPROM_SIZE 368
+#define EEPROM_ADDR_REMAINING_KWH       0   // float (4 bytes) — legacy, read once for migration
+#define EEPROM_ADDR_SESSION_PURCHASED   4   // float (4 bytes) — legacy, read once for migration
+#define EEPROM_ADDR_PZEM_SESSION_START  8   // float (4 bytes) — legacy, read once for migration
+#define EEPROM_ADDR_TOKEN              12   // char[21] — legacy, read once for migration
+#define EEPROM_ADDR_LEDGER_MAGIC       36   // uint32 — EEPROM_LEDGER_MAGIC when the slots below are valid
+#define EEPROM_ADDR_PURCHASED_UWH      40   // int64 (8 bytes) — legacy, read once for migration
+#define EEPROM_ADDR_CONSUMED_UWH       48   // int64 (8 bytes) — legacy, read once for migration
+#define EEPROM_ADDR_BASELINE_WH        56   // uint32 — legacy, read once for migration
+#define EEPROM_LEDGER_MAGIC    0x4C444731UL // "LDG1"
+#define EEPROM_ADDR_CHECKPOINT_V2_A    64   // BillingCheckpointV2 (56 bytes) — legacy, read once for migration
+#define EEPROM_ADDR_CHECKPOINT_V2_B   120   // BillingCheckpointV2 (56 bytes) — legacy, read once for migration
+#define EEPROM_ADDR_CHECKPOINT_A      176   // BillingCheckpoint (96 bytes)
+#define EEPROM_ADDR_CHECKPOINT_B      272   // BillingCheckpoint (96 bytes)
+
+struct BillingState {
+  // kWh views of the integer ledger for display/telemetry; the ledger itself is authoritative
+  float remaining_kwh;
+  float session_purchased_kwh;
+  float consumed_kwh;
+  // PZEM energy register captured at the moment a token is applied (kWh).
+  // Ledger consumption is reconciled against energy - pzem_energy_at_session_start.
+  float pzem_energy_at_session_start;
+  int64_t remaining_uwh;
+  int64_t consumed_uwh;    // exact, for telemetry (a float kWh only keeps mWh up to ~16.7 kWh)
+  int32_t ledger_correction_uwh;  // last reconcile correction (0 = ledger within register window)
+  uint32_t ledger_corrections;
+  char token[21];          // active token (for API calls), "" if none
+  bool relay_on;
+  bool exhausted;          // set at cutoff, cleared by the next token
+  uint32_t commands_applied;
+  uint32_t last_command_id;  // newest BillingCommand::id handled (loop() waits for it, see apply())
+  uint32_t commands_rejected;  // handled but not credited (token or purchase already applied)
+  uint32_t last_rejected_id;   // newest BillingCommand::id among those, 0 = none
+  TokenReplayWindow replay;  // offline crypto tokens already applied (persisted with the ledger)
+  PurchaseHistory purchases; // server purchases already credited (persisted with the ledger)
+};
+
+struct BillingCommand {
+  uint32_t id;             // submitter's sequence number, published back as last_command_id
+  float kwh;
+  bool top_up;             // true = add to remaining and keep baseline
+  uint16_t crypto_seq;     // sequence of an offline crypto token, 0 = other token
+  uint64_t purchase;       // purchaseIdHash() of a server purchase, 0 = keypad token
+  char token[21];
+};
+
+class MeteringCore {
+ public:
+  // journal may be unattached (ready() false): the EEPROM checkpoints are used instead
+  MeteringCore(HalMeter& meter, HalRelay& relay, PersistJournal& journal, HalStore& store);
+
+  // Ledger and token from the journal; on the first boot with a journal, from the
+  // EEPROM, which is then migrated into the journal in one checkpoint. Switches the
+  // relay from the restored credit. Returns where the token came from ("journal",
+  // "EEPROM checkpoint", "EEPROM"), NULL when none was restored.
+  const char* restore(uint32_t nowMs);
+
+  // Collect the reply to last period's request and send the next one; true on a new reading
+  bool poll(uint32_t nowMs);
+  // Apply a token command (fresh session, or top-up while credit remains). A crypto token
+  // already in the replay window or a purchase already in billing().purchases is not
+  // credited again: billing().last_rejected_id is then its id. Either way the command
+  // counts as handled: billing().last_command_id is its id afterwards.
+  void apply(const BillingCommand& cmd, uint32_t nowMs);
+  // Integrate a fresh reading, cut off when exhausted, persist. True when sample holds a
+  // reading to publish (a fresh one, or the invalid one marking a silent sensor).
+  bool settle(uint32_t nowMs, bool fresh, PzemReading& sample);
+
+  const BillingState& billing() const { return billing_; }
+  const EnergyLedger& ledger() const { return ledger_; }
+  const PersistJournal& journal() const { return journal_; }
+
+ private:
+  void sync();
+  void persist(uint32_t nowMs, bool force);
+  PersistState persistState() const;
+  bool applyPersistState(const PersistState& s);
+  bool loadCheckpoint(PersistState& out);
+  bool loadCheckpointV2(PersistState& out);
+  void saveCheckpoint();
+  bool loadLegacy();
+
+  HalMeter& meter_;
+  HalRelay& relay_;
+  PersistJournal& journal_;
+  HalStore& store_;
+
+  EnergyLedger ledger_;
+  BillingState billing_;
+  PzemReading lastGood_;
+  uint32_t lastEepromSaveMs_;
+  uint32_t eepromSeq_;       // EEPROM A/B: the newest valid checkpoint is restored,
+  bool eepromInA_;           // saves overwrite the other slot (first save -> A)
+};
+
+#endif // METERING_CORE_H
@@ -0,0 +1,129 @@
+/**
+ * pcd8544.h - Nokia 5110 (PCD8544) driver that pushes only what changed
+ *
+ * Drop-in for the Adafruit_PCD8544 calls the firmware uses (begin, setContrast,
+ * clearDisplay, display, Adafruit GFX text), with two differences:
+ *
+ *  - display() compares the frame with the last one sent and, per 84-byte bank
+ *    (8 pixel rows), sends only the column span that differs. Nothing changed ->
+ *    nothing is sent. The library version always pushed all 504 bytes.
+ *  - textRow() is a retained-mode text cell: 6 rows x 14 characters, one per
+ *    bank. A row is redrawn only when its formatted text differs from what the
+ *    row already shows, so a screen that refreshes every 500 ms costs a few
+ *    string compares until a value actually changes.
+ *
+ * clearDisplay() (and fillScreen) forget the text rows, so screens drawn with
+ * plain print() calls and text-row screens can be mixed freely.
+ *
+ * Transports: Pcd8544 bit-bangs any GPIOs; Pcd8544Spi drives the VSPI
+ * peripheral with queued DMA transactions. With DMA, display() only queues the
+ * changed spans and returns; the spans are sent from the "last sent" copy, which
+ * nothing touches until the next display() has waited for them (the fence), so
+ * drawing the next frame overlaps the transfer. The diff itself is
+ * pcd8544Flush() (pcd8544_flush.h), which the native tests run against a fake
+ * panel; writeBytes() is the seam for a mock transport.
+ */
+
+#ifndef PCD8544_H
+#define PCD8544_H
+
+#include <Arduino.h>
+#include <Adafruit_GFX.h>
+#include "driver/spi_master.h"
+#include "hal.h"
+#include "pcd8544_flush.h"
+
+#ifndef BLACK
+#define BLACK 1
+#define WHITE 0
+#endif
+
+#define PCD8544_TEXT_COLS  14   // 6 px font cells
+#define PCD8544_TEXT_ROWS  PCD8544_BANKS
+
+class Pcd8544 : public Adafruit_GFX, public HalPanel {
+ public:
+  // Bit-banged serial interface on any GPIOs
+  Pcd8544(int8_t sclk, int8_t din, int8_t dc, int8_t cs, int8_t rst);
+
+  virtual ~Pcd8544() {}
+
+  bool begin(uint8_t contrast = 40, uint8_t bias = 0x04);
+  void setContrast(uint8_t contrast);
+  void clearDisplay();
+  // Push the bytes that differ from the panel contents (with DMA: queue them and return)
+  void display() override;
+  // Next display() resends the whole frame (panel state unknown)
+  void invalidate();
+
+  // Show text (truncated to 14 characters) on a text row; redraws only on change
+  void textRow(uint8_t row, const char* text) override;
+
+  void drawPixel(int16_t x, int16_t y, uint16_t color) override;
+  void fillScreen(uint16_t color) override;
+
+  // Diagnostics
+  uint32_t bytesPushed() const { return bytesPushed_; }       // data + addressing, since boot
+  uint16_t lastFlushBytes() const { return lastFlushBytes_; }
+  uint32_t lastFlushUs() const { return lastFlushUs_; }      // CPU time spent in display()
+  uint32_t flushes() const { return flushes_; }
+  uint32_t flushesSkipped() const { return flushesSkipped_; }  // display() with nothing to send
+
+ protected:
+  // Transport: dc low = commands, dc high = display data. Data passed by display()
+  // stays valid until the next waitIdle(); anything else may be gone on return.
+  virtual bool beginTransport();
+  virtual void writeBytes(bool isData, const uint8_t* bytes, size_t len);
+  // Fence: return once everything written so far is on the panel
+  virtual void waitIdle() {}
+
+  int8_t sclk_, din_, dc_, cs_, rst_;
+  uint8_t spanAlign_;      // display() starts spans on this byte boundary (DMA wants words)
+
+ private:
+  static void flushWrite(void* ctx, bool isData, const uint8_t* bytes, size_t len);
+
+  uint8_t contrast_;
+  uint8_t bias_;
+  uint8_t frame_[PCD8544_FRAME_BYTES];
+  uint8_t sent_[PCD8544_FRAME_BYTES] __attribute__((aligned(4)));  // what the panel shows
+  bool sentValid_;
+  char rows_[PCD8544_TEXT_ROWS][PCD8544_TEXT_COLS + 1];
+  bool rowValid_[PCD8544_TEXT_ROWS];
+
+  uint32_t bytesPushed_;
+  uint16_t lastFlushBytes_;
+  uint32_t lastFlushUs_;
+  uint32_t flushes_;
+  uint32_t flushesSkipped_;
+};
+
+#define PCD8544_SPI_HZ        4000000   // PCD8544 maximum serial clock
+#define PCD8544_SPI_QUEUE     16        // a full frame is 12 transactions (address + data per bank)
+
+// VSPI (SPI3) + DMA transport. On the VSPI IO_MUX pins (SCK 18, MOSI 23, CS 5) the
+// GPIO matrix is bypassed.
+class Pcd8544Spi : public Pcd8544 {
+ public:
+  Pcd8544Spi(spi_host_device_t host, int8_t sclk, int8_t mosi, int8_t dc, int8_t cs, int8_t rst);
+
+  uint32_t fenceWaits() const { return fenceWaits_; }   // display() found the last frame still in flight
+  uint32_t maxFenceUs() const { return maxFenceUs_; }
+
+ protected:
+  bool beginTransport() override;
+  void writeBytes(bool isData, const uint8_t* bytes, size_t len) override;
+  void waitIdle() override;
+
+ private:
+  static void IRAM_ATTR setDc(spi_transaction_t* t);
+
+  spi_host_device_t host_;
+  spi_device_handle_t dev_;
+  spi_transaction_t trans_[PCD8544_SPI_QUEUE];
+  uint8_t inFlight_;
+  uint32_t fenceWaits_;
+  uint32_t maxFenceUs_;
+};
+
+#endif // PCD8544_H
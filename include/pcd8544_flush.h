@@ -0,0 +1,34 @@
+/**
+ * pcd8544_flush.h - Change-only frame diff of the PCD8544 driver (see pcd8544.h)
+ *
+ * Pcd8544::display() without the hardware: compares the frame with what the
+ * panel shows and, per 84-byte bank, writes the address commands and the one
+ * column span that differs, widened to spanAlign bytes. The span is copied into
+ * sent first and written from there, so with a DMA transport the data stays
+ * valid until the next flush. Builds for the host, where a fake panel checks
+ * that what it ends up showing is the frame (test/test_pcd8544_flush).
+ */
+
+#ifndef PCD8544_FLUSH_H
+#define PCD8544_FLUSH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PCD8544_WIDTH      84
+#define PCD8544_HEIGHT     48
+#define PCD8544_BANKS      (PCD8544_HEIGHT / 8)
+#define PCD8544_FRAME_BYTES  (PCD8544_WIDTH * PCD8544_BANKS)
+
+#define PCD8544_SETYADDR   0x40
+#define PCD8544_SETXADDR   0x80
+
+// dc low = commands, dc high = display data
+typedef void (*Pcd8544Write)(void* ctx, bool isData, const uint8_t* bytes, size_t len);
+
+// Bring sent up to frame through write; sentValid false resends every bank whole.
+// spanAlign must divide PCD8544_WIDTH. Returns the bytes written (addressing + data).
+uint16_t pcd8544Flush(const uint8_t* frame, uint8_t* sent, bool sentValid, uint8_t spanAlign,
+                      Pcd8544Write write, void* ctx);
+
+#endif // PCD8544_FLUSH_H
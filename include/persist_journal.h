@@ -0,0 +1,135 @@
+/**
+ * persist_journal.h - Wear-leveled, append-only journal for the billing state
+ *
+ * Replaces the EEPROM slots for purchased/consumed/baseline/token. Every
+ * EEPROM.commit() rewrote the whole emulated-EEPROM sector; the journal instead
+ * appends small CRC-checked records to a ring of flash pages on its own data
+ * partition ("journal", see partitions.csv):
+ *
+ *   page   := PageHeader Record* (erased 0xFF tail)
+ *   Record := type len crc16 payload (padded to 4 bytes)
+ *     PJ_REC_CHECKPOINT  whole state as a BillingCheckpoint (96 bytes, see
+ *                        billing_checkpoint.h), always the first record of a page;
+ *                        56-byte ones from before version 3 are still restored
+ *     PJ_REC_CONSUMED    consumed-energy delta since the previous record (4 bytes)
+ *     PJ_REC_FULL        unversioned whole state of the first journal format (48
+ *                        bytes); still restored, no longer written
+ *
+ * While a session runs only consumption changes, so a commit is one 8-byte
+ * delta record and no erase. When a page is full the journal rotates: the
+ * oldest page is erased, stamped with the next sequence number and starts with a
+ * checkpoint, which makes every older page garbage. Restore takes the newest
+ * page whose first checkpoint is intact and replays its records up to the first
+ * erased or torn record; a page cut by power loss mid-rotation leaves the
+ * previous page as the newest valid one. Each page header carries its own
+ * erase count.
+ *
+ * Commits are coalesced: stage() just remembers the newest state and service()
+ * writes it at most once per commitIntervalMs unless forced (token applied,
+ * cutoff). Energy used between commits is not lost on power failure: the PZEM
+ * keeps its own energy register and the ledger reconciles against it at boot.
+ *
+ * Wear at the default 60 s interval: ~500 deltas fill a page (~8.3 h), so each of
+ * the 8 pages is erased about every 3 days - ~1,300 cycles in 10 years against the
+ * 100k the flash is rated for (a 5 s interval would still stay around 16k).
+ * test/test_persist_journal reproduces these numbers on a simulated month.
+ *
+ * Not thread-safe: owned by the metering task once setup() has finished.
+ */
+
+#ifndef PERSIST_JOURNAL_H
+#define PERSIST_JOURNAL_H
+
+#include <stdint.h>
+#include "hal.h"
+#include "billing_checkpoint.h"
+
+#define PJ_PAGE_SIZE   4096           // flash sector = erase unit
+#define PJ_PAGE_MAGIC  0x314E524AUL   // "JRN1"
+#define PJ_REC_FULL       0x01
+#define PJ_REC_CONSUMED   0x02
+#define PJ_REC_CHECKPOINT 0x03
+
+class PersistJournal {
+ public:
+  PersistJournal();
+
+  // Attach to the journal partition and restore the newest state. False when it
+  // is too small (under two pages): caller keeps using EEPROM.
+  bool begin(HalFlash& flash, uint32_t commitIntervalMs);
+  bool ready() const { return flash_ != NULL; }
+  // begin() found a valid state (false on a fresh partition)
+  bool hasState() const { return haveWritten_; }
+  const PersistState& state() const { return written_; }
+
+  // Remember s as the newest state; written by the next due service().
+  void stage(const PersistState& s);
+  // Write the staged state if it changed and commitIntervalMs has passed (or force).
+  // Returns true when a record was written.
+  bool service(uint32_t nowMs, bool force = false);
+
+  // Diagnostics
+  uint32_t commits() const { return commits_; }
+  uint32_t eraseCycles() const { return eraseCycles_; }    // pages erased since boot
+  uint32_t maxPageErases() const { return maxPageErases_; } // lifetime, most-worn page
+  uint32_t lastCommitUs() const { return lastCommitUs_; }
+  uint32_t maxCommitUs() const { return maxCommitUs_; }
+  uint16_t pages() const { return pageCount_; }
+  uint32_t writeOffset() const { return writeOff_; }
+
+ private:
+  struct PageHeader {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t erases;   // lifetime erase count of this page
+    uint16_t reserved;
+    uint16_t crc;
+  };
+  struct RecHeader {
+    uint8_t type;
+    uint8_t len;
+    uint16_t crc;      // over type, len and payload
+  };
+  struct FullRecord {
+    int64_t purchasedUwh;
+    int64_t consumedUwh;
+    uint32_t baselineWh;
+    char token[20];    // digits, no terminator
+    uint8_t haveBaseline;
+    uint8_t pad[7];
+  };
+  static_assert(sizeof(FullRecord) == 48, "FullRecord layout changed");
+
+  bool readHeader(uint16_t page, PageHeader& h);
+  bool replayPage(uint16_t page, PersistState& out, uint32_t& seq, uint32_t& endOff, bool& cleanEnd);
+  bool appendRecord(uint8_t type, const void* payload, uint8_t len);
+  bool rotate();
+  bool writeCheckpoint();
+  static uint16_t recordCrc(const RecHeader& h, const uint8_t* payload);
+  static uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF);
+
+  HalFlash* flash_;
+  uint16_t pageCount_;
+  uint32_t commitIntervalMs_;
+
+  int32_t headPage_;       // page with the highest sequence number, -1 = blank partition
+  uint32_t headSeq_;
+  int32_t curPage_;        // page appended to (newest with an intact checkpoint), -1 = none
+  uint32_t writeOff_;      // next record offset in curPage_
+  bool needRotate_;        // current page has a torn tail: never append to it again
+  uint32_t ckptSeq_;       // sequence number of the last checkpoint written/restored
+
+  PersistState written_;   // what the journal holds
+  bool haveWritten_;
+  PersistState staged_;
+  bool dirty_;
+  uint32_t lastCommitMs_;
+
+  uint32_t commits_;
+  uint32_t eraseCycles_;
+  uint32_t maxPageErases_;
+  uint32_t lastCommitUs_;
+  uint32_t maxCommitUs_;
+};
+
+#endif // PERSIST_JOURNAL_H
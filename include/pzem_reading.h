@@ -0,0 +1,34 @@
+/**
+ * pzem_reading.h - One PZEM-004T v3.0 measurement and the driver result codes
+ *
+ * Shared by the UART driver (pzem_snapshot.h), the metering core and the
+ * simulated meter of the native build, so it has no Arduino dependency.
+ */
+
+#ifndef PZEM_READING_H
+#define PZEM_READING_H
+
+#include <stdint.h>
+
+// collect() results
+#define PZEM_IDLE       0   // no request outstanding
+#define PZEM_PENDING    1   // reply not complete yet
+#define PZEM_OK         2   // new reading available in last()
+#define PZEM_TIMEOUT   -1
+#define PZEM_CRC_ERROR -2
+#define PZEM_BAD_FRAME -3   // wrong address/function/length or Modbus exception
+
+struct PzemReading {
+  uint32_t t_ms;        // millis() when the request frame was sent
+  float voltage;        // V
+  float current;        // A
+  float power;          // W
+  float energy_kwh;     // cumulative energy register, kWh
+  uint32_t energy_wh;   // same register, raw integer Wh
+  float frequency;      // Hz
+  float pf;
+  uint16_t alarm;
+  uint32_t power_dw;    // raw power register, 0.1 W units (exact, for the energy ledger)
+};
+
+#endif // PZEM_READING_H
@@ -0,0 +1,64 @@
+/**
+ * pzem_snapshot.h - Single-frame, non-blocking PZEM-004T v3.0 Modbus driver
+ *
+ * One "read input registers 0x0000..0x0009" request returns voltage, current,
+ * power, energy, frequency, PF and alarm in a single 25-byte reply, instead of
+ * the six getter calls of the PZEM004Tv30 library. The driver never waits on the
+ * UART: request() queues the 8-byte frame and returns, collect() on a later tick
+ * picks up whatever has arrived in the RX buffer. The UART is a HalSerial
+ * (UartSerial in hal_esp32.h on the device), so the driver builds natively too.
+ *
+ * Owned by the metering task; not thread-safe.
+ */
+
+#ifndef PZEM_SNAPSHOT_H
+#define PZEM_SNAPSHOT_H
+
+#include <math.h>
+#include "hal.h"
+
+#define PZEM_DEFAULT_ADDR   0xF8   // general address, valid with a single slave on the bus
+#define PZEM_REPLY_TIMEOUT_MS 150  // 25 bytes @ 9600 baud ~ 26 ms + device latency
+
+struct PzemStats {
+  uint32_t requests;        // frames sent
+  uint32_t transactions;    // valid replies
+  uint32_t crc_errors;
+  uint32_t timeouts;
+  uint32_t bad_frames;
+  uint16_t tx_per_sec;      // valid replies in the last full 1 s window
+  uint16_t last_rtt_ms;     // request -> complete reply
+};
+
+class PzemSnapshot : public HalMeter {
+ public:
+  explicit PzemSnapshot(HalSerial& port, uint8_t addr = PZEM_DEFAULT_ADDR);
+
+  // Send the read-all request. Returns false while a previous request is still pending.
+  bool request(uint32_t nowMs) override;
+
+  // Pick up the reply to the last request; see PZEM_* result codes.
+  int collect(uint32_t nowMs) override;
+
+  const PzemReading& last() const override { return reading_; }
+  const PzemStats& stats() const { return stats_; }
+
+  static uint16_t crc16(const uint8_t* data, size_t len);
+
+ private:
+  bool decode();
+  void countWindow(uint32_t nowMs);
+
+  HalSerial& port_;
+  uint8_t addr_;
+  bool pending_;
+  uint32_t sentMs_;
+  uint8_t rx_[25];
+  uint8_t rxLen_;
+  PzemReading reading_;
+  PzemStats stats_;
+  uint32_t windowStartMs_;
+  uint32_t windowCount_;
+};
+
+#endif // PZEM_SNAPSHOT_H
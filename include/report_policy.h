@@ -0,0 +1,79 @@
+/**
+ * report_policy.h - Decides when a telemetry reading is worth reporting
+ *
+ * Replaces the fixed 30 s send interval. A report is due when, compared with the
+ * last reported values:
+ *   - power moved by more than max(absolute, relative) deadband,
+ *   - voltage moved by more than its deadband,
+ *   - remaining balance moved by more than its deadband,
+ *   - the sensor went valid <-> invalid,
+ *   - or the heartbeat expired.
+ * The heartbeat starts at heartbeatMinMs and doubles after every heartbeat-only
+ * report (flat readings) up to heartbeatMaxMs; any event resets it. Reports are
+ * never closer than minIntervalMs: an event seen during that time is latched and
+ * reported as soon as the spacing allows.
+ *
+ * Pure integer logic, no Arduino calls: used from loop() only.
+ */
+
+#ifndef REPORT_POLICY_H
+#define REPORT_POLICY_H
+
+#include <stdint.h>
+
+// evaluate() reason bits
+#define REPORT_FIRST     0x01   // nothing reported yet
+#define REPORT_POWER     0x02
+#define REPORT_VOLTAGE   0x04
+#define REPORT_BALANCE   0x08
+#define REPORT_SENSOR    0x10   // sensor went valid <-> invalid
+#define REPORT_FORCED    0x20   // force() (token applied, exhausted, ...)
+#define REPORT_HEARTBEAT 0x40
+#define REPORT_EVENTS    (REPORT_FIRST | REPORT_POWER | REPORT_VOLTAGE | REPORT_BALANCE | REPORT_SENSOR | REPORT_FORCED)
+
+struct ReportPolicyConfig {
+  uint32_t powerDeadbandDw;      // absolute power deadband, 0.1 W
+  uint8_t powerDeadbandPct;      // relative power deadband, % of last reported power
+  uint16_t voltageDeadbandDv;    // 0.1 V
+  uint32_t balanceDeadbandMwh;   // remaining balance, mWh
+  uint32_t minIntervalMs;
+  uint32_t heartbeatMinMs;
+  uint32_t heartbeatMaxMs;
+};
+
+struct ReportSample {
+  bool sensorValid;
+  uint32_t powerDw;
+  uint16_t voltageDv;
+  uint32_t remainingMwh;
+};
+
+class ReportPolicy {
+ public:
+  explicit ReportPolicy(const ReportPolicyConfig& cfg);
+
+  // Reason bits if a report is due now, 0 otherwise. Does not change the baseline.
+  uint8_t evaluate(uint32_t nowMs, const ReportSample& s);
+  // The sample was reported: it becomes the new baseline.
+  void reported(uint32_t nowMs, const ReportSample& s, uint8_t reasons);
+  // Report on the next evaluate() (still subject to the minimum spacing).
+  void force() { latched_ |= REPORT_FORCED; }
+
+  uint32_t heartbeatMs() const { return heartbeatMs_; }
+  uint32_t reports() const { return reports_; }
+  uint32_t eventReports() const { return eventReports_; }
+
+ private:
+  uint8_t events(const ReportSample& s) const;
+
+  ReportPolicyConfig cfg_;
+  bool haveLast_;
+  ReportSample last_;
+  uint32_t lastMs_;
+  uint32_t heartbeatMs_;
+  uint8_t latched_;
+  uint32_t reports_;
+  uint32_t eventReports_;
+};
+
+#endif // REPORT_POLICY_H
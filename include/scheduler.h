@@ -0,0 +1,133 @@
+/**
+ * scheduler.h - Cooperative scheduler for loop(): timer wheel, priorities, budgets
+ *
+ * loop() work is registered once as tasks instead of being gated by hand-kept
+ * "last run" timestamps. A task is periodic (every periodMs, phase kept: a late
+ * run does not shift the next one) or one-shot (runs once after start(id, ms)).
+ *
+ * Pending tasks sit in a hashed timer wheel: SCHED_WHEEL_SLOTS slots of
+ * SCHED_TICK_MS each, slot = due tick mod slots. run() only visits the slots
+ * for the ticks that elapsed since the previous call; a task due more than one
+ * revolution ahead simply stays in its slot until its due time is reached.
+ * Everything due in one run() executes highest priority first, then oldest due.
+ *
+ * Budgets: each task has a CPU budget in microseconds. A run that takes longer
+ * counts an overrun (the task is not interrupted - this is cooperative). Long
+ * jobs check yieldDue() between steps and return SCHED_YIELD when it is true;
+ * they run again on the next run() pass, after other due work, without waiting
+ * for their period.
+ *
+ * Every run is also recorded in a per-task latency histogram (latency_histogram.h),
+ * and the longest single run since boot is kept with its task and time, so a
+ * field regression shows up as numbers instead of a guess.
+ *
+ * The clock is injected (halMillis/halMicros, see hal.h), so the same code runs
+ * against a fake clock on a host. Single-threaded: only loop() may call in.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "latency_histogram.h"
+
+#define SCHED_MAX_TASKS    24     // loop() registers 16 of them (registerLoopTasks() in main.cpp)
+#define SCHED_TICK_MS      10
+#define SCHED_WHEEL_SLOTS  64     // power of two; one revolution = 640 ms
+#define SCHED_NONE         0xFF
+
+enum SchedResult {
+  SCHED_DONE,    // finished: next run at the next period (periodic) or never (one-shot)
+  SCHED_YIELD,   // more to do: run again on the next pass
+};
+
+typedef SchedResult (*SchedFn)(void* arg);
+typedef uint32_t (*SchedClock)();
+
+struct SchedTaskStats {
+  const char* name;
+  uint32_t runs;
+  uint32_t yields;
+  uint32_t overruns;     // runs longer than the budget
+  uint32_t maxUs;
+  uint32_t budgetUs;
+};
+
+class Scheduler {
+ public:
+  Scheduler(SchedClock clockMs, SchedClock clockUs);
+
+  // Register a periodic task, first run periodMs from now (or after start()).
+  // Returns the task id, SCHED_NONE when the table is full.
+  uint8_t every(const char* name, uint32_t periodMs, uint8_t priority, uint32_t budgetUs,
+                SchedFn fn, void* arg = NULL);
+  // Register a one-shot task; it does nothing until start()
+  uint8_t once(const char* name, uint8_t priority, uint32_t budgetUs, SchedFn fn, void* arg = NULL);
+
+  // (Re)arm: run after delayMs. For a periodic task this restarts its phase.
+  void start(uint8_t id, uint32_t delayMs);
+  // Disarm until the next start()
+  void stop(uint8_t id);
+  bool armed(uint8_t id) const;
+
+  // Run everything that is due. Returns ms until the next task is due (0 = something
+  // yielded or is already due, SCHED_TICK_MS * SCHED_WHEEL_SLOTS when nothing is armed).
+  uint32_t run();
+
+  // For the running task: its budget is used up, return SCHED_YIELD at the next step
+  bool yieldDue() const;
+
+  uint8_t taskCount() const { return count_; }
+  SchedTaskStats stats(uint8_t id) const;
+  const LatencyHistogram& latency(uint8_t id) const { return tasks_[id < count_ ? id : 0].latency; }
+  void resetLatency();
+
+  // Longest single task run since boot (or resetLatency()): SCHED_NONE when nothing ran
+  uint8_t worstTask() const { return worstId_; }
+  uint32_t worstUs() const { return worstUs_; }
+  uint32_t worstAtMs() const { return worstAtMs_; }
+
+ private:
+  enum TaskState : uint8_t { TASK_IDLE, TASK_WAITING, TASK_READY };
+
+  struct Task {
+    const char* name;
+    SchedFn fn;
+    void* arg;
+    uint32_t periodMs;     // 0 = one-shot
+    uint32_t due;          // ms
+    uint32_t budgetUs;
+    uint32_t runs;
+    uint32_t yields;
+    uint32_t overruns;
+    uint32_t maxUs;
+    uint8_t priority;
+    uint8_t next;          // wheel slot chain
+    TaskState state;
+    bool restarted;        // start()/stop() called from its own run: rearm() keeps that
+    LatencyHistogram latency;
+  };
+
+  uint8_t add(const char* name, uint32_t periodMs, uint8_t priority, uint32_t budgetUs, SchedFn fn, void* arg);
+  void link(uint8_t id);
+  void unlink(uint8_t id);
+  void collect(uint8_t slot, uint32_t now);
+  void rearm(uint8_t id, SchedResult result);
+
+  SchedClock clockMs_;
+  SchedClock clockUs_;
+  Task tasks_[SCHED_MAX_TASKS];
+  uint8_t count_;
+  uint8_t wheel_[SCHED_WHEEL_SLOTS];
+  uint32_t lastTick_;
+  uint8_t ready_[SCHED_MAX_TASKS];
+  uint8_t readyCount_;
+  uint8_t current_;
+  uint32_t currentStartUs_;
+  uint8_t worstId_;
+  uint32_t worstUs_;
+  uint32_t worstAtMs_;
+};
+
+#endif // SCHEDULER_H
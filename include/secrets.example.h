@@ -0,0 +1,17 @@
+/**
+ * secrets.example.h - Template for include/secrets.h (git-ignored, included by config.h)
+ *
+ * Copy to include/secrets.h on the provisioning machine and fill in this meter's values.
+ * Never commit the filled-in file.
+ */
+
+#ifndef SECRETS_H
+#define SECRETS_H
+
+// Token push channel credential: node server/scripts/meterKey.js <METER_NUMBER>
+#define METER_SOCKET_KEY ""
+
+// Offline crypto token key: same script (METER_TOKEN_SECRET)
+#define METER_TOKEN_KEY ""
+
+#endif // SECRETS_H
@@ -0,0 +1,57 @@
+/**
+ * seqlock.h - Single-writer sequence lock for small POD snapshots
+ *
+ * The writer never blocks; readers retry while a write is in progress.
+ * Used for the billing state (remaining kWh, token, relay) which is owned
+ * by the metering task and read by the network/UI loop on the other core.
+ * T must be trivially copyable.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+template <typename T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable<T>::value, "SeqLock payload must be trivially copyable");
+
+ public:
+  SeqLock() : seq_(0) { memset(&data_, 0, sizeof(data_)); }
+
+  // Writer side (one task only).
+  void write(const T& value) {
+    uint32_t s = seq_.load(std::memory_order_relaxed);
+    seq_.store(s + 1, std::memory_order_relaxed);        // odd = write in progress
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&data_, &value, sizeof(T));
+    std::atomic_thread_fence(std::memory_order_release);
+    seq_.store(s + 2, std::memory_order_relaxed);        // even = stable
+  }
+
+  // Reader side (any task). Spins only while the writer is mid-copy (a few µs).
+  T read() const {
+    T out;
+    uint32_t s1, s2;
+    do {
+      s1 = seq_.load(std::memory_order_acquire);
+      if (s1 & 1) continue;
+      memcpy(&out, &data_, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      s2 = seq_.load(std::memory_order_relaxed);
+      if (s1 == s2) break;
+    } while (true);
+    return out;
+  }
+
+  uint32_t version() const { return seq_.load(std::memory_order_acquire) >> 1; }
+
+ private:
+  std::atomic<uint32_t> seq_;
+  T data_;
+};
+
+#endif // SEQLOCK_H
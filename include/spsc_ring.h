@@ -0,0 +1,69 @@
+/**
+ * spsc_ring.h - Lock-free single-producer / single-consumer ring buffer
+ *
+ * Used to hand PZEM samples from the metering task (core 0) to the
+ * network/UI loop (core 1) without a mutex. Exactly one task may call
+ * push() and exactly one (other) task may call pop()/peekLatest().
+ * N must be a power of two; one slot is never wasted because head/tail
+ * are free-running counters.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+template <typename T, size_t N>
+class SpscRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+ public:
+  SpscRing() : head_(0), tail_(0), dropped_(0) {}
+
+  // Producer side. Returns false (and counts a drop) when the consumer is behind.
+  bool push(const T& item) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    if (head - tail >= N) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    buf_[head & (N - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false when empty.
+  bool pop(T& out) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    uint32_t head = head_.load(std::memory_order_acquire);
+    if (head == tail) return false;
+    out = buf_[tail & (N - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side: drain everything queued and keep only the newest item.
+  // Returns the number of items consumed (0 = nothing new, out untouched).
+  size_t drainLatest(T& out) {
+    size_t n = 0;
+    while (pop(out)) n++;
+    return n;
+  }
+
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+  static constexpr size_t capacity() { return N; }
+
+ private:
+  T buf_[N];
+  std::atomic<uint32_t> head_;     // written by producer only
+  std::atomic<uint32_t> tail_;     // written by consumer only
+  std::atomic<uint32_t> dropped_;  // producer-side overflow counter
+};
+
+#endif // SPSC_RING_H
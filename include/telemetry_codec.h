@@ -0,0 +1,88 @@
+/**
+ * telemetry_codec.h - Compact binary telemetry frame (POST /energy-data/bin)
+ *
+ * Replaces the per-reading JSON document: integer-scaled fields in a fixed
+ * layout, and the static identity (client name/TIN/phone) sent only until the
+ * server has it instead of with every reading. All integers little-endian.
+ *
+ *   Frame   := 'S' 'M' version meter_bcd[7] Block*
+ *   Block   := type payload
+ *     0x01 IDENTITY  len name[len] len tin[len] len phone[len]   (stored per meter by the server)
+ *     0x02 SESSION   token_bcd[10]                              (token of the readings that follow)
+ *     0x03 READING   40 bytes, see TelemetryEncoder::addReading()
+ *     0x04 LATENCY   loop() latency since boot (v2): passes u32, p50/p99/max us u32,
+ *                    worst task run us u32, len worst_task_name[len]
+ *     0x05 WINDOW    88 bytes (v3): a READING whose voltage, current, power and
+ *                    power factor are min/max/mean/p95/stddev over the samples
+ *                    since the previous reading instead of one instant
+ *
+ * addReading() writes a WINDOW for records that carry window statistics
+ * (TelemetryWindow::samples > 0) and a READING for the others.
+ *
+ * begin() can also write an older version for a server that answers 415 to the
+ * current one: blocks that version does not know are left out (no LATENCY
+ * below 2) or written the old way (a READING from the capture-time values
+ * instead of a WINDOW below 3).
+ *
+ * BCD digits are packed two per byte, high nibble first, padded with 0xF.
+ * Blocks carry no length, so any layout change bumps TCODEC_VERSION and the
+ * server rejects versions it does not know (415 Unsupported Media Type).
+ */
+
+#ifndef TELEMETRY_CODEC_H
+#define TELEMETRY_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "telemetry_record.h"
+
+#define TCODEC_VERSION        3   // 2: LATENCY block, 3: WINDOW block
+#define TCODEC_VERSION_MIN    1   // oldest version begin() can still write
+#define TCODEC_HEADER_SIZE    10
+#define TCODEC_READING_SIZE   40
+#define TCODEC_WINDOW_SIZE    88
+#define TCODEC_SESSION_SIZE   10
+#define TCODEC_MAX_STR        32   // identity strings are truncated to this
+
+#define TCODEC_BLOCK_IDENTITY 0x01
+#define TCODEC_BLOCK_SESSION  0x02
+#define TCODEC_BLOCK_READING  0x03
+#define TCODEC_BLOCK_LATENCY  0x04
+#define TCODEC_BLOCK_WINDOW   0x05
+
+class TelemetryEncoder {
+ public:
+  TelemetryEncoder(uint8_t* buf, size_t cap);
+
+  // Start a frame for this meter (11 or 13 digits), version TCODEC_VERSION_MIN..TCODEC_VERSION
+  void begin(const char* meterNumber, uint8_t version = TCODEC_VERSION);
+  void addIdentity(const char* clientName, const char* clientTIN, const char* clientPhone);
+  void addSession(const uint8_t tokenBcd[10]);
+  // localEpoch: capture time in local epoch seconds, 0 if unknown (server then uses uptime_ms)
+  void addReading(const TelemetryRecord& rec, uint32_t localEpoch);
+  // Latency summary (one per frame); worstTask may be "" when nothing ran yet
+  void addLatency(uint32_t passes, uint32_t p50Us, uint32_t p99Us, uint32_t maxUs,
+                  uint32_t worstUs, const char* worstTask);
+
+  uint8_t version() const { return version_; }
+  size_t size() const { return len_; }
+  bool overflowed() const { return overflow_; }
+
+  static void packDigits(const char* digits, uint8_t* out, size_t outLen);
+
+ private:
+  void put8(uint8_t v);
+  void put16(uint16_t v);
+  void put32(uint32_t v);
+  void addWindow(const TelemetryRecord& rec, uint32_t localEpoch);
+  void putBytes(const uint8_t* p, size_t n);
+  void putString(const char* s);
+
+  uint8_t* buf_;
+  size_t cap_;
+  size_t len_;
+  uint8_t version_;
+  bool overflow_;
+};
+
+#endif // TELEMETRY_CODEC_H
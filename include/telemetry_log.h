@@ -0,0 +1,107 @@
+/**
+ * telemetry_log.h - Flash-backed store-and-forward queue for telemetry records
+ *
+ * Every reading is appended to a persistent ring log on LittleFS before it is
+ * uploaded, so a WiFi or backend outage leaves the readings waiting in flash
+ * instead of dropping them. Layout under <dir>/:
+ *
+ *   <seg>.rec   append-only segments of TLOG_SEG_RECORDS fixed-size records
+ *               (hex-numbered, oldest = lowest id)
+ *   cursor.rec  {segment, index} of the oldest record not yet acknowledged
+ *   boot        boot sequence counter (lets unsynced timestamps be fixed later)
+ *
+ * "<seg>.seg" and "cursor" are the same log from before records carried window
+ * statistics (52-byte records); begin() moves what is still pending into the
+ * current log and removes them.
+ *
+ * Segments that are fully uploaded are deleted; when the log exceeds its byte
+ * budget the oldest segment is evicted even if not uploaded (counted in dropped()).
+ * Each record carries a CRC so a record torn by power loss is skipped, and a
+ * torn tail segment is never appended to again.
+ *
+ * Files stay open between calls: every fs.open() allocates (the VFS file object,
+ * its path, the stdio buffer), and a reading is logged and uploaded every few
+ * seconds. The tail segment is one "a+" handle for appends and for uploads that
+ * have caught up, an older segment being drained has its own read handle, and
+ * the cursor is rewritten in place. Appends are flushed (fsync) before append()
+ * returns, so a power cut loses no more than with a close per record. Steady
+ * state opens one file per TLOG_SEG_RECORDS records, when a segment rolls over.
+ *
+ * Not thread-safe: used from loop() only.
+ */
+
+#ifndef TELEMETRY_LOG_H
+#define TELEMETRY_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <FS.h>  // LittleFS on the device, a host directory natively (src/native/FS.h)
+#include "telemetry_record.h"
+
+#define TLOG_SEG_RECORDS      64
+#define TLOG_CURSOR_SAVE_EVERY 8   // persist the cursor every N acks (and whenever caught up)
+
+class TelemetryLog {
+ public:
+  TelemetryLog();
+
+  // Mount-time scan of dir; budgetBytes bounds the total size of all segments.
+  bool begin(fs::FS& fs, const char* dir, uint32_t budgetBytes);
+
+  // Append one record (crc and boot_seq are filled in). Evicts oldest segments over budget.
+  bool append(TelemetryRecord& rec);
+
+  // Oldest record not yet acknowledged. Returns false when the log is caught up.
+  bool peek(TelemetryRecord& out) { return peek(&out, 1) == 1; }
+  // Up to max oldest unacknowledged records, in order; returns the count (0 = caught up).
+  size_t peek(TelemetryRecord* out, size_t max);
+  // Acknowledge the records returned by the last peek() (upload succeeded).
+  void advance();
+
+  uint32_t pending() const { return pending_; }
+  uint32_t dropped() const { return dropped_; }
+  uint32_t corrupt() const { return corrupt_; }
+  uint32_t bytesUsed() const { return totalBytes_; }
+  uint16_t bootSeq() const { return bootSeq_; }
+  bool ready() const { return fs_ != NULL; }
+
+  static void packToken(const char* digits, uint8_t out[10]);
+  static void unpackToken(const uint8_t in[10], char out[21]);
+
+ private:
+  bool store(TelemetryRecord& rec);
+  void importLegacy(uint32_t firstSeg, uint32_t lastSeg);
+  void segPath(uint32_t seg, char* buf, size_t len) const;
+  File* segFile(uint32_t seg);
+  void nextTailSegment();
+  uint32_t segBytes(uint32_t seg);
+  uint32_t segRecords(uint32_t seg);
+  void removeSegment(uint32_t seg);
+  void saveCursor();
+  void skipSlots(uint32_t n);
+  static uint16_t crc16(const uint8_t* data, size_t len);
+
+  fs::FS* fs_;
+  char dir_[24];
+  uint32_t budget_;
+  uint32_t headSeg_;    // oldest segment on flash
+  uint32_t tailSeg_;    // segment being appended to
+  uint32_t tailCount_;  // records in tail segment
+  uint32_t cursorSeg_;
+  uint32_t cursorIdx_;
+  uint32_t totalBytes_;
+  uint32_t pending_;
+  uint32_t dropped_;
+  uint32_t corrupt_;
+  uint32_t acksSinceSave_;
+  uint32_t peekSlots_;  // slots covered by the last peek(), acknowledged by advance()
+  uint16_t bootSeq_;
+  File tail_;           // tailSeg_, opened "a+" on first use
+  File read_;           // readSeg_ (older than the tail), being uploaded
+  uint32_t readSeg_;    // 0 = none
+  File cursorFile_;
+  uint32_t sizeSeg_;    // last non-tail segment whose size was looked up (0 = none);
+  uint32_t sizeBytes_;  // only the tail ever grows
+};
+
+#endif // TELEMETRY_LOG_H
@@ -0,0 +1,57 @@
+/**
+ * telemetry_record.h - One logged telemetry reading, as stored and as uploaded
+ *
+ * Shared by the flash log (telemetry_log.h), the binary frame encoder
+ * (telemetry_codec.h) and the host tools, so it depends on nothing but stdint.
+ */
+
+#ifndef TELEMETRY_RECORD_H
+#define TELEMETRY_RECORD_H
+
+#include <stdint.h>
+
+#define TLOG_FLAG_SENSOR_VALID 0x01
+#define TLOG_FLAG_TIME_SYNCED  0x02  // epoch is valid; otherwise only boot_seq + uptime_ms
+
+// Index of each statistic in the TelemetryWindow arrays
+#define TWIN_MIN   0
+#define TWIN_MAX   1
+#define TWIN_MEAN  2
+#define TWIN_P95   3
+#define TWIN_STD   4   // population standard deviation
+#define TWIN_STATS 5
+
+// Metering samples since the previous record (interval_stats.h), in the units of the reading
+struct TelemetryWindow {
+  uint32_t current_ma[TWIN_STATS];
+  uint32_t power_dw[TWIN_STATS];
+  uint16_t voltage_dv[TWIN_STATS];
+  uint16_t samples;        // samples with a valid reading; 0 = no statistics
+  uint16_t span_s;         // window length
+  uint8_t pf_pct[TWIN_STATS];
+  uint8_t reserved;
+};
+static_assert(sizeof(TelemetryWindow) == 60, "TelemetryWindow layout changed");
+
+// Compact, fixed-layout record (112 bytes, little-endian, no padding)
+struct TelemetryRecord {
+  uint32_t epoch;          // local epoch seconds at capture (valid if TLOG_FLAG_TIME_SYNCED)
+  uint32_t uptime_ms;      // millis() at capture
+  uint16_t boot_seq;
+  uint8_t flags;
+  uint8_t pf_pct;          // power factor * 100
+  uint32_t remaining_mwh;
+  uint32_t consumed_mwh;
+  uint32_t energy_wh;      // PZEM energy register
+  uint32_t current_ma;
+  uint32_t power_dw;       // 0.1 W
+  uint32_t session_s;
+  uint16_t voltage_dv;     // 0.1 V
+  uint16_t frequency_dhz;  // 0.1 Hz
+  TelemetryWindow window;
+  uint8_t token_bcd[10];   // 20-digit token, packed BCD
+  uint16_t crc;            // CRC-16/MODBUS over the preceding bytes
+};
+static_assert(sizeof(TelemetryRecord) == 112, "TelemetryRecord layout changed");
+
+#endif // TELEMETRY_RECORD_H
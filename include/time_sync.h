@@ -0,0 +1,181 @@
+/**
+ * time_sync.h - Non-blocking multi-server NTP client and disciplined local clock
+ *
+ * Replaces NTPClient, which sent one request to one server and waited up to a
+ * second for the answer inside loop(). Here a sync round sends a request to every
+ * configured server at once through HalUdp (hal.h) and poll() picks the replies
+ * up as they arrive, so no call ever waits on the network:
+ *
+ *   - Each reply is checked (mode, stratum, leap alarm, echoed origin timestamp)
+ *     and turned into an offset/RTT sample against the raw local microsecond
+ *     clock. Kiss-o'-death replies silence that server for NTP_KOD_BACKOFF_MS.
+ *   - Every server keeps its last NTP_FILTER_SAMPLES samples; its estimate is the
+ *     one with the lowest RTT (queueing delay only ever adds error).
+ *   - With three or more answers, servers whose [offset - distance, offset +
+ *     distance] interval misses the majority's are dropped as falsetickers (no
+ *     majority: the round is not used); of the rest the one with the smallest
+ *     distance (RTT / 2 + root distance) sets the clock. Of two that disagree,
+ *     the one agreeing with the already synced clock is kept.
+ *   - The first sync, or an error above NTP_STEP_US, steps the clock; smaller
+ *     errors are slewed at NTP_SLEW_PPM, so time never jumps during normal work.
+ *   - The crystal's drift is the slope of the measured offset over a baseline of
+ *     NTP_FREQ_MIN_BASELINE_MS..NTP_FREQ_MAX_BASELINE_MS and is corrected between
+ *     syncs. The poll interval doubles from NTP_POLL_MIN_MS to NTP_POLL_MAX_MS
+ *     while the clock stays within NTP_STABLE_US, and halves when it does not.
+ *   - Without any reply, rounds are retried from NTP_RETRY_MIN_MS, doubling up to
+ *     NTP_RETRY_MAX_MS. The clock is never marked synced without a server; once
+ *     synced it keeps running on the drift estimate while the servers are away.
+ *
+ * isoLocal() keeps the "YYYY-MM-DDTHH:MM:SS" string of the current second: a new
+ * second only rewrites the time of day, a new date is converted once. formatIso()
+ * converts any epoch with days-to-civil arithmetic instead of gmtime() + snprintf().
+ *
+ * The clock is injected (halMicros on the device), so the same code runs against
+ * fake responders on a host (test/test_time_sync). Single-threaded: only loop()
+ * may call in.
+ */
+
+#ifndef TIME_SYNC_H
+#define TIME_SYNC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hal.h"
+#include "scheduler.h"  // SchedClock
+
+#define NTP_PORT                  123
+#define NTP_PACKET_BYTES          48
+#define NTP_MAX_SERVERS           4
+#define NTP_FILTER_SAMPLES        8
+#define NTP_ROUND_TIMEOUT_MS      1500      // a reply later than this is lost
+#define NTP_RX_POLL_MS            5         // poll() cadence while replies are outstanding
+#define NTP_RETRY_MIN_MS          2000      // no reply at all: next round
+#define NTP_RETRY_MAX_MS          64000
+#define NTP_POLL_MIN_MS           64000     // synced: next round
+#define NTP_POLL_MAX_MS           1024000
+#define NTP_STEP_US               128000    // larger errors step the clock
+#define NTP_STABLE_US             20000     // errors below this lengthen the poll interval
+#define NTP_SLEW_PPM              500       // correction rate for smaller errors
+#define NTP_MAX_FREQ_PPB          500000    // drift estimates beyond 500 ppm are rejected
+#define NTP_FREQ_MIN_BASELINE_MS  900000    // 15 min before the first drift estimate
+#define NTP_FREQ_MAX_BASELINE_MS  14400000  // restart the baseline after 4 h (temperature)
+#define NTP_KOD_BACKOFF_MS        3600000
+#define NTP_ISO_LEN               19        // "YYYY-MM-DDTHH:MM:SS"
+
+struct NtpServerStats {
+  const char* host;
+  uint32_t sent;
+  uint32_t replies;
+  uint32_t rejected;     // malformed, unsynchronized, wrong origin, kiss-o'-death
+  uint32_t lost;         // no reply within NTP_ROUND_TIMEOUT_MS
+  int32_t offsetUs;      // filtered estimate of the last round: server - local clock
+  uint32_t rttUs;
+  uint8_t stratum;
+  bool falseticker;      // dropped by the last selection
+};
+
+class TimeSync {
+ public:
+  explicit TimeSync(SchedClock clockUs);
+
+  // Up to NTP_MAX_SERVERS host names; the pointers must outlive the service
+  bool addServer(const char* host);
+  // Seconds added to UTC for localEpoch() and the ISO strings
+  void setLocalOffset(int32_t seconds) { localOffsetS_ = seconds; }
+  // Transport; the first round starts on the next poll()
+  void begin(HalUdp* udp);
+  // Start a round on the next poll(), e.g. after the link came back
+  void resync();
+
+  // Send due requests and take the replies; returns ms until it wants to run again
+  uint32_t poll();
+
+  bool synced() const { return synced_; }
+  // Disciplined time, valid once synced()
+  int64_t utcMicros();
+  uint32_t utcEpoch() { return (uint32_t)(utcMicros() / 1000000); }
+  uint32_t localEpoch() { return utcEpoch() + localOffsetS_; }
+  // ISO 8601 local time of the current second, "1970-01-01T00:00:00" until synced
+  const char* isoLocal();
+  // ISO 8601 for any epoch; buf holds NTP_ISO_LEN + 1 bytes
+  static void formatIso(uint32_t epoch, char* buf);
+
+  // Diagnostics
+  uint8_t serverCount() const { return serverCount_; }
+  const NtpServerStats& server(uint8_t i) const { return servers_[i].stats; }
+  uint8_t selected() const { return selected_; }          // 0xFF before the first sync
+  int32_t freqPpb() const { return freqPpb_; }             // drift correction, parts per billion
+  int32_t lastErrorUs() const { return lastErrorUs_; }     // clock error found by the last sync
+  uint32_t pollIntervalMs() const { return pollMs_; }
+  uint32_t steps() const { return steps_; }
+  uint32_t syncs() const { return syncs_; }
+  uint32_t lastSyncAgeMs();
+
+ private:
+  struct Sample {
+    int64_t offsetUs;    // UTC - raw local clock at localUs
+    uint64_t localUs;    // midpoint of the exchange
+    uint32_t rttUs;
+    uint32_t rootUs;     // root delay / 2 + root dispersion of the server
+  };
+
+  struct Server {
+    NtpServerStats stats;
+    Sample samples[NTP_FILTER_SAMPLES];
+    uint8_t sampleCount;
+    uint8_t sampleNext;
+    bool queued;         // request of this round not sent yet (name still resolving)
+    bool pending;        // request out, no reply yet
+    bool answered;       // valid reply in this round
+    uint64_t sentUs;
+    uint64_t nonce;      // transmit timestamp of the request, echoed as origin
+    uint64_t silentUntilUs;
+  };
+
+  uint64_t localUs();
+  int64_t utcAt(uint64_t local) const;
+  int64_t slewAt(uint64_t local) const;
+  void rebase(uint64_t local);
+  void startRound(uint64_t now);
+  void sendPending(uint64_t now);
+  void receive(uint64_t now);
+  void finishRound(uint64_t now);
+  bool bestSample(const Server& s, uint64_t now, Sample& out) const;
+  void discipline(const Sample& s, uint64_t now);
+  void refreshIso(uint32_t epoch);
+
+  SchedClock clockUs_;
+  HalUdp* udp_;
+  uint32_t lastRawUs_;
+  uint64_t highUs_;      // 64-bit extension of the injected clock
+
+  Server servers_[NTP_MAX_SERVERS];
+  uint8_t serverCount_;
+  uint8_t selected_;
+  bool inRound_;
+  uint64_t roundStartUs_;
+  uint64_t nextRoundUs_;
+  uint32_t retryMs_;
+  uint32_t pollMs_;
+  uint32_t nonceSeq_;
+
+  // Disciplined clock: utc = baseUtcUs_ + dt + dt * freqPpb_ / 1e9 + slew, dt = local - baseLocalUs_
+  bool synced_;
+  uint64_t baseLocalUs_;
+  int64_t baseUtcUs_;
+  int32_t freqPpb_;
+  int64_t slewUs_;       // still to be slewed in from baseLocalUs_ on
+  bool haveAnchor_;
+  Sample anchor_;        // start of the drift baseline
+  int32_t lastErrorUs_;
+  uint64_t lastSyncUs_;
+  uint32_t steps_;
+  uint32_t syncs_;
+  int32_t localOffsetS_;
+
+  // isoLocal() cache
+  uint32_t isoEpoch_;
+  char iso_[NTP_ISO_LEN + 1];
+};
+
+#endif // TIME_SYNC_H
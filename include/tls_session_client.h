@@ -0,0 +1,83 @@
+/**
+ * tls_session_client.h - TLS client (mbedTLS over an lwIP socket) with session resumption
+ *
+ * WiFiClientSecure starts every connection with a full handshake and gives no
+ * access to the mbedTLS session. This client keeps the session (ID and/or ticket)
+ * of its last successful handshake and offers it on the next connect, so a
+ * reconnect after the server closed an idle keep-alive connection costs one round
+ * trip and no certificate/key exchange. Full vs resumed handshakes are counted.
+ *
+ * connect() blocks (TCP connect + handshake, bounded by the timeout) and is meant
+ * for AsyncHttp's connect helper task; after that the socket is non-blocking:
+ * write() may return 0 while the socket buffer is full, and read()/available()
+ * never wait.
+ *
+ * Same trust model as WiFiClientSecure::setInsecure(): the server certificate is
+ * not verified.
+ */
+
+#ifndef TLS_SESSION_CLIENT_H
+#define TLS_SESSION_CLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <IPAddress.h>
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+
+class TlsSessionClient : public Client {
+ public:
+  TlsSessionClient();
+  ~TlsSessionClient();
+
+  // TCP connect to ip:port, then TLS handshake with SNI host, offering the saved session.
+  // Returns 1 on success, 0 on failure.
+  int connect(IPAddress ip, uint16_t port, const char* host, uint32_t timeoutMs);
+
+  // Client interface (connect without SNI host/timeout is not supported)
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char* host, uint16_t port) override;
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* buf, size_t size) override;
+  int available() override;
+  int read() override;
+  int read(uint8_t* buf, size_t size) override;
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return connected(); }
+
+  // Forget the saved session (next connect does a full handshake).
+  void clearSession();
+
+  uint32_t fullHandshakes() const { return fullHandshakes_; }
+  uint32_t resumedHandshakes() const { return resumedHandshakes_; }
+  uint32_t lastHandshakeMs() const { return lastHandshakeMs_; }
+
+ private:
+  bool initContext();
+  bool tcpConnect(IPAddress ip, uint16_t port, uint32_t timeoutMs);
+  bool waitSocket(bool forWrite, uint32_t timeoutMs);
+  static int bioSend(void* ctx, const unsigned char* buf, size_t len);
+  static int bioRecv(void* ctx, unsigned char* buf, size_t len);
+
+  int sock_;
+  bool open_;       // handshake done, peer has not closed
+  bool seeded_;
+  int peeked_;      // byte returned by peek(), -1 if none
+  bool lastIoWasSend_;  // direction of the latest bio call (full vs resumed handshake)
+  mbedtls_ssl_context ssl_;
+  mbedtls_ssl_config conf_;
+  mbedtls_entropy_context entropy_;
+  mbedtls_ctr_drbg_context drbg_;
+  mbedtls_ssl_session session_;
+  bool haveSession_;
+
+  uint32_t fullHandshakes_;
+  uint32_t resumedHandshakes_;
+  uint32_t lastHandshakeMs_;
+};
+
+#endif // TLS_SESSION_CLIENT_H
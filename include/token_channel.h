@@ -0,0 +1,81 @@
+/**
+ * token_channel.h - WebSocket push channel for purchased tokens
+ *
+ * Keeps one WebSocket session open to the server (links2004/WebSockets). The
+ * server pushes a token the moment it is purchased, and again on every
+ * (re)connect while it is still PENDING; the device answers with a confirm
+ * once the token is applied. HTTP polling of /purchases/pending-token is only
+ * the fallback while the socket is down.
+ *
+ * Messages are JSON text frames:
+ *   server -> device  {"type":"token","purchaseId":"..","tokenNumber":"..","kwhAmount":5.0,"rechargeCode":".."}
+ *   device -> server  {"type":"confirm","purchaseId":".."}
+ *   server -> device  {"type":"confirmed","purchaseId":".."}
+ *
+ * The WebSocket library connects (DNS + TCP + TLS) synchronously inside its
+ * loop(), so it runs in its own task on core 0 next to the http-connect helper;
+ * loop() only touches the two SPSC rings below and never blocks on the socket.
+ */
+
+#ifndef TOKEN_CHANNEL_H
+#define TOKEN_CHANNEL_H
+
+#include <Arduino.h>
+#include <WebSocketsClient.h>
+#include <atomic>
+#include "spsc_ring.h"
+
+#define TOKEN_CHANNEL_RECONNECT_MS 5000
+#define TOKEN_CHANNEL_PING_MS      20000  // also keeps proxies from closing an idle socket
+#define TOKEN_CHANNEL_PONG_MS      5000
+
+struct PushedToken {
+  char purchaseId[32];
+  char tokenNumber[21];
+  float kwhAmount;
+};
+
+struct TokenConfirm {
+  char purchaseId[32];
+};
+
+class TokenChannel {
+ public:
+  TokenChannel();
+
+  // Connect to ws[s]://host:port/path, authenticated as meterNumber:key (HTTP Basic, checked
+  // by the server on the upgrade), and start the socket task.
+  bool begin(const char* host, uint16_t port, bool secure, const char* path, const char* meterNumber,
+             const char* key);
+
+  // loop() side: next pushed token, false when none.
+  bool receive(PushedToken& out) { return inbox_.pop(out); }
+  // loop() side: queue a confirm. False when the socket is down or the queue is full
+  // (the caller then confirms over HTTP).
+  bool confirm(const char* purchaseId);
+
+  bool connected() const { return connected_.load(std::memory_order_acquire); }
+
+  // Diagnostics
+  uint32_t connects() const { return connects_; }
+  uint32_t tokensPushed() const { return tokensPushed_; }
+  uint32_t confirmsAcked() const { return confirmsAcked_; }
+
+ private:
+  static void task(void* arg);
+  void onEvent(WStype_t type, uint8_t* payload, size_t length);
+  void handleText(const char* text, size_t len);
+
+  WebSocketsClient ws_;
+  TaskHandle_t task_;
+  std::atomic<bool> connected_;
+
+  SpscRing<PushedToken, 4> inbox_;     // socket task -> loop()
+  SpscRing<TokenConfirm, 4> outbox_;   // loop() -> socket task
+
+  uint32_t connects_;
+  uint32_t tokensPushed_;
+  uint32_t confirmsAcked_;
+};
+
+#endif // TOKEN_CHANNEL_H
@@ -0,0 +1,102 @@
+/**
+ * token_store.h - Offline token table: sorted packed-BCD keys in flash, used-token bitmap
+ *
+ * Tokens that can be redeemed without a network live in their own data partition
+ * ("tokens", see partitions.csv), written at provisioning time by
+ * scripts/make-token-partition.mjs:
+ *
+ *   0x00  TokenStoreHeader (magic "TKS1", count, bitmap offset, CRCs)
+ *   0x20  TokenRecord[count]    sorted ascending by key, 16 bytes each
+ *   bitmapOffset  used bitmap   ceil(count / 8) bytes, 1 = unused, 0 = redeemed
+ *
+ * A key is the 20 token digits packed two per byte, most significant first, so
+ * memcmp order is numeric order and lookup is a binary search over the table
+ * memory-mapped straight from flash (no RAM copy, 12 probes for 4,000 tokens).
+ * Redeeming a token clears its bit in place: NOR flash can always turn a 1 into
+ * a 0, so the bitmap needs no erase and a token can never be reused, across
+ * reboots included.
+ *
+ * Footprint: 16.125 bytes of flash per token; RAM is the object itself. The
+ * 64 KB partition holds 4,062 tokens; bigger fleets only need a bigger partition.
+ *
+ * When the partition is blank (first boot) it is provisioned from the built-in
+ * seed table; when it is missing (old partition table) the seeds are searched in
+ * RAM and redeemed tokens are remembered until the next reboot only.
+ */
+
+#ifndef TOKEN_STORE_H
+#define TOKEN_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hal.h"
+
+#define TS_MAGIC         0x31534B54UL  // "TKS1"
+#define TS_VERSION       1
+#define TS_TABLE_OFFSET  0x20
+#define TS_KEY_BYTES     10
+
+// Built-in token (firmware constant), packed and sorted by begin()
+struct TokenSeed {
+  const char* code;  // 20 digits, no spaces
+  float kwh;
+};
+
+struct TokenRecord {
+  uint8_t key[TS_KEY_BYTES];  // packed BCD, most significant digit first
+  uint16_t reserved;
+  uint32_t wh;                // energy credited, Wh
+};
+static_assert(sizeof(TokenRecord) == 16, "TokenRecord layout changed");
+
+struct TokenStoreHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordSize;
+  uint32_t count;
+  uint32_t bitmapOffset;
+  uint16_t tableCrc;   // CRC-16/MODBUS over the records
+  uint16_t headerCrc;  // CRC-16/MODBUS over the preceding header bytes
+};
+
+enum TokenLookup { TOKEN_UNKNOWN, TOKEN_VALID, TOKEN_USED };
+
+class TokenStore {
+ public:
+  TokenStore();
+
+  // Attach to the token partition (provisioning it from seeds when blank); flash is
+  // NULL when there is none. False when only the RAM seed table is available.
+  bool begin(HalFlash* flash, const TokenSeed* seeds, size_t seedCount);
+  bool persistent() const { return flash_ != NULL; }
+  size_t count() const { return count_; }
+
+  // Look up 20 digits. On TOKEN_VALID/TOKEN_USED, index and kwh describe the record.
+  TokenLookup find(const char* digits, int32_t& index, float& kwh);
+  // Redeem the token at index (from find()); false when it could not be recorded.
+  bool markUsed(int32_t index);
+
+  uint32_t lastLookupUs() const { return lastLookupUs_; }
+
+  // 20 ASCII digits -> packed key; false when digits is not exactly 20 digits
+  static bool packKey(const char* digits, uint8_t key[TS_KEY_BYTES]);
+
+ private:
+  bool attach(const TokenStoreHeader& h);
+  bool provision(const TokenRecord* recs, size_t n);
+  bool isUsed(size_t index);
+  static size_t buildSorted(const TokenSeed* seeds, size_t seedCount, TokenRecord* out);
+  static uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF);
+
+  HalFlash* flash_;
+  const TokenRecord* table_;  // memory-mapped flash, or ramTable_
+  size_t count_;
+  uint32_t bitmapOffset_;
+
+  TokenRecord* ramTable_;     // fallback without the partition
+  uint8_t* ramUsed_;
+
+  uint32_t lastLookupUs_;
+};
+
+#endif // TOKEN_STORE_H
@@ -0,0 +1,70 @@
+/**
+ * Compare two benchmark runs (firmware: include/bench.h).
+ *
+ *   .pio/build/native/program --bench all > before.jsonl      (or the "bench" serial output)
+ *   node scripts/bench-compare.mjs before.jsonl after.jsonl [threshold%]
+ *
+ * Lines that are not JSON (serial log noise) are skipped. Prints mean_ns and p99_us
+ * per case with the change in percent; exits 1 when a case's mean got slower than
+ * threshold (default 10%). A case whose "check" differs did different work: it is
+ * flagged and not counted as a regression.
+ */
+import { readFileSync } from 'fs';
+
+const load = (path) => {
+  const cases = new Map();
+  for (const line of readFileSync(path, 'utf8').split(/\r?\n/)) {
+    const start = line.indexOf('{"bench"');
+    if (start < 0) continue;
+    try {
+      const r = JSON.parse(line.slice(start));
+      cases.set(r.bench, r);
+    } catch {
+      // truncated line
+    }
+  }
+  return cases;
+};
+
+const [beforePath, afterPath, thresholdArg] = process.argv.slice(2);
+if (!beforePath || !afterPath) {
+  console.error('usage: node scripts/bench-compare.mjs before.jsonl after.jsonl [threshold%]');
+  process.exit(2);
+}
+const threshold = thresholdArg ? Number(thresholdArg) : 10;
+const before = load(beforePath);
+const after = load(afterPath);
+
+const pct = (a, b) => (a > 0 ? ((b - a) / a) * 100 : 0);
+const fmt = (p) => `${p >= 0 ? '+' : ''}${p.toFixed(1)}%`;
+let regressions = 0;
+
+console.log('case                  mean_ns before -> after           p99_us before -> after');
+for (const [name, b] of before) {
+  const a = after.get(name);
+  if (!a) {
+    console.log(`${name.padEnd(20)}  missing in ${afterPath}`);
+    continue;
+  }
+  if (b.skipped || a.skipped) {
+    console.log(`${name.padEnd(20)}  skipped`);
+    continue;
+  }
+  const dMean = pct(b.mean_ns, a.mean_ns);
+  let note = '';
+  if (a.target !== b.target) note = `  (${b.target} vs ${a.target})`;
+  if (a.check !== b.check) {
+    note += '  check differs: not comparable';
+  } else if (dMean > threshold) {
+    note += '  SLOWER';
+    regressions++;
+  }
+  console.log(
+    `${name.padEnd(20)}  ${String(b.mean_ns).padStart(8)} -> ${String(a.mean_ns).padEnd(8)} ${fmt(dMean).padStart(7)}` +
+      `   ${String(b.p99_us).padStart(6)} -> ${String(a.p99_us).padEnd(6)}${note}`
+  );
+}
+for (const name of after.keys()) {
+  if (!before.has(name)) console.log(`${name.padEnd(20)}  new`);
+}
+process.exit(regressions ? 1 : 0);
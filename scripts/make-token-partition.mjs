@@ -0,0 +1,80 @@
+/**
+ * Build the offline token partition image (firmware: include/token_store.h).
+ *
+ *   node scripts/make-token-partition.mjs tokens.csv tokens.bin
+ *   parttool.py --port <port> write_partition --partition-name tokens --input tokens.bin
+ *
+ * tokens.csv: one "<20 digits>,<kWh>" per line (spaces inside the token are ignored,
+ * lines starting with # are skipped). Tokens are sorted by key; duplicates are rejected.
+ * Writing the partition resets the used-token bitmap.
+ */
+import { readFileSync, writeFileSync } from 'fs';
+
+const PARTITION_SIZE = 0x10000;
+const MAGIC = 0x31534b54; // "TKS1"
+const VERSION = 1;
+const TABLE_OFFSET = 0x20;
+const RECORD_SIZE = 16;
+
+// CRC-16/MODBUS, as on the meter
+const crc16 = (buf) => {
+  let crc = 0xffff;
+  for (const byte of buf) {
+    crc ^= byte;
+    for (let b = 0; b < 8; b++) crc = crc & 1 ? (crc >>> 1) ^ 0xa001 : crc >>> 1;
+  }
+  return crc;
+};
+
+const [input, output] = process.argv.slice(2);
+if (!input || !output) {
+  console.error('usage: node scripts/make-token-partition.mjs <tokens.csv> <tokens.bin>');
+  process.exit(1);
+}
+
+const tokens = readFileSync(input, 'utf8')
+  .split(/\r?\n/)
+  .map((line) => line.trim())
+  .filter((line) => line && !line.startsWith('#'))
+  .map((line, i) => {
+    const [code, kwh] = line.split(',');
+    const digits = code.replace(/\s/g, '');
+    const wh = Math.round(parseFloat(kwh) * 1000);
+    if (!/^\d{20}$/.test(digits) || !(wh > 0) || wh > 0xffffffff) {
+      throw new Error(`line ${i + 1}: expected "<20 digits>,<kWh>", got "${line}"`);
+    }
+    return { digits, wh };
+  })
+  .sort((a, b) => (a.digits < b.digits ? -1 : a.digits > b.digits ? 1 : 0));
+
+for (let i = 1; i < tokens.length; i++) {
+  if (tokens[i].digits === tokens[i - 1].digits) throw new Error(`duplicate token ${tokens[i].digits}`);
+}
+
+const bitmapOffset = TABLE_OFFSET + tokens.length * RECORD_SIZE;
+const end = bitmapOffset + Math.ceil(tokens.length / 8);
+if (end > PARTITION_SIZE) {
+  throw new Error(`${tokens.length} tokens need ${end} bytes, partition has ${PARTITION_SIZE}`);
+}
+
+const image = Buffer.alloc(end, 0xff);
+const table = image.subarray(TABLE_OFFSET, bitmapOffset);
+tokens.forEach(({ digits, wh }, i) => {
+  const rec = table.subarray(i * RECORD_SIZE, (i + 1) * RECORD_SIZE);
+  rec.fill(0);
+  for (let k = 0; k < 10; k++) rec[k] = (Number(digits[2 * k]) << 4) | Number(digits[2 * k + 1]);
+  rec.writeUInt32LE(wh, 12);
+});
+
+const header = image.subarray(0, TABLE_OFFSET);
+header.fill(0);
+header.writeUInt32LE(MAGIC, 0);
+header.writeUInt16LE(VERSION, 4);
+header.writeUInt16LE(RECORD_SIZE, 6);
+header.writeUInt32LE(tokens.length, 8);
+header.writeUInt32LE(bitmapOffset, 12);
+header.writeUInt16LE(crc16(table), 16);
+header.writeUInt16LE(crc16(header.subarray(0, 18)), 18);
+
+writeFileSync(output, image);
+console.log(`${tokens.length} tokens, ${end} of ${PARTITION_SIZE} bytes -> ${output}`);
@@ -4,12 +4,35 @@
  */
 import express from 'express';
 import db from '../database.js';
+import EnergyData from '../models/EnergyData.js';
 import { verifyToken } from './auth.js';
 
 const router = express.Router();
 
 const getTimestamp = () => new Date().toISOString();
 
+// Upper bound on readings per batch request (the ESP32 sends at most 10)
+const BATCH_MAX_ITEMS = 100;
+
+/**
+ * Validation shared by single and batch posts; returns an error message or null
+ */
+const validateReading = (data) => {
+  if (!data || typeof data !== 'object' || Array.isArray(data)) {
+    return 'Reading must be an object';
+  }
+  if (!data.meterNumber || !data.token) {
+    return 'Missing required fields: meterNumber and token are required';
+  }
+  if (!/^\d{13}$/.test(data.meterNumber)) {
+    return 'Invalid meter number format. Must be 13 digits';
+  }
+  if (!/^\d{20}$/.test(data.token)) {
+    return 'Invalid token format. Must be 20 digits';
+  }
+  return null;
+};
+
 /**
  * POST /api/energy-data
  * Receives energy meter data from ESP32 (no auth - device endpoint).
@@ -19,24 +42,11 @@ router.post('/', async (req, res) => {
   try {
     const data = req.body;
 
-    if (!data.meterNumber || !data.token) {
-      return res.status(400).json({
-        success: false,
-        error: 'Missing required fields: meterNumber and token are required'
-      });
-    }
-
-    if (!/^\d{13}$/.test(data.meterNumber)) {
-      return res.status(400).json({
-        success: false,
-        error: 'Invalid meter number format. Must be 13 digits'
-      });
-    }
-
-    if (!/^\d{20}$/.test(data.token)) {
+    const validationError = validateReading(data);
+    if (validationError) {
       return res.status(400).json({
         success: false,
-        error: 'Invalid token format. Must be 20 digits'
+        error: validationError
       });
     }
 
@@ -68,6 +78,84 @@ router.post('/', async (req, res) => {
   }
 });
 
+/**
+ * POST /api/energy-data/batch
+ * Several readings from one ESP32 in one request (no auth - device endpoint).
+ * Body: { meterNumber, token, clientName, ..., readings: [ { ...reading }, ... ] }
+ * Top-level fields are defaults for every reading; a reading may override them.
+ * Valid readings are bulk-inserted even if others are rejected.
+ * Response: { success, accepted, rejected, results: [ { index, status, error? } ] }
+ */
+router.post('/batch', async (req, res) => {
+  try {
+    const { readings, ...shared } = req.body || {};
+
+    if (!Array.isArray(readings) || readings.length === 0) {
+      return res.status(400).json({
+        success: false,
+        error: 'readings must be a non-empty array'
+      });
+    }
+    if (readings.length > BATCH_MAX_ITEMS) {
+      return res.status(413).json({
+        success: false,
+        error: `At most ${BATCH_MAX_ITEMS} readings per batch`
+      });
+    }
+
+    const serverTimestamp = getTimestamp();
+    const receivedAt = Date.now();
+    const docs = [];
+    const docIndex = [];
+    const results = readings.map((item, index) => {
+      const data = item && typeof item === 'object' && !Array.isArray(item) ? { ...shared, ...item } : item;
+      const validationError = validateReading(data);
+      if (validationError) {
+        return { index, status: 'rejected', error: validationError };
+      }
+      docs.push({ ...data, serverTimestamp, receivedAt });
+      docIndex.push(index);
+      return { index, status: 'accepted' };
+    });
+
+    if (docs.length > 0) {
+      const reject = (i, message) => {
+        const index = docIndex[i];
+        results[index] = { index, status: 'rejected', error: message || 'Insert failed' };
+      };
+      try {
+        // One round trip; unordered so one bad document does not stop the rest
+        await EnergyData.insertMany(docs, { ordered: false, throwOnValidationError: true });
+      } catch (error) {
+        if (Array.isArray(error.results)) {
+          // Schema validation failures: results[i] is the Error for docs[i]
+          error.results.forEach((r, i) => { if (r instanceof Error) reject(i, r.message); });
+        } else if (Array.isArray(error.writeErrors)) {
+          for (const writeError of error.writeErrors) reject(writeError.index, writeError.errmsg);
+        } else {
+          throw error;
+        }
+      }
+    }
+
+    const accepted = results.filter(r => r.status === 'accepted').length;
+    const rejected = results.length - accepted;
+    res.status(200).json({
+      success: rejected === 0,
+      accepted,
+      rejected,
+      results
+    });
+  } catch (error) {
+    console.error('Error processing energy data batch:', error);
+    res.status(500).json({
+      success: false,
+      error: 'Internal server error',
+      message: error.message
+    });
+  }
+});
+
 /**
  * GET /api/energy-data
  * List energy data with optional filters. Auth required; only user's meters.
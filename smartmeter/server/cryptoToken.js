@@ -0,0 +1,110 @@
+/**
+ * Offline credit tokens, the server side of the firmware codec (include/crypto_token.h,
+ * src/crypto_token.cpp): a 20-digit token bound to one meter that the meter verifies by itself.
+ *
+ *   data  := class(4) seq(16) deciKwh(14)                        34 bits
+ *   mac   := SipHash-2-4(key, meterNumber '|' data as 5 bytes BE)   low 30 bits
+ *   token := ((data ^ keystream(mac)) << 30 | mac) as 20 decimal digits
+ *
+ * Each meter has its own key, HMAC-SHA256(METER_TOKEN_SECRET, meterNumber) (scripts/meterKey.js
+ * prints it as METER_TOKEN_KEY for provisioning), and each token a new sequence number from
+ * Meter.tokenSeq. Without METER_TOKEN_SECRET purchases get random tokens, which the meter only
+ * accepts through the server.
+ */
+import crypto from 'crypto';
+
+export const TOKEN_CLASS_CREDIT = 1;
+export const MAX_DECI_KWH = 0x3fff;
+export const MAX_SEQ = 0xffff;
+
+const MAC_BITS = 30n;
+const MAC_MASK = (1n << MAC_BITS) - 1n;
+const DATA_MASK = (1n << 34n) - 1n;
+const KEYSTREAM_DOMAIN = 0x4b53; // "KS": separates the keystream from the MAC input
+const U64 = (1n << 64n) - 1n;
+const KEY_HEX = 32;
+
+const rotl = (x, b) => ((x << b) | (x >> (64n - b))) & U64;
+
+const siphash24 = (key, msg) => {
+  const k0 = key.readBigUInt64LE(0);
+  const k1 = key.readBigUInt64LE(8);
+  let v0 = 0x736f6d6570736575n ^ k0;
+  let v1 = 0x646f72616e646f6dn ^ k1;
+  let v2 = 0x6c7967656e657261n ^ k0;
+  let v3 = 0x7465646279746573n ^ k1;
+  const round = () => {
+    v0 = (v0 + v1) & U64; v1 = rotl(v1, 13n); v1 ^= v0; v0 = rotl(v0, 32n);
+    v2 = (v2 + v3) & U64; v3 = rotl(v3, 16n); v3 ^= v2;
+    v0 = (v0 + v3) & U64; v3 = rotl(v3, 21n); v3 ^= v0;
+    v2 = (v2 + v1) & U64; v1 = rotl(v1, 17n); v1 ^= v2; v2 = rotl(v2, 32n);
+  };
+  const full = msg.length & ~7;
+  for (let i = 0; i < full; i += 8) {
+    const m = msg.readBigUInt64LE(i);
+    v3 ^= m;
+    round();
+    round();
+    v0 ^= m;
+  }
+  let b = BigInt(msg.length & 0xff) << 56n;
+  for (let i = full; i < msg.length; i++) b |= BigInt(msg[i]) << BigInt(8 * (i - full));
+  v3 ^= b;
+  round();
+  round();
+  v0 ^= b;
+  v2 ^= 0xffn;
+  for (let i = 0; i < 4; i++) round();
+  return v0 ^ v1 ^ v2 ^ v3;
+};
+
+const tokenMac = (key, meterNumber, data) => {
+  const bytes = Buffer.alloc(5);
+  for (let i = 0; i < 5; i++) bytes[i] = Number((data >> BigInt(8 * (4 - i))) & 0xffn);
+  return siphash24(key, Buffer.concat([Buffer.from(`${meterNumber}|`, 'latin1'), bytes])) & MAC_MASK;
+};
+
+const keystream = (key, mac) => {
+  const m = Number(mac);
+  const msg = Buffer.from([KEYSTREAM_DOMAIN >> 8, KEYSTREAM_DOMAIN & 0xff, m >>> 24, (m >>> 16) & 0xff, (m >>> 8) & 0xff, m & 0xff]);
+  return siphash24(key, msg) & DATA_MASK;
+};
+
+const parseKey = (hex) => {
+  if (typeof hex !== 'string' || !/^[0-9a-fA-F]{32}$/.test(hex)) throw new Error('token key must be 32 hex characters');
+  return Buffer.from(hex, 'hex');
+};
+
+/** The crypto token key of a meter (hex, as METER_TOKEN_KEY), null when METER_TOKEN_SECRET is not configured */
+export const meterTokenKey = (meterNumber) => {
+  const secret = process.env.METER_TOKEN_SECRET;
+  if (!secret) return null;
+  return crypto.createHmac('sha256', secret).update(meterNumber).digest('hex').slice(0, KEY_HEX);
+};
+
+/** 20-digit token for seq 1..65535 and deciKwh 1..16383, as cryptoTokenEncode() */
+export const encodeCryptoToken = (keyHex, meterNumber, seq, deciKwh) => {
+  if (!Number.isInteger(seq) || seq < 1 || seq > MAX_SEQ) throw new RangeError('sequence must be 1..65535');
+  if (!Number.isInteger(deciKwh) || deciKwh < 1 || deciKwh > MAX_DECI_KWH) throw new RangeError('deciKwh must be 1..16383');
+  const key = parseKey(keyHex);
+  const data = (BigInt(TOKEN_CLASS_CREDIT) << 30n) | (BigInt(seq) << 14n) | BigInt(deciKwh);
+  const mac = tokenMac(key, meterNumber, data);
+  const block = ((data ^ keystream(key, mac)) << MAC_BITS) | mac;
+  return block.toString().padStart(20, '0');
+};
+
+/** { seq, deciKwh } of a valid credit token of this meter, null otherwise (cryptoTokenDecode()) */
+export const decodeCryptoToken = (keyHex, meterNumber, digits) => {
+  if (!/^\d{20}$/.test(digits)) return null;
+  const block = BigInt(digits);
+  if (block > U64) return null;
+  const key = parseKey(keyHex);
+  const mac = block & MAC_MASK;
+  const data = (block >> MAC_BITS) ^ keystream(key, mac);
+  if (tokenMac(key, meterNumber, data) !== mac) return null;
+  const tokenClass = Number(data >> 30n);
+  const seq = Number((data >> 14n) & 0xffffn);
+  const deciKwh = Number(data & BigInt(MAX_DECI_KWH));
+  if (tokenClass !== TOKEN_CLASS_CREDIT || seq === 0 || deciKwh === 0) return null;
+  return { seq, deciKwh };
+};
@@ -65,6 +65,16 @@ const db = {
     }
   },
 
+  // Next crypto token sequence number of a meter (atomic, never handed out twice)
+  async nextTokenSeq(meterNumber) {
+    try {
+      const meter = await Meter.findOneAndUpdate({ meterNumber }, { $inc: { tokenSeq: 1 } }, { new: true });
+      return meter ? meter.tokenSeq : null;
+    } catch (error) {
+      throw error;
+    }
+  },
+
   async getMetersByUserId(userId) {
     try {
       return await Meter.find({ userId }).sort({ createdAt: -1 });
@@ -110,6 +120,14 @@ const db = {
     }
   },
 
+  async getPurchaseById(purchaseId) {
+    try {
+      return await Purchase.findById(purchaseId);
+    } catch (error) {
+      throw error;
+    }
+  },
+
   async updatePurchaseStatus(purchaseId, status) {
     try {
       return await Purchase.findByIdAndUpdate(purchaseId, { status }, { new: true });
@@ -0,0 +1,111 @@
+/**
+ * Energy readings from the ESP32: validation and storage behind POST /api/energy-data,
+ * /energy-data/batch and /energy-data/bin (routes/energyData.js). Kept free of express so
+ * test/energyBatch.test.js can serve it from a plain http.Server with a stand-in store.
+ *
+ * A store saves enriched readings, in order: save(reading) for a single post, saveBatch(readings)
+ * for a batch (one call per request). Either may return a promise.
+ */
+import fs from 'fs';
+import path from 'path';
+
+// Upper bound on readings per batch request (the ESP32 sends at most TELEMETRY_BATCH_MAX = 8, api_schedule.h)
+export const BATCH_MAX_ITEMS = 100;
+
+const getTimestamp = () => new Date().toISOString();
+
+/** Readings as JSON files under dir, one per reading (the deployed server's store) */
+export const fileReadingStore = (dir) => {
+  if (!fs.existsSync(dir)) {
+    fs.mkdirSync(dir, { recursive: true });
+  }
+  return {
+    save: (data) => {
+      const timestamp = new Date().toISOString().replace(/:/g, '-');
+      fs.writeFileSync(path.join(dir, `energy_data_${timestamp}.json`), JSON.stringify(data, null, 2));
+    },
+    /**
+     * Files share the request timestamp plus a zero-padded index, so they sort after
+     * each other (and after single posts of the same millisecond).
+     */
+    saveBatch: (items) => {
+      const timestamp = new Date().toISOString().replace(/:/g, '-');
+      items.forEach((data, i) => {
+        const filename = `energy_data_${timestamp}_${String(i).padStart(3, '0')}.json`;
+        fs.writeFileSync(path.join(dir, filename), JSON.stringify(data, null, 2));
+      });
+    },
+  };
+};
+
+/** Validation shared by single and batch posts; returns an error message or null */
+export const validateReading = (data) => {
+  if (!data || typeof data !== 'object' || Array.isArray(data)) {
+    return 'reading must be an object';
+  }
+  if (!data.meterNumber || !data.token) {
+    return 'meterNumber and token required';
+  }
+  // Accept 11 or 13-digit meter numbers
+  if (!/^\d{11}$/.test(data.meterNumber) && !/^\d{13}$/.test(data.meterNumber)) {
+    return 'meterNumber must be 11 or 13 digits';
+  }
+  // Token: accept any non-empty alphanumeric string (20-digit decimal from server, or legacy formats)
+  if (typeof data.token !== 'string' || data.token.trim().length === 0) {
+    return 'token must be a non-empty string';
+  }
+  return null;
+};
+
+/** Validate and store readings (defaults merged in); returns the per-item response body */
+export const storeReadings = async (store, readings, shared) => {
+  const serverTimestamp = getTimestamp();
+  const receivedAt = Date.now();
+  const accepted = [];
+  const results = readings.map((item, index) => {
+    const data = item && typeof item === 'object' && !Array.isArray(item) ? { ...shared, ...item } : item;
+    const error = validateReading(data);
+    if (error) {
+      return { index, status: 'rejected', error };
+    }
+    accepted.push({ ...data, serverTimestamp, receivedAt });
+    return { index, status: 'accepted' };
+  });
+
+  await store.saveBatch(accepted);
+  const rejected = readings.length - accepted.length;
+  return { success: rejected === 0, accepted: accepted.length, rejected, results };
+};
+
+/** POST /api/energy-data: one reading; returns { status, body } of the response */
+export const postReading = async (store, data) => {
+  const error = validateReading(data);
+  if (error) {
+    return { status: 400, body: { success: false, error } };
+  }
+  const enriched = { ...data, serverTimestamp: getTimestamp(), receivedAt: Date.now() };
+  await store.save(enriched);
+  return {
+    status: 200,
+    body: {
+      success: true,
+      message: 'Energy data received',
+      data: { meterNumber: data.meterNumber, token: data.token, remainingKwh: data.remainingKwh, receivedAt: enriched.serverTimestamp },
+    },
+  };
+};
+
+/**
+ * POST /api/energy-data/batch: { meterNumber, token, clientName, ..., readings: [ ... ] }.
+ * Top-level fields are defaults for every reading; returns { status, body } of the response.
+ */
+export const postBatch = async (store, body) => {
+  const { readings, ...shared } = body || {};
+  if (!Array.isArray(readings) || readings.length === 0) {
+    return { status: 400, body: { success: false, error: 'readings must be a non-empty array' } };
+  }
+  if (readings.length > BATCH_MAX_ITEMS) {
+    return { status: 413, body: { success: false, error: `at most ${BATCH_MAX_ITEMS} readings per batch` } };
+  }
+  return { status: 200, body: await storeReadings(store, readings, shared) };
+};
@@ -4,7 +4,8 @@ import dotenv from 'dotenv';
 import authRoutes from './routes/auth.js';
 import purchasesRoutes from './routes/purchases.js';
 import energyDataRoutes from './routes/energyData.js';
-import { initializeDatabase } from './database.js';
+import db, { initializeDatabase } from './database.js';
+import { attachMeterSocket } from './meterSocket.js';
 
 dotenv.config();
 
@@ -73,7 +74,7 @@ app.use((err, req, res, next) => {
 // Initialize database and start server
 initializeDatabase().then(() => {
   const host = process.env.NODE_ENV === 'production' ? '0.0.0.0' : '0.0.0.0';
-  app.listen(PORT, host, () => {
+  const server = app.listen(PORT, host, () => {
     console.log(`✅ Server running on port ${PORT} [${process.env.NODE_ENV || 'development'}]`);
     console.log(`📊 Database: MongoDB Atlas`);
     if (process.env.NODE_ENV !== 'production') {
@@ -81,6 +82,7 @@ initializeDatabase().then(() => {
       console.log(`🔌 ESP32 → http://192.168.1.120:${PORT}/api/energy-data`);
     }
   });
+  attachMeterSocket(server, db);  // token push channel: /api/meter-socket?meter=<meterNumber>
 }).catch((error) => {
   console.error('Failed to initialize database:', error);
   process.exit(1);
@@ -0,0 +1,221 @@
+/**
+ * WebSocket push channel for token delivery (firmware: include/token_channel.h).
+ *
+ * The meter keeps one socket open on /api/meter-socket?meter=<meterNumber>. A purchase is pushed
+ * the moment it is created, and every PENDING purchase is pushed again when the meter (re)connects;
+ * the meter answers with a confirm once the token is applied. JSON text frames only:
+ *
+ *   server -> meter  {"type":"token","purchaseId","tokenNumber","kwhAmount","rechargeCode"}
+ *   meter -> server  {"type":"confirm","purchaseId"}
+ *   server -> meter  {"type":"confirmed","purchaseId"}
+ *
+ * The upgrade must carry the meter's credential as HTTP Basic auth, <meterNumber>:<meterSocketKey>,
+ * where the key is HMAC-SHA256(METER_SOCKET_SECRET, meterNumber) (scripts/meterKey.js prints it for
+ * provisioning). Without METER_SOCKET_SECRET every upgrade is refused and meters fall back to
+ * polling. A meter only ever confirms its own purchases.
+ *
+ * Minimal RFC 6455 server on the HTTP upgrade event: text, ping/pong and close; the meter never
+ * sends fragmented or large frames.
+ */
+import crypto from 'crypto';
+
+const SOCKET_PATH = '/api/meter-socket';
+const WS_GUID = '258EAFA5-E914-47DA-95CA-C5AB0DC85B11';
+const MAX_FRAME = 4096;
+const OP_TEXT = 0x1;
+const OP_CLOSE = 0x8;
+const OP_PING = 0x9;
+const OP_PONG = 0xa;
+
+const METER_KEY_HEX = 32;        // config.h METER_SOCKET_KEY
+
+let db = null;                   // purchase store, given to attachMeterSocket()
+const meters = new Map();        // meterNumber -> socket
+const pushedAt = new Map();      // purchaseId -> ms, for push-to-confirm latency
+export const socketStats = { connects: 0, pushes: 0, confirms: 0 };
+
+/** The socket credential of a meter, null when METER_SOCKET_SECRET is not configured */
+export const meterSocketKey = (meterNumber) => {
+  const secret = process.env.METER_SOCKET_SECRET;
+  if (!secret) return null;
+  return crypto.createHmac('sha256', secret).update(meterNumber).digest('hex').slice(0, METER_KEY_HEX);
+};
+
+// Basic <base64(meterNumber:key)> matching the requested meter
+const authorized = (req, meterNumber) => {
+  const expected = meterSocketKey(meterNumber);
+  const [scheme, encoded] = (req.headers.authorization || '').split(' ');
+  if (!expected || scheme !== 'Basic' || !encoded) return false;
+  const credential = Buffer.from(encoded, 'base64').toString('utf8');
+  const sep = credential.indexOf(':');
+  if (sep < 0 || credential.slice(0, sep) !== meterNumber) return false;
+  const key = Buffer.from(credential.slice(sep + 1));
+  return key.length === expected.length && crypto.timingSafeEqual(key, Buffer.from(expected));
+};
+
+const encodeFrame = (opcode, payload = Buffer.alloc(0)) => {
+  const len = payload.length;
+  let header;
+  if (len < 126) {
+    header = Buffer.from([0x80 | opcode, len]);
+  } else if (len < 65536) {
+    header = Buffer.alloc(4);
+    header[0] = 0x80 | opcode;
+    header[1] = 126;
+    header.writeUInt16BE(len, 2);
+  } else {
+    header = Buffer.alloc(10);
+    header[0] = 0x80 | opcode;
+    header[1] = 127;
+    header.writeBigUInt64BE(BigInt(len), 2);
+  }
+  return Buffer.concat([header, payload]);
+};
+
+const sendJson = (socket, message) => {
+  if (!socket.destroyed) socket.write(encodeFrame(OP_TEXT, Buffer.from(JSON.stringify(message))));
+};
+
+const tokenMessage = (purchase) => ({
+  type: 'token',
+  purchaseId: purchase._id.toString(),
+  tokenNumber: purchase.tokenNumber,
+  kwhAmount: purchase.kwhAmount,
+  rechargeCode: purchase.rechargeCode,
+});
+
+/** Push a purchase to its meter if that meter is connected. Returns true when sent. */
+export const pushTokenToMeter = (purchase) => {
+  const socket = meters.get(purchase.meterNumber);
+  if (!socket) return false;
+  sendJson(socket, tokenMessage(purchase));
+  pushedAt.set(purchase._id.toString(), Date.now());
+  socketStats.pushes++;
+  return true;
+};
+
+const pushPendingTokens = async (meterNumber) => {
+  const purchases = await db.getPurchasesByMeterNumber(meterNumber);
+  purchases.filter((p) => p.status === 'PENDING').forEach(pushTokenToMeter);
+};
+
+const handleMessage = async (meterNumber, socket, text) => {
+  let message;
+  try {
+    message = JSON.parse(text);
+  } catch {
+    return;
+  }
+  if (message.type === 'confirm' && typeof message.purchaseId === 'string') {
+    const purchase = /^[0-9a-f]{24}$/i.test(message.purchaseId) ? await db.getPurchaseById(message.purchaseId) : null;
+    if (!purchase || purchase.meterNumber !== meterNumber) {
+      console.warn(`🔌 Meter ${meterNumber} tried to confirm ${message.purchaseId}, not one of its purchases`);
+      return;
+    }
+    await db.updatePurchaseStatus(message.purchaseId, 'DELIVERED');
+    socketStats.confirms++;
+    const sentAt = pushedAt.get(message.purchaseId);
+    pushedAt.delete(message.purchaseId);
+    console.log(`🔌 Meter ${meterNumber} confirmed ${message.purchaseId}` +
+      (sentAt ? ` (${Date.now() - sentAt} ms after push)` : ''));
+    sendJson(socket, { type: 'confirmed', purchaseId: message.purchaseId });
+  }
+};
+
+// Split the receive buffer into frames; returns the unconsumed rest
+const readFrames = (buf, onFrame) => {
+  let o = 0;
+  while (buf.length - o >= 2) {
+    const fin = buf[o] & 0x80;
+    const opcode = buf[o] & 0x0f;
+    const masked = buf[o + 1] & 0x80;
+    let len = buf[o + 1] & 0x7f;
+    let p = o + 2;
+    if (len === 126) {
+      if (buf.length - p < 2) break;
+      len = buf.readUInt16BE(p);
+      p += 2;
+    } else if (len === 127) {
+      throw new Error('frame too large');
+    }
+    if (!fin || !masked || len > MAX_FRAME) throw new Error('unsupported frame');
+    if (buf.length - p < 4 + len) break;
+    const mask = buf.subarray(p, p + 4);
+    const payload = Buffer.from(buf.subarray(p + 4, p + 4 + len));
+    for (let i = 0; i < len; i++) payload[i] ^= mask[i & 3];
+    onFrame(opcode, payload);
+    o = p + 4 + len;
+  }
+  return buf.subarray(o);
+};
+
+const acceptSocket = (meterNumber, socket) => {
+  const previous = meters.get(meterNumber);
+  if (previous && previous !== socket) previous.destroy();  // stale session from before a reboot
+  meters.set(meterNumber, socket);
+  socketStats.connects++;
+  socket.setNoDelay(true);
+
+  let rx = Buffer.alloc(0);
+  const drop = () => {
+    if (meters.get(meterNumber) === socket) meters.delete(meterNumber);
+    socket.destroy();
+  };
+  socket.on('data', (chunk) => {
+    try {
+      rx = readFrames(Buffer.concat([rx, chunk]), (opcode, payload) => {
+        if (opcode === OP_TEXT) {
+          handleMessage(meterNumber, socket, payload.toString('utf8'))
+            .catch((err) => console.error('Meter socket message error:', err));
+        } else if (opcode === OP_PING) {
+          socket.write(encodeFrame(OP_PONG, payload));
+        } else if (opcode === OP_CLOSE) {
+          socket.end(encodeFrame(OP_CLOSE));
+          drop();
+        }
+      });
+    } catch (err) {
+      socket.end(encodeFrame(OP_CLOSE));
+      drop();
+    }
+  });
+  socket.on('close', drop);
+  socket.on('error', drop);
+
+  pushPendingTokens(meterNumber).catch((err) => console.error('Pending token push error:', err));
+};
+
+/**
+ * Handle WebSocket upgrades for the meter channel on an http.Server. store is the purchase
+ * store (database.js; test/meterSocket.test.js passes an in-memory one): getPurchasesByMeterNumber,
+ * getPurchaseById, updatePurchaseStatus.
+ */
+export const attachMeterSocket = (server, store) => {
+  db = store;
+  if (!process.env.METER_SOCKET_SECRET) {
+    console.warn('⚠️  METER_SOCKET_SECRET not set: meter sockets refused, meters poll for tokens');
+  }
+  server.on('upgrade', (req, socket) => {
+    const url = new URL(req.url, 'http://localhost');
+    const meterNumber = url.searchParams.get('meter');
+    const key = req.headers['sec-websocket-key'];
+    if (url.pathname !== SOCKET_PATH || !key || !/^\d{13}$/.test(meterNumber || '')) {
+      socket.end('HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n');
+      return;
+    }
+    if (!authorized(req, meterNumber)) {
+      // Checked before anything else happens: a stranger cannot take over (and close) a meter's session
+      socket.end('HTTP/1.1 401 Unauthorized\r\nConnection: close\r\n\r\n');
+      return;
+    }
+    const accept = crypto.createHash('sha1').update(key + WS_GUID).digest('base64');
+    const protocol = req.headers['sec-websocket-protocol'];
+    socket.write(
+      'HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n' +
+      `Sec-WebSocket-Accept: ${accept}\r\n` +
+      (protocol ? `Sec-WebSocket-Protocol: ${protocol.split(',')[0].trim()}\r\n` : '') +
+      '\r\n'
+    );
+    acceptSocket(meterNumber, socket);
+  });
+};
@@ -11,6 +11,11 @@ const meterSchema = new mongoose.Schema({
     required: true,
     unique: true
   },
+  // Sequence number of the last crypto token issued for this meter (cryptoToken.js)
+  tokenSeq: {
+    type: Number,
+    default: 0
+  },
   createdAt: {
     type: Date,
     default: Date.now
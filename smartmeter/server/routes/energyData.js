@@ -1,12 +1,20 @@
 /**
- * Energy data routes - live PZEM data from ESP32 (file-based storage).
- * GET /api/energy-data/:meterNumber - latest data for dashboard/Meter Diagnostics.
+ * Energy data routes - live PZEM data from ESP32.
+ * The deployed server (render.yaml) keeps users and purchases in MongoDB; the readings
+ * handled here are written as JSON files under server/data/energy, which do not
+ * survive a redeploy on Render.
+ * GET /api/energy-data/:meterNumber - latest data (and loop() latency summary) for dashboard/Meter Diagnostics.
  * POST /api/energy-data - receive data from ESP32 (optional, can use backend on 3000).
+ * POST /api/energy-data/batch - several readings in one request, per-item status.
+ * POST /api/energy-data/bin - same as batch, compact binary frame (see telemetryFrame.js).
+ * Validation and storage of the readings are in energyReadings.js.
  */
 import express from 'express';
 import fs from 'fs';
 import path from 'path';
 import { fileURLToPath } from 'url';
+import { decodeTelemetryFrame, UnsupportedFrameVersionError } from '../telemetryFrame.js';
+import { BATCH_MAX_ITEMS, fileReadingStore, postBatch, postReading, storeReadings } from '../energyReadings.js';
 
 const __dirname = path.dirname(fileURLToPath(import.meta.url));
 const router = express.Router();
@@ -18,38 +26,114 @@ if (!fs.existsSync(dataDir)) {
 
 const getTimestamp = () => new Date().toISOString();
 
-const saveDataToFile = (data) => {
-  const timestamp = new Date().toISOString().replace(/:/g, '-');
-  const filename = `energy_data_${timestamp}.json`;
-  const filepath = path.join(dataDir, filename);
-  fs.writeFileSync(filepath, JSON.stringify(data, null, 2));
-  return filepath;
+const readingStore = fileReadingStore(dataDir);
+
+/**
+ * Client identity per meter, sent by the binary route only until we have it.
+ * Kept in memory and in identity_<meterNumber>.json so it survives restarts.
+ */
+const identities = new Map();
+
+const identityPath = (meterNumber) => path.join(dataDir, `identity_${meterNumber}.json`);
+
+const getIdentity = (meterNumber) => {
+  if (!identities.has(meterNumber)) {
+    const filepath = identityPath(meterNumber);
+    if (!fs.existsSync(filepath)) return null;
+    identities.set(meterNumber, JSON.parse(fs.readFileSync(filepath, 'utf8')));
+  }
+  return identities.get(meterNumber);
+};
+
+const saveIdentity = (meterNumber, identity) => {
+  identities.set(meterNumber, identity);
+  fs.writeFileSync(identityPath(meterNumber), JSON.stringify(identity, null, 2));
+};
+
+/** Latest loop() latency summary per meter (binary frames only), latency_<meterNumber>.json */
+const latencyPath = (meterNumber) => path.join(dataDir, `latency_${meterNumber}.json`);
+
+const saveLatency = (meterNumber, latency) => {
+  fs.writeFileSync(latencyPath(meterNumber), JSON.stringify({ ...latency, receivedAt: getTimestamp() }, null, 2));
+};
+
+const getLatency = (meterNumber) => {
+  const filepath = latencyPath(meterNumber);
+  return fs.existsSync(filepath) ? JSON.parse(fs.readFileSync(filepath, 'utf8')) : null;
 };
 
 /** POST /api/energy-data - receive from ESP32 */
-router.post('/energy-data', (req, res) => {
+router.post('/energy-data', async (req, res) => {
+  try {
+    const { status, body } = await postReading(readingStore, req.body);
+    return res.status(status).json(body);
+  } catch (err) {
+    console.error('Energy data POST error:', err);
+    return res.status(500).json({ success: false, error: 'Internal server error' });
+  }
+});
+
+/**
+ * POST /api/energy-data/batch - several readings from one ESP32 in one request.
+ * Body: { meterNumber, token, clientName, ..., readings: [ { ...reading }, ... ] }
+ * Top-level fields are defaults for every reading; a reading may override them (e.g. token).
+ * Readings are validated one by one: valid ones are stored even if others are rejected.
+ * Response: { success, accepted, rejected, results: [ { index, status, error? } ] }
+ */
+router.post('/energy-data/batch', async (req, res) => {
   try {
-    const data = req.body;
-    if (!data.meterNumber || !data.token) {
-      return res.status(400).json({ success: false, error: 'meterNumber and token required' });
+    const { status, body } = await postBatch(readingStore, req.body);
+    return res.status(status).json(body);
+  } catch (err) {
+    console.error('Energy data batch POST error:', err);
+    return res.status(500).json({ success: false, error: 'Internal server error' });
+  }
+});
+
+/**
+ * POST /api/energy-data/bin - binary frame (Content-Type: application/octet-stream).
+ * Decoded readings are stored exactly like a JSON batch and get the same response.
+ * The frame carries the client identity only until the server has it: 409 asks the
+ * device to include it again (e.g. after the data directory was wiped); 415 says the
+ * frame version is newer than this server decodes.
+ */
+router.post('/energy-data/bin', express.raw({ type: 'application/octet-stream', limit: '64kb' }), async (req, res) => {
+  let frame;
+  try {
+    frame = decodeTelemetryFrame(req.body);
+  } catch (err) {
+    if (err instanceof UnsupportedFrameVersionError) {
+      // The device steps down to an older version (or to /energy-data/batch) and resends
+      return res.status(415).json({ success: false, error: err.message, supportedVersions: err.supported });
+    }
+    return res.status(400).json({ success: false, error: err.message });
+  }
+  try {
+    const { meterNumber, identity, readings, latency } = frame;
+    if (readings.length === 0) {
+      return res.status(400).json({ success: false, error: 'frame contains no readings' });
     }
-    // Accept 11 or 13-digit meter numbers
-    if (!/^\d{11}$/.test(data.meterNumber) && !/^\d{13}$/.test(data.meterNumber)) {
+    if (readings.length > BATCH_MAX_ITEMS) {
+      return res.status(413).json({ success: false, error: `at most ${BATCH_MAX_ITEMS} readings per batch` });
+    }
+    if (!/^\d{11}$/.test(meterNumber) && !/^\d{13}$/.test(meterNumber)) {
       return res.status(400).json({ success: false, error: 'meterNumber must be 11 or 13 digits' });
     }
-    // Token: accept any non-empty alphanumeric string (20-digit decimal from server, or legacy formats)
-    if (typeof data.token !== 'string' || data.token.trim().length === 0) {
-      return res.status(400).json({ success: false, error: 'token must be a non-empty string' });
+    if (identity) {
+      saveIdentity(meterNumber, identity);
+    }
+    if (latency) {
+      saveLatency(meterNumber, latency);
     }
-    const enriched = { ...data, serverTimestamp: getTimestamp(), receivedAt: Date.now() };
-    saveDataToFile(enriched);
-    return res.status(200).json({
-      success: true,
-      message: 'Energy data received',
-      data: { meterNumber: data.meterNumber, token: data.token, remainingKwh: data.remainingKwh, receivedAt: enriched.serverTimestamp },
-    });
+    const known = getIdentity(meterNumber);
+    if (!known) {
+      return res.status(409).json({ success: false, error: 'identity required' });
+    }
+    const shared = { meterNumber, clientName: known.clientName, clientPhone: known.clientPhone };
+    if (known.clientTIN) shared.clientTIN = known.clientTIN;
+    return res.status(200).json(await storeReadings(readingStore, readings, shared));
   } catch (err) {
-    console.error('Energy data POST error:', err);
+    console.error('Energy data binary POST error:', err);
     return res.status(500).json({ success: false, error: 'Internal server error' });
   }
 });
@@ -66,7 +150,7 @@ router.get('/energy-data/:meterNumber', (req, res) => {
       const filepath = path.join(dataDir, file);
       const fileData = JSON.parse(fs.readFileSync(filepath, 'utf8'));
       if (fileData.meterNumber === meterNumber) {
-        return res.status(200).json({ success: true, data: fileData });
+        return res.status(200).json({ success: true, data: fileData, latency: getLatency(meterNumber) });
       }
     }
     return res.status(404).json({ success: false, error: 'No data found for this meter' });
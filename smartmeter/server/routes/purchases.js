@@ -1,6 +1,8 @@
 import express from 'express';
 import db from '../database.js';
 import { verifyToken } from './auth.js';
+import { pushTokenToMeter } from '../meterSocket.js';
+import { encodeCryptoToken, meterTokenKey, MAX_DECI_KWH, MAX_SEQ } from '../cryptoToken.js';
 
 const router = express.Router();
 
@@ -21,9 +23,25 @@ function generateRechargeCode() {
   return `${seg()}-${seg()}`;
 }
 
-function generateTokenAndCode() {
+// A crypto token the meter verifies by itself (typed on the keypad with no network) when this
+// server has METER_TOKEN_SECRET and the amount fits one token; otherwise a random token that
+// only works through the server. kwhAmount is what the token carries (0.1 kWh steps).
+async function generateTokenAndCode(meterNumber, kwhAmount) {
+  const key = meterTokenKey(meterNumber);
+  const deciKwh = Math.round(kwhAmount * 10);
+  if (key && deciKwh >= 1 && deciKwh <= MAX_DECI_KWH) {
+    const seq = await db.nextTokenSeq(meterNumber);
+    if (seq && seq <= MAX_SEQ) {
+      return {
+        tokenNumber: encodeCryptoToken(key, meterNumber, seq, deciKwh),
+        kwhAmount: deciKwh / 10,
+        rechargeCode: generateRechargeCode(),
+      };
+    }
+  }
   return {
     tokenNumber: generate20DigitToken(),
+    kwhAmount,
     rechargeCode: generateRechargeCode(),
   };
 }
@@ -38,15 +56,13 @@ router.post('/buy', verifyToken, async (req, res) => {
       return res.status(400).json({ error: 'Missing required fields' });
     }
 
-    // Calculate kWh (1 kWh = 125 RWF)
-    const kwhAmount = parseFloat((amountRWF / 125).toFixed(2));
-
-    // Generate token and code
-    const { tokenNumber, rechargeCode } = generateTokenAndCode();
-
-    // Create meter if needed
+    // Create meter if needed (it holds the crypto token sequence)
     await db.createMeter(userId, meterNumber);
 
+    // Calculate kWh (1 kWh = 125 RWF), then generate token and code
+    const { tokenNumber, kwhAmount, rechargeCode } =
+      await generateTokenAndCode(meterNumber, parseFloat((amountRWF / 125).toFixed(2)));
+
     // Create purchase with PENDING status — device must confirm receipt
     const purchase = await db.createPurchase(
       userId,
@@ -60,6 +76,9 @@ router.post('/buy', verifyToken, async (req, res) => {
       'PENDING'
     );
 
+    // Deliver to the meter right away if it is online; otherwise it gets it on reconnect or poll
+    pushTokenToMeter(purchase);
+
     res.json({
       success: true,
       purchase: {
@@ -158,7 +177,7 @@ router.get('/meters', verifyToken, async (req, res) => {
 
 /**
  * GET /purchases/pending-token/:meterNumber
- * ESP32 polls this every 10s to receive a freshly purchased token.
+ * ESP32 polls this (every 30s) only while its WebSocket push channel is down.
  * Returns the most recent PENDING purchase for this meter.
  */
 router.get('/pending-token/:meterNumber', async (req, res) => {
@@ -0,0 +1,28 @@
+/**
+ * Prints a meter's credentials for include/secrets.h on the device: METER_SOCKET_KEY (token push
+ * channel, from the server's METER_SOCKET_SECRET) and METER_TOKEN_KEY (offline crypto tokens, from
+ * METER_TOKEN_SECRET). Secrets come from .env or the environment; one that is not set is skipped.
+ *
+ *   node server/scripts/meterKey.js 0215002079873
+ */
+import dotenv from 'dotenv';
+import { meterSocketKey } from '../meterSocket.js';
+import { meterTokenKey } from '../cryptoToken.js';
+
+dotenv.config();
+
+const meterNumber = process.argv[2] || '';
+if (!/^\d{13}$/.test(meterNumber)) {
+  console.error('usage: node server/scripts/meterKey.js <13-digit meter number>');
+  process.exit(1);
+}
+const socketKey = meterSocketKey(meterNumber);
+const tokenKey = meterTokenKey(meterNumber);
+if (!socketKey && !tokenKey) {
+  console.error('neither METER_SOCKET_SECRET nor METER_TOKEN_SECRET is set');
+  process.exit(1);
+}
+if (socketKey) console.log(`#define METER_SOCKET_KEY "${socketKey}"`);
+else console.error('METER_SOCKET_SECRET is not set - no push channel key');
+if (tokenKey) console.log(`#define METER_TOKEN_KEY "${tokenKey}"`);
+else console.error('METER_TOKEN_SECRET is not set - no crypto token key');
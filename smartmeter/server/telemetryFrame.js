@@ -0,0 +1,194 @@
+/**
+ * Decoder for the ESP32 binary telemetry frame (firmware: include/telemetry_codec.h).
+ * All integers little-endian; BCD digits two per byte, high nibble first, 0xF = padding.
+ *
+ *   Frame   := 'S' 'M' version meter_bcd[7] Block*
+ *   0x01 IDENTITY  len name len tin len phone
+ *   0x02 SESSION   token_bcd[10]
+ *   0x03 READING   40 bytes
+ *   0x04 LATENCY   passes u32, p50/p99/max us u32, worst run us u32, len worst_task[len]  (v2)
+ *   0x05 WINDOW    88 bytes: READING with min/max/mean/p95/stddev of V, I, P, PF since the last one  (v3)
+ */
+
+export const FRAME_VERSION = 3;
+const FRAME_VERSION_MIN = 1;
+
+/** A well-formed frame of a version this server does not decode; the route answers 415. */
+export class UnsupportedFrameVersionError extends Error {
+  constructor(version) {
+    super(`unsupported frame version ${version}`);
+    this.version = version;
+    this.supported = { min: FRAME_VERSION_MIN, max: FRAME_VERSION };
+  }
+}
+
+const HEADER_SIZE = 10;
+const READING_SIZE = 40;
+const WINDOW_SIZE = 88;
+const SESSION_SIZE = 10;
+const BLOCK_IDENTITY = 0x01;
+const BLOCK_SESSION = 0x02;
+const BLOCK_READING = 0x03;
+const BLOCK_LATENCY = 0x04;
+const BLOCK_WINDOW = 0x05;
+const LATENCY_FIXED_SIZE = 20;
+const FLAG_SENSOR_VALID = 0x01;
+
+const unpackDigits = (buf, start, len) => {
+  let out = '';
+  for (let i = 0; i < len * 2; i++) {
+    const byte = buf[start + (i >> 1)];
+    const d = (i & 1) ? (byte & 0x0f) : (byte >> 4);
+    if (d > 9) break;
+    out += d;
+  }
+  return out;
+};
+
+/** Local epoch seconds -> "YYYY-MM-DDTHH:MM:SS", same as the firmware's formatLocalTimestamp() */
+const formatLocalTimestamp = (localEpoch) => new Date(localEpoch * 1000).toISOString().slice(0, 19);
+
+const setTimestamp = (reading, epoch, uptimeMs) => {
+  if (epoch !== 0) {
+    reading.timestamp = epoch * 1000;
+    reading.timestampFormatted = formatLocalTimestamp(epoch);
+  } else {
+    reading.timestamp = uptimeMs;  // same fallback as the JSON path
+    reading.timestampFormatted = '1970-01-01T00:00:00';
+  }
+};
+
+const decodeReading = (buf, o) => {
+  const epoch = buf.readUInt32LE(o);
+  const uptimeMs = buf.readUInt32LE(o + 4);
+  const flags = buf[o + 10];
+  const reading = {
+    remainingKwh: buf.readUInt32LE(o + 12) / 1e6,
+    consumedKwh: buf.readUInt32LE(o + 16) / 1e6,
+    sessionDuration: buf.readUInt32LE(o + 32),
+    bootSeq: buf.readUInt16LE(o + 8),
+    uptimeMs,
+  };
+  if (flags & FLAG_SENSOR_VALID) {
+    reading.voltage = buf.readUInt16LE(o + 36) / 10;
+    reading.current = buf.readUInt32LE(o + 24) / 1000;
+    reading.power = buf.readUInt32LE(o + 28) / 10;
+    reading.totalEnergy = buf.readUInt32LE(o + 20) / 1000;
+    reading.frequency = buf.readUInt16LE(o + 38) / 10;
+    reading.powerFactor = buf[o + 11] / 100;
+  }
+  setTimestamp(reading, epoch, uptimeMs);
+  return reading;
+};
+
+/** Five statistics in firmware order (TWIN_*), scaled to the reading's units */
+const decodeStats = (read, scale) => {
+  const [min, max, mean, p95, std] = [0, 1, 2, 3, 4].map((i) => read(i) / scale);
+  return { min, max, mean, p95, std };
+};
+
+/**
+ * WINDOW block: voltage/current/power/powerFactor are the window means, so consumers of
+ * plain readings keep working (null when the sensor was not answering at capture, like
+ * the missing fields of a READING); reading.window has the samples, span and all statistics.
+ */
+const decodeWindow = (buf, o) => {
+  const epoch = buf.readUInt32LE(o);
+  const uptimeMs = buf.readUInt32LE(o + 4);
+  const flags = buf[o + 10];
+  const reading = {
+    remainingKwh: buf.readUInt32LE(o + 16) / 1e6,
+    consumedKwh: buf.readUInt32LE(o + 20) / 1e6,
+    sessionDuration: buf.readUInt32LE(o + 28),
+    bootSeq: buf.readUInt16LE(o + 8),
+    uptimeMs,
+  };
+  const window = {
+    samples: buf.readUInt16LE(o + 34),
+    spanS: buf.readUInt16LE(o + 36),
+    voltage: decodeStats((i) => buf.readUInt16LE(o + 38 + 2 * i), 10),
+    current: decodeStats((i) => buf.readUInt32LE(o + 48 + 4 * i), 1000),
+    power: decodeStats((i) => buf.readUInt32LE(o + 68 + 4 * i), 10),
+    powerFactor: decodeStats((i) => buf[o + 11 + i], 100),
+  };
+  const sensorValid = (flags & FLAG_SENSOR_VALID) !== 0;
+  reading.voltage = sensorValid ? window.voltage.mean : null;
+  reading.current = sensorValid ? window.current.mean : null;
+  reading.power = sensorValid ? window.power.mean : null;
+  reading.powerFactor = sensorValid ? window.powerFactor.mean : null;
+  if (sensorValid) {
+    reading.totalEnergy = buf.readUInt32LE(o + 24) / 1000;
+    reading.frequency = buf.readUInt16LE(o + 32) / 10;
+  }
+  reading.window = window;
+  setTimestamp(reading, epoch, uptimeMs);
+  return reading;
+};
+
+/**
+ * Decode a frame. Returns { meterNumber, identity, readings, latency } where identity and
+ * latency are null when the frame carries none and each reading has the token of the
+ * SESSION block before it (and a window when it came in a WINDOW block). latency is the device's loop() summary since boot (us).
+ * Throws an Error with a client-facing message on malformed input, an
+ * UnsupportedFrameVersionError when the version is outside FRAME_VERSION_MIN..FRAME_VERSION.
+ */
+export const decodeTelemetryFrame = (buf) => {
+  if (!Buffer.isBuffer(buf) || buf.length < HEADER_SIZE || buf[0] !== 0x53 || buf[1] !== 0x4d) {
+    throw new Error('not a telemetry frame');
+  }
+  const version = buf[2];
+  if (version < FRAME_VERSION_MIN || version > FRAME_VERSION) {
+    throw new UnsupportedFrameVersionError(version);
+  }
+  const meterNumber = unpackDigits(buf, 3, 7);
+  let identity = null;
+  let latency = null;
+  let token = null;
+  const readings = [];
+
+  let o = HEADER_SIZE;
+  const need = (n) => {
+    if (o + n > buf.length) throw new Error(`truncated frame at byte ${o}`);
+  };
+  const readString = () => {
+    need(1);
+    const len = buf[o++];
+    need(len);
+    const s = buf.toString('utf8', o, o + len);
+    o += len;
+    return s;
+  };
+
+  while (o < buf.length) {
+    const type = buf[o++];
+    if (type === BLOCK_IDENTITY) {
+      identity = { clientName: readString(), clientTIN: readString(), clientPhone: readString() };
+    } else if (type === BLOCK_SESSION) {
+      need(SESSION_SIZE);
+      token = unpackDigits(buf, o, SESSION_SIZE);
+      o += SESSION_SIZE;
+    } else if (type === BLOCK_READING) {
+      need(READING_SIZE);
+      readings.push({ token, ...decodeReading(buf, o) });
+      o += READING_SIZE;
+    } else if (type === BLOCK_LATENCY && version >= 2) {
+      need(LATENCY_FIXED_SIZE);
+      latency = {
+        passes: buf.readUInt32LE(o),
+        p50Us: buf.readUInt32LE(o + 4),
+        p99Us: buf.readUInt32LE(o + 8),
+        maxUs: buf.readUInt32LE(o + 12),
+        worstRunUs: buf.readUInt32LE(o + 16),
+      };
+      o += LATENCY_FIXED_SIZE;
+      latency.worstTask = readString();
+    } else if (type === BLOCK_WINDOW && version >= 3) {
+      need(WINDOW_SIZE);
+      readings.push({ token, ...decodeWindow(buf, o) });
+      o += WINDOW_SIZE;
+    } else {
+      throw new Error(`unknown block type ${type} at byte ${o - 1}`);
+    }
+  }
+  return { meterNumber, identity, readings, latency };
+};
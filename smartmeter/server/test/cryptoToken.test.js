@@ -0,0 +1,55 @@
+/**
+ * The server's token encoder against tokens from the firmware codec (tools/tokengen, which
+ * links src/crypto_token.cpp): what the server issues is what the meter accepts.
+ * Run: npm run test:server
+ */
+import { test } from 'node:test';
+import assert from 'node:assert/strict';
+import { encodeCryptoToken, decodeCryptoToken, meterTokenKey } from '../cryptoToken.js';
+
+// tokengen encode <key> <meter> <seq> <kWh>
+const VECTORS = [
+  ['00112233445566778899aabbccddeeff', '0215002079873', 1, 50, '01286791123868515499'],
+  ['00112233445566778899aabbccddeeff', '0215002079873', 2, 125, '15748738583651070995'],
+  ['00112233445566778899aabbccddeeff', '0215002079873', 65535, 16383, '04083809692569922963'],
+  ['a1b2c3d4e5f60718293a4b5c6d7e8f90', '0299000000042', 300, 1, '00909798123272949999'],
+  ['a1b2c3d4e5f60718293a4b5c6d7e8f90', '0299000000042', 7, 400, '04822413255107149527'],
+];
+
+test('encode matches the firmware codec', () => {
+  for (const [key, meter, seq, deciKwh, token] of VECTORS) {
+    assert.equal(encodeCryptoToken(key, meter, seq, deciKwh), token);
+  }
+});
+
+test('decode round-trips and rejects other meters, keys and typos', () => {
+  for (const [key, meter, seq, deciKwh, token] of VECTORS) {
+    assert.deepEqual(decodeCryptoToken(key, meter, token), { seq, deciKwh });
+    assert.equal(decodeCryptoToken(key, '0215002079874', token), null);
+    assert.equal(decodeCryptoToken('ffeeddccbbaa99887766554433221100', meter, token), null);
+    const typo = token.slice(0, 19) + String((Number(token[19]) + 1) % 10);
+    assert.equal(decodeCryptoToken(key, meter, typo), null);
+  }
+  assert.equal(decodeCryptoToken(VECTORS[0][0], VECTORS[0][1], '99999999999999999999'), null); // above 2^64
+});
+
+test('out-of-range fields are refused', () => {
+  const [key, meter] = VECTORS[0];
+  assert.throws(() => encodeCryptoToken(key, meter, 0, 10), RangeError);
+  assert.throws(() => encodeCryptoToken(key, meter, 65536, 10), RangeError);
+  assert.throws(() => encodeCryptoToken(key, meter, 1, 0), RangeError);
+  assert.throws(() => encodeCryptoToken(key, meter, 1, 16384), RangeError);
+  assert.throws(() => encodeCryptoToken('0011', meter, 1, 10));
+});
+
+test('per-meter key comes from METER_TOKEN_SECRET', () => {
+  const saved = process.env.METER_TOKEN_SECRET;
+  delete process.env.METER_TOKEN_SECRET;
+  assert.equal(meterTokenKey('0215002079873'), null);
+  process.env.METER_TOKEN_SECRET = 'test-secret';
+  const a = meterTokenKey('0215002079873');
+  assert.match(a, /^[0-9a-f]{32}$/);
+  assert.notEqual(meterTokenKey('0215002079874'), a);
+  if (saved === undefined) delete process.env.METER_TOKEN_SECRET;
+  else process.env.METER_TOKEN_SECRET = saved;
+});
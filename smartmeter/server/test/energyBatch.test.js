@@ -0,0 +1,221 @@
+/**
+ * POST /energy-data/batch against one POST /energy-data per reading: readings/sec on the
+ * server and device airtime per reading, from a local http.Server running energyReadings.js
+ * with a stand-in for the EnergyData model (one round trip of DB_RTT_MS per create or insertMany).
+ *
+ * Each simulated meter sends its readings one request at a time on a keep-alive connection,
+ * with the firmware's headers and body shapes (AsyncHttp, postTelemetryRecord/Batch in main.cpp).
+ * Airtime is modelled from the bytes each request put on the socket: TLS record and TCP/IP +
+ * 802.11 headers per segment, a TCP ACK per segment, at the lowest 802.11n rate.
+ * Run: npm run test:server
+ */
+import { test } from 'node:test';
+import assert from 'node:assert/strict';
+import http from 'http';
+import { performance } from 'perf_hooks';
+import { postBatch, postReading } from '../energyReadings.js';
+
+const METERS = 16;
+const READINGS_PER_METER = 64;
+const BATCH = 8;                 // TELEMETRY_BATCH_MAX, api_schedule.h
+const DB_RTT_MS = 2;             // stand-in for a MongoDB round trip
+
+const MSS = 1460;
+const TLS_RECORD_BYTES = 29;     // header + explicit nonce + GCM tag
+const SEGMENT_HEADER_BYTES = 40 + 34;   // TCP/IP + 802.11 MAC/LLC
+const ACK_BYTES = 40 + 34;
+const PHY_BPS = 6.5e6;           // 802.11n MCS0, 20 MHz
+const FRAME_OVERHEAD_US = 150;   // preamble, DIFS + mean backoff, SIFS + link-layer ACK
+
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+// ------ Stand-in for models/EnergyData.js ------
+class EnergyDataModel {
+  constructor() {
+    this.docs = [];
+    this.roundTrips = 0;
+  }
+  async create(doc) {
+    await sleep(DB_RTT_MS);
+    this.roundTrips++;
+    this.docs.push(doc);
+    return doc;
+  }
+  async insertMany(docs) {
+    await sleep(DB_RTT_MS);
+    this.roundTrips++;
+    this.docs.push(...docs);
+    return docs;
+  }
+}
+
+const modelStore = (model) => ({
+  save: (reading) => model.create(reading),
+  saveBatch: (readings) => (readings.length > 0 ? model.insertMany(readings) : undefined),
+});
+
+// Body parsing and response headers as express.json() / res.json() would do them
+const startServer = (store) => {
+  const server = http.createServer((req, res) => {
+    const chunks = [];
+    req.on('data', (chunk) => chunks.push(chunk));
+    req.on('end', async () => {
+      const handler = req.url === '/api/energy-data/batch' ? postBatch : req.url === '/api/energy-data' ? postReading : null;
+      if (!handler) return res.writeHead(404).end();
+      const { status, body } = await handler(store, JSON.parse(Buffer.concat(chunks).toString('utf8')));
+      const json = JSON.stringify(body);
+      res.writeHead(status, {
+        'X-Powered-By': 'Express',
+        'Content-Type': 'application/json; charset=utf-8',
+        'Content-Length': Buffer.byteLength(json),
+      });
+      res.end(json);
+    });
+  });
+  return new Promise((resolve) => server.listen(0, '127.0.0.1', () => resolve(server)));
+};
+
+// ------ Readings as the firmware serializes them ------
+const identity = (meterNumber) => ({
+  meterNumber, token: '18886583547834136861', clientName: 'YUMVUHORE', clientTIN: '1200000', clientPhone: '0782946444',
+});
+
+const telemetryFields = (i) => ({
+  remainingKwh: +(39.971 - i * 0.0025).toFixed(4),
+  consumedKwh: +(0.029 + i * 0.0025).toFixed(4),
+  sessionDuration: 120 + 30 * i,
+  voltage: +(231.2 + (i % 7) * 0.3).toFixed(1),
+  current: +(0.12 + (i % 5) * 0.41).toFixed(3),
+  power: +(27.8 + (i % 5) * 94.6).toFixed(1),
+  totalEnergy: +(12.345 + i * 0.0025).toFixed(3),
+  frequency: 50.0 + (i % 3) / 10,
+  powerFactor: 0.95,
+  timestamp: 1771443620000 + 30000 * i,
+  timestampFormatted: new Date(1771443620000 + 30000 * i).toISOString().slice(0, 19),
+});
+
+// One request the way AsyncHttp sends it; resolves with the parsed response
+const post = (port, agent, path, body) => new Promise((resolve, reject) => {
+  const payload = JSON.stringify(body);
+  const req = http.request({
+    port, agent, path, method: 'POST',
+    headers: {
+      'User-Agent': 'SmartMeter-ESP32',
+      Connection: 'keep-alive',
+      'Content-Type': 'application/json',
+      'Content-Length': Buffer.byteLength(payload),
+    },
+  }, (res) => {
+    const chunks = [];
+    res.on('data', (chunk) => chunks.push(chunk));
+    res.on('end', () => resolve({ status: res.statusCode, body: JSON.parse(Buffer.concat(chunks).toString('utf8')) }));
+  });
+  req.on('error', reject);
+  req.end(payload);
+});
+
+// Airtime of one request/response exchange, in µs
+const exchangeAirtimeUs = (requestBytes, responseBytes) => {
+  let bytes = 0;
+  let frames = 0;
+  for (const n of [requestBytes, responseBytes]) {
+    const segments = Math.ceil((n + TLS_RECORD_BYTES) / MSS);
+    bytes += n + TLS_RECORD_BYTES + segments * (SEGMENT_HEADER_BYTES + ACK_BYTES);
+    frames += 2 * segments;
+  }
+  return (bytes * 8 * 1e6) / PHY_BPS + frames * FRAME_OVERHEAD_US;
+};
+
+/**
+ * All meters upload READINGS_PER_METER readings at once, BATCH per request (0 = the single
+ * reading route); returns throughput and per-reading costs
+ */
+const run = async (batch) => {
+  const model = new EnergyDataModel();
+  const server = await startServer(modelStore(model));
+  const { port } = server.address();
+  let requests = 0;
+  let airtimeUs = 0;
+  let wireBytes = 0;
+  let busyMs = 0;
+
+  const meter = async (m) => {
+    const meterNumber = String(215002079000 + m).padStart(13, '0');
+    const agent = new http.Agent({ keepAlive: true, maxSockets: 1 });
+    let socket = null;
+    for (let i = 0; i < READINGS_PER_METER; i += batch || 1) {
+      const body = batch
+        ? { ...identity(meterNumber), readings: Array.from({ length: batch }, (_, k) => telemetryFields(i + k)) }
+        : { ...identity(meterNumber), ...telemetryFields(i) };
+      const written0 = socket ? socket.bytesWritten : 0;
+      const read0 = socket ? socket.bytesRead : 0;
+      const t0 = performance.now();
+      const res = await post(port, agent, batch ? '/api/energy-data/batch' : '/api/energy-data', body);
+      busyMs += performance.now() - t0;
+      assert.equal(res.status, 200);
+      assert.equal(res.body.success, true);
+      socket = socket || Object.values(agent.freeSockets)[0][0];
+      const sent = socket.bytesWritten - written0;
+      const received = socket.bytesRead - read0;
+      wireBytes += sent + received;
+      airtimeUs += exchangeAirtimeUs(sent, received);
+      requests++;
+    }
+    agent.destroy();
+  };
+
+  const t0 = performance.now();
+  await Promise.all(Array.from({ length: METERS }, (_, m) => meter(m)));
+  const elapsedMs = performance.now() - t0;
+  server.close();
+
+  const readings = METERS * READINGS_PER_METER;
+  assert.equal(model.docs.length, readings);
+  return {
+    requests,
+    roundTrips: model.roundTrips,
+    readingsPerSec: (readings * 1000) / elapsedMs,
+    bytesPerReading: wireBytes / readings,
+    airtimeUsPerReading: airtimeUs / readings,
+    busyMsPerReading: busyMs / readings,
+  };
+};
+
+const describe = (name, r) =>
+  `${name}: ${r.readingsPerSec.toFixed(0)} readings/s, ${r.requests} requests, ${r.roundTrips} DB round trips, ` +
+  `${r.bytesPerReading.toFixed(0)} B/reading on the wire, airtime ${r.airtimeUsPerReading.toFixed(0)} us/reading, ` +
+  `device waits ${r.busyMsPerReading.toFixed(2)} ms/reading`;
+
+test('batch of 8 against single posts: readings/sec and device airtime', async (t) => {
+  const single = await run(0);
+  const batched = await run(BATCH);
+  t.diagnostic(describe('single', single));
+  t.diagnostic(describe(`batch ${BATCH}`, batched));
+
+  const readings = METERS * READINGS_PER_METER;
+  assert.equal(single.requests, readings);
+  assert.equal(batched.requests, readings / BATCH);
+  assert.equal(batched.roundTrips, readings / BATCH);
+  // Identity and headers once per 8 readings: well under the single route's bytes and airtime
+  assert.ok(batched.bytesPerReading < single.bytesPerReading * 0.6);
+  assert.ok(batched.airtimeUsPerReading < single.airtimeUsPerReading * 0.5);
+  // One DB round trip and one request per 8 readings; loose, the runner may be loaded
+  assert.ok(batched.readingsPerSec > single.readingsPerSec * 2,
+    `${batched.readingsPerSec.toFixed(0)} vs ${single.readingsPerSec.toFixed(0)} readings/s`);
+});
+
+test('batch results are per reading: one bad reading does not drop the others', async () => {
+  const model = new EnergyDataModel();
+  const meterNumber = '0215002079873';
+  const readings = [telemetryFields(0), { ...telemetryFields(1), token: '' }, telemetryFields(2)];
+  const { status, body } = await postBatch(modelStore(model), { ...identity(meterNumber), readings });
+  assert.equal(status, 200);
+  assert.deepEqual([body.success, body.accepted, body.rejected], [false, 2, 1]);
+  assert.equal(body.results[1].status, 'rejected');
+  assert.equal(model.roundTrips, 1);
+  assert.deepEqual(model.docs.map((d) => d.sessionDuration), [120, 180]);
+  assert.equal(model.docs[0].meterNumber, meterNumber);
+
+  const tooMany = await postBatch(modelStore(model), { ...identity(meterNumber), readings: Array(101).fill({}) });
+  assert.equal(tooMany.status, 413);
+});
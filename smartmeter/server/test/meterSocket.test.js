@@ -0,0 +1,318 @@
+/**
+ * Token channel end to end: purchase -> token on the meter -> confirm -> ack, over the meter
+ * socket and over the HTTP polling fallback, on a local http.Server with an in-memory purchase
+ * store in place of database.js.
+ *
+ * The simulated meter follows the firmware: taskTokenPoll GETs pending-token every
+ * TOKEN_CHECK_INTERVAL_MS (include/api_schedule.h) only while the socket is down, and the socket
+ * is retried every TOKEN_CHANNEL_RECONNECT_MS (include/token_channel.h). Both run TIME_SCALE times
+ * faster than on the device; poll latencies are reported scaled back to device time.
+ * The pending-token and confirm-token handlers answer like routes/purchases.js (express is not
+ * loaded: these tests run without node_modules).
+ * Run: npm run test:server
+ */
+import { test } from 'node:test';
+import assert from 'node:assert/strict';
+import crypto from 'crypto';
+import fs from 'fs';
+import http from 'http';
+import path from 'path';
+import { performance } from 'perf_hooks';
+import { fileURLToPath } from 'url';
+import { attachMeterSocket, meterSocketKey, pushTokenToMeter } from '../meterSocket.js';
+
+const includeDir = path.join(path.dirname(fileURLToPath(import.meta.url)), '..', '..', '..', 'include');
+const firmwareConstant = (file, name) => {
+  const source = fs.readFileSync(path.join(includeDir, file), 'utf8');
+  const match = source.match(new RegExp(`${name}\\s*=?\\s*(\\d+)`));
+  assert.ok(match, `${name} not found in ${file}`);
+  return Number(match[1]);
+};
+
+const TIME_SCALE = 100;
+const POLL_MS = firmwareConstant('api_schedule.h', 'TOKEN_CHECK_INTERVAL_MS') / TIME_SCALE;
+const RECONNECT_MS = firmwareConstant('token_channel.h', 'TOKEN_CHANNEL_RECONNECT_MS') / TIME_SCALE;
+const WINDOW_POLLS = 10;         // run length of each scenario, in poll intervals
+const PURCHASES = 6;
+
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+// ------ Stand-in for database.js: purchases in memory, newest first ------
+class MemoryStore {
+  constructor() {
+    this.purchases = [];
+  }
+  createPurchase(meterNumber, kwhAmount) {
+    const purchase = {
+      _id: crypto.randomBytes(12).toString('hex'),
+      meterNumber,
+      tokenNumber: String(10 ** 19 + crypto.randomInt(2 ** 47)),
+      kwhAmount,
+      rechargeCode: crypto.randomBytes(4).toString('hex'),
+      status: 'PENDING',
+    };
+    this.purchases.unshift(purchase);
+    return purchase;
+  }
+  async getPurchasesByMeterNumber(meterNumber) {
+    return this.purchases.filter((p) => p.meterNumber === meterNumber);
+  }
+  async getPurchaseById(id) {
+    return this.purchases.find((p) => p._id === id) || null;
+  }
+  async updatePurchaseStatus(id, status) {
+    const purchase = await this.getPurchaseById(id);
+    if (purchase) purchase.status = status;
+    return purchase;
+  }
+}
+
+const store = new MemoryStore();
+const httpStats = { polls: 0, confirms: 0 };
+
+const sendJson = (res, body) => {
+  res.writeHead(200, { 'Content-Type': 'application/json' });
+  res.end(JSON.stringify(body));
+};
+
+const server = http.createServer(async (req, res) => {
+  const pending = req.url.match(/^\/api\/purchases\/pending-token\/(\d+)$/);
+  const confirm = req.url.match(/^\/api\/purchases\/confirm-token\/([0-9a-f]+)$/);
+  if (req.method === 'GET' && pending) {
+    httpStats.polls++;
+    const purchase = (await store.getPurchasesByMeterNumber(pending[1])).find((p) => p.status === 'PENDING');
+    if (!purchase) return sendJson(res, { success: true, hasToken: false });
+    return sendJson(res, {
+      success: true,
+      hasToken: true,
+      token: {
+        purchaseId: purchase._id, tokenNumber: purchase.tokenNumber,
+        kwhAmount: purchase.kwhAmount, rechargeCode: purchase.rechargeCode,
+      },
+    });
+  }
+  if (req.method === 'POST' && confirm) {
+    httpStats.confirms++;
+    await store.updatePurchaseStatus(confirm[1], 'DELIVERED');
+    return sendJson(res, { success: true, message: 'Token confirmed as delivered' });
+  }
+  res.writeHead(404).end();
+});
+attachMeterSocket(server, store);
+
+// ------ Simulated meter ------
+const maskedText = (text) => {
+  const payload = Buffer.from(text);
+  assert.ok(payload.length < 126);
+  const mask = crypto.randomBytes(4);
+  const frame = Buffer.alloc(6 + payload.length);
+  frame[0] = 0x81;
+  frame[1] = 0x80 | payload.length;
+  mask.copy(frame, 2);
+  for (let i = 0; i < payload.length; i++) frame[6 + i] = payload[i] ^ mask[i & 3];
+  return frame;
+};
+
+class Meter {
+  constructor(port, meterNumber) {
+    this.port = port;
+    this.meterNumber = meterNumber;
+    this.socket = null;
+    this.applied = new Set();
+    this.acked = new Map();      // purchaseId -> performance.now() of the confirm ack
+    this.connectAttempts = 0;
+    this.running = false;
+  }
+
+  get connected() {
+    return this.socket !== null;
+  }
+
+  start() {
+    this.running = true;
+    this.connect();
+    this.pollTimer = setInterval(() => {
+      if (!this.connected) this.poll().catch(() => {});
+    }, POLL_MS);
+  }
+
+  stop() {
+    this.running = false;
+    clearInterval(this.pollTimer);
+    clearTimeout(this.retryTimer);
+    if (this.socket) this.socket.destroy();
+  }
+
+  retry() {
+    this.socket = null;
+    if (this.running) this.retryTimer = setTimeout(() => this.connect(), RECONNECT_MS);
+  }
+
+  connect() {
+    this.connectAttempts++;
+    const key = meterSocketKey(this.meterNumber) || '';
+    const req = http.request({
+      port: this.port,
+      path: `/api/meter-socket?meter=${this.meterNumber}`,
+      headers: {
+        Connection: 'Upgrade',
+        Upgrade: 'websocket',
+        'Sec-WebSocket-Version': '13',
+        'Sec-WebSocket-Key': crypto.randomBytes(16).toString('base64'),
+        Authorization: `Basic ${Buffer.from(`${this.meterNumber}:${key}`).toString('base64')}`,
+      },
+    });
+    req.on('upgrade', (res, socket, head) => {
+      if (!this.running) return socket.destroy();
+      this.socket = socket;
+      let rx = head;
+      socket.on('data', (chunk) => {
+        rx = Buffer.concat([rx, chunk]);
+        while (rx.length >= 2) {
+          let len = rx[1] & 0x7f;
+          let p = 2;
+          if (len === 126) {
+            if (rx.length < 4) break;
+            len = rx.readUInt16BE(2);
+            p = 4;
+          }
+          if (rx.length < p + len) break;
+          if ((rx[0] & 0x0f) === 0x1) this.onMessage(JSON.parse(rx.subarray(p, p + len).toString('utf8')));
+          rx = rx.subarray(p + len);
+        }
+      });
+      socket.on('close', () => this.retry());
+      socket.on('error', () => {});
+    });
+    req.on('response', (res) => {
+      res.resume();
+      this.retry();
+    });
+    req.on('error', () => this.retry());
+    req.end();
+  }
+
+  onMessage(message) {
+    if (message.type === 'token') {
+      this.applied.add(message.purchaseId);
+      this.socket.write(maskedText(JSON.stringify({ type: 'confirm', purchaseId: message.purchaseId })));
+    } else if (message.type === 'confirmed') {
+      this.acked.set(message.purchaseId, performance.now());
+    }
+  }
+
+  async poll() {
+    const res = await fetch(`http://127.0.0.1:${this.port}/api/purchases/pending-token/${this.meterNumber}`);
+    const body = await res.json();
+    if (!body.hasToken) return;
+    this.applied.add(body.token.purchaseId);
+    const confirm = await fetch(`http://127.0.0.1:${this.port}/api/purchases/confirm-token/${body.token.purchaseId}`,
+      { method: 'POST' });
+    if ((await confirm.json()).success) this.acked.set(body.token.purchaseId, performance.now());
+  }
+}
+
+// ------ Purchases, as POST /buy makes them ------
+const buy = (meterNumber) => {
+  const purchase = store.createPurchase(meterNumber, 5);
+  pushTokenToMeter(purchase);
+  return { id: purchase._id, at: performance.now() };
+};
+
+// PURCHASES purchases spread over the window at a fixed odd phase to the poll timer
+const runWindow = async (meter) => {
+  const bought = [];
+  const polls0 = httpStats.polls;
+  const spacing = (WINDOW_POLLS * POLL_MS) / (PURCHASES + 1);
+  await sleep(spacing);
+  for (let i = 0; i < PURCHASES; i++) {
+    bought.push(buy(meter.meterNumber));
+    await sleep(spacing);
+  }
+  await sleep(2 * POLL_MS);      // the last purchase gets its poll
+  const latencies = bought.map((b) => meter.acked.get(b.id) - b.at);
+  return { bought, latencies, polls: httpStats.polls - polls0 };
+};
+
+const percentile = (values, q) => {
+  const sorted = [...values].sort((a, b) => a - b);
+  return sorted[Math.max(0, Math.ceil(q * sorted.length) - 1)];
+};
+
+let port;
+test.before(async () => {
+  await new Promise((resolve) => server.listen(0, '127.0.0.1', resolve));
+  port = server.address().port;
+});
+test.after(() => server.close());
+
+test('socket up: tokens pushed and acked within milliseconds, no HTTP polls', async (t) => {
+  process.env.METER_SOCKET_SECRET = 'test-secret';
+  const meter = new Meter(port, '0215002079873');
+  // Bought while the meter was offline: pushed when it connects
+  const offline = buy(meter.meterNumber);
+  meter.start();
+  t.after(() => meter.stop());
+  while (!meter.connected) await sleep(1);
+
+  const { bought, latencies, polls } = await runWindow(meter);
+  t.diagnostic(`socket: ${PURCHASES} purchases, purchase->ack p50 ${percentile(latencies, 0.5).toFixed(2)} ms, ` +
+    `max ${Math.max(...latencies).toFixed(2)} ms, ${polls} polls in ${WINDOW_POLLS} poll intervals`);
+
+  assert.ok(meter.acked.has(offline.id), 'pending purchase pushed on connect');
+  assert.equal(polls, 0);
+  assert.equal(meter.connectAttempts, 1);
+  for (const b of bought) assert.equal((await store.getPurchaseById(b.id)).status, 'DELIVERED');
+  // Loopback round trip: far below one device poll interval, even scaled back to device time
+  assert.ok(Math.max(...latencies) < 50, `socket ack took ${Math.max(...latencies)} ms`);
+});
+
+test('socket down: one poll per interval, tokens wait for the next poll', async (t) => {
+  delete process.env.METER_SOCKET_SECRET;    // every upgrade refused, as on a server without the secret
+  const meter = new Meter(port, '0215002079874');
+  meter.start();
+  t.after(() => meter.stop());
+
+  const { bought, latencies, polls } = await runWindow(meter);
+  const windows = WINDOW_POLLS + 2;
+  const device = latencies.map((ms) => (ms * TIME_SCALE) / 1000);
+  t.diagnostic(`polling: ${PURCHASES} purchases, purchase->ack p50 ${percentile(device, 0.5).toFixed(1)} s, ` +
+    `max ${Math.max(...device).toFixed(1)} s (device time), ${polls} polls in ${windows} poll intervals, ` +
+    `${meter.connectAttempts} socket attempts`);
+
+  assert.ok(polls >= windows - 2 && polls <= windows + 1, `${polls} polls in ${windows} intervals`);
+  assert.ok(meter.connectAttempts > 1, 'socket retried');
+  for (const b of bought) assert.equal((await store.getPurchaseById(b.id)).status, 'DELIVERED');
+  // Up to one poll interval (plus timer slack), and on average far behind the socket
+  assert.ok(Math.max(...latencies) < POLL_MS * 1.5, `poll ack took ${Math.max(...latencies)} ms`);
+  assert.ok(percentile(latencies, 0.5) > POLL_MS / 10);
+});
+
+test('socket lost mid-session: polling takes over, push resumes after reconnect', async (t) => {
+  process.env.METER_SOCKET_SECRET = 'test-secret';
+  const meter = new Meter(port, '0215002079875');
+  meter.start();
+  t.after(() => meter.stop());
+  while (!meter.connected) await sleep(1);
+
+  // Server side refuses for a while (secret rotated away), the open socket drops
+  delete process.env.METER_SOCKET_SECRET;
+  const polls0 = httpStats.polls;
+  meter.socket.destroy();
+  await sleep(3 * POLL_MS);
+  const whileDown = buy(meter.meterNumber);
+  await sleep(1.5 * POLL_MS);
+  assert.ok(meter.acked.has(whileDown.id), 'delivered by polling while the socket is down');
+  const downPolls = httpStats.polls - polls0;
+
+  process.env.METER_SOCKET_SECRET = 'test-secret';
+  while (!meter.connected) await sleep(1);
+  const polls1 = httpStats.polls;
+  const afterReconnect = buy(meter.meterNumber);
+  await sleep(3 * POLL_MS);
+  t.diagnostic(`outage: ${downPolls} polls over ~4.5 intervals down, ${httpStats.polls - polls1} over 3 intervals up`);
+
+  assert.ok(downPolls >= 3);
+  assert.equal(httpStats.polls, polls1);
+  assert.ok(meter.acked.get(afterReconnect.id) - afterReconnect.at < 50);
+});
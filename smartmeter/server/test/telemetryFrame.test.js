@@ -0,0 +1,87 @@
+/**
+ * Golden frames from the firmware encoder (test/golden/telemetry, written by
+ * test/test_telemetry_codec on the native env) decoded field by field.
+ * Run: npm run test:server
+ */
+import { test } from 'node:test';
+import assert from 'node:assert/strict';
+import fs from 'fs';
+import path from 'path';
+import { fileURLToPath } from 'url';
+import { decodeTelemetryFrame, FRAME_VERSION, UnsupportedFrameVersionError } from '../telemetryFrame.js';
+
+const goldenDir = path.join(path.dirname(fileURLToPath(import.meta.url)), '..', '..', '..', 'test', 'golden', 'telemetry');
+const golden = (name) => fs.readFileSync(path.join(goldenDir, name));
+
+const TOKEN = '18886583547834136861';
+
+test('readings.bin: identity, session, readings with and without sensor, latency', () => {
+  const frame = decodeTelemetryFrame(golden('readings.bin'));
+  assert.equal(frame.meterNumber, '0215002079873');
+  assert.deepEqual(frame.identity, { clientName: 'YUMVUHORE', clientTIN: '1200000', clientPhone: '0782946444' });
+  assert.deepEqual(frame.latency, {
+    passes: 98765, p50Us: 12, p99Us: 840, maxUs: 15230, worstRunUs: 15230, worstTask: 'telemetry-drain',
+  });
+  assert.deepEqual(frame.readings, [
+    {
+      token: TOKEN, remainingKwh: 39.971, consumedKwh: 0.029, sessionDuration: 120, bootSeq: 7, uptimeMs: 123456,
+      voltage: 232.4, current: 0.12, power: 27.8, totalEnergy: 12.345, frequency: 50.2, powerFactor: 0.95,
+      timestamp: 1771443620000, timestampFormatted: '2026-02-18T19:40:20',
+    },
+    {
+      // sensor silent, clock not synced: no electrical fields, dated from uptime
+      token: TOKEN, remainingKwh: 39.971, consumedKwh: 0.029, sessionDuration: 150, bootSeq: 7, uptimeMs: 153456,
+      timestamp: 153456, timestampFormatted: '1970-01-01T00:00:00',
+    },
+  ]);
+});
+
+test('windows.bin: window statistics, means null without the sensor', () => {
+  const frame = decodeTelemetryFrame(golden('windows.bin'));
+  assert.equal(frame.identity, null);
+  assert.equal(frame.latency, null);
+  const stats = {
+    voltage: { min: 228.1, max: 234.2, mean: 231.8, p95: 233.7, std: 1.2 },
+    current: { min: 0.08, max: 5.12, mean: 1.43, p95: 4.98, std: 1.31 },
+    power: { min: 17, max: 1173, mean: 330.5, p95: 1142, std: 301.2 },
+    powerFactor: { min: 0.88, max: 0.99, mean: 0.95, p95: 0.98, std: 0.03 },
+  };
+  assert.deepEqual(frame.readings, [
+    {
+      token: TOKEN, remainingKwh: 39.971, consumedKwh: 0.029, sessionDuration: 120, bootSeq: 7, uptimeMs: 123456,
+      voltage: 231.8, current: 1.43, power: 330.5, powerFactor: 0.95, totalEnergy: 12.345, frequency: 50.2,
+      window: { samples: 150, spanS: 30, ...stats },
+      timestamp: 1771443620000, timestampFormatted: '2026-02-18T19:40:20',
+    },
+    {
+      token: TOKEN, remainingKwh: 39.971, consumedKwh: 0.029, sessionDuration: 120, bootSeq: 7, uptimeMs: 153456,
+      voltage: null, current: null, power: null, powerFactor: null,
+      window: { samples: 40, spanS: 30, ...stats },
+      timestamp: 1771443650000, timestampFormatted: '2026-02-18T19:40:50',
+    },
+  ]);
+});
+
+test('frames from a newer firmware are refused', () => {
+  const frame = Buffer.from(golden('windows.bin'));
+  frame[2] = FRAME_VERSION + 1;
+  assert.throws(() => decodeTelemetryFrame(frame), UnsupportedFrameVersionError);
+  frame[2] = 0;
+  assert.throws(() => decodeTelemetryFrame(frame), UnsupportedFrameVersionError);
+});
+
+test('fallback_v1.bin: a window record sent as version 1 after a 415', () => {
+  const frame = decodeTelemetryFrame(golden('fallback_v1.bin'));
+  assert.equal(frame.meterNumber, '0215002079873');
+  assert.equal(frame.latency, null);
+  assert.equal(frame.readings.length, 1);
+  assert.equal(frame.readings[0].token, TOKEN);
+  assert.equal(frame.readings[0].window, undefined);
+  assert.equal(frame.readings[0].voltage, 232.4);  // capture-time value, not the window mean
+  assert.equal(frame.readings[0].power, 27.8);
+});
+
+test('truncated frames are refused', () => {
+  const frame = golden('windows.bin');
+  assert.throws(() => decodeTelemetryFrame(frame.subarray(0, frame.length - 1)), /truncated frame/);
+});
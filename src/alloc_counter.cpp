@@ -0,0 +1,138 @@
+/**
+ * alloc_counter.cpp - malloc/calloc/realloc wrappers behind the allocation counter (see alloc_counter.h)
+ */
+#include "alloc_counter.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if ALLOC_COUNTER_ENABLED
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#define ALLOC_ATTR IRAM_ATTR  // malloc may be called while the flash cache is off
+#else
+#include <new>
+#define ALLOC_ATTR
+#endif
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+}
+
+static volatile bool armed = false;
+static AllocCounterStats stats;
+#ifdef ARDUINO
+static void* watched[ALLOC_COUNTER_MAX_TASKS];
+static uint8_t watchedCount = 0;
+#endif
+
+static inline ALLOC_ATTR void countAlloc(size_t size, const void* caller) {
+  if (!armed) return;
+#ifdef ARDUINO
+  void* self = xTaskGetCurrentTaskHandle();
+  bool mine = false;
+  for (uint8_t i = 0; i < watchedCount; i++) mine |= watched[i] == self;
+  if (!mine) return;
+#endif
+  if (stats.count == 0) {
+    stats.firstCaller = caller;
+    stats.firstSize = (uint32_t)size;
+  }
+  stats.count++;
+  stats.bytes += (uint32_t)size;
+  if (size > stats.largest) stats.largest = (uint32_t)size;
+  stats.lastCaller = caller;
+  stats.lastSize = (uint32_t)size;
+}
+
+extern "C" {
+ALLOC_ATTR void* __wrap_malloc(size_t size) {
+  countAlloc(size, __builtin_return_address(0));
+  return __real_malloc(size);
+}
+
+ALLOC_ATTR void* __wrap_calloc(size_t n, size_t size) {
+  countAlloc(n * size, __builtin_return_address(0));
+  return __real_calloc(n, size);
+}
+
+// realloc(NULL, n) is a malloc; shrinking or growing a block is counted as well
+// (String::reserve() grows through it)
+ALLOC_ATTR void* __wrap_realloc(void* ptr, size_t size) {
+  if (size != 0) countAlloc(size, __builtin_return_address(0));
+  return __real_realloc(ptr, size);
+}
+}
+
+#ifndef ARDUINO
+// The host libstdc++ is a shared library whose operator new calls malloc internally,
+// out of reach of --wrap: replace it so C++ allocations are counted too. On the device
+// libstdc++ is linked statically and its malloc calls are already wrapped.
+void* operator new(size_t size) {
+  countAlloc(size, __builtin_return_address(0));
+  void* p = __real_malloc(size ? size : 1);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  countAlloc(size, __builtin_return_address(0));
+  void* p = __real_malloc(size ? size : 1);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+#endif
+
+void allocCounterWatch(void* task) {
+#ifdef ARDUINO
+  if (task == NULL) task = xTaskGetCurrentTaskHandle();
+  for (uint8_t i = 0; i < watchedCount; i++) {
+    if (watched[i] == task) return;
+  }
+  if (watchedCount < ALLOC_COUNTER_MAX_TASKS) watched[watchedCount++] = task;
+#else
+  (void)task;
+#endif
+}
+
+void allocCounterArm() {
+  armed = false;
+  memset(&stats, 0, sizeof(stats));
+  armed = true;
+}
+
+void allocCounterDisarm() {
+  armed = false;
+}
+
+bool allocCounterArmed() {
+  return armed;
+}
+
+AllocCounterStats allocCounterStats() {
+  return stats;
+}
+
+#else  // !ALLOC_COUNTER_ENABLED
+
+void allocCounterWatch(void*) {}
+void allocCounterArm() {}
+void allocCounterDisarm() {}
+bool allocCounterArmed() { return false; }
+
+AllocCounterStats allocCounterStats() {
+  AllocCounterStats s;
+  memset(&s, 0, sizeof(s));
+  return s;
+}
+
+#endif
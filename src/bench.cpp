@@ -0,0 +1,551 @@
+/**
+ * bench.cpp - Fixed-seed micro benchmarks (see bench.h)
+ */
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "config.h"
+#include "hal.h"
+#include "latency_histogram.h"
+#include "metering_core.h"
+#include "persist_journal.h"
+#include "token_store.h"
+#include "crypto_token.h"
+#include "interval_stats.h"
+#include "api_schedule.h"
+#include "telemetry_codec.h"
+
+void BenchRng::digits(char* out, uint8_t n) {
+  for (uint8_t i = 0; i < n; i++) out[i] = (char)('0' + (i == 0 ? 1 + below(9) : below(10)));
+  out[n] = '\0';
+}
+
+BenchRunner::BenchRunner(const char* target) : target_(target), count_(0) {}
+
+bool BenchRunner::add(const char* name, BenchFn fn, void* ctx, uint32_t iters, BenchSetup setup,
+                      BenchTeardown teardown, BenchInfo info) {
+  if (count_ >= BENCH_MAX_CASES || iters == 0) return false;
+  BenchCase& c = cases_[count_++];
+  c.name = name;
+  c.fn = fn;
+  c.ctx = ctx;
+  c.iters = iters;
+  c.setup = setup;
+  c.teardown = teardown;
+  c.info = info;
+  return true;
+}
+
+uint8_t BenchRunner::run(const char* prefix, BenchSink sink, void* sinkCtx) {
+  char line[BENCH_LINE_MAX];
+  size_t prefixLen = strlen(prefix);
+  uint8_t ran = 0;
+  for (uint8_t i = 0; i < count_; i++) {
+    const BenchCase& c = cases_[i];
+    if (strncmp(c.name, prefix, prefixLen) != 0) continue;
+    if (c.setup != NULL && !c.setup(c.ctx)) {
+      snprintf(line, sizeof(line), "{\"bench\":\"%s\",\"target\":\"%s\",\"skipped\":true}", c.name, target_);
+      sink(line, sinkCtx);
+      continue;
+    }
+
+    // Pass 1: whole loop timed, no clock reads inside
+    BenchRng rng;
+    uint32_t check = 0;
+    uint32_t t0 = halMicros();
+    for (uint32_t n = 0; n < c.iters; n++) check = check * 31 + c.fn(c.ctx, rng);
+    uint32_t totalUs = halMicros() - t0;
+
+    // Pass 2: same inputs, each iteration timed
+    LatencyHistogram hist;
+    rng = BenchRng();
+    for (uint32_t n = 0; n < c.iters; n++) {
+      uint32_t s = halMicros();
+      c.fn(c.ctx, rng);
+      hist.record(halMicros() - s);
+    }
+    char extra[BENCH_LINE_MAX / 2] = "";
+    if (c.info != NULL) c.info(c.ctx, extra, sizeof(extra));
+    if (c.teardown != NULL) c.teardown(c.ctx);
+
+    snprintf(line, sizeof(line),
+             "{\"bench\":\"%s\",\"target\":\"%s\",\"seed\":%lu,\"iters\":%lu,\"mean_ns\":%lu,"
+             "\"p50_us\":%lu,\"p99_us\":%lu,\"max_us\":%lu,\"check\":\"%08lx\"%s}",
+             c.name, target_, (unsigned long)BENCH_SEED, (unsigned long)c.iters,
+             (unsigned long)((uint64_t)totalUs * 1000 / c.iters), (unsigned long)hist.percentile(50),
+             (unsigned long)hist.percentile(99), (unsigned long)hist.max(), (unsigned long)check, extra);
+    sink(line, sinkCtx);
+    ran++;
+  }
+  return ran;
+}
+
+// ------ RAM stand-ins for the HAL ------
+// Flash cost is left out on purpose: these cases time the code, not the part.
+
+class RamFlash : public HalFlash {
+ public:
+  RamFlash() : mem_(NULL), size_(0) {}
+  bool alloc(uint32_t size) {
+    mem_ = (uint8_t*)malloc(size);
+    if (mem_ == NULL) return false;
+    size_ = size;
+    memset(mem_, 0xFF, size_);
+    return true;
+  }
+  void release() {
+    free(mem_);
+    mem_ = NULL;
+    size_ = 0;
+  }
+
+  uint32_t size() const override { return size_; }
+  bool read(uint32_t offset, void* buf, size_t len) override {
+    if (offset + len > size_) return false;
+    memcpy(buf, mem_ + offset, len);
+    return true;
+  }
+  bool write(uint32_t offset, const void* buf, size_t len) override {
+    if (offset + len > size_) return false;
+    const uint8_t* src = (const uint8_t*)buf;
+    for (size_t i = 0; i < len; i++) mem_[offset + i] &= src[i];
+    return true;
+  }
+  bool erase(uint32_t offset, size_t len) override {
+    if (offset + len > size_) return false;
+    memset(mem_ + offset, 0xFF, len);
+    return true;
+  }
+  const void* map(uint32_t offset, size_t len) override {
+    return offset + len <= size_ ? mem_ + offset : NULL;
+  }
+  void unmap(const void*) override {}
+
+ private:
+  uint8_t* mem_;
+  uint32_t size_;
+};
+
+class RamStore : public HalStore {
+ public:
+  RamStore() { memset(mem_, 0xFF, sizeof(mem_)); }
+  void read(uint32_t addr, void* buf, size_t len) override {
+    if (addr + len <= sizeof(mem_)) memcpy(buf, mem_ + addr, len);
+  }
+  void write(uint32_t addr, const void* buf, size_t len) override {
+    if (addr + len <= sizeof(mem_)) memcpy(mem_ + addr, buf, len);
+  }
+  bool commit() override { return true; }
+
+ private:
+  uint8_t mem_[EEPROM_SIZE];
+};
+
+// A load drawing 200..2200 W, answering every request by the next period
+class BenchMeter : public HalMeter {
+ public:
+  void reset() {
+    rng_ = BenchRng(BENCH_SEED ^ 0xA5A5A5A5UL);
+    memset(&r_, 0, sizeof(r_));
+    uwh_ = 0;
+    sentMs_ = 0;
+    pending_ = false;
+  }
+  bool request(uint32_t nowMs) override {
+    if (pending_) return false;
+    sentMs_ = nowMs;
+    pending_ = true;
+    return true;
+  }
+  int collect(uint32_t) override {
+    if (!pending_) return PZEM_IDLE;
+    pending_ = false;
+    uint32_t dw = 2000 + rng_.below(20000);
+    uwh_ += (uint64_t)dw * METER_PERIOD_MS / 36;  // 1 dW for 1 ms = 1/36 uWh
+    r_.t_ms = sentMs_;
+    r_.voltage = 220.0f + rng_.below(200) / 10.0f;
+    r_.power_dw = dw;
+    r_.power = dw / 10.0f;
+    r_.pf = 0.95f;
+    r_.current = r_.power / (r_.voltage * r_.pf);
+    r_.frequency = 50.0f;
+    r_.energy_wh = 12345 + (uint32_t)(uwh_ / 1000000);
+    r_.energy_kwh = r_.energy_wh / 1000.0f;
+    return PZEM_OK;
+  }
+  const PzemReading& last() const override { return r_; }
+
+ private:
+  BenchRng rng_;
+  PzemReading r_;
+  uint64_t uwh_;
+  uint32_t sentMs_;
+  bool pending_;
+};
+
+class NullRelay : public HalRelay {
+ public:
+  void set(bool) override {}
+};
+
+// ------ ledger.sample: one trapezoid step + register reconcile (settle() on every reading) ------
+
+struct LedgerBench {
+  EnergyLedger ledger;
+  uint32_t tMs;
+  uint64_t uwh;
+};
+static LedgerBench ledgerBench;
+
+static bool ledgerSetup(void* ctx) {
+  LedgerBench& b = *(LedgerBench*)ctx;
+  b.ledger = EnergyLedger();
+  b.ledger.setMaxGapMs(PZEM_STALE_MS);
+  b.ledger.reset(EnergyLedger::fromKwh(1000000.0f), 0, true);
+  b.tMs = 0;
+  b.uwh = 0;
+  return true;
+}
+
+static uint32_t ledgerSample(void* ctx, BenchRng& rng) {
+  LedgerBench& b = *(LedgerBench*)ctx;
+  uint32_t dw = 2000 + rng.below(20000);
+  b.tMs += METER_PERIOD_MS;
+  b.uwh += (uint64_t)dw * METER_PERIOD_MS / 36;
+  b.ledger.addSample(b.tMs, dw);
+  b.ledger.reconcile((uint32_t)(b.uwh / 1000000));
+  return (uint32_t)b.ledger.consumedUwh();
+}
+
+// ------ metering.period / persist.eeprom: MeteringCore on the EEPROM checkpoint path ------
+
+struct MeteringBench {
+  BenchMeter meter;
+  NullRelay relay;
+  PersistJournal journal;  // never attached: persistence goes to the A/B checkpoints
+  RamStore store;
+  MeteringCore* core;
+  uint32_t nowMs;
+};
+static MeteringBench meteringBench;
+static MeteringBench eepromBench;
+
+static bool meteringSetup(void* ctx) {
+  MeteringBench& b = *(MeteringBench*)ctx;
+  b.meter.reset();
+  b.store = RamStore();
+  b.core = new MeteringCore(b.meter, b.relay, b.journal, b.store);
+  b.nowMs = 1000;
+  b.core->restore(b.nowMs);
+  BillingCommand cmd = {};
+  cmd.kwh = 100000.0f;
+  strcpy(cmd.token, "18886583547834136861");
+  b.core->apply(cmd, b.nowMs);
+  return true;
+}
+
+static void meteringTeardown(void* ctx) {
+  MeteringBench& b = *(MeteringBench*)ctx;
+  delete b.core;
+  b.core = NULL;
+}
+
+// poll + settle, a checkpoint every EEPROM_SAVE_INTERVAL_MS (1 period in 25)
+static uint32_t meteringPeriod(void* ctx, BenchRng&) {
+  MeteringBench& b = *(MeteringBench*)ctx;
+  b.nowMs += METER_PERIOD_MS;
+  bool fresh = b.core->poll(b.nowMs);
+  PzemReading sample;
+  b.core->settle(b.nowMs, fresh, sample);
+  return (uint32_t)b.core->billing().remaining_uwh;
+}
+
+// A top-up: apply() + forced checkpoint (pack, CRC, put, commit)
+static uint32_t eepromCheckpoint(void* ctx, BenchRng& rng) {
+  MeteringBench& b = *(MeteringBench*)ctx;
+  BillingCommand cmd = {};
+  cmd.kwh = (1 + rng.below(500)) / 10.0f;
+  cmd.top_up = true;
+  rng.digits(cmd.token, 20);
+  b.nowMs += METER_PERIOD_MS;
+  b.core->apply(cmd, b.nowMs);
+  return (uint32_t)b.core->ledger().remainingUwh();  // billing() is synced by settle()
+}
+
+// ------ persist.journal: forced journal commits on a two-page RAM partition (rotation included) ------
+
+struct JournalBench {
+  RamFlash flash;
+  PersistJournal* journal;
+  PersistState state;
+  uint32_t nowMs;
+};
+static JournalBench journalBench;
+
+static bool journalSetup(void* ctx) {
+  JournalBench& b = *(JournalBench*)ctx;
+  if (!b.flash.alloc(2 * PJ_PAGE_SIZE)) return false;
+  b.journal = new PersistJournal();
+  b.journal->begin(b.flash, PERSIST_COMMIT_INTERVAL_MS);
+  memset(&b.state, 0, sizeof(b.state));
+  b.state.purchasedUwh = EnergyLedger::fromKwh(1000.0f);
+  b.state.baselineWh = 12345;
+  b.state.haveBaseline = true;
+  strcpy(b.state.token, "18886583547834136861");
+  b.nowMs = 0;
+  return true;
+}
+
+static void journalTeardown(void* ctx) {
+  JournalBench& b = *(JournalBench*)ctx;
+  delete b.journal;
+  b.journal = NULL;
+  b.flash.release();
+}
+
+static uint32_t journalCommit(void* ctx, BenchRng& rng) {
+  JournalBench& b = *(JournalBench*)ctx;
+  b.state.consumedUwh += 1 + rng.below(400000);  // one commit interval of a 0..24 kW load
+  b.nowMs += PERSIST_COMMIT_INTERVAL_MS;
+  b.journal->stage(b.state);
+  b.journal->service(b.nowMs, true);
+  return b.journal->commits();
+}
+
+// ------ token.find.*: binary search over the mapped table (submitToken()), half hits ------
+// 3 tokens is the built-in seed table, 1k a district's offline stock, 100k a whole
+// utility's, each on a partition of whole flash sectors. 100k (1.6 MB) does not fit
+// the device's RAM and is skipped there.
+
+struct TokenBench {
+  uint32_t tokens;
+  RamFlash flash;
+  TokenStore* store;
+  char (*codes)[21];
+};
+static TokenBench tokenBench3 = {3, RamFlash(), NULL, NULL};
+static TokenBench tokenBench1k = {1000, RamFlash(), NULL, NULL};
+static TokenBench tokenBench100k = {100000, RamFlash(), NULL, NULL};
+
+static uint32_t tokenBitmapBytes(uint32_t tokens) { return (tokens + 7) / 8; }
+static uint32_t tokenFlashBytes(uint32_t tokens) {
+  uint32_t used = TS_TABLE_OFFSET + tokens * sizeof(TokenRecord) + tokenBitmapBytes(tokens);
+  return (used + PJ_PAGE_SIZE - 1) / PJ_PAGE_SIZE * PJ_PAGE_SIZE;
+}
+
+static int cmpCode(const void* a, const void* b) {
+  return strcmp((const char*)a, (const char*)b);
+}
+
+static bool tokenSetup(void* ctx) {
+  TokenBench& b = *(TokenBench*)ctx;
+  b.codes = new (std::nothrow) char[b.tokens][21];
+  TokenSeed* seeds = new (std::nothrow) TokenSeed[b.tokens];
+  bool ok = b.codes != NULL && seeds != NULL && b.flash.alloc(tokenFlashBytes(b.tokens));
+  if (ok) {
+    BenchRng rng(BENCH_SEED ^ 0x5A5A5A5AUL);
+    for (uint32_t i = 0; i < b.tokens; i++) rng.digits(b.codes[i], 20);
+    // Sorted seeds: begin() inserts in order, which is quadratic on random input
+    qsort(b.codes, b.tokens, sizeof(b.codes[0]), cmpCode);
+    for (uint32_t i = 0; i < b.tokens; i++) {
+      seeds[i].code = b.codes[i];
+      seeds[i].kwh = (1 + rng.below(250)) / 10.0f;
+    }
+    b.store = new TokenStore();
+    ok = b.store->begin(&b.flash, seeds, b.tokens);
+    if (!ok) delete b.store;  // fell back to a RAM table: not the path being measured
+  }
+  delete[] seeds;
+  if (!ok) {
+    b.store = NULL;
+    b.flash.release();
+    delete[] b.codes;
+    b.codes = NULL;
+  }
+  return ok;
+}
+
+static void tokenTeardown(void* ctx) {
+  TokenBench& b = *(TokenBench*)ctx;
+  delete b.store;
+  b.store = NULL;
+  b.flash.release();
+  delete[] b.codes;
+  b.codes = NULL;
+}
+
+static uint32_t tokenFind(void* ctx, BenchRng& rng) {
+  TokenBench& b = *(TokenBench*)ctx;
+  char miss[21];
+  const char* digits = b.codes[rng.below(b.tokens)];
+  if (rng.below(2)) {
+    rng.digits(miss, 20);
+    digits = miss;
+  }
+  int32_t index = -1;
+  float kwh = 0.0f;
+  TokenLookup r = b.store->find(digits, index, kwh);
+  return (uint32_t)r * 1000 + (uint32_t)(index + 1);
+}
+
+// Table and used bitmap live in flash (mapped); RAM is the TokenStore object
+static void tokenInfo(void* ctx, char* out, size_t len) {
+  TokenBench& b = *(TokenBench*)ctx;
+  snprintf(out, len, ",\"tokens\":%lu,\"table_bytes\":%lu,\"bitmap_bytes\":%lu,\"flash_bytes\":%lu,\"ram_bytes\":%lu",
+           (unsigned long)b.store->count(), (unsigned long)(b.tokens * sizeof(TokenRecord)),
+           (unsigned long)tokenBitmapBytes(b.tokens), (unsigned long)tokenFlashBytes(b.tokens),
+           (unsigned long)sizeof(TokenStore));
+}
+
+// ------ crypto.decode: offline token check for digits not in the table (submitToken()) ------
+
+#define BENCH_CRYPTO_TOKENS  32
+#define BENCH_TOKEN_KEY      "00112233445566778899aabbccddeeff"  // test key, not a meter's
+
+struct CryptoBench {
+  uint8_t key[CRYPTO_TOKEN_KEY_BYTES];
+  char tokens[BENCH_CRYPTO_TOKENS][21];
+};
+static CryptoBench cryptoBench;
+
+static bool cryptoSetup(void* ctx) {
+  CryptoBench& b = *(CryptoBench*)ctx;
+  if (!cryptoTokenParseKey(BENCH_TOKEN_KEY, b.key)) return false;
+  BenchRng rng(BENCH_SEED ^ 0x3C3C3C3CUL);
+  for (uint16_t i = 0; i < BENCH_CRYPTO_TOKENS; i++) {
+    CryptoToken t;
+    t.tokenClass = CRYPTO_TOKEN_CLASS_CREDIT;
+    t.seq = (uint16_t)(i + 1);
+    t.deciKwh = (uint16_t)(1 + rng.below(500));
+    if (!cryptoTokenEncode(b.key, METER_NUMBER, t, b.tokens[i])) return false;
+  }
+  return true;
+}
+
+// Three in four are ours, the rest mistyped/foreign digits
+static uint32_t cryptoDecode(void* ctx, BenchRng& rng) {
+  CryptoBench& b = *(CryptoBench*)ctx;
+  char other[21];
+  const char* digits = b.tokens[rng.below(BENCH_CRYPTO_TOKENS)];
+  if (rng.below(4) == 0) {
+    rng.digits(other, 20);
+    digits = other;
+  }
+  CryptoToken t = {};
+  CryptoTokenResult r = cryptoTokenDecode(b.key, METER_NUMBER, digits, t);
+  return (uint32_t)r * 100000 + t.seq * 1000 + t.deciKwh;
+}
+
+// ------ stats.sample: window statistics of one metering sample (refreshMeteringView()) ------
+
+#define BENCH_STATS_WINDOW  150  // samples per window: 30 s at METER_PERIOD_MS
+
+struct StatsBench {
+  IntervalStats stats;
+  uint32_t n;
+};
+static StatsBench statsBench;
+
+static bool statsSetup(void* ctx) {
+  StatsBench& b = *(StatsBench*)ctx;
+  b.stats.reset(0);
+  b.n = 0;
+  return true;
+}
+
+// Mostly steady load with a step now and then; every BENCH_STATS_WINDOW-th call closes the window
+static uint32_t statsSample(void* ctx, BenchRng& rng) {
+  StatsBench& b = *(StatsBench*)ctx;
+  PzemReading r = {};
+  r.voltage = 225.0f + (float)rng.below(100) / 10.0f;
+  r.current = rng.below(16) == 0 ? 8.0f + (float)rng.below(4000) / 1000.0f : 0.4f + (float)rng.below(100) / 1000.0f;
+  r.pf = 0.85f + (float)rng.below(15) / 100.0f;
+  r.power = r.voltage * r.current * r.pf;
+  b.stats.add(r);
+  if (++b.n % BENCH_STATS_WINDOW != 0) return b.stats.samples();
+  TelemetryWindow w;
+  b.stats.close(b.n * METER_PERIOD_MS, w);
+  return w.power_dw[TWIN_P95] + w.voltage_dv[TWIN_STD];
+}
+
+// ------ telemetry.frame: one /energy-data/bin upload of a full batch (postTelemetryFrame()) ------
+// One session, TELEMETRY_BATCH_MAX readings with their window statistics and the latency
+// summary; the identity block only goes out until the server has it, so it is left out.
+
+struct FrameBench {
+  uint8_t frame[TELEMETRY_FRAME_MAX];
+  TelemetryRecord recs[TELEMETRY_BATCH_MAX];
+  uint32_t bytes;
+  uint32_t frames;
+};
+static FrameBench frameBench;
+
+static bool frameSetup(void* ctx) {
+  FrameBench& b = *(FrameBench*)ctx;
+  b.bytes = 0;
+  b.frames = 0;
+  return true;
+}
+
+static uint32_t telemetryFrame(void* ctx, BenchRng& rng) {
+  FrameBench& b = *(FrameBench*)ctx;
+  uint32_t epoch = 1767225600UL + rng.below(365UL * 86400);
+  for (size_t i = 0; i < TELEMETRY_BATCH_MAX; i++) {
+    TelemetryRecord& r = b.recs[i];
+    memset(&r, 0, sizeof(r));
+    r.epoch = epoch + i * 30;
+    r.uptime_ms = rng.next();
+    r.flags = TLOG_FLAG_TIME_SYNCED | TLOG_FLAG_SENSOR_VALID;
+    r.voltage_dv = 2200 + rng.below(200);
+    r.current_ma = rng.below(20000);
+    r.power_dw = rng.below(48000);
+    r.energy_wh = 12345000 + rng.below(100000);
+    r.frequency_dhz = 495 + rng.below(10);
+    r.pf_pct = rng.below(101);
+    r.remaining_mwh = rng.below(50000000);
+    r.consumed_mwh = rng.below(50000000);
+    r.session_s = rng.below(86400);
+    for (uint8_t k = 0; k < TWIN_STATS; k++) {
+      r.window.voltage_dv[k] = 2200 + rng.below(200);
+      r.window.current_ma[k] = rng.below(20000);
+      r.window.power_dw[k] = rng.below(48000);
+      r.window.pf_pct[k] = rng.below(101);
+    }
+    r.window.samples = BENCH_STATS_WINDOW;
+    r.window.span_s = 30;
+  }
+  TelemetryEncoder enc(b.frame, sizeof(b.frame));
+  enc.begin(METER_NUMBER);
+  enc.addLatency(rng.below(100000), rng.below(1000), rng.below(10000), rng.below(100000), rng.below(100000),
+                 "telemetry-drain");
+  enc.addSession(b.recs[0].token_bcd);
+  for (size_t i = 0; i < TELEMETRY_BATCH_MAX; i++) enc.addReading(b.recs[i], b.recs[i].epoch);
+  b.bytes += enc.size();
+  b.frames++;
+  return enc.overflowed() ? 0 : (uint32_t)enc.size() + b.frame[enc.size() - 1];
+}
+
+// Bytes on the wire per reading, frame overhead included. Compare json.energy_data on the
+// device: the frame also carries the window statistics, which the JSON body never had.
+static void frameInfo(void* ctx, char* out, size_t len) {
+  FrameBench& b = *(FrameBench*)ctx;
+  uint32_t frameBytes = b.frames ? b.bytes / b.frames : 0;
+  snprintf(out, len, ",\"readings\":%u,\"frame_bytes\":%lu,\"bytes_per_reading\":%lu",
+           (unsigned)TELEMETRY_BATCH_MAX, (unsigned long)frameBytes,
+           (unsigned long)((frameBytes + TELEMETRY_BATCH_MAX / 2) / TELEMETRY_BATCH_MAX));
+}
+
+void benchAddCore(BenchRunner& runner) {
+  runner.add("ledger.sample", ledgerSample, &ledgerBench, 20000, ledgerSetup);
+  runner.add("metering.period", meteringPeriod, &meteringBench, 10000, meteringSetup, meteringTeardown);
+  runner.add("persist.eeprom", eepromCheckpoint, &eepromBench, 2000, meteringSetup, meteringTeardown);
+  runner.add("persist.journal", journalCommit, &journalBench, 2000, journalSetup, journalTeardown);
+  runner.add("token.find.3", tokenFind, &tokenBench3, 5000, tokenSetup, tokenTeardown, tokenInfo);
+  runner.add("token.find.1k", tokenFind, &tokenBench1k, 5000, tokenSetup, tokenTeardown, tokenInfo);
+  runner.add("token.find.100k", tokenFind, &tokenBench100k, 5000, tokenSetup, tokenTeardown, tokenInfo);
+  runner.add("crypto.decode", cryptoDecode, &cryptoBench, 2000, cryptoSetup);
+  runner.add("stats.sample", statsSample, &statsBench, 15000, statsSetup);
+  runner.add("telemetry.frame", telemetryFrame, &frameBench, 2000, frameSetup, NULL, frameInfo);
+}
@@ -0,0 +1,87 @@
+/**
+ * billing_checkpoint.cpp - Versioned billing state snapshot (see billing_checkpoint.h)
+ */
+#include "billing_checkpoint.h"
+#include <string.h>
+#include <stddef.h>
+
+// CRC-16/MODBUS
+static uint16_t checkpointCrc(const void* cp, size_t len) {
+  const uint8_t* data = (const uint8_t*)cp;
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (uint8_t b = 0; b < 8; b++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+  }
+  return crc;
+}
+
+uint64_t purchaseIdHash(const char* id) {
+  uint64_t h = 0xCBF29CE484222325ULL;
+  for (; *id; id++) {
+    h ^= (uint8_t)*id;
+    h *= 0x100000001B3ULL;
+  }
+  return h != 0 ? h : 1;
+}
+
+bool purchaseHistoryContains(const PurchaseHistory& h, uint64_t id) {
+  for (int i = 0; i < CHECKPOINT_PURCHASES; i++) {
+    if (h.ids[i] == id) return id != 0;
+  }
+  return false;
+}
+
+void purchaseHistoryAdd(PurchaseHistory& h, uint64_t id) {
+  memmove(&h.ids[1], &h.ids[0], sizeof(h.ids) - sizeof(h.ids[0]));
+  h.ids[0] = id;
+}
+
+void checkpointPack(const PersistState& s, uint32_t seq, BillingCheckpoint& cp) {
+  memset(&cp, 0, sizeof(cp));
+  cp.version = CHECKPOINT_VERSION;
+  cp.flags = s.haveBaseline ? CHECKPOINT_HAVE_BASELINE : 0;
+  cp.seq = seq;
+  cp.purchasedUwh = s.purchasedUwh;
+  cp.consumedUwh = s.consumedUwh;
+  cp.baselineWh = s.baselineWh;
+  memcpy(cp.token, s.token, sizeof(cp.token));
+  cp.replayHighest = s.replay.highest;
+  cp.replaySeen = s.replay.seen;
+  memcpy(cp.purchases, s.purchases.ids, sizeof(cp.purchases));
+  cp.crc = checkpointCrc(&cp, offsetof(BillingCheckpoint, crc));
+}
+
+bool checkpointUnpack(const BillingCheckpoint& cp, PersistState& s) {
+  if (cp.version != CHECKPOINT_VERSION || cp.crc != checkpointCrc(&cp, offsetof(BillingCheckpoint, crc))) return false;
+  if (cp.purchasedUwh < 0 || cp.consumedUwh < 0) return false;
+  s.purchasedUwh = cp.purchasedUwh;
+  s.consumedUwh = cp.consumedUwh;
+  s.baselineWh = cp.baselineWh;
+  s.haveBaseline = (cp.flags & CHECKPOINT_HAVE_BASELINE) != 0;
+  memcpy(s.token, cp.token, sizeof(cp.token));
+  s.token[sizeof(cp.token)] = '\0';
+  s.replay.highest = cp.replayHighest;
+  s.replay.seen = cp.replaySeen;
+  memcpy(s.purchases.ids, cp.purchases, sizeof(cp.purchases));
+  return true;
+}
+
+bool checkpointUnpackV2(const BillingCheckpointV2& cp, PersistState& s) {
+  if (cp.version < 1 || cp.version > 2 || cp.crc != checkpointCrc(&cp, offsetof(BillingCheckpointV2, crc))) {
+    return false;
+  }
+  if (cp.purchasedUwh < 0 || cp.consumedUwh < 0) return false;
+  s.purchasedUwh = cp.purchasedUwh;
+  s.consumedUwh = cp.consumedUwh;
+  s.baselineWh = cp.baselineWh;
+  s.haveBaseline = (cp.flags & CHECKPOINT_HAVE_BASELINE) != 0;
+  memcpy(s.token, cp.token, sizeof(cp.token));
+  s.token[sizeof(cp.token)] = '\0';
+  s.replay.highest = cp.version >= 2 ? cp.replayHighest : 0;
+  s.replay.seen = cp.version >= 2 ? cp.replaySeen : 0;
+  memset(&s.purchases, 0, sizeof(s.purchases));
+  return true;
+}
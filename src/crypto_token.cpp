@@ -0,0 +1,156 @@
+/**
+ * crypto_token.cpp - Offline credit token codec (see crypto_token.h)
+ */
+#include "crypto_token.h"
+#include <string.h>
+
+#define MAC_BITS   30
+#define DATA_BITS  34
+#define MAC_MASK   ((1ULL << MAC_BITS) - 1)
+#define DATA_MASK  ((1ULL << DATA_BITS) - 1)
+#define KEYSTREAM_DOMAIN  0x4B53  // "KS": separates the keystream from the MAC input
+
+// ------ SipHash-2-4 ------
+
+static inline uint64_t rotl(uint64_t x, int b) { return (x << b) | (x >> (64 - b)); }
+
+static inline uint64_t readLe64(const uint8_t* p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+  return v;
+}
+
+#define SIPROUND                                                   \
+  do {                                                             \
+    v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);      \
+    v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;                         \
+    v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;                         \
+    v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);      \
+  } while (0)
+
+static uint64_t siphash24(const uint8_t key[16], const uint8_t* in, size_t len) {
+  uint64_t k0 = readLe64(key), k1 = readLe64(key + 8);
+  uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+  uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+  uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+  uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+  size_t full = len & ~(size_t)7;
+  for (size_t i = 0; i < full; i += 8) {
+    uint64_t m = readLe64(in + i);
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+  }
+  uint64_t b = (uint64_t)len << 56;
+  for (size_t i = full; i < len; i++) b |= (uint64_t)in[i] << (8 * (i - full));
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// ------ Token block ------
+
+// MAC over meter number | data (big-endian, 5 bytes)
+static uint32_t tokenMac(const uint8_t* key, const char* meterNumber, uint64_t data) {
+  uint8_t msg[40];
+  size_t n = strlen(meterNumber);
+  if (n > sizeof(msg) - 6) n = sizeof(msg) - 6;
+  memcpy(msg, meterNumber, n);
+  msg[n++] = '|';
+  for (int i = 4; i >= 0; i--) msg[n++] = (uint8_t)(data >> (8 * i));
+  return (uint32_t)(siphash24(key, msg, n) & MAC_MASK);
+}
+
+static uint64_t keystream(const uint8_t* key, uint32_t mac) {
+  uint8_t msg[6] = {(uint8_t)(KEYSTREAM_DOMAIN >> 8), (uint8_t)KEYSTREAM_DOMAIN,
+                    (uint8_t)(mac >> 24), (uint8_t)(mac >> 16), (uint8_t)(mac >> 8), (uint8_t)mac};
+  return siphash24(key, msg, sizeof(msg)) & DATA_MASK;
+}
+
+bool cryptoTokenParseKey(const char* hex, uint8_t key[CRYPTO_TOKEN_KEY_BYTES]) {
+  for (uint8_t i = 0; i < CRYPTO_TOKEN_KEY_BYTES * 2; i++) {
+    char c = hex[i];
+    uint8_t v;
+    if (c >= '0' && c <= '9') v = c - '0';
+    else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+    else return false;
+    if (i & 1) key[i / 2] = (uint8_t)((key[i / 2] << 4) | v);
+    else key[i / 2] = v;
+  }
+  return hex[CRYPTO_TOKEN_KEY_BYTES * 2] == '\0';
+}
+
+bool cryptoTokenEncode(const uint8_t key[CRYPTO_TOKEN_KEY_BYTES], const char* meterNumber,
+                       const CryptoToken& t, char out[21]) {
+  if (t.tokenClass > 0xF || t.seq == 0 || t.deciKwh == 0 || t.deciKwh > CRYPTO_TOKEN_MAX_DECI_KWH) {
+    return false;
+  }
+  uint64_t data = ((uint64_t)t.tokenClass << 30) | ((uint64_t)t.seq << 14) | t.deciKwh;
+  uint32_t mac = tokenMac(key, meterNumber, data);
+  uint64_t block = ((data ^ keystream(key, mac)) << MAC_BITS) | mac;
+  for (int i = 19; i >= 0; i--) {
+    out[i] = (char)('0' + block % 10);
+    block /= 10;
+  }
+  out[20] = '\0';
+  return true;
+}
+
+CryptoTokenResult cryptoTokenDecode(const uint8_t key[CRYPTO_TOKEN_KEY_BYTES], const char* meterNumber,
+                                    const char* digits, CryptoToken& t) {
+  uint64_t block = 0;
+  for (uint8_t i = 0; i < 20; i++) {
+    if (digits[i] < '0' || digits[i] > '9') return CRYPTO_TOKEN_NOT_CRYPTO;
+    uint8_t d = digits[i] - '0';
+    if (block > (UINT64_MAX - d) / 10) return CRYPTO_TOKEN_NOT_CRYPTO;  // above 2^64 - 1
+    block = block * 10 + d;
+  }
+  if (digits[20] != '\0') return CRYPTO_TOKEN_NOT_CRYPTO;
+
+  uint32_t mac = (uint32_t)(block & MAC_MASK);
+  uint64_t data = (block >> MAC_BITS) ^ keystream(key, mac);
+  if (tokenMac(key, meterNumber, data) != mac) return CRYPTO_TOKEN_NOT_CRYPTO;
+
+  t.tokenClass = (uint8_t)(data >> 30);
+  t.seq = (uint16_t)(data >> 14);
+  t.deciKwh = (uint16_t)(data & CRYPTO_TOKEN_MAX_DECI_KWH);
+  if (t.tokenClass != CRYPTO_TOKEN_CLASS_CREDIT || t.seq == 0 || t.deciKwh == 0) {
+    return CRYPTO_TOKEN_BAD_FIELDS;
+  }
+  return CRYPTO_TOKEN_OK;
+}
+
+// ------ Replay window ------
+
+bool replayWindowAllows(const TokenReplayWindow& w, uint16_t seq) {
+  if (seq == 0) return false;
+  if (seq > w.highest) return true;
+  uint16_t age = w.highest - seq;  // 0 = the highest itself
+  if (age == 0 || age > CRYPTO_TOKEN_WINDOW) return false;
+  return (w.seen & (1UL << (age - 1))) == 0;
+}
+
+bool replayWindowAccept(TokenReplayWindow& w, uint16_t seq) {
+  if (!replayWindowAllows(w, seq)) return false;
+  if (seq > w.highest) {
+    uint16_t shift = seq - w.highest;
+    // the old highest becomes age `shift`
+    uint32_t seen = shift >= 32 ? 0 : (w.seen << shift);
+    if (w.highest != 0 && shift <= CRYPTO_TOKEN_WINDOW) seen |= 1UL << (shift - 1);
+    w.seen = seen;
+    w.highest = seq;
+  } else {
+    w.seen |= 1UL << (w.highest - seq - 1);
+  }
+  return true;
+}
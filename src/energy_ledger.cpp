@@ -0,0 +1,75 @@
+/**
+ * energy_ledger.cpp - Exact integer energy ledger (see energy_ledger.h)
+ */
+#include "energy_ledger.h"
+
+// 1 dW * 1 ms = 1e-4 J and 1 µWh = 3.6e-3 J = 36 units; the trapezoid's /2 makes it 72
+#define LEDGER_AREA_PER_UWH 72ULL
+#define LEDGER_DEFAULT_MAX_GAP_MS 1000
+
+EnergyLedger::EnergyLedger()
+    : purchased_(0), consumed_(0), baselineWh_(0), haveBaseline_(false),
+      havePrev_(false), prevT_(0), prevP_(0), residue_(0), maxGapMs_(LEDGER_DEFAULT_MAX_GAP_MS),
+      lastCorrection_(0), maxCorrection_(0), corrections_(0) {}
+
+void EnergyLedger::reset(int64_t purchasedUwh, uint32_t baselineWh, bool haveBaseline) {
+  restore(purchasedUwh, 0, baselineWh, haveBaseline);
+}
+
+void EnergyLedger::topUp(int64_t uwh) {
+  purchased_ += uwh;
+}
+
+void EnergyLedger::restore(int64_t purchasedUwh, int64_t consumedUwh, uint32_t baselineWh, bool haveBaseline) {
+  purchased_ = purchasedUwh;
+  consumed_ = consumedUwh;
+  baselineWh_ = baselineWh;
+  haveBaseline_ = haveBaseline;
+  havePrev_ = false;
+  residue_ = 0;
+}
+
+void EnergyLedger::addSample(uint32_t tMs, uint32_t powerDw) {
+  if (havePrev_) {
+    uint32_t dt = tMs - prevT_;
+    if (dt > 0 && dt <= maxGapMs_) {
+      uint64_t area = (uint64_t)(prevP_ + powerDw) * dt + residue_;
+      consumed_ += (int64_t)(area / LEDGER_AREA_PER_UWH);
+      residue_ = area % LEDGER_AREA_PER_UWH;
+    }
+  }
+  prevT_ = tMs;
+  prevP_ = powerDw;
+  havePrev_ = true;
+}
+
+int64_t EnergyLedger::reconcile(uint32_t energyWh) {
+  if (!haveBaseline_) {
+    // First reading of this session: anchor the register to what we have already billed
+    baselineWh_ = energyWh - (uint32_t)(consumed_ / LEDGER_UWH_PER_WH);
+    haveBaseline_ = true;
+    return 0;
+  }
+  int64_t regWh = (int64_t)(int32_t)(energyWh - baselineWh_);
+  if (regWh < 0) {
+    // Register was reset on the device (or wrapped): re-anchor, keep the ledger as is
+    baselineWh_ = energyWh - (uint32_t)(consumed_ / LEDGER_UWH_PER_WH);
+    return 0;
+  }
+
+  int64_t lo = regWh * LEDGER_UWH_PER_WH;
+  int64_t hi = lo + LEDGER_UWH_PER_WH - 1;
+  int64_t correction = 0;
+  if (consumed_ < lo) correction = lo - consumed_;
+  else if (consumed_ > hi) correction = hi - consumed_;
+
+  lastCorrection_ = correction;
+  if (correction != 0) {
+    consumed_ += correction;
+    corrections_++;
+    int64_t mag = correction < 0 ? -correction : correction;
+    int64_t maxMag = maxCorrection_ < 0 ? -maxCorrection_ : maxCorrection_;
+    if (mag > maxMag) maxCorrection_ = correction;
+  }
+  return correction;
+}
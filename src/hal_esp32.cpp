@@ -0,0 +1,130 @@
+/**
+ * hal_esp32.cpp - ESP32 backends of the hardware abstraction (see hal_esp32.h)
+ */
+#include "hal_esp32.h"
+#include <EEPROM.h>
+#include <WiFi.h>
+#include "lwip/sockets.h"
+
+uint32_t halMillis() { return millis(); }
+uint32_t halMicros() { return micros(); }
+
+// ------ EspPartitionFlash ------
+bool EspPartitionFlash::begin(const char* label) {
+  part_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  return part_ != NULL;
+}
+
+bool EspPartitionFlash::read(uint32_t offset, void* buf, size_t len) {
+  return part_ != NULL && esp_partition_read(part_, offset, buf, len) == ESP_OK;
+}
+
+bool EspPartitionFlash::write(uint32_t offset, const void* buf, size_t len) {
+  return part_ != NULL && esp_partition_write(part_, offset, buf, len) == ESP_OK;
+}
+
+bool EspPartitionFlash::erase(uint32_t offset, size_t len) {
+  return part_ != NULL && esp_partition_erase_range(part_, offset, len) == ESP_OK;
+}
+
+const void* EspPartitionFlash::map(uint32_t offset, size_t len) {
+  const void* mapped = NULL;
+  if (part_ == NULL ||
+      esp_partition_mmap(part_, offset, len, ESP_PARTITION_MMAP_DATA, &mapped, &map_) != ESP_OK) {
+    return NULL;
+  }
+  return mapped;
+}
+
+void EspPartitionFlash::unmap(const void* /*ptr*/) {
+  spi_flash_munmap(map_);
+  map_ = 0;
+}
+
+// ------ EepromStore ------
+void EepromStore::read(uint32_t addr, void* buf, size_t len) {
+  EEPROM.readBytes(addr, buf, len);
+}
+
+void EepromStore::write(uint32_t addr, const void* buf, size_t len) {
+  EEPROM.writeBytes(addr, buf, len);
+}
+
+bool EepromStore::commit() {
+  return EEPROM.commit();
+}
+
+// ------ WiFiUdpLink ------
+bool WiFiUdpLink::open() {
+  sock_ = lwip_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock_ < 0) return false;
+  struct sockaddr_in local = {};
+  local.sin_family = AF_INET;
+  local.sin_port = htons(UDP_LOCAL_PORT);
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  int flags = lwip_fcntl(sock_, F_GETFL, 0);
+  if (lwip_bind(sock_, (struct sockaddr*)&local, sizeof(local)) != 0 ||
+      lwip_fcntl(sock_, F_SETFL, flags | O_NONBLOCK) != 0) {
+    lwip_close(sock_);
+    sock_ = -1;
+    return false;
+  }
+  return true;
+}
+
+bool WiFiUdpLink::send(const char* host, uint16_t port, const void* buf, size_t len) {
+  if (WiFi.status() != WL_CONNECTED) return false;
+  if (sock_ < 0 && !open()) return false;
+  uint32_t addr = resolve(host);
+  if (addr == 0) return false;
+  struct sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(port);
+  to.sin_addr.s_addr = addr;  // already in network order
+  return lwip_sendto(sock_, buf, len, 0, (struct sockaddr*)&to, sizeof(to)) == (int)len;
+}
+
+size_t WiFiUdpLink::receive(void* buf, size_t cap) {
+  if (sock_ < 0) return 0;
+  int n = lwip_recv(sock_, buf, cap, MSG_DONTWAIT);  // a longer datagram is truncated
+  return n > 0 ? (size_t)n : 0;
+}
+
+// Runs on the lwIP thread; ip is NULL when the lookup failed
+void WiFiUdpLink::onDnsFound(const char* /*name*/, const ip_addr_t* ip, void* arg) {
+  DnsSlot* slot = (DnsSlot*)arg;
+  if (ip != NULL) {
+    slot->addr = ip4_addr_get_u32(ip_2_ip4(ip));
+    slot->resolvedMs = millis();
+  }
+  slot->pending = false;
+}
+
+// Cached address of host, 0 while the first lookup is outstanding
+uint32_t WiFiUdpLink::resolve(const char* host) {
+  DnsSlot* slot = NULL;
+  for (uint8_t i = 0; i < dnsUsed_ && slot == NULL; i++) {
+    if (dns_[i].host == host) slot = &dns_[i];
+  }
+  if (slot == NULL) {
+    if (dnsUsed_ == UDP_DNS_SLOTS) return 0;
+    slot = &dns_[dnsUsed_++];
+    slot->host = host;
+    slot->addr = 0;
+    slot->resolvedMs = 0;
+    slot->pending = false;
+  }
+  bool fresh = slot->addr != 0 && millis() - slot->resolvedMs < UDP_DNS_TTL_MS;
+  if (!fresh && !slot->pending) {
+    // Same call as WiFiGenericClass::hostByName(), without waiting on the callback
+    ip_addr_t ip;
+    slot->pending = true;
+    err_t err = dns_gethostbyname(host, &ip, onDnsFound, slot);
+    if (err == ERR_OK) {  // answered from lwIP's own cache
+      slot->addr = ip4_addr_get_u32(ip_2_ip4(&ip));
+      slot->resolvedMs = millis();
+    }
+    if (err != ERR_INPROGRESS) slot->pending = false;
+  }
+  return slot->addr;
+}
@@ -0,0 +1,26 @@
+/**
+ * host_cache.cpp - Cached IPv4 address of one host name (see host_cache.h)
+ */
+#include "host_cache.h"
+
+HostCache::HostCache(uint32_t ttlMs, HostResolver resolve, void* ctx)
+    : ttlMs_(ttlMs), resolve_(resolve), ctx_(ctx), addr_(0), resolvedMs_(0), fresh_(false),
+      lookups_(0), hits_(0) {}
+
+bool HostCache::lookup(const char* host, uint32_t nowMs, uint32_t& addr) {
+  if (fresh_ && nowMs - resolvedMs_ < ttlMs_) {
+    hits_++;
+    addr = addr_;
+    return true;
+  }
+  lookups_++;
+  uint32_t found = 0;
+  if (resolve_(host, found, ctx_) && found != 0) {
+    addr_ = found;
+    resolvedMs_ = nowMs;
+    fresh_ = true;
+  }
+  if (addr_ == 0) return false;
+  addr = addr_;
+  return true;
+}
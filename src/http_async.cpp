@@ -0,0 +1,451 @@
+/**
+ * http_async.cpp - Non-blocking HTTP/1.1 request engine (see http_async.h)
+ */
+#include "http_async.h"
+#include <WiFi.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define HTTP_CONNECT_TASK_CORE     0
+#define HTTP_CONNECT_TASK_PRIORITY 1   // below the metering task: billing always wins
+#define HTTP_CONNECT_TASK_STACK    8192 // TLS handshake runs on this stack
+#define HTTP_SEND_CHUNK            512
+
+static bool wifiResolve(const char* host, uint32_t& addr, void* /*ctx*/) {
+  IPAddress ip;
+  if (WiFi.hostByName(host, ip) != 1) return false;
+  addr = (uint32_t)ip;
+  return true;
+}
+
+AsyncHttp::AsyncHttp()
+    : secure_(false), port_(80), idleConn_(false), idleSinceMs_(0), reused_(false),
+      dns_(HTTP_DNS_TTL_MS, wifiResolve), head_(0), count_(0), phase_(IDLE),
+      headerLen_(0), headerSent_(0), bodySent_(0), respLen_(0), bodyTotal_(0), status_(0),
+      contentLength_(-1), chunked_(false), keepAlive_(false), complete_(false),
+      truncated_(false), lastRxMs_(0),
+      worker_(NULL), connectResult_(0), connectInFlight_(false), connectTimeoutMs_(0),
+      abandoned_(false), completed_(0), failed_(0), maxPollUs_(0),
+      connectsOpened_(0), connectsReused_(0) {
+  host_[0] = '\0';
+  prefix_[0] = '\0';
+  memset(chunkTail_, 0, sizeof(chunkTail_));
+}
+
+bool AsyncHttp::begin(const char* baseUrl) {
+  const char* p = baseUrl;
+  if (strncmp(p, "https://", 8) == 0) {
+    secure_ = true;
+    port_ = 443;
+    p += 8;
+  } else if (strncmp(p, "http://", 7) == 0) {
+    secure_ = false;
+    port_ = 80;
+    p += 7;
+  } else {
+    return false;
+  }
+
+  // host[:port]
+  size_t hostLen = strcspn(p, ":/");
+  if (hostLen == 0 || hostLen >= sizeof(host_)) return false;
+  memcpy(host_, p, hostLen);
+  host_[hostLen] = '\0';
+  p += hostLen;
+  if (*p == ':') {
+    port_ = (uint16_t)strtoul(p + 1, (char**)&p, 10);
+  }
+
+  // /prefix (without trailing slash)
+  size_t prefixLen = strlen(p);
+  while (prefixLen > 0 && p[prefixLen - 1] == '/') prefixLen--;
+  if (prefixLen >= sizeof(prefix_)) return false;
+  memcpy(prefix_, p, prefixLen);
+  prefix_[prefixLen] = '\0';
+
+  if (worker_ == NULL) {
+    xTaskCreatePinnedToCore(connectWorker, "http-connect", HTTP_CONNECT_TASK_STACK, this,
+                            HTTP_CONNECT_TASK_PRIORITY, &worker_, HTTP_CONNECT_TASK_CORE);
+  }
+  return worker_ != NULL;
+}
+
+bool AsyncHttp::enqueue(const char* method, const char* path, const char* body,
+                        uint32_t deadlineMs, uint8_t retries,
+                        HttpDoneCallback cb, void* ctx) {
+  return enqueue(method, path, (const uint8_t*)body, body ? strlen(body) : 0, "application/json",
+                 deadlineMs, retries, cb, ctx);
+}
+
+bool AsyncHttp::enqueue(const char* method, const char* path, const uint8_t* body, size_t len,
+                        const char* contentType, uint32_t deadlineMs, uint8_t retries,
+                        HttpDoneCallback cb, void* ctx) {
+  if (count_ >= HTTP_QUEUE_LEN) return false;
+  size_t bodyLen = body ? len : 0;
+  if (strlen(method) >= sizeof(queue_[0].method) ||
+      strlen(path) >= sizeof(queue_[0].path) ||
+      bodyLen >= sizeof(queue_[0].body)) {
+    return false;
+  }
+
+  Request& r = queue_[(head_ + count_) % HTTP_QUEUE_LEN];
+  strcpy(r.method, method);
+  strcpy(r.path, path);
+  if (body) memcpy(r.body, body, bodyLen);
+  r.body[bodyLen] = '\0';
+  r.bodyLen = (uint16_t)bodyLen;
+  r.contentType = contentType;
+  r.enqueuedMs = millis();
+  r.deadlineMs = deadlineMs;
+  r.notBeforeMs = r.enqueuedMs;
+  r.retriesLeft = retries;
+  r.cb = cb;
+  r.ctx = ctx;
+  count_++;
+  return true;
+}
+
+void AsyncHttp::poll(uint32_t sliceMs) {
+  uint32_t t0 = micros();
+
+  // A connect that outlived its request: reap it once the helper task is done with the client
+  if (abandoned_) {
+    if (connectInFlight_.load(std::memory_order_acquire)) return;
+    closeConnection();
+    abandoned_ = false;
+  }
+
+  uint32_t now = millis();
+  if (phase_ == IDLE && idleConn_ && now - idleSinceMs_ >= HTTP_KEEPALIVE_IDLE_MS) {
+    closeConnection();  // don't hold a socket (and the TLS buffers) nobody is using
+  }
+  if (phase_ == IDLE && !startNext(now)) return;
+
+  Request& r = queue_[head_];
+  if ((int32_t)(now - (r.enqueuedMs + r.deadlineMs)) >= 0) {
+    finish(HTTP_ERR_TIMEOUT);
+  } else {
+    bool progress = true;
+    while (progress && (micros() - t0) < sliceMs * 1000UL) {
+      switch (phase_) {
+        case CONNECTING:
+          if (connectInFlight_.load(std::memory_order_acquire)) {
+            progress = false;  // TLS handshake still running in the helper task
+          } else if (connectResult_.load(std::memory_order_acquire) <= 0) {
+            finish(HTTP_ERR_CONNECT);
+            progress = false;
+          } else {
+            connectsOpened_++;
+            phase_ = SENDING;
+          }
+          break;
+        case SENDING:       progress = stepSend();    break;
+        case AWAIT_HEADERS: progress = stepHeaders(); break;
+        case READ_BODY:     progress = stepBody();    break;
+        default:            progress = false;         break;
+      }
+    }
+  }
+
+  uint32_t us = micros() - t0;
+  if (us > maxPollUs_) maxPollUs_ = us;
+}
+
+void AsyncHttp::connectWorker(void* arg) {
+  AsyncHttp* self = static_cast<AsyncHttp*>(arg);
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    int32_t timeout = (int32_t)self->connectTimeoutMs_;
+    IPAddress ip;
+    int ok = 0;
+    if (self->resolveHost(ip)) {
+      ok = self->secure_ ? self->tls_.connect(ip, self->port_, self->host_, timeout)
+                         : self->plain_.connect(ip, self->port_, timeout);
+      if (!ok) self->dns_.invalidate();  // maybe the address moved: look it up again next time
+    }
+    self->connectResult_.store(ok ? 1 : -1, std::memory_order_release);
+    self->connectInFlight_.store(false, std::memory_order_release);
+  }
+}
+
+// Cached DNS lookup (host_cache.h), helper task only
+bool AsyncHttp::resolveHost(IPAddress& ip) {
+  uint32_t addr;
+  if (!dns_.lookup(host_, millis(), addr)) return false;
+  ip = IPAddress(addr);
+  return true;
+}
+
+Client& AsyncHttp::client() {
+  if (secure_) return tls_;
+  return plain_;
+}
+
+bool AsyncHttp::startNext(uint32_t now) {
+  if (count_ == 0) return false;
+  Request& r = queue_[head_];
+  if ((int32_t)(now - r.notBeforeMs) < 0) return false;  // retry backoff
+  reused_ = false;
+
+  if (WiFi.status() != WL_CONNECTED) {
+    finish(HTTP_ERR_NOT_CONNECTED);
+    return false;
+  }
+
+  int n;
+  if (r.bodyLen > 0 || strcmp(r.method, "GET") != 0) {
+    n = snprintf(header_, sizeof(header_),
+                 "%s %s%s HTTP/1.1\r\nHost: %s\r\nUser-Agent: SmartMeter-ESP32\r\n"
+                 "Connection: keep-alive\r\nContent-Type: %s\r\nContent-Length: %u\r\n\r\n",
+                 r.method, prefix_, r.path, host_, r.contentType, (unsigned)r.bodyLen);
+  } else {
+    n = snprintf(header_, sizeof(header_),
+                 "%s %s%s HTTP/1.1\r\nHost: %s\r\nUser-Agent: SmartMeter-ESP32\r\n"
+                 "Connection: keep-alive\r\n\r\n",
+                 r.method, prefix_, r.path, host_);
+  }
+  if (n <= 0 || (size_t)n >= sizeof(header_)) {
+    finish(HTTP_ERR_SEND);
+    return false;
+  }
+  headerLen_ = (size_t)n;
+  headerSent_ = 0;
+  bodySent_ = 0;
+  respLen_ = 0;
+  bodyTotal_ = 0;
+  status_ = 0;
+  contentLength_ = -1;
+  chunked_ = false;
+  keepAlive_ = false;
+  complete_ = false;
+  truncated_ = false;
+
+  // Reuse the kept-alive connection unless the server has closed it meanwhile
+  if (idleConn_) {
+    idleConn_ = false;
+    if (now - idleSinceMs_ < HTTP_KEEPALIVE_IDLE_MS && client().connected()) {
+      reused_ = true;
+      connectsReused_++;
+      phase_ = SENDING;
+      return true;
+    }
+    closeConnection();
+  }
+
+  // Hand the blocking connect/handshake to the helper task, bounded by what is left of the deadline
+  uint32_t left = r.enqueuedMs + r.deadlineMs - now;
+  connectTimeoutMs_ = left < 1000 ? 1000 : left;
+  connectResult_.store(0, std::memory_order_relaxed);
+  connectInFlight_.store(true, std::memory_order_release);
+  phase_ = CONNECTING;
+  xTaskNotifyGive(worker_);
+  return true;
+}
+
+// Returns true when more work can be done right away
+bool AsyncHttp::stepSend() {
+  Client& c = client();
+  if (!c.connected()) {
+    finish(HTTP_ERR_CONN_LOST);
+    return false;
+  }
+  Request& r = queue_[head_];
+  const uint8_t* src;
+  size_t left;
+  size_t* sent;
+  if (headerSent_ < headerLen_) {
+    src = (const uint8_t*)header_ + headerSent_;
+    left = headerLen_ - headerSent_;
+    sent = &headerSent_;
+  } else if (bodySent_ < r.bodyLen) {
+    src = (const uint8_t*)r.body + bodySent_;
+    left = r.bodyLen - bodySent_;
+    sent = &bodySent_;
+  } else {
+    phase_ = AWAIT_HEADERS;
+    lastRxMs_ = millis();
+    return true;
+  }
+  size_t w = c.write(src, left > HTTP_SEND_CHUNK ? HTTP_SEND_CHUNK : left);
+  if (w == 0) {
+    if (!c.connected()) finish(HTTP_ERR_SEND);  // else: socket buffer full, retry next pass
+    return false;
+  }
+  *sent += w;
+  return true;
+}
+
+bool AsyncHttp::stepHeaders() {
+  Client& c = client();
+  int avail = c.available();
+  if (avail <= 0) {
+    if (!c.connected()) finish(HTTP_ERR_CONN_LOST);
+    return false;
+  }
+  while (avail-- > 0) {
+    int ch = c.read();
+    if (ch < 0) break;
+    if (respLen_ >= sizeof(resp_) - 1) {
+      finish(HTTP_ERR_CONN_LOST);  // header block larger than our buffer
+      return false;
+    }
+    resp_[respLen_++] = (char)ch;
+    if (respLen_ >= 4 && memcmp(resp_ + respLen_ - 4, "\r\n\r\n", 4) == 0) {
+      resp_[respLen_] = '\0';
+      int minor = 0;
+      if (sscanf(resp_, "HTTP/1.%d %d", &minor, &status_) != 2) status_ = 0;
+      keepAlive_ = minor >= 1;
+      for (char* line = strstr(resp_, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+          contentLength_ = atol(line + 15);
+        } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+          char* eol = strstr(line, "\r\n");
+          char* chunk = strstr(line, "chunked");
+          chunked_ = chunk && (!eol || chunk < eol);
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+          char* eol = strstr(line, "\r\n");
+          char* close = strstr(line, "close");
+          if (close && (!eol || close < eol)) keepAlive_ = false;
+        }
+      }
+      if (status_ <= 0) {
+        finish(HTTP_ERR_CONN_LOST);
+        return false;
+      }
+      respLen_ = 0;
+      phase_ = READ_BODY;
+      lastRxMs_ = millis();
+      memset(chunkTail_, 0, sizeof(chunkTail_));
+      chunkTail_[5] = '\r';  // so a body that is just "0\r\n\r\n" matches too
+      chunkTail_[6] = '\n';
+      if (contentLength_ == 0 || status_ == 204 || status_ == 304) {
+        complete_ = true;
+        finish(status_);
+        return false;
+      }
+      return true;
+    }
+  }
+  return true;
+}
+
+bool AsyncHttp::stepBody() {
+  Client& c = client();
+  int avail = c.available();
+  if (avail <= 0) {
+    // No Content-Length and not chunked: the server closes after the response
+    if (!c.connected()) finish(status_);
+    return false;
+  }
+  uint8_t tmp[128];
+  int got = c.read(tmp, avail > (int)sizeof(tmp) ? sizeof(tmp) : (size_t)avail);
+  if (got <= 0) return false;
+  lastRxMs_ = millis();
+  bodyTotal_ += got;
+  if (chunked_) trackChunkEnd(tmp, (size_t)got);
+  size_t room = sizeof(resp_) - 1 - respLen_;
+  size_t keep = (size_t)got < room ? (size_t)got : room;
+  if (keep < (size_t)got) truncated_ = true;
+  memcpy(resp_ + respLen_, tmp, keep);
+  respLen_ += keep;
+  if (!chunked_ && contentLength_ >= 0 && bodyTotal_ >= contentLength_) complete_ = true;
+  if (complete_) {
+    finish(status_);
+    return false;
+  }
+  return true;
+}
+
+// Sending these twice has the same effect as once (RFC 9110, 9.2.2)
+static bool idempotentMethod(const char* method) {
+  return strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0 || strcmp(method, "PUT") == 0 ||
+         strcmp(method, "DELETE") == 0 || strcmp(method, "OPTIONS") == 0;
+}
+
+void AsyncHttp::finish(int status) {
+  Request& r = queue_[head_];
+  uint32_t now = millis();
+  // Once the whole request is out the server may have acted on it even though no answer
+  // came back: a POST is not sent again from there (it could credit or confirm twice)
+  bool mayResend = idempotentMethod(r.method) || (phase_ != AWAIT_HEADERS && phase_ != READ_BODY);
+  if (connectInFlight_.load(std::memory_order_acquire)) {
+    abandoned_ = true;  // helper task still owns the client; poll() reaps it later
+  } else if (status > 0 && complete_ && keepAlive_) {
+    idleConn_ = true;   // response fully read: keep the connection for the next request
+    idleSinceMs_ = now;
+  } else {
+    closeConnection();
+  }
+
+  // The server dropped the kept-alive connection while it was idle: nothing was
+  // answered, so go again right away on a fresh connection without using a retry
+  if (reused_ && mayResend && (status == HTTP_ERR_SEND || status == HTTP_ERR_CONN_LOST) &&
+      phase_ != READ_BODY && respLen_ == 0) {
+    reused_ = false;
+    r.notBeforeMs = now;
+    phase_ = IDLE;
+    return;
+  }
+
+  // Transport failures get retried (after a backoff) while the deadline allows it
+  bool transportError = status <= 0 && status != HTTP_ERR_TIMEOUT;
+  if (transportError && mayResend && r.retriesLeft > 0 &&
+      (int32_t)(r.enqueuedMs + r.deadlineMs - now) > (int32_t)HTTP_RETRY_BACKOFF_MS) {
+    r.retriesLeft--;
+    r.notBeforeMs = now + HTTP_RETRY_BACKOFF_MS;
+    phase_ = IDLE;
+    return;
+  }
+
+  if (status > 0) {
+    resp_[respLen_] = '\0';
+    if (chunked_) respLen_ = dechunk(resp_, respLen_);
+    completed_++;
+  } else {
+    respLen_ = 0;
+    resp_[0] = '\0';
+    failed_++;
+  }
+
+  // Pop before the callback so it may enqueue follow-up requests
+  HttpDoneCallback cb = r.cb;
+  void* ctx = r.ctx;
+  head_ = (head_ + 1) % HTTP_QUEUE_LEN;
+  count_--;
+  phase_ = IDLE;
+  if (cb) cb(status, resp_, respLen_, ctx);
+}
+
+void AsyncHttp::closeConnection() {
+  client().stop();
+  idleConn_ = false;
+}
+
+// Chunked bodies end with an empty chunk: remember the last 7 raw bytes to see "\r\n0\r\n\r\n"
+void AsyncHttp::trackChunkEnd(const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    memmove(chunkTail_, chunkTail_ + 1, sizeof(chunkTail_) - 1);
+    chunkTail_[sizeof(chunkTail_) - 1] = (char)data[i];
+    if (memcmp(chunkTail_, "\r\n0\r\n\r\n", sizeof(chunkTail_)) == 0) complete_ = true;
+  }
+}
+
+// In-place decode of a chunked body ("<hex>\r\n<data>\r\n ... 0\r\n\r\n"); buf is NUL-terminated
+size_t AsyncHttp::dechunk(char* buf, size_t len) {
+  size_t in = 0, out = 0;
+  while (in < len) {
+    char* end = NULL;
+    unsigned long sz = strtoul(buf + in, &end, 16);
+    char* crlf = strstr(buf + in, "\r\n");
+    if (!crlf) break;
+    in = (size_t)(crlf - buf) + 2;
+    if (sz == 0) break;
+    if (in + sz > len) sz = len - in;  // truncated body
+    memmove(buf + out, buf + in, sz);
+    out += sz;
+    in += sz + 2;
+  }
+  buf[out] = '\0';
+  return out;
+}
@@ -0,0 +1,181 @@
+/**
+ * interval_stats.cpp - Streaming window statistics of the metering samples (see interval_stats.h)
+ */
+#include "interval_stats.h"
+#include <math.h>
+#include <string.h>
+
+// ------ P2Quantile ------
+
+void P2Quantile::add(float x) {
+  if (n_ < 5) {
+    // Warm-up: keep the samples sorted, they become the initial markers
+    uint32_t i = n_++;
+    while (i > 0 && q_[i - 1] > x) {
+      q_[i] = q_[i - 1];
+      i--;
+    }
+    q_[i] = x;
+    if (n_ == 5) {
+      for (int m = 0; m < 5; m++) pos_[m] = m + 1;
+      want_[0] = 1.0f;
+      want_[1] = 1.0f + 2.0f * p_;
+      want_[2] = 1.0f + 4.0f * p_;
+      want_[3] = 3.0f + 2.0f * p_;
+      want_[4] = 5.0f;
+    }
+    return;
+  }
+
+  // Cell the sample falls into; the extremes stretch to take it
+  int k;
+  if (x < q_[0]) {
+    q_[0] = x;
+    k = 0;
+  } else if (x >= q_[4]) {
+    q_[4] = x;
+    k = 3;
+  } else {
+    k = 0;
+    while (x >= q_[k + 1]) k++;
+  }
+  n_++;
+  for (int i = k + 1; i < 5; i++) pos_[i]++;
+  want_[1] += p_ / 2.0f;
+  want_[2] += p_;
+  want_[3] += (1.0f + p_) / 2.0f;
+  want_[4] += 1.0f;
+
+  // Move the middle markers at most one rank towards where they should be
+  for (int i = 1; i <= 3; i++) {
+    float off = want_[i] - (float)pos_[i];
+    if ((off >= 1.0f && pos_[i + 1] - pos_[i] > 1) || (off <= -1.0f && pos_[i - 1] - pos_[i] < -1)) {
+      int d = off > 0 ? 1 : -1;
+      float h = parabolic(i, d);
+      q_[i] = (q_[i - 1] < h && h < q_[i + 1]) ? h : linear(i, d);
+      pos_[i] += d;
+    }
+  }
+}
+
+float P2Quantile::value() const {
+  if (n_ == 0) return 0.0f;
+  if (n_ < 5) {
+    uint32_t rank = (uint32_t)ceilf(p_ * (float)n_);  // nearest rank
+    return q_[rank > 0 ? rank - 1 : 0];
+  }
+  return q_[2];
+}
+
+float P2Quantile::parabolic(int i, int d) const {
+  float below = (float)(pos_[i] - pos_[i - 1]);
+  float above = (float)(pos_[i + 1] - pos_[i]);
+  return q_[i] + (float)d / (float)(pos_[i + 1] - pos_[i - 1]) *
+                     ((below + d) * (q_[i + 1] - q_[i]) / above + (above - d) * (q_[i] - q_[i - 1]) / below);
+}
+
+float P2Quantile::linear(int i, int d) const {
+  return q_[i] + (float)d * (q_[i + d] - q_[i]) / (float)(pos_[i + d] - pos_[i]);
+}
+
+// ------ ChannelStats ------
+
+void ChannelStats::add(float x) {
+  n_++;
+  if (n_ == 1) {
+    min_ = max_ = x;
+  } else if (x < min_) {
+    min_ = x;
+  } else if (x > max_) {
+    max_ = x;
+  }
+  float delta = x - mean_;
+  mean_ += delta / (float)n_;
+  m2_ += delta * (x - mean_);
+
+  // Largest samples, descending; most samples are below the smallest kept one
+  if (topCount_ < ISTATS_TOP_SAMPLES || x > top_[topCount_ - 1]) {
+    uint32_t i = topCount_ < ISTATS_TOP_SAMPLES ? topCount_++ : topCount_ - 1;
+    while (i > 0 && top_[i - 1] < x) {
+      top_[i] = top_[i - 1];
+      i--;
+    }
+    top_[i] = x;
+  }
+  p95Estimate_.add(x);
+}
+
+void ChannelStats::reset() {
+  n_ = 0;
+  min_ = max_ = mean_ = m2_ = 0.0f;
+  topCount_ = 0;
+  p95Estimate_.reset();
+}
+
+float ChannelStats::p95() const {
+  if (n_ == 0) return 0.0f;
+  // Nearest rank ceil(0.95 n) is the (n - rank + 1)-th largest sample
+  uint32_t rank = (uint32_t)ceilf(ISTATS_QUANTILE * (float)n_);
+  uint32_t fromTop = n_ - (rank > 0 ? rank : 1);
+  if (fromTop < topCount_) return top_[fromTop];
+  return p95Estimate_.value();
+}
+
+float ChannelStats::stddev() const {
+  return n_ > 0 ? sqrtf(m2_ / (float)n_) : 0.0f;
+}
+
+// ------ IntervalStats ------
+
+void IntervalStats::reset(uint32_t nowMs) {
+  voltage_.reset();
+  current_.reset();
+  power_.reset();
+  pf_.reset();
+  startMs_ = nowMs;
+}
+
+void IntervalStats::add(const PzemReading& r) {
+  if (isnan(r.voltage) || isnan(r.current)) return;
+  voltage_.add(r.voltage);
+  current_.add(r.current);
+  power_.add(r.power);
+  pf_.add(r.pf);
+}
+
+// x * scale rounded into [0, maxUnits]
+static uint32_t toUnits(float x, float scale, uint32_t maxUnits) {
+  float v = x * scale;
+  if (!(v > 0.0f)) return 0;  // also NaN
+  if (v >= (float)maxUnits) return maxUnits;
+  return (uint32_t)lroundf(v);
+}
+
+static void channelUnits(const ChannelStats& c, float scale, uint32_t maxUnits, uint32_t out[TWIN_STATS]) {
+  out[TWIN_MIN] = toUnits(c.min(), scale, maxUnits);
+  out[TWIN_MAX] = toUnits(c.max(), scale, maxUnits);
+  out[TWIN_MEAN] = toUnits(c.mean(), scale, maxUnits);
+  out[TWIN_P95] = toUnits(c.p95(), scale, maxUnits);
+  out[TWIN_STD] = toUnits(c.stddev(), scale, maxUnits);
+}
+
+void IntervalStats::close(uint32_t nowMs, TelemetryWindow& out) {
+  memset(&out, 0, sizeof(out));
+  uint32_t n = samples();
+  uint32_t spanS = (nowMs - startMs_) / 1000;
+  out.samples = (uint16_t)(n < 0xFFFF ? n : 0xFFFF);
+  out.span_s = (uint16_t)(spanS < 0xFFFF ? spanS : 0xFFFF);
+  if (n > 0) {
+    uint32_t v[TWIN_STATS];
+    uint32_t pf[TWIN_STATS];
+    channelUnits(current_, 1000.0f, 0x7FFFFFFFUL, out.current_ma);
+    channelUnits(power_, 10.0f, 0x7FFFFFFFUL, out.power_dw);
+    channelUnits(voltage_, 10.0f, 0xFFFF, v);
+    channelUnits(pf_, 100.0f, 0xFF, pf);
+    for (int i = 0; i < TWIN_STATS; i++) {
+      out.voltage_dv[i] = (uint16_t)v[i];
+      out.pf_pct[i] = (uint8_t)pf[i];
+    }
+  }
+  reset(nowMs);
+}
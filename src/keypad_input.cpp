@@ -0,0 +1,94 @@
+/**
+ * keypad_input.cpp - PCF8574 keypad scan task (see keypad_input.h)
+ */
+#include "keypad_input.h"
+
+#define KEYPAD_TASK_CORE      1     // loop()'s core: the bus is only ever touched from this task
+#define KEYPAD_TASK_PRIORITY  3     // above loop() (1): scans preempt whatever loop() is blocked in
+#define KEYPAD_TASK_STACK     2048
+
+#define KEYPAD_ROWS           4
+#define KEYPAD_COLS           4
+#define PORT_REST             0xF0  // rows (P0..P3) low, columns (P4..P7) released high
+
+KeypadInput::KeypadInput(TwoWire& wire, uint8_t addr, int8_t intPin)
+    : wire_(wire), addr_(addr), intPin_(intPin), busHz_(0), task_(NULL),
+      interrupts_(0), scans_(0), busErrors_(0) {}
+
+bool KeypadInput::begin(uint8_t sda, uint8_t scl) {
+  // Fast mode first; the PCF8574 is only rated for 100 kHz, so fall back if it does not answer
+  const uint32_t speeds[] = {KEYPAD_I2C_FAST_HZ, KEYPAD_I2C_STD_HZ};
+  uint8_t v;
+  wire_.begin(sda, scl);
+  for (uint8_t i = 0; i < 2 && busHz_ == 0; i++) {
+    wire_.setClock(speeds[i]);
+    if (writePort(PORT_REST) && readPort(v)) busHz_ = speeds[i];
+  }
+  if (busHz_ == 0) return false;
+
+  if (task_ == NULL) {
+    xTaskCreatePinnedToCore(task, "keypad", KEYPAD_TASK_STACK, this,
+                            KEYPAD_TASK_PRIORITY, &task_, KEYPAD_TASK_CORE);
+  }
+  if (task_ == NULL) return false;
+  if (intPin_ >= 0) {
+    pinMode(intPin_, INPUT_PULLUP);  // INT is open drain
+    attachInterruptArg(intPin_, onInt, this, FALLING);
+  }
+  return true;
+}
+
+void IRAM_ATTR KeypadInput::onInt(void* arg) {
+  KeypadInput* self = static_cast<KeypadInput*>(arg);
+  self->interrupts_ = self->interrupts_ + 1;
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(self->task_, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+void KeypadInput::task(void* arg) {
+  KeypadInput* self = static_cast<KeypadInput*>(arg);
+  uint32_t waitMs = KEYPAD_IDLE_POLL_MS;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+    uint8_t raw = self->scan();
+    waitMs = keyScanPass(self->debouncer_, self->events_, raw, millis());
+  }
+}
+
+bool KeypadInput::writePort(uint8_t v) {
+  wire_.beginTransmission(addr_);
+  wire_.write(v);
+  if (wire_.endTransmission() == 0) return true;
+  busErrors_++;
+  return false;
+}
+
+bool KeypadInput::readPort(uint8_t& v) {
+  if (wire_.requestFrom(addr_, (uint8_t)1) != 1) {
+    busErrors_++;
+    return false;
+  }
+  v = (uint8_t)wire_.read();
+  return true;
+}
+
+// One key index (first found) or KEYPAD_NO_KEY. Leaves the port at rest and INT released.
+uint8_t KeypadInput::scan() {
+  scans_++;
+  uint8_t v;
+  if (!readPort(v)) return KEYPAD_NO_KEY;
+  uint8_t cols = (uint8_t)(~v >> 4) & 0x0F;  // low = pressed
+  if (cols == 0) return KEYPAD_NO_KEY;
+
+  uint8_t col = 0;
+  while (!(cols & (1 << col))) col++;
+  uint8_t key = KEYPAD_NO_KEY;
+  for (uint8_t row = 0; row < KEYPAD_ROWS && key == KEYPAD_NO_KEY; row++) {
+    if (!writePort((uint8_t)~(1 << row)) || !readPort(v)) break;
+    if (!(v & (0x10 << col))) key = row * KEYPAD_COLS + col;
+  }
+  writePort(PORT_REST);
+  readPort(v);  // reading the rest state clears INT
+  return key;
+}
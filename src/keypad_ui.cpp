@@ -0,0 +1,94 @@
+/**
+ * keypad_ui.cpp - Keypad state machine of the meter UI (see keypad_ui.h)
+ */
+#include "keypad_ui.h"
+
+static const char KEY_MAP[16] = {
+  'D', '#', '0', '*',
+  'C', '9', '8', '7',
+  'B', '6', '5', '4',
+  'A', '3', '2', '1',
+};
+
+KeypadUi::KeypadUi()
+    : state(STATE_WIFI_CONNECTING), infoScreen(UI_INFO_METER), runningScreen(0), inputLen(0) {
+  input[0] = '\0';
+}
+
+char KeypadUi::keyFor(uint8_t index) {
+  return index < sizeof(KEY_MAP) ? KEY_MAP[index] : '\0';
+}
+
+void KeypadUi::clearInput() {
+  inputLen = 0;
+  input[0] = '\0';
+}
+
+UiAction KeypadUi::key(char k) {
+  // Waiting for server validation: A = cancel (late response is ignored)
+  if (state == STATE_VALIDATING) {
+    if (k != 'A') return UI_NONE;
+    state = STATE_READY;
+    return UI_CANCEL_VALIDATION;
+  }
+
+  // When showing info screen (C/B/#), any key returns
+  if (state == STATE_INFO_SCREEN) return UI_LEAVE_INFO;
+
+  // EXHAUSTED: A = reset and return to READY (enter new token)
+  if (state == STATE_EXHAUSTED && k == 'A') {
+    clearInput();
+    state = STATE_READY;
+    return UI_SHOW_READY;
+  }
+
+  if (state == STATE_READY) {
+    if (k == 'A') {
+      state = STATE_ENTERING;
+      clearInput();
+      return UI_SHOW_ENTERING;
+    }
+    if (k == 'C' || k == 'B' || k == '#' || k == '*' || k == '0') {
+      infoScreen = k == 'C' ? UI_INFO_ENERGY : k == 'B' ? UI_INFO_PREVIOUS_TOKEN : UI_INFO_METER;
+      state = STATE_INFO_SCREEN;
+      return UI_SHOW_INFO;
+    }
+  }
+
+  if (state == STATE_RUNNING) {
+    if (k == '*' || k == '#') {
+      // # = +4 mod 5 = go back one
+      runningScreen = (runningScreen + (k == '*' ? 1 : UI_RUNNING_SCREENS - 1)) % UI_RUNNING_SCREENS;
+      return UI_SHOW_RUNNING;
+    }
+    if (k == 'C') {
+      infoScreen = UI_INFO_ENERGY;
+      state = STATE_INFO_SCREEN;
+      return UI_SHOW_INFO;
+    }
+  }
+
+  // ENTERING: 0-9 add digit (auto-submit at 20). D = delete, * = backspace. A = cancel.
+  if (k >= '0' && k <= '9') {
+    if (state == STATE_READY) {
+      state = STATE_ENTERING;
+      clearInput();
+    }
+    if (state != STATE_ENTERING || inputLen >= UI_TOKEN_DIGITS) return UI_NONE;
+    input[inputLen++] = k;
+    input[inputLen] = '\0';
+    return inputLen == UI_TOKEN_DIGITS ? UI_SUBMIT : UI_SHOW_ENTERING;
+  }
+  if (k == 'D' || k == '*') {
+    if (state != STATE_ENTERING || inputLen == 0) return UI_NONE;
+    input[--inputLen] = '\0';
+    if (inputLen == 0) state = STATE_READY;  // the emptied entry screen stays up
+    return UI_SHOW_ENTERING;
+  }
+  if (k == 'A' && state == STATE_ENTERING) {
+    clearInput();
+    state = STATE_READY;
+    return UI_SHOW_READY;
+  }
+  return UI_NONE;
+}
@@ -0,0 +1,52 @@
+/**
+ * latency_histogram.cpp - Log-bucketed latency histogram (see latency_histogram.h)
+ */
+#include "latency_histogram.h"
+#include <string.h>
+
+uint8_t LatencyHistogram::bucketOf(uint32_t us) {
+  if (us < 2) return (uint8_t)us;
+  uint8_t e = 31 - __builtin_clz(us);              // floor(log2(us)), >= 1
+  uint8_t b = (uint8_t)(2 * e + ((us >> (e - 1)) & 1));
+  return b < LHIST_BUCKETS ? b : LHIST_BUCKETS - 1;
+}
+
+uint32_t LatencyHistogram::bucketLow(uint8_t b) {
+  if (b < 2) return b;
+  uint8_t e = b / 2;
+  return (1UL << e) + (b & 1) * (1UL << (e - 1));
+}
+
+uint32_t LatencyHistogram::bucketHigh(uint8_t b) {
+  if (b < 2) return b;
+  if (b >= LHIST_BUCKETS - 1) return UINT32_MAX;  // overflow bucket
+  return bucketLow(b) + (1UL << (b / 2 - 1)) - 1;
+}
+
+void LatencyHistogram::record(uint32_t us) {
+  buckets_[bucketOf(us)]++;
+  count_++;
+  if (us > max_) max_ = us;
+}
+
+void LatencyHistogram::reset() {
+  memset(buckets_, 0, sizeof(buckets_));
+  count_ = 0;
+  max_ = 0;
+}
+
+uint32_t LatencyHistogram::percentile(uint8_t pct) const {
+  if (count_ == 0) return 0;
+  // rank of the percentile sample, 1-based, rounded up
+  uint32_t rank = (uint32_t)(((uint64_t)count_ * pct + 99) / 100);
+  if (rank == 0) rank = 1;
+  uint32_t seen = 0;
+  for (uint8_t b = 0; b < LHIST_BUCKETS; b++) {
+    seen += buckets_[b];
+    if (seen >= rank) {
+      uint32_t high = bucketHigh(b);
+      return high < max_ ? high : max_;
+    }
+  }
+  return max_;
+}
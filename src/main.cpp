@@ -11,18 +11,37 @@
 #endif
 
 // Combined sketch: PZEM + Nokia 5110 + PCF8574T Keypad + token logic + WiFi + API
-#include <PZEM004Tv30.h>
 #include <Adafruit_GFX.h>
-#include <Adafruit_PCD8544.h>
+#include "pcd8544.h"
 #include <Wire.h>
-#include <AdvKeyPad.h>
+#include "keypad_input.h"
+#include "keypad_ui.h"
 #include <WiFi.h>
 #include <WiFiManager.h>
-#include <WiFiUdp.h>
-#include <HTTPClient.h>
+#include "http_async.h"
+#include "pzem_snapshot.h"
+#include "hal_esp32.h"
+#include "metering_core.h"
 #include <ArduinoJson.h>
-#include <NTPClient.h>
 #include <EEPROM.h>
+#include "spsc_ring.h"
+#include "seqlock.h"
+#include "telemetry_log.h"
+#include "telemetry_codec.h"
+#include "report_policy.h"
+#include "api_schedule.h"
+#include "token_channel.h"
+#include "persist_journal.h"
+#include "billing_checkpoint.h"
+#include "token_store.h"
+#include "crypto_token.h"
+#include "scheduler.h"
+#include "time_sync.h"
+#include "latency_histogram.h"
+#include "interval_stats.h"
+#include "bench.h"
+#include "alloc_counter.h"
+#include <LittleFS.h>
 // C library includes for string and math helpers used by strcmp/isnan
 #include <string.h>
 #include <math.h>
@@ -43,25 +62,20 @@ const char* ntpServers[] = {
 const long gmtOffset_sec = 7200;
 // Daylight savings time offset (in seconds), 0 for Rwanda
 const int daylightOffset_sec = 0;
-// NTP update interval (60 seconds)
-const unsigned long ntpUpdateInterval = 60000;
-
-WiFiUDP ntpUDP;
-// Initialize NTPClient with 0 offset - we'll apply timezone manually for accuracy
-// This ensures we have full control over timezone application
-NTPClient timeClient(ntpUDP, ntpServers[0], 0, ntpUpdateInterval);
-bool timeSynchronized = false;
-unsigned long lastNTPAttempt = 0;
-int currentNTPServerIndex = 0;
-int ntpRetries = 10;
-const unsigned long ntpRetryInterval = 1000; // 1 second between retries
+
+WiFiUdpLink ntpUdp;
+// Queries all ntpServers at once from the "ntp" task and keeps the local clock
+// disciplined in between (time_sync.h); the timezone is applied on read
+TimeSync timeSync(halMicros);
 
 // Meter and client details are in config.h (METER_NUMBER, CLIENT_NAME, CLIENT_TIN, CLIENT_PHONE)
 
 // --------------------- PZEM CONFIG ---------------------
 #define PZEM_RX_PIN 17
 #define PZEM_TX_PIN 16
-PZEM004Tv30 pzem(Serial2, PZEM_RX_PIN, PZEM_TX_PIN);
+// One Modbus frame per metering tick, reply collected on the next tick (see pzem_snapshot.h)
+UartSerial pzemUart(Serial2);
+PzemSnapshot pzemBus(pzemUart);
 
 // --------------------- NOKIA 5110 CONFIG -----------------
 #define LCD_CLK  18
@@ -69,127 +83,192 @@ PZEM004Tv30 pzem(Serial2, PZEM_RX_PIN, PZEM_TX_PIN);
 #define LCD_DC   26
 #define LCD_CE   5
 #define LCD_RST  27
-Adafruit_PCD8544 display(LCD_CLK, LCD_DIN, LCD_DC, LCD_CE, LCD_RST);
+// CLK/DIN/CE are the VSPI IO_MUX pins: frames go out by DMA while loop() carries on
+Pcd8544Spi display(SPI3_HOST, LCD_CLK, LCD_DIN, LCD_DC, LCD_CE, LCD_RST);  // pushes only changed bytes
+uint32_t displayRenderUs = 0;     // last running-screen frame: format + draw + flush
+uint32_t displayRenderMaxUs = 0;
+// display.bitbang benchmark: the bit-banged transport on GPIOs this firmware leaves unused
+// (nothing is attached to them on the meter board)
+#define BENCH_BITBANG_CLK  32
+#define BENCH_BITBANG_DIN  33
+#define BENCH_BITBANG_DC   25
+#define BENCH_BITBANG_CE   14
 
 // --------------------- KEYPAD (PCF8574T) ----------------
 const uint8_t KBD_ADDR = 0x20;
 const uint8_t SDA_PIN = 21;
 const uint8_t SCL_PIN = 22;
-const byte ROWS = 4;
-const byte COLS = 4;
-char keys[ROWS][COLS] = {
-  {'D', '#', '0', '*'},
-  {'C', '9', '8', '7'},
-  {'B', '6', '5', '4'},
-  {'A', '3', '2', '1'}
-};
-AdvKeyPad keypad(KBD_ADDR);
+const int8_t KBD_INT_PIN = 19;   // PCF8574 INT (open drain, active low)
+KeypadInput keypad(Wire, KBD_ADDR, KBD_INT_PIN);  // scanned on INT, presses queued for loop()
 
 // --------------------- RELAY (power control) --------------
 // Relay ON = power to load, Relay OFF = cutoff when energy exhausted
 #define RELAY_PIN 2
-#define EEPROM_SIZE 64
-#define EEPROM_ADDR_REMAINING_KWH       0   // float (4 bytes)
-#define EEPROM_ADDR_SESSION_PURCHASED   4   // float (4 bytes)
-#define EEPROM_ADDR_PZEM_SESSION_START  8   // float (4 bytes) — PZEM energy() at token application time
-#define EEPROM_ADDR_TOKEN              12   // char[21] — active 20-digit token + null terminator
+GpioRelay relay(RELAY_PIN);
+// Billing state is kept in a wear-leveled flash journal (see persist_journal.h). Without the
+// journal partition it goes to the A/B checkpoint slots in EEPROM (see billing_checkpoint.h);
+// the legacy EEPROM slots are only read, once, to migrate (layout in metering_core.h).
+#define JOURNAL_PARTITION_LABEL "journal"
+EspPartitionFlash journalFlash;
+PersistJournal journal;
+EepromStore eepromStore;
 
 // --------------------- TOKENS ----------------------------
 // Token format: 20 digits with spaces (e.g., "1888 6583 5478 3413 6861")
 // Stored without spaces for comparison
-struct Token { 
-  const char *code;  // 20 digits without spaces
-  float kwh; 
-  const char *clientName;
-  const char *clientTIN;
-  const char *clientPhone;
+// Offline tokens live in the "tokens" partition (see token_store.h), written with
+// scripts/make-token-partition.mjs. These seeds provision a blank partition on first boot.
+#define TOKEN_PARTITION_LABEL "tokens"
+EspPartitionFlash tokenFlash;
+const TokenSeed tokenSeeds[] = {
+  {"18886583547834136861", 5.0},
+  {"12345678901234567890", 10.0},
+  {"98765432109876543210", 25.0}
 };
-Token tokens[] = {
-  {"18886583547834136861", 5.0, CLIENT_NAME, CLIENT_TIN, CLIENT_PHONE},
-  {"12345678901234567890", 10.0, CLIENT_NAME, CLIENT_TIN, CLIENT_PHONE},
-  {"98765432109876543210", 25.0, CLIENT_NAME, CLIENT_TIN, CLIENT_PHONE}
-};
-const int TOKENS_COUNT = sizeof(tokens) / sizeof(tokens[0]);
+TokenStore tokenStore;
+// Offline crypto tokens (see crypto_token.h), keyed with METER_TOKEN_KEY
+uint8_t tokenKey[CRYPTO_TOKEN_KEY_BYTES];
+bool tokenKeyValid = false;
 
 // --------------------- STATE -----------------------------
-enum State_t { STATE_READY, STATE_ENTERING, STATE_RUNNING, STATE_EXHAUSTED, STATE_BADTOKEN, STATE_WIFI_CONNECTING, STATE_INFO_SCREEN };
-State_t state = STATE_WIFI_CONNECTING;
-unsigned long infoScreenStart = 0;  // For C/B/# info screens (auto-return after 5s)
-int infoScreenType = 0;             // 0=meter, 1=energy, 2=previous token
-String lastTokenEntered = "";       // Last token applied (for B = check previous token)
-
-// input buffer for 20-digit token (digits only, spaces added for display)
-char inputBuf[21] = {0};  // 20 digits + null terminator
-uint8_t inputLen = 0;
-
-// running session
-float remaining_kwh = 0.0;
-float session_purchased_kwh = 0.0;
-// PZEM energy() reading captured at the moment a token is applied.
-// consumedKwh (real) = pzem.energy() - pzem_energy_at_session_start
-float pzem_energy_at_session_start = 0.0f;
-unsigned long lastMillis = 0;
-String currentToken = "";  // Store current token for API calls
-
-// keypad debounce
-uint8_t lastKeyIndex = 255;
-unsigned long lastKeyMillis = 0;
-const unsigned long KEY_DEBOUNCE_MS = 80;
-
-// keypad high priority: for 30s after any key press, skip blocking network calls so keypad stays responsive
-unsigned long lastKeypadActivityMillis = 0;
-const unsigned long KEYPAD_PRIORITY_MS = 30000;
+// UI state, token being typed and running screen index (see keypad_ui.h)
+KeypadUi ui;
+char lastTokenEntered[21] = "";     // Last token applied (for B = check previous token)
+
+// --------------------- METERING TASK (core 0) -------------
+// Metering + billing run in their own fixed-rate task pinned to PRO_CPU so that
+// blocking WiFi/HTTP/NTP work in loop() (APP_CPU) can never stretch the
+// integration interval. The task is the ONLY code that touches the MeteringCore
+// (pzemBus, the relay, the journal and the energy EEPROM slots) once setup() has finished.
+//   metering task -> loop():  sampleRing (SPSC)   + billingShared (seqlock)
+//   loop() -> metering task:  billingCommands (SPSC) for token application
+#define METER_TASK_CORE      0
+#define METER_TASK_PRIORITY  5
+#define METER_TASK_STACK     4096
+SpscRing<PzemReading, 16> sampleRing;
+SeqLock<BillingState> billingShared;
+SpscRing<BillingCommand, 4> billingCommands;
+uint32_t nextCommandId = 1;     // BillingCommand::id (loop()-side, never 0)
+uint32_t pendingCommandId = 0;  // keypad token the running screen waits for, 0 = none
+TaskHandle_t meteringTaskHandle = NULL;
+
+// Owned by the metering task (and by setup() before the task starts): ledger, relay,
+// persistence (see metering_core.h)
+MeteringCore metering(pzemBus, relay, journal, eepromStore);
+
+// loop()-side copies, refreshed every VIEW_REFRESH_MS by refreshMeteringView()
+PzemReading latestSample = {0, NAN, NAN, NAN, NAN, 0, NAN, NAN, 0, 0};
+BillingState billingView = {};
+// Every sample since the last logged record, closed into it by captureTelemetryRecord()
+IntervalStats windowStats;
 
 // display timing
-unsigned long lastDisplayMillis = 0;
 const unsigned long DISPLAY_REFRESH_MS = 500;
+const unsigned long STATUS_SCREEN_REFRESH_MS = 1000;  // EXHAUSTED / WiFi connecting
+const unsigned long NOTICE_HOLD_MS = 2000;            // "Token applied" stays up this long
+const unsigned long BAD_TOKEN_SCREEN_MS = 2000;
+const unsigned long INFO_SCREEN_MS = 5000;            // C/B/# info screens auto-return
 
-// Rotating display screens during STATE_RUNNING
+// Rotating display screens during STATE_RUNNING (ui.runningScreen)
 // 0=Energy(remaining/consumed), 1=Voltage+Current, 2=Power+SensorE, 3=Freq+PF, 4=Time
-uint8_t runningScreenIdx = 0;
-unsigned long lastScreenSwapMillis = 0;
 const unsigned long SCREEN_SWAP_MS = 4000;  // rotate every 4 seconds
 
-// API timing
-unsigned long lastApiSendMillis = 0;
-const unsigned long API_SEND_INTERVAL_MS = 30000;  // Send data every 30 seconds
-unsigned long sessionStartTime = 0;
+// API timing: readings are reported on change or heartbeat (cadence in api_schedule.h)
+ReportPolicy reportPolicy(REPORT_POLICY_CONFIG);
+unsigned long sessionStartTime = 0;  // loop()-side, for sessionDuration in telemetry
 
-// Token polling timing
-unsigned long lastTokenCheckMillis = 0;
-const unsigned long TOKEN_CHECK_INTERVAL_MS = 10000;  // Check for pending tokens every 10 seconds
+// Token delivery: pushed over the WebSocket channel; HTTP polling only while it is down
+TokenChannel tokenChannel;
+const unsigned long TOKEN_INBOX_INTERVAL_MS = 100;
+uint64_t submittedPurchase = 0;  // purchaseIdHash() of the last purchase queued (in billingView.purchases once applied)
 
 // WiFi connection status
 bool wifiConnected = false;
 
-// EEPROM helpers: persist purchased/remaining energy across power loss
-void loadEnergyFromEEPROM();
-void saveRemainingToEEPROM();
-void saveSessionPurchasedToEEPROM();
-void savePzemSessionStartToEEPROM();
-void saveTokenToEEPROM();
+// --------------------- LOOP SCHEDULER --------------------
+// Everything loop() does is a task on this scheduler (see scheduler.h, registerLoopTasks())
+Scheduler scheduler(halMillis, halMicros);
+const unsigned long LOOP_MAX_SLEEP_MS = 5;
+const unsigned long UI_POLL_MS = 10;          // keypad queue + HTTP slices
+const unsigned long VIEW_REFRESH_MS = 50;     // metering snapshot (the task itself runs every 200 ms)
+const unsigned long SERIAL_COMMAND_MS = 100;
+LatencyHistogram loopLatency;                 // one scheduler pass (all due tasks), us
+char serialLine[24];                          // serial command being typed
+BenchRunner bench("esp32");                   // fixed-seed benchmarks, "bench" on the console
+uint8_t serialLineLen = 0;
+unsigned long allocArmedAtMs = 0;             // "alloc": counting since (alloc_counter.h)
+uint8_t tScreenSwap = SCHED_NONE;
+uint8_t tDisplay = SCHED_NONE;
+uint8_t tWiFiReconnect = SCHED_NONE;
+uint8_t tTelemetryDrain = SCHED_NONE;
+uint8_t tBadTokenTimeout = SCHED_NONE;
+uint8_t tInfoTimeout = SCHED_NONE;
+uint8_t tNtp = SCHED_NONE;
+
+// --------------------- ASYNC HTTP ------------------------
+// All API calls go through one non-blocking engine advanced from loop() (see http_async.h)
+AsyncHttp api;
+const uint32_t HTTP_POLL_SLICE_MS = 3;           // max time per scheduler pass spent on HTTP
+bool tokenPollInFlight = false;                  // at most one pending-token GET queued
+char validatingToken[21] = {0};                  // keypad token awaiting server validation
+// Nothing on the periodic paths allocates (check with the esp32dev-alloc build, alloc_counter.h):
+// request and response documents, the serialized body and the fixed paths live here, not on the heap
+StaticJsonDocument<4096> apiRequestDoc;          // an 8-reading /energy-data/batch is ~2.7 KB
+StaticJsonDocument<512> apiResponseDoc;
+char apiRequestBody[HTTP_MAX_REQ_BODY];
+const char PENDING_TOKEN_PATH[] = "/purchases/pending-token/" METER_NUMBER;
+
+// --------------------- TELEMETRY LOG ---------------------
+// Every reading is appended to flash first and uploaded from there (see telemetry_log.h);
+// budget, batching and drain pace are in api_schedule.h
+TelemetryLog telemetryLog;
+const char* TELEMETRY_LOG_DIR = "/tlm";
+// Upload encoding, stepped down one level each time the server answers 404 (older deployment)
+enum TelemetryUploadMode { UPLOAD_BINARY, UPLOAD_JSON_BATCH, UPLOAD_JSON_SINGLE };
+TelemetryUploadMode telemetryUploadMode = UPLOAD_BINARY;
+uint8_t telemetryFrameVersion = TCODEC_VERSION;          // stepped down on 415 (server older than the codec)
+bool telemetryIdentitySent = false;                      // server has our client name/TIN/phone
+bool telemetryFrameHasIdentity = false;                  // in-flight binary frame carries them
+bool telemetryUploadInFlight = false;                    // at most one logged upload in the HTTP queue
+bool telemetryFlushRequested = false;                    // send the next upload without waiting for a full batch
+
+// Metering task + cross-core handoff
+void meteringTask(void* arg);
+void meteringTick();
+void refreshMeteringView();
+void registerLoopTasks();
+void registerBenchmarks();
+uint32_t submitBillingCommand(const char* token, float kwh, bool topUp, uint16_t cryptoSeq = 0, uint64_t purchase = 0);
+bool billingCommandDone(uint32_t id);
+void finishKeypadToken();
+void runBenchmarks(const char* prefix);
 
 // Forward declarations
 void showReadyScreen();
 void printHeader(const char* subtitle);
 void handleKeypad();
+void handleKey(char k);
 void showRunningScreen();
 void showExhaustedScreen();
 void showEnteringScreen();
 void submitToken();
 void connectWiFi();
-void sendEnergyDataToAPI();
+void sendEnergyDataToAPI(bool urgent = false);
+ReportSample currentReportSample();
+void drainTelemetryLog();
 void sendTestDataToAPI();  // Function to send test data for server testing
 void showWiFiConnectingScreen();
 void showWiFiConfigPortalScreen(WiFiManager* wm);
 void showMeterNumberScreen();
 void showCheckEnergyScreen();
 void showPreviousTokenScreen();
+void leaveInfoScreen();
 bool checkForPendingToken();  // Check server for pending token
-bool applyTokenFromServer(String tokenNumber, float kwhAmount, String purchaseId);  // Apply token received from server
-bool validateTokenFromServer(String tokenNumber);  // Validate token with server
-void synchronizeNTPTime();  // Synchronize time with NTP servers
-String getFormattedTimestamp();  // Get formatted timestamp (ISO 8601 format)
+bool applyTokenFromServer(const char* tokenNumber, float kwhAmount, const char* purchaseId);  // Apply token received from server
+void confirmTokenDelivery(const char* purchaseId);  // Tell the server the token was applied
+bool validateTokenFromServer(const char* tokenNumber);  // Validate token with server (async, result via callback)
+void showBadTokenScreen(const char* reason, const char* detail = nullptr);
+const char* getFormattedTimestamp();  // Get formatted timestamp (ISO 8601 format)
 
 void setup() {
   Serial.begin(115200);
@@ -204,8 +283,7 @@ void setup() {
   display.setTextSize(1);
   display.setTextColor(BLACK);
 
-  Wire.begin(SDA_PIN, SCL_PIN);
-  if (!keypad.begin()) {
+  if (!keypad.begin(SDA_PIN, SCL_PIN)) {
     Serial.println(F("[SmartMeter] Warning: Keypad not found - continuing (WiFi AP will still start)"));
     SERIAL_PRINTLN("Error: Couldn't find PCF8574T I2C expander");
     display.clearDisplay();
@@ -216,218 +294,456 @@ void setup() {
     // Continue so WiFi config AP can still appear
   }
 
-  pinMode(RELAY_PIN, OUTPUT);
-  digitalWrite(RELAY_PIN, LOW);  // Relay OFF (no power to load) until we have energy
+  relay.begin();
+  relay.set(false);  // Relay OFF (no power to load) until we have energy
+
+  bool haveTokenPartition = tokenFlash.begin(TOKEN_PARTITION_LABEL);
+  if (!tokenStore.begin(haveTokenPartition ? &tokenFlash : NULL, tokenSeeds,
+                        sizeof(tokenSeeds) / sizeof(tokenSeeds[0]))) {
+    Serial.println(F("[SmartMeter] Warning: no token partition - redeemed tokens reset on reboot"));
+  }
+  SERIAL_PRINT("Offline tokens: "); SERIAL_PRINTLN(tokenStore.count());
+  tokenKeyValid = cryptoTokenParseKey(METER_TOKEN_KEY, tokenKey);
+  if (!tokenKeyValid) {
+    Serial.println(F("[SmartMeter] Warning: METER_TOKEN_KEY not set - crypto tokens disabled"));
+  }
 
+  // Ledger and token: journal, else EEPROM (migrated into the journal); relay from the credit
   EEPROM.begin(EEPROM_SIZE);
-  loadEnergyFromEEPROM();
+  if (!journalFlash.begin(JOURNAL_PARTITION_LABEL) ||
+      !journal.begin(journalFlash, PERSIST_COMMIT_INTERVAL_MS)) {
+    Serial.println(F("[SmartMeter] Warning: no journal partition - using EEPROM"));
+  }
+  const char* restoredFrom = metering.restore(millis());
+  if (restoredFrom != NULL) {
+    strncpy(lastTokenEntered, metering.billing().token, sizeof(lastTokenEntered) - 1);
+    SERIAL_PRINT("Restored token from "); SERIAL_PRINT(restoredFrom); SERIAL_PRINT(": ");
+    SERIAL_PRINTLN(metering.billing().token);
+  }
 
-  // Relay from restored energy: ON if we have remaining, OFF otherwise
-  if (remaining_kwh > 0.00001f) {
-    digitalWrite(RELAY_PIN, HIGH);  // Relay ON (power to load)
+  // Publish the restored state, then hand the metering core over to the metering task
+  billingShared.write(metering.billing());
+  billingView = metering.billing();
+  xTaskCreatePinnedToCore(meteringTask, "metering", METER_TASK_STACK, NULL,
+                          METER_TASK_PRIORITY, &meteringTaskHandle, METER_TASK_CORE);
+
+  if (LittleFS.begin(true) && telemetryLog.begin(LittleFS, TELEMETRY_LOG_DIR, TELEMETRY_LOG_BUDGET_BYTES)) {
+    SERIAL_PRINT("Telemetry log: ");
+    SERIAL_PRINT(telemetryLog.pending());
+    SERIAL_PRINTLN(" records waiting for upload");
+  } else {
+    Serial.println(F("[SmartMeter] Warning: LittleFS unavailable - telemetry is not buffered"));
+  }
+
+  if (!api.begin(apiBaseUrl)) {
+    Serial.println(F("[SmartMeter] Warning: invalid API_BASE_URL - API calls disabled"));
+  } else if (METER_SOCKET_KEY[0] == '\0') {
+    Serial.println(F("[SmartMeter] No METER_SOCKET_KEY - tokens are polled over HTTP"));
   } else {
-    remaining_kwh = 0.0f;
-    session_purchased_kwh = 0.0f;
-    digitalWrite(RELAY_PIN, LOW);   // Relay OFF (cutoff)
+    // Token push channel on the same host: <prefix>/meter-socket?meter=<METER_NUMBER>
+    char wsPath[96];
+    snprintf(wsPath, sizeof(wsPath), "%s/meter-socket?meter=%s", api.prefix(), METER_NUMBER);
+    tokenChannel.begin(api.host(), api.port(), api.secure(), wsPath, METER_NUMBER, METER_SOCKET_KEY);
   }
 
   // Connect to WiFi
   Serial.println(F("[SmartMeter] Starting WiFi..."));
-  state = STATE_WIFI_CONNECTING;
+  ui.state = STATE_WIFI_CONNECTING;
   showWiFiConnectingScreen();
   connectWiFi();
   
+  refreshMeteringView();
   if (wifiConnected) {
-    if (remaining_kwh > 0.00001f) {
-      state = STATE_RUNNING;
-      digitalWrite(RELAY_PIN, HIGH);
+    if (billingView.remaining_kwh > 0.00001f) {
+      ui.state = STATE_RUNNING;
       showRunningScreen();
     } else {
       showReadyScreen();
-      state = STATE_READY;
+      ui.state = STATE_READY;
     }
-    // Start NTP synchronization
-    synchronizeNTPTime();
-    
     // Uncomment the line below to send test data on startup (for testing)
     // sendTestDataToAPI();
   } else {
-    state = (remaining_kwh > 0.00001f) ? STATE_RUNNING : STATE_READY;
-    if (state == STATE_RUNNING) {
-      digitalWrite(RELAY_PIN, HIGH);
+    ui.state = (billingView.remaining_kwh > 0.00001f) ? STATE_RUNNING : STATE_READY;
+    if (ui.state == STATE_RUNNING) {
       showRunningScreen();
     } else {
       showReadyScreen();
     }
   }
+
+  // The first sync round goes out with the first scheduler pass (no-op until the link is up)
+  for (uint8_t i = 0; i < sizeof(ntpServers) / sizeof(ntpServers[0]); i++) timeSync.addServer(ntpServers[i]);
+  timeSync.setLocalOffset(gmtOffset_sec + daylightOffset_sec);
+  timeSync.begin(&ntpUdp);
+
+  registerLoopTasks();
+  registerBenchmarks();
+
+  // esp32dev-alloc builds: from here on every heap allocation of loop() and the metering task counts
+  allocCounterWatch(NULL);
+  allocCounterWatch(meteringTaskHandle);
+  allocCounterArm();
+  allocArmedAtMs = millis();
 }
 
 /**
- * loop() execution order and blocking:
- * 1. handleKeypad() - ONLY keypad poll; if we block below, no keys are seen until we return.
- * 2. WiFi reconnect - can block (delay + connectWiFi up to ~10s).
- * 3. NTP sync - timeClient.update() can block several seconds.
- * 4. checkForPendingToken() every 10s - http.GET() blocks up to timeout (2s).
- * 5. STATE_RUNNING: sendEnergyDataToAPI() every 30s - http.POST() + retry delay block.
- * 6. submitToken() -> validateTokenFromServer() / applyTokenFromServer() - HTTP + delay(2s) block.
- * So: long delays and HTTP calls prevent handleKeypad() from running; keypad is polled only once per loop. Fix: poll keypad during every long delay and again at end of loop.
+ * loop() only runs the scheduler: all UI/network work is a task registered in
+ * registerLoopTasks() and run when due, highest priority first. Each task has a CPU
+ * budget; overruns are counted and logged with the stats. Between passes loop() sleeps
+ * until the next task is due (at most LOOP_MAX_SLEEP_MS).
+ * Every task run and every pass is recorded in a latency histogram: "lat" on the serial
+ * console dumps them, and each binary telemetry frame carries the pass p50/p99/max and
+ * the worst task run since boot.
+ *
+ * Blocking that remains:
+ * - sendEnergyDataToAPI() appends a record to the LittleFS telemetry log (one small file append).
+ * HTTP and NTP never block here: TLS connect runs in the http-connect helper task, everything else is
+ * sliced by AsyncHttp. Key presses are scanned and queued by the keypad task, which preempts
+ * loop(), so none are lost while a task runs long.
+ * Energy integration and relay cutoff do NOT happen here: they run in meteringTask() on the
+ * other core at a fixed 200 ms cadence, so none of the blocking above affects billing.
  */
 void loop() {
+  uint32_t t0 = micros();  // esp_timer based on the ESP32 core
+  uint32_t idleMs = scheduler.run();
+  loopLatency.record(micros() - t0);
+  delay(idleMs < LOOP_MAX_SLEEP_MS ? idleMs : LOOP_MAX_SLEEP_MS);
+}
+
+// ------ loop() tasks ------
+
+SchedResult taskMeteringView(void*) {
+  refreshMeteringView();
+  if (pendingCommandId != 0 && billingCommandDone(pendingCommandId)) finishKeypadToken();
+  return SCHED_DONE;
+}
+
+SchedResult taskKeypad(void*) {
   handleKeypad();
-  unsigned long now = millis();
+  return SCHED_DONE;
+}
+
+SchedResult taskHttp(void*) {
+  api.poll(HTTP_POLL_SLICE_MS);
+  return SCHED_DONE;
+}
 
-  // Reconnect WiFi if disconnected - skip during keypad priority (first 30s after any key)
+// Track the WiFi link; retry NTP at once after a reconnect and the link while it is down
+SchedResult taskWiFiWatch(void*) {
   if (WiFi.status() != WL_CONNECTED) {
     wifiConnected = false;
-    bool doReconnect = (now % 10000 < 100);  // every 10s
-    if (doReconnect) {
-      bool skipForKeypad = (now - lastKeypadActivityMillis < KEYPAD_PRIORITY_MS);
-      if (!skipForKeypad) {
-      SERIAL_PRINTLN("WiFi disconnected, attempting reconnect...");
-      WiFi.reconnect();
-      for (int i = 0; i < 20; i++) { handleKeypad(); delay(50); }  // ~1s, keypad stays responsive
-      if (WiFi.status() == WL_CONNECTED) {
-        wifiConnected = true;
-        SERIAL_PRINTLN("WiFi reconnected!");
-        // Reinitialize NTP after reconnection
-        if (!timeSynchronized) {
-          timeClient.begin();
-          synchronizeNTPTime();
-        }
-      } else {
-        connectWiFi();
-      }
-      }
-    }
-  } else if (!wifiConnected) {
+    if (!scheduler.armed(tWiFiReconnect)) scheduler.start(tWiFiReconnect, 0);
+    return SCHED_DONE;
+  }
+  scheduler.stop(tWiFiReconnect);
+  if (!wifiConnected) {
     wifiConnected = true;
     SERIAL_PRINTLN("WiFi reconnected!");
-    // Reinitialize NTP after reconnection
-    if (!timeSynchronized) {
-      timeClient.begin();
-      synchronizeNTPTime();
+    if (!timeSync.synced()) {  // once synced the disciplined clock bridges the outage
+      timeSync.resync();
+      scheduler.start(tNtp, 0);
     }
   }
-  
-  // Keypad priority: for 30s after any key we skip blocking work; then resume normal loop
-  bool keypadPriorityActive = (now - lastKeypadActivityMillis < KEYPAD_PRIORITY_MS);
-  static bool wasKeypadPriority = false;
-  if (!keypadPriorityActive && wasKeypadPriority) {
-    Serial.println("[KEYPAD] 30s idle - normal loop resumed");
-    wasKeypadPriority = false;
-  }
-  if (keypadPriorityActive) wasKeypadPriority = true;
-
-  // Synchronize NTP time at WiFi connect (skip during keypad priority so loop stays fast)
-  if (wifiConnected && WiFi.status() == WL_CONNECTED && !timeSynchronized) {
-    if (!keypadPriorityActive)
-      synchronizeNTPTime();
-  }
-
-  // Check for pending tokens from server - SKIP during keypad priority (first 30s after any key)
-  if (!keypadPriorityActive &&
-      (state == STATE_READY || state == STATE_RUNNING) && wifiConnected && WiFi.status() == WL_CONNECTED) {
-    if (now - lastTokenCheckMillis >= TOKEN_CHECK_INTERVAL_MS) {
-      lastTokenCheckMillis = now;
-      checkForPendingToken();
-    }
+  return SCHED_DONE;
+}
+
+// One NTP step: send, collect replies, or sleep until the next round (re-arms itself)
+SchedResult taskNtp(void*) {
+  uint32_t steps = timeSync.steps();
+  scheduler.start(tNtp, timeSync.poll());
+  if (timeSync.steps() != steps) {
+    SERIAL_PRINT("Clock set from ");
+    SERIAL_PRINT(timeSync.server(timeSync.selected()).host);
+    SERIAL_PRINT(", local time (GMT+2): ");
+    SERIAL_PRINTLN(timeSync.isoLocal());
   }
+  return SCHED_DONE;
+}
 
-  // Update running energy consumption
-  if (state == STATE_RUNNING) {
-    if (lastMillis == 0) {
-      lastMillis = now;
-      sessionStartTime = now;
-    }
-    unsigned long dt_ms = now - lastMillis;
-    if (dt_ms >= 200) {
-      float powerW = pzem.power();
-      if (!isnan(powerW)) {
-        float delta_kwh = (powerW * (dt_ms / 1000.0)) / 3600000.0;
-        remaining_kwh -= delta_kwh;
-        if (remaining_kwh < 0) remaining_kwh = 0;
-      }
-      lastMillis = now;
-    }
+// Non-blocking; the WiFi stack finishes in the background
+SchedResult taskWiFiReconnect(void*) {
+  SERIAL_PRINTLN("WiFi disconnected, attempting reconnect...");
+  WiFi.reconnect();
+  return SCHED_DONE;
+}
 
-    // Rotate display screen every 4 seconds (auto-advance)
-    if (now - lastScreenSwapMillis >= SCREEN_SWAP_MS) {
-      runningScreenIdx = (runningScreenIdx + 1) % 5;
-      lastScreenSwapMillis = now;
-    }
-    if (now - lastDisplayMillis >= DISPLAY_REFRESH_MS) {
-      showRunningScreen();
-      lastDisplayMillis = now;
-    }
+// Tokens pushed by the server; left queued while a keypad entry/validation is in progress
+SchedResult taskTokenInbox(void*) {
+  if (ui.state != STATE_READY && ui.state != STATE_RUNNING) return SCHED_DONE;
+  PushedToken pushed;
+  if (tokenChannel.receive(pushed)) {
+    SERIAL_PRINT("Token pushed: "); SERIAL_PRINTLN(pushed.tokenNumber);
+    applyTokenFromServer(pushed.tokenNumber, pushed.kwhAmount, pushed.purchaseId);
+  }
+  return SCHED_DONE;
+}
 
-    // Guard: only proceed with API send and exhaustion check when sensor gives valid readings
-    float voltage = pzem.voltage();
-    float current = pzem.current();
-    if (!isnan(voltage) && !isnan(current)) {
+// Fallback: poll for pending tokens while the push channel is down
+SchedResult taskTokenPoll(void*) {
+  if ((ui.state == STATE_READY || ui.state == STATE_RUNNING) && wifiConnected && WiFi.status() == WL_CONNECTED &&
+      !tokenChannel.connected()) {
+    checkForPendingToken();
+  }
+  return SCHED_DONE;
+}
 
-    // Send data to API periodically - SKIP during keypad priority so keypad stays responsive
-    if (!keypadPriorityActive &&
-        wifiConnected && (now - lastApiSendMillis >= API_SEND_INTERVAL_MS)) {
-      sendEnergyDataToAPI();
-      lastApiSendMillis = now;
-    }
+// Backfill telemetry from the flash log (one upload in flight)
+SchedResult taskTelemetryDrain(void*) {
+  drainTelemetryLog();
+  return SCHED_DONE;
+}
 
-    // Check energy exhausted -> cutoff power (relay OFF)
-    if (remaining_kwh <= 0.00001) {
-      // Send final data before exhausting (always send)
-      if (wifiConnected) {
-        sendEnergyDataToAPI();
-      }
-      digitalWrite(RELAY_PIN, LOW);  // Cutoff power
-      saveRemainingToEEPROM();
-      state = STATE_EXHAUSTED;
-      lastMillis = 0;
-      showExhaustedScreen();
-    } else {
-      // Periodically save remaining to EEPROM so it survives power loss
-      static unsigned long lastEepromSave = 0;
-      if (now - lastEepromSave >= 5000) {
-        lastEepromSave = now;
-        saveRemainingToEEPROM();
-      }
-    }
-  }  // end if (!isnan(voltage) && !isnan(current))
-  }  // end if (state == STATE_RUNNING)
+// Running session: energy is integrated by the metering task; here we only drive
+// telemetry and the EXHAUSTED transition from its snapshot (once it has handled the
+// last token, so a stale EXHAUSTED does not count)
+SchedResult taskSession(void*) {
+  if (ui.state != STATE_RUNNING || !billingCommandDone(nextCommandId - 1)) return SCHED_DONE;
+  unsigned long now = millis();
+  if (sessionStartTime == 0) sessionStartTime = now;
+
+  // Metering task already cut the relay -> send final data and show EXHAUSTED
+  if (billingView.exhausted) {
+    sendEnergyDataToAPI(true);
+    ui.state = STATE_EXHAUSTED;
+    sessionStartTime = 0;
+    showExhaustedScreen();
+    return SCHED_DONE;
+  }
+  // Log a reading on deadband crossings, sensor loss/recovery or the backing-off
+  // heartbeat (uploaded by drainTelemetryLog(), also after an outage)
+  ReportSample sample = currentReportSample();
+  uint8_t reasons = reportPolicy.evaluate(now, sample);
+  if (reasons) {
+    SERIAL_PRINT("Report reasons: "); SERIAL_PRINTLN(reasons);
+    sendEnergyDataToAPI((reasons & REPORT_URGENT) != 0);
+    reportPolicy.reported(now, sample, reasons);
+  }
+  return SCHED_DONE;
+}
 
-  if (state == STATE_EXHAUSTED) {
-    if (millis() - lastDisplayMillis >= 1000) {
-      showExhaustedScreen();
-      lastDisplayMillis = millis();
-    }
+// Rotate the running screen (auto-advance; * and # restart the period)
+SchedResult taskScreenSwap(void*) {
+  if (ui.state == STATE_RUNNING) ui.runningScreen = (ui.runningScreen + 1) % UI_RUNNING_SCREENS;
+  return SCHED_DONE;
+}
+
+// Running screen refresh; a notice postpones it with scheduler.start(tDisplay, NOTICE_HOLD_MS)
+SchedResult taskDisplay(void*) {
+  if (ui.state == STATE_RUNNING) showRunningScreen();
+  return SCHED_DONE;
+}
+
+SchedResult taskStatusScreen(void*) {
+  if (ui.state == STATE_EXHAUSTED) showExhaustedScreen();
+  if (ui.state == STATE_WIFI_CONNECTING) showWiFiConnectingScreen();
+  return SCHED_DONE;
+}
+
+SchedResult taskBadTokenTimeout(void*) {
+  if (ui.state == STATE_BADTOKEN) {
+    ui.state = STATE_READY;
+    ui.clearInput();
+    showReadyScreen();
   }
+  return SCHED_DONE;
+}
 
-  if (state == STATE_BADTOKEN) {
-    static unsigned long badStart = 0;
-    if (badStart == 0) badStart = millis();
-    if (millis() - badStart >= 2000) {
-      badStart = 0;
-      state = STATE_READY;
-      inputLen = 0;
-      inputBuf[0] = '\0';
-      showReadyScreen();
-    }
+// Info screens (C=Energy, B=Prev token, #/*/0=Meter): back to READY (or RUNNING) after 5s
+SchedResult taskInfoTimeout(void*) {
+  if (ui.state == STATE_INFO_SCREEN) leaveInfoScreen();
+  return SCHED_DONE;
+}
+
+void printLatencyRow(const char* name, const LatencyHistogram& h) {
+  char line[96];
+  snprintf(line, sizeof(line), "[LAT] %-16s %10lu %9lu %9lu %9lu", name, (unsigned long)h.count(),
+           (unsigned long)h.percentile(50), (unsigned long)h.percentile(99), (unsigned long)h.max());
+  Serial.println(line);
+}
+
+void printLatencyBuckets(const char* name, const LatencyHistogram& h) {
+  Serial.print("[LAT] buckets for "); Serial.println(name);
+  char line[64];
+  for (uint8_t b = 0; b < LHIST_BUCKETS; b++) {
+    if (h.bucketCount(b) == 0) continue;
+    snprintf(line, sizeof(line), "[LAT]   %9lu..%-9lu %10lu", (unsigned long)LatencyHistogram::bucketLow(b),
+             (unsigned long)LatencyHistogram::bucketHigh(b), (unsigned long)h.bucketCount(b));
+    Serial.println(line);
   }
+}
+
+void printTimeSync() {
+  char line[128];
+  uint32_t age = timeSync.lastSyncAgeMs();
+  snprintf(line, sizeof(line), "[TIME] %s synced=%d syncs=%lu steps=%lu last=%lds ago err=%ldus drift=%.2fppm poll=%lus",
+           timeSync.isoLocal(), timeSync.synced(), (unsigned long)timeSync.syncs(), (unsigned long)timeSync.steps(),
+           age == UINT32_MAX ? -1L : (long)(age / 1000), (long)timeSync.lastErrorUs(), timeSync.freqPpb() / 1000.0,
+           (unsigned long)(timeSync.pollIntervalMs() / 1000));
+  Serial.println(line);
+  Serial.println("[TIME] server               stratum   sent replies rejected  lost   offsetus    rttus");
+  for (uint8_t i = 0; i < timeSync.serverCount(); i++) {
+    const NtpServerStats& s = timeSync.server(i);
+    snprintf(line, sizeof(line), "[TIME] %-20s %7u %6lu %7lu %8lu %5lu %10ld %8lu%s", s.host, s.stratum,
+             (unsigned long)s.sent, (unsigned long)s.replies, (unsigned long)s.rejected, (unsigned long)s.lost,
+             (long)s.offsetUs, (unsigned long)s.rttUs,
+             i == timeSync.selected() ? " *" : (s.falseticker ? " x" : ""));
+    Serial.println(line);
+  }
+}
 
-  if (state == STATE_WIFI_CONNECTING) {
-    if (millis() - lastDisplayMillis >= 1000) {
-      showWiFiConnectingScreen();
-      lastDisplayMillis = millis();
+void printAllocCounter(bool reset) {
+  if (!ALLOC_COUNTER_ENABLED) {
+    Serial.println("[ALLOC] not counted in this build (pio run -e esp32dev-alloc)");
+    return;
+  }
+  if (reset) {
+    allocCounterArm();
+    allocArmedAtMs = millis();
+    Serial.println("[ALLOC] reset");
+    return;
+  }
+  AllocCounterStats a = allocCounterStats();
+  char line[128];
+  snprintf(line, sizeof(line), "[ALLOC] %lu allocations, %lu bytes, largest %lu in the last %lu s",
+           (unsigned long)a.count, (unsigned long)a.bytes, (unsigned long)a.largest,
+           (unsigned long)((millis() - allocArmedAtMs) / 1000));
+  Serial.println(line);
+  if (a.count > 0) {
+    // xtensa-esp32-elf-addr2line -e .pio/build/esp32dev-alloc/firmware.elf <caller>
+    snprintf(line, sizeof(line), "[ALLOC] first %lu bytes from %p, last %lu bytes from %p",
+             (unsigned long)a.firstSize, a.firstCaller, (unsigned long)a.lastSize, a.lastCaller);
+    Serial.println(line);
+  }
+}
+
+/**
+ * Serial console commands (always on, independent of SERIAL_LOGGING_ENABLED):
+ *   lat          count / p50 / p99 / max (us) per scheduler pass and per task, worst run
+ *   lat <task>   the non-empty histogram buckets of one task ("loop" = whole pass)
+ *   lat reset    start the histograms over
+ *   bench        run the fixed-seed benchmarks (bench.h), one JSON line per case
+ *   bench <p>    only the cases whose name starts with p ("token.", "display.", "json.energy_data")
+ *   time         NTP state: local time, drift, poll interval, and per server sent/replies/offset/RTT
+ *   alloc        heap allocations of loop() and the metering task since boot (esp32dev-alloc builds)
+ *   alloc reset  count from now on, e.g. once the first connection is up
+ */
+void runSerialCommand(const char* cmd) {
+  if (strncmp(cmd, "bench", 5) == 0 && (cmd[5] == '\0' || cmd[5] == ' ')) {
+    runBenchmarks(cmd[5] ? cmd + 6 : "");
+    return;
+  }
+  if (strcmp(cmd, "time") == 0) {
+    printTimeSync();
+    return;
+  }
+  if (strcmp(cmd, "alloc") == 0 || strcmp(cmd, "alloc reset") == 0) {
+    printAllocCounter(cmd[5] != '\0');
+    return;
+  }
+  if (strncmp(cmd, "lat", 3) != 0 || (cmd[3] != '\0' && cmd[3] != ' ')) {
+    Serial.println("[CMD] commands: lat, lat <task>, lat reset, bench, bench <prefix>, time, alloc, alloc reset");
+    return;
+  }
+  const char* arg = cmd[3] ? cmd + 4 : "";
+  if (strcmp(arg, "reset") == 0) {
+    loopLatency.reset();
+    scheduler.resetLatency();
+    Serial.println("[LAT] reset");
+    return;
+  }
+  if (strcmp(arg, "loop") == 0) {
+    printLatencyBuckets("loop", loopLatency);
+    return;
+  }
+  for (uint8_t id = 0; arg[0] && id < scheduler.taskCount(); id++) {
+    if (strcmp(arg, scheduler.stats(id).name) == 0) {
+      printLatencyBuckets(arg, scheduler.latency(id));
+      return;
     }
   }
+  Serial.println("[LAT] phase                 count     p50us     p99us     maxus");
+  printLatencyRow("loop", loopLatency);
+  for (uint8_t id = 0; id < scheduler.taskCount(); id++) {
+    printLatencyRow(scheduler.stats(id).name, scheduler.latency(id));
+  }
+  uint8_t worst = scheduler.worstTask();
+  if (worst != SCHED_NONE) {
+    Serial.print("[LAT] worst run: "); Serial.print(scheduler.stats(worst).name);
+    Serial.print(" "); Serial.print(scheduler.worstUs());
+    Serial.print(" us at uptime "); Serial.print(scheduler.worstAtMs()); Serial.println(" ms");
+  }
+}
 
-  // Info screens (C=Energy, B=Prev token, #/*/0=Meter): auto-return to READY after 5s
-  if (state == STATE_INFO_SCREEN && (now - infoScreenStart >= 5000)) {
-    state = STATE_READY;
-    showReadyScreen();
+// Collect a console line without blocking; run it on newline
+SchedResult taskSerialCommand(void*) {
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (c == '\r' || c == '\n') {
+      if (serialLineLen == 0) continue;
+      serialLine[serialLineLen] = '\0';
+      serialLineLen = 0;
+      runSerialCommand(serialLine);
+    } else if (serialLineLen < sizeof(serialLine) - 1) {
+      serialLine[serialLineLen++] = (char)c;
+    }
   }
+  return SCHED_DONE;
+}
 
-  handleKeypad();  // Poll again so keys are not missed after long stretches
-  delay(5);
+/**
+ * registerLoopTasks()
+ * Called once at the end of setup(). Priority decides the order when several tasks
+ * are due in the same pass; budgets (us) only count overruns.
+ *
+ *   task             period                      prio  budget
+ *   metering-view    VIEW_REFRESH_MS               5     300
+ *   keypad           UI_POLL_MS                    4    8000   (a key may redraw the screen)
+ *   http             UI_POLL_MS                    3    HTTP_POLL_SLICE_MS + 1 ms
+ *   session          SESSION_CHECK_MS              3    8000   (telemetry log append)
+ *   token-inbox      TOKEN_INBOX_INTERVAL_MS       2    8000
+ *   display          DISPLAY_REFRESH_MS            2    5000
+ *   screen-swap      SCREEN_SWAP_MS                2     100
+ *   status-screen    STATUS_SCREEN_REFRESH_MS      1    5000
+ *   wifi-watch       WIFI_WATCH_INTERVAL_MS        1    2000
+ *   ntp              one-shot, re-armed by itself  1    2000   (NTP_RX_POLL_MS while replies are due)
+ *   token-poll       TOKEN_CHECK_INTERVAL_MS       1    2000
+ *   telemetry-drain  TELEMETRY_DRAIN_INTERVAL_MS   1   10000
+ *   wifi-reconnect   WIFI_RECONNECT_INTERVAL_MS    1    2000   (armed while the link is down)
+ *   serial-cmd       SERIAL_COMMAND_MS             0    2000   (a "lat" dump or a "bench" run is long:
+ *                                                             it overruns and can show up as the worst run)
+ *   bad-token, info-timeout: one-shots armed by the screens that need them
+ *
+ * A full table makes every()/once() return SCHED_NONE and the task would silently
+ * never run, so the count is checked here: adding a task means updating LOOP_TASKS.
+ */
+#define LOOP_TASKS 16
+static_assert(LOOP_TASKS <= SCHED_MAX_TASKS, "raise SCHED_MAX_TASKS for the loop() tasks");
+
+void registerLoopTasks() {
+  scheduler.every("metering-view", VIEW_REFRESH_MS, 5, 300, taskMeteringView);
+  scheduler.every("keypad", UI_POLL_MS, 4, 8000, taskKeypad);
+  scheduler.every("http", UI_POLL_MS, 3, HTTP_POLL_SLICE_MS * 1000 + 1000, taskHttp);
+  scheduler.every("session", SESSION_CHECK_MS, 3, 8000, taskSession);
+  scheduler.every("token-inbox", TOKEN_INBOX_INTERVAL_MS, 2, 8000, taskTokenInbox);
+  tDisplay = scheduler.every("display", DISPLAY_REFRESH_MS, 2, 5000, taskDisplay);
+  tScreenSwap = scheduler.every("screen-swap", SCREEN_SWAP_MS, 2, 100, taskScreenSwap);
+  scheduler.every("status-screen", STATUS_SCREEN_REFRESH_MS, 1, 5000, taskStatusScreen);
+  scheduler.every("wifi-watch", WIFI_WATCH_INTERVAL_MS, 1, 2000, taskWiFiWatch);
+  scheduler.every("token-poll", TOKEN_CHECK_INTERVAL_MS, 1, 2000, taskTokenPoll);
+  tTelemetryDrain = scheduler.every("telemetry-drain", TELEMETRY_DRAIN_INTERVAL_MS, 1, 10000, taskTelemetryDrain);
+  tWiFiReconnect = scheduler.every("wifi-reconnect", WIFI_RECONNECT_INTERVAL_MS, 1, 2000, taskWiFiReconnect);
+  scheduler.stop(tWiFiReconnect);  // wifi-watch arms it when the link drops
+  scheduler.every("serial-cmd", SERIAL_COMMAND_MS, 0, 2000, taskSerialCommand);
+  tBadTokenTimeout = scheduler.once("bad-token", 2, 5000, taskBadTokenTimeout);
+  tInfoTimeout = scheduler.once("info-timeout", 2, 5000, taskInfoTimeout);
+  tNtp = scheduler.once("ntp", 1, 2000, taskNtp);
+  scheduler.start(tNtp, 0);
+  if (scheduler.taskCount() != LOOP_TASKS) {
+    Serial.printf("[SmartMeter] FATAL: %u loop tasks registered, expected %u (SCHED_MAX_TASKS %u)\n",
+                  scheduler.taskCount(), LOOP_TASKS, SCHED_MAX_TASKS);
+    abort();
+  }
 }
 
 void connectWiFi() {
@@ -461,13 +777,6 @@ void connectWiFi() {
     SERIAL_PRINTLN(WiFi.localIP());
     SERIAL_PRINT("MAC address: ");
     SERIAL_PRINTLN(WiFi.macAddress());
-
-    // Initialize NTP client after WiFi connection
-    timeClient.begin();
-    timeSynchronized = false;
-    lastNTPAttempt = 0;
-    currentNTPServerIndex = 0;
-    ntpRetries = 10;
   } else {
     wifiConnected = false;
     SERIAL_PRINTLN("WiFi connection failed (timeout or user cancelled).");
@@ -475,211 +784,458 @@ void connectWiFi() {
 }
 
 /**
- * Synchronize time with NTP servers
+ * Get formatted timestamp in ISO 8601 format (YYYY-MM-DDTHH:MM:SS)
  */
-void synchronizeNTPTime() {
-  if (timeSynchronized) return; // No need to synchronize if time is already synchronized
-  
-  if (!wifiConnected || WiFi.status() != WL_CONNECTED) {
-    return; // Can't sync without WiFi
+const char* getFormattedTimestamp() {
+  if (!timeSync.synced()) {
+    // Fallback: isoLocal() is a placeholder until the first NTP sync
+    SERIAL_PRINTLN("WARNING: NTP not synchronized, using fallback timestamp");
   }
+  return timeSync.isoLocal();
+}
 
-  unsigned long currentMillis = millis();
-  
-  // Check if it's time to retry the NTP request
-  if (currentMillis - lastNTPAttempt >= ntpRetryInterval) {
-    lastNTPAttempt = currentMillis;
-
-    if (ntpRetries > 0) {
-      SERIAL_PRINT("Trying NTP server: ");
-      SERIAL_PRINTLN(ntpServers[currentNTPServerIndex]);
-
-      timeClient.setPoolServerName(ntpServers[currentNTPServerIndex]);
-      timeClient.begin();
-
-      if (timeClient.update()) {
-        SERIAL_PRINTLN("Time synchronized successfully!");
-        
-        // Get UTC epoch time from NTP (NTPClient initialized with 0 offset)
-        unsigned long utcEpoch = timeClient.getEpochTime();
-        
-        // Manually add timezone offset for Rwanda (GMT+2 = 7200 seconds)
-        unsigned long localEpoch = utcEpoch + gmtOffset_sec + daylightOffset_sec;
-        
-        // Convert to time components
-        time_t rawTime = (time_t)localEpoch;
-        struct tm *timeInfo = gmtime(&rawTime);
-        
-        char formattedTime[25];
-        snprintf(formattedTime, sizeof(formattedTime), "%04d-%02d-%02dT%02d:%02d:%02d",
-                 timeInfo->tm_year + 1900, timeInfo->tm_mon + 1, timeInfo->tm_mday,
-                 timeInfo->tm_hour, timeInfo->tm_min, timeInfo->tm_sec);
-        
-        SERIAL_PRINT("NTP UTC Time: ");
-        SERIAL_PRINTLN(utcEpoch);
-        SERIAL_PRINT("Local Time (GMT+2): ");
-        SERIAL_PRINTLN(formattedTime);
-        timeSynchronized = true;
-      } else {
-        SERIAL_PRINTLN("Failed to get time from this server, retrying...");
-        ntpRetries--;
-        currentNTPServerIndex = (currentNTPServerIndex + 1) % (sizeof(ntpServers) / sizeof(ntpServers[0]));
-        timeClient.end(); // End previous client session
-      }
+/**
+ * onEnergyDataSent()
+ * Completion callback for a telemetry POST (retries already handled by AsyncHttp).
+ * ctx is &telemetryLog when the record came from the flash log: acknowledge it on
+ * success, otherwise leave it queued and back off.
+ */
+void onEnergyDataSent(int status, const char* body, size_t /*len*/, void* ctx) {
+  bool fromLog = (ctx == &telemetryLog);
+  if (fromLog) telemetryUploadInFlight = false;
+
+  if (status > 0) {
+    SERIAL_PRINT("HTTP Response code: ");
+    SERIAL_PRINTLN(status);
+    SERIAL_PRINT("Response: ");
+    SERIAL_PRINTLN(body);
+  } else {
+    SERIAL_PRINT("Error code: ");
+    SERIAL_PRINTLN(status);
+    SERIAL_PRINT("URL: ");
+    SERIAL_PRINT(apiBaseUrl);
+    SERIAL_PRINTLN("/energy-data");
+    SERIAL_PRINTLN("Connection failed: is the server running at that IP:5000? Same WiFi? Firewall?");
+  }
+  if (!fromLog) return;
+
+  if (status >= 200 && status < 300) {
+    telemetryLog.advance();
+  } else if (status == 415) {
+    // Not the record but its encoding: keep it, the server needs updating
+    SERIAL_PRINTLN("Telemetry encoding not supported by server, keeping the record");
+    scheduler.start(tTelemetryDrain, TELEMETRY_DRAIN_BACKOFF_MS);
+  } else if (status >= 400 && status < 500) {
+    // Rejected by the server: resending it will never succeed, don't block the queue on it
+    SERIAL_PRINTLN("Telemetry record rejected by server, skipping it");
+    telemetryLog.advance();
+  } else {
+    scheduler.start(tTelemetryDrain, TELEMETRY_DRAIN_BACKOFF_MS);
+  }
+}
+
+/**
+ * isUnsupportedFrameVersion()
+ * The server cannot decode our binary frame version: 415, or 400 with the decoder's
+ * message from servers that predate the 415 answer
+ */
+bool isUnsupportedFrameVersion(int status, const char* body, size_t len) {
+  static const char MSG[] = "unsupported frame version";
+  if (status == 415) return true;
+  if (status != 400 || body == nullptr) return false;
+  for (size_t i = 0; i + sizeof(MSG) - 1 <= len; i++) {
+    if (memcmp(body + i, MSG, sizeof(MSG) - 1) == 0) return true;
+  }
+  return false;
+}
+
+/**
+ * onEnergyBatchSent()
+ * Completion callback for POST /energy-data/bin and /energy-data/batch. Rejected readings
+ * are reported per item by the server and are not resent; transport/5xx failures and
+ * answers about the encoding (404, 409, 415) keep the batch queued.
+ */
+void onEnergyBatchSent(int status, const char* body, size_t len, void* /*ctx*/) {
+  telemetryUploadInFlight = false;
+  if (status == 200) {
+    StaticJsonDocument<128> filter;
+    filter["accepted"] = true;
+    filter["rejected"] = true;
+    deserializeJson(apiResponseDoc, body, len, DeserializationOption::Filter(filter));
+    SERIAL_PRINT("Batch accepted: "); SERIAL_PRINT(apiResponseDoc["accepted"].as<int>());
+    SERIAL_PRINT(" rejected: "); SERIAL_PRINTLN(apiResponseDoc["rejected"].as<int>());
+    if (telemetryFrameHasIdentity) telemetryIdentitySent = true;
+    telemetryLog.advance();
+  } else if (status == 409) {
+    // Server has no identity for this meter (e.g. it was redeployed): resend it with the next frame
+    telemetryIdentitySent = false;
+  } else if (isUnsupportedFrameVersion(status, body, len) && telemetryUploadMode == UPLOAD_BINARY) {
+    // Server is older than this codec: keep the readings, resend them in the previous frame version
+    if (telemetryFrameVersion > TCODEC_VERSION_MIN) {
+      telemetryFrameVersion--;
+    } else {
+      telemetryUploadMode = UPLOAD_JSON_BATCH;
+    }
+    SERIAL_PRINT("Frame version not supported, falling back to ");
+    if (telemetryUploadMode == UPLOAD_BINARY) {
+      SERIAL_PRINT("version "); SERIAL_PRINTLN(telemetryFrameVersion);
     } else {
-      SERIAL_PRINTLN("Unable to synchronize time from all NTP servers.");
-      timeSynchronized = true; // Stop retrying
+      SERIAL_PRINTLN("JSON batch");
     }
+  } else if ((status == 404 || status == 415) && telemetryUploadMode != UPLOAD_JSON_SINGLE) {
+    // Server predates this route or encoding: keep the readings and fall back to the next older one
+    telemetryUploadMode = (telemetryUploadMode == UPLOAD_BINARY) ? UPLOAD_JSON_BATCH : UPLOAD_JSON_SINGLE;
+    SERIAL_PRINT("Upload route not found or not accepted, falling back to mode ");
+    SERIAL_PRINTLN((int)telemetryUploadMode);
+  } else if (status >= 400 && status < 500) {
+    SERIAL_PRINT("Telemetry batch rejected by server, skipping it: ");
+    SERIAL_PRINTLN(status);
+    telemetryLog.advance();
+  } else {
+    SERIAL_PRINT("Telemetry batch upload failed: ");
+    SERIAL_PRINTLN(status);
+    scheduler.start(tTelemetryDrain, TELEMETRY_DRAIN_BACKOFF_MS);
   }
 }
 
 /**
- * Get formatted timestamp in ISO 8601 format (YYYY-MM-DDTHH:MM:SS)
+ * captureTelemetryRecord()
+ * Compact snapshot of the latest sample and billing state for the flash log
  */
-String getFormattedTimestamp() {
-  if (timeSynchronized && timeClient.isTimeSet()) {
-    // Get UTC epoch time from NTP (NTPClient initialized with 0 offset)
-    unsigned long utcEpoch = timeClient.getEpochTime();
-    
-    // Manually add timezone offset for Rwanda (GMT+2 = 7200 seconds)
-    unsigned long localEpoch = utcEpoch + gmtOffset_sec + daylightOffset_sec;
-    
-    // Convert to time components
-    time_t rawTime = (time_t)localEpoch;
-    struct tm *timeInfo = gmtime(&rawTime);
-    
-    char formattedTime[25];
-    snprintf(formattedTime, sizeof(formattedTime), "%04d-%02d-%02dT%02d:%02d:%02d",
-             timeInfo->tm_year + 1900, timeInfo->tm_mon + 1, timeInfo->tm_mday,
-             timeInfo->tm_hour, timeInfo->tm_min, timeInfo->tm_sec);
-    
-    return String(formattedTime);
+void captureTelemetryRecord(TelemetryRecord& rec) {
+  memset(&rec, 0, sizeof(rec));
+  unsigned long nowMs = millis();
+  rec.uptime_ms = nowMs;
+  if (timeSync.synced()) {
+    rec.epoch = timeSync.localEpoch();
+    rec.flags |= TLOG_FLAG_TIME_SYNCED;
+  }
+  if (!isnan(latestSample.voltage) && !isnan(latestSample.current)) {
+    rec.flags |= TLOG_FLAG_SENSOR_VALID;
+    rec.voltage_dv = (uint16_t)lroundf(latestSample.voltage * 10.0f);
+    rec.current_ma = (uint32_t)lroundf(latestSample.current * 1000.0f);
+    rec.power_dw = latestSample.power_dw;
+    rec.energy_wh = latestSample.energy_wh;
+    rec.frequency_dhz = (uint16_t)lroundf(latestSample.frequency * 10.0f);
+    rec.pf_pct = (uint8_t)lroundf(latestSample.pf * 100.0f);
+  }
+  rec.remaining_mwh = billingView.remaining_uwh > 0 ? (uint32_t)(billingView.remaining_uwh / 1000) : 0;
+  rec.consumed_mwh = billingView.consumed_uwh > 0 ? (uint32_t)(billingView.consumed_uwh / 1000) : 0;
+  rec.session_s = sessionStartTime ? (nowMs - sessionStartTime) / 1000 : 0;
+  windowStats.close(nowMs, rec.window);
+  TelemetryLog::packToken(billingView.token, rec.token_bcd);
+}
+
+/**
+ * recordLocalEpoch()
+ * Capture time of a logged record as local epoch seconds, 0 if unknown.
+ * Records captured before NTP sync in this boot are dated from their uptime.
+ */
+unsigned long recordLocalEpoch(const TelemetryRecord& rec) {
+  if (rec.flags & TLOG_FLAG_TIME_SYNCED) return rec.epoch;
+  if (rec.boot_seq == telemetryLog.bootSeq() && timeSync.synced()) {
+    return timeSync.localEpoch() - (millis() - rec.uptime_ms) / 1000;
+  }
+  return 0;
+}
+
+/**
+ * addTelemetryFields()
+ * Per-reading /energy-data fields of a logged record, keeping its capture time
+ */
+void addTelemetryFields(JsonObject obj, const TelemetryRecord& rec) {
+  obj["remainingKwh"] = rec.remaining_mwh / 1000000.0f;
+  // consumedKwh = ledger energy since this session's token was applied (reconciled to the PZEM register)
+  obj["consumedKwh"] = rec.consumed_mwh / 1000000.0f;
+  obj["sessionDuration"] = rec.session_s;  // seconds
+
+  // Add PZEM readings if valid (V, I, P, total energy, F, PF - for dashboard diagnostics)
+  if (rec.flags & TLOG_FLAG_SENSOR_VALID) {
+    obj["voltage"] = rec.voltage_dv / 10.0f;
+    obj["current"] = rec.current_ma / 1000.0f;
+    obj["power"] = rec.power_dw / 10.0f;
+    obj["totalEnergy"] = rec.energy_wh / 1000.0f;
+    obj["frequency"] = rec.frequency_dhz / 10.0f;
+    obj["powerFactor"] = rec.pf_pct / 100.0f;
+  }
+
+  // Unix timestamp in milliseconds of the capture (Database expects Number, not String)
+  unsigned long localEpoch = recordLocalEpoch(rec);
+  char formattedTime[25] = "1970-01-01T00:00:00";
+  if (localEpoch != 0) {
+    obj["timestamp"] = (unsigned long long)localEpoch * 1000;
+    TimeSync::formatIso(localEpoch, formattedTime);
   } else {
-    // Fallback: return placeholder if NTP not synchronized
-    SERIAL_PRINTLN("WARNING: NTP not synchronized, using fallback timestamp");
-    return "1970-01-01T00:00:00";
+    obj["timestamp"] = rec.uptime_ms;  // Fallback to millis if NTP not synced
   }
+  obj["timestampFormatted"] = formattedTime;
 }
 
-void sendEnergyDataToAPI() {
-  // Check WiFi connection before each request
-  if (WiFi.status() != WL_CONNECTED) {
-    SERIAL_PRINTLN("WiFi disconnected, attempting reconnect...");
-    wifiConnected = false;
-    connectWiFi();
-    if (WiFi.status() != WL_CONNECTED) {
-      SERIAL_PRINTLN("WiFi not connected, skipping API call");
-      return;
+/**
+ * addMeterIdentity()
+ * Meter/client fields shared by every reading
+ */
+void addMeterIdentity(JsonObject obj, const char* token) {
+  obj["meterNumber"] = METER_NUMBER;
+  obj["token"] = token;
+  obj["clientName"] = CLIENT_NAME;
+  if (strlen(CLIENT_TIN) > 0) {
+    obj["clientTIN"] = CLIENT_TIN;
+  }
+  obj["clientPhone"] = CLIENT_PHONE;
+}
+
+/**
+ * serializeApiRequest()
+ * apiRequestDoc as JSON in apiRequestBody; NULL when it did not fit (document or body)
+ */
+const char* serializeApiRequest() {
+  if (apiRequestDoc.overflowed()) return NULL;
+  size_t n = serializeJson(apiRequestDoc, apiRequestBody, sizeof(apiRequestBody));
+  return n < sizeof(apiRequestBody) - 1 ? apiRequestBody : NULL;
+}
+
+/**
+ * buildTelemetryRecordJson()
+ * /energy-data body for one logged record, in apiRequestBody
+ */
+const char* buildTelemetryRecordJson(const TelemetryRecord& rec) {
+  char token[21];
+  TelemetryLog::unpackToken(rec.token_bcd, token);
+
+  JsonObject root = apiRequestDoc.to<JsonObject>();
+  addMeterIdentity(root, token);
+  addTelemetryFields(root, rec);
+  return serializeApiRequest();
+}
+
+/**
+ * postTelemetryRecord()
+ * POST /energy-data with one logged record
+ */
+bool postTelemetryRecord(const TelemetryRecord& rec, void* ctx) {
+  const char* jsonPayload = buildTelemetryRecordJson(rec);
+  if (jsonPayload == NULL) return false;
+
+  SERIAL_PRINTLN("Sending data to API:");
+  SERIAL_PRINTLN(jsonPayload);
+
+  // One retry after 1s on transport failure; longer outages are covered by the flash log
+  return api.enqueue("POST", "/energy-data", jsonPayload, API_SEND_DEADLINE_MS, 1, onEnergyDataSent, ctx);
+}
+
+/**
+ * postTelemetryBatch()
+ * POST /energy-data/batch with n logged records: identity once, a token only on
+ * readings whose token differs from the first one (session changed mid-batch)
+ */
+bool postTelemetryBatch(const TelemetryRecord* recs, size_t n) {
+  char token[21];
+  char firstToken[21];
+  TelemetryLog::unpackToken(recs[0].token_bcd, firstToken);
+
+  JsonObject root = apiRequestDoc.to<JsonObject>();
+  addMeterIdentity(root, firstToken);
+  JsonArray readings = root.createNestedArray("readings");
+  for (size_t i = 0; i < n; i++) {
+    JsonObject item = readings.createNestedObject();
+    TelemetryLog::unpackToken(recs[i].token_bcd, token);
+    if (strcmp(token, firstToken) != 0) item["token"] = token;
+    addTelemetryFields(item, recs[i]);
+  }
+  const char* jsonPayload = serializeApiRequest();
+  if (jsonPayload == NULL) return false;
+
+  SERIAL_PRINT("Sending batch of "); SERIAL_PRINT(n);
+  SERIAL_PRINT(" readings, bytes: "); SERIAL_PRINTLN(strlen(jsonPayload));
+
+  return api.enqueue("POST", "/energy-data/batch", jsonPayload, API_SEND_DEADLINE_MS, 1,
+                     onEnergyBatchSent, &telemetryLog);
+}
+
+/**
+ * postTelemetryFrame()
+ * POST /energy-data/bin with n logged records as one binary frame (see telemetry_codec.h):
+ * identity only until the server has it, a SESSION block whenever the token changes
+ */
+bool postTelemetryFrame(const TelemetryRecord* recs, size_t n) {
+  uint8_t frame[TELEMETRY_FRAME_MAX];
+  TelemetryEncoder enc(frame, sizeof(frame));
+  enc.begin(METER_NUMBER, telemetryFrameVersion);
+  if (!telemetryIdentitySent) enc.addIdentity(CLIENT_NAME, CLIENT_TIN, CLIENT_PHONE);
+  uint8_t worst = scheduler.worstTask();
+  enc.addLatency(loopLatency.count(), loopLatency.percentile(50), loopLatency.percentile(99), loopLatency.max(),
+                 scheduler.worstUs(), worst == SCHED_NONE ? "" : scheduler.stats(worst).name);
+  for (size_t i = 0; i < n; i++) {
+    if (i == 0 || memcmp(recs[i].token_bcd, recs[i - 1].token_bcd, sizeof(recs[i].token_bcd)) != 0) {
+      enc.addSession(recs[i].token_bcd);
     }
+    enc.addReading(recs[i], recordLocalEpoch(recs[i]));
   }
-  wifiConnected = true;
+  if (enc.overflowed()) return false;
+
+  SERIAL_PRINT("Sending binary frame of "); SERIAL_PRINT(n);
+  SERIAL_PRINT(" readings, bytes: "); SERIAL_PRINTLN(enc.size());
+
+  if (!api.enqueue("POST", "/energy-data/bin", frame, enc.size(), "application/octet-stream",
+                   API_SEND_DEADLINE_MS, 1, onEnergyBatchSent, &telemetryLog)) {
+    return false;
+  }
+  telemetryFrameHasIdentity = !telemetryIdentitySent;
+  return true;
+}
+
+/**
+ * currentReportSample()
+ * Values the reporting policy compares against the last report
+ */
+ReportSample currentReportSample() {
+  ReportSample s;
+  s.sensorValid = !isnan(latestSample.voltage) && !isnan(latestSample.current);
+  s.powerDw = s.sensorValid ? latestSample.power_dw : 0;
+  s.voltageDv = s.sensorValid ? (uint16_t)lroundf(latestSample.voltage * 10.0f) : 0;
+  s.remainingMwh = billingView.remaining_uwh > 0 ? (uint32_t)(billingView.remaining_uwh / 1000) : 0;
+  return s;
+}
 
-  if (currentToken.length() == 0) {
+/**
+ * sendEnergyDataToAPI()
+ * Capture the current reading into the flash telemetry log; drainTelemetryLog()
+ * uploads it. Works offline: readings wait in flash until the API is reachable.
+ * urgent: upload without waiting for a full batch (load change, token applied, exhausted).
+ */
+void sendEnergyDataToAPI(bool urgent) {
+  if (billingView.token[0] == '\0') {
     SERIAL_PRINTLN("Skipping API send: no active token");
+    windowStats.reset(millis());  // the next record's window starts here
     return;
   }
 
-  HTTPClient http;
-  String url = String(apiBaseUrl) + "/energy-data";
-  
-  http.begin(url);
-  http.setTimeout(3000);   // 3s - keep short so keypad stays responsive on failure
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("Connection", "close");  // Ensure clean connection
-
-  // Get current PZEM readings
-  float voltage = pzem.voltage();
-  float current = pzem.current();
-  float power = pzem.power();
-  float energy = pzem.energy();
-  float frequency = pzem.frequency();
-  float pf = pzem.pf();
-
-  // Create JSON payload
-  DynamicJsonDocument doc(1024);
-  doc["meterNumber"] = METER_NUMBER;
-  doc["token"] = currentToken;
-  doc["clientName"] = CLIENT_NAME;
-  if (strlen(CLIENT_TIN) > 0) {
-    doc["clientTIN"] = CLIENT_TIN;
+  TelemetryRecord rec;
+  captureTelemetryRecord(rec);
+
+  // PZEM bus health (counters written by the metering task; debug read only)
+  const PzemStats& bus = pzemBus.stats();
+  (void)bus;
+  SERIAL_PRINT("PZEM tx/s: "); SERIAL_PRINT(bus.tx_per_sec);
+  SERIAL_PRINT(" ok: "); SERIAL_PRINT(bus.transactions);
+  SERIAL_PRINT(" crc: "); SERIAL_PRINT(bus.crc_errors);
+  SERIAL_PRINT(" timeout: "); SERIAL_PRINT(bus.timeouts);
+  SERIAL_PRINT(" rtt ms: "); SERIAL_PRINTLN(bus.last_rtt_ms);
+
+  // Flash journal wear (written by the metering task; debug read only)
+  SERIAL_PRINT("Journal commits: "); SERIAL_PRINT(journal.commits());
+  SERIAL_PRINT(" erases: "); SERIAL_PRINT(journal.eraseCycles());
+  SERIAL_PRINT(" max page erases: "); SERIAL_PRINT(journal.maxPageErases());
+  SERIAL_PRINT(" commit us: "); SERIAL_PRINT(journal.lastCommitUs());
+  SERIAL_PRINT(" max: "); SERIAL_PRINTLN(journal.maxCommitUs());
+
+  // Display: bytes sent to the panel (only changed spans) and running-screen frame time
+  SERIAL_PRINT("LCD bytes: "); SERIAL_PRINT(display.bytesPushed());
+  SERIAL_PRINT(" flushes: "); SERIAL_PRINT(display.flushes());
+  SERIAL_PRINT(" skipped: "); SERIAL_PRINT(display.flushesSkipped());
+  SERIAL_PRINT(" last: "); SERIAL_PRINT(display.lastFlushBytes());
+  SERIAL_PRINT(" B / "); SERIAL_PRINT(display.lastFlushUs());
+  SERIAL_PRINT(" us fence waits: "); SERIAL_PRINT(display.fenceWaits());
+  SERIAL_PRINT(" max fence us: "); SERIAL_PRINT(display.maxFenceUs());
+  SERIAL_PRINT(" render us: "); SERIAL_PRINT(displayRenderUs);
+  SERIAL_PRINT(" max: "); SERIAL_PRINTLN(displayRenderMaxUs);
+
+  // Keypad: INT wake-ups vs. scans, I2C errors, presses lost to a full queue
+  SERIAL_PRINT("Keypad bus hz: "); SERIAL_PRINT(keypad.busHz());
+  SERIAL_PRINT(" ints: "); SERIAL_PRINT(keypad.interrupts());
+  SERIAL_PRINT(" scans: "); SERIAL_PRINT(keypad.scans());
+  SERIAL_PRINT(" bus errors: "); SERIAL_PRINT(keypad.busErrors());
+  SERIAL_PRINT(" dropped: "); SERIAL_PRINTLN(keypad.dropped());
+
+  // Scheduler: per task runs, max CPU time and budget overruns
+#if SERIAL_LOGGING_ENABLED
+  for (uint8_t id = 0; id < scheduler.taskCount(); id++) {
+    SchedTaskStats st = scheduler.stats(id);
+    SERIAL_PRINT("Task "); SERIAL_PRINT(st.name);
+    SERIAL_PRINT(" runs: "); SERIAL_PRINT(st.runs);
+    SERIAL_PRINT(" max us: "); SERIAL_PRINT(st.maxUs);
+    SERIAL_PRINT(" / "); SERIAL_PRINT(st.budgetUs);
+    SERIAL_PRINT(" overruns: "); SERIAL_PRINT(st.overruns);
+    SERIAL_PRINT(" yields: "); SERIAL_PRINTLN(st.yields);
   }
-  doc["clientPhone"] = CLIENT_PHONE;
-  doc["remainingKwh"] = remaining_kwh;
-  // consumedKwh = actual PZEM sensor energy since this session's token was applied
-  float consumed_kwh = energy - pzem_energy_at_session_start;
-  if (isnan(consumed_kwh) || consumed_kwh < 0.0f) consumed_kwh = 0.0f;
-  doc["consumedKwh"] = consumed_kwh;
-  doc["sessionDuration"] = (millis() - sessionStartTime) / 1000;  // seconds
-  
-  // Add PZEM readings if valid (V, I, P, total energy, F, PF - for dashboard diagnostics)
-  if (!isnan(voltage)) doc["voltage"] = voltage;
-  if (!isnan(current)) doc["current"] = current;
-  if (!isnan(power)) doc["power"] = power;
-  if (!isnan(energy)) doc["totalEnergy"] = energy;
-  if (!isnan(frequency)) doc["frequency"] = frequency;
-  if (!isnan(pf)) doc["powerFactor"] = pf;
-  
-  // Add Unix timestamp in milliseconds (NTP synchronized)
-  // Database expects Number, not String
-  if (timeSynchronized && timeClient.isTimeSet()) {
-    unsigned long utcEpoch = timeClient.getEpochTime();
-    unsigned long localEpoch = utcEpoch + gmtOffset_sec + daylightOffset_sec;
-    doc["timestamp"] = (unsigned long long)localEpoch * 1000;  // Convert to milliseconds
-  } else {
-    doc["timestamp"] = millis();  // Fallback to millis if NTP not synced
+#endif
+
+  // Connection reuse: new connections vs keep-alive reuse, full vs resumed TLS handshakes
+  SERIAL_PRINT("HTTP conns: "); SERIAL_PRINT(api.connectsOpened());
+  SERIAL_PRINT(" reused: "); SERIAL_PRINT(api.connectsReused());
+  SERIAL_PRINT(" tls full: "); SERIAL_PRINT(api.fullHandshakes());
+  SERIAL_PRINT(" resumed: "); SERIAL_PRINT(api.resumedHandshakes());
+  SERIAL_PRINT(" last hs ms: "); SERIAL_PRINT(api.lastHandshakeMs());
+  SERIAL_PRINT(" dns: "); SERIAL_PRINT(api.dnsLookups());
+  SERIAL_PRINT(" cached: "); SERIAL_PRINTLN(api.dnsCacheHits());
+
+  if (telemetryLog.ready() && telemetryLog.append(rec)) {
+    if (urgent) telemetryFlushRequested = true;
+    SERIAL_PRINT("Telemetry logged, pending: "); SERIAL_PRINT(telemetryLog.pending());
+    SERIAL_PRINT(" dropped: "); SERIAL_PRINT(telemetryLog.dropped());
+    SERIAL_PRINT(" flash bytes: "); SERIAL_PRINTLN(telemetryLog.bytesUsed());
+    return;
   }
-  
-  // Also include formatted timestamp as a separate field for readability
-  doc["timestampFormatted"] = getFormattedTimestamp();
 
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
+  // No flash log: best-effort direct send as before
+  if (WiFi.status() != WL_CONNECTED) {
+    wifiConnected = false;
+    SERIAL_PRINTLN("WiFi not connected, skipping API call");
+    return;
+  }
+  if (!postTelemetryRecord(rec, NULL)) {
+    SERIAL_PRINTLN("API queue full, dropping this reading");
+  }
+}
 
-  SERIAL_PRINTLN("Sending data to API:");
-  SERIAL_PRINTLN(jsonPayload);
+/**
+ * drainTelemetryLog()
+ * Upload the oldest logged readings as one binary frame (JSON batch on an older server),
+ * one request in flight at a time and at most one per TELEMETRY_DRAIN_INTERVAL_MS.
+ * Live readings are held until TELEMETRY_BATCH_MIN have accumulated or the oldest is
+ * TELEMETRY_BATCH_MAX_WAIT_MS old; a backlog after an outage goes out in full batches.
+ */
+void drainTelemetryLog() {
+  if (!telemetryLog.ready() || telemetryUploadInFlight) return;
+  if (!wifiConnected || WiFi.status() != WL_CONNECTED) return;
+  unsigned long now = millis();
 
-  // Retry logic for failed requests
-  int httpResponseCode = -1;
-  int retries = 0;
-  const int maxRetries = 2;
-  
-  while (httpResponseCode <= 0 && retries < maxRetries) {
-    if (retries > 0) {
-      SERIAL_PRINT("Retry attempt ");
-      SERIAL_PRINT(retries);
-      SERIAL_PRINTLN("...");
-      for (int i = 0; i < 20; i++) { handleKeypad(); delay(50); }  // ~1s, keypad stays responsive
-      
-      // Recheck WiFi
-      if (WiFi.status() != WL_CONNECTED) {
-        SERIAL_PRINTLN("WiFi lost during retry, reconnecting...");
-        connectWiFi();
-        if (WiFi.status() != WL_CONNECTED) {
-          SERIAL_PRINTLN("WiFi reconnection failed");
-          http.end();
-          return;
-        }
-      }
+  TelemetryRecord batch[TELEMETRY_BATCH_MAX];
+  if (telemetryUploadMode == UPLOAD_JSON_SINGLE) {
+    if (telemetryLog.peek(batch[0]) && postTelemetryRecord(batch[0], &telemetryLog)) {
+      telemetryUploadInFlight = true;
     }
-    
-    httpResponseCode = http.POST(jsonPayload);
-    retries++;
+    return;
   }
 
-  if (httpResponseCode > 0) {
-    SERIAL_PRINT("HTTP Response code: ");
-    SERIAL_PRINTLN(httpResponseCode);
-    String response = http.getString();
-    SERIAL_PRINTLN("Response: " + response);
-  } else {
-    SERIAL_PRINT("Error code: ");
-    SERIAL_PRINTLN(httpResponseCode);
-    SERIAL_PRINT("URL: ");
-    SERIAL_PRINTLN(url);
-    SERIAL_PRINTLN("Connection failed: is the server running at that IP:5000? Same WiFi? Firewall?");
+  if (telemetryLog.pending() < TELEMETRY_BATCH_MIN && !telemetryFlushRequested) {
+    if (!telemetryLog.peek(batch[0])) return;  // caught up
+    // Oldest reading from this boot and still young: wait for more
+    if (batch[0].boot_seq == telemetryLog.bootSeq() && now - batch[0].uptime_ms < TELEMETRY_BATCH_MAX_WAIT_MS) return;
   }
 
-  http.end();
+  size_t n = telemetryLog.peek(batch, TELEMETRY_BATCH_MAX);
+  if (n == 0) return;
+  telemetryFlushRequested = false;
+  bool queued = (telemetryUploadMode == UPLOAD_BINARY) ? postTelemetryFrame(batch, n)
+                                                       : postTelemetryBatch(batch, n);
+  if (queued) {
+    telemetryUploadInFlight = true;
+  }
+}
+
+void onTestDataSent(int status, const char* body, size_t /*len*/, void* /*ctx*/) {
+  if (status > 0) {
+    SERIAL_PRINT("Ô£à TEST - HTTP Response code: ");
+    SERIAL_PRINTLN(status);
+    SERIAL_PRINT("Response: ");
+    SERIAL_PRINTLN(body);
+  } else {
+    SERIAL_PRINT("ÔØî TEST - Error code: ");
+    SERIAL_PRINTLN(status);
+    SERIAL_PRINTLN("Check server URL and connectivity");
+  }
 }
 
 /**
@@ -693,14 +1249,9 @@ void sendTestDataToAPI() {
     return;
   }
 
-  HTTPClient http;
-  String url = String(apiBaseUrl) + "/energy-data";
-  
-  http.begin(url);
-  http.addHeader("Content-Type", "application/json");
-
   // Create test JSON payload with simulated data
-  DynamicJsonDocument doc(1024);
+  apiRequestDoc.clear();
+  JsonDocument& doc = apiRequestDoc;
   doc["meterNumber"] = METER_NUMBER;
   doc["token"] = "18886583547834136861";  // Test token
   doc["clientName"] = CLIENT_NAME;
@@ -721,84 +1272,77 @@ void sendTestDataToAPI() {
   
   doc["timestamp"] = getFormattedTimestamp();  // ISO 8601 formatted timestamp
 
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
+  const char* jsonPayload = serializeApiRequest();
+  if (jsonPayload == NULL) return;
 
   SERIAL_PRINTLN("========================================");
   SERIAL_PRINTLN("Sending TEST data to API:");
   SERIAL_PRINTLN(jsonPayload);
   SERIAL_PRINTLN("========================================");
 
-  int httpResponseCode = http.POST(jsonPayload);
-
-  if (httpResponseCode > 0) {
-    SERIAL_PRINT("Ô£à TEST - HTTP Response code: ");
-    SERIAL_PRINTLN(httpResponseCode);
-    String response = http.getString();
-    SERIAL_PRINTLN("Response: " + response);
-  } else {
-    SERIAL_PRINT("ÔØî TEST - Error code: ");
-    SERIAL_PRINTLN(httpResponseCode);
-    SERIAL_PRINTLN("Check server URL and connectivity");
-  }
-
-  http.end();
+  api.enqueue("POST", "/energy-data", jsonPayload, API_SEND_DEADLINE_MS, 0, onTestDataSent);
 }
 
 /**
- * checkForPendingToken()
- * Checks the server for pending tokens for this meter
- * Returns true if a token was found and applied, false otherwise
+ * onPendingTokenResponse()
+ * Completion callback for the pending-token poll: applies the token if the server has one
  */
-bool checkForPendingToken() {
-  // Check WiFi connection
-  if (WiFi.status() != WL_CONNECTED) {
-    wifiConnected = false;
-    return false;
-  }
-  wifiConnected = true;
-
-  HTTPClient http;
-  String url = String(apiBaseUrl) + "/purchases/pending-token/" + String(METER_NUMBER);
-  
-  http.begin(url);
-  http.setTimeout(2000);  // 2s - fail fast so keypad is not blocked
-  http.addHeader("Connection", "close");
-
-  int httpResponseCode = http.GET();
-
-  if (httpResponseCode == 200) {
-    String response = http.getString();
-    DynamicJsonDocument doc(512);
-    deserializeJson(doc, response);
+void onPendingTokenResponse(int status, const char* body, size_t len, void* /*ctx*/) {
+  tokenPollInFlight = false;
+  if (status == 200) {
+    JsonDocument& doc = apiResponseDoc;
+    deserializeJson(doc, body, len);
 
     if (doc["success"].as<bool>() && doc["hasToken"].as<bool>()) {
-      String tokenNumber = doc["token"]["tokenNumber"].as<String>();
+      const char* tokenNumber = doc["token"]["tokenNumber"] | "";
       float kwhAmount = doc["token"]["kwhAmount"].as<float>();
-      String purchaseId = doc["token"]["purchaseId"].as<String>();
+      const char* purchaseId = doc["token"]["purchaseId"] | "";
 
-      SERIAL_PRINTLN("Found pending token: " + tokenNumber);
+      SERIAL_PRINT("Found pending token: "); SERIAL_PRINTLN(tokenNumber);
       SERIAL_PRINT("kWh: "); SERIAL_PRINTLN(kwhAmount);
 
-      // Apply the token
-      if (applyTokenFromServer(tokenNumber, kwhAmount, purchaseId)) {
-        http.end();
-        return true;
+      // Only apply when idle or running; a keypad entry/validation in progress wins
+      if (ui.state == STATE_READY || ui.state == STATE_RUNNING) {
+        applyTokenFromServer(tokenNumber, kwhAmount, purchaseId);
       }
     }
     // No pending token found - silently continue (don't log every check)
     // Device will maintain current state and remaining energy
-  } else if (httpResponseCode == -1) {
+  } else if (status == HTTP_ERR_CONNECT) {
     // -1 = connection failed (server unreachable) - log URL so user can fix config
     SERIAL_PRINT("Pending token: connection failed (-1) to ");
-    SERIAL_PRINTLN(url);
+    SERIAL_PRINTLN(api.host());
   } else {
     SERIAL_PRINT("Error checking pending token: ");
-    SERIAL_PRINTLN(httpResponseCode);
+    SERIAL_PRINTLN(status);
   }
+}
 
-  http.end();
-  return false;
+/**
+ * checkForPendingToken()
+ * Queues a pending-token check for this meter (result handled in onPendingTokenResponse)
+ * Returns true if a request was queued, false otherwise
+ */
+bool checkForPendingToken() {
+  // Check WiFi connection
+  if (WiFi.status() != WL_CONNECTED) {
+    wifiConnected = false;
+    return false;
+  }
+  wifiConnected = true;
+  if (tokenPollInFlight) return false;  // previous poll still queued/active
+
+  tokenPollInFlight = api.enqueue("GET", PENDING_TOKEN_PATH, NULL, TOKEN_POLL_DEADLINE_MS, 0, onPendingTokenResponse);
+  return tokenPollInFlight;
+}
+
+void onTokenConfirmed(int status, const char* /*body*/, size_t /*len*/, void* /*ctx*/) {
+  if (status > 0) {
+    SERIAL_PRINTLN("Token confirmed on server");
+  } else {
+    SERIAL_PRINT("Failed to confirm token: ");
+    SERIAL_PRINTLN(status);
+  }
 }
 
 /**
@@ -806,56 +1350,57 @@ bool checkForPendingToken() {
  * Applies a token received from the server
  * Returns true if successful, false otherwise
  */
-bool applyTokenFromServer(String tokenNumber, float kwhAmount, String purchaseId) {
-  // Snapshot the PZEM energy reading right now — consumed = pzem.energy() - this baseline
-  float current_pzem_e = pzem.energy();
-  bool fresh_session = !(state == STATE_RUNNING && remaining_kwh > 0);
-
-  if (!fresh_session) {
-    // Already running — top-up: keep existing baseline (consumed keeps accumulating)
-    remaining_kwh += kwhAmount;
-    SERIAL_PRINT("Top-up: added kWh. Total remaining: ");
-    SERIAL_PRINTLN(remaining_kwh);
-  } else {
-    // Fresh start or after exhaustion — reset baseline to current PZEM reading
-    remaining_kwh = kwhAmount;
-    if (!isnan(current_pzem_e) && current_pzem_e >= 0.0f) {
-      pzem_energy_at_session_start = current_pzem_e;
-    } else {
-      pzem_energy_at_session_start = 0.0f;
+bool applyTokenFromServer(const char* tokenNumber, float kwhAmount, const char* purchaseId) {
+  // Same purchase again (pushed on reconnect / polled before our confirm got through, also
+  // after a reboot: the metering task persists the last ones credited): confirm only.
+  // A duplicate that slips past this (queued twice) is still not credited by MeteringCore::apply().
+  uint64_t purchase = purchaseId[0] != '\0' ? purchaseIdHash(purchaseId) : 0;
+  if (purchase != 0 && (purchase == submittedPurchase || purchaseHistoryContains(billingView.purchases, purchase))) {
+    confirmTokenDelivery(purchaseId);
+    return true;
+  }
+  // A crypto token (the server issues them when it has METER_TOKEN_SECRET) enters the replay
+  // window like a typed one, so the same token typed on the keypad is not credited again
+  uint16_t cryptoSeq = 0;
+  CryptoToken crypto;
+  if (tokenKeyValid && cryptoTokenDecode(tokenKey, METER_NUMBER, tokenNumber, crypto) == CRYPTO_TOKEN_OK) {
+    if (!replayWindowAllows(billingView.replay, crypto.seq)) {
+      SERIAL_PRINTLN("Server token already typed on the keypad: confirm only");
+      confirmTokenDelivery(purchaseId);
+      return true;
     }
-    savePzemSessionStartToEEPROM();
-    SERIAL_PRINT("New session baseline PZEM energy: ");
-    SERIAL_PRINTLN(pzem_energy_at_session_start);
-  }
-  currentToken = tokenNumber;
-  lastTokenEntered = tokenNumber;
-  state = STATE_RUNNING;
-  lastMillis = millis();
+    cryptoSeq = crypto.seq;
+  }
+
+  // Already running with balance -> top-up (keep PZEM baseline, consumed keeps accumulating).
+  // Otherwise fresh start: the metering task snapshots pzem.energy() as the new baseline.
+  bool fresh_session = !(ui.state == STATE_RUNNING && billingView.remaining_kwh > 0);
+  float expected_total = fresh_session ? kwhAmount : billingView.remaining_kwh + kwhAmount;
+  if (submitBillingCommand(tokenNumber, kwhAmount, !fresh_session, cryptoSeq, purchase) == 0) {
+    SERIAL_PRINTLN("Token apply failed: metering task did not accept command");
+    return false;
+  }
+  strncpy(lastTokenEntered, tokenNumber, sizeof(lastTokenEntered) - 1);
+  submittedPurchase = purchase;
+  ui.state = STATE_RUNNING;
   sessionStartTime = millis();
-  lastDisplayMillis = 0;
-  lastApiSendMillis = 0;
-  session_purchased_kwh = remaining_kwh;
-  saveRemainingToEEPROM();
-  saveSessionPurchasedToEEPROM();
-  saveTokenToEEPROM();
-  digitalWrite(RELAY_PIN, HIGH);  // Power to load
-  
+  reportPolicy.force();  // report the new balance on the next session check
+
   SERIAL_PRINT("Token applied from server, kWh: "); SERIAL_PRINTLN(kwhAmount);
-  SERIAL_PRINT("Token: "); SERIAL_PRINTLN(currentToken);
+  SERIAL_PRINT("Token: "); SERIAL_PRINTLN(tokenNumber);
 
-  // Show notification on display
+  // Show notification on display; the display task resumes the running screen after 2s
   display.clearDisplay();
   display.setCursor(0,0);
   display.println("Token Applied!");
   display.println("From Server");
-  if (state == STATE_RUNNING && remaining_kwh > kwhAmount) {
+  if (!fresh_session) {
     // Show that energy was added to existing
     display.print("Added: ");
     display.print(kwhAmount, 2);
     display.println(" kWh");
     display.print("Total: ");
-    display.print(remaining_kwh, 2);
+    display.print(expected_total, 2);
     display.println(" kWh");
   } else {
     // New token starting
@@ -863,205 +1408,131 @@ bool applyTokenFromServer(String tokenNumber, float kwhAmount, String purchaseId
     display.println(kwhAmount, 2);
   }
   display.display();
-  for (int i = 0; i < 40; i++) { handleKeypad(); delay(50); }  // ~2s, keypad stays responsive
-  showRunningScreen();
-
-  // Confirm token was applied to server
-  HTTPClient http;
-  String url = String(apiBaseUrl) + "/purchases/confirm-token/" + purchaseId;
-  
-  http.begin(url);
-  http.setTimeout(2000);
-  int httpResponseCode = http.POST("{}");
-
-  if (httpResponseCode > 0) {
-    SERIAL_PRINTLN("Token confirmed on server");
-  } else {
-    SERIAL_PRINT("Failed to confirm token: ");
-    SERIAL_PRINTLN(httpResponseCode);
-  }
-  http.end();
-
-  // Send initial data to API
-  if (wifiConnected) {
-    sendEnergyDataToAPI();
-  }
+  scheduler.start(tDisplay, NOTICE_HOLD_MS);  // running screen resumes after the notice
 
+  confirmTokenDelivery(purchaseId);
   return true;
 }
 
 /**
- * validateTokenFromServer()
- * Validates a token with the server
- * Returns true if token is valid, false otherwise
+ * confirmTokenDelivery()
+ * Marks the purchase DELIVERED: over the push channel when it is up, otherwise HTTP
+ * (retried on transport errors). The server is idempotent; a lost socket confirm
+ * just means the token is pushed again on reconnect and confirmed again.
  */
-bool validateTokenFromServer(String tokenNumber) {
-  if (!wifiConnected || WiFi.status() != WL_CONNECTED) {
-    return false;
-  }
-
-  // Check if this token is pending for this meter
-  HTTPClient http;
-  String url = String(apiBaseUrl) + "/purchases/pending-token/" + String(METER_NUMBER);
-  
-  http.begin(url);
-  http.setTimeout(2000);  // fail fast so keypad stays responsive
+void confirmTokenDelivery(const char* purchaseId) {
+  if (tokenChannel.confirm(purchaseId)) return;
+  char path[HTTP_MAX_PATH];
+  snprintf(path, sizeof(path), "/purchases/confirm-token/%s", purchaseId);
+  api.enqueue("POST", path, "{}", TOKEN_CONFIRM_DEADLINE_MS, 2, onTokenConfirmed);
+}
 
-  int httpResponseCode = http.GET();
+/**
+ * onValidateTokenResponse()
+ * Completion callback for validateTokenFromServer(): apply on match, otherwise BAD TOKEN
+ */
+void onValidateTokenResponse(int status, const char* body, size_t len, void* /*ctx*/) {
+  if (ui.state != STATE_VALIDATING) return;  // cancelled from the keypad
 
-  if (httpResponseCode == 200) {
-    String response = http.getString();
-    DynamicJsonDocument doc(512);
-    deserializeJson(doc, response);
+  if (status == 200) {
+    JsonDocument& doc = apiResponseDoc;
+    deserializeJson(doc, body, len);
 
     if (doc["success"].as<bool>() && doc["hasToken"].as<bool>()) {
-      String pendingToken = doc["token"]["tokenNumber"].as<String>();
-      if (pendingToken == tokenNumber) {
+      const char* pendingToken = doc["token"]["tokenNumber"] | "";
+      if (strcmp(pendingToken, validatingToken) == 0) {
         // Token matches pending token, apply it
         float kwhAmount = doc["token"]["kwhAmount"].as<float>();
-        String purchaseId = doc["token"]["purchaseId"].as<String>();
-        http.end();
-        return applyTokenFromServer(tokenNumber, kwhAmount, purchaseId);
+        const char* purchaseId = doc["token"]["purchaseId"] | "";
+        ui.state = STATE_READY;  // fresh session
+        if (applyTokenFromServer(pendingToken, kwhAmount, purchaseId)) {
+          validatingToken[0] = '\0';
+          return;
+        }
       }
     }
   }
 
-  http.end();
-  return false;
+  validatingToken[0] = '\0';
+  showBadTokenScreen(status > 0 ? "Not found" : "Server error");
+  SERIAL_PRINTLN("BAD TOKEN - Not found on server either");
 }
 
+/**
+ * validateTokenFromServer()
+ * Queues validation of a keypad token against this meter's pending token.
+ * Returns true if the check was queued (state -> STATE_VALIDATING), false otherwise
+ */
+bool validateTokenFromServer(const char* tokenNumber) {
+  if (!wifiConnected || WiFi.status() != WL_CONNECTED) {
+    return false;
+  }
+
+  // Check if this token is pending for this meter
+  if (!api.enqueue("GET", PENDING_TOKEN_PATH, NULL, TOKEN_POLL_DEADLINE_MS, 1, onValidateTokenResponse)) {
+    return false;
+  }
+  strncpy(validatingToken, tokenNumber, sizeof(validatingToken) - 1);
+  ui.state = STATE_VALIDATING;
+  return true;
+}
+
+// Apply every key press the keypad task has queued, oldest first
 void handleKeypad() {
-  uint8_t keyIndex = keypad.getKey();
-  if (keyIndex < 16) {
-    unsigned long now = millis();
-    if (keyIndex == lastKeyIndex && (now - lastKeyMillis) < KEY_DEBOUNCE_MS) return;
-    lastKeyIndex = keyIndex;
-    lastKeyMillis = now;
-    lastKeypadActivityMillis = now;  // high priority: next 30s skip blocking network
-
-    char k = keys[keyIndex / COLS][keyIndex % COLS];
-    // Always print to Serial for keypad debugging (independent of SERIAL_LOGGING_ENABLED)
-    Serial.print("[KEYPAD] Key pressed: ");
-    Serial.println(k);
-    SERIAL_PRINT("Key: "); SERIAL_PRINTLN(k);
-
-    // When showing info screen (C/B/#), any key returns to READY
-    if (state == STATE_INFO_SCREEN) {
-      state = STATE_READY;
-      showReadyScreen();
-      return;
-    }
+  KeyEvent ev;
+  while (keypad.next(ev)) {
+    handleKey(KeypadUi::keyFor(ev.index));
+  }
+}
 
-    // EXHAUSTED: A = reset and return to READY (enter new token)
-    if (state == STATE_EXHAUSTED && k == 'A') {
-      inputLen = 0;
-      inputBuf[0] = '\0';
-      state = STATE_READY;
-      showReadyScreen();
-      return;
-    }
+void handleKey(char k) {
+  // Always print to Serial for keypad debugging (independent of SERIAL_LOGGING_ENABLED)
+  Serial.print("[KEYPAD] Key pressed: ");
+  Serial.println(k);
+  SERIAL_PRINT("Key: "); SERIAL_PRINTLN(k);
 
-    // READY: A = start manual token entry. C = Check Energy, B = Previous token, # * 0 = Meter number
-    if (state == STATE_READY) {
-      if (k == 'A') {
-        state = STATE_ENTERING;
-        inputLen = 0;
-        inputBuf[0] = '\0';
-        showEnteringScreen();
-        return;
-      }
-      if (k == 'C') {
+  switch (ui.key(k)) {
+    case UI_SHOW_READY:
+      showReadyScreen();
+      break;
+    case UI_SHOW_ENTERING:
+      showEnteringScreen();
+      break;
+    case UI_SUBMIT:
+      showEnteringScreen();
+      submitToken();  // Auto-validate with server when WiFi available
+      break;
+    case UI_SHOW_RUNNING:
+      scheduler.start(tScreenSwap, SCREEN_SWAP_MS);
+      showRunningScreen();
+      break;
+    case UI_SHOW_INFO:
+      if (ui.infoScreen == UI_INFO_ENERGY) {
         showCheckEnergyScreen();
-        state = STATE_INFO_SCREEN;
-        infoScreenStart = now;
-        infoScreenType = 1;
-        return;
-      }
-      if (k == 'B') {
+      } else if (ui.infoScreen == UI_INFO_PREVIOUS_TOKEN) {
         showPreviousTokenScreen();
-        state = STATE_INFO_SCREEN;
-        infoScreenStart = now;
-        infoScreenType = 2;
-        return;
-      }
-      if (k == '#' || k == '*' || k == '0') {
+      } else {
         showMeterNumberScreen();
-        state = STATE_INFO_SCREEN;
-        infoScreenStart = now;
-        infoScreenType = 0;
-        return;
-      }
-    }
-
-    // RUNNING: * = next display screen, # = previous screen
-    if (state == STATE_RUNNING) {
-      if (k == '*') {
-        runningScreenIdx = (runningScreenIdx + 1) % 5;
-        lastScreenSwapMillis = now;
-        showRunningScreen();
-        return;
-      }
-      if (k == '#') {
-        runningScreenIdx = (runningScreenIdx + 4) % 5;  // +4 mod 5 = go back one
-        lastScreenSwapMillis = now;
-        showRunningScreen();
-        return;
       }
-      // C = Check Energy info screen while running
-      if (k == 'C') {
-        showCheckEnergyScreen();
-        state = STATE_INFO_SCREEN;
-        infoScreenStart = now;
-        infoScreenType = 1;
-        return;
-      }
-    }
-
-    // ENTERING: 0-9 add digit (auto-submit at 20). D = delete, * = backspace. A = cancel.
-    if (k >= '0' && k <= '9') {
-      if (state == STATE_READY) {
-        state = STATE_ENTERING;
-        inputLen = 0;
-        inputBuf[0] = '\0';
-      }
-      if (state == STATE_ENTERING) {
-        if (inputLen < 20) {
-          inputBuf[inputLen++] = k;
-          inputBuf[inputLen] = '\0';
-          showEnteringScreen();
-          if (inputLen == 20) {
-            submitToken();  // Auto-validate with server when WiFi available
-          }
-        }
-      }
-    } else if (k == 'D' || k == '*') {
-      // D = Delete (backspace), * = backspace
-      if (state == STATE_ENTERING && inputLen > 0) {
-        inputLen--;
-        inputBuf[inputLen] = '\0';
-        showEnteringScreen();
-        if (inputLen == 0) state = STATE_READY;
-      }
-    } else if (k == 'A') {
-      if (state == STATE_ENTERING) {
-        inputLen = 0;
-        inputBuf[0] = '\0';
-        state = STATE_READY;
-        showReadyScreen();
-      }
-      // In READY, A already handled above (start token entry)
-    }
-  } else {
-    lastKeyIndex = 255;
+      scheduler.start(tInfoTimeout, INFO_SCREEN_MS);
+      break;
+    case UI_LEAVE_INFO:
+      leaveInfoScreen();
+      break;
+    case UI_CANCEL_VALIDATION:
+      validatingToken[0] = '\0';
+      showReadyScreen();
+      break;
+    case UI_NONE:
+      break;
   }
 }
 
 void submitToken() {
   // Input buffer already contains only digits (no spaces)
-  String tokenString = String(inputBuf);
-  
-  if (tokenString.length() != 20) {
-    state = STATE_BADTOKEN;
+  if (strlen(ui.input) != 20) {
+    ui.state = STATE_BADTOKEN;
+    scheduler.start(tBadTokenTimeout, BAD_TOKEN_SCREEN_MS);
     display.clearDisplay();
     display.setCursor(0,0);
     display.println("INVALID TOKEN!");
@@ -1069,106 +1540,156 @@ void submitToken() {
     display.println("Returning...");
     display.display();
     SERIAL_PRINTLN("INVALID TOKEN - Wrong length");
-    inputLen = 0;
-    inputBuf[0] = '\0';
+    ui.clearInput();
     return;
   }
 
-  bool found = false;
   float kwh = 0.0;
-  const char* clientName = CLIENT_NAME;
-  const char* clientTIN = CLIENT_TIN;
-  const char* clientPhone = CLIENT_PHONE;
-  
-  for (int i = 0; i < TOKENS_COUNT; ++i) {
-    if (tokenString.equals(tokens[i].code)) {
-      found = true;
-      kwh = tokens[i].kwh;
-      clientName = tokens[i].clientName;
-      clientTIN = tokens[i].clientTIN;
-      clientPhone = tokens[i].clientPhone;
-      break;
-    }
+  int32_t tokenIndex = -1;
+  TokenLookup lookup = tokenStore.find(ui.input, tokenIndex, kwh);
+  SERIAL_PRINT("Token lookup (us): "); SERIAL_PRINTLN(tokenStore.lastLookupUs());
+  if (lookup == TOKEN_USED) {
+    showBadTokenScreen("Already used");
+    SERIAL_PRINTLN("BAD TOKEN - already redeemed");
+    ui.clearInput();
+    return;
+  }
+  bool found = lookup == TOKEN_VALID;
+  bool topUp = false;
+  uint16_t cryptoSeq = 0;
+
+  // Meter-bound crypto token: decoded and verified here, no server round trip
+  CryptoToken crypto;
+  CryptoTokenResult decoded = found || !tokenKeyValid ? CRYPTO_TOKEN_NOT_CRYPTO
+                                                      : cryptoTokenDecode(tokenKey, METER_NUMBER, ui.input, crypto);
+  if (decoded == CRYPTO_TOKEN_BAD_FIELDS ||
+      (decoded == CRYPTO_TOKEN_OK && !replayWindowAllows(billingView.replay, crypto.seq))) {
+    showBadTokenScreen(decoded == CRYPTO_TOKEN_OK ? "Already used" : "Invalid");
+    SERIAL_PRINTLN("BAD TOKEN - crypto token replayed or malformed");
+    ui.clearInput();
+    return;
+  }
+  if (decoded == CRYPTO_TOKEN_OK) {
+    found = true;
+    kwh = crypto.deciKwh / 10.0f;
+    cryptoSeq = crypto.seq;
+    topUp = billingView.remaining_kwh > 0;  // credit adds to the balance, like a server top-up
   }
 
-  // If not found locally, check server if WiFi is available
+  // If not found locally, check server if WiFi is available (result arrives in onValidateTokenResponse)
   if (!found && wifiConnected) {
     SERIAL_PRINTLN("Token not found locally, checking server...");
-    display.clearDisplay();
-    display.setCursor(0,0);
-    display.println("Checking server...");
-    display.display();
-    
-    if (validateTokenFromServer(tokenString)) {
-      lastTokenEntered = tokenString;
-      inputLen = 0;
-      inputBuf[0] = '\0';
-      return;
-    } else {
-      state = STATE_BADTOKEN;
+    bool queued = validateTokenFromServer(ui.input);
+    ui.clearInput();
+    if (queued) {
       display.clearDisplay();
       display.setCursor(0,0);
-      display.println("BAD TOKEN!");
-      display.println("Not found");
-      display.println("Returning...");
+      display.println("Checking server...");
+      display.println("A=Cancel");
       display.display();
-      SERIAL_PRINTLN("BAD TOKEN - Not found on server either");
-      inputLen = 0;
-      inputBuf[0] = '\0';
-      return;
+    } else {
+      showBadTokenScreen("Server busy");
+      SERIAL_PRINTLN("BAD TOKEN - could not queue server check");
     }
+    return;
   } else if (!found) {
     // No WiFi, can't check server
-    state = STATE_BADTOKEN;
-    display.clearDisplay();
-    display.setCursor(0,0);
-    display.println("BAD TOKEN!");
-    display.println("Not found");
-    display.println("No network");
-    display.println("Returning...");
-    display.display();
+    showBadTokenScreen("Not found", "No network");
     SERIAL_PRINTLN("BAD TOKEN - Not found locally and no WiFi");
-    inputLen = 0;
-    inputBuf[0] = '\0';
+    ui.clearInput();
     return;
   }
 
-  // Apply token from local database — snapshot PZEM energy baseline
-  float current_pzem_e = pzem.energy();
-  remaining_kwh = kwh;
-  session_purchased_kwh = kwh;
-  if (!isnan(current_pzem_e) && current_pzem_e >= 0.0f) {
-    pzem_energy_at_session_start = current_pzem_e;
-  } else {
-    pzem_energy_at_session_start = 0.0f;
+  // Table token: its used bit is on flash before the credit is queued (loop() is the only
+  // producer, so a free slot stays free). A power cut in between costs the customer the
+  // token instead of crediting it twice; the crypto replay window persists with the credit.
+  if (cryptoSeq == 0) {
+    if (billingCommands.size() >= billingCommands.capacity()) {
+      SERIAL_PRINTLN("Token apply failed: metering task did not accept command");
+      ui.clearInput();
+      return;
+    }
+    if (!tokenStore.markUsed(tokenIndex)) {
+      showBadTokenScreen("Try again");
+      SERIAL_PRINTLN("BAD TOKEN - could not record token as used");
+      ui.clearInput();
+      return;
+    }
   }
-  currentToken = tokenString;
-  lastTokenEntered = tokenString;
-  state = STATE_RUNNING;
-  lastMillis = millis();
+
+  // Apply token from local database — metering task snapshots the PZEM energy baseline
+  uint32_t commandId = submitBillingCommand(ui.input, kwh, topUp, cryptoSeq);
+  if (commandId == 0) {
+    SERIAL_PRINTLN("Token apply failed: metering task did not accept command");
+    ui.clearInput();
+    return;
+  }
+  strncpy(lastTokenEntered, ui.input, sizeof(lastTokenEntered) - 1);
+  ui.state = STATE_RUNNING;
   sessionStartTime = millis();
-  lastDisplayMillis = 0;
-  lastApiSendMillis = 0;
-  saveRemainingToEEPROM();
-  saveSessionPurchasedToEEPROM();
-  savePzemSessionStartToEEPROM();
-  saveTokenToEEPROM();
-  SERIAL_PRINT("Local token: PZEM baseline = "); SERIAL_PRINTLN(pzem_energy_at_session_start);
-  digitalWrite(RELAY_PIN, HIGH);  // Power to load
-  showRunningScreen();
+  reportPolicy.force();  // report the new balance on the next session check
   SERIAL_PRINT("Token accepted, kWh: "); SERIAL_PRINTLN(kwh);
-  SERIAL_PRINT("Token: "); SERIAL_PRINTLN(currentToken);
 
-  // Send initial data to API
-  if (wifiConnected) {
-    sendEnergyDataToAPI();
-  }
+  // billingView still holds the old balance until the metering task has applied the
+  // command (one period at most): the running screen comes up from finishKeypadToken()
+  pendingCommandId = commandId;
+  scheduler.stop(tDisplay);
+  display.clearDisplay();
+  display.setCursor(0,0);
+  display.println("Applying token...");
+  display.display();
+  ui.clearInput();
+}
 
-  inputLen = 0;
-  inputBuf[0] = '\0';
+/**
+ * finishKeypadToken()
+ * The metering task has handled the keypad token (metering-view task): billingView
+ * shows the new session, bring up the running screen. A token the metering task found
+ * already credited (typed twice before the first was applied) gets the bad-token screen.
+ */
+void finishKeypadToken() {
+  bool rejected = billingView.last_rejected_id == pendingCommandId;
+  pendingCommandId = 0;
+  if (rejected) {
+    SERIAL_PRINTLN("BAD TOKEN - already applied by the metering task");
+    if (ui.state == STATE_RUNNING) showBadTokenScreen("Already used");
+    return;
+  }
+  SERIAL_PRINT("Local token: PZEM baseline = "); SERIAL_PRINTLN(billingView.pzem_energy_at_session_start);
+  SERIAL_PRINT("Token: "); SERIAL_PRINTLN(billingView.token);
+  if (ui.state != STATE_RUNNING) return;  // already on another screen
+  scheduler.start(tDisplay, DISPLAY_REFRESH_MS);
+  showRunningScreen();
 }
 
 // Display functions
+// BAD TOKEN notice with the reason (and an optional second line); the bad-token task
+// returns to READY after 2s
+void showBadTokenScreen(const char* reason, const char* detail) {
+  ui.state = STATE_BADTOKEN;
+  scheduler.start(tBadTokenTimeout, BAD_TOKEN_SCREEN_MS);
+  display.clearDisplay();
+  display.setCursor(0,0);
+  display.println("BAD TOKEN!");
+  display.println(reason);
+  if (detail) display.println(detail);
+  display.println("Returning...");
+  display.display();
+}
+
+// Info screens opened from RUNNING must return there: billing keeps going in the metering task
+void leaveInfoScreen() {
+  scheduler.stop(tInfoTimeout);
+  if (billingView.relay_on) {
+    ui.state = STATE_RUNNING;
+    scheduler.start(tScreenSwap, SCREEN_SWAP_MS);
+    showRunningScreen();
+  } else {
+    ui.state = STATE_READY;
+    showReadyScreen();
+  }
+}
+
 void showReadyScreen() {
   display.clearDisplay();
   display.setCursor(0, 0);
@@ -1187,8 +1708,8 @@ void showEnteringScreen() {
   display.print(">");
   
   // Display token with formatting (add spaces every 4 digits)
-  for (uint8_t i = 0; i < inputLen; ++i) {
-    display.print(inputBuf[i]);
+  for (uint8_t i = 0; i < ui.inputLen; ++i) {
+    display.print(ui.input[i]);
     // Add space after every 4 digits (after positions 3, 7, 11, 15)
     if ((i + 1) % 4 == 0 && i < 19) {
       display.print(' ');
@@ -1196,11 +1717,11 @@ void showEnteringScreen() {
   }
   
   // Show remaining placeholders with spaces
-  int remainingDigits = 20 - inputLen;
+  int remainingDigits = 20 - ui.inputLen;
   for (int i = 0; i < remainingDigits; ++i) {
     display.print('_');
     // Add space after every 4 digits
-    if ((inputLen + i + 1) % 4 == 0 && (inputLen + i) < 19) {
+    if ((ui.inputLen + i + 1) % 4 == 0 && (ui.inputLen + i) < 19) {
       display.print(' ');
     }
   }
@@ -1219,102 +1740,92 @@ void printHeader(const char* subtitle) {
 }
 
 
-void showRunningScreen() {
-  float sensor_kwh = pzem.energy();
-  // consumed = actual PZEM energy since this session token was applied
-  float consumed_kwh = sensor_kwh - pzem_energy_at_session_start;
-  if (isnan(consumed_kwh) || consumed_kwh < 0.0f) consumed_kwh = 0.0f;
-  float voltage    = pzem.voltage();
-  float current_a  = pzem.current();
-  float power_w    = pzem.power();
-  float frequency  = pzem.frequency();
-  float pf         = pzem.pf();
-
-  display.clearDisplay();
-  display.setCursor(0, 0);
+// One value row for a 14-character text cell: fewer decimals until it fits, "--" when NaN
+void formatValueRow(char* out, const char* label, float value, int decimals, const char* unit) {
+  char buf[32];
+  if (isnan(value)) {
+    snprintf(out, PCD8544_TEXT_COLS + 1, "%s--%s", label, unit);
+    return;
+  }
+  for (; decimals >= 0; decimals--) {
+    snprintf(buf, sizeof(buf), "%s%.*f%s", label, decimals, value, unit);
+    if (strlen(buf) <= PCD8544_TEXT_COLS) break;
+  }
+  snprintf(out, PCD8544_TEXT_COLS + 1, "%s", buf);
+}
 
-  switch (runningScreenIdx) {
+// Running screens are text rows: formatted every refresh, drawn and sent only when they change
+void showRunningScreen() {
+  uint32_t t0 = micros();
+  float remaining_kwh = billingView.remaining_kwh;
+  float sensor_kwh = latestSample.energy_kwh;
+  // consumed = ledger energy since this session token was applied (reconciled to the PZEM register)
+  float consumed_kwh = billingView.consumed_kwh;
+  char rows[PCD8544_TEXT_ROWS][PCD8544_TEXT_COLS + 1] = {};
+  const char* title = "";
+
+  switch (ui.runningScreen) {
     // ---- Screen 0: Energy (remaining / consumed / sensor total) ----
     case 0:
-      printHeader("ENERGY");
-      display.print("Rem:");
-      if (remaining_kwh < 10.0f) display.print(remaining_kwh, 3);
-      else display.print(remaining_kwh, 2);
-      display.println("kWh");
-      display.print("Used:");
-      if (consumed_kwh < 10.0f) display.print(consumed_kwh, 3);
-      else display.print(consumed_kwh, 2);
-      display.println("kWh");
-      display.print("Tot:");
-      if (!isnan(sensor_kwh)) display.print(sensor_kwh, 3);
-      else display.print("--");
-      display.println("kWh");
+      title = "ENERGY";
+      formatValueRow(rows[3], "Rem:", remaining_kwh, remaining_kwh < 10.0f ? 3 : 2, "kWh");
+      formatValueRow(rows[4], "Used:", consumed_kwh, consumed_kwh < 10.0f ? 3 : 2, "kWh");
+      formatValueRow(rows[5], "Tot:", sensor_kwh, 3, "kWh");
       break;
 
     // ---- Screen 1: Voltage + Current ----
     case 1:
-      printHeader("VOLTAGE-CURRENT");
-      display.print("V: ");
-      if (!isnan(voltage)) { display.print(voltage, 1); display.println(" V"); }
-      else display.println("-- V");
-      display.print("I: ");
-      if (!isnan(current_a)) { display.print(current_a, 3); display.println(" A"); }
-      else display.println("-- A");
-      display.println(wifiConnected ? "WiFi: ON" : "WiFi: OFF");
+      title = "VOLT-CURRENT";
+      formatValueRow(rows[3], "V: ", latestSample.voltage, 1, " V");
+      formatValueRow(rows[4], "I: ", latestSample.current, 3, " A");
+      strcpy(rows[5], wifiConnected ? "WiFi: ON" : "WiFi: OFF");
       break;
 
     // ---- Screen 2: Power + Sensor Energy ----
     case 2:
-      printHeader("POWER-ENERGY");
-      display.print("P: ");
-      if (!isnan(power_w)) { display.print(power_w, 1); display.println(" W"); }
-      else display.println("-- W");
-      display.print("E: ");
-      if (!isnan(sensor_kwh)) { display.print(sensor_kwh, 3); display.println("kWh"); }
-      else display.println("-- kWh");
+      title = "POWER-ENERGY";
+      formatValueRow(rows[3], "P: ", latestSample.power, 1, " W");
+      formatValueRow(rows[4], "E: ", sensor_kwh, 3, "kWh");
       break;
 
     // ---- Screen 3: Frequency + Power Factor ----
     case 3:
-      printHeader("AC PARAMS");
-      display.print("Hz: ");
-      if (!isnan(frequency)) display.println(frequency, 2);
-      else display.println("--");
-      display.print("PF: ");
-      if (!isnan(pf)) display.println(pf, 2);
-      else display.println("--");
-      display.println(wifiConnected ? "WiFi: ON" : "WiFi: OFF");
+      title = "AC PARAMS";
+      formatValueRow(rows[3], "Hz: ", latestSample.frequency, 2, "");
+      formatValueRow(rows[4], "PF: ", latestSample.pf, 2, "");
+      strcpy(rows[5], wifiConnected ? "WiFi: ON" : "WiFi: OFF");
       break;
 
     // ---- Screen 4: Date / Time ----
     case 4:
-      printHeader("DATE-TIME");
-      if (timeSynchronized && timeClient.isTimeSet()) {
-        unsigned long utcEpoch = timeClient.getEpochTime();
-        unsigned long localEpoch = utcEpoch + gmtOffset_sec + daylightOffset_sec;
-        time_t rawTime = (time_t)localEpoch;
-        struct tm *ti = gmtime(&rawTime);
-        char timeBuf[10], dateBuf[12];
-        snprintf(timeBuf, sizeof(timeBuf), "%02d:%02d:%02d",
-                 ti->tm_hour, ti->tm_min, ti->tm_sec);
-        snprintf(dateBuf, sizeof(dateBuf), "%04d-%02d-%02d",
-                 ti->tm_year + 1900, ti->tm_mon + 1, ti->tm_mday);
-        display.println(timeBuf);
-        display.println(dateBuf);
-        display.println("GMT+2");
+      title = "DATE-TIME";
+      if (timeSync.synced()) {
+        // Cached "YYYY-MM-DDTHH:MM:SS" of the current second
+        const char* iso = timeSync.isoLocal();
+        memcpy(rows[3], iso + 11, 8);
+        memcpy(rows[4], iso, 10);
+        strcpy(rows[5], "GMT+2");
       } else {
-        display.println("Not synced");
-        display.print("Meter:");
-        display.println(METER_NUMBER);
+        strcpy(rows[3], "Not synced");
+        strcpy(rows[4], "Meter:");
+        snprintf(rows[5], sizeof(rows[5]), "%s", METER_NUMBER);
       }
       break;
 
     default:
-      runningScreenIdx = 0;
+      ui.runningScreen = 0;
       break;
   }
 
+  // Same header as printHeader()
+  snprintf(rows[0], sizeof(rows[0]), "SMART METER");
+  snprintf(rows[1], sizeof(rows[1]), "%s", title);
+  snprintf(rows[2], sizeof(rows[2]), "-------------");
+  for (uint8_t i = 0; i < PCD8544_TEXT_ROWS; i++) display.textRow(i, rows[i]);
   display.display();
+
+  displayRenderUs = micros() - t0;
+  if (displayRenderUs > displayRenderMaxUs) displayRenderMaxUs = displayRenderUs;
 }
 
 void showExhaustedScreen() {
@@ -1336,11 +1847,10 @@ void showMeterNumberScreen() {
 }
 
 void showCheckEnergyScreen() {
-  float sensor_kwh = pzem.energy();
-  float power_w    = pzem.power();
-  // Consumed = PZEM energy since this token was applied (same formula as API payload)
-  float consumed_kwh = sensor_kwh - pzem_energy_at_session_start;
-  if (isnan(consumed_kwh) || consumed_kwh < 0.0f) consumed_kwh = 0.0f;
+  float remaining_kwh = billingView.remaining_kwh;
+  float sensor_kwh = latestSample.energy_kwh;
+  // Consumed = ledger energy since this token was applied (same value as API payload)
+  float consumed_kwh = billingView.consumed_kwh;
 
   display.clearDisplay();
   display.setCursor(0, 0);
@@ -1370,7 +1880,7 @@ void showPreviousTokenScreen() {
   display.clearDisplay();
   display.setCursor(0, 0);
   printHeader("PREV TOKEN");
-  if (lastTokenEntered.length() == 20) {
+  if (strlen(lastTokenEntered) == 20) {
     for (int i = 0; i < 20; i++) {
       display.print(lastTokenEntered[i]);
       if ((i + 1) % 4 == 0 && i < 19) display.print(' ');
@@ -1404,44 +1914,276 @@ void showWiFiConfigPortalScreen(WiFiManager* /*wm*/) {
   display.display();
 }
 
-// --------------------- EEPROM persistence ------------------
-void loadEnergyFromEEPROM() {
-  float r = 0.0f, s = 0.0f, p = 0.0f;
-  EEPROM.get(EEPROM_ADDR_REMAINING_KWH, r);
-  EEPROM.get(EEPROM_ADDR_SESSION_PURCHASED, s);
-  EEPROM.get(EEPROM_ADDR_PZEM_SESSION_START, p);
-  if (!isnan(r) && r >= 0.0f) remaining_kwh = r;
-  if (!isnan(s) && s >= 0.0f) session_purchased_kwh = s;
-  if (!isnan(p) && p >= 0.0f) pzem_energy_at_session_start = p;
-  // Restore active token so API sends survive reboots
-  char savedToken[21] = {0};
-  EEPROM.get(EEPROM_ADDR_TOKEN, savedToken);
-  savedToken[20] = '\0';
-  if (savedToken[0] >= '0' && savedToken[0] <= '9') {
-    currentToken = String(savedToken);
-    lastTokenEntered = currentToken;
-    SERIAL_PRINT("Restored token from EEPROM: "); SERIAL_PRINTLN(currentToken);
+// --------------------- Metering task (core 0) ------------------
+/**
+ * meteringTask()
+ * Fixed-rate metering/billing loop pinned to METER_TASK_CORE.
+ * vTaskDelayUntil keeps the period at METER_PERIOD_MS regardless of how long
+ * loop() spends in WiFi/HTTP/NTP calls on the other core.
+ */
+void meteringTask(void* /*arg*/) {
+  TickType_t lastWake = xTaskGetTickCount();
+  for (;;) {
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(METER_PERIOD_MS));
+    meteringTick();
+  }
+}
+
+/**
+ * meteringTick()
+ * One metering period (see MeteringCore): collect the PZEM reply to last tick's
+ * request and send the next one, apply queued token commands, integrate, cut
+ * the relay when exhausted, persist, then publish the sample (SPSC ring) and
+ * billing state (seqlock) for loop().
+ */
+void meteringTick() {
+  uint32_t now = millis();
+  bool fresh = metering.poll(now);
+
+  // Token applications queued by loop() — baseline is the latest energy register
+  BillingCommand cmd;
+  while (billingCommands.pop(cmd)) metering.apply(cmd, now);
+
+  PzemReading sample;
+  if (metering.settle(now, fresh, sample)) sampleRing.push(sample);
+  billingShared.write(metering.billing());
+}
+
+/**
+ * refreshMeteringView()
+ * loop()-side: feed every new sample to the window statistics, keep the newest
+ * one and take a consistent billing snapshot.
+ */
+void refreshMeteringView() {
+  PzemReading sample;
+  while (sampleRing.pop(sample)) {
+    windowStats.add(sample);
+    latestSample = sample;
+  }
+  billingView = billingShared.read();
+}
+
+/**
+ * submitBillingCommand()
+ * Queue a token application for the metering task and return: the task applies it
+ * within one METER_PERIOD_MS and publishes its id (billingCommandDone()). Returns
+ * the command's id, 0 when the queue is full.
+ */
+uint32_t submitBillingCommand(const char* token, float kwh, bool topUp, uint16_t cryptoSeq, uint64_t purchase) {
+  BillingCommand cmd = {};
+  cmd.id = nextCommandId++;
+  if (nextCommandId == 0) nextCommandId = 1;
+  cmd.kwh = kwh;
+  cmd.top_up = topUp;
+  cmd.crypto_seq = cryptoSeq;
+  cmd.purchase = purchase;
+  strncpy(cmd.token, token, sizeof(cmd.token) - 1);
+
+  return billingCommands.push(cmd) ? cmd.id : 0;
+}
+
+// The metering task has handled command id (ids increase, so later ones imply earlier ones)
+bool billingCommandDone(uint32_t id) {
+  return (int32_t)(billingView.last_command_id - id) >= 0;
+}
+
+// --------------------- Benchmarks ------------------------
+// Device-only hot paths on top of the core cases (bench.h). Inputs are seeded,
+// so the numbers compare across commits; the live state is put back afterwards.
+
+// /energy-data payload of one reading, as built by postTelemetryRecord(); reports its
+// bytes per reading next to telemetry.frame's
+uint32_t benchJsonBytes;
+uint32_t benchJsonReadings;
+
+bool benchEnergyDataJsonSetup(void*) {
+  benchJsonBytes = 0;
+  benchJsonReadings = 0;
+  return true;
+}
+
+void benchEnergyDataJsonInfo(void*, char* out, size_t len) {
+  snprintf(out, len, ",\"bytes_per_reading\":%lu",
+           (unsigned long)(benchJsonReadings ? benchJsonBytes / benchJsonReadings : 0));
+}
+
+uint32_t benchEnergyDataJson(void*, BenchRng& rng) {
+  TelemetryRecord rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.epoch = 1767225600UL + rng.below(365UL * 86400);
+  rec.uptime_ms = rng.next();
+  rec.flags = TLOG_FLAG_TIME_SYNCED | TLOG_FLAG_SENSOR_VALID;
+  rec.voltage_dv = 2200 + rng.below(200);
+  rec.current_ma = rng.below(20000);
+  rec.power_dw = rng.below(48000);
+  rec.energy_wh = 12345000 + rng.below(100000);
+  rec.frequency_dhz = 495 + rng.below(10);
+  rec.pf_pct = rng.below(101);
+  rec.remaining_mwh = rng.below(50000000);
+  rec.consumed_mwh = rng.below(50000000);
+  rec.session_s = rng.below(86400);
+  char token[21];
+  rng.digits(token, 20);
+  TelemetryLog::packToken(token, rec.token_bcd);
+
+  const char* jsonPayload = buildTelemetryRecordJson(rec);
+  uint32_t bytes = jsonPayload != NULL ? strlen(jsonPayload) : 0;
+  benchJsonBytes += bytes;
+  benchJsonReadings++;
+  return bytes;
+}
+
+// ISO timestamp of a logged reading (addTelemetryFields); the live clock's isoLocal() is cached
+uint32_t benchTimestamp(void*, BenchRng& rng) {
+  char formattedTime[25];
+  TimeSync::formatIso(1767225600UL + rng.below(365UL * 86400), formattedTime);
+  return strlen(formattedTime) + (uint8_t)formattedTime[18];
+}
+
+// showRunningScreen() over seeded readings, every screen in turn (changed rows are redrawn and sent)
+PzemReading benchSavedSample;
+uint8_t benchSavedScreen;
+
+bool benchRunningScreenSetup(void*) {
+  benchSavedSample = latestSample;
+  benchSavedScreen = ui.runningScreen;
+  return true;
+}
+
+void benchRunningScreenTeardown(void*) {
+  latestSample = benchSavedSample;
+  ui.runningScreen = benchSavedScreen;
+  if (ui.state == STATE_RUNNING) showRunningScreen();
+  else if (ui.state == STATE_READY) showReadyScreen();
+  // other states are repainted by their own task
+}
+
+uint32_t benchRunningScreen(void*, BenchRng& rng) {
+  latestSample.t_ms = 1 + rng.below(100000);
+  latestSample.voltage = 220.0f + rng.below(200) / 10.0f;
+  latestSample.power = rng.below(24000) / 10.0f;
+  latestSample.current = latestSample.power / latestSample.voltage;
+  latestSample.energy_kwh = 12345.0f + rng.below(100000) / 1000.0f;
+  latestSample.frequency = 49.5f + rng.below(10) / 10.0f;
+  latestSample.pf = rng.below(101) / 100.0f;
+  ui.runningScreen = (ui.runningScreen + 1) % UI_RUNNING_SCREENS;
+  showRunningScreen();
+  return ui.runningScreen;
+}
+
+// display.bitbang / display.dma: the same two text rows change per frame on each transport;
+// CPU time is what display() spends after the fence (Pcd8544::lastFlushUs()), so for DMA it
+// is the diff plus queueing the spans, for bit-banging the diff plus every clock edge
+struct PanelBench {
+  Pcd8544* panel;
+  uint32_t cpuUs;
+  uint32_t bytes;
+  uint32_t frames;
+};
+PanelBench bitBangBench = {NULL, 0, 0, 0};
+PanelBench dmaBench = {&display, 0, 0, 0};
+
+bool benchBitBangSetup(void* ctx) {
+  PanelBench& b = *(PanelBench*)ctx;
+  b.panel = new Pcd8544(BENCH_BITBANG_CLK, BENCH_BITBANG_DIN, BENCH_BITBANG_DC, BENCH_BITBANG_CE, -1);
+  b.cpuUs = b.bytes = b.frames = 0;
+  b.panel->begin();
+  b.panel->setTextColor(BLACK);
+  b.panel->clearDisplay();
+  return true;
+}
+
+void benchBitBangTeardown(void* ctx) {
+  PanelBench& b = *(PanelBench*)ctx;
+  delete b.panel;
+  b.panel = NULL;
+}
+
+bool benchDmaSetup(void* ctx) {
+  PanelBench& b = *(PanelBench*)ctx;
+  b.cpuUs = b.bytes = b.frames = 0;
+  display.clearDisplay();
+  return true;
+}
+
+void benchDmaTeardown(void*) {
+  display.clearDisplay();
+  if (ui.state == STATE_RUNNING) showRunningScreen();
+  else if (ui.state == STATE_READY) showReadyScreen();
+}
+
+uint32_t benchPanelFrame(void* ctx, BenchRng& rng) {
+  PanelBench& b = *(PanelBench*)ctx;
+  char text[PCD8544_TEXT_COLS + 1];
+  for (uint8_t k = 0; k < 2; k++) {
+    snprintf(text, sizeof(text), "P: %lu.%lu W", (unsigned long)rng.below(2400),
+             (unsigned long)rng.below(10));
+    b.panel->textRow((uint8_t)rng.below(PCD8544_TEXT_ROWS), text);
   }
+  uint32_t flushes = b.panel->flushes();
+  b.panel->display();
+  if (b.panel->flushes() == flushes) return 0;
+  b.cpuUs += b.panel->lastFlushUs();
+  b.bytes += b.panel->lastFlushBytes();
+  b.frames++;
+  return b.panel->lastFlushBytes();
+}
+
+void benchPanelInfo(void* ctx, char* out, size_t len) {
+  PanelBench& b = *(PanelBench*)ctx;
+  uint32_t frames = b.frames ? b.frames : 1;
+  snprintf(out, len, ",\"frames\":%lu,\"cpu_us_per_frame\":%lu,\"bytes_per_frame\":%lu",
+           (unsigned long)b.frames, (unsigned long)(b.cpuUs / frames), (unsigned long)(b.bytes / frames));
+}
+
+// submitToken() lookup in the live table (mapped from the token partition), half misses
+uint32_t benchTokenFlash(void*, BenchRng& rng) {
+  char digits[21];
+  if (rng.below(2)) {
+    rng.digits(digits, 20);
+  } else {
+    strcpy(digits, tokenSeeds[rng.below(sizeof(tokenSeeds) / sizeof(tokenSeeds[0]))].code);
+  }
+  int32_t index = -1;
+  float kwh = 0.0f;
+  TokenLookup r = tokenStore.find(digits, index, kwh);
+  return (uint32_t)r * 1000 + (uint32_t)(index + 1);
+}
+
+// A real EEPROM save (checkpoint slot rewritten with its own bytes, then commit).
+// Only with the journal: without it the metering task owns the EEPROM.
+bool benchEepromSetup(void*) {
+  return journal.ready();
 }
 
-void saveRemainingToEEPROM() {
-  EEPROM.put(EEPROM_ADDR_REMAINING_KWH, remaining_kwh);
-  EEPROM.commit();
+uint32_t benchEepromCommit(void*, BenchRng&) {
+  BillingCheckpoint cp;
+  eepromStore.get(EEPROM_ADDR_CHECKPOINT_A, cp);
+  eepromStore.put(EEPROM_ADDR_CHECKPOINT_A, cp);
+  return eepromStore.commit() ? 1 : 0;
 }
 
-void saveSessionPurchasedToEEPROM() {
-  EEPROM.put(EEPROM_ADDR_SESSION_PURCHASED, session_purchased_kwh);
-  EEPROM.commit();
+void registerBenchmarks() {
+  benchAddCore(bench);
+  bench.add("json.energy_data", benchEnergyDataJson, NULL, 500, benchEnergyDataJsonSetup, NULL,
+            benchEnergyDataJsonInfo);
+  bench.add("timestamp.format", benchTimestamp, NULL, 2000);
+  bench.add("display.running", benchRunningScreen, NULL, 200, benchRunningScreenSetup, benchRunningScreenTeardown);
+  bench.add("display.bitbang", benchPanelFrame, &bitBangBench, 200, benchBitBangSetup, benchBitBangTeardown,
+            benchPanelInfo);
+  bench.add("display.dma", benchPanelFrame, &dmaBench, 200, benchDmaSetup, benchDmaTeardown, benchPanelInfo);
+  bench.add("token.flash", benchTokenFlash, NULL, 2000);
+  bench.add("eeprom.commit", benchEepromCommit, NULL, 20, benchEepromSetup);
 }
 
-void savePzemSessionStartToEEPROM() {
-  EEPROM.put(EEPROM_ADDR_PZEM_SESSION_START, pzem_energy_at_session_start);
-  EEPROM.commit();
+void benchPrintLine(const char* line, void*) {
+  Serial.println(line);
 }
 
-void saveTokenToEEPROM() {
-  char buf[21] = {0};
-  currentToken.toCharArray(buf, sizeof(buf));
-  EEPROM.put(EEPROM_ADDR_TOKEN, buf);
-  EEPROM.commit();
+void runBenchmarks(const char* prefix) {
+  Serial.println("[BENCH] running (loop() is blocked until done)");
+  uint32_t t0 = millis();
+  uint8_t ran = bench.run(prefix, benchPrintLine, NULL);
+  Serial.print("[BENCH] "); Serial.print(ran); Serial.print(" cases in ");
+  Serial.print(millis() - t0); Serial.println(" ms");
 }
@@ -0,0 +1,250 @@
+/**
+ * metering_core.cpp - Metering, billing and persistence (see metering_core.h)
+ */
+#include "metering_core.h"
+#include <string.h>
+#include <math.h>
+
+MeteringCore::MeteringCore(HalMeter& meter, HalRelay& relay, PersistJournal& journal, HalStore& store)
+    : meter_(meter), relay_(relay), journal_(journal), store_(store),
+      lastEepromSaveMs_(0), eepromSeq_(0), eepromInA_(false) {
+  memset(&billing_, 0, sizeof(billing_));
+  lastGood_ = {0, NAN, NAN, NAN, NAN, 0, NAN, NAN, 0, 0};
+  ledger_.setMaxGapMs(PZEM_STALE_MS);
+}
+
+const char* MeteringCore::restore(uint32_t nowMs) {
+  const char* source = NULL;
+  if (journal_.ready() && journal_.hasState()) {
+    if (applyPersistState(journal_.state())) source = "journal";
+  } else {
+    PersistState saved;
+    if (loadCheckpoint(saved) || loadCheckpointV2(saved)) {
+      if (applyPersistState(saved)) source = "EEPROM checkpoint";
+    } else if (loadLegacy()) {
+      source = "EEPROM";
+    }
+    if (journal_.ready()) persist(nowMs, true);  // migrate into the journal
+  }
+
+  // Relay from restored energy: ON if we have remaining, OFF otherwise
+  if (ledger_.remainingUwh() > EXHAUSTED_UWH) {
+    billing_.relay_on = true;
+  } else {
+    ledger_.reset(0, 0, false);
+    billing_.relay_on = false;
+  }
+  relay_.set(billing_.relay_on);
+  lastEepromSaveMs_ = nowMs;
+  sync();
+  return source;
+}
+
+bool MeteringCore::poll(uint32_t nowMs) {
+  // Reply to the request sent one period ago is already sitting in the UART buffer
+  bool fresh = (meter_.collect(nowMs) == PZEM_OK);
+  meter_.request(nowMs);
+  if (fresh) lastGood_ = meter_.last();
+  return fresh;
+}
+
+void MeteringCore::apply(const BillingCommand& cmd, uint32_t nowMs) {
+  billing_.last_command_id = cmd.id;
+  // loop() checked the published window; this catches the same token queued twice
+  bool already = cmd.purchase != 0 && purchaseHistoryContains(billing_.purchases, cmd.purchase);
+  if (!already && cmd.crypto_seq != 0) already = !replayWindowAccept(billing_.replay, cmd.crypto_seq);
+  if (already) {
+    billing_.commands_rejected++;
+    billing_.last_rejected_id = cmd.id;
+    return;
+  }
+  if (cmd.purchase != 0) {
+    purchaseHistoryAdd(billing_.purchases, cmd.purchase);  // persisted with the credit below
+  }
+  if (cmd.top_up && ledger_.remainingUwh() > 0) {
+    // Top-up: keep existing baseline (consumed keeps accumulating)
+    ledger_.topUp(EnergyLedger::fromKwh(cmd.kwh));
+  } else {
+    // Fresh start or after exhaustion — reset baseline to current PZEM reading
+    bool haveReading = lastGood_.t_ms != 0 && !isnan(lastGood_.energy_kwh);
+    ledger_.reset(EnergyLedger::fromKwh(cmd.kwh), lastGood_.energy_wh, haveReading);
+  }
+  memcpy(billing_.token, cmd.token, sizeof(billing_.token));
+  billing_.token[20] = '\0';
+  billing_.relay_on = true;
+  billing_.exhausted = false;
+  billing_.commands_applied++;
+  persist(nowMs, true);  // ledger + token in one checkpoint
+  relay_.set(true);      // Power to load
+  lastEepromSaveMs_ = nowMs;
+}
+
+bool MeteringCore::settle(uint32_t nowMs, bool fresh, PzemReading& sample) {
+  bool publish = false;
+  if (fresh) {
+    if (billing_.relay_on) {
+      // Exact trapezoidal integration; gaps > PZEM_STALE_MS restart the series and are
+      // recovered from the PZEM's own energy register by reconcile()
+      ledger_.addSample(lastGood_.t_ms, lastGood_.power_dw);
+      ledger_.reconcile(lastGood_.energy_wh);
+
+      // Check energy exhausted -> cutoff power (relay OFF)
+      if (ledger_.remainingUwh() <= EXHAUSTED_UWH) {
+        relay_.set(false);  // Cutoff power
+        billing_.relay_on = false;
+        billing_.exhausted = true;
+        sync();
+        persist(nowMs, true);
+      }
+    }
+    sample = lastGood_;
+    publish = true;
+  } else if (nowMs - lastGood_.t_ms > PZEM_STALE_MS && !isnan(lastGood_.voltage)) {
+    // Sensor silent: publish an invalid sample once so the UI shows "--"
+    lastGood_.voltage = lastGood_.current = lastGood_.power = NAN;
+    lastGood_.energy_kwh = lastGood_.frequency = lastGood_.pf = NAN;
+    lastGood_.t_ms = nowMs;
+    sample = lastGood_;
+    publish = true;
+  }
+
+  // Persist consumption so it survives power loss (commits coalesced by the journal)
+  if (billing_.relay_on) persist(nowMs, false);
+
+  sync();
+  return publish;
+}
+
+// Refresh the kWh views in billing from the integer ledger
+void MeteringCore::sync() {
+  billing_.remaining_uwh = ledger_.remainingUwh();
+  billing_.remaining_kwh = EnergyLedger::toKwh(billing_.remaining_uwh);
+  billing_.session_purchased_kwh = EnergyLedger::toKwh(ledger_.purchasedUwh());
+  billing_.consumed_uwh = ledger_.consumedUwh();
+  billing_.consumed_kwh = EnergyLedger::toKwh(billing_.consumed_uwh);
+  billing_.pzem_energy_at_session_start = ledger_.baselineWh() / 1000.0f;
+  billing_.ledger_correction_uwh = (int32_t)ledger_.lastCorrectionUwh();
+  billing_.ledger_corrections = ledger_.corrections();
+}
+
+// ------ Persistence ------
+
+/**
+ * Stage the current ledger + token; the journal writes it at most once per
+ * PERSIST_COMMIT_INTERVAL_MS, or now when force (token applied, cutoff).
+ * Without a journal partition: EEPROM A/B checkpoint every EEPROM_SAVE_INTERVAL_MS.
+ */
+void MeteringCore::persist(uint32_t nowMs, bool force) {
+  if (journal_.ready()) {
+    journal_.stage(persistState());
+    journal_.service(nowMs, force);
+    return;
+  }
+  if (force || nowMs - lastEepromSaveMs_ >= EEPROM_SAVE_INTERVAL_MS) {
+    lastEepromSaveMs_ = nowMs;
+    saveCheckpoint();
+  }
+}
+
+PersistState MeteringCore::persistState() const {
+  PersistState s;
+  s.purchasedUwh = ledger_.purchasedUwh();
+  s.consumedUwh = ledger_.consumedUwh();
+  s.baselineWh = ledger_.baselineWh();
+  s.haveBaseline = ledger_.hasBaseline();
+  memcpy(s.token, billing_.token, sizeof(s.token));
+  s.replay = billing_.replay;
+  s.purchases = billing_.purchases;
+  return s;
+}
+
+// True when s carried a token
+bool MeteringCore::applyPersistState(const PersistState& s) {
+  billing_.replay = s.replay;
+  billing_.purchases = s.purchases;
+  if (s.purchasedUwh >= 0 && s.consumedUwh >= 0) {
+    ledger_.restore(s.purchasedUwh, s.consumedUwh, s.baselineWh, s.haveBaseline);
+  }
+  if (s.token[0] >= '0' && s.token[0] <= '9') {
+    memcpy(billing_.token, s.token, sizeof(billing_.token));
+    return true;
+  }
+  return false;
+}
+
+bool MeteringCore::loadCheckpoint(PersistState& out) {
+  BillingCheckpoint a, b;
+  PersistState sa, sb;
+  store_.get(EEPROM_ADDR_CHECKPOINT_A, a);
+  store_.get(EEPROM_ADDR_CHECKPOINT_B, b);
+  bool okA = checkpointUnpack(a, sa);
+  bool okB = checkpointUnpack(b, sb);
+  if (!okA && !okB) return false;
+  bool useA = okA && (!okB || checkpointNewer(a.seq, b.seq));
+  out = useA ? sa : sb;
+  eepromSeq_ = useA ? a.seq : b.seq;
+  eepromInA_ = useA;
+  return true;
+}
+
+// Slots of a firmware before checkpoint version 3; the new slots lie past them, so the
+// migration never overwrites the state it migrates from.
+bool MeteringCore::loadCheckpointV2(PersistState& out) {
+  BillingCheckpointV2 a, b;
+  PersistState sa, sb;
+  store_.get(EEPROM_ADDR_CHECKPOINT_V2_A, a);
+  store_.get(EEPROM_ADDR_CHECKPOINT_V2_B, b);
+  bool okA = checkpointUnpackV2(a, sa);
+  bool okB = checkpointUnpackV2(b, sb);
+  if (!okA && !okB) return false;
+  bool useA = okA && (!okB || checkpointNewer(a.seq, b.seq));
+  out = useA ? sa : sb;
+  eepromSeq_ = useA ? a.seq : b.seq;
+  eepromInA_ = false;  // first save -> A
+  return true;
+}
+
+// Whole state in one commit; the slot holding the newest checkpoint is never touched
+void MeteringCore::saveCheckpoint() {
+  BillingCheckpoint cp;
+  checkpointPack(persistState(), eepromSeq_ + 1, cp);
+  store_.put(eepromInA_ ? EEPROM_ADDR_CHECKPOINT_B : EEPROM_ADDR_CHECKPOINT_A, cp);
+  if (store_.commit()) {
+    eepromSeq_ = cp.seq;
+    eepromInA_ = !eepromInA_;
+  }
+}
+
+// Before checkpoints: separate ledger, float and token slots. True when a token was restored.
+bool MeteringCore::loadLegacy() {
+  uint32_t magic = 0;
+  store_.get(EEPROM_ADDR_LEDGER_MAGIC, magic);
+  if (magic == EEPROM_LEDGER_MAGIC) {
+    int64_t purchased = 0, consumed = 0;
+    uint32_t baseline = 0;
+    store_.get(EEPROM_ADDR_PURCHASED_UWH, purchased);
+    store_.get(EEPROM_ADDR_CONSUMED_UWH, consumed);
+    store_.get(EEPROM_ADDR_BASELINE_WH, baseline);
+    if (purchased >= 0 && consumed >= 0) ledger_.restore(purchased, consumed, baseline, true);
+  } else {
+    // First boot after upgrade: convert the legacy float slots
+    float r = 0.0f, s = 0.0f, p = 0.0f;
+    store_.get(EEPROM_ADDR_REMAINING_KWH, r);
+    store_.get(EEPROM_ADDR_SESSION_PURCHASED, s);
+    store_.get(EEPROM_ADDR_PZEM_SESSION_START, p);
+    if (isnan(r) || r < 0.0f) r = 0.0f;
+    if (isnan(s) || s < r) s = r;
+    bool haveBaseline = !isnan(p) && p >= 0.0f;
+    ledger_.restore(EnergyLedger::fromKwh(s), EnergyLedger::fromKwh(s) - EnergyLedger::fromKwh(r),
+                    haveBaseline ? (uint32_t)(p * 1000.0f + 0.5f) : 0, haveBaseline);
+  }
+  // Restore active token so API sends survive reboots
+  char savedToken[21] = {0};
+  store_.get(EEPROM_ADDR_TOKEN, savedToken);
+  savedToken[20] = '\0';
+  if (savedToken[0] >= '0' && savedToken[0] <= '9') {
+    memcpy(billing_.token, savedToken, sizeof(billing_.token));
+    return true;
+  }
+  return false;
+}
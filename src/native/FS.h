@@ -0,0 +1,80 @@
+/**
+ * FS.h - The Arduino-ESP32 fs::FS / fs::File API on a host directory (native build)
+ *
+ * TelemetryLog (telemetry_log.h) talks to LittleFS through <FS.h>. Natively the
+ * same calls go to stdio and dirent below a root directory, so the log runs
+ * unchanged against files a test can inspect, corrupt or truncate. As on the
+ * device, copies of a File share one open handle, name() is the base name and
+ * opening a directory gives a File that lists it with openNextFile().
+ *
+ * Test hooks: opens() counts files opened (each one allocates on the device),
+ * failWritesAfter(n) lets only n more bytes reach the files - a power cut in
+ * the middle of a write - until it is called again with -1.
+ */
+
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class FS;
+
+class File {
+ public:
+  File() {}
+
+  size_t write(const uint8_t* buf, size_t len);
+  size_t read(uint8_t* buf, size_t len);
+  bool seek(uint32_t pos, SeekMode mode = SeekSet);
+  size_t position() const;
+  size_t size() const;
+  void flush();
+  void close() { h_.reset(); }
+  const char* name() const;
+  bool isDirectory() const;
+  File openNextFile();
+  operator bool() const { return h_ != nullptr; }
+
+ private:
+  friend class FS;
+  struct Handle;
+  std::shared_ptr<Handle> h_;
+};
+
+class FS {
+ public:
+  // root: host directory that stands for the mount point
+  explicit FS(const char* root);
+
+  File open(const char* path, const char* mode = FILE_READ);
+  bool exists(const char* path);
+  bool remove(const char* path);
+  bool mkdir(const char* path);
+
+  uint32_t opens() const { return opens_; }
+  void failWritesAfter(long bytes) { writeBudget_ = bytes; }
+
+ private:
+  friend class File;
+  void hostPath(const char* path, char* out, size_t len) const;
+
+  char root_[128];
+  uint32_t opens_;
+  long writeBudget_;  // bytes that still reach the files, -1 = no limit
+};
+
+}  // namespace fs
+
+using fs::File;
+
+#endif // HOST_FS_H
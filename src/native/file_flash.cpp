@@ -0,0 +1,106 @@
+/**
+ * file_flash.cpp - File-backed flash partition and EEPROM (see file_flash.h)
+ */
+#include "file_flash.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Read what the file has into image (pre-filled with fill), true when the file existed
+static bool loadImage(const char* path, uint8_t* image, uint32_t size, uint8_t fill) {
+  memset(image, fill, size);
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) return false;
+  size_t n = fread(image, 1, size, f);
+  (void)n;  // a short file keeps the fill
+  fclose(f);
+  return true;
+}
+
+// ------ FileFlash ------
+FileFlash::FileFlash() : file_(NULL), image_(NULL), size_(0), bytesWritten_(0), sectorErases_(0) {}
+
+FileFlash::~FileFlash() {
+  if (file_ != NULL) fclose(file_);
+  free(image_);
+}
+
+bool FileFlash::open(const char* path, uint32_t size) {
+  if (size == 0 || size % FILE_FLASH_SECTOR != 0) return false;
+  image_ = (uint8_t*)malloc(size);
+  if (image_ == NULL) return false;
+  size_ = size;
+  bool existed = loadImage(path, image_, size, 0xFF);
+  file_ = fopen(path, existed ? "rb+" : "wb+");
+  return file_ != NULL && sync(0, size);  // pads a short or new file to the full size
+}
+
+bool FileFlash::sync(uint32_t offset, size_t len) {
+  if (fseek(file_, offset, SEEK_SET) != 0 || fwrite(image_ + offset, 1, len, file_) != len) return false;
+  return fflush(file_) == 0;
+}
+
+bool FileFlash::read(uint32_t offset, void* buf, size_t len) {
+  if (!inRange(offset, len)) return false;
+  memcpy(buf, image_ + offset, len);
+  return true;
+}
+
+bool FileFlash::write(uint32_t offset, const void* buf, size_t len) {
+  if (!inRange(offset, len)) return false;
+  const uint8_t* src = (const uint8_t*)buf;
+  for (size_t i = 0; i < len; i++) image_[offset + i] &= src[i];
+  bytesWritten_ += len;
+  return sync(offset, len);
+}
+
+bool FileFlash::erase(uint32_t offset, size_t len) {
+  if (!inRange(offset, len) || offset % FILE_FLASH_SECTOR != 0 || len % FILE_FLASH_SECTOR != 0) return false;
+  memset(image_ + offset, 0xFF, len);
+  sectorErases_ += len / FILE_FLASH_SECTOR;
+  return sync(offset, len);
+}
+
+const void* FileFlash::map(uint32_t offset, size_t len) {
+  return inRange(offset, len) ? image_ + offset : NULL;
+}
+
+// ------ FileStore ------
+FileStore::FileStore() : image_(NULL), size_(0), commits_(0) {
+  path_[0] = '\0';
+}
+
+FileStore::~FileStore() {
+  free(image_);
+}
+
+bool FileStore::open(const char* path, uint32_t size) {
+  if (strlen(path) >= sizeof(path_)) return false;
+  strcpy(path_, path);
+  image_ = (uint8_t*)malloc(size);
+  if (image_ == NULL) return false;
+  size_ = size;
+  loadImage(path, image_, size, 0xFF);  // erased EEPROM sector
+  return true;
+}
+
+void FileStore::read(uint32_t addr, void* buf, size_t len) {
+  if (addr > size_ || len > size_ - addr) {
+    memset(buf, 0xFF, len);
+    return;
+  }
+  memcpy(buf, image_ + addr, len);
+}
+
+void FileStore::write(uint32_t addr, const void* buf, size_t len) {
+  if (addr > size_ || len > size_ - addr) return;
+  memcpy(image_ + addr, buf, len);
+}
+
+bool FileStore::commit() {
+  FILE* f = fopen(path_, "wb");
+  if (f == NULL) return false;
+  bool ok = fwrite(image_, 1, size_, f) == size_;
+  ok = fclose(f) == 0 && ok;
+  if (ok) commits_++;
+  return ok;
+}
@@ -0,0 +1,71 @@
+/**
+ * file_flash.h - File-backed flash partition and EEPROM for the native build
+ *
+ * FileFlash keeps the partition image in RAM and writes every change through
+ * to its file, so a run can be killed at any point and restarted on the same
+ * state, like a power cut. NOR rules apply: erase sets 0xFF, write can only
+ * clear bits (a write over programmed bytes ANDs, as on the chip). map() hands
+ * out the RAM image.
+ *
+ * FileStore is the EEPROM emulation: writes stay in RAM until commit(), which
+ * rewrites the whole file.
+ */
+
+#ifndef FILE_FLASH_H
+#define FILE_FLASH_H
+
+#include <stdio.h>
+#include "hal.h"
+
+#define FILE_FLASH_SECTOR  4096
+
+class FileFlash : public HalFlash {
+ public:
+  FileFlash();
+  ~FileFlash();
+
+  // Open (or create, erased) the image at path; a shorter file is padded with 0xFF
+  bool open(const char* path, uint32_t size);
+
+  uint32_t size() const override { return size_; }
+  bool read(uint32_t offset, void* buf, size_t len) override;
+  bool write(uint32_t offset, const void* buf, size_t len) override;
+  bool erase(uint32_t offset, size_t len) override;
+  const void* map(uint32_t offset, size_t len) override;
+  void unmap(const void* /*ptr*/) override {}
+
+  uint32_t bytesWritten() const { return bytesWritten_; }
+  uint32_t sectorErases() const { return sectorErases_; }
+
+ private:
+  bool inRange(uint32_t offset, size_t len) const { return offset <= size_ && len <= size_ - offset; }
+  bool sync(uint32_t offset, size_t len);
+
+  FILE* file_;
+  uint8_t* image_;
+  uint32_t size_;
+  uint32_t bytesWritten_;
+  uint32_t sectorErases_;
+};
+
+class FileStore : public HalStore {
+ public:
+  FileStore();
+  ~FileStore();
+
+  bool open(const char* path, uint32_t size);
+
+  void read(uint32_t addr, void* buf, size_t len) override;
+  void write(uint32_t addr, const void* buf, size_t len) override;
+  bool commit() override;
+
+  uint32_t commits() const { return commits_; }
+
+ private:
+  char path_[256];
+  uint8_t* image_;
+  uint32_t size_;
+  uint32_t commits_;
+};
+
+#endif // FILE_FLASH_H
@@ -0,0 +1,146 @@
+/**
+ * host_fs.cpp - fs::FS on a host directory (see FS.h)
+ */
+#include "FS.h"
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+struct fs::File::Handle {
+  FS* fs;
+  FILE* file;
+  DIR* dir;
+  char path[320];  // host path
+  ~Handle() {
+    if (file) fclose(file);
+    if (dir) closedir(dir);
+  }
+};
+
+// ------ File ------
+
+size_t fs::File::write(const uint8_t* buf, size_t len) {
+  if (!h_ || !h_->file) return 0;
+  long& budget = h_->fs->writeBudget_;
+  if (budget >= 0 && (long)len > budget) len = (size_t)budget;  // power cut: the rest never lands
+  size_t n = fwrite(buf, 1, len, h_->file);
+  if (budget >= 0) budget -= (long)n;
+  return n;
+}
+
+size_t fs::File::read(uint8_t* buf, size_t len) {
+  return h_ && h_->file ? fread(buf, 1, len, h_->file) : 0;
+}
+
+bool fs::File::seek(uint32_t pos, SeekMode mode) {
+  static const int whence[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+  return h_ && h_->file && fseek(h_->file, (long)pos, whence[mode]) == 0;
+}
+
+size_t fs::File::position() const {
+  return h_ && h_->file ? (size_t)ftell(h_->file) : 0;
+}
+
+size_t fs::File::size() const {
+  if (!h_ || !h_->file) return 0;
+  fflush(h_->file);
+  struct stat st;
+  return fstat(fileno(h_->file), &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+void fs::File::flush() {
+  if (h_ && h_->file) fflush(h_->file);
+}
+
+const char* fs::File::name() const {
+  if (!h_) return "";
+  const char* slash = strrchr(h_->path, '/');
+  return slash ? slash + 1 : h_->path;
+}
+
+bool fs::File::isDirectory() const {
+  return h_ && h_->dir;
+}
+
+File fs::File::openNextFile() {
+  File next;
+  if (!h_ || !h_->dir) return next;
+  for (struct dirent* e = readdir(h_->dir); e != NULL; e = readdir(h_->dir)) {
+    if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+    next.h_ = std::make_shared<Handle>();
+    Handle& h = *next.h_;
+    h.fs = h_->fs;
+    h.file = NULL;
+    h.dir = NULL;
+    int n = snprintf(h.path, sizeof(h.path), "%s/%s", h_->path, e->d_name);
+    if (n < 0 || (size_t)n >= sizeof(h.path)) {
+      next.h_.reset();  // too long to open here
+      continue;
+    }
+    struct stat st;
+    if (stat(h.path, &st) == 0 && S_ISDIR(st.st_mode)) {
+      h.dir = opendir(h.path);
+    } else {
+      h.file = fopen(h.path, "rb");
+      h_->fs->opens_++;
+    }
+    if (h.file == NULL && h.dir == NULL) next.h_.reset();
+    break;
+  }
+  return next;
+}
+
+// ------ FS ------
+
+fs::FS::FS(const char* root) : opens_(0), writeBudget_(-1) {
+  snprintf(root_, sizeof(root_), "%s", root);
+}
+
+void fs::FS::hostPath(const char* path, char* out, size_t len) const {
+  snprintf(out, len, "%s%s%s", root_, path[0] == '/' ? "" : "/", path);
+}
+
+File fs::FS::open(const char* path, const char* mode) {
+  File f;
+  f.h_ = std::make_shared<File::Handle>();
+  File::Handle& h = *f.h_;
+  h.fs = this;
+  h.file = NULL;
+  h.dir = NULL;
+  hostPath(path, h.path, sizeof(h.path));
+  size_t n = strlen(h.path);
+  if (n > 1 && h.path[n - 1] == '/') h.path[n - 1] = '\0';
+
+  struct stat st;
+  if (stat(h.path, &st) == 0 && S_ISDIR(st.st_mode)) {
+    h.dir = opendir(h.path);
+  } else {
+    char m[4];
+    snprintf(m, sizeof(m), "%sb", mode);
+    h.file = fopen(h.path, m);
+    opens_++;
+  }
+  if (h.file == NULL && h.dir == NULL) f.h_.reset();
+  return f;
+}
+
+bool fs::FS::exists(const char* path) {
+  char p[320];
+  hostPath(path, p, sizeof(p));
+  struct stat st;
+  return stat(p, &st) == 0;
+}
+
+bool fs::FS::remove(const char* path) {
+  char p[320];
+  hostPath(path, p, sizeof(p));
+  return unlink(p) == 0;
+}
+
+bool fs::FS::mkdir(const char* path) {
+  char p[320];
+  hostPath(path, p, sizeof(p));
+  return ::mkdir(p, 0755) == 0;
+}
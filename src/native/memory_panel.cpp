@@ -0,0 +1,36 @@
+/**
+ * memory_panel.cpp - In-memory text panel (see memory_panel.h)
+ */
+#include "memory_panel.h"
+#include <string.h>
+
+MemoryPanel::MemoryPanel() : dirty_(false), echo_(NULL), flushes_(0), rowWrites_(0) {
+  memset(rows_, 0, sizeof(rows_));
+}
+
+void MemoryPanel::textRow(uint8_t row, const char* text) {
+  if (row >= PANEL_ROWS) return;
+  char cell[PANEL_COLS + 1];
+  strncpy(cell, text, PANEL_COLS);
+  cell[PANEL_COLS] = '\0';
+  if (strcmp(cell, rows_[row]) == 0) return;
+  memcpy(rows_[row], cell, sizeof(cell));
+  dirty_ = true;
+  rowWrites_++;
+}
+
+void MemoryPanel::clear() {
+  for (uint8_t r = 0; r < PANEL_ROWS; r++) textRow(r, "");
+}
+
+void MemoryPanel::display() {
+  if (!dirty_) return;
+  dirty_ = false;
+  flushes_++;
+  if (echo_ == NULL) return;
+  uint32_t s = halMillis() / 1000;
+  fprintf(echo_, "+--------------+ %02u:%02u:%02u\n", (unsigned)(s / 3600), (unsigned)(s / 60 % 60),
+          (unsigned)(s % 60));
+  for (uint8_t r = 0; r < PANEL_ROWS; r++) fprintf(echo_, "|%-14s|\n", rows_[r]);
+  fprintf(echo_, "+--------------+\n");
+}
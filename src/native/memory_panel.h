@@ -0,0 +1,39 @@
+/**
+ * memory_panel.h - In-memory text panel for the native build
+ *
+ * Same geometry as the PCD8544 text rows (6 x 14). display() counts a flush
+ * only when a row changed since the last one and, when echo is on, prints the
+ * frame with the virtual time so a run can be read like the LCD.
+ */
+
+#ifndef MEMORY_PANEL_H
+#define MEMORY_PANEL_H
+
+#include <stdio.h>
+#include "hal.h"
+
+#define PANEL_ROWS  6
+#define PANEL_COLS  14
+
+class MemoryPanel : public HalPanel {
+ public:
+  MemoryPanel();
+
+  void textRow(uint8_t row, const char* text) override;
+  void display() override;
+  void clear();
+
+  void setEcho(FILE* out) { echo_ = out; }
+  const char* row(uint8_t r) const { return r < PANEL_ROWS ? rows_[r] : ""; }
+  uint32_t flushes() const { return flushes_; }
+  uint32_t rowWrites() const { return rowWrites_; }
+
+ private:
+  char rows_[PANEL_ROWS][PANEL_COLS + 1];
+  bool dirty_;
+  FILE* echo_;
+  uint32_t flushes_;
+  uint32_t rowWrites_;
+};
+
+#endif // MEMORY_PANEL_H
@@ -0,0 +1,71 @@
+/**
+ * script_keys.cpp - Scripted keypad (see script_keys.h)
+ */
+#include "script_keys.h"
+#include "keypad_ui.h"
+#include <stdlib.h>
+#include <ctype.h>
+
+ScriptKeys::ScriptKeys() : count_(0), pos_(0), lastScan_(0), head_(0), tail_(0) {}
+
+static int keyIndex(char c) {
+  for (uint8_t i = 0; i < 16; i++) {
+    if (KeypadUi::keyFor(i) == toupper((unsigned char)c)) return i;
+  }
+  return -1;
+}
+
+bool ScriptKeys::load(const char* script, uint32_t startMs) {
+  uint32_t cursor = startMs;
+  lastScan_ = startMs;
+  const char* p = script;
+  while (*p) {
+    while (isspace((unsigned char)*p)) p++;
+    if (!*p) break;
+    if (*p == '@' || *p == '+') {
+      char* end;
+      double sec = strtod(p + 1, &end);
+      if (end == p + 1) return false;
+      uint32_t ms = (uint32_t)(sec * 1000.0 + 0.5);
+      cursor = *p == '@' ? startMs + ms : cursor + ms;
+      p = end;
+      continue;
+    }
+    while (*p && !isspace((unsigned char)*p)) {
+      int idx = keyIndex(*p++);
+      if (idx < 0 || count_ >= SCRIPT_MAX_KEYS) return false;
+      downAt_[count_] = cursor;
+      index_[count_] = (uint8_t)idx;
+      count_++;
+      cursor += SCRIPT_KEY_HOLD_MS + SCRIPT_KEY_GAP_MS;
+    }
+  }
+  return true;
+}
+
+uint8_t ScriptKeys::rawAt(uint32_t tMs) {
+  while (pos_ < count_ && tMs >= downAt_[pos_] + SCRIPT_KEY_HOLD_MS) pos_++;
+  if (pos_ < count_ && tMs >= downAt_[pos_]) return index_[pos_];
+  return KEYPAD_NO_KEY;
+}
+
+// Scan the way the keypad task does, catching up on the virtual time since the last call
+void ScriptKeys::scanUntil(uint32_t nowMs) {
+  while ((int32_t)(nowMs - lastScan_) >= SCRIPT_SCAN_MS) {
+    lastScan_ += SCRIPT_SCAN_MS;
+    uint8_t pressed = debouncer_.update(rawAt(lastScan_), lastScan_);
+    if (pressed != KEYPAD_NO_KEY && (uint8_t)(head_ - tail_) < SCRIPT_QUEUE) {
+      queue_[head_ % SCRIPT_QUEUE].index = pressed;
+      queue_[head_ % SCRIPT_QUEUE].atMs = lastScan_;
+      head_++;
+    }
+  }
+}
+
+bool ScriptKeys::next(KeyEvent& out) {
+  scanUntil(halMillis());
+  if (head_ == tail_) return false;
+  out = queue_[tail_ % SCRIPT_QUEUE];
+  tail_++;
+  return true;
+}
@@ -0,0 +1,53 @@
+/**
+ * script_keys.h - Scripted keypad for the native build
+ *
+ * Script: whitespace-separated words. "@<seconds>" moves the cursor to that
+ * virtual time, "+<seconds>" forward by that much; any other word is typed one
+ * key after another from the cursor, each held SCRIPT_KEY_HOLD_MS with
+ * SCRIPT_KEY_GAP_MS between keys. Example: "@2 A18886583547834136861 +30 C".
+ *
+ * The key-down intervals are turned into raw scans every KEYPAD_SCAN_MS and
+ * go through the same KeyDebouncer as the PCF8574 driver.
+ */
+
+#ifndef SCRIPT_KEYS_H
+#define SCRIPT_KEYS_H
+
+#include "hal.h"
+
+#define SCRIPT_KEY_HOLD_MS  80
+#define SCRIPT_KEY_GAP_MS   120
+#define SCRIPT_SCAN_MS      5
+#define SCRIPT_MAX_KEYS     256
+#define SCRIPT_QUEUE        32
+
+class ScriptKeys : public HalKeys {
+ public:
+  ScriptKeys();
+
+  // Parse the script, times relative to startMs. False on an unknown key or a full script.
+  bool load(const char* script, uint32_t startMs);
+
+  bool next(KeyEvent& out) override;
+
+  // Every scripted key has been pressed and released
+  bool done() const { return pos_ >= count_ && debouncer_.idle(); }
+  // Virtual time of the last key release (end of the script)
+  uint32_t endMs() const { return count_ ? downAt_[count_ - 1] + SCRIPT_KEY_HOLD_MS : 0; }
+
+ private:
+  void scanUntil(uint32_t nowMs);
+  uint8_t rawAt(uint32_t tMs);
+
+  uint32_t downAt_[SCRIPT_MAX_KEYS];
+  uint8_t index_[SCRIPT_MAX_KEYS];
+  uint16_t count_;
+  uint16_t pos_;        // first key not released yet at the last scan
+  uint32_t lastScan_;
+  KeyDebouncer debouncer_;
+  KeyEvent queue_[SCRIPT_QUEUE];
+  uint8_t head_;
+  uint8_t tail_;
+};
+
+#endif // SCRIPT_KEYS_H
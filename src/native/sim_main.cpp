@@ -0,0 +1,578 @@
+/**
+ * sim_main.cpp - The meter on Linux: `pio run -e native` builds it, then
+ *
+ *   .pio/build/native/program [--rate N] [--hours H] [--load W] [--swing W] [--pf PF]
+ *                             [--keys SCRIPT] [--outage-every S --outage S]
+ *                             [--state DIR] [--no-journal] [--echo] [--check-alloc]
+ *   .pio/build/native/program --bench all|PREFIX
+ *
+ * runs the portable firmware core - MeteringCore (ledger, relay cutoff, journal
+ * or EEPROM persistence), TokenStore, crypto tokens, KeypadUi and the loop()
+ * scheduler - against the native HAL backends: a simulated PZEM load
+ * (sim_meter.h), an in-memory panel (memory_panel.h), scripted keys
+ * (script_keys.h) and file-backed flash and EEPROM under --state
+ * (file_flash.h), on a virtual clock running --rate times real time
+ * (virtual_clock.h; 0 = jump from one due task to the next).
+ *
+ * The state directory survives the run like the device's flash survives a
+ * power cut: a second run restores the ledger and token from it, and the
+ * simulated PZEM keeps its energy register there (the real one keeps counting
+ * through a reboot), so the ledger reconciles the energy used after the last
+ * journal commit. --no-journal runs on the EEPROM A/B checkpoints instead. With
+ * no --keys and no credit restored, the first seed token is typed at 2 s.
+ *
+ * No WiFi/HTTP/NTP here: tokens unknown to the offline table are rejected as on
+ * a device without network, and the screens are text rows rather than the
+ * device's GFX layouts.
+ *
+ * --check-alloc arms the allocation counter (alloc_counter.h) once setup is done
+ * and exits 1 if the running simulation allocated anything: the core must not
+ * touch the heap in steady state, whatever keys, outages and tokens it goes through.
+ *
+ * --bench runs the fixed-seed micro benchmarks (bench.h) instead of the
+ * simulation and prints one JSON line per case: the core cases plus the text-row
+ * running screen here. Host numbers only compare with host numbers; the device
+ * runs the same cases with "bench" on its serial console.
+ *
+ * `pio test -e native` builds the same sources without this file: the suites
+ * under test/ bring their own main().
+ */
+#ifndef PIO_UNIT_TESTING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "config.h"
+#include "hal.h"
+#include "metering_core.h"
+#include "persist_journal.h"
+#include "token_store.h"
+#include "crypto_token.h"
+#include "keypad_ui.h"
+#include "scheduler.h"
+#include "latency_histogram.h"
+#include "bench.h"
+#include "alloc_counter.h"
+#include "virtual_clock.h"
+#include "sim_meter.h"
+#include "memory_panel.h"
+#include "script_keys.h"
+#include "file_flash.h"
+
+#define SIM_JOURNAL_SIZE  0x8000    // partitions.csv
+#define SIM_TOKENS_SIZE   0x10000
+#define SIM_REPORT_MS     600000    // status line every 10 virtual minutes
+
+// Same seeds as the device (main.cpp)
+static const TokenSeed tokenSeeds[] = {
+  {"18886583547834136861", 5.0},
+  {"12345678901234567890", 10.0},
+  {"98765432109876543210", 25.0}
+};
+
+// Relay: switches the simulated load's supply
+class SimRelay : public HalRelay {
+ public:
+  explicit SimRelay(SimMeter& meter) : meter_(meter), switches_(0) {}
+  void set(bool on) override {
+    meter_.setSupply(on, halMillis());
+    switches_++;
+  }
+  uint32_t switches() const { return switches_; }
+
+ private:
+  SimMeter& meter_;
+  uint32_t switches_;
+};
+
+static const SimLoad DEFAULT_LOAD = {800.0f, 300.0f, 3600000, 0.95f, 0, 0};
+
+static SimMeter* meter;
+static SimRelay* relay;
+static FileFlash journalFlash;
+static FileFlash tokenFlash;
+static FileStore eeprom;
+static PersistJournal journal;
+static MeteringCore* metering;
+static TokenStore tokenStore;
+static uint8_t tokenKey[CRYPTO_TOKEN_KEY_BYTES];
+static bool tokenKeyValid = false;
+
+static KeypadUi ui;
+static MemoryPanel panel;
+static ScriptKeys keys;
+static Scheduler scheduler(halMillis, halMicros);
+static LatencyHistogram loopLatency;
+static uint8_t tInfoTimeout = SCHED_NONE;
+static uint8_t tBadTokenTimeout = SCHED_NONE;
+static char lastTokenEntered[21] = "";
+static char badReason[PANEL_COLS + 1] = "";
+static PzemReading latest;
+static uint32_t samples = 0;
+static uint32_t tokensApplied = 0;
+static uint32_t commandId = 0;
+
+// ------ Token entry (offline path of the device's submitToken()) ------
+static void showBadToken(const char* reason) {
+  strncpy(badReason, reason, PANEL_COLS);
+  ui.state = STATE_BADTOKEN;
+  scheduler.start(tBadTokenTimeout, 2000);
+}
+
+static void submitToken() {
+  float kwh = 0.0f;
+  int32_t index = -1;
+  TokenLookup lookup = tokenStore.find(ui.input, index, kwh);
+  bool found = lookup == TOKEN_VALID;
+  bool topUp = false;
+  uint16_t cryptoSeq = 0;
+  CryptoToken crypto;
+  CryptoTokenResult decoded = found || lookup == TOKEN_USED || !tokenKeyValid
+                                  ? CRYPTO_TOKEN_NOT_CRYPTO
+                                  : cryptoTokenDecode(tokenKey, METER_NUMBER, ui.input, crypto);
+  if (decoded == CRYPTO_TOKEN_OK && replayWindowAllows(metering->billing().replay, crypto.seq)) {
+    found = true;
+    kwh = crypto.deciKwh / 10.0f;
+    cryptoSeq = crypto.seq;
+    topUp = metering->billing().remaining_kwh > 0;
+  }
+  if (!found) {
+    showBadToken(lookup == TOKEN_USED || decoded == CRYPTO_TOKEN_OK ? "Already used"
+                 : decoded == CRYPTO_TOKEN_BAD_FIELDS          ? "Invalid"
+                                                               : "No network");
+    printf("[%8.1f s] token %s rejected (%s)\n", halMillis() / 1000.0, ui.input, badReason);
+    ui.clearInput();
+    return;
+  }
+
+  // Used bit first, as on the device: a failure here costs the token, never a double credit
+  if (cryptoSeq == 0 && !tokenStore.markUsed(index)) {
+    showBadToken("Try again");
+    printf("[%8.1f s] token %s rejected (%s)\n", halMillis() / 1000.0, ui.input, badReason);
+    ui.clearInput();
+    return;
+  }
+  BillingCommand cmd = {};
+  cmd.id = ++commandId;
+  cmd.kwh = kwh;
+  cmd.top_up = topUp;
+  cmd.crypto_seq = cryptoSeq;
+  memcpy(cmd.token, ui.input, sizeof(cmd.token));
+  metering->apply(cmd, halMillis());
+  if (metering->billing().last_rejected_id == cmd.id) {
+    showBadToken("Already used");
+    printf("[%8.1f s] token %s rejected (%s)\n", halMillis() / 1000.0, ui.input, badReason);
+    ui.clearInput();
+    return;
+  }
+  memcpy(lastTokenEntered, ui.input, sizeof(lastTokenEntered));
+  tokensApplied++;
+  printf("[%8.1f s] token %s applied: %.1f kWh%s, lookup %u us\n", halMillis() / 1000.0, ui.input, kwh,
+         topUp ? " (top-up)" : "", (unsigned)tokenStore.lastLookupUs());
+  ui.state = STATE_RUNNING;
+  ui.clearInput();
+}
+
+static void handleKey(char k) {
+  switch (ui.key(k)) {
+    case UI_SUBMIT:
+      submitToken();
+      break;
+    case UI_SHOW_INFO:
+      scheduler.start(tInfoTimeout, 5000);
+      break;
+    case UI_LEAVE_INFO:
+      scheduler.stop(tInfoTimeout);
+      ui.state = metering->billing().relay_on ? STATE_RUNNING : STATE_READY;
+      break;
+    default:
+      break;  // the display task draws the new state
+  }
+}
+
+// ------ Screens (text rows) ------
+static void rowf(uint8_t row, const char* fmt, double v) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), fmt, v);
+  panel.textRow(row, buf);
+}
+
+static void renderRunning() {
+  const BillingState& b = metering->billing();
+  bool valid = latest.t_ms != 0 && latest.voltage == latest.voltage;
+  panel.textRow(0, "-- RUNNING --");
+  switch (ui.runningScreen) {
+    case 0:
+      rowf(1, "Rem %.3fkWh", b.remaining_kwh);
+      rowf(2, "Use %.3fkWh", b.consumed_kwh);
+      panel.textRow(3, "");
+      break;
+    case 1:
+      if (valid) rowf(1, "V %.1f", latest.voltage); else panel.textRow(1, "V --");
+      if (valid) rowf(2, "I %.3f A", latest.current); else panel.textRow(2, "I --");
+      panel.textRow(3, "");
+      break;
+    case 2:
+      if (valid) rowf(1, "P %.1f W", latest.power); else panel.textRow(1, "P --");
+      if (valid) rowf(2, "E %.3fkWh", latest.energy_kwh); else panel.textRow(2, "E --");
+      panel.textRow(3, "");
+      break;
+    case 3:
+      if (valid) rowf(1, "F %.1f Hz", latest.frequency); else panel.textRow(1, "F --");
+      if (valid) rowf(2, "PF %.2f", latest.pf); else panel.textRow(2, "PF --");
+      panel.textRow(3, "");
+      break;
+    default: {
+      char buf[16];
+      uint32_t s = halMillis() / 1000;
+      snprintf(buf, sizeof(buf), "Up %02u:%02u:%02u", (unsigned)(s / 3600), (unsigned)(s / 60 % 60),
+               (unsigned)(s % 60));
+      panel.textRow(1, buf);
+      panel.textRow(2, "");
+      panel.textRow(3, "");
+      break;
+    }
+  }
+  panel.textRow(4, "");
+  panel.textRow(5, "*=Next #=Prev");
+}
+
+static void render() {
+  char buf[24];
+  switch (ui.state) {
+    case STATE_READY:
+      panel.textRow(0, "-- READY --");
+      panel.textRow(1, "Meter:");
+      panel.textRow(2, METER_NUMBER);
+      panel.textRow(3, "A=Token");
+      panel.textRow(4, "C=Energy");
+      panel.textRow(5, "B=Prev #=No");
+      break;
+    case STATE_ENTERING:
+      panel.textRow(0, "ENTER TOKEN");
+      for (uint8_t r = 0; r < 4; r++) {
+        // 20 digits as five groups of four, two groups per row
+        uint8_t from = r * 8;
+        buf[0] = '\0';
+        if (from < ui.inputLen) {
+          snprintf(buf, sizeof(buf), "%.4s %.4s", ui.input + from,
+                   from + 4 < ui.inputLen ? ui.input + from + 4 : "");
+        }
+        panel.textRow(r + 1, r < 3 ? buf : "");
+      }
+      panel.textRow(5, "D=Del A=Cancel");
+      break;
+    case STATE_RUNNING:
+      renderRunning();
+      break;
+    case STATE_EXHAUSTED:
+      panel.textRow(0, "-- EMPTY --");
+      panel.textRow(1, "Energy used up");
+      panel.textRow(2, "Relay OFF");
+      panel.textRow(3, "");
+      panel.textRow(4, "");
+      panel.textRow(5, "A=New token");
+      break;
+    case STATE_BADTOKEN:
+      panel.textRow(0, "BAD TOKEN!");
+      panel.textRow(1, badReason);
+      for (uint8_t r = 2; r < PANEL_ROWS; r++) panel.textRow(r, "");
+      break;
+    case STATE_INFO_SCREEN:
+      if (ui.infoScreen == UI_INFO_ENERGY) {
+        panel.textRow(0, "ENERGY");
+        rowf(1, "Rem %.3fkWh", metering->billing().remaining_kwh);
+        rowf(2, "Use %.3fkWh", metering->billing().consumed_kwh);
+        rowf(3, "Buy %.3fkWh", metering->billing().session_purchased_kwh);
+      } else if (ui.infoScreen == UI_INFO_PREVIOUS_TOKEN) {
+        panel.textRow(0, "PREV TOKEN");
+        snprintf(buf, sizeof(buf), "%.10s", lastTokenEntered);
+        panel.textRow(1, buf);
+        panel.textRow(2, lastTokenEntered[0] ? lastTokenEntered + 10 : "(none)");
+        panel.textRow(3, "");
+      } else {
+        panel.textRow(0, "METER NO");
+        panel.textRow(1, METER_NUMBER);
+        panel.textRow(2, "");
+        panel.textRow(3, "");
+      }
+      panel.textRow(4, "");
+      panel.textRow(5, "Any key=back");
+      break;
+    default:
+      break;
+  }
+  panel.display();
+}
+
+// ------ Scheduler tasks ------
+static SchedResult taskMetering(void*) {
+  uint32_t now = halMillis();
+  bool fresh = metering->poll(now);
+  PzemReading sample;
+  if (metering->settle(now, fresh, sample)) {
+    latest = sample;
+    samples++;
+  }
+  if (metering->billing().exhausted && ui.state == STATE_RUNNING) {
+    ui.state = STATE_EXHAUSTED;
+    printf("[%8.1f s] credit exhausted, relay off\n", now / 1000.0);
+  }
+  return SCHED_DONE;
+}
+
+static SchedResult taskKeypad(void*) {
+  KeyEvent ev;
+  while (keys.next(ev)) handleKey(KeypadUi::keyFor(ev.index));
+  return SCHED_DONE;
+}
+
+static SchedResult taskScreenSwap(void*) {
+  if (ui.state == STATE_RUNNING) ui.runningScreen = (ui.runningScreen + 1) % UI_RUNNING_SCREENS;
+  return SCHED_DONE;
+}
+
+static SchedResult taskDisplay(void*) {
+  render();
+  return SCHED_DONE;
+}
+
+static SchedResult taskInfoTimeout(void*) {
+  if (ui.state == STATE_INFO_SCREEN) handleKey('A');  // any key leaves
+  return SCHED_DONE;
+}
+
+static SchedResult taskBadTokenTimeout(void*) {
+  if (ui.state == STATE_BADTOKEN) ui.state = STATE_READY;
+  return SCHED_DONE;
+}
+
+static SchedResult taskReport(void*) {
+  const BillingState& b = metering->billing();
+  printf("[%8.1f s] P %7.1f W  register %8.3f kWh  remaining %7.3f kWh  consumed %7.3f kWh  relay %s\n",
+         halMillis() / 1000.0, latest.power, meter->energyWh() / 1000.0, b.remaining_kwh, b.consumed_kwh,
+         b.relay_on ? "on" : "off");
+  return SCHED_DONE;
+}
+
+// ------ Benchmarks ------
+// Running screen over seeded readings, every screen in turn (the display task's refresh)
+static uint32_t benchRunningScreen(void*, BenchRng& rng) {
+  latest.t_ms = 1 + rng.below(100000);
+  latest.voltage = 220.0f + rng.below(200) / 10.0f;
+  latest.power = rng.below(24000) / 10.0f;
+  latest.current = latest.power / latest.voltage;
+  latest.energy_kwh = 12345.0f + rng.below(100000) / 1000.0f;
+  latest.frequency = 49.5f + rng.below(10) / 10.0f;
+  latest.pf = rng.below(101) / 100.0f;
+  ui.runningScreen = (ui.runningScreen + 1) % UI_RUNNING_SCREENS;
+  renderRunning();
+  panel.display();
+  return panel.rowWrites();
+}
+
+static void benchPrint(const char* line, void*) {
+  puts(line);
+}
+
+static int runBench(const char* prefix) {
+  BenchRunner bench("native");
+  benchAddCore(bench);
+  bench.add("display.running", benchRunningScreen, NULL, 5000);
+  if (strcmp(prefix, "all") == 0) prefix = "";
+  if (bench.run(prefix, benchPrint, NULL) == 0) {
+    fprintf(stderr, "no benchmark matches '%s':", prefix);
+    for (uint8_t i = 0; i < bench.count(); i++) fprintf(stderr, " %s", bench.name(i));
+    fprintf(stderr, "\n");
+    return 2;
+  }
+  return 0;
+}
+
+// ------ Setup / run ------
+static void usage() {
+  fprintf(stderr,
+          "usage: program [--rate N] [--hours H] [--load W] [--swing W] [--pf PF] [--keys SCRIPT]\n"
+          "               [--outage-every S --outage S] [--state DIR] [--no-journal] [--echo]\n"
+          "               [--check-alloc]\n"
+          "       program --bench all|PREFIX\n");
+}
+
+static double hostSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+  double rate = 1000.0;
+  double hours = 8.0;
+  SimLoad load = DEFAULT_LOAD;
+  const char* script = NULL;
+  const char* stateDir = "sim_state";
+  bool echo = false;
+  bool useJournal = true;
+  bool checkAlloc = false;
+  const char* benchPrefix = NULL;
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    const char* v = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(a, "--echo") == 0 || strcmp(a, "--no-journal") == 0 || strcmp(a, "--check-alloc") == 0) {
+      if (a[2] == 'e') echo = true;
+      if (a[2] == 'n') useJournal = false;
+      if (a[2] == 'c') checkAlloc = true;
+      continue;
+    }
+    if (v == NULL) {
+      usage();
+      return 2;
+    }
+    i++;
+    if (strcmp(a, "--rate") == 0) rate = atof(v);
+    else if (strcmp(a, "--hours") == 0) hours = atof(v);
+    else if (strcmp(a, "--load") == 0) load.baseW = (float)atof(v);
+    else if (strcmp(a, "--swing") == 0) load.swingW = (float)atof(v);
+    else if (strcmp(a, "--pf") == 0) load.pf = (float)atof(v);
+    else if (strcmp(a, "--keys") == 0) script = v;
+    else if (strcmp(a, "--outage-every") == 0) load.outageEveryMs = (uint32_t)(atof(v) * 1000.0);
+    else if (strcmp(a, "--outage") == 0) load.outageMs = (uint32_t)(atof(v) * 1000.0);
+    else if (strcmp(a, "--state") == 0) stateDir = v;
+    else if (strcmp(a, "--bench") == 0) benchPrefix = v;
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (benchPrefix != NULL) {
+    // Nothing under --state is opened: the screens only read the (empty) billing state
+    static SimMeter benchMeter(load);
+    static SimRelay benchRelay(benchMeter);
+    static MeteringCore benchCore(benchMeter, benchRelay, journal, eeprom);
+    metering = &benchCore;
+    return runBench(benchPrefix);
+  }
+  vclockSetRate(rate);
+
+  char path[240];
+  mkdir(stateDir, 0755);
+  snprintf(path, sizeof(path), "%s/journal.bin", stateDir);
+  bool haveJournal = useJournal && journalFlash.open(path, SIM_JOURNAL_SIZE) &&
+                     journal.begin(journalFlash, PERSIST_COMMIT_INTERVAL_MS);
+  snprintf(path, sizeof(path), "%s/tokens.bin", stateDir);
+  bool haveTokens = tokenFlash.open(path, SIM_TOKENS_SIZE);
+  snprintf(path, sizeof(path), "%s/eeprom.bin", stateDir);
+  if (!eeprom.open(path, EEPROM_SIZE)) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return 1;
+  }
+  if (!haveJournal) printf("no journal - using EEPROM\n");
+  tokenStore.begin(haveTokens ? &tokenFlash : NULL, tokenSeeds, sizeof(tokenSeeds) / sizeof(tokenSeeds[0]));
+  tokenKeyValid = cryptoTokenParseKey(METER_TOKEN_KEY, tokenKey);
+
+  static SimMeter simMeter(load);
+  static SimRelay simRelay(simMeter);
+  static MeteringCore core(simMeter, simRelay, journal, eeprom);
+  meter = &simMeter;
+  relay = &simRelay;
+  metering = &core;
+  char registerPath[240];
+  snprintf(registerPath, sizeof(registerPath), "%s/pzem_wh.txt", stateDir);
+  double registerWh = 12345.0;  // a meter that has been in service a while
+  FILE* rf = fopen(registerPath, "r");
+  if (rf != NULL) {
+    if (fscanf(rf, "%lf", &registerWh) != 1) registerWh = 12345.0;
+    fclose(rf);
+  }
+  simMeter.setEnergyWh(registerWh);
+  const char* restoredFrom = core.restore(halMillis());
+  if (restoredFrom != NULL) {
+    memcpy(lastTokenEntered, core.billing().token, sizeof(lastTokenEntered));
+    printf("restored token %s from %s: %.3f kWh left\n", core.billing().token, restoredFrom,
+           core.billing().remaining_kwh);
+  }
+  ui.state = core.billing().relay_on ? STATE_RUNNING : STATE_READY;
+
+  if (script == NULL && !core.billing().relay_on) script = "@2 A18886583547834136861";
+  if (script != NULL && !keys.load(script, halMillis())) {
+    fprintf(stderr, "bad key script: %s\n", script);
+    return 2;
+  }
+  if (echo) panel.setEcho(stdout);
+
+  scheduler.every("metering", METER_PERIOD_MS, 5, 2000, taskMetering);
+  scheduler.every("keypad", 10, 4, 500, taskKeypad);
+  scheduler.every("screen-swap", 4000, 1, 200, taskScreenSwap);
+  scheduler.every("display", 500, 2, 1000, taskDisplay);
+  scheduler.every("report", SIM_REPORT_MS, 0, 200, taskReport);
+  tInfoTimeout = scheduler.once("info-timeout", 3, 200, taskInfoTimeout);
+  tBadTokenTimeout = scheduler.once("badtoken-timeout", 3, 200, taskBadTokenTimeout);
+
+  char speed[24];
+  snprintf(speed, sizeof(speed), rate > 0.0 ? "%.0fx" : "max speed", rate);
+  printf("simulating %.1f h at %s, %.0f W +/- %.0f W, state in %s/\n", hours, speed, load.baseW, load.swingW,
+         stateDir);
+  uint32_t startMs = halMillis();
+  uint32_t runMs = (uint32_t)(hours * 3600000.0);
+  double hostStart = hostSeconds();
+  if (checkAlloc) allocCounterArm();
+  while (halMillis() - startMs < runMs) {
+    uint32_t t0 = halMicros();
+    uint32_t idleMs = scheduler.run();
+    loopLatency.record(halMicros() - t0);
+    if (rate > 0.0) {
+      vclockSleep(idleMs < 5 ? idleMs : 5);
+    } else {
+      vclockAdvance((uint64_t)(idleMs ? idleMs : 1) * 1000);
+    }
+  }
+  double hostElapsed = hostSeconds() - hostStart;
+  AllocCounterStats allocs = allocCounterStats();
+  allocCounterDisarm();
+
+  const BillingState& b = core.billing();
+  const EnergyLedger& l = core.ledger();
+  printf("\n--- %.2f h simulated in %.2f s (%.0fx) ---\n", (halMillis() - startMs) / 3600000.0, hostElapsed,
+         hostElapsed > 0 ? (halMillis() - startMs) / 1000.0 / hostElapsed : 0.0);
+  printf("samples %u, meter timeouts %u, tokens applied %u, relay switches %u, relay %s\n", (unsigned)samples,
+         (unsigned)simMeter.timeouts(), (unsigned)tokensApplied, (unsigned)simRelay.switches(),
+         b.relay_on ? "on" : "off");
+  printf("register %.3f kWh, ledger consumed %.6f kWh (baseline %.3f), remaining %.6f kWh, corrections %u\n",
+         simMeter.energyWh() / 1000.0, l.consumedUwh() / 1e9, l.baselineWh() / 1000.0, l.remainingUwh() / 1e9,
+         (unsigned)l.corrections());
+  printf("journal commits %u, page erases %u, flash bytes written %u; EEPROM commits %u\n",
+         (unsigned)journal.commits(), (unsigned)journal.eraseCycles(), (unsigned)journalFlash.bytesWritten(),
+         (unsigned)eeprom.commits());
+  printf("panel flushes %u, row writes %u\n", (unsigned)panel.flushes(), (unsigned)panel.rowWrites());
+  printf("loop passes %u, p50 %u us, p99 %u us, max %u us (host time)\n", (unsigned)loopLatency.count(),
+         (unsigned)loopLatency.percentile(50), (unsigned)loopLatency.percentile(99), (unsigned)loopLatency.max());
+  for (uint8_t id = 0; id < scheduler.taskCount(); id++) {
+    SchedTaskStats st = scheduler.stats(id);
+    printf("  %-16s runs %7u  p99 %5u us  max %5u us\n", st.name, (unsigned)st.runs,
+           (unsigned)scheduler.latency(id).percentile(99), (unsigned)st.maxUs);
+  }
+  for (uint8_t r = 0; r < PANEL_ROWS; r++) printf("|%-14s|\n", panel.row(r));
+  if (checkAlloc) {
+    if (ALLOC_COUNTER_ENABLED) {
+      printf("heap allocations after init: %u (%u bytes, largest %u)", (unsigned)allocs.count,
+             (unsigned)allocs.bytes, (unsigned)allocs.largest);
+      if (allocs.count > 0) {
+        printf(", first %u bytes from %p, last %u bytes from %p", (unsigned)allocs.firstSize, allocs.firstCaller,
+               (unsigned)allocs.lastSize, allocs.lastCaller);
+      }
+      printf("\n");
+    } else {
+      printf("--check-alloc: built without ALLOC_COUNTER_ENABLED, nothing was counted\n");
+    }
+  }
+
+  rf = fopen(registerPath, "w");
+  if (rf != NULL) {
+    fprintf(rf, "%.6f\n", simMeter.energyWh());
+    fclose(rf);
+  }
+  return checkAlloc && (!ALLOC_COUNTER_ENABLED || allocs.count > 0) ? 1 : 0;
+}
+
+#endif // PIO_UNIT_TESTING
@@ -0,0 +1,79 @@
+/**
+ * sim_meter.cpp - Simulated PZEM-004T (see sim_meter.h)
+ */
+#include "sim_meter.h"
+#include <math.h>
+#include <string.h>
+
+SimMeter::SimMeter(const SimLoad& load)
+    : load_(load), supply_(false), energyWh_(0.0), modelMs_(0), started_(false), lastW_(0.0f),
+      noise_(12345), pending_(false), sentMs_(0), timeouts_(0) {
+  memset(&taken_, 0, sizeof(taken_));
+  memset(&reading_, 0, sizeof(reading_));
+}
+
+bool SimMeter::silent(uint32_t nowMs) const {
+  return load_.outageEveryMs != 0 && nowMs % load_.outageEveryMs < load_.outageMs;
+}
+
+float SimMeter::loadW(uint32_t nowMs) {
+  if (!supply_) return 0.0f;
+  noise_ = noise_ * 1103515245u + 12345u;  // LCG: same run every time
+  float noise = ((float)((noise_ >> 16) & 0x3FF) / 1023.0f - 0.5f) * 0.02f * load_.baseW;
+  float swing = load_.swingPeriodMs == 0 ? 0.0f
+      : load_.swingW * sinf(6.2831853f * (float)(nowMs % load_.swingPeriodMs) / (float)load_.swingPeriodMs);
+  float w = load_.baseW + swing + noise;
+  return w > 0.0f ? w : 0.0f;
+}
+
+// Trapezoid of the load since the last model step into the register
+void SimMeter::advance(uint32_t nowMs) {
+  float w = loadW(nowMs);
+  if (started_ && nowMs > modelMs_) {
+    energyWh_ += (double)(lastW_ + w) / 2.0 * (double)(nowMs - modelMs_) / 3600000.0;
+  }
+  started_ = true;
+  modelMs_ = nowMs;
+  lastW_ = w;
+}
+
+void SimMeter::setSupply(bool on, uint32_t nowMs) {
+  advance(nowMs);
+  supply_ = on;
+  lastW_ = loadW(nowMs);
+}
+
+bool SimMeter::request(uint32_t nowMs) {
+  if (pending_) return false;
+  advance(nowMs);
+  pending_ = true;
+  sentMs_ = nowMs;
+
+  float v = 230.0f + 4.0f * sinf(6.2831853f * (float)(nowMs % 3600000u) / 3600000.0f);
+  float p = lastW_;
+  taken_.t_ms = nowMs;
+  taken_.voltage = roundf(v * 10.0f) / 10.0f;
+  taken_.power_dw = (uint32_t)lroundf(p * 10.0f);
+  taken_.power = taken_.power_dw / 10.0f;
+  taken_.current = p > 0.0f ? roundf(p / (v * load_.pf) * 1000.0f) / 1000.0f : 0.0f;
+  taken_.pf = p > 0.0f ? load_.pf : 0.0f;
+  taken_.energy_wh = (uint32_t)energyWh_;
+  taken_.energy_kwh = taken_.energy_wh / 1000.0f;
+  taken_.frequency = 50.0f;
+  taken_.alarm = 0;
+  return true;
+}
+
+int SimMeter::collect(uint32_t nowMs) {
+  if (!pending_) return PZEM_IDLE;
+  if (silent(sentMs_)) {
+    if (nowMs - sentMs_ < SIM_REPLY_TIMEOUT_MS) return PZEM_PENDING;
+    pending_ = false;
+    timeouts_++;
+    return PZEM_TIMEOUT;
+  }
+  if (nowMs - sentMs_ < SIM_REPLY_MS) return PZEM_PENDING;
+  pending_ = false;
+  reading_ = taken_;
+  return PZEM_OK;
+}
@@ -0,0 +1,64 @@
+/**
+ * sim_meter.h - Simulated PZEM-004T for the native build
+ *
+ * Load model: a base load plus a slow sinusoidal swing and a little
+ * deterministic noise, on a 230 V / 50 Hz supply that wanders by a few volts.
+ * The energy register integrates the power in Wh like the real meter, and the
+ * load is only powered while the relay is on (setSupply(), called by the
+ * simulated relay). Replies behave like the UART driver's: the reading is
+ * taken when request() is sent and collected on a later collect(); during a
+ * scripted outage requests time out after PZEM_REPLY_TIMEOUT_MS.
+ */
+
+#ifndef SIM_METER_H
+#define SIM_METER_H
+
+#include "hal.h"
+
+#define SIM_REPLY_MS          30    // 25 bytes @ 9600 baud + device latency
+#define SIM_REPLY_TIMEOUT_MS  150   // same as PZEM_REPLY_TIMEOUT_MS
+
+struct SimLoad {
+  float baseW;
+  float swingW;          // amplitude of the sinusoidal swing
+  uint32_t swingPeriodMs;
+  float pf;
+  uint32_t outageEveryMs; // 0 = never: sensor silent for outageMs every outageEveryMs
+  uint32_t outageMs;
+};
+
+class SimMeter : public HalMeter {
+ public:
+  explicit SimMeter(const SimLoad& load);
+
+  bool request(uint32_t nowMs) override;
+  int collect(uint32_t nowMs) override;
+  const PzemReading& last() const override { return reading_; }
+
+  // Relay switched at nowMs: the load before it is integrated at the old state
+  void setSupply(bool on, uint32_t nowMs);
+  // Register starts here (a meter that has been in service a while)
+  void setEnergyWh(double wh) { energyWh_ = wh; }
+  double energyWh() const { return energyWh_; }
+  uint32_t timeouts() const { return timeouts_; }
+
+ private:
+  void advance(uint32_t nowMs);
+  float loadW(uint32_t nowMs);
+  bool silent(uint32_t nowMs) const;
+
+  SimLoad load_;
+  bool supply_;
+  double energyWh_;
+  uint32_t modelMs_;
+  bool started_;
+  float lastW_;
+  uint32_t noise_;
+  bool pending_;
+  uint32_t sentMs_;
+  PzemReading taken_;
+  PzemReading reading_;
+  uint32_t timeouts_;
+};
+
+#endif // SIM_METER_H
@@ -0,0 +1,45 @@
+/**
+ * virtual_clock.cpp - Virtual time for the native build (see virtual_clock.h)
+ */
+#include "virtual_clock.h"
+#include "hal.h"
+#include <time.h>
+
+static uint64_t hostUs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static double rate_ = 1.0;
+static uint64_t baseUs_ = 0;             // virtual time at anchorUs_
+static uint64_t anchorUs_ = hostUs();    // host monotonic time of the last rate change
+
+uint64_t vclockNowUs() {
+  if (rate_ <= 0.0) return baseUs_;
+  return baseUs_ + (uint64_t)((double)(hostUs() - anchorUs_) * rate_);
+}
+
+void vclockSetRate(double rate) {
+  baseUs_ = vclockNowUs();
+  anchorUs_ = hostUs();
+  rate_ = rate;
+}
+
+double vclockRate() { return rate_; }
+
+void vclockAdvance(uint64_t us) {
+  baseUs_ += us;
+}
+
+void vclockSleep(uint32_t virtualMs) {
+  if (rate_ <= 0.0 || virtualMs == 0) return;
+  uint64_t ns = (uint64_t)((double)virtualMs * 1000000.0 / rate_);
+  struct timespec ts = {(time_t)(ns / 1000000000ULL), (long)(ns % 1000000000ULL)};
+  nanosleep(&ts, NULL);
+}
+
+// Start one second in: a zero timestamp means "no reading yet" to the metering code
+uint32_t halMillis() { return (uint32_t)((vclockNowUs() + 1000000ULL) / 1000); }
+// Durations are measured in host time (see hal.h)
+uint32_t halMicros() { return (uint32_t)hostUs(); }
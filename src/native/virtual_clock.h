@@ -0,0 +1,24 @@
+/**
+ * virtual_clock.h - Virtual time behind halMillis()/halMicros() in the native build
+ *
+ * Rate N: virtual time runs N times faster than the host's monotonic clock
+ * (1000 = a day of metering in ~86 s). Rate 0: time stands still until
+ * vclockAdvance() moves it, for runs that jump straight to the next due task.
+ * Only halMillis() is virtual: halMicros() stays on the host clock, so scheduler
+ * budgets, latency histograms and commit timings measure real CPU time.
+ */
+
+#ifndef VIRTUAL_CLOCK_H
+#define VIRTUAL_CLOCK_H
+
+#include <stdint.h>
+
+void vclockSetRate(double rate);
+double vclockRate();
+// Move time forward (any rate)
+void vclockAdvance(uint64_t us);
+uint64_t vclockNowUs();
+// Sleep the host for this much virtual time (no-op at rate 0)
+void vclockSleep(uint32_t virtualMs);
+
+#endif // VIRTUAL_CLOCK_H
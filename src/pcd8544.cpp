@@ -0,0 +1,210 @@
+/**
+ * pcd8544.cpp - Nokia 5110 driver with change-only flushing (see pcd8544.h)
+ */
+#include "pcd8544.h"
+#include <string.h>
+
+#define PCD8544_FUNCTIONSET     0x20
+#define PCD8544_EXTENDED        0x01
+#define PCD8544_DISPLAYNORMAL   0x0C
+#define PCD8544_SETBIAS         0x10
+#define PCD8544_SETVOP          0x80
+
+Pcd8544::Pcd8544(int8_t sclk, int8_t din, int8_t dc, int8_t cs, int8_t rst)
+    : Adafruit_GFX(PCD8544_WIDTH, PCD8544_HEIGHT), sclk_(sclk), din_(din), dc_(dc), cs_(cs), rst_(rst),
+      spanAlign_(1), contrast_(40), bias_(0x04), sentValid_(false), bytesPushed_(0), lastFlushBytes_(0),
+      lastFlushUs_(0), flushes_(0), flushesSkipped_(0) {
+  memset(frame_, 0, sizeof(frame_));
+  memset(sent_, 0, sizeof(sent_));
+  memset(rows_, 0, sizeof(rows_));
+  memset(rowValid_, 0, sizeof(rowValid_));
+}
+
+bool Pcd8544::begin(uint8_t contrast, uint8_t bias) {
+  contrast_ = contrast > 0x7F ? 0x7F : contrast;
+  bias_ = bias & 0x07;
+  if (!beginTransport()) return false;
+  if (rst_ >= 0) {
+    pinMode(rst_, OUTPUT);
+    digitalWrite(rst_, LOW);
+    delay(1);
+    digitalWrite(rst_, HIGH);
+  }
+  const uint8_t init[] = {
+    PCD8544_FUNCTIONSET | PCD8544_EXTENDED,
+    (uint8_t)(PCD8544_SETBIAS | bias_),
+    (uint8_t)(PCD8544_SETVOP | contrast_),
+    PCD8544_FUNCTIONSET,
+    PCD8544_DISPLAYNORMAL,
+  };
+  writeBytes(false, init, sizeof(init));
+  invalidate();
+  return true;
+}
+
+void Pcd8544::setContrast(uint8_t contrast) {
+  contrast_ = contrast > 0x7F ? 0x7F : contrast;
+  const uint8_t cmds[] = {
+    PCD8544_FUNCTIONSET | PCD8544_EXTENDED,
+    (uint8_t)(PCD8544_SETVOP | contrast_),
+    PCD8544_FUNCTIONSET,
+  };
+  writeBytes(false, cmds, sizeof(cmds));
+}
+
+void Pcd8544::clearDisplay() {
+  fillScreen(WHITE);
+  setCursor(0, 0);
+}
+
+void Pcd8544::invalidate() {
+  sentValid_ = false;
+}
+
+void Pcd8544::display() {
+  waitIdle();  // the previous frame's spans are sent from sent_: let them finish first
+  uint32_t t0 = micros();
+  uint16_t bytes = pcd8544Flush(frame_, sent_, sentValid_, spanAlign_, flushWrite, this);
+  sentValid_ = true;
+  if (bytes == 0) {
+    flushesSkipped_++;
+    return;
+  }
+  flushes_++;
+  bytesPushed_ += bytes;
+  lastFlushBytes_ = bytes;
+  lastFlushUs_ = micros() - t0;
+}
+
+void Pcd8544::flushWrite(void* ctx, bool isData, const uint8_t* bytes, size_t len) {
+  ((Pcd8544*)ctx)->writeBytes(isData, bytes, len);
+}
+
+void Pcd8544::textRow(uint8_t row, const char* text) {
+  if (row >= PCD8544_TEXT_ROWS) return;
+  char cell[PCD8544_TEXT_COLS + 1];
+  strncpy(cell, text, PCD8544_TEXT_COLS);
+  cell[PCD8544_TEXT_COLS] = '\0';
+  if (rowValid_[row] && strcmp(cell, rows_[row]) == 0) return;
+
+  // Only this bank changes; display() then sends just the columns that differ
+  Adafruit_GFX::fillRect(0, row * 8, PCD8544_WIDTH, 8, WHITE);
+  setCursor(0, row * 8);
+  print(cell);
+  memcpy(rows_[row], cell, sizeof(cell));
+  rowValid_[row] = true;
+}
+
+void Pcd8544::drawPixel(int16_t x, int16_t y, uint16_t color) {
+  if (x < 0 || x >= PCD8544_WIDTH || y < 0 || y >= PCD8544_HEIGHT) return;
+  uint8_t* b = &frame_[x + (y / 8) * PCD8544_WIDTH];
+  if (color) {
+    *b |= (uint8_t)(1 << (y & 7));
+  } else {
+    *b &= (uint8_t)~(1 << (y & 7));
+  }
+}
+
+void Pcd8544::fillScreen(uint16_t color) {
+  memset(frame_, color ? 0xFF : 0x00, sizeof(frame_));
+  memset(rowValid_, 0, sizeof(rowValid_));  // rows no longer show their cached text
+}
+
+bool Pcd8544::beginTransport() {
+  pinMode(sclk_, OUTPUT);
+  pinMode(din_, OUTPUT);
+  pinMode(dc_, OUTPUT);
+  pinMode(cs_, OUTPUT);
+  digitalWrite(cs_, HIGH);
+  return true;
+}
+
+// Software SPI, mode 0, MSB first
+void Pcd8544::writeBytes(bool isData, const uint8_t* bytes, size_t len) {
+  digitalWrite(dc_, isData ? HIGH : LOW);
+  digitalWrite(cs_, LOW);
+  for (size_t i = 0; i < len; i++) {
+    shiftOut(din_, sclk_, MSBFIRST, bytes[i]);
+  }
+  digitalWrite(cs_, HIGH);
+}
+
+// ------ VSPI + DMA transport ------
+
+Pcd8544Spi::Pcd8544Spi(spi_host_device_t host, int8_t sclk, int8_t mosi, int8_t dc, int8_t cs, int8_t rst)
+    : Pcd8544(sclk, mosi, dc, cs, rst), host_(host), dev_(NULL), inFlight_(0), fenceWaits_(0), maxFenceUs_(0) {
+  spanAlign_ = 4;  // word-aligned DMA source and length: the driver would otherwise bounce them through the heap
+  memset(trans_, 0, sizeof(trans_));
+}
+
+bool Pcd8544Spi::beginTransport() {
+  pinMode(dc_, OUTPUT);
+  spi_bus_config_t bus = {};
+  bus.mosi_io_num = din_;
+  bus.miso_io_num = -1;
+  bus.sclk_io_num = sclk_;
+  bus.quadwp_io_num = -1;
+  bus.quadhd_io_num = -1;
+  bus.max_transfer_sz = PCD8544_WIDTH * PCD8544_BANKS;
+  if (spi_bus_initialize(host_, &bus, SPI_DMA_CH_AUTO) != ESP_OK) return false;
+
+  spi_device_interface_config_t dev = {};
+  dev.mode = 0;
+  dev.clock_speed_hz = PCD8544_SPI_HZ;
+  dev.spics_io_num = cs_;
+  dev.queue_size = PCD8544_SPI_QUEUE;
+  dev.pre_cb = setDc;
+  return spi_bus_add_device(host_, &dev, &dev_) == ESP_OK;
+}
+
+// Runs in the SPI ISR before each transaction: D/C for this transaction
+void IRAM_ATTR Pcd8544Spi::setDc(spi_transaction_t* t) {
+  uint32_t u = (uint32_t)(uintptr_t)t->user;
+  gpio_set_level((gpio_num_t)(u >> 1), u & 1);
+}
+
+// Up to 4 bytes travel inside the transaction; longer data is DMA'd from the caller's
+// buffer (display() keeps it valid until waitIdle()); longer commands go out blocking.
+void Pcd8544Spi::writeBytes(bool isData, const uint8_t* bytes, size_t len) {
+  if (dev_ == NULL || len == 0) return;
+  if (inFlight_ == PCD8544_SPI_QUEUE) waitIdle();
+
+  spi_transaction_t* t = &trans_[inFlight_];
+  memset(t, 0, sizeof(*t));
+  t->length = len * 8;
+  t->user = (void*)(uintptr_t)(((uint32_t)dc_ << 1) | (isData ? 1 : 0));
+  if (len <= sizeof(t->tx_data)) {
+    t->flags = SPI_TRANS_USE_TXDATA;
+    memcpy(t->tx_data, bytes, len);
+  } else if (isData) {
+    t->tx_buffer = bytes;
+  } else {
+    waitIdle();
+    t = &trans_[0];
+    memset(t, 0, sizeof(*t));
+    t->length = len * 8;
+    t->user = (void*)(uintptr_t)((uint32_t)dc_ << 1);
+    t->tx_buffer = bytes;
+    spi_device_polling_transmit(dev_, t);
+    return;
+  }
+  if (spi_device_queue_trans(dev_, t, portMAX_DELAY) == ESP_OK) inFlight_++;
+}
+
+void Pcd8544Spi::waitIdle() {
+  if (inFlight_ == 0) return;
+  uint32_t t0 = micros();
+  bool waited = false;
+  spi_transaction_t* done;
+  while (inFlight_ > 0) {
+    if (spi_device_get_trans_result(dev_, &done, 0) != ESP_OK) {
+      waited = true;  // still sending when the next frame was ready
+      spi_device_get_trans_result(dev_, &done, portMAX_DELAY);
+    }
+    inFlight_--;
+  }
+  if (!waited) return;
+  fenceWaits_++;
+  uint32_t us = micros() - t0;
+  if (us > maxFenceUs_) maxFenceUs_ = us;
+}
@@ -0,0 +1,31 @@
+/**
+ * pcd8544_flush.cpp - Change-only frame diff of the PCD8544 driver (see pcd8544_flush.h)
+ */
+#include "pcd8544_flush.h"
+#include <string.h>
+
+uint16_t pcd8544Flush(const uint8_t* frame, uint8_t* sent, bool sentValid, uint8_t spanAlign,
+                      Pcd8544Write write, void* ctx) {
+  uint16_t bytes = 0;
+  for (uint8_t bank = 0; bank < PCD8544_BANKS; bank++) {
+    const uint8_t* cur = frame + bank * PCD8544_WIDTH;
+    uint8_t* old = sent + bank * PCD8544_WIDTH;
+    int16_t first = 0, last = PCD8544_WIDTH - 1;
+    if (sentValid) {
+      while (first < PCD8544_WIDTH && cur[first] == old[first]) first++;
+      if (first == PCD8544_WIDTH) continue;  // bank unchanged
+      while (cur[last] == old[last]) last--;
+      // Widen to whole spanAlign units; banks are 84 bytes, so this never leaves the bank
+      first -= first % spanAlign;
+      last += spanAlign - 1 - last % spanAlign;
+    }
+    // Horizontal addressing: X auto-increments across the span
+    const uint8_t addr[] = {(uint8_t)(PCD8544_SETYADDR | bank), (uint8_t)(PCD8544_SETXADDR | first)};
+    uint8_t len = (uint8_t)(last - first + 1);
+    memcpy(old + first, cur + first, len);
+    write(ctx, false, addr, sizeof(addr));
+    write(ctx, true, old + first, len);  // stable until the next flush
+    bytes += sizeof(addr) + len;
+  }
+  return bytes;
+}
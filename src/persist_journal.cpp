@@ -0,0 +1,244 @@
+/**
+ * persist_journal.cpp - Wear-leveled billing state journal (see persist_journal.h)
+ */
+#include "persist_journal.h"
+#include <string.h>
+
+static bool sameState(const PersistState& a, const PersistState& b) {
+  return a.purchasedUwh == b.purchasedUwh && a.consumedUwh == b.consumedUwh &&
+         a.baselineWh == b.baselineWh && a.haveBaseline == b.haveBaseline &&
+         strncmp(a.token, b.token, sizeof(a.token)) == 0 &&
+         a.replay.highest == b.replay.highest && a.replay.seen == b.replay.seen &&
+         memcmp(&a.purchases, &b.purchases, sizeof(a.purchases)) == 0;
+}
+
+PersistJournal::PersistJournal()
+    : flash_(NULL), pageCount_(0), commitIntervalMs_(0), headPage_(-1), headSeq_(0), curPage_(-1),
+      writeOff_(0), needRotate_(false), ckptSeq_(0), haveWritten_(false), dirty_(false), lastCommitMs_(0),
+      commits_(0), eraseCycles_(0), maxPageErases_(0), lastCommitUs_(0), maxCommitUs_(0) {
+  memset(&written_, 0, sizeof(written_));
+  memset(&staged_, 0, sizeof(staged_));
+}
+
+bool PersistJournal::begin(HalFlash& flash, uint32_t commitIntervalMs) {
+  commitIntervalMs_ = commitIntervalMs;
+  if (flash.size() / PJ_PAGE_SIZE < 2) return false;
+  flash_ = &flash;
+  pageCount_ = (uint16_t)(flash.size() / PJ_PAGE_SIZE);
+
+  for (uint16_t p = 0; p < pageCount_; p++) {
+    PageHeader h;
+    if (!readHeader(p, h)) continue;
+    if (h.erases > maxPageErases_) maxPageErases_ = h.erases;
+    if (headPage_ < 0 || h.seq > headSeq_) {
+      headPage_ = p;
+      headSeq_ = h.seq;
+    }
+  }
+
+  // Newest page with an intact first checkpoint; a newer page cut during rotation is skipped
+  uint32_t bound = 0xFFFFFFFFUL;
+  for (;;) {
+    int32_t best = -1;
+    uint32_t bestSeq = 0;
+    for (uint16_t p = 0; p < pageCount_; p++) {
+      PageHeader h;
+      if (readHeader(p, h) && h.seq < bound && (best < 0 || h.seq > bestSeq)) {
+        best = p;
+        bestSeq = h.seq;
+      }
+    }
+    if (best < 0) break;
+    PersistState s;
+    uint32_t seq = 0, endOff;
+    bool clean;
+    if (replayPage((uint16_t)best, s, seq, endOff, clean)) {
+      ckptSeq_ = seq;
+      written_ = s;
+      staged_ = s;
+      haveWritten_ = true;
+      curPage_ = best;
+      writeOff_ = endOff;
+      needRotate_ = !clean || best != headPage_;  // torn tail, or a newer (broken) page exists
+      break;
+    }
+    bound = bestSeq;
+  }
+  return true;
+}
+
+void PersistJournal::stage(const PersistState& s) {
+  staged_ = s;
+  staged_.token[sizeof(staged_.token) - 1] = '\0';
+  dirty_ = !haveWritten_ || !sameState(staged_, written_);
+}
+
+bool PersistJournal::service(uint32_t nowMs, bool force) {
+  if (flash_ == NULL || !dirty_) return false;
+  if (!force && haveWritten_ && nowMs - lastCommitMs_ < commitIntervalMs_) return false;
+  uint32_t t0 = halMicros();
+
+  // Steady state: only consumption grew since the last record -> 8-byte delta, no erase
+  int64_t delta = staged_.consumedUwh - written_.consumedUwh;
+  PersistState probe = staged_;
+  probe.consumedUwh = written_.consumedUwh;
+  bool deltaOnly = haveWritten_ && delta >= 0 && delta <= 0xFFFFFFFFLL && sameState(probe, written_);
+  size_t need = sizeof(RecHeader) + (deltaOnly ? sizeof(uint32_t) : sizeof(BillingCheckpoint));
+
+  bool ok;
+  if (curPage_ < 0 || needRotate_ || writeOff_ + need > PJ_PAGE_SIZE) {
+    ok = rotate();  // new page starts with a checkpoint of the staged state
+  } else if (deltaOnly) {
+    uint32_t d = (uint32_t)delta;
+    ok = appendRecord(PJ_REC_CONSUMED, &d, sizeof(d));
+  } else {
+    ok = writeCheckpoint();  // token/purchase/baseline changed: all of it in one record
+  }
+
+  if (ok) {
+    written_ = staged_;
+    haveWritten_ = true;
+    dirty_ = false;
+    commits_++;
+  }
+  lastCommitMs_ = nowMs;  // also after a failure: don't hammer a failing flash every tick
+  lastCommitUs_ = halMicros() - t0;
+  if (lastCommitUs_ > maxCommitUs_) maxCommitUs_ = lastCommitUs_;
+  return ok;
+}
+
+bool PersistJournal::readHeader(uint16_t page, PageHeader& h) {
+  if (!flash_->read((size_t)page * PJ_PAGE_SIZE, &h, sizeof(h))) return false;
+  return h.magic == PJ_PAGE_MAGIC && h.crc == crc16((const uint8_t*)&h, sizeof(h) - 2);
+}
+
+// Replay one page. False when its first record is not an intact checkpoint.
+// seq: sequence number of the last checkpoint replayed.
+// cleanEnd: stopped at erased flash (or the page end), not at a torn record.
+bool PersistJournal::replayPage(uint16_t page, PersistState& out, uint32_t& seq, uint32_t& endOff,
+                                bool& cleanEnd) {
+  size_t base = (size_t)page * PJ_PAGE_SIZE;
+  uint32_t off = sizeof(PageHeader);
+  bool haveFull = false;
+  cleanEnd = false;
+  while (off + sizeof(RecHeader) <= PJ_PAGE_SIZE) {
+    RecHeader h;
+    if (!flash_->read(base + off, &h, sizeof(h))) break;
+    if (h.type == 0xFF && h.len == 0xFF && h.crc == 0xFFFF) {
+      cleanEnd = true;  // erased: end of the journal
+      break;
+    }
+    uint8_t payload[sizeof(BillingCheckpoint)];
+    uint32_t total = (sizeof(h) + h.len + 3) & ~3UL;
+    if (h.len > sizeof(payload) || off + total > PJ_PAGE_SIZE ||
+        !flash_->read(base + off + sizeof(h), payload, h.len) ||
+        h.crc != recordCrc(h, payload)) {
+      break;  // torn by power loss
+    }
+    if (h.type == PJ_REC_CHECKPOINT && h.len == sizeof(BillingCheckpoint)) {
+      BillingCheckpoint cp;
+      memcpy(&cp, payload, sizeof(cp));
+      if (!checkpointUnpack(cp, out)) break;
+      seq = cp.seq;
+      haveFull = true;
+    } else if (h.type == PJ_REC_CHECKPOINT && h.len == sizeof(BillingCheckpointV2)) {
+      BillingCheckpointV2 cp;
+      memcpy(&cp, payload, sizeof(cp));
+      if (!checkpointUnpackV2(cp, out)) break;
+      seq = cp.seq;
+      haveFull = true;
+    } else if (h.type == PJ_REC_FULL && h.len == sizeof(FullRecord)) {
+      FullRecord f;
+      memcpy(&f, payload, sizeof(f));
+      out.purchasedUwh = f.purchasedUwh;
+      out.consumedUwh = f.consumedUwh;
+      out.baselineWh = f.baselineWh;
+      out.haveBaseline = f.haveBaseline != 0;
+      memcpy(out.token, f.token, sizeof(f.token));
+      out.token[sizeof(f.token)] = '\0';
+      out.replay.highest = 0;
+      out.replay.seen = 0;
+      memset(&out.purchases, 0, sizeof(out.purchases));
+      haveFull = true;
+    } else if (h.type == PJ_REC_CONSUMED && h.len == sizeof(uint32_t) && haveFull) {
+      uint32_t d;
+      memcpy(&d, payload, sizeof(d));
+      out.consumedUwh += d;
+    } else {
+      break;
+    }
+    off += total;
+  }
+  if (off + sizeof(RecHeader) > PJ_PAGE_SIZE) cleanEnd = true;  // page full
+  endOff = off;
+  return haveFull;
+}
+
+bool PersistJournal::appendRecord(uint8_t type, const void* payload, uint8_t len) {
+  uint8_t buf[sizeof(RecHeader) + sizeof(BillingCheckpoint) + 3];
+  RecHeader h = {type, len, 0};
+  h.crc = recordCrc(h, (const uint8_t*)payload);
+  uint32_t total = (sizeof(h) + len + 3) & ~3UL;
+  memset(buf, 0xFF, sizeof(buf));  // padding stays erased
+  memcpy(buf, &h, sizeof(h));
+  memcpy(buf + sizeof(h), payload, len);
+  if (!flash_->write((size_t)curPage_ * PJ_PAGE_SIZE + writeOff_, buf, total)) {
+    needRotate_ = true;  // state of the tail unknown: continue on a fresh page
+    return false;
+  }
+  writeOff_ += total;
+  return true;
+}
+
+bool PersistJournal::writeCheckpoint() {
+  BillingCheckpoint cp;
+  checkpointPack(staged_, ckptSeq_ + 1, cp);
+  if (!appendRecord(PJ_REC_CHECKPOINT, &cp, sizeof(cp))) return false;
+  ckptSeq_ = cp.seq;
+  return true;
+}
+
+// Erase the oldest page, stamp it as the new head and start it with a checkpoint.
+// The page we restored from is never the one erased, so a power cut here leaves it intact.
+bool PersistJournal::rotate() {
+  uint16_t page = headPage_ < 0 ? 0 : (uint16_t)((headPage_ + 1) % pageCount_);
+  if ((int32_t)page == curPage_) page = (uint16_t)headPage_;  // 2 pages, head broken: reuse it
+
+  PageHeader old = {};
+  uint32_t erases = 1;  // blank page
+  if (readHeader(page, old)) {
+    erases = old.erases + 1;
+  } else if (old.magic != 0xFFFFFFFFUL) {
+    erases = maxPageErases_ + 1;  // header lost: assume the worst
+  }
+  size_t base = (size_t)page * PJ_PAGE_SIZE;
+  if (!flash_->erase(base, PJ_PAGE_SIZE)) return false;
+  eraseCycles_++;
+  if (erases > maxPageErases_) maxPageErases_ = erases;
+
+  PageHeader h = {PJ_PAGE_MAGIC, headSeq_ + 1, erases, 0, 0};
+  h.crc = crc16((const uint8_t*)&h, sizeof(h) - 2);
+  if (!flash_->write(base, &h, sizeof(h))) return false;
+  headPage_ = page;
+  headSeq_ = h.seq;
+  curPage_ = page;
+  writeOff_ = sizeof(h);
+  needRotate_ = false;
+  return writeCheckpoint();
+}
+
+uint16_t PersistJournal::recordCrc(const RecHeader& h, const uint8_t* payload) {
+  uint16_t crc = crc16((const uint8_t*)&h, 2);
+  return crc16(payload, h.len, crc);
+}
+
+// CRC-16/MODBUS, continuable through crc
+uint16_t PersistJournal::crc16(const uint8_t* data, size_t len, uint16_t crc) {
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (uint8_t b = 0; b < 8; b++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+  }
+  return crc;
+}
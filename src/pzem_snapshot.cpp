@@ -0,0 +1,126 @@
+/**
+ * pzem_snapshot.cpp - Single-frame, non-blocking PZEM-004T v3.0 driver (see pzem_snapshot.h)
+ */
+#include "pzem_snapshot.h"
+#include <string.h>
+
+#define PZEM_CMD_RIR        0x04   // read input registers
+#define PZEM_REG_COUNT      10     // 0x0000 voltage .. 0x0009 alarm
+#define PZEM_REPLY_LEN      (3 + PZEM_REG_COUNT * 2 + 2)
+
+PzemSnapshot::PzemSnapshot(HalSerial& port, uint8_t addr)
+    : port_(port), addr_(addr), pending_(false), sentMs_(0), rxLen_(0),
+      windowStartMs_(0), windowCount_(0) {
+  memset(&reading_, 0, sizeof(reading_));
+  memset(&stats_, 0, sizeof(stats_));
+  reading_.voltage = reading_.current = reading_.power = NAN;
+  reading_.energy_kwh = reading_.frequency = reading_.pf = NAN;
+}
+
+bool PzemSnapshot::request(uint32_t nowMs) {
+  if (pending_) return false;
+
+  // Drop anything stale (late reply to a timed-out request, line noise)
+  while (port_.available() > 0) port_.read();
+
+  uint8_t frame[8] = {addr_, PZEM_CMD_RIR, 0x00, 0x00, 0x00, PZEM_REG_COUNT, 0, 0};
+  uint16_t crc = crc16(frame, 6);
+  frame[6] = crc & 0xFF;
+  frame[7] = crc >> 8;
+  port_.write(frame, sizeof(frame));  // 8 bytes fit the UART TX FIFO, returns immediately
+
+  pending_ = true;
+  sentMs_ = nowMs;
+  rxLen_ = 0;
+  stats_.requests++;
+  return true;
+}
+
+int PzemSnapshot::collect(uint32_t nowMs) {
+  countWindow(nowMs);
+  if (!pending_) return PZEM_IDLE;
+
+  while (rxLen_ < PZEM_REPLY_LEN && port_.available() > 0) {
+    rx_[rxLen_++] = (uint8_t)port_.read();
+    // Modbus exception replies are 5 bytes: addr, func|0x80, code, crc
+    if (rxLen_ == 5 && (rx_[1] & 0x80)) break;
+  }
+
+  if (rxLen_ == 5 && (rx_[1] & 0x80)) {
+    pending_ = false;
+    stats_.bad_frames++;
+    return PZEM_BAD_FRAME;
+  }
+
+  if (rxLen_ < PZEM_REPLY_LEN) {
+    if (nowMs - sentMs_ >= PZEM_REPLY_TIMEOUT_MS) {
+      pending_ = false;
+      stats_.timeouts++;
+      return PZEM_TIMEOUT;
+    }
+    return PZEM_PENDING;
+  }
+
+  pending_ = false;
+  uint16_t crc = crc16(rx_, PZEM_REPLY_LEN - 2);
+  if (rx_[PZEM_REPLY_LEN - 2] != (crc & 0xFF) || rx_[PZEM_REPLY_LEN - 1] != (crc >> 8)) {
+    stats_.crc_errors++;
+    return PZEM_CRC_ERROR;
+  }
+  if (!decode()) {
+    stats_.bad_frames++;
+    return PZEM_BAD_FRAME;
+  }
+  stats_.transactions++;
+  stats_.last_rtt_ms = (uint16_t)(nowMs - sentMs_);
+  windowCount_++;
+  return PZEM_OK;
+}
+
+bool PzemSnapshot::decode() {
+  if ((rx_[0] != addr_ && addr_ != PZEM_DEFAULT_ADDR) || rx_[1] != PZEM_CMD_RIR ||
+      rx_[2] != PZEM_REG_COUNT * 2) {
+    return false;
+  }
+  const uint8_t* d = rx_ + 3;
+  uint16_t reg[PZEM_REG_COUNT];
+  for (int i = 0; i < PZEM_REG_COUNT; i++) {
+    reg[i] = ((uint16_t)d[2 * i] << 8) | d[2 * i + 1];
+  }
+  // 32-bit values are sent low word first
+  uint32_t current_mA = (uint32_t)reg[1] | ((uint32_t)reg[2] << 16);
+  uint32_t power_dW   = (uint32_t)reg[3] | ((uint32_t)reg[4] << 16);
+  uint32_t energy_Wh  = (uint32_t)reg[5] | ((uint32_t)reg[6] << 16);
+
+  reading_.t_ms       = sentMs_;
+  reading_.voltage    = reg[0] / 10.0f;
+  reading_.current    = current_mA / 1000.0f;
+  reading_.power      = power_dW / 10.0f;
+  reading_.power_dw   = power_dW;
+  reading_.energy_wh  = energy_Wh;
+  reading_.energy_kwh = energy_Wh / 1000.0f;
+  reading_.frequency  = reg[7] / 10.0f;
+  reading_.pf         = reg[8] / 100.0f;
+  reading_.alarm      = reg[9];
+  return true;
+}
+
+void PzemSnapshot::countWindow(uint32_t nowMs) {
+  if (nowMs - windowStartMs_ >= 1000) {
+    stats_.tx_per_sec = (uint16_t)windowCount_;
+    windowCount_ = 0;
+    windowStartMs_ = nowMs;
+  }
+}
+
+// Modbus RTU CRC-16 (poly 0xA001, init 0xFFFF)
+uint16_t PzemSnapshot::crc16(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+  }
+  return crc;
+}
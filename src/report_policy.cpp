@@ -0,0 +1,55 @@
+/**
+ * report_policy.cpp - Deadband / heartbeat reporting policy (see report_policy.h)
+ */
+#include "report_policy.h"
+
+static uint32_t absDiff(uint32_t a, uint32_t b) {
+  return a > b ? a - b : b - a;
+}
+
+ReportPolicy::ReportPolicy(const ReportPolicyConfig& cfg)
+    : cfg_(cfg), haveLast_(false), lastMs_(0), heartbeatMs_(cfg.heartbeatMinMs),
+      latched_(0), reports_(0), eventReports_(0) {
+  last_.sensorValid = false;
+  last_.powerDw = 0;
+  last_.voltageDv = 0;
+  last_.remainingMwh = 0;
+}
+
+uint8_t ReportPolicy::events(const ReportSample& s) const {
+  if (!haveLast_) return REPORT_FIRST;
+  uint8_t r = 0;
+  if (s.sensorValid != last_.sensorValid) r |= REPORT_SENSOR;
+  if (s.sensorValid && last_.sensorValid) {
+    uint32_t band = (uint32_t)((uint64_t)last_.powerDw * cfg_.powerDeadbandPct / 100);
+    if (band < cfg_.powerDeadbandDw) band = cfg_.powerDeadbandDw;
+    if (absDiff(s.powerDw, last_.powerDw) > band) r |= REPORT_POWER;
+    if (absDiff(s.voltageDv, last_.voltageDv) > cfg_.voltageDeadbandDv) r |= REPORT_VOLTAGE;
+  }
+  if (absDiff(s.remainingMwh, last_.remainingMwh) > cfg_.balanceDeadbandMwh) r |= REPORT_BALANCE;
+  return r;
+}
+
+uint8_t ReportPolicy::evaluate(uint32_t nowMs, const ReportSample& s) {
+  latched_ |= events(s);
+  uint32_t since = nowMs - lastMs_;
+  if (haveLast_ && since < cfg_.minIntervalMs) return 0;
+  uint8_t r = latched_;
+  if (haveLast_ && since >= heartbeatMs_) r |= REPORT_HEARTBEAT;
+  return r;
+}
+
+void ReportPolicy::reported(uint32_t nowMs, const ReportSample& s, uint8_t reasons) {
+  last_ = s;
+  haveLast_ = true;
+  lastMs_ = nowMs;
+  latched_ = 0;
+  reports_++;
+  if (reasons & REPORT_EVENTS) {
+    eventReports_++;
+    heartbeatMs_ = cfg_.heartbeatMinMs;
+  } else if (heartbeatMs_ < cfg_.heartbeatMaxMs) {
+    // Flat readings: back off
+    heartbeatMs_ = heartbeatMs_ * 2 > cfg_.heartbeatMaxMs ? cfg_.heartbeatMaxMs : heartbeatMs_ * 2;
+  }
+}
@@ -0,0 +1,200 @@
+/**
+ * scheduler.cpp - Cooperative timer-wheel scheduler (see scheduler.h)
+ */
+#include "scheduler.h"
+#include <string.h>
+
+#define SLOT_OF(ms)  (((ms) / SCHED_TICK_MS) & (SCHED_WHEEL_SLOTS - 1))
+
+// Wrap-safe: a is at or before b
+static inline bool notAfter(uint32_t a, uint32_t b) { return (int32_t)(a - b) <= 0; }
+
+Scheduler::Scheduler(SchedClock clockMs, SchedClock clockUs)
+    : clockMs_(clockMs), clockUs_(clockUs), count_(0), lastTick_(0), readyCount_(0),
+      current_(SCHED_NONE), currentStartUs_(0), worstId_(SCHED_NONE), worstUs_(0), worstAtMs_(0) {
+  memset(wheel_, SCHED_NONE, sizeof(wheel_));
+}
+
+uint8_t Scheduler::every(const char* name, uint32_t periodMs, uint8_t priority, uint32_t budgetUs,
+                         SchedFn fn, void* arg) {
+  if (periodMs == 0) return SCHED_NONE;
+  uint8_t id = add(name, periodMs, priority, budgetUs, fn, arg);
+  if (id != SCHED_NONE) start(id, periodMs);
+  return id;
+}
+
+uint8_t Scheduler::once(const char* name, uint8_t priority, uint32_t budgetUs, SchedFn fn, void* arg) {
+  return add(name, 0, priority, budgetUs, fn, arg);
+}
+
+uint8_t Scheduler::add(const char* name, uint32_t periodMs, uint8_t priority, uint32_t budgetUs,
+                       SchedFn fn, void* arg) {
+  if (count_ == SCHED_MAX_TASKS || fn == NULL) return SCHED_NONE;
+  if (count_ == 0) lastTick_ = clockMs_() / SCHED_TICK_MS;
+  Task& t = tasks_[count_];
+  t = Task();
+  t.name = name;
+  t.fn = fn;
+  t.arg = arg;
+  t.periodMs = periodMs;
+  t.budgetUs = budgetUs;
+  t.priority = priority;
+  t.next = SCHED_NONE;
+  t.state = TASK_IDLE;
+  return count_++;
+}
+
+void Scheduler::start(uint8_t id, uint32_t delayMs) {
+  if (id >= count_) return;
+  Task& t = tasks_[id];
+  if (t.state == TASK_WAITING) unlink(id);
+  t.due = clockMs_() + delayMs;
+  if (id == current_) {
+    t.restarted = true;     // linked by rearm() once it returns
+    t.state = TASK_READY;   // even after a stop() earlier in the same run
+    return;
+  }
+  link(id);  // if it was due later in this pass, it now waits instead
+}
+
+void Scheduler::stop(uint8_t id) {
+  if (id >= count_) return;
+  Task& t = tasks_[id];
+  if (t.state == TASK_WAITING) unlink(id);
+  if (id == current_) t.restarted = true;  // not rearmed when it returns
+  t.state = TASK_IDLE;                     // if due later in this pass, it is skipped
+}
+
+bool Scheduler::armed(uint8_t id) const {
+  return id < count_ && tasks_[id].state != TASK_IDLE;
+}
+
+void Scheduler::link(uint8_t id) {
+  uint8_t slot = SLOT_OF(tasks_[id].due);
+  tasks_[id].next = wheel_[slot];
+  tasks_[id].state = TASK_WAITING;
+  wheel_[slot] = id;
+}
+
+void Scheduler::unlink(uint8_t id) {
+  uint8_t* p = &wheel_[SLOT_OF(tasks_[id].due)];
+  while (*p != SCHED_NONE && *p != id) p = &tasks_[*p].next;
+  if (*p == id) *p = tasks_[id].next;
+  tasks_[id].next = SCHED_NONE;
+  tasks_[id].state = TASK_IDLE;
+}
+
+// Move the due tasks of one slot to the ready list (priority desc, then due asc)
+void Scheduler::collect(uint8_t slot, uint32_t now) {
+  uint8_t* p = &wheel_[slot];
+  while (*p != SCHED_NONE) {
+    uint8_t id = *p;
+    Task& t = tasks_[id];
+    if (!notAfter(t.due, now)) {  // a later revolution
+      p = &t.next;
+      continue;
+    }
+    *p = t.next;
+    t.next = SCHED_NONE;
+    t.state = TASK_READY;
+    t.restarted = false;
+    uint8_t i = readyCount_++;
+    while (i > 0) {
+      const Task& o = tasks_[ready_[i - 1]];
+      if (o.priority > t.priority || (o.priority == t.priority && notAfter(o.due, t.due))) break;
+      ready_[i] = ready_[i - 1];
+      i--;
+    }
+    ready_[i] = id;
+  }
+}
+
+uint32_t Scheduler::run() {
+  uint32_t now = clockMs_();
+  uint32_t tick = now / SCHED_TICK_MS;
+  uint32_t span = tick - lastTick_ + 1;  // lastTick_ itself again: tasks due later in that tick
+  if (span > SCHED_WHEEL_SLOTS) span = SCHED_WHEEL_SLOTS;
+  readyCount_ = 0;
+  for (uint32_t i = 0; i < span; i++) {
+    collect((uint8_t)((tick - i) & (SCHED_WHEEL_SLOTS - 1)), now);
+  }
+  lastTick_ = tick;
+
+  for (uint8_t r = 0; r < readyCount_; r++) {
+    uint8_t id = ready_[r];
+    Task& t = tasks_[id];
+    if (t.state != TASK_READY) continue;  // stopped by a task that ran before it
+    current_ = id;
+    currentStartUs_ = clockUs_();
+    SchedResult result = t.fn(t.arg);
+    uint32_t us = clockUs_() - currentStartUs_;
+    current_ = SCHED_NONE;
+    t.runs++;
+    if (us > t.maxUs) t.maxUs = us;
+    if (us > t.budgetUs) t.overruns++;
+    t.latency.record(us);
+    if (us > worstUs_) {
+      worstId_ = id;
+      worstUs_ = us;
+      worstAtMs_ = clockMs_();
+    }
+    rearm(id, result);
+  }
+
+  // Sleep hint: earliest due among the armed tasks
+  now = clockMs_();
+  uint32_t idle = SCHED_TICK_MS * SCHED_WHEEL_SLOTS;
+  for (uint8_t id = 0; id < count_; id++) {
+    const Task& t = tasks_[id];
+    if (t.state != TASK_WAITING) continue;
+    if (notAfter(t.due, now)) return 0;
+    if (t.due - now < idle) idle = t.due - now;
+  }
+  return idle;
+}
+
+void Scheduler::rearm(uint8_t id, SchedResult result) {
+  Task& t = tasks_[id];
+  if (t.restarted) {  // start()/stop() from inside the run wins
+    t.restarted = false;
+    if (t.state == TASK_READY) link(id);
+    return;
+  }
+  uint32_t now = clockMs_();
+  if (result == SCHED_YIELD) {
+    t.yields++;
+    t.due = now;
+  } else if (t.periodMs == 0) {
+    t.state = TASK_IDLE;
+    return;
+  } else {
+    // Keep the phase; skip the periods missed while late instead of bursting
+    t.due += t.periodMs;
+    if (notAfter(t.due, now)) t.due += ((now - t.due) / t.periodMs + 1) * t.periodMs;
+  }
+  link(id);
+}
+
+bool Scheduler::yieldDue() const {
+  return current_ != SCHED_NONE && clockUs_() - currentStartUs_ >= tasks_[current_].budgetUs;
+}
+
+SchedTaskStats Scheduler::stats(uint8_t id) const {
+  SchedTaskStats s = {};
+  if (id >= count_) return s;
+  const Task& t = tasks_[id];
+  s.name = t.name;
+  s.runs = t.runs;
+  s.yields = t.yields;
+  s.overruns = t.overruns;
+  s.maxUs = t.maxUs;
+  s.budgetUs = t.budgetUs;
+  return s;
+}
+
+void Scheduler::resetLatency() {
+  for (uint8_t id = 0; id < count_; id++) tasks_[id].latency.reset();
+  worstId_ = SCHED_NONE;
+  worstUs_ = 0;
+  worstAtMs_ = 0;
+}
@@ -0,0 +1,123 @@
+/**
+ * telemetry_codec.cpp - Compact binary telemetry frame (see telemetry_codec.h)
+ */
+#include "telemetry_codec.h"
+#include <string.h>
+
+TelemetryEncoder::TelemetryEncoder(uint8_t* buf, size_t cap)
+    : buf_(buf), cap_(cap), len_(0), version_(TCODEC_VERSION), overflow_(false) {}
+
+void TelemetryEncoder::begin(const char* meterNumber, uint8_t version) {
+  len_ = 0;
+  version_ = version;
+  overflow_ = false;
+  put8('S');
+  put8('M');
+  put8(version);
+  uint8_t meter[7];
+  packDigits(meterNumber, meter, sizeof(meter));
+  putBytes(meter, sizeof(meter));
+}
+
+void TelemetryEncoder::addIdentity(const char* clientName, const char* clientTIN, const char* clientPhone) {
+  put8(TCODEC_BLOCK_IDENTITY);
+  putString(clientName);
+  putString(clientTIN);
+  putString(clientPhone);
+}
+
+void TelemetryEncoder::addSession(const uint8_t tokenBcd[10]) {
+  put8(TCODEC_BLOCK_SESSION);
+  putBytes(tokenBcd, TCODEC_SESSION_SIZE);
+}
+
+void TelemetryEncoder::addReading(const TelemetryRecord& rec, uint32_t localEpoch) {
+  if (rec.window.samples > 0 && version_ >= 3) {
+    addWindow(rec, localEpoch);
+    return;
+  }
+  put8(TCODEC_BLOCK_READING);
+  put32(localEpoch);          //  0 epoch, local seconds (0 = unknown)
+  put32(rec.uptime_ms);       //  4
+  put16(rec.boot_seq);        //  8
+  put8(rec.flags);            // 10 TLOG_FLAG_*
+  put8(rec.pf_pct);           // 11 PF * 100
+  put32(rec.remaining_mwh);   // 12
+  put32(rec.consumed_mwh);    // 16
+  put32(rec.energy_wh);       // 20 PZEM energy register
+  put32(rec.current_ma);      // 24
+  put32(rec.power_dw);        // 28 0.1 W
+  put32(rec.session_s);       // 32
+  put16(rec.voltage_dv);      // 36 0.1 V
+  put16(rec.frequency_dhz);   // 38 0.1 Hz
+}
+
+// Statistics in TWIN_* order: min, max, mean, p95, stddev
+void TelemetryEncoder::addWindow(const TelemetryRecord& rec, uint32_t localEpoch) {
+  const TelemetryWindow& w = rec.window;
+  put8(TCODEC_BLOCK_WINDOW);
+  put32(localEpoch);          //  0 epoch, local seconds (0 = unknown)
+  put32(rec.uptime_ms);       //  4
+  put16(rec.boot_seq);        //  8
+  put8(rec.flags);            // 10 TLOG_FLAG_*
+  putBytes(w.pf_pct, TWIN_STATS);  // 11 PF * 100
+  put32(rec.remaining_mwh);   // 16
+  put32(rec.consumed_mwh);    // 20
+  put32(rec.energy_wh);       // 24 PZEM energy register
+  put32(rec.session_s);       // 28
+  put16(rec.frequency_dhz);   // 32 0.1 Hz, at capture
+  put16(w.samples);           // 34
+  put16(w.span_s);            // 36
+  for (int i = 0; i < TWIN_STATS; i++) put16(w.voltage_dv[i]);  // 38 0.1 V
+  for (int i = 0; i < TWIN_STATS; i++) put32(w.current_ma[i]);  // 48
+  for (int i = 0; i < TWIN_STATS; i++) put32(w.power_dw[i]);    // 68 0.1 W
+}
+
+void TelemetryEncoder::addLatency(uint32_t passes, uint32_t p50Us, uint32_t p99Us, uint32_t maxUs,
+                                  uint32_t worstUs, const char* worstTask) {
+  if (version_ < 2) return;
+  put8(TCODEC_BLOCK_LATENCY);
+  put32(passes);
+  put32(p50Us);
+  put32(p99Us);
+  put32(maxUs);
+  put32(worstUs);
+  putString(worstTask);
+}
+
+void TelemetryEncoder::packDigits(const char* digits, uint8_t* out, size_t outLen) {
+  memset(out, 0xFF, outLen);  // 0xF nibble = no digit
+  for (size_t i = 0; i < outLen * 2 && digits[i] >= '0' && digits[i] <= '9'; i++) {
+    uint8_t d = (uint8_t)(digits[i] - '0');
+    out[i / 2] = (i & 1) ? (uint8_t)((out[i / 2] & 0xF0) | d) : (uint8_t)((d << 4) | 0x0F);
+  }
+}
+
+void TelemetryEncoder::put8(uint8_t v) {
+  if (len_ >= cap_) {
+    overflow_ = true;
+    return;
+  }
+  buf_[len_++] = v;
+}
+
+void TelemetryEncoder::put16(uint16_t v) {
+  put8(v & 0xFF);
+  put8(v >> 8);
+}
+
+void TelemetryEncoder::put32(uint32_t v) {
+  put16(v & 0xFFFF);
+  put16(v >> 16);
+}
+
+void TelemetryEncoder::putBytes(const uint8_t* p, size_t n) {
+  for (size_t i = 0; i < n; i++) put8(p[i]);
+}
+
+void TelemetryEncoder::putString(const char* s) {
+  size_t n = strlen(s);
+  if (n > TCODEC_MAX_STR) n = TCODEC_MAX_STR;
+  put8((uint8_t)n);
+  putBytes((const uint8_t*)s, n);
+}
@@ -0,0 +1,381 @@
+/**
+ * telemetry_log.cpp - Flash-backed store-and-forward telemetry queue (see telemetry_log.h)
+ */
+#include "telemetry_log.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define TLOG_REC_SIZE ((uint32_t)sizeof(TelemetryRecord))
+
+// Record layout before window statistics, in "<seg>.seg" segments (see importLegacy())
+struct LegacyRecord {
+  uint8_t head[40];  // epoch .. frequency_dhz, same as TelemetryRecord
+  uint8_t token_bcd[10];
+  uint16_t crc;
+};
+static_assert(sizeof(LegacyRecord) == 52, "legacy record layout");
+
+TelemetryLog::TelemetryLog()
+    : fs_(NULL), budget_(0), headSeg_(1), tailSeg_(1), tailCount_(0), cursorSeg_(1), cursorIdx_(0),
+      totalBytes_(0), pending_(0), dropped_(0), corrupt_(0), acksSinceSave_(0), peekSlots_(0), bootSeq_(0),
+      readSeg_(0), sizeSeg_(0), sizeBytes_(0) {
+  dir_[0] = '\0';
+}
+
+bool TelemetryLog::begin(fs::FS& fs, const char* dir, uint32_t budgetBytes) {
+  if (strlen(dir) >= sizeof(dir_)) return false;
+  strcpy(dir_, dir);
+  budget_ = budgetBytes;
+  if (!fs.exists(dir_)) fs.mkdir(dir_);
+
+  // Scan segments: ids are contiguous from head to tail
+  uint32_t minSeg = 0, maxSeg = 0;
+  uint32_t legacyMin = 0, legacyMax = 0;
+  totalBytes_ = 0;
+  File root = fs.open(dir_);
+  if (!root || !root.isDirectory()) return false;
+  for (File f = root.openNextFile(); f; f = root.openNextFile()) {
+    const char* name = f.name();
+    const char* slash = strrchr(name, '/');
+    if (slash) name = slash + 1;
+    size_t len = strlen(name);
+    uint32_t seg = len == 12 ? strtoul(name, NULL, 16) : 0;  // "%08lx.rec" / "%08lx.seg"
+    if (seg != 0 && strcmp(name + len - 4, ".rec") == 0) {
+      if (minSeg == 0 || seg < minSeg) minSeg = seg;
+      if (seg > maxSeg) maxSeg = seg;
+      totalBytes_ += f.size();
+    } else if (seg != 0 && strcmp(name + len - 4, ".seg") == 0) {
+      if (legacyMin == 0 || seg < legacyMin) legacyMin = seg;
+      if (seg > legacyMax) legacyMax = seg;
+    }
+    f.close();
+  }
+  root.close();
+
+  fs_ = &fs;
+  if (maxSeg == 0) {
+    headSeg_ = tailSeg_ = 1;
+    tailCount_ = 0;
+  } else {
+    headSeg_ = minSeg;
+    tailSeg_ = maxSeg;
+    char path[40];
+    segPath(tailSeg_, path, sizeof(path));
+    File tail = fs.open(path, FILE_READ);
+    uint32_t size = tail ? tail.size() : 0;
+    if (tail) tail.close();
+    if (size % TLOG_REC_SIZE != 0 || size / TLOG_REC_SIZE >= TLOG_SEG_RECORDS) {
+      // Torn (power loss mid-append) or full: never append behind it
+      nextTailSegment();
+    } else {
+      tailCount_ = size / TLOG_REC_SIZE;
+    }
+  }
+
+  // Upload cursor
+  char path[40];
+  snprintf(path, sizeof(path), "%s/cursor.rec", dir_);
+  cursorSeg_ = headSeg_;
+  cursorIdx_ = 0;
+  File cf = fs.open(path, FILE_READ);
+  if (cf) {
+    uint32_t c[2];
+    if (cf.read((uint8_t*)c, sizeof(c)) == sizeof(c) && c[0] >= headSeg_ && c[0] <= tailSeg_) {
+      cursorSeg_ = c[0];
+      cursorIdx_ = c[1];
+    }
+    cf.close();
+  }
+
+  pending_ = 0;
+  for (uint32_t seg = cursorSeg_; seg <= tailSeg_; seg++) pending_ += segRecords(seg);
+  pending_ = pending_ > cursorIdx_ ? pending_ - cursorIdx_ : 0;
+
+  // Boot sequence
+  snprintf(path, sizeof(path), "%s/boot", dir_);
+  File bf = fs.open(path, FILE_READ);
+  if (bf) {
+    bf.read((uint8_t*)&bootSeq_, sizeof(bootSeq_));
+    bf.close();
+  }
+  bootSeq_++;
+  bf = fs.open(path, FILE_WRITE);
+  if (bf) {
+    bf.write((const uint8_t*)&bootSeq_, sizeof(bootSeq_));
+    bf.close();
+  }
+
+  if (legacyMax != 0) importLegacy(legacyMin, legacyMax);
+  return true;
+}
+
+// Records still waiting in segments of the layout before window statistics (after a
+// firmware update) are logged again in the current layout, without statistics, and
+// the old files removed. Each old segment is deleted once its records are on flash
+// again, so a power cut halfway logs at most that segment twice.
+void TelemetryLog::importLegacy(uint32_t firstSeg, uint32_t lastSeg) {
+  char path[40];
+  snprintf(path, sizeof(path), "%s/cursor", dir_);
+  uint32_t c[2] = {firstSeg, 0};
+  File cf = fs_->open(path, FILE_READ);
+  if (cf) {
+    if (cf.read((uint8_t*)c, sizeof(c)) != sizeof(c) || c[0] < firstSeg) {
+      c[0] = firstSeg;
+      c[1] = 0;
+    }
+    cf.close();
+  }
+
+  for (uint32_t seg = firstSeg; seg <= lastSeg; seg++) {
+    char segName[40];
+    snprintf(segName, sizeof(segName), "%s/%08lx.seg", dir_, (unsigned long)seg);
+    File f = seg >= c[0] ? fs_->open(segName, FILE_READ) : File();  // older ones were uploaded
+    if (f) {
+      LegacyRecord old;
+      for (uint32_t idx = 0; f.read((uint8_t*)&old, sizeof(old)) == sizeof(old); idx++) {
+        if (seg == c[0] && idx < c[1]) continue;
+        if (old.crc != crc16((const uint8_t*)&old, sizeof(old) - 2)) {
+          corrupt_++;
+          continue;
+        }
+        TelemetryRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        memcpy(&rec, old.head, sizeof(old.head));
+        memcpy(rec.token_bcd, old.token_bcd, sizeof(rec.token_bcd));
+        store(rec);  // keeps the record's boot_seq
+      }
+      f.close();
+    }
+    fs_->remove(segName);
+  }
+  fs_->remove(path);
+}
+
+bool TelemetryLog::append(TelemetryRecord& rec) {
+  if (!fs_) return false;
+  rec.boot_seq = bootSeq_;
+  return store(rec);
+}
+
+bool TelemetryLog::store(TelemetryRecord& rec) {
+  if (tailCount_ >= TLOG_SEG_RECORDS) nextTailSegment();
+  rec.crc = crc16((const uint8_t*)&rec, TLOG_REC_SIZE - 2);
+
+  File* f = segFile(tailSeg_);
+  if (f == NULL) return false;
+  f->seek(0, fs::SeekEnd);  // the handle may have been read from since the last append
+  size_t w = f->write((const uint8_t*)&rec, TLOG_REC_SIZE);
+  f->flush();           // fflush + fsync: on flash before we count it
+  if (w != TLOG_REC_SIZE) {
+    // Partial write: this segment is now misaligned, continue in a fresh one
+    totalBytes_ += w;
+    nextTailSegment();
+    return false;
+  }
+  tailCount_++;
+  totalBytes_ += TLOG_REC_SIZE;
+  pending_++;
+
+  // Oldest-first eviction under the byte budget (never the segment being appended to)
+  while (totalBytes_ > budget_ && headSeg_ < tailSeg_) {
+    uint32_t n = segRecords(headSeg_);
+    if (cursorSeg_ == headSeg_) {
+      uint32_t lost = n > cursorIdx_ ? n - cursorIdx_ : 0;
+      dropped_ += lost;
+      pending_ -= lost < pending_ ? lost : pending_;
+      peekSlots_ = peekSlots_ > lost ? peekSlots_ - lost : 0;  // in-flight batch lost its head
+      cursorSeg_ = headSeg_ + 1;
+      cursorIdx_ = 0;
+      acksSinceSave_ = TLOG_CURSOR_SAVE_EVERY;  // force a cursor save below
+    }
+    removeSegment(headSeg_);
+    headSeg_++;
+  }
+  if (acksSinceSave_ >= TLOG_CURSOR_SAVE_EVERY) saveCursor();
+  return true;
+}
+
+size_t TelemetryLog::peek(TelemetryRecord* out, size_t max) {
+  peekSlots_ = 0;
+  if (!fs_ || max == 0) return 0;
+  size_t n = 0;
+  uint32_t seg = cursorSeg_;
+  uint32_t idx = cursorIdx_;
+  while (n < max) {
+    uint32_t count = segRecords(seg);
+    if (idx >= count) {
+      if (seg >= tailSeg_) break;  // caught up
+      if (n == 0 && seg == headSeg_) {
+        // Segment fully uploaded: reclaim it and move the cursor on
+        removeSegment(headSeg_);
+        headSeg_++;
+        cursorSeg_ = seg + 1;
+        cursorIdx_ = 0;
+      }
+      seg++;
+      idx = 0;
+      continue;
+    }
+
+    File* f = segFile(seg);
+    if (f == NULL) break;
+    bool ok = f->seek(idx * TLOG_REC_SIZE);
+    // Read the rest of this segment in one pass
+    while (ok && n < max && idx < count) {
+      TelemetryRecord& rec = out[n];
+      if (f->read((uint8_t*)&rec, TLOG_REC_SIZE) != TLOG_REC_SIZE) {
+        ok = false;
+      } else if (rec.crc != crc16((const uint8_t*)&rec, TLOG_REC_SIZE - 2)) {
+        // return what we have; the bad record is skipped once it reaches the cursor
+        if (n > 0) return n;
+        // Torn/corrupt record at the cursor: skip it (may reclaim this segment and close f)
+        corrupt_++;
+        skipSlots(1);
+        seg = cursorSeg_;
+        idx = cursorIdx_;
+        break;
+      } else {
+        n++;
+        idx++;
+        peekSlots_++;
+      }
+    }
+    if (!ok) {
+      if (f == &read_) read_.close();  // reopened on the next peek()
+      break;
+    }
+  }
+  return n;
+}
+
+void TelemetryLog::advance() {
+  skipSlots(peekSlots_);
+  peekSlots_ = 0;
+}
+
+void TelemetryLog::skipSlots(uint32_t n) {
+  if (n == 0) return;
+  cursorIdx_ += n;
+  pending_ -= n < pending_ ? n : pending_;
+  // A batch may end in a later segment than it started in
+  while (cursorSeg_ < tailSeg_) {
+    uint32_t count = segRecords(cursorSeg_);
+    if (cursorIdx_ < count) break;
+    cursorIdx_ -= count;
+    if (cursorSeg_ == headSeg_) {
+      removeSegment(headSeg_);
+      headSeg_++;
+    }
+    cursorSeg_++;
+  }
+  acksSinceSave_ += n;
+  if (acksSinceSave_ >= TLOG_CURSOR_SAVE_EVERY || pending_ == 0) saveCursor();
+}
+
+void TelemetryLog::segPath(uint32_t seg, char* buf, size_t len) const {
+  snprintf(buf, len, "%s/%08lx.rec", dir_, (unsigned long)seg);
+}
+
+// Open handle of a segment: the tail's shared append handle, else the read handle
+// (moved to seg if it was on another one). NULL when the file cannot be opened.
+File* TelemetryLog::segFile(uint32_t seg) {
+  File* f = (seg == tailSeg_) ? &tail_ : &read_;
+  if (f == &read_ && readSeg_ != seg) {
+    read_.close();
+    readSeg_ = seg;
+  }
+  if (!*f) {
+    char path[40];
+    segPath(seg, path, sizeof(path));
+    *f = fs_->open(path, f == &tail_ ? "a+" : FILE_READ);
+  }
+  return *f ? f : NULL;
+}
+
+void TelemetryLog::nextTailSegment() {
+  tail_.close();
+  tailSeg_++;
+  tailCount_ = 0;
+}
+
+// Size of a segment other than the tail (those never change once the tail moved on)
+uint32_t TelemetryLog::segBytes(uint32_t seg) {
+  if (seg == sizeSeg_) return sizeBytes_;
+  uint32_t size = 0;
+  if (seg == readSeg_ && read_) {
+    size = read_.size();
+  } else {
+    char path[40];
+    segPath(seg, path, sizeof(path));
+    File f = fs_->open(path, FILE_READ);
+    if (!f) return 0;
+    size = f.size();
+    f.close();
+  }
+  sizeSeg_ = seg;
+  sizeBytes_ = size;
+  return size;
+}
+
+uint32_t TelemetryLog::segRecords(uint32_t seg) {
+  if (seg == tailSeg_) return tailCount_;
+  return segBytes(seg) / TLOG_REC_SIZE;
+}
+
+void TelemetryLog::removeSegment(uint32_t seg) {
+  uint32_t size = segBytes(seg);
+  totalBytes_ -= size < totalBytes_ ? size : totalBytes_;
+  if (seg == readSeg_) {
+    read_.close();
+    readSeg_ = 0;
+  }
+  if (seg == sizeSeg_) sizeSeg_ = 0;
+  char path[40];
+  segPath(seg, path, sizeof(path));
+  fs_->remove(path);
+}
+
+void TelemetryLog::saveCursor() {
+  if (!cursorFile_) {
+    char path[40];
+    snprintf(path, sizeof(path), "%s/cursor.rec", dir_);
+    cursorFile_ = fs_->open(path, fs_->exists(path) ? "r+" : "w+");
+    if (!cursorFile_) return;
+  }
+  uint32_t c[2] = {cursorSeg_, cursorIdx_};
+  cursorFile_.seek(0);
+  cursorFile_.write((const uint8_t*)c, sizeof(c));
+  cursorFile_.flush();
+  acksSinceSave_ = 0;
+}
+
+void TelemetryLog::packToken(const char* digits, uint8_t out[10]) {
+  memset(out, 0xFF, 10);  // 0xF nibble = no digit
+  for (int i = 0; i < 20 && digits[i] >= '0' && digits[i] <= '9'; i++) {
+    uint8_t d = (uint8_t)(digits[i] - '0');
+    out[i / 2] = (i & 1) ? (uint8_t)((out[i / 2] & 0xF0) | d) : (uint8_t)((d << 4) | 0x0F);
+  }
+}
+
+void TelemetryLog::unpackToken(const uint8_t in[10], char out[21]) {
+  int n = 0;
+  for (int i = 0; i < 20; i++) {
+    uint8_t d = (i & 1) ? (in[i / 2] & 0x0F) : (in[i / 2] >> 4);
+    if (d > 9) break;
+    out[n++] = (char)('0' + d);
+  }
+  out[n] = '\0';
+}
+
+// CRC-16/MODBUS, same polynomial as the PZEM link
+uint16_t TelemetryLog::crc16(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+  }
+  return crc;
+}
@@ -0,0 +1,402 @@
+/**
+ * time_sync.cpp - Non-blocking multi-server NTP client and disciplined clock (see time_sync.h)
+ */
+#include "time_sync.h"
+#include <string.h>
+
+#define NTP_UNIX_OFFSET_S   2208988800LL   // 1900-01-01 -> 1970-01-01
+#define NTP_ERA_S           4294967296LL
+#define NTP_RX_BYTES        68             // header + key id + MAC, the rest is dropped
+#define NTP_DISPERSION_PPM  15             // distance added per second of sample age (RFC 5905 PHI)
+#define NO_SERVER           0xFF
+
+static const char ISO_UNSYNCED[] = "1970-01-01T00:00:00";
+
+static inline uint32_t be32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint64_t be64(const uint8_t* p) {
+  return ((uint64_t)be32(p) << 32) | be32(p + 4);
+}
+
+static inline void putBe64(uint8_t* p, uint64_t v) {
+  for (int i = 7; i >= 0; i--) { p[i] = (uint8_t)v; v >>= 8; }
+}
+
+// NTP timestamp -> microseconds since the Unix epoch; seconds below 2^31 are era 1 (from 2036)
+static int64_t ntpToUnixUs(uint64_t ts) {
+  uint32_t sec = (uint32_t)(ts >> 32);
+  int64_t s = (int64_t)sec - NTP_UNIX_OFFSET_S;
+  if (sec < 0x80000000u) s += NTP_ERA_S;
+  return s * 1000000 + (int64_t)(((ts & 0xFFFFFFFFu) * 1000000) >> 32);
+}
+
+// NTP short format (16.16 seconds) -> microseconds
+static inline uint32_t shortToUs(uint32_t v) {
+  return (uint32_t)(((uint64_t)v * 1000000) >> 16);
+}
+
+static inline int64_t absI64(int64_t v) { return v < 0 ? -v : v; }
+
+static inline int32_t clampI32(int64_t v) {
+  return v > INT32_MAX ? INT32_MAX : (v < INT32_MIN ? INT32_MIN : (int32_t)v);
+}
+
+// splitmix64: request nonces nobody off-path can guess from the previous one
+static uint64_t mix64(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ull;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+static inline void put2(char* p, uint32_t v) {
+  p[0] = (char)('0' + v / 10);
+  p[1] = (char)('0' + v % 10);
+}
+
+TimeSync::TimeSync(SchedClock clockUs)
+    : clockUs_(clockUs), udp_(NULL), lastRawUs_(0), highUs_(0), serverCount_(0), selected_(NO_SERVER),
+      inRound_(false), roundStartUs_(0), nextRoundUs_(0), retryMs_(NTP_RETRY_MIN_MS), pollMs_(NTP_POLL_MIN_MS),
+      nonceSeq_(0), synced_(false), baseLocalUs_(0), baseUtcUs_(0), freqPpb_(0), slewUs_(0), haveAnchor_(false),
+      lastErrorUs_(0), lastSyncUs_(0), steps_(0), syncs_(0), localOffsetS_(0), isoEpoch_(0) {
+  memset(servers_, 0, sizeof(servers_));
+  memset(&anchor_, 0, sizeof(anchor_));
+  memcpy(iso_, ISO_UNSYNCED, sizeof(iso_));
+}
+
+bool TimeSync::addServer(const char* host) {
+  if (serverCount_ == NTP_MAX_SERVERS || host == NULL) return false;
+  servers_[serverCount_++].stats.host = host;
+  return true;
+}
+
+void TimeSync::begin(HalUdp* udp) {
+  udp_ = udp;
+  lastRawUs_ = clockUs_();
+  highUs_ = lastRawUs_;
+  nextRoundUs_ = highUs_;
+}
+
+void TimeSync::resync() {
+  retryMs_ = NTP_RETRY_MIN_MS;
+  if (!inRound_) nextRoundUs_ = localUs();
+}
+
+// Wrap-safe as long as something reads the clock at least every 71 minutes (poll() does)
+uint64_t TimeSync::localUs() {
+  uint32_t raw = clockUs_();
+  highUs_ += (uint32_t)(raw - lastRawUs_);
+  lastRawUs_ = raw;
+  return highUs_;
+}
+
+uint32_t TimeSync::poll() {
+  if (udp_ == NULL || serverCount_ == 0) return NTP_RETRY_MAX_MS;
+  uint64_t now = localUs();
+  if (synced_ && now - baseLocalUs_ > 3600000000ull) rebase(now);  // holdover: keep dt small
+  if (!inRound_) {
+    if ((int64_t)(nextRoundUs_ - now) > 0) {
+      uint64_t waitMs = (nextRoundUs_ - now + 999) / 1000;
+      return waitMs > NTP_POLL_MAX_MS ? NTP_POLL_MAX_MS : (uint32_t)waitMs;
+    }
+    startRound(now);
+  }
+  sendPending(now);
+  receive(now);
+
+  bool outstanding = false;
+  for (uint8_t i = 0; i < serverCount_; i++) outstanding |= servers_[i].queued || servers_[i].pending;
+  if (outstanding && now - roundStartUs_ < (uint64_t)NTP_ROUND_TIMEOUT_MS * 1000) return NTP_RX_POLL_MS;
+  finishRound(now);
+  return (uint32_t)((nextRoundUs_ - now) / 1000);
+}
+
+// ------ Exchange ------
+
+void TimeSync::startRound(uint64_t now) {
+  inRound_ = true;
+  roundStartUs_ = now;
+  for (uint8_t i = 0; i < serverCount_; i++) {
+    Server& s = servers_[i];
+    s.pending = s.answered = false;
+    s.queued = (int64_t)(s.silentUntilUs - now) <= 0;
+  }
+}
+
+void TimeSync::sendPending(uint64_t now) {
+  uint8_t pkt[NTP_PACKET_BYTES];
+  for (uint8_t i = 0; i < serverCount_; i++) {
+    Server& s = servers_[i];
+    if (!s.queued) continue;
+    memset(pkt, 0, sizeof(pkt));
+    pkt[0] = (0 << 6) | (4 << 3) | 3;  // no leap warning, version 4, client
+    // The transmit timestamp only has to come back as the origin: a random value
+    // matches the reply to its server and does not reveal the local clock
+    uint64_t nonce = mix64(now ^ ((uint64_t)++nonceSeq_ << 40) ^ i);
+    putBe64(pkt + 40, nonce);
+    uint64_t sentUs = localUs();
+    if (!udp_->send(s.stats.host, NTP_PORT, pkt, sizeof(pkt))) continue;  // retried on the next poll()
+    s.nonce = nonce;
+    s.sentUs = sentUs;
+    s.queued = false;
+    s.pending = true;
+    s.stats.sent++;
+  }
+}
+
+void TimeSync::receive(uint64_t now) {
+  uint8_t buf[NTP_RX_BYTES];
+  size_t len;
+  while ((len = udp_->receive(buf, sizeof(buf))) != 0) {
+    uint64_t t4 = localUs();
+    if (len < NTP_PACKET_BYTES) continue;
+    uint64_t origin = be64(buf + 24);
+    uint8_t i = 0;
+    while (i < serverCount_ && !(servers_[i].pending && servers_[i].nonce == origin)) i++;
+    if (i == serverCount_) continue;  // late, duplicate or not ours
+    Server& s = servers_[i];
+    s.pending = false;
+
+    uint8_t leap = buf[0] >> 6, version = (buf[0] >> 3) & 7, mode = buf[0] & 7;
+    uint8_t stratum = buf[1];
+    uint64_t rxTs = be64(buf + 32), txTs = be64(buf + 40);
+    if (stratum == 0) {  // kiss-o'-death (RATE, DENY, RSTR): leave this server alone for a while
+      s.silentUntilUs = now + (uint64_t)NTP_KOD_BACKOFF_MS * 1000;
+      s.stats.rejected++;
+      continue;
+    }
+    if (mode != 4 || version < 3 || leap == 3 || stratum > 15 || rxTs == 0 || txTs == 0) {
+      s.stats.rejected++;
+      continue;
+    }
+    int64_t t1 = (int64_t)s.sentUs, t2 = ntpToUnixUs(rxTs), t3 = ntpToUnixUs(txTs);
+    int64_t elapsed = (int64_t)(t4 - s.sentUs);
+    int64_t serverTime = t3 - t2;
+    if (serverTime < 0 || serverTime > elapsed) {
+      s.stats.rejected++;
+      continue;
+    }
+    Sample& smp = s.samples[s.sampleNext];
+    smp.rttUs = (uint32_t)(elapsed - serverTime);
+    smp.localUs = s.sentUs + (uint64_t)(elapsed / 2);
+    smp.offsetUs = ((t2 - t1) + (t3 - (int64_t)t4)) / 2;
+    smp.rootUs = shortToUs(be32(buf + 4)) / 2 + shortToUs(be32(buf + 8));
+    s.sampleNext = (s.sampleNext + 1) % NTP_FILTER_SAMPLES;
+    if (s.sampleCount < NTP_FILTER_SAMPLES) s.sampleCount++;
+    s.answered = true;
+    s.stats.replies++;
+    s.stats.stratum = stratum;
+  }
+}
+
+// Sample of the register with the lowest RTT, counting older samples as further away
+// (RFC 5905 dispersion), carried forward to now on the drift estimate
+bool TimeSync::bestSample(const Server& s, uint64_t now, Sample& out) const {
+  if (s.sampleCount == 0) return false;
+  const Sample* best = NULL;
+  uint64_t bestDist = 0;
+  for (uint8_t k = 0; k < s.sampleCount; k++) {
+    const Sample& c = s.samples[k];
+    uint64_t dist = c.rttUs / 2 + (now - c.localUs) / 1000000 * NTP_DISPERSION_PPM;
+    if (best == NULL || dist < bestDist) {
+      best = &c;
+      bestDist = dist;
+    }
+  }
+  int64_t age = (int64_t)(now - best->localUs);
+  out = *best;
+  out.offsetUs += age * freqPpb_ / 1000000000;
+  out.localUs = now;
+  out.rootUs += (uint32_t)(age / 1000000 * NTP_DISPERSION_PPM);
+  return true;
+}
+
+void TimeSync::finishRound(uint64_t now) {
+  inRound_ = false;
+  Sample cand[NTP_MAX_SERVERS];
+  uint8_t idx[NTP_MAX_SERVERS];
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < serverCount_; i++) {
+    Server& s = servers_[i];
+    if (s.queued || s.pending) s.stats.lost++;
+    bool answered = s.answered;
+    s.queued = s.pending = s.answered = false;
+    s.stats.falseticker = false;
+    if (!answered || !bestSample(s, now, cand[n])) continue;
+    // Against the disciplined clock once there is one, so a healthy server reads near 0
+    s.stats.offsetUs = clampI32(synced_ ? cand[n].offsetUs + (int64_t)now - utcAt(now) : cand[n].offsetUs);
+    s.stats.rttUs = cand[n].rttUs;
+    idx[n++] = i;
+  }
+
+  // Intersection: the point covered by the most correctness intervals (one of the
+  // lower ends); intervals that miss it are falsetickers. With three or more servers
+  // the survivors must be a majority, else nothing this round is trusted; with one
+  // or two there is nothing to vote with and the closer one wins.
+  int64_t lo[NTP_MAX_SERVERS], hi[NTP_MAX_SERVERS];
+  for (uint8_t k = 0; k < n; k++) {
+    int64_t dist = cand[k].rttUs / 2 + cand[k].rootUs;
+    lo[k] = cand[k].offsetUs - dist;
+    hi[k] = cand[k].offsetUs + dist;
+  }
+  uint8_t bestCount = 0;
+  int64_t point = 0;
+  for (uint8_t k = 0; k < n; k++) {
+    uint8_t count = 0;
+    for (uint8_t j = 0; j < n; j++) count += lo[j] <= lo[k] && lo[k] <= hi[j];
+    if (count > bestCount) { bestCount = count; point = lo[k]; }
+  }
+  bool vote = n >= 3;
+  uint8_t pick = NO_SERVER;
+  for (uint8_t k = 0; k < n && (!vote || bestCount * 2 > n); k++) {
+    bool truechimer = !vote || (lo[k] <= point && point <= hi[k]);
+    servers_[idx[k]].stats.falseticker = !truechimer;
+    if (!truechimer) continue;
+    if (pick == NO_SERVER ||
+        cand[k].rttUs / 2 + cand[k].rootUs < cand[pick].rttUs / 2 + cand[pick].rootUs) {
+      pick = k;
+    }
+  }
+  // Two that disagree: once synced, keep following the one that agrees with the clock
+  // instead of flipping between them whenever the RTTs change order
+  if (!vote && n == 2 && bestCount < 2 && synced_) {
+    int64_t e0 = absI64(cand[0].offsetUs + (int64_t)now - utcAt(now));
+    int64_t e1 = absI64(cand[1].offsetUs + (int64_t)now - utcAt(now));
+    pick = e0 <= e1 ? 0 : 1;
+    servers_[idx[1 - pick]].stats.falseticker = true;
+  }
+  if (pick == NO_SERVER) {  // no reply, or no majority
+    nextRoundUs_ = now + (uint64_t)retryMs_ * 1000;
+    retryMs_ = retryMs_ * 2 > NTP_RETRY_MAX_MS ? NTP_RETRY_MAX_MS : retryMs_ * 2;
+    return;
+  }
+  selected_ = idx[pick];
+  discipline(cand[pick], now);
+  retryMs_ = NTP_RETRY_MIN_MS;
+  nextRoundUs_ = now + (uint64_t)pollMs_ * 1000;
+}
+
+// ------ Clock ------
+
+// Part of slewUs_ applied between baseLocalUs_ and local
+int64_t TimeSync::slewAt(uint64_t local) const {
+  int64_t dt = (int64_t)(local - baseLocalUs_);
+  if (dt <= 0 || slewUs_ == 0) return 0;
+  int64_t reach = dt * NTP_SLEW_PPM / 1000000;
+  if (slewUs_ > 0) return reach < slewUs_ ? reach : slewUs_;
+  return reach < -slewUs_ ? -reach : slewUs_;
+}
+
+int64_t TimeSync::utcAt(uint64_t local) const {
+  int64_t dt = (int64_t)(local - baseLocalUs_);
+  return baseUtcUs_ + dt + dt * freqPpb_ / 1000000000 + slewAt(local);
+}
+
+void TimeSync::rebase(uint64_t local) {
+  int64_t utc = utcAt(local);
+  slewUs_ -= slewAt(local);
+  baseLocalUs_ = local;
+  baseUtcUs_ = utc;
+}
+
+void TimeSync::discipline(const Sample& s, uint64_t now) {
+  syncs_++;
+  lastSyncUs_ = now;
+
+  // Drift: slope of the raw offset since the anchor, once the baseline is long
+  // enough for the network jitter to average out
+  if (!haveAnchor_) {
+    anchor_ = s;
+    haveAnchor_ = true;
+  } else {
+    int64_t baseline = (int64_t)(s.localUs - anchor_.localUs);
+    if (baseline >= (int64_t)NTP_FREQ_MIN_BASELINE_MS * 1000) {
+      int64_t ppb = (s.offsetUs - anchor_.offsetUs) * 1000000000 / baseline;
+      if (absI64(ppb) <= NTP_MAX_FREQ_PPB) {
+        rebase(now);  // the new rate only applies from here on
+        freqPpb_ = (int32_t)ppb;
+      }
+      if (baseline >= (int64_t)NTP_FREQ_MAX_BASELINE_MS * 1000) anchor_ = s;
+    }
+  }
+
+  int64_t err = synced_ ? s.offsetUs + (int64_t)s.localUs - utcAt(s.localUs) : 0;
+  lastErrorUs_ = clampI32(err);
+  if (!synced_ || absI64(err) > NTP_STEP_US) {
+    baseLocalUs_ = s.localUs;
+    baseUtcUs_ = (int64_t)s.localUs + s.offsetUs;
+    slewUs_ = 0;
+    if (synced_) anchor_ = s;  // whatever made the clock jump also spoils the baseline
+    synced_ = true;
+    pollMs_ = NTP_POLL_MIN_MS;
+    steps_++;
+    return;
+  }
+  rebase(now);
+  slewUs_ = err;
+  if (absI64(err) < NTP_STABLE_US) {
+    pollMs_ = pollMs_ * 2 > NTP_POLL_MAX_MS ? NTP_POLL_MAX_MS : pollMs_ * 2;
+  } else {
+    pollMs_ = pollMs_ / 2 < NTP_POLL_MIN_MS ? NTP_POLL_MIN_MS : pollMs_ / 2;
+  }
+}
+
+int64_t TimeSync::utcMicros() {
+  return synced_ ? utcAt(localUs()) : 0;
+}
+
+uint32_t TimeSync::lastSyncAgeMs() {
+  if (!synced_) return UINT32_MAX;
+  uint64_t age = (localUs() - lastSyncUs_) / 1000;
+  return age > UINT32_MAX ? UINT32_MAX : (uint32_t)age;
+}
+
+// ------ ISO 8601 ------
+
+const char* TimeSync::isoLocal() {
+  if (!synced_) return ISO_UNSYNCED;
+  uint32_t epoch = localEpoch();
+  if (epoch != isoEpoch_) refreshIso(epoch);
+  return iso_;
+}
+
+void TimeSync::refreshIso(uint32_t epoch) {
+  if (isoEpoch_ != 0 && epoch / 86400 == isoEpoch_ / 86400) {
+    uint32_t sod = epoch % 86400;
+    put2(iso_ + 11, sod / 3600);
+    put2(iso_ + 14, sod / 60 % 60);
+    put2(iso_ + 17, sod % 60);
+  } else {
+    formatIso(epoch, iso_);
+  }
+  isoEpoch_ = epoch;
+}
+
+// Days to civil date (H. Hinnant, "chrono-compatible low-level date algorithms")
+void TimeSync::formatIso(uint32_t epoch, char* buf) {
+  uint32_t z = epoch / 86400 + 719468;
+  uint32_t era = z / 146097;
+  uint32_t doe = z - era * 146097;
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp = (5 * doy + 2) / 153;
+  uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+  uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+  uint32_t year = yoe + era * 400 + (month <= 2);
+  uint32_t sod = epoch % 86400;
+  put2(buf, year / 100 % 100);
+  put2(buf + 2, year % 100);
+  buf[4] = '-';
+  put2(buf + 5, month);
+  buf[7] = '-';
+  put2(buf + 8, day);
+  buf[10] = 'T';
+  put2(buf + 11, sod / 3600);
+  buf[13] = ':';
+  put2(buf + 14, sod / 60 % 60);
+  buf[16] = ':';
+  put2(buf + 17, sod % 60);
+  buf[NTP_ISO_LEN] = '\0';
+}
@@ -0,0 +1,245 @@
+/**
+ * tls_session_client.cpp - TLS client with session resumption (see tls_session_client.h)
+ */
+#include "tls_session_client.h"
+#include <WiFi.h>
+#include <string.h>
+#include <errno.h>
+#include "lwip/sockets.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/version.h"
+
+#define TLS_DEFAULT_TIMEOUT_MS 10000  // for the plain Client::connect(host, port)
+
+TlsSessionClient::TlsSessionClient()
+    : sock_(-1), open_(false), seeded_(false), peeked_(-1), lastIoWasSend_(false), haveSession_(false),
+      fullHandshakes_(0), resumedHandshakes_(0), lastHandshakeMs_(0) {
+  mbedtls_ssl_init(&ssl_);
+  mbedtls_ssl_config_init(&conf_);
+  mbedtls_entropy_init(&entropy_);
+  mbedtls_ctr_drbg_init(&drbg_);
+  mbedtls_ssl_session_init(&session_);
+}
+
+TlsSessionClient::~TlsSessionClient() {
+  stop();
+  mbedtls_ssl_session_free(&session_);
+  mbedtls_ssl_free(&ssl_);
+  mbedtls_ssl_config_free(&conf_);
+  mbedtls_ctr_drbg_free(&drbg_);
+  mbedtls_entropy_free(&entropy_);
+}
+
+// Seed the RNG and build the config once; both are reused by every connection
+bool TlsSessionClient::initContext() {
+  if (seeded_) return true;
+  static const char pers[] = "smartmeter-tls";
+  if (mbedtls_ctr_drbg_seed(&drbg_, mbedtls_entropy_func, &entropy_,
+                            (const unsigned char*)pers, sizeof(pers) - 1) != 0) {
+    return false;
+  }
+  if (mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                  MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+    return false;
+  }
+  mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_NONE);  // as WiFiClientSecure::setInsecure()
+  mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &drbg_);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  mbedtls_ssl_conf_session_tickets(&conf_, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3) && MBEDTLS_VERSION_NUMBER >= 0x03020000
+  // Resumption and the full/resumed count below are TLS 1.2's (mbedTLS 3 can negotiate 1.3)
+  mbedtls_ssl_conf_max_tls_version(&conf_, MBEDTLS_SSL_VERSION_TLS1_2);
+#endif
+  seeded_ = true;
+  return true;
+}
+
+int TlsSessionClient::connect(IPAddress ip, uint16_t port, const char* host, uint32_t timeoutMs) {
+  stop();
+  if (!initContext()) return 0;
+  uint32_t t0 = millis();
+  if (!tcpConnect(ip, port, timeoutMs)) return 0;
+
+  if (mbedtls_ssl_setup(&ssl_, &conf_) != 0 || mbedtls_ssl_set_hostname(&ssl_, host) != 0) {
+    stop();
+    return 0;
+  }
+  mbedtls_ssl_set_bio(&ssl_, this, bioSend, bioRecv, NULL);
+  bool offered = haveSession_ && mbedtls_ssl_set_session(&ssl_, &session_) == 0;
+
+  for (;;) {
+    int ret = mbedtls_ssl_handshake(&ssl_);
+    if (ret == 0) break;
+    uint32_t elapsed = millis() - t0;
+    bool wantIo = ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE;
+    if (!wantIo || elapsed >= timeoutMs ||
+        !waitSocket(ret == MBEDTLS_ERR_SSL_WANT_WRITE, timeoutMs - elapsed)) {
+      if (!wantIo && offered) clearSession();  // protocol error: don't offer that session again
+      stop();
+      return 0;
+    }
+  }
+  lastHandshakeMs_ = millis() - t0;
+  // Told apart by who finished (RFC 5246 7.3, no private mbedTLS state needed): in a full
+  // handshake the server's Finished is the last flight, in an abbreviated one the server
+  // sends its Finished right after ServerHello and the client's Finished ends it
+  if (offered && lastIoWasSend_) resumedHandshakes_++;
+  else fullHandshakes_++;
+
+  // Keep this session (ID and/or ticket) for the next connect
+  mbedtls_ssl_session_free(&session_);
+  mbedtls_ssl_session_init(&session_);
+  haveSession_ = mbedtls_ssl_get_session(&ssl_, &session_) == 0;
+
+  open_ = true;
+  return 1;
+}
+
+int TlsSessionClient::connect(IPAddress /*ip*/, uint16_t /*port*/) {
+  return 0;  // SNI needs the host name: use connect(ip, port, host, timeoutMs)
+}
+
+int TlsSessionClient::connect(const char* host, uint16_t port) {
+  IPAddress ip;
+  if (!WiFi.hostByName(host, ip)) return 0;
+  return connect(ip, port, host, TLS_DEFAULT_TIMEOUT_MS);
+}
+
+bool TlsSessionClient::tcpConnect(IPAddress ip, uint16_t port, uint32_t timeoutMs) {
+  sock_ = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (sock_ < 0) return false;
+  int flags = lwip_fcntl(sock_, F_GETFL, 0);
+  lwip_fcntl(sock_, F_SETFL, flags | O_NONBLOCK);
+  int one = 1;
+  lwip_setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = (uint32_t)ip;
+  int ret = lwip_connect(sock_, (struct sockaddr*)&addr, sizeof(addr));
+  if (ret < 0 && errno == EINPROGRESS && waitSocket(true, timeoutMs)) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    lwip_getsockopt(sock_, SOL_SOCKET, SO_ERROR, &err, &len);
+    ret = err == 0 ? 0 : -1;
+  }
+  if (ret < 0) {
+    lwip_close(sock_);
+    sock_ = -1;
+    return false;
+  }
+  return true;
+}
+
+bool TlsSessionClient::waitSocket(bool forWrite, uint32_t timeoutMs) {
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(sock_, &fds);
+  struct timeval tv;
+  tv.tv_sec = timeoutMs / 1000;
+  tv.tv_usec = (timeoutMs % 1000) * 1000;
+  int ret = forWrite ? lwip_select(sock_ + 1, NULL, &fds, NULL, &tv)
+                     : lwip_select(sock_ + 1, &fds, NULL, NULL, &tv);
+  return ret > 0;
+}
+
+int TlsSessionClient::bioSend(void* ctx, const unsigned char* buf, size_t len) {
+  TlsSessionClient* self = (TlsSessionClient*)ctx;
+  self->lastIoWasSend_ = true;
+  int ret = lwip_send(self->sock_, buf, len, 0);
+  if (ret < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+  }
+  return ret;
+}
+
+int TlsSessionClient::bioRecv(void* ctx, unsigned char* buf, size_t len) {
+  TlsSessionClient* self = (TlsSessionClient*)ctx;
+  self->lastIoWasSend_ = false;
+  int ret = lwip_recv(self->sock_, buf, len, 0);
+  if (ret < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+  }
+  return ret;  // 0 = peer closed the TCP connection
+}
+
+size_t TlsSessionClient::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t TlsSessionClient::write(const uint8_t* buf, size_t size) {
+  if (!open_) return 0;
+  int ret = mbedtls_ssl_write(&ssl_, buf, size);
+  if (ret > 0) return (size_t)ret;
+  if (ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != MBEDTLS_ERR_SSL_WANT_READ) open_ = false;
+  return 0;  // socket buffer full: call again with the same data
+}
+
+int TlsSessionClient::available() {
+  if (sock_ < 0) return 0;
+  int n = (int)mbedtls_ssl_get_bytes_avail(&ssl_);
+  if (n == 0 && open_) {
+    // Let mbedTLS pull and decrypt the next record if one has arrived
+    int ret = mbedtls_ssl_read(&ssl_, NULL, 0);
+    if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      open_ = false;  // close_notify, EOF or error
+    }
+    n = (int)mbedtls_ssl_get_bytes_avail(&ssl_);
+  }
+  return n + (peeked_ >= 0 ? 1 : 0);
+}
+
+int TlsSessionClient::read() {
+  uint8_t b;
+  return read(&b, 1) == 1 ? b : -1;
+}
+
+int TlsSessionClient::read(uint8_t* buf, size_t size) {
+  if (size == 0 || sock_ < 0) return -1;
+  int n = 0;
+  if (peeked_ >= 0) {
+    buf[n++] = (uint8_t)peeked_;
+    peeked_ = -1;
+    if (--size == 0) return n;
+  }
+  if (!open_ && mbedtls_ssl_get_bytes_avail(&ssl_) == 0) return n > 0 ? n : -1;
+  int ret = mbedtls_ssl_read(&ssl_, buf + n, size);
+  if (ret > 0) return n + ret;
+  if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) open_ = false;
+  return n > 0 ? n : -1;
+}
+
+int TlsSessionClient::peek() {
+  if (peeked_ < 0) {
+    uint8_t b;
+    if (read(&b, 1) == 1) peeked_ = b;
+  }
+  return peeked_;
+}
+
+void TlsSessionClient::stop() {
+  if (sock_ >= 0) {
+    if (open_) mbedtls_ssl_close_notify(&ssl_);  // best effort, non-blocking
+    lwip_close(sock_);
+    sock_ = -1;
+  }
+  mbedtls_ssl_free(&ssl_);  // releases the record buffers between connections
+  mbedtls_ssl_init(&ssl_);
+  open_ = false;
+  peeked_ = -1;
+}
+
+uint8_t TlsSessionClient::connected() {
+  if (sock_ < 0) return 0;
+  int n = available();  // notices a close_notify / FIN that arrived while idle
+  return open_ || n > 0;
+}
+
+void TlsSessionClient::clearSession() {
+  mbedtls_ssl_session_free(&session_);
+  mbedtls_ssl_session_init(&session_);
+  haveSession_ = false;
+}
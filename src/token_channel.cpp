@@ -0,0 +1,99 @@
+/**
+ * token_channel.cpp - WebSocket push channel for purchased tokens (see token_channel.h)
+ */
+#include "token_channel.h"
+#include <WiFi.h>
+#include <ArduinoJson.h>
+#include <string.h>
+
+#define TOKEN_CHANNEL_TASK_CORE     0
+#define TOKEN_CHANNEL_TASK_PRIORITY 1     // below the metering task: billing always wins
+#define TOKEN_CHANNEL_TASK_STACK    8192  // TLS handshake runs on this stack
+#define TOKEN_CHANNEL_TICK_MS       10
+
+TokenChannel::TokenChannel()
+    : task_(NULL), connected_(false), connects_(0), tokensPushed_(0), confirmsAcked_(0) {}
+
+bool TokenChannel::begin(const char* host, uint16_t port, bool secure, const char* path, const char* meterNumber,
+                         const char* key) {
+  if (secure) {
+    ws_.beginSSL(host, port, path);  // no fingerprint: same trust model as the HTTPS client
+  } else {
+    ws_.begin(host, port, path);
+  }
+  ws_.setAuthorization(meterNumber, key);
+  ws_.onEvent([this](WStype_t type, uint8_t* payload, size_t length) { onEvent(type, payload, length); });
+  ws_.setReconnectInterval(TOKEN_CHANNEL_RECONNECT_MS);
+  ws_.enableHeartbeat(TOKEN_CHANNEL_PING_MS, TOKEN_CHANNEL_PONG_MS, 2);
+
+  if (task_ == NULL) {
+    xTaskCreatePinnedToCore(task, "token-ws", TOKEN_CHANNEL_TASK_STACK, this,
+                            TOKEN_CHANNEL_TASK_PRIORITY, &task_, TOKEN_CHANNEL_TASK_CORE);
+  }
+  return task_ != NULL;
+}
+
+bool TokenChannel::confirm(const char* purchaseId) {
+  if (!connected() || strlen(purchaseId) >= sizeof(TokenConfirm::purchaseId)) return false;
+  TokenConfirm c;
+  strcpy(c.purchaseId, purchaseId);
+  return outbox_.push(c);
+}
+
+void TokenChannel::task(void* arg) {
+  TokenChannel* self = static_cast<TokenChannel*>(arg);
+  for (;;) {
+    if (WiFi.status() == WL_CONNECTED) {
+      self->ws_.loop();  // connects/reconnects here, blocking this task only
+      TokenConfirm c;
+      while (self->connected() && self->outbox_.pop(c)) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "{\"type\":\"confirm\",\"purchaseId\":\"%s\"}", c.purchaseId);
+        self->ws_.sendTXT(msg);
+      }
+    } else if (self->connected()) {
+      self->ws_.disconnect();
+      self->connected_.store(false, std::memory_order_release);
+    }
+    vTaskDelay(pdMS_TO_TICKS(TOKEN_CHANNEL_TICK_MS));
+  }
+}
+
+// Runs in the socket task (called from ws_.loop())
+void TokenChannel::onEvent(WStype_t type, uint8_t* payload, size_t length) {
+  switch (type) {
+    case WStype_CONNECTED:
+      connects_++;
+      connected_.store(true, std::memory_order_release);
+      break;
+    case WStype_DISCONNECTED:
+      connected_.store(false, std::memory_order_release);
+      break;
+    case WStype_TEXT:
+      handleText((const char*)payload, length);
+      break;
+    default:
+      break;
+  }
+}
+
+void TokenChannel::handleText(const char* text, size_t len) {
+  StaticJsonDocument<384> doc;
+  if (deserializeJson(doc, text, len)) return;
+  const char* type = doc["type"] | "";
+
+  if (strcmp(type, "token") == 0) {
+    const char* id = doc["purchaseId"] | "";
+    const char* number = doc["tokenNumber"] | "";
+    PushedToken t;
+    if (id[0] == '\0' || strlen(id) >= sizeof(t.purchaseId) || strlen(number) != sizeof(t.tokenNumber) - 1) {
+      return;
+    }
+    strcpy(t.purchaseId, id);
+    strcpy(t.tokenNumber, number);
+    t.kwhAmount = doc["kwhAmount"].as<float>();
+    if (inbox_.push(t)) tokensPushed_++;  // full inbox: the server pushes it again on reconnect
+  } else if (strcmp(type, "confirmed") == 0) {
+    confirmsAcked_++;
+  }
+}
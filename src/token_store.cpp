@@ -0,0 +1,177 @@
+/**
+ * token_store.cpp - Offline token table (see token_store.h)
+ */
+#include "token_store.h"
+#include <string.h>
+#include <stddef.h>
+
+TokenStore::TokenStore()
+    : flash_(NULL), table_(NULL), count_(0), bitmapOffset_(0),
+      ramTable_(NULL), ramUsed_(NULL), lastLookupUs_(0) {}
+
+bool TokenStore::begin(HalFlash* flash, const TokenSeed* seeds, size_t seedCount) {
+  flash_ = flash;
+  TokenRecord* recs = new TokenRecord[seedCount ? seedCount : 1];
+  size_t n = buildSorted(seeds, seedCount, recs);
+
+  if (flash_ != NULL) {
+    TokenStoreHeader h;
+    if (flash_->read(0, &h, sizeof(h))) {
+      if (h.magic == 0xFFFFFFFFUL && provision(recs, n)) {
+        flash_->read(0, &h, sizeof(h));
+      }
+      if (attach(h)) {
+        delete[] recs;
+        return true;
+      }
+    }
+    flash_ = NULL;  // corrupt table: never overwrite provisioned tokens, use the seeds
+  }
+
+  ramTable_ = recs;
+  table_ = ramTable_;
+  count_ = n;
+  ramUsed_ = new uint8_t[(n + 7) / 8 + 1];
+  memset(ramUsed_, 0xFF, (n + 7) / 8 + 1);
+  return false;
+}
+
+// Validate the header and the table, then map the table
+bool TokenStore::attach(const TokenStoreHeader& h) {
+  if (h.magic != TS_MAGIC || h.version != TS_VERSION || h.recordSize != sizeof(TokenRecord) ||
+      h.headerCrc != crc16((const uint8_t*)&h, offsetof(TokenStoreHeader, headerCrc))) {
+    return false;
+  }
+  if (h.count > flash_->size() / sizeof(TokenRecord)) return false;
+  uint32_t tableEnd = TS_TABLE_OFFSET + h.count * sizeof(TokenRecord);
+  if (h.bitmapOffset < tableEnd ||
+      h.bitmapOffset + (h.count + 7) / 8 > flash_->size()) {
+    return false;
+  }
+
+  const void* mapped = flash_->map(0, tableEnd);
+  if (mapped == NULL) return false;
+  const TokenRecord* table = (const TokenRecord*)((const uint8_t*)mapped + TS_TABLE_OFFSET);
+  bool sorted = true;
+  for (uint32_t i = 1; i < h.count && sorted; i++) {
+    sorted = memcmp(table[i - 1].key, table[i].key, TS_KEY_BYTES) < 0;
+  }
+  if (!sorted || crc16((const uint8_t*)table, h.count * sizeof(TokenRecord)) != h.tableCrc) {
+    flash_->unmap(mapped);
+    return false;
+  }
+  table_ = table;
+  count_ = h.count;
+  bitmapOffset_ = h.bitmapOffset;
+  return true;
+}
+
+// First boot: records, then an all-unused bitmap, then the header (a cut before it
+// leaves the header blank and provisioning simply runs again).
+bool TokenStore::provision(const TokenRecord* recs, size_t n) {
+  uint32_t tableEnd = TS_TABLE_OFFSET + n * sizeof(TokenRecord);
+  uint32_t bitmapBytes = (n + 7) / 8;
+  if (tableEnd + bitmapBytes > flash_->size()) return false;
+  uint32_t eraseLen = (tableEnd + bitmapBytes + 4095) & ~4095UL;
+  if (!flash_->erase(0, eraseLen)) return false;
+  if (n > 0 && !flash_->write(TS_TABLE_OFFSET, recs, n * sizeof(TokenRecord))) {
+    return false;
+  }
+
+  TokenStoreHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic = TS_MAGIC;
+  h.version = TS_VERSION;
+  h.recordSize = sizeof(TokenRecord);
+  h.count = n;
+  h.bitmapOffset = tableEnd;  // erased = every token unused
+  h.tableCrc = crc16((const uint8_t*)recs, n * sizeof(TokenRecord));
+  h.headerCrc = crc16((const uint8_t*)&h, offsetof(TokenStoreHeader, headerCrc));
+  return flash_->write(0, &h, sizeof(h));
+}
+
+TokenLookup TokenStore::find(const char* digits, int32_t& index, float& kwh) {
+  uint32_t t0 = halMicros();
+  uint8_t key[TS_KEY_BYTES];
+  TokenLookup result = TOKEN_UNKNOWN;
+  if (packKey(digits, key)) {
+    size_t lo = 0, hi = count_;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      int c = memcmp(table_[mid].key, key, TS_KEY_BYTES);
+      if (c == 0) {
+        index = (int32_t)mid;
+        kwh = table_[mid].wh / 1000.0f;
+        result = isUsed(mid) ? TOKEN_USED : TOKEN_VALID;
+        break;
+      }
+      if (c < 0) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+  }
+  lastLookupUs_ = halMicros() - t0;
+  return result;
+}
+
+bool TokenStore::markUsed(int32_t index) {
+  if (index < 0 || (size_t)index >= count_) return false;
+  uint8_t bit = (uint8_t)(1u << (index & 7));
+  if (flash_ == NULL) {
+    ramUsed_[index / 8] &= (uint8_t)~bit;
+    return true;
+  }
+  uint8_t b = (uint8_t)~bit;  // programming only clears bits: the other tokens are untouched
+  return flash_->write(bitmapOffset_ + index / 8, &b, 1);
+}
+
+// Read through the flash driver, not the mapping, so a bit cleared since boot is seen
+bool TokenStore::isUsed(size_t index) {
+  uint8_t bit = (uint8_t)(1u << (index & 7));
+  if (flash_ == NULL) return (ramUsed_[index / 8] & bit) == 0;
+  uint8_t b = 0;
+  if (!flash_->read(bitmapOffset_ + index / 8, &b, 1)) return true;
+  return (b & bit) == 0;
+}
+
+bool TokenStore::packKey(const char* digits, uint8_t key[TS_KEY_BYTES]) {
+  for (uint8_t i = 0; i < TS_KEY_BYTES * 2; i++) {
+    if (digits[i] < '0' || digits[i] > '9') return false;
+  }
+  if (digits[TS_KEY_BYTES * 2] != '\0') return false;
+  for (uint8_t i = 0; i < TS_KEY_BYTES; i++) {
+    key[i] = (uint8_t)(((digits[2 * i] - '0') << 4) | (digits[2 * i + 1] - '0'));
+  }
+  return true;
+}
+
+// Pack and insertion-sort the seeds (a handful), dropping malformed and duplicate codes
+size_t TokenStore::buildSorted(const TokenSeed* seeds, size_t seedCount, TokenRecord* out) {
+  size_t n = 0;
+  for (size_t i = 0; i < seedCount; i++) {
+    TokenRecord r;
+    memset(&r, 0, sizeof(r));
+    if (!packKey(seeds[i].code, r.key) || seeds[i].kwh <= 0.0f) continue;
+    r.wh = (uint32_t)(seeds[i].kwh * 1000.0f + 0.5f);
+    size_t j = n;
+    while (j > 0 && memcmp(out[j - 1].key, r.key, TS_KEY_BYTES) > 0) j--;
+    if (j > 0 && memcmp(out[j - 1].key, r.key, TS_KEY_BYTES) == 0) continue;
+    memmove(&out[j + 1], &out[j], (n - j) * sizeof(TokenRecord));
+    out[j] = r;
+    n++;
+  }
+  return n;
+}
+
+// CRC-16/MODBUS
+uint16_t TokenStore::crc16(const uint8_t* data, size_t len, uint16_t crc) {
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (uint8_t b = 0; b < 8; b++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+  }
+  return crc;
+}
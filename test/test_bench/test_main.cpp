@@ -0,0 +1,101 @@
+/**
+ * test_main.cpp - Bench harness: fixed inputs, repeatable checks, prefix filter
+ *
+ * Two runs of the core cases must do exactly the same work ("check" equal), or
+ * numbers from two commits are not comparable.
+ */
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+
+#define MAX_LINES 16
+
+struct Lines {
+  char text[MAX_LINES][BENCH_LINE_MAX];
+  uint8_t count;
+};
+
+static void collect(const char* line, void* ctx) {
+  Lines* l = (Lines*)ctx;
+  if (l->count < MAX_LINES) {
+    strncpy(l->text[l->count], line, BENCH_LINE_MAX - 1);
+    l->text[l->count][BENCH_LINE_MAX - 1] = '\0';
+    l->count++;
+  }
+}
+
+// Value of "check" in a result line, "" when missing
+static const char* checkOf(const char* line, char* out, size_t outLen) {
+  const char* p = strstr(line, "\"check\":\"");
+  out[0] = '\0';
+  if (p == NULL) return out;
+  p += 9;
+  size_t n = 0;
+  while (p[n] && p[n] != '"' && n + 1 < outLen) {
+    out[n] = p[n];
+    n++;
+  }
+  out[n] = '\0';
+  return out;
+}
+
+static Lines first;
+static Lines second;
+
+void setUp() {
+  memset(&first, 0, sizeof(first));
+  memset(&second, 0, sizeof(second));
+}
+
+void tearDown() {}
+
+static void test_rng_is_seeded() {
+  BenchRng a;
+  BenchRng b(BENCH_SEED);
+  for (int i = 0; i < 1000; i++) TEST_ASSERT_EQUAL_UINT32(a.next(), b.next());
+
+  char d[21];
+  for (int i = 0; i < 100; i++) {
+    a.digits(d, 20);
+    TEST_ASSERT_EQUAL(20, strlen(d));
+    TEST_ASSERT_TRUE(d[0] >= '1' && d[0] <= '9');
+    for (int k = 1; k < 20; k++) TEST_ASSERT_TRUE(d[k] >= '0' && d[k] <= '9');
+  }
+}
+
+static void test_core_cases_repeat_their_work() {
+  BenchRunner runner("native");
+  benchAddCore(runner);
+  TEST_ASSERT_GREATER_THAN(0, runner.count());
+
+  TEST_ASSERT_EQUAL(runner.count(), runner.run("", collect, &first));
+  TEST_ASSERT_EQUAL(runner.count(), runner.run("", collect, &second));
+  TEST_ASSERT_EQUAL(first.count, second.count);
+  for (uint8_t i = 0; i < first.count; i++) {
+    char a[16];
+    char b[16];
+    TEST_ASSERT_NULL(strstr(first.text[i], "\"skipped\""));
+    TEST_ASSERT_NOT_NULL(strstr(first.text[i], runner.name(i)));
+    TEST_ASSERT_EQUAL(8, strlen(checkOf(first.text[i], a, sizeof(a))));
+    TEST_ASSERT_EQUAL_STRING(a, checkOf(second.text[i], b, sizeof(b)));
+  }
+}
+
+static void test_prefix_selects_cases() {
+  BenchRunner runner("native");
+  benchAddCore(runner);
+  TEST_ASSERT_EQUAL(2, runner.run("persist.", collect, &first));
+  TEST_ASSERT_NOT_NULL(strstr(first.text[0], "\"bench\":\"persist."));
+  TEST_ASSERT_NOT_NULL(strstr(first.text[1], "\"bench\":\"persist."));
+  TEST_ASSERT_EQUAL(0, runner.run("nothing", collect, &second));
+  TEST_ASSERT_EQUAL(0, second.count);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_rng_is_seeded);
+  RUN_TEST(test_core_cases_repeat_their_work);
+  RUN_TEST(test_prefix_selects_cases);
+  return UNITY_END();
+}
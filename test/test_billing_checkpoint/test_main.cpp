@@ -0,0 +1,360 @@
+/**
+ * test_main.cpp - Billing checkpoints: corruption, version fallback, and power cuts
+ * in the middle of an EEPROM A/B save
+ *
+ * The EEPROM runs on a store that keeps what commit() made durable apart from
+ * the RAM copy put() writes to, and can cut a commit after any number of bytes.
+ * For every cut point a fresh MeteringCore restores from the durable bytes: it
+ * must come back with either the state before or the state after the save,
+ * never a mix and never nothing.
+ */
+#include <unity.h>
+#include <string.h>
+#include <stddef.h>
+#include "billing_checkpoint.h"
+#include "metering_core.h"
+
+#define TOKEN_1 "11111111111111111111"
+#define TOKEN_2 "22222222222222222222"
+#define TOKEN_3 "33333333333333333333"
+
+// EEPROM emulation whose commit can be cut short (power loss mid-write)
+class TearStore : public HalStore {
+ public:
+  TearStore() : tearAfter_(-1), commits_(0) {
+    memset(durable_, 0xFF, sizeof(durable_));
+    memcpy(ram_, durable_, sizeof(ram_));
+  }
+  // What a reboot reads: the durable bytes
+  void reboot() { memcpy(ram_, durable_, sizeof(ram_)); }
+  // The next commit writes only its first n changed bytes, then "loses power"
+  void tearNextCommit(int n) { tearAfter_ = n; }
+
+  void read(uint32_t addr, void* buf, size_t len) override {
+    if (addr + len <= sizeof(ram_)) memcpy(buf, ram_ + addr, len);
+  }
+  void write(uint32_t addr, const void* buf, size_t len) override {
+    if (addr + len <= sizeof(ram_)) memcpy(ram_ + addr, buf, len);
+  }
+  bool commit() override {
+    int left = tearAfter_;
+    for (size_t i = 0; i < sizeof(ram_); i++) {
+      if (durable_[i] == ram_[i]) continue;
+      if (left == 0) break;
+      durable_[i] = ram_[i];
+      if (left > 0) left--;
+    }
+    bool whole = tearAfter_ < 0;
+    tearAfter_ = -1;
+    commits_++;
+    return whole;
+  }
+
+  // The save at addr made it to the media whole (bytes it shares with the old slot need no write)
+  bool landed(uint32_t addr, size_t len) const { return memcmp(durable_ + addr, ram_ + addr, len) == 0; }
+  uint8_t* durable() { return durable_; }
+  uint32_t commits() const { return commits_; }
+
+ private:
+  uint8_t durable_[EEPROM_SIZE];
+  uint8_t ram_[EEPROM_SIZE];
+  int tearAfter_;
+  uint32_t commits_;
+};
+
+class IdleMeter : public HalMeter {
+ public:
+  IdleMeter() { memset(&r_, 0, sizeof(r_)); }
+  bool request(uint32_t) override { return true; }
+  int collect(uint32_t) override { return PZEM_IDLE; }
+  const PzemReading& last() const override { return r_; }
+
+ private:
+  PzemReading r_;
+};
+
+class NullRelay : public HalRelay {
+ public:
+  void set(bool) override {}
+};
+
+struct Rig {
+  IdleMeter meter;
+  NullRelay relay;
+  PersistJournal journal;  // never attached: the EEPROM A/B slots are used
+};
+
+static BillingCommand command(uint32_t id, const char* token, float kwh, uint64_t purchase = 0) {
+  BillingCommand cmd = {};
+  cmd.id = id;
+  cmd.kwh = kwh;
+  cmd.purchase = purchase;
+  strcpy(cmd.token, token);
+  return cmd;
+}
+
+// Restore a fresh core from what the store made durable
+static const char* restoreToken(TearStore& store, char token[21], int64_t* purchasedUwh = NULL) {
+  Rig rig;
+  store.reboot();
+  MeteringCore core(rig.meter, rig.relay, rig.journal, store);
+  const char* source = core.restore(0);
+  strcpy(token, core.billing().token);
+  if (purchasedUwh) *purchasedUwh = core.ledger().purchasedUwh();
+  return source;
+}
+
+static PersistState sampleState() {
+  PersistState s;
+  memset(&s, 0, sizeof(s));
+  s.purchasedUwh = 50000000000LL;
+  s.consumedUwh = 1234567890LL;
+  s.baselineWh = 98765;
+  s.haveBaseline = true;
+  strcpy(s.token, TOKEN_1);
+  s.replay.highest = 42;
+  s.replay.seen = 0x00010203UL;
+  purchaseHistoryAdd(s.purchases, purchaseIdHash("65f1a2b3c4d5e6f7a8b9c0d1"));
+  return s;
+}
+
+// A sealed checkpoint of an older firmware (same CRC, 56-byte layout)
+static void sealV2(BillingCheckpointV2& cp, uint8_t version) {
+  uint16_t crc = 0xFFFF;
+  const uint8_t* data = (const uint8_t*)&cp;
+  cp.version = version;
+  for (size_t i = 0; i < offsetof(BillingCheckpointV2, crc); i++) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+  cp.crc = crc;
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_round_trip_and_every_byte_is_covered() {
+  PersistState s = sampleState(), out;
+  BillingCheckpoint cp;
+  checkpointPack(s, 7, cp);
+  TEST_ASSERT_TRUE(checkpointUnpack(cp, out));
+  TEST_ASSERT_EQUAL_INT64(s.purchasedUwh, out.purchasedUwh);
+  TEST_ASSERT_EQUAL_INT64(s.consumedUwh, out.consumedUwh);
+  TEST_ASSERT_EQUAL_UINT32(s.baselineWh, out.baselineWh);
+  TEST_ASSERT_TRUE(out.haveBaseline);
+  TEST_ASSERT_EQUAL_STRING(TOKEN_1, out.token);
+  TEST_ASSERT_EQUAL_UINT16(42, out.replay.highest);
+  TEST_ASSERT_EQUAL_HEX32(0x00010203UL, out.replay.seen);
+  TEST_ASSERT_TRUE(purchaseHistoryContains(out.purchases, purchaseIdHash("65f1a2b3c4d5e6f7a8b9c0d1")));
+
+  // Any single flipped bit, padding included, is a CRC mismatch
+  for (size_t i = 0; i < sizeof(cp); i++) {
+    for (int b = 0; b < 8; b++) {
+      BillingCheckpoint bad = cp;
+      ((uint8_t*)&bad)[i] ^= (uint8_t)(1 << b);
+      TEST_ASSERT_FALSE(checkpointUnpack(bad, out));
+    }
+  }
+
+  // Blank EEPROM and erased flash are not checkpoints
+  memset(&cp, 0xFF, sizeof(cp));
+  TEST_ASSERT_FALSE(checkpointUnpack(cp, out));
+  memset(&cp, 0x00, sizeof(cp));
+  TEST_ASSERT_FALSE(checkpointUnpack(cp, out));
+}
+
+static void test_version_fallback() {
+  BillingCheckpointV2 old;
+  memset(&old, 0, sizeof(old));
+  old.flags = CHECKPOINT_HAVE_BASELINE;
+  old.seq = 3;
+  old.purchasedUwh = 5000000000LL;
+  old.consumedUwh = 1000;
+  old.baselineWh = 77;
+  memcpy(old.token, TOKEN_2, 20);
+  old.replayHighest = 9;
+  old.replaySeen = 0x5;
+
+  PersistState out;
+  memset(&out.purchases, 0xAB, sizeof(out.purchases));
+  sealV2(old, 2);
+  TEST_ASSERT_TRUE(checkpointUnpackV2(old, out));
+  TEST_ASSERT_EQUAL_STRING(TOKEN_2, out.token);
+  TEST_ASSERT_EQUAL_UINT16(9, out.replay.highest);
+  TEST_ASSERT_EQUAL_HEX32(0x5, out.replay.seen);
+  TEST_ASSERT_EQUAL_HEX64(0, out.purchases.ids[0]);  // no purchase history before version 3
+
+  // Version 1 had no replay window: whatever the bytes hold is read as empty
+  sealV2(old, 1);
+  TEST_ASSERT_TRUE(checkpointUnpackV2(old, out));
+  TEST_ASSERT_EQUAL_UINT16(0, out.replay.highest);
+  TEST_ASSERT_EQUAL_UINT32(0, out.replay.seen);
+
+  // Unknown versions are refused even with a matching CRC
+  sealV2(old, 3);
+  TEST_ASSERT_FALSE(checkpointUnpackV2(old, out));
+  BillingCheckpoint cp;
+  checkpointPack(sampleState(), 1, cp);
+  cp.version = CHECKPOINT_VERSION + 1;
+  TEST_ASSERT_FALSE(checkpointUnpack(cp, out));
+}
+
+static void test_torn_save_keeps_previous_checkpoint() {
+  // Slot A holds token 1 (seq 1), slot B token 2 (seq 2); the third save goes to A,
+  // the fourth to B. Cut each of them after every possible byte count.
+  for (int slot = 0; slot < 2; slot++) {
+    int torn = 0;
+    for (int n = 0; n <= (int)sizeof(BillingCheckpoint); n++) {
+      TearStore store;
+      bool landed;
+      {
+        Rig rig;
+        MeteringCore core(rig.meter, rig.relay, rig.journal, store);
+        core.restore(0);
+        core.apply(command(1, TOKEN_1, 1.0f), 0);
+        core.apply(command(2, TOKEN_2, 2.0f), 0);
+        if (slot == 1) core.apply(command(3, TOKEN_3, 3.0f), 0);
+        store.tearNextCommit(n);
+        core.apply(command(4, slot == 0 ? TOKEN_3 : TOKEN_1, 4.0f), 0);
+        landed = store.landed(slot == 0 ? EEPROM_ADDR_CHECKPOINT_A : EEPROM_ADDR_CHECKPOINT_B,
+                              sizeof(BillingCheckpoint));
+      }
+      const char* before = slot == 0 ? TOKEN_2 : TOKEN_3;
+      const char* after = slot == 0 ? TOKEN_3 : TOKEN_1;
+      char token[21];
+      int64_t purchased;
+      TEST_ASSERT_NOT_NULL(restoreToken(store, token, &purchased));
+      TEST_ASSERT_TRUE(landed || n < (int)sizeof(BillingCheckpoint));
+      if (!landed) {
+        // Part of the new checkpoint may be on the media: its CRC does not match
+        torn++;
+        TEST_ASSERT_EQUAL_STRING(before, token);
+        TEST_ASSERT_EQUAL_INT64(EnergyLedger::fromKwh(slot == 0 ? 2.0f : 3.0f), purchased);
+      } else {
+        TEST_ASSERT_EQUAL_STRING(after, token);
+        TEST_ASSERT_EQUAL_INT64(EnergyLedger::fromKwh(4.0f), purchased);
+      }
+    }
+    TEST_ASSERT_GREATER_THAN(20, torn);  // a cut before each byte that differs (seq, token, credit, CRC)
+  }
+}
+
+static void test_newer_slot_corrupt_falls_back_to_older() {
+  TearStore store;
+  {
+    Rig rig;
+    MeteringCore core(rig.meter, rig.relay, rig.journal, store);
+    core.restore(0);
+    core.apply(command(1, TOKEN_1, 1.0f), 0);  // -> A
+    core.apply(command(2, TOKEN_2, 2.0f), 0);  // -> B, newest
+  }
+  char token[21];
+  restoreToken(store, token);
+  TEST_ASSERT_EQUAL_STRING(TOKEN_2, token);
+
+  store.durable()[EEPROM_ADDR_CHECKPOINT_B + offsetof(BillingCheckpoint, consumedUwh)] ^= 0x01;
+  TEST_ASSERT_EQUAL_STRING("EEPROM checkpoint", restoreToken(store, token));
+  TEST_ASSERT_EQUAL_STRING(TOKEN_1, token);
+
+  // Both gone: nothing restored, no credit
+  store.durable()[EEPROM_ADDR_CHECKPOINT_A + offsetof(BillingCheckpoint, crc)] ^= 0x80;
+  int64_t purchased;
+  TEST_ASSERT_NULL(restoreToken(store, token, &purchased));
+}
+
+static void test_migrates_version2_slots_without_touching_them() {
+  TearStore store;
+  BillingCheckpointV2 a, b;
+  memset(&a, 0, sizeof(a));
+  a.seq = 10;
+  a.purchasedUwh = EnergyLedger::fromKwh(1.0f);
+  memcpy(a.token, TOKEN_1, 20);
+  sealV2(a, 2);
+  b = a;
+  b.seq = 11;
+  b.purchasedUwh = EnergyLedger::fromKwh(6.0f);
+  memcpy(b.token, TOKEN_2, 20);
+  sealV2(b, 2);
+  store.put(EEPROM_ADDR_CHECKPOINT_V2_A, a);
+  store.put(EEPROM_ADDR_CHECKPOINT_V2_B, b);
+  store.commit();
+  uint8_t legacy[EEPROM_ADDR_CHECKPOINT_V2_B + sizeof(BillingCheckpointV2)];
+  memcpy(legacy, store.durable(), sizeof(legacy));
+
+  char token[21];
+  int64_t purchased;
+  TEST_ASSERT_EQUAL_STRING("EEPROM checkpoint", restoreToken(store, token, &purchased));
+  TEST_ASSERT_EQUAL_STRING(TOKEN_2, token);
+  TEST_ASSERT_EQUAL_INT64(EnergyLedger::fromKwh(6.0f), purchased);
+
+  // The first version-3 saves land past the old slots
+  {
+    Rig rig;
+    store.reboot();
+    MeteringCore core(rig.meter, rig.relay, rig.journal, store);
+    core.restore(0);
+    core.apply(command(1, TOKEN_3, 1.0f, purchaseIdHash("65f1a2b3c4d5e6f7a8b9c0d1")), 0);
+    core.apply(command(2, TOKEN_3, 1.0f), 0);
+  }
+  TEST_ASSERT_EQUAL_MEMORY(legacy, store.durable(), sizeof(legacy));
+  restoreToken(store, token);
+  TEST_ASSERT_EQUAL_STRING(TOKEN_3, token);
+}
+
+static void test_purchase_is_credited_once_across_reboots() {
+  TearStore store;
+  uint64_t purchase = purchaseIdHash("65f1a2b3c4d5e6f7a8b9c0d1");
+  int64_t purchased = 0;
+  for (int boot = 0; boot < 3; boot++) {
+    Rig rig;
+    store.reboot();
+    MeteringCore core(rig.meter, rig.relay, rig.journal, store);
+    core.restore(0);
+    // Pushed again on every reconnect until the confirm gets through
+    core.apply(command(1, TOKEN_1, 5.0f, purchase), 0);
+    TEST_ASSERT_EQUAL_UINT32(1, core.billing().last_command_id);  // handled either way
+    TEST_ASSERT_EQUAL_UINT32(boot == 0 ? 0 : 1, core.billing().last_rejected_id);
+    TEST_ASSERT_EQUAL_UINT32(boot == 0 ? 0 : 1, core.billing().commands_rejected);
+    TEST_ASSERT_TRUE(purchaseHistoryContains(core.billing().purchases, purchase));
+    purchased = core.ledger().purchasedUwh();
+    TEST_ASSERT_EQUAL_INT64(EnergyLedger::fromKwh(5.0f), purchased);
+  }
+
+  // A crypto token queued twice (typed, then pushed by the server) is rejected the second time
+  {
+    Rig rig;
+    store.reboot();
+    MeteringCore core(rig.meter, rig.relay, rig.journal, store);
+    core.restore(0);
+    BillingCommand typed = command(2, TOKEN_2, 1.0f);
+    typed.crypto_seq = 9;
+    typed.top_up = true;
+    BillingCommand pushed = command(3, TOKEN_2, 1.0f, purchaseIdHash("65f1a2b3c4d5e6f7a8b9c0d2"));
+    pushed.crypto_seq = 9;
+    core.apply(typed, 0);
+    TEST_ASSERT_EQUAL_UINT32(0, core.billing().last_rejected_id);
+    core.apply(pushed, 0);
+    TEST_ASSERT_EQUAL_UINT32(3, core.billing().last_rejected_id);
+    TEST_ASSERT_EQUAL_INT64(purchased + EnergyLedger::fromKwh(1.0f), core.ledger().purchasedUwh());
+  }
+
+  // Older purchases drop out of the history, newest first
+  PurchaseHistory h;
+  memset(&h, 0, sizeof(h));
+  for (uint64_t id = 1; id <= CHECKPOINT_PURCHASES + 1; id++) purchaseHistoryAdd(h, id);
+  TEST_ASSERT_FALSE(purchaseHistoryContains(h, 1));
+  TEST_ASSERT_TRUE(purchaseHistoryContains(h, 2));
+  TEST_ASSERT_EQUAL_HEX64(CHECKPOINT_PURCHASES + 1, h.ids[0]);
+  TEST_ASSERT_FALSE(purchaseHistoryContains(h, 0));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip_and_every_byte_is_covered);
+  RUN_TEST(test_version_fallback);
+  RUN_TEST(test_torn_save_keeps_previous_checkpoint);
+  RUN_TEST(test_newer_slot_corrupt_falls_back_to_older);
+  RUN_TEST(test_migrates_version2_slots_without_touching_them);
+  RUN_TEST(test_purchase_is_credited_once_across_reboots);
+  return UNITY_END();
+}
@@ -0,0 +1,176 @@
+/**
+ * test_main.cpp - EnergyLedger: exact integration, and 30 days against the PZEM register
+ *
+ * The replay feeds the ledger what the metering task feeds it - a sample every
+ * ~200 ms, reconcile() after each - from a seeded load, while a model PZEM
+ * integrates the same load into its 1 Wh register with a small gain error and
+ * keeps counting through sensor dropouts the ledger cannot integrate. Whatever
+ * happened, the ledger must end each period inside the register's window.
+ *
+ * The same samples also go through the float path the firmware used before the
+ * ledger (remaining_kwh -= powerW * dt / 3.6e6 on a float balance). With kWh left
+ * on the balance a float step is a fraction of a Wh, so a small load's per-sample
+ * delta rounds away: both billing errors against the register are reported, and
+ * the float one must show the under-billing.
+ */
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include "energy_ledger.h"
+#include "bench.h"  // BenchRng
+
+#define REPLAY_DAYS        30
+#define REGISTER_START_WH  123456UL
+#define REGISTER_GAIN      1.002     // the PZEM reads 0.2% high
+#define MAX_LOAD_DW        50000     // 5 kW
+#define MAX_DROPOUT_MS     30000
+#define START_KWH          5000.0f
+
+void setUp() {}
+void tearDown() {}
+
+// The pre-ledger billing step: float W, rectangle over dt, subtracted from a float kWh balance
+static float legacyDeltaKwh(uint32_t powerDw, uint32_t dtMs) {
+  float powerW = powerDw / 10.0f;
+  float deltaKwh = (powerW * (dtMs / 1000.0)) / 3600000.0;
+  return deltaKwh;
+}
+
+static void test_trapezoid_is_exact() {
+  EnergyLedger ledger;
+  ledger.reset(0, 0, true);
+  // 100 W for one hour at 200 ms: 5555.5 µWh per step, the half is carried
+  uint32_t t = 0;
+  for (int i = 0; i <= 18000; i++, t += 200) ledger.addSample(t, 1000);
+  TEST_ASSERT_EQUAL_INT64(100LL * LEDGER_UWH_PER_WH, ledger.consumedUwh());
+
+  // A gap over maxGapMs is not integrated (reconcile() recovers it)
+  ledger.setMaxGapMs(1000);
+  ledger.addSample(t + 5000, 1000);
+  TEST_ASSERT_EQUAL_INT64(100LL * LEDGER_UWH_PER_WH, ledger.consumedUwh());
+}
+
+static void test_credit_and_top_up() {
+  EnergyLedger ledger;
+  ledger.reset(EnergyLedger::fromKwh(1.5f), 0, true);
+  TEST_ASSERT_EQUAL_INT64(1500LL * LEDGER_UWH_PER_WH, ledger.remainingUwh());
+  ledger.topUp(EnergyLedger::fromKwh(0.25f));
+  TEST_ASSERT_EQUAL_INT64(1750LL * LEDGER_UWH_PER_WH, ledger.purchasedUwh());
+  ledger.restore(1000, 5000, 7, true);
+  TEST_ASSERT_EQUAL_INT64(0, ledger.remainingUwh());  // never negative
+}
+
+static void test_reconcile_window() {
+  EnergyLedger ledger;
+  ledger.reset(0, 1000, true);
+  TEST_ASSERT_EQUAL_INT64(0, ledger.reconcile(1000));
+  // Register 3 Wh ahead: pulled up to the bottom of the window
+  TEST_ASSERT_EQUAL_INT64(3LL * LEDGER_UWH_PER_WH, ledger.reconcile(1003));
+  TEST_ASSERT_EQUAL_INT64(3LL * LEDGER_UWH_PER_WH, ledger.consumedUwh());
+  // Register reset on the device: re-anchored, nothing billed or refunded
+  TEST_ASSERT_EQUAL_INT64(0, ledger.reconcile(10));
+  TEST_ASSERT_EQUAL_INT64(3LL * LEDGER_UWH_PER_WH, ledger.consumedUwh());
+  TEST_ASSERT_EQUAL_INT64(LEDGER_UWH_PER_WH, ledger.reconcile(11));  // counts on from the new anchor
+  TEST_ASSERT_EQUAL_INT64(2, ledger.corrections());
+}
+
+static void test_thirty_day_replay_stays_in_register_window() {
+  BenchRng rng;
+  EnergyLedger ledger;
+  ledger.setMaxGapMs(1000);
+  ledger.reset(EnergyLedger::fromKwh(START_KWH), REGISTER_START_WH, true);
+  float legacyKwh = START_KWH;
+
+  uint32_t t = 0xFFFFFFFFUL - 86400000UL;  // millis() wraps on day two
+  uint32_t loadDw = 0;
+  uint32_t prevDw = 0;
+  uint32_t loadUntil = t;
+  double trueUwh = 0.0;                    // what the PZEM integrated
+  uint32_t samples = 0;
+  uint32_t dropouts = 0;
+  int64_t worstOutside = 0;
+
+  for (uint64_t elapsed = 0; elapsed < REPLAY_DAYS * 86400000ULL;) {
+    uint32_t dt = 190 + rng.below(21);     // task jitter
+    if (rng.below(20000) == 0) {
+      dt = 1000 + rng.below(MAX_DROPOUT_MS);  // sensor silent
+      dropouts++;
+    }
+    if ((int32_t)(t - loadUntil) >= 0) {   // load changes every few minutes
+      loadDw = rng.below(4) == 0 ? rng.below(200) : rng.below(MAX_LOAD_DW);
+      loadUntil = t + 60000 + rng.below(600000);
+    }
+    uint32_t p = loadDw + rng.below(50);
+    trueUwh += (double)(prevDw + p) * dt / 72.0 * REGISTER_GAIN;
+    t += dt;
+    elapsed += dt;
+    prevDw = p;
+
+    legacyKwh -= legacyDeltaKwh(p, dt);
+
+    uint32_t registerWh = REGISTER_START_WH + (uint32_t)floor(trueUwh / LEDGER_UWH_PER_WH);
+    ledger.addSample(t, p);
+    ledger.reconcile(registerWh);
+    samples++;
+
+    int64_t lo = (int64_t)(registerWh - REGISTER_START_WH) * LEDGER_UWH_PER_WH;
+    int64_t off = ledger.consumedUwh() - lo;
+    if (off < 0 && -off > worstOutside) worstOutside = -off;
+    if (off >= LEDGER_UWH_PER_WH && off - LEDGER_UWH_PER_WH + 1 > worstOutside) {
+      worstOutside = off - LEDGER_UWH_PER_WH + 1;
+    }
+  }
+
+  TEST_ASSERT_GREATER_THAN(12000000, samples);
+  TEST_ASSERT_GREATER_THAN(0, dropouts);
+  TEST_ASSERT_EQUAL_INT64(0, worstOutside);
+  // Ends within 1 Wh of the register however much it drifted meanwhile
+  TEST_ASSERT_LESS_THAN(LEDGER_UWH_PER_WH, llabs(ledger.consumedUwh() - (int64_t)trueUwh));
+  TEST_ASSERT_GREATER_THAN(0, ledger.corrections());
+  // No single correction beyond a dropout at full load (plus the register step)
+  int64_t bound = (int64_t)((double)MAX_LOAD_DW * 2 * (1000 + MAX_DROPOUT_MS) / 72.0 * REGISTER_GAIN) +
+                  LEDGER_UWH_PER_WH;
+  TEST_ASSERT_LESS_THAN(bound, llabs(ledger.maxCorrectionUwh()));
+  TEST_ASSERT_EQUAL_INT64(ledger.purchasedUwh() - ledger.consumedUwh(), ledger.remainingUwh());
+
+  // Billing error against the register, ledger vs the float path
+  double ledgerErrWh = (ledger.consumedUwh() - trueUwh) / LEDGER_UWH_PER_WH;
+  double legacyErrWh = ((double)START_KWH - legacyKwh) * 1000.0 - trueUwh / LEDGER_UWH_PER_WH;
+  char msg[160];
+  snprintf(msg, sizeof(msg), "30 days, %.1f kWh: ledger off by %+.3f Wh, float path off by %+.1f Wh",
+           trueUwh / LEDGER_UWH_PER_KWH, ledgerErrWh, legacyErrWh);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_TRUE(fabs(ledgerErrWh) < 1.0);
+  TEST_ASSERT_TRUE(legacyErrWh < -1000.0);  // under-billed by more than a kWh
+}
+
+// A 15 W standby load for a day: about 0.36 kWh the float balance never sees
+static void test_float_path_under_bills_small_loads() {
+  EnergyLedger ledger;
+  ledger.reset(EnergyLedger::fromKwh(START_KWH), 0, true);
+  float legacyKwh = START_KWH;
+  uint32_t t = 0;
+  for (uint32_t elapsed = 0; elapsed < 86400000UL; elapsed += 200, t += 200) {
+    ledger.addSample(t, 150);
+    legacyKwh -= legacyDeltaKwh(150, 200);
+  }
+  double trueWh = 15.0 * 24.0;
+  double ledgerWh = (double)ledger.consumedUwh() / LEDGER_UWH_PER_WH;
+  double legacyWh = ((double)START_KWH - legacyKwh) * 1000.0;
+  char msg[120];
+  snprintf(msg, sizeof(msg), "15 W for 24 h: %.1f Wh, ledger bills %.3f Wh, float path %.1f Wh",
+           trueWh, ledgerWh, legacyWh);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_TRUE(fabs(ledgerWh - trueWh) < 0.01);
+  TEST_ASSERT_TRUE(legacyWh < 0.5 * trueWh);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_trapezoid_is_exact);
+  RUN_TEST(test_credit_and_top_up);
+  RUN_TEST(test_reconcile_window);
+  RUN_TEST(test_thirty_day_replay_stays_in_register_window);
+  RUN_TEST(test_float_path_under_bills_small_loads);
+  return UNITY_END();
+}
@@ -0,0 +1,135 @@
+/**
+ * test_main.cpp - HostCache: TTL expiry, fallback to the last address, and the
+ * re-lookup after a failed connect
+ *
+ * A fake resolver answers from a table the test changes (the host moving to a
+ * new address, the resolver going down) and counts its calls, on the clock the
+ * test passes in. The TTL is AsyncHttp's HTTP_DNS_TTL_MS (http_async.h).
+ */
+#include <unity.h>
+#include <string.h>
+#include "host_cache.h"
+
+#define HTTP_DNS_TTL_MS  300000UL    // http_async.h
+#define ADDR_A           0x0A01A8C0UL // 192.168.1.10, network byte order
+#define ADDR_B           0x0B01A8C0UL
+
+struct FakeDns {
+  uint32_t addr;     // 0 = lookup fails
+  uint32_t calls;
+  const char* lastHost;
+};
+
+static FakeDns dns;
+
+static bool fakeResolve(const char* host, uint32_t& addr, void* ctx) {
+  FakeDns& d = *(FakeDns*)ctx;
+  d.calls++;
+  d.lastHost = host;
+  if (d.addr == 0) return false;
+  addr = d.addr;
+  return true;
+}
+
+void setUp() {
+  memset(&dns, 0, sizeof(dns));
+  dns.addr = ADDR_A;
+}
+void tearDown() {}
+
+static void test_cached_until_ttl_expires() {
+  HostCache cache(HTTP_DNS_TTL_MS, fakeResolve, &dns);
+  uint32_t addr = 0;
+  uint32_t t0 = 1000;
+  TEST_ASSERT_TRUE(cache.lookup("api.example.com", t0, addr));
+  TEST_ASSERT_EQUAL_HEX32(ADDR_A, addr);
+  TEST_ASSERT_EQUAL_STRING("api.example.com", dns.lastHost);
+
+  // Every connect within the TTL: no resolver round trip, even after the host moved
+  dns.addr = ADDR_B;
+  for (uint32_t t = t0; t < t0 + HTTP_DNS_TTL_MS; t += 7000) {
+    TEST_ASSERT_TRUE(cache.lookup("api.example.com", t, addr));
+    TEST_ASSERT_EQUAL_HEX32(ADDR_A, addr);
+  }
+  TEST_ASSERT_TRUE(cache.lookup("api.example.com", t0 + HTTP_DNS_TTL_MS - 1, addr));
+  TEST_ASSERT_EQUAL_UINT32(1, dns.calls);
+  TEST_ASSERT_EQUAL_UINT32(1, cache.lookups());
+  TEST_ASSERT_EQUAL_UINT32(44, cache.hits());
+
+  // TTL ran out: looked up again, the new address is used and cached from here
+  TEST_ASSERT_TRUE(cache.lookup("api.example.com", t0 + HTTP_DNS_TTL_MS, addr));
+  TEST_ASSERT_EQUAL_HEX32(ADDR_B, addr);
+  TEST_ASSERT_EQUAL_UINT32(2, dns.calls);
+  TEST_ASSERT_TRUE(cache.lookup("api.example.com", t0 + 2 * HTTP_DNS_TTL_MS - 1, addr));
+  TEST_ASSERT_EQUAL_UINT32(2, dns.calls);
+}
+
+// millis() wraps after 49.7 days; the age is taken modulo 2^32
+static void test_ttl_across_millis_wrap() {
+  HostCache cache(HTTP_DNS_TTL_MS, fakeResolve, &dns);
+  uint32_t addr;
+  uint32_t t0 = 0xFFFFFFFFUL - 1000;
+  TEST_ASSERT_TRUE(cache.lookup("h", t0, addr));
+  TEST_ASSERT_TRUE(cache.lookup("h", t0 + 60000, addr));
+  TEST_ASSERT_EQUAL_UINT32(1, dns.calls);
+  TEST_ASSERT_TRUE(cache.lookup("h", t0 + HTTP_DNS_TTL_MS, addr));
+  TEST_ASSERT_EQUAL_UINT32(2, dns.calls);
+}
+
+static void test_failed_lookup_falls_back_to_last_address() {
+  HostCache cache(HTTP_DNS_TTL_MS, fakeResolve, &dns);
+  uint32_t addr = 0;
+
+  // Nothing resolved yet and the resolver is down: no address at all
+  dns.addr = 0;
+  TEST_ASSERT_FALSE(cache.lookup("h", 0, addr));
+  TEST_ASSERT_EQUAL_UINT32(1, dns.calls);
+
+  dns.addr = ADDR_A;
+  TEST_ASSERT_TRUE(cache.lookup("h", 10, addr));
+  TEST_ASSERT_EQUAL_HEX32(ADDR_A, addr);
+
+  // Expired while the resolver is down: the old address, and another try next time
+  dns.addr = 0;
+  TEST_ASSERT_TRUE(cache.lookup("h", 10 + HTTP_DNS_TTL_MS, addr));
+  TEST_ASSERT_EQUAL_HEX32(ADDR_A, addr);
+  TEST_ASSERT_TRUE(cache.lookup("h", 20 + HTTP_DNS_TTL_MS, addr));
+  TEST_ASSERT_EQUAL_UINT32(4, dns.calls);
+
+  dns.addr = ADDR_B;
+  TEST_ASSERT_TRUE(cache.lookup("h", 30 + HTTP_DNS_TTL_MS, addr));
+  TEST_ASSERT_EQUAL_HEX32(ADDR_B, addr);
+  TEST_ASSERT_EQUAL_UINT32(5, cache.lookups());
+  TEST_ASSERT_EQUAL_UINT32(0, cache.hits());
+}
+
+// AsyncHttp invalidates after a failed connect: the next one resolves again
+static void test_invalidate_forces_lookup() {
+  HostCache cache(HTTP_DNS_TTL_MS, fakeResolve, &dns);
+  uint32_t addr;
+  TEST_ASSERT_TRUE(cache.lookup("h", 0, addr));
+  TEST_ASSERT_TRUE(cache.lookup("h", 1000, addr));
+  TEST_ASSERT_EQUAL_UINT32(1, dns.calls);
+
+  dns.addr = ADDR_B;
+  cache.invalidate();
+  TEST_ASSERT_TRUE(cache.lookup("h", 2000, addr));
+  TEST_ASSERT_EQUAL_HEX32(ADDR_B, addr);
+  TEST_ASSERT_EQUAL_UINT32(2, dns.calls);
+
+  // Invalidated with the resolver down: the last address is still returned
+  dns.addr = 0;
+  cache.invalidate();
+  TEST_ASSERT_TRUE(cache.lookup("h", 3000, addr));
+  TEST_ASSERT_EQUAL_HEX32(ADDR_B, addr);
+  TEST_ASSERT_EQUAL_UINT32(3, dns.calls);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_cached_until_ttl_expires);
+  RUN_TEST(test_ttl_across_millis_wrap);
+  RUN_TEST(test_failed_lookup_falls_back_to_last_address);
+  RUN_TEST(test_invalidate_forces_lookup);
+  return UNITY_END();
+}
@@ -0,0 +1,206 @@
+/**
+ * test_main.cpp - IntervalStats accuracy: top-K p95 and the P-square estimate
+ * against an exact sort
+ *
+ * Seeded sample streams shaped like the metering channels (voltage with sags,
+ * current stepping between loads, lognormal power spikes, power factor in 0.01
+ * steps) plus uniform data and ramps go through ChannelStats and, sorted, through
+ * the nearest-rank definition. Below 20 * ISTATS_TOP_SAMPLES samples p95 must be
+ * the exact order statistic; from there on the P-square estimate must land within
+ * a few percent of rank 0.95 n (quantized data: within one step of the exact
+ * value). Min/max must be exact and the Welford mean/stddev close to a double
+ * computation.
+ */
+#include <unity.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "interval_stats.h"
+
+#define MAX_N            10000
+#define EXACT_MAX_N      (20 * ISTATS_TOP_SAMPLES - 1)   // 639
+#define RANK_TOLERANCE   0.03    // P-square, continuous data: fraction of n
+
+static uint32_t rngState;
+static uint32_t rnd() {
+  rngState = rngState * 1664525UL + 1013904223UL;
+  return rngState >> 8;
+}
+static double uniform01() { return (rnd() + 0.5) / 16777216.0; }
+static double gaussian() {
+  return sqrt(-2.0 * log(uniform01())) * cos(6.283185307179586 * uniform01());
+}
+
+typedef float (*Generator)(uint32_t i, uint32_t n);
+
+static float voltageWithSags(uint32_t, uint32_t) {
+  float v = roundf((230.0f + 1.5f * (float)gaussian()) * 10.0f) / 10.0f;
+  return rnd() % 200 == 0 ? v - 30.0f : v;
+}
+static float currentSteps(uint32_t i, uint32_t n) {
+  float base = (i * 7 / n) % 3 == 0 ? 0.35f : 8.2f;
+  return roundf((base + 0.05f * (float)gaussian()) * 1000.0f) / 1000.0f;
+}
+static float powerSpikes(uint32_t, uint32_t) {
+  return roundf((float)exp(6.0 + 0.8 * gaussian()) * 10.0f) / 10.0f;
+}
+static float uniformValues(uint32_t, uint32_t) { return (float)(uniform01() * 1000.0); }
+static float ascending(uint32_t i, uint32_t) { return (float)i; }
+static float descending(uint32_t i, uint32_t n) { return (float)(n - i); }
+static float pfSteps(uint32_t, uint32_t) { return (float)(88 + rnd() % 11) / 100.0f; }
+
+struct Shape {
+  const char* name;
+  Generator gen;
+};
+static const Shape CONTINUOUS[] = {
+  {"voltage", voltageWithSags}, {"current", currentSteps}, {"power", powerSpikes},
+  {"uniform", uniformValues},   {"ascending", ascending},  {"descending", descending},
+};
+#define CONTINUOUS_COUNT (sizeof(CONTINUOUS) / sizeof(CONTINUOUS[0]))
+
+static float samples[MAX_N];
+static float sorted[MAX_N];
+
+static int cmpFloat(const void* a, const void* b) {
+  float x = *(const float*)a, y = *(const float*)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Fill samples[0..n) and feed them to c; sorted gets the same samples ascending
+static void generate(Generator gen, uint32_t n, uint32_t seed, ChannelStats& c) {
+  rngState = seed;
+  c.reset();
+  for (uint32_t i = 0; i < n; i++) {
+    samples[i] = gen(i, n);
+    c.add(samples[i]);
+  }
+  memcpy(sorted, samples, n * sizeof(float));
+  qsort(sorted, n, sizeof(float), cmpFloat);
+}
+
+// Nearest rank ceil(q n), in integers
+static float exactQuantile(uint32_t n, uint32_t percent) {
+  uint32_t rank = (percent * n + 99) / 100;
+  return sorted[(rank > 0 ? rank : 1) - 1];
+}
+
+// How far (fraction of n) the estimate sits from rank q n among the sorted samples
+static double rankError(float est, uint32_t n, double q) {
+  uint32_t below = 0, atOrBelow = 0;
+  while (below < n && sorted[below] < est) below++;
+  atOrBelow = below;
+  while (atOrBelow < n && sorted[atOrBelow] <= est) atOrBelow++;
+  double target = q * n;
+  if (target < below) return (below - target) / n;
+  if (target > atOrBelow) return (target - atOrBelow) / n;
+  return 0.0;
+}
+
+static void checkMoments(const ChannelStats& c, uint32_t n, const char* name) {
+  double mean = 0.0, ss = 0.0;
+  for (uint32_t i = 0; i < n; i++) mean += samples[i];
+  mean /= n;
+  for (uint32_t i = 0; i < n; i++) ss += (samples[i] - mean) * (samples[i] - mean);
+  double sd = sqrt(ss / n);
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(n, c.count(), name);
+  TEST_ASSERT_TRUE_MESSAGE(sorted[0] == c.min(), name);
+  TEST_ASSERT_TRUE_MESSAGE(sorted[n - 1] == c.max(), name);
+  TEST_ASSERT_TRUE_MESSAGE(fabs(c.mean() - mean) <= 1e-5 * fabs(mean) + 1e-6, name);
+  TEST_ASSERT_TRUE_MESSAGE(fabs(c.stddev() - sd) <= 1e-4 * sd + 1e-5 * fabs(mean) + 1e-6, name);
+}
+
+static void test_p2_exact_below_five_samples() {
+  const float xs[] = {7.5f, -2.0f, 11.0f, 3.25f};
+  for (uint32_t n = 1; n <= 4; n++) {
+    P2Quantile p95(0.95f), p50(0.5f);
+    for (uint32_t i = 0; i < n; i++) {
+      p95.add(xs[i]);
+      p50.add(xs[i]);
+      sorted[i] = xs[i];
+    }
+    qsort(sorted, n, sizeof(float), cmpFloat);
+    TEST_ASSERT_EQUAL_FLOAT(exactQuantile(n, 95), p95.value());
+    TEST_ASSERT_EQUAL_FLOAT(exactQuantile(n, 50), p50.value());
+  }
+  P2Quantile empty(0.95f);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, empty.value());
+}
+
+// Up to 639 samples the top ISTATS_TOP_SAMPLES still contain rank 0.95 n
+static void test_p95_exact_below_640_samples() {
+  const uint32_t sizes[] = {1, 2, 19, 20, 21, 100, 333, 620, EXACT_MAX_N};
+  for (uint32_t s = 0; s < CONTINUOUS_COUNT; s++) {
+    for (uint32_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+      for (uint32_t seed = 1; seed <= 10; seed++) {
+        ChannelStats c;
+        generate(CONTINUOUS[s].gen, sizes[k], seed * 7919, c);
+        TEST_ASSERT_TRUE_MESSAGE(exactQuantile(sizes[k], 95) == c.p95(), CONTINUOUS[s].name);
+        checkMoments(c, sizes[k], CONTINUOUS[s].name);
+      }
+    }
+  }
+  ChannelStats pf;
+  generate(pfSteps, EXACT_MAX_N, 42, pf);
+  TEST_ASSERT_EQUAL_FLOAT(exactQuantile(EXACT_MAX_N, 95), pf.p95());
+}
+
+static void test_p95_estimate_beyond_640_samples() {
+  const uint32_t sizes[] = {EXACT_MAX_N + 1, 641, 700, 2000, MAX_N};
+  for (uint32_t s = 0; s < CONTINUOUS_COUNT; s++) {
+    double worst = 0.0;
+    for (uint32_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+      for (uint32_t seed = 1; seed <= 10; seed++) {
+        ChannelStats c;
+        generate(CONTINUOUS[s].gen, sizes[k], seed * 104729, c);
+        double err = rankError(c.p95(), sizes[k], 0.95);
+        if (err > worst) worst = err;
+        TEST_ASSERT_TRUE(c.p95() >= c.min() && c.p95() <= c.max());
+        checkMoments(c, sizes[k], CONTINUOUS[s].name);
+      }
+    }
+    TEST_ASSERT_TRUE_MESSAGE(worst <= RANK_TOLERANCE, CONTINUOUS[s].name);
+  }
+}
+
+// Eleven PF levels: rank is meaningless between two of them, the value is off by one step at most
+static void test_p95_estimate_of_quantized_values() {
+  for (uint32_t n = 640; n <= MAX_N; n *= 2) {
+    for (uint32_t seed = 1; seed <= 10; seed++) {
+      ChannelStats c;
+      generate(pfSteps, n, seed, c);
+      TEST_ASSERT_FLOAT_WITHIN(0.0101f, exactQuantile(n, 95), c.p95());
+    }
+  }
+}
+
+// The estimator on its own, at other quantiles of long streams. Not the current
+// stream: it switches between two loads in blocks, and away from the tail the
+// markers follow such a jump in the middle of the distribution only slowly.
+static void test_p2_other_quantiles() {
+  const float qs[] = {0.5f, 0.9f, 0.99f};
+  for (uint32_t k = 0; k < sizeof(qs) / sizeof(qs[0]); k++) {
+    for (uint32_t s = 0; s < CONTINUOUS_COUNT; s++) {
+      if (CONTINUOUS[s].gen == currentSteps) continue;
+      ChannelStats unused;
+      generate(CONTINUOUS[s].gen, MAX_N, 2024 + s, unused);
+      P2Quantile p(qs[k]);
+      for (uint32_t i = 0; i < MAX_N; i++) p.add(samples[i]);
+      TEST_ASSERT_EQUAL_UINT32(MAX_N, p.count());
+      TEST_ASSERT_TRUE_MESSAGE(rankError(p.value(), MAX_N, qs[k]) <= RANK_TOLERANCE, CONTINUOUS[s].name);
+    }
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_p2_exact_below_five_samples);
+  RUN_TEST(test_p95_exact_below_640_samples);
+  RUN_TEST(test_p95_estimate_beyond_640_samples);
+  RUN_TEST(test_p95_estimate_of_quantized_values);
+  RUN_TEST(test_p2_other_quantiles);
+  return UNITY_END();
+}
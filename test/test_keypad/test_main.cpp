@@ -0,0 +1,212 @@
+/**
+ * test_main.cpp - Keypad: key bursts typed while loop() is stuck in blocking I/O
+ *
+ * A millisecond clock drives both sides the way FreeRTOS does on the device.
+ * The scan task (keyScanPass(), above loop() in priority) runs whenever INT
+ * falls or its wait runs out, even while loop() is blocked. loop() only gets
+ * to the queue between its blocking calls (TLS write, NTP, WiFi portal) and
+ * feeds KeypadUi from there. The keys are scripted with contact bounce; every
+ * press must reach the UI once, in order, however long loop() was away.
+ */
+#include <unity.h>
+#include <string.h>
+#include "key_debouncer.h"
+#include "keypad_ui.h"
+
+#define MAX_PRESSES   64
+#define BOUNCE_MS     4     // contacts chatter this long after press and release
+
+struct Press {
+  uint8_t index;
+  uint32_t downMs;
+  uint32_t upMs;
+};
+
+// Keys the customer types: raw scan at any millisecond, bounce included
+class Fingers {
+ public:
+  Fingers() : count_(0) {}
+
+  // Type the keys of text from atMs, holdMs down, gapMs up between keys; returns the end
+  uint32_t type(const char* text, uint32_t atMs, uint32_t holdMs, uint32_t gapMs) {
+    for (const char* p = text; *p; p++) {
+      TEST_ASSERT_TRUE(count_ < MAX_PRESSES);
+      presses_[count_].index = indexOf(*p);
+      presses_[count_].downMs = atMs;
+      presses_[count_].upMs = atMs + holdMs;
+      count_++;
+      atMs += holdMs + gapMs;
+    }
+    return atMs;
+  }
+
+  uint8_t raw(uint32_t t) const {
+    for (uint16_t i = 0; i < count_; i++) {
+      const Press& p = presses_[i];
+      if (t < p.downMs || t >= p.upMs + BOUNCE_MS) continue;
+      if (t < p.downMs + BOUNCE_MS) return (t - p.downMs) % 2 == 0 ? p.index : KEYPAD_NO_KEY;
+      if (t >= p.upMs) return (t - p.upMs) % 2 == 0 ? KEYPAD_NO_KEY : p.index;
+      return p.index;
+    }
+    return KEYPAD_NO_KEY;
+  }
+
+ private:
+  static uint8_t indexOf(char c) {
+    for (uint8_t i = 0; i < 16; i++) {
+      if (KeypadUi::keyFor(i) == c) return i;
+    }
+    TEST_FAIL_MESSAGE("no such key");
+    return KEYPAD_NO_KEY;
+  }
+
+  Press presses_[MAX_PRESSES];
+  uint16_t count_;
+};
+
+// Scan task + loop() on one clock
+struct Device {
+  Fingers fingers;
+  KeyDebouncer debouncer;
+  KeyQueue events;
+  KeypadUi ui;
+  bool intWired;
+  uint32_t now;
+  uint32_t nextScan;
+  uint32_t scans;
+  char typed[MAX_PRESSES + 1];  // key characters loop() got, in order
+  uint8_t typedLen;
+  uint8_t submits;
+  uint32_t worstLatencyMs;      // press accepted -> loop() handled it
+
+  Device() : intWired(true), now(0), nextScan(KEYPAD_IDLE_POLL_MS), scans(0), typedLen(0), submits(0),
+             worstLatencyMs(0) {
+    memset(typed, 0, sizeof(typed));
+    ui.state = STATE_READY;  // WiFi connected
+  }
+
+  // The scan task's share of one millisecond: INT falls on a press from rest
+  void tick() {
+    uint8_t raw = fingers.raw(now);
+    bool intFell = intWired && raw != KEYPAD_NO_KEY && fingers.raw(now - 1) == KEYPAD_NO_KEY;
+    if (intFell || now >= nextScan) {
+      scans++;
+      nextScan = now + keyScanPass(debouncer, events, raw, now);
+    }
+    now++;
+  }
+
+  // loop() inside a blocking call: only the scan task runs
+  void block(uint32_t ms) {
+    for (uint32_t end = now + ms; now < end;) tick();
+  }
+
+  // loop() back at handleKeypad()
+  void handleKeypad() {
+    KeyEvent ev;
+    while (events.pop(ev)) {
+      char k = KeypadUi::keyFor(ev.index);
+      typed[typedLen++] = k;
+      if (now - ev.atMs > worstLatencyMs) worstLatencyMs = now - ev.atMs;
+      if (ui.key(k) == UI_SUBMIT) submits++;
+    }
+  }
+
+  // Alternate blocking calls of blockMs with one pass of the rest of loop()
+  void run(uint32_t untilMs, uint32_t blockMs) {
+    while (now < untilMs) {
+      block(blockMs);
+      handleKeypad();
+    }
+  }
+};
+
+static void test_token_typed_during_one_long_blocking_call() {
+  Device dev;
+  // A and 20 digits at a fast typist's pace, all inside an 8 s NTP/TLS stall
+  uint32_t end = dev.fingers.type("A18886583547834136861", 100, 60, 80);
+  TEST_ASSERT_TRUE(end < 8000);
+  dev.block(8000);
+  TEST_ASSERT_EQUAL_UINT32(21, dev.events.size());
+  dev.handleKeypad();
+  TEST_ASSERT_EQUAL_STRING("A18886583547834136861", dev.typed);
+  TEST_ASSERT_EQUAL_UINT8(1, dev.submits);
+  TEST_ASSERT_EQUAL_STRING("18886583547834136861", dev.ui.input);
+  TEST_ASSERT_EQUAL_UINT32(0, dev.events.dropped());
+}
+
+static void test_bursts_across_mixed_blocking_calls() {
+  Device dev;
+  uint32_t t = dev.fingers.type("A1234", 50, 40, 40);
+  t = dev.fingers.type("56789012345678", t + 700, 45, 30);
+  t = dev.fingers.type("90", t + 2500, 200, 400);
+  dev.fingers.type("C", t + 3000, 80, 0);
+  uint32_t blocks[] = {3000, 250, 1200, 5000, 20, 6000};
+  for (uint8_t i = 0; dev.now < t + 4000; i = (uint8_t)((i + 1) % 6)) {
+    dev.block(blocks[i]);
+    dev.handleKeypad();
+  }
+  TEST_ASSERT_EQUAL_STRING("A1234567890123456789" "0C", dev.typed);
+  TEST_ASSERT_EQUAL_UINT8(1, dev.submits);
+  TEST_ASSERT_EQUAL_UINT32(0, dev.events.dropped());
+  TEST_ASSERT_TRUE(dev.worstLatencyMs <= 6000);  // never more than one blocking call late
+}
+
+// Press times come from the scan task, not from when loop() got to them
+static void test_events_carry_the_press_time() {
+  Device dev;
+  dev.fingers.type("7", 300, 100, 0);
+  dev.block(5000);
+  KeyEvent ev;
+  TEST_ASSERT_TRUE(dev.events.pop(ev));
+  TEST_ASSERT_EQUAL_HEX8('7', KeypadUi::keyFor(ev.index));
+  TEST_ASSERT_UINT32_WITHIN(KEYPAD_SCAN_MS, 300 + BOUNCE_MS + KEYPAD_DEBOUNCE_MS, ev.atMs);
+  TEST_ASSERT_FALSE(dev.events.pop(ev));
+}
+
+// Bounce on press and release never turns into extra presses of the same key
+static void test_bounce_gives_one_press_per_key() {
+  Device dev;
+  dev.fingers.type("5555555555", 10, 30, 30);
+  dev.run(2000, 1);
+  TEST_ASSERT_EQUAL_STRING("5555555555", dev.typed);
+}
+
+// Beyond KEYPAD_QUEUE presses in one stall the newest are dropped and counted, the rest stay in order
+static void test_queue_overflow_is_counted() {
+  Device dev;
+  const char* keys = "1234567890123456789012345678901234567890";  // 40
+  dev.fingers.type(keys, 100, 50, 50);
+  dev.block(10000);
+  dev.handleKeypad();
+  TEST_ASSERT_EQUAL_UINT32(40 - KEYPAD_QUEUE, dev.events.dropped());
+  TEST_ASSERT_EQUAL_UINT8(KEYPAD_QUEUE, dev.typedLen);
+  TEST_ASSERT_EQUAL_MEMORY(keys, dev.typed, KEYPAD_QUEUE);
+}
+
+// INT edge lost (or not wired): the safety poll still finds a key held long enough
+static void test_idle_poll_without_int() {
+  Device dev;
+  dev.intWired = false;
+  dev.fingers.type("C", 1500, 1200, 0);
+  dev.run(4000, 500);
+  TEST_ASSERT_EQUAL_STRING("C", dev.typed);
+  // At rest the task only wakes for the poll
+  Device quiet;
+  quiet.block(10000);
+  TEST_ASSERT_TRUE(quiet.scans <= 10000 / KEYPAD_IDLE_POLL_MS);
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_token_typed_during_one_long_blocking_call);
+  RUN_TEST(test_bursts_across_mixed_blocking_calls);
+  RUN_TEST(test_events_carry_the_press_time);
+  RUN_TEST(test_bounce_gives_one_press_per_key);
+  RUN_TEST(test_queue_overflow_is_counted);
+  RUN_TEST(test_idle_poll_without_int);
+  return UNITY_END();
+}
@@ -0,0 +1,331 @@
+/**
+ * test_main.cpp - MeteringCore cadence and the cross-core hand-off while the
+ * network loop stalls
+ *
+ * The metering period runs on a fake clock, one meteringTick() (main.cpp) every
+ * METER_PERIOD_MS: poll, queued BillingCommands, settle, samples into the same
+ * SpscRing<PzemReading, 16> and billing state into the same SeqLock as the
+ * firmware. The consumer plays loop(): it drains the ring and reads the snapshot
+ * every 20 ms, except while an HTTPS request or a WiFi reconnect blocks it for
+ * seconds. A stalled consumer must cost samples (counted, oldest kept), never a
+ * meter request, a period or a microwatt-hour of billing.
+ *
+ * The second run puts producer and consumer on two host threads, as on the two
+ * cores, and checks every snapshot the consumer takes for a torn copy.
+ */
+#include <unity.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "metering_core.h"
+#include "persist_journal.h"
+#include "spsc_ring.h"
+#include "seqlock.h"
+
+#define LOAD_DW         10000       // 1 kW
+#define CREDIT_KWH      1000.0f     // never exhausted within a run
+#define TOP_UP_KWH      5.0f
+#define RING_SLOTS      16          // main.cpp sampleRing
+#define LOOP_PASS_MS    20          // loop() pass without a stall
+
+// Answers every request on the next collect, like the UART driver one period
+// later; the register integrates the load exactly
+class StepMeter : public HalMeter {
+ public:
+  StepMeter() : pending_(false), sentMs_(0), dwMs_(0), requests_(0), refused_(0) {
+    memset(&r_, 0, sizeof(r_));
+  }
+  bool request(uint32_t nowMs) override {
+    if (pending_) {
+      refused_++;
+      return false;
+    }
+    pending_ = true;
+    sentMs_ = nowMs;
+    requests_++;
+    return true;
+  }
+  int collect(uint32_t nowMs) override {
+    if (!pending_) return PZEM_IDLE;
+    pending_ = false;
+    if (r_.t_ms != 0) dwMs_ += (uint64_t)LOAD_DW * (sentMs_ - r_.t_ms);
+    r_.t_ms = sentMs_;
+    r_.voltage = 230.0f;
+    r_.power_dw = LOAD_DW;
+    r_.power = LOAD_DW / 10.0f;
+    r_.pf = 1.0f;
+    r_.current = r_.power / r_.voltage;
+    r_.frequency = 50.0f;
+    r_.energy_wh = (uint32_t)(dwMs_ / 36 / 1000000);  // 1 dW for 1 ms = 1/36 uWh
+    r_.energy_kwh = r_.energy_wh / 1000.0f;
+    (void)nowMs;
+    return PZEM_OK;
+  }
+  const PzemReading& last() const override { return r_; }
+
+  uint32_t requests() const { return requests_; }
+  uint32_t refused() const { return refused_; }
+
+ private:
+  PzemReading r_;
+  bool pending_;
+  uint32_t sentMs_;
+  uint64_t dwMs_;
+  uint32_t requests_;
+  uint32_t refused_;
+};
+
+class CountRelay : public HalRelay {
+ public:
+  CountRelay() : on(false) {}
+  void set(bool v) override { on = v; }
+  bool on;
+};
+
+class RamStore : public HalStore {
+ public:
+  RamStore() { memset(mem_, 0xFF, sizeof(mem_)); }
+  void read(uint32_t addr, void* buf, size_t len) override {
+    if (addr + len <= sizeof(mem_)) memcpy(buf, mem_ + addr, len);
+  }
+  void write(uint32_t addr, const void* buf, size_t len) override {
+    if (addr + len <= sizeof(mem_)) memcpy(mem_ + addr, buf, len);
+  }
+  bool commit() override { return true; }
+
+ private:
+  uint8_t mem_[EEPROM_SIZE];
+};
+
+// The metering task's side: MeteringCore plus the queues main.cpp shares with loop()
+struct Rig {
+  StepMeter meter;
+  CountRelay relay;
+  RamStore store;
+  PersistJournal journal;   // unattached: EEPROM checkpoints
+  MeteringCore core;
+  SpscRing<PzemReading, RING_SLOTS> samples;
+  SeqLock<BillingState> billing;
+  SpscRing<BillingCommand, 4> commands;
+  uint32_t pushes;
+  uint32_t lastT;           // newest sample published, kept or not
+
+  Rig() : core(meter, relay, journal, store), pushes(0), lastT(0) {}
+
+  // main.cpp meteringTick()
+  void tick(uint32_t now) {
+    bool fresh = core.poll(now);
+    BillingCommand cmd;
+    while (commands.pop(cmd)) core.apply(cmd, now);
+    PzemReading sample;
+    if (core.settle(now, fresh, sample)) {
+      samples.push(sample);
+      pushes++;
+      lastT = sample.t_ms;
+    }
+    billing.write(core.billing());
+  }
+};
+
+static BillingCommand command(uint32_t id, float kwh, bool topUp) {
+  BillingCommand cmd = {};
+  cmd.id = id;
+  cmd.kwh = kwh;
+  cmd.top_up = topUp;
+  strcpy(cmd.token, topUp ? "22222222222222222222" : "11111111111111111111");
+  return cmd;
+}
+
+// The fields a torn copy would disagree on: kWh views against the exact counters,
+// and purchased credit against the commands applied so far
+static bool snapshotConsistent(const BillingState& b) {
+  if (b.remaining_kwh != EnergyLedger::toKwh(b.remaining_uwh)) return false;
+  if (b.consumed_kwh != EnergyLedger::toKwh(b.consumed_uwh)) return false;
+  int64_t purchased = 0;
+  if (b.commands_applied >= 1) purchased += EnergyLedger::fromKwh(CREDIT_KWH);
+  if (b.commands_applied >= 2) purchased += EnergyLedger::fromKwh(TOP_UP_KWH);
+  if (b.commands_applied >= 1 && b.remaining_uwh + b.consumed_uwh != purchased) return false;
+  return b.commands_applied != 1 || strcmp(b.token, "11111111111111111111") == 0;
+}
+
+// Consumer bookkeeping: samples must arrive oldest first, one period apart, with
+// a hole exactly where the ring overflowed
+struct Drain {
+  uint32_t popped;
+  uint32_t lastT;
+  uint32_t holes;        // periods missing between two popped samples
+  uint32_t badSteps;     // not a whole number of periods, or backwards
+  uint32_t torn;
+  uint32_t lastVersion;
+
+  Drain() : popped(0), lastT(0), holes(0), badSteps(0), torn(0), lastVersion(0) {}
+
+  void pass(Rig& rig) {
+    PzemReading s;
+    while (rig.samples.pop(s)) {
+      if (popped > 0) {
+        uint32_t step = s.t_ms - lastT;
+        if (step == 0 || step % METER_PERIOD_MS != 0 || step > 0x80000000UL) badSteps++;
+        else holes += step / METER_PERIOD_MS - 1;
+      }
+      lastT = s.t_ms;
+      popped++;
+    }
+    BillingState b = rig.billing.read();
+    uint32_t v = rig.billing.version();
+    if (!snapshotConsistent(b) || v < lastVersion) torn++;
+    lastVersion = v;
+  }
+
+  // After the producer stopped: samples dropped behind the last one popped
+  void finish(Rig& rig) {
+    pass(rig);
+    holes += (rig.lastT - lastT) / METER_PERIOD_MS;
+  }
+};
+
+struct Stall {
+  uint32_t atMs;
+  uint32_t forMs;
+};
+
+// HTTPS post, a TLS handshake, a WiFi reconnect, the config portal's first seconds
+static const Stall STALLS[] = {
+  {60000, 2500}, {120000, 3200}, {180000, 5000}, {300000, 30000}, {420000, 8000},
+};
+#define STALL_COUNT (sizeof(STALLS) / sizeof(STALLS[0]))
+#define RUN_MS      600000UL
+
+static void test_stalled_consumer_keeps_the_metering_period() {
+  static Rig rig;
+  rig.core.restore(0);
+  BillingCommand first = command(1, CREDIT_KWH, false);
+  TEST_ASSERT_TRUE(rig.commands.push(first));
+
+  Drain drain;
+  uint32_t expectedDrops = 0;
+  uint32_t pushesAtDrain = 0;
+  uint32_t nextLoop = 0;
+  uint32_t ticks = 0;
+  size_t stall = 0;
+  uint32_t firstTick = METER_PERIOD_MS;
+  for (uint32_t now = firstTick; now <= RUN_MS; now += METER_PERIOD_MS / 10) {
+    if ((now - firstTick) % METER_PERIOD_MS == 0) {
+      rig.tick(now);
+      ticks++;
+    }
+    if (now < nextLoop) continue;
+    uint32_t produced = rig.pushes - pushesAtDrain;
+    if (produced > RING_SLOTS) expectedDrops += produced - RING_SLOTS;
+    drain.pass(rig);
+    pushesAtDrain = rig.pushes;
+    nextLoop = now + LOOP_PASS_MS;
+    if (stall < STALL_COUNT && now >= STALLS[stall].atMs) {
+      nextLoop = now + STALLS[stall].forMs;
+      stall++;
+    }
+  }
+  drain.finish(rig);
+
+  // Cadence: one request per period, none refused, every one answered
+  TEST_ASSERT_EQUAL_UINT32(ticks, rig.meter.requests());
+  TEST_ASSERT_EQUAL_UINT32(0, rig.meter.refused());
+  TEST_ASSERT_EQUAL_UINT32(ticks - 1, rig.pushes);
+
+  // Hand-off: drops only past the ring's 16 slots, each one a hole the consumer sees
+  TEST_ASSERT_EQUAL_UINT32(expectedDrops, rig.samples.dropped());
+  TEST_ASSERT_EQUAL_UINT32(rig.pushes, drain.popped + rig.samples.dropped());
+  TEST_ASSERT_EQUAL_UINT32(rig.samples.dropped(), drain.holes);
+  TEST_ASSERT_EQUAL_UINT32(0, drain.badSteps);
+  TEST_ASSERT_EQUAL_UINT32(0, drain.torn);
+  TEST_ASSERT_EQUAL_UINT32(ticks, rig.billing.version());
+
+  // Billing: every period integrated, stall or not (first reading starts the series)
+  BillingState b = rig.billing.read();
+  int64_t expectedUwh = (int64_t)LOAD_DW * (RUN_MS - 2 * METER_PERIOD_MS) / 36;
+  TEST_ASSERT_TRUE(b.consumed_uwh >= expectedUwh - 1 && b.consumed_uwh <= expectedUwh + 1);
+  TEST_ASSERT_EQUAL_UINT32(0, b.ledger_corrections);
+  TEST_ASSERT_TRUE(rig.relay.on);
+
+  char msg[128];
+  snprintf(msg, sizeof(msg), "%lu periods, %lu samples dropped in %u stalls, %.3f kWh billed",
+           (unsigned long)ticks, (unsigned long)rig.samples.dropped(), (unsigned)STALL_COUNT,
+           b.consumed_kwh);
+  TEST_MESSAGE(msg);
+}
+
+// ------ Two threads: the metering task on one core, loop() on the other ------
+
+#define THREAD_TICKS        20000      // 4000 s of metering
+#define THREAD_TICK_US      50         // fake clock at 4000x
+#define THREAD_STALL_EVERY  30000      // ms of metering between two stalls
+#define THREAD_STALL_US     8000       // ~160 periods at 50 us: the ring overflows
+
+static void test_snapshot_and_ring_consistent_across_threads() {
+  static Rig rig;
+  rig.core.restore(0);
+  TEST_ASSERT_TRUE(rig.commands.push(command(1, CREDIT_KWH, false)));
+
+  std::atomic<uint32_t> nowMs(0);
+  std::atomic<bool> done(false);
+
+  std::thread metering([&]() {
+    for (uint32_t i = 1; i <= THREAD_TICKS; i++) {
+      uint32_t now = i * METER_PERIOD_MS;
+      nowMs.store(now, std::memory_order_release);
+      rig.tick(now);
+      std::this_thread::sleep_for(std::chrono::microseconds(THREAD_TICK_US));
+    }
+    done.store(true, std::memory_order_release);
+  });
+
+  Drain drain;
+  uint32_t passes = 0;
+  uint32_t stalls = 0;
+  uint32_t nextStall = THREAD_STALL_EVERY;
+  bool toppedUp = false;
+  while (!done.load(std::memory_order_acquire)) {
+    drain.pass(rig);
+    passes++;
+    uint32_t now = nowMs.load(std::memory_order_acquire);
+    if (!toppedUp && now >= THREAD_TICKS * METER_PERIOD_MS / 2) {
+      toppedUp = rig.commands.push(command(2, TOP_UP_KWH, true));
+    }
+    if (now >= nextStall) {
+      std::this_thread::sleep_for(std::chrono::microseconds(THREAD_STALL_US));
+      nextStall = now + THREAD_STALL_EVERY;
+      stalls++;
+    }
+  }
+  metering.join();
+  drain.finish(rig);
+
+  BillingState b = rig.billing.read();
+  TEST_ASSERT_TRUE(toppedUp);
+  TEST_ASSERT_EQUAL_UINT32(2, b.commands_applied);
+  TEST_ASSERT_EQUAL_UINT32(2, b.last_command_id);
+  TEST_ASSERT_EQUAL_UINT32(THREAD_TICKS, rig.meter.requests());
+  TEST_ASSERT_EQUAL_UINT32(0, rig.meter.refused());
+  TEST_ASSERT_EQUAL_UINT32(THREAD_TICKS - 1, rig.pushes);
+  TEST_ASSERT_EQUAL_UINT32(rig.pushes, drain.popped + rig.samples.dropped());
+  TEST_ASSERT_EQUAL_UINT32(rig.samples.dropped(), drain.holes);
+  TEST_ASSERT_EQUAL_UINT32(0, drain.badSteps);
+  TEST_ASSERT_EQUAL_UINT32(0, drain.torn);
+  TEST_ASSERT_TRUE(snapshotConsistent(b));
+
+  char msg[128];
+  snprintf(msg, sizeof(msg), "%lu snapshots checked, %lu stalls, %lu samples dropped",
+           (unsigned long)passes, (unsigned long)stalls, (unsigned long)rig.samples.dropped());
+  TEST_MESSAGE(msg);
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_stalled_consumer_keeps_the_metering_period);
+  RUN_TEST(test_snapshot_and_ring_consistent_across_threads);
+  return UNITY_END();
+}
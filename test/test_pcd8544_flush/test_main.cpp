@@ -0,0 +1,210 @@
+/**
+ * test_main.cpp - pcd8544Flush: the dirty-region diff of the Nokia 5110 driver
+ * against a fake panel
+ *
+ * FakePanel decodes what the driver writes like the PCD8544 does (Y/X address
+ * commands, X auto-increment wrapping into the next bank) into its own display
+ * RAM. Writes are queued and only played at the next flush, as with the DMA
+ * transport, so the frame being drawn meanwhile must not reach the panel. After
+ * every flush the panel has to show exactly the flushed frame, with no more
+ * bytes on the wire than the changed spans need.
+ */
+#include <unity.h>
+#include <string.h>
+#include "pcd8544_flush.h"
+
+#define MAX_WRITES  (2 * PCD8544_BANKS)
+
+struct QueuedWrite {
+  bool isData;
+  const uint8_t* bytes;  // data: the driver's buffer, read at drain()
+  size_t len;
+  uint8_t cmd[4];        // commands: copied, as the SPI transport does
+};
+
+class FakePanel {
+ public:
+  FakePanel() : queued_(0), x_(0), y_(0), misaligned_(0) { memset(ram_, 0, sizeof(ram_)); }
+
+  static void write(void* ctx, bool isData, const uint8_t* bytes, size_t len) {
+    FakePanel& p = *(FakePanel*)ctx;
+    TEST_ASSERT_TRUE(p.queued_ < MAX_WRITES);
+    QueuedWrite& w = p.writes_[p.queued_++];
+    w.isData = isData;
+    w.len = len;
+    if (isData) {
+      w.bytes = bytes;
+    } else {
+      TEST_ASSERT_TRUE(len <= sizeof(w.cmd));
+      memcpy(w.cmd, bytes, len);
+      w.bytes = w.cmd;
+    }
+  }
+
+  // The fence: the transfers happen now, from wherever the driver pointed them
+  void drain(const uint8_t* sent, uint8_t spanAlign) {
+    for (uint8_t i = 0; i < queued_; i++) {
+      const QueuedWrite& w = writes_[i];
+      if (w.isData && ((w.bytes - sent) % spanAlign != 0 || w.len % spanAlign != 0)) misaligned_++;
+      for (size_t k = 0; k < w.len; k++) {
+        if (w.isData) {
+          ram_[y_ * PCD8544_WIDTH + x_] = w.bytes[k];
+          if (++x_ == PCD8544_WIDTH) {
+            x_ = 0;
+            y_ = (uint8_t)((y_ + 1) % PCD8544_BANKS);
+          }
+        } else if ((w.bytes[k] & 0x80) != 0) {
+          x_ = w.bytes[k] & 0x7F;
+          TEST_ASSERT_TRUE(x_ < PCD8544_WIDTH);
+        } else if ((w.bytes[k] & 0xC0) == PCD8544_SETYADDR) {
+          y_ = w.bytes[k] & 0x07;
+          TEST_ASSERT_TRUE(y_ < PCD8544_BANKS);
+        }
+      }
+    }
+    queued_ = 0;
+  }
+
+  const uint8_t* ram() const { return ram_; }
+  uint8_t queued() const { return queued_; }
+  const QueuedWrite& queuedWrite(uint8_t i) const { return writes_[i]; }
+  uint32_t misaligned() const { return misaligned_; }
+
+ private:
+  uint8_t ram_[PCD8544_FRAME_BYTES];
+  QueuedWrite writes_[MAX_WRITES];
+  uint8_t queued_;
+  uint8_t x_, y_;
+  uint32_t misaligned_;
+};
+
+static uint32_t rngState;
+static uint32_t rnd() {
+  rngState = rngState * 1664525UL + 1013904223UL;
+  return rngState >> 8;
+}
+
+struct Rig {
+  uint8_t frame[PCD8544_FRAME_BYTES];
+  uint8_t sent[PCD8544_FRAME_BYTES] __attribute__((aligned(4)));
+  FakePanel panel;
+  uint8_t align;  // of the flush in flight
+  Rig() : align(1) {
+    memset(frame, 0, sizeof(frame));
+    memset(sent, 0, sizeof(sent));
+  }
+  void drain() { panel.drain(sent, align); }
+  uint16_t flush(bool sentValid, uint8_t spanAlign) {
+    drain();  // previous frame's transfers finish before the diff
+    align = spanAlign;
+    return pcd8544Flush(frame, sent, sentValid, spanAlign, FakePanel::write, &panel);
+  }
+};
+
+static void test_first_flush_sends_everything_then_nothing() {
+  Rig rig;
+  for (size_t i = 0; i < sizeof(rig.frame); i++) rig.frame[i] = (uint8_t)(i * 37);
+  TEST_ASSERT_EQUAL_UINT16(PCD8544_BANKS * (2 + PCD8544_WIDTH), rig.flush(false, 1));
+  TEST_ASSERT_EQUAL_UINT16(0, rig.flush(true, 1));
+  TEST_ASSERT_EQUAL_UINT8(0, rig.panel.queued());
+  TEST_ASSERT_EQUAL_MEMORY(rig.frame, rig.panel.ram(), sizeof(rig.frame));
+
+  // Panel state unknown (invalidate()): whole frame again even though nothing changed
+  TEST_ASSERT_EQUAL_UINT16(PCD8544_BANKS * (2 + PCD8544_WIDTH), rig.flush(false, 4));
+}
+
+static void test_one_pixel_costs_one_span() {
+  Rig rig;
+  rig.flush(false, 1);
+  rig.frame[3 * PCD8544_WIDTH + 41] |= 0x10;
+  TEST_ASSERT_EQUAL_UINT16(2 + 1, rig.flush(true, 1));
+  TEST_ASSERT_EQUAL_UINT8(2, rig.panel.queued());
+  TEST_ASSERT_EQUAL_HEX8(PCD8544_SETYADDR | 3, rig.panel.queuedWrite(0).bytes[0]);
+  TEST_ASSERT_EQUAL_HEX8(PCD8544_SETXADDR | 41, rig.panel.queuedWrite(0).bytes[1]);
+
+  // DMA alignment: the span grows to the enclosing word, 40..43
+  rig.frame[3 * PCD8544_WIDTH + 41] &= (uint8_t)~0x10;
+  TEST_ASSERT_EQUAL_UINT16(2 + 4, rig.flush(true, 4));
+  TEST_ASSERT_EQUAL_HEX8(PCD8544_SETXADDR | 40, rig.panel.queuedWrite(0).bytes[1]);
+  rig.drain();
+  TEST_ASSERT_EQUAL_UINT32(0, rig.panel.misaligned());
+  TEST_ASSERT_EQUAL_MEMORY(rig.frame, rig.panel.ram(), sizeof(rig.frame));
+
+  // Changes at both ends of a bank: one span from the first to the last
+  rig.frame[5 * PCD8544_WIDTH + 0] = 0xFF;
+  rig.frame[5 * PCD8544_WIDTH + PCD8544_WIDTH - 1] = 0xFF;
+  TEST_ASSERT_EQUAL_UINT16(2 + PCD8544_WIDTH, rig.flush(true, 4));
+}
+
+// A text row redraw touches one bank; the others are not addressed at all
+static void test_text_row_change_stays_in_its_bank() {
+  Rig rig;
+  rig.flush(false, 4);
+  for (uint8_t x = 12; x < 30; x++) rig.frame[2 * PCD8544_WIDTH + x] = (uint8_t)(x | 0x81);
+  TEST_ASSERT_EQUAL_UINT16(2 + 20, rig.flush(true, 4));  // 12..31
+  TEST_ASSERT_EQUAL_UINT8(2, rig.panel.queued());
+  TEST_ASSERT_EQUAL_HEX8(PCD8544_SETYADDR | 2, rig.panel.queuedWrite(0).bytes[0]);
+  rig.drain();
+  TEST_ASSERT_EQUAL_MEMORY(rig.frame, rig.panel.ram(), sizeof(rig.frame));
+}
+
+// Seeded random edits, drawn while the previous flush is still "in flight"
+static void randomFrames(uint8_t spanAlign) {
+  Rig rig;
+  rngState = 0xC0FFEE + spanAlign;
+  rig.flush(false, spanAlign);
+  uint8_t expected[PCD8544_FRAME_BYTES];
+  for (int f = 0; f < 500; f++) {
+    uint32_t edits = rnd() % 6;
+    for (uint32_t e = 0; e < edits; e++) {
+      uint32_t at = rnd() % PCD8544_FRAME_BYTES;
+      uint32_t run = 1 + rnd() % 12;
+      for (uint32_t k = 0; k < run && at + k < PCD8544_FRAME_BYTES; k++) rig.frame[at + k] ^= (uint8_t)(1 + rnd() % 255);
+    }
+    // What this frame must send: addressing + changed span per bank, plus alignment
+    uint16_t minBytes = 0, maxBytes = 0;
+    for (uint8_t bank = 0; bank < PCD8544_BANKS; bank++) {
+      const uint8_t* cur = rig.frame + bank * PCD8544_WIDTH;
+      const uint8_t* old = rig.sent + bank * PCD8544_WIDTH;
+      int first = -1, last = -1;
+      for (int x = 0; x < PCD8544_WIDTH; x++) {
+        if (cur[x] == old[x]) continue;
+        if (first < 0) first = x;
+        last = x;
+      }
+      if (first < 0) continue;
+      minBytes += 2 + (last - first + 1);
+      maxBytes += 2 + (last - first + 1) + 2 * (spanAlign - 1);
+    }
+    uint16_t bytes = rig.flush(true, spanAlign);
+    TEST_ASSERT_TRUE(bytes >= minBytes && bytes <= maxBytes);
+    memcpy(expected, rig.frame, sizeof(expected));
+
+    // Next frame's drawing starts before the transfer has run
+    rig.frame[rnd() % PCD8544_FRAME_BYTES] ^= 0x5A;
+    rig.drain();
+    TEST_ASSERT_EQUAL_MEMORY(expected, rig.panel.ram(), sizeof(expected));
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, rig.panel.misaligned());
+}
+
+static void test_random_frames_bit_banged() {
+  randomFrames(1);
+}
+
+static void test_random_frames_dma_aligned() {
+  randomFrames(4);
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_flush_sends_everything_then_nothing);
+  RUN_TEST(test_one_pixel_costs_one_span);
+  RUN_TEST(test_text_row_change_stays_in_its_bank);
+  RUN_TEST(test_random_frames_bit_banged);
+  RUN_TEST(test_random_frames_dma_aligned);
+  return UNITY_END();
+}
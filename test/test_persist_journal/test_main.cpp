@@ -0,0 +1,219 @@
+/**
+ * test_main.cpp - PersistJournal: commit coalescing, delta records, wear leveling
+ * and the erase-cycle projection behind the numbers in persist_journal.h
+ *
+ * The journal runs on a RAM partition of the real size (8 pages, partitions.csv)
+ * that follows the NOR rules and counts the erases of every sector. A simulated
+ * month of metering (a stage() every second, a token every day) is projected to
+ * ten years and held against the header's claim and the flash rating.
+ */
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "persist_journal.h"
+#include "energy_ledger.h"
+
+#define JOURNAL_PAGES       8
+#define COMMIT_INTERVAL_MS  60000UL    // config.h PERSIST_COMMIT_INTERVAL_MS
+#define DAY_MS              86400000UL
+#define FLASH_RATED_CYCLES  100000UL
+
+class WearFlash : public HalFlash {
+ public:
+  WearFlash() {
+    memset(mem_, 0xFF, sizeof(mem_));
+    memset(erases_, 0, sizeof(erases_));
+    bytesWritten_ = 0;
+  }
+  uint32_t size() const override { return sizeof(mem_); }
+  bool read(uint32_t offset, void* buf, size_t len) override {
+    if (offset + len > sizeof(mem_)) return false;
+    memcpy(buf, mem_ + offset, len);
+    return true;
+  }
+  bool write(uint32_t offset, const void* buf, size_t len) override {
+    if (offset + len > sizeof(mem_)) return false;
+    const uint8_t* src = (const uint8_t*)buf;
+    for (size_t i = 0; i < len; i++) mem_[offset + i] &= src[i];  // NOR: bits only clear
+    bytesWritten_ += len;
+    return true;
+  }
+  bool erase(uint32_t offset, size_t len) override {
+    if (offset % PJ_PAGE_SIZE != 0 || len % PJ_PAGE_SIZE != 0 || offset + len > sizeof(mem_)) return false;
+    memset(mem_ + offset, 0xFF, len);
+    for (uint32_t p = offset / PJ_PAGE_SIZE; p < (offset + len) / PJ_PAGE_SIZE; p++) erases_[p]++;
+    return true;
+  }
+  const void* map(uint32_t offset, size_t len) override {
+    return offset + len <= sizeof(mem_) ? mem_ + offset : NULL;
+  }
+  void unmap(const void*) override {}
+
+  uint32_t erases(uint16_t page) const { return erases_[page]; }
+  uint32_t totalErases() const {
+    uint32_t n = 0;
+    for (int p = 0; p < JOURNAL_PAGES; p++) n += erases_[p];
+    return n;
+  }
+  uint32_t minErases() const {
+    uint32_t n = erases_[0];
+    for (int p = 1; p < JOURNAL_PAGES; p++) n = erases_[p] < n ? erases_[p] : n;
+    return n;
+  }
+  uint32_t maxErases() const {
+    uint32_t n = 0;
+    for (int p = 0; p < JOURNAL_PAGES; p++) n = erases_[p] > n ? erases_[p] : n;
+    return n;
+  }
+  uint32_t bytesWritten() const { return bytesWritten_; }
+
+ private:
+  uint8_t mem_[JOURNAL_PAGES * PJ_PAGE_SIZE];
+  uint32_t erases_[JOURNAL_PAGES];
+  uint32_t bytesWritten_;
+};
+
+static PersistState sessionState() {
+  PersistState s;
+  memset(&s, 0, sizeof(s));
+  s.purchasedUwh = EnergyLedger::fromKwh(50.0f);
+  s.baselineWh = 12345;
+  s.haveBaseline = true;
+  strcpy(s.token, "18886583547834136861");
+  return s;
+}
+
+static bool sameState(const PersistState& a, const PersistState& b) {
+  return a.purchasedUwh == b.purchasedUwh && a.consumedUwh == b.consumedUwh && a.baselineWh == b.baselineWh &&
+         a.haveBaseline == b.haveBaseline && strcmp(a.token, b.token) == 0 &&
+         memcmp(&a.purchases, &b.purchases, sizeof(a.purchases)) == 0;
+}
+
+// What the metering task does for `days`: a stage() per second with ~500 W flowing
+// (commits coalesced to the interval), a forced commit for one token a day
+static void simulate(PersistJournal& journal, PersistState& s, uint32_t& nowMs, uint32_t days, uint32_t stepMs) {
+  uint32_t end = nowMs + days * DAY_MS;
+  uint32_t nextToken = nowMs + DAY_MS;
+  for (; nowMs != end; nowMs += stepMs) {
+    s.consumedUwh += 500LL * stepMs * 1000 / 3600;  // 500 W
+    bool token = nowMs == nextToken;
+    if (token) {
+      s.purchasedUwh += EnergyLedger::fromKwh(10.0f);
+      nextToken += DAY_MS;
+    }
+    journal.stage(s);
+    journal.service(nowMs, token);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_commits_are_coalesced() {
+  WearFlash flash;
+  PersistJournal journal;
+  TEST_ASSERT_TRUE(journal.begin(flash, COMMIT_INTERVAL_MS));
+  PersistState s = sessionState();
+
+  // One hour of metering periods: one commit per interval, not one per period
+  for (uint32_t t = 0; t <= 3600000UL; t += 200) {
+    s.consumedUwh += 1000;
+    journal.stage(s);
+    journal.service(t);
+  }
+  TEST_ASSERT_EQUAL_UINT32(61, journal.commits());  // t = 0, then every 60 s
+
+  // Nothing changed: nothing written, even when forced
+  uint32_t bytes = flash.bytesWritten();
+  journal.stage(journal.state());
+  TEST_ASSERT_FALSE(journal.service(7200000UL, true));
+  TEST_ASSERT_EQUAL_UINT32(bytes, flash.bytesWritten());
+
+  // A token is written at once, not at the next interval
+  s.purchasedUwh += EnergyLedger::fromKwh(5.0f);
+  journal.stage(s);
+  TEST_ASSERT_FALSE(journal.service(3600001UL));
+  TEST_ASSERT_TRUE(journal.service(3600001UL, true));
+  TEST_ASSERT_TRUE(sameState(s, journal.state()));
+}
+
+static void test_steady_state_is_deltas_without_erase() {
+  WearFlash flash;
+  PersistJournal journal;
+  journal.begin(flash, COMMIT_INTERVAL_MS);
+  PersistState s = sessionState();
+  journal.stage(s);
+  journal.service(0);
+  TEST_ASSERT_EQUAL_UINT32(1, flash.totalErases());  // first page
+
+  // Consumption only: 8 bytes a commit (4 header + 4 delta), the page fills before any erase
+  uint32_t bytes = flash.bytesWritten();
+  uint32_t deltas = 0;
+  uint32_t t = 0;
+  while (flash.totalErases() == 1) {
+    s.consumedUwh += 123456;
+    journal.stage(s);
+    t += COMMIT_INTERVAL_MS;
+    journal.service(t);
+    if (flash.totalErases() == 1) deltas++;
+  }
+  TEST_ASSERT_EQUAL_UINT32(deltas * 8, flash.bytesWritten() - bytes - (sizeof(BillingCheckpoint) + 4 + 16));
+  // Header (16) + checkpoint record, then deltas to the end of the page
+  TEST_ASSERT_EQUAL_UINT32((PJ_PAGE_SIZE - 16 - (sizeof(BillingCheckpoint) + 4)) / 8, deltas);
+  TEST_ASSERT_EQUAL_UINT32(2, journal.eraseCycles());
+}
+
+static void test_wear_is_level_and_projection_holds() {
+  static WearFlash flash;  // 32 KB: off the stack
+  PersistJournal journal;
+  journal.begin(flash, COMMIT_INTERVAL_MS);
+  PersistState s = sessionState();
+  uint32_t nowMs = 0;
+  simulate(journal, s, nowMs, 30, 1000);
+
+  // Rotation visits the pages in turn: none is more than one erase ahead of another
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(1, flash.maxErases() - flash.minErases());
+  TEST_ASSERT_EQUAL_UINT32(flash.maxErases(), journal.maxPageErases());
+  TEST_ASSERT_EQUAL_UINT32(flash.totalErases(), journal.eraseCycles());
+
+  // persist_journal.h: about every 3 days per page, ~1,300 cycles in 10 years
+  uint32_t tenYears = flash.maxErases() * 3650UL / 30;
+  char msg[96];
+  snprintf(msg, sizeof(msg), "60 s interval: %u erases/page in 30 days -> %u in 10 years",
+           (unsigned)flash.maxErases(), (unsigned)tenYears);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_UINT32_WITHIN(200, 1300, tenYears);
+
+  // The journal still restores exactly what was last committed
+  PersistJournal again;
+  again.begin(flash, COMMIT_INTERVAL_MS);
+  TEST_ASSERT_TRUE(again.hasState());
+  TEST_ASSERT_TRUE(sameState(journal.state(), again.state()));
+}
+
+static void test_short_interval_stays_within_rating() {
+  static WearFlash flash;
+  PersistJournal journal;
+  journal.begin(flash, 5000);
+  PersistState s = sessionState();
+  uint32_t nowMs = 0;
+  simulate(journal, s, nowMs, 5, 1000);
+
+  // persist_journal.h: "a 5 s interval would still stay around 16k"
+  uint32_t tenYears = flash.maxErases() * 3650UL / 5;
+  char msg[96];
+  snprintf(msg, sizeof(msg), "5 s interval: %u erases/page in 5 days -> %u in 10 years",
+           (unsigned)flash.maxErases(), (unsigned)tenYears);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_UINT32_WITHIN(1000, 16000, tenYears);
+  TEST_ASSERT_LESS_THAN_UINT32(FLASH_RATED_CYCLES, tenYears);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_commits_are_coalesced);
+  RUN_TEST(test_steady_state_is_deltas_without_erase);
+  RUN_TEST(test_wear_is_level_and_projection_holds);
+  RUN_TEST(test_short_interval_stays_within_rating);
+  return UNITY_END();
+}
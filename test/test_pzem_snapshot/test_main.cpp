@@ -0,0 +1,280 @@
+/**
+ * test_main.cpp - PzemSnapshot on a simulated 9600 baud line: one frame per
+ * metering cycle, bus time against the six-read library, CRC and timeout paths
+ *
+ * A fake PZEM-004T sits behind HalSerial. It checks every request frame
+ * (address, function 0x04, registers 0x0000..0x0009, CRC), answers after a
+ * device latency with the 25-byte reply, and lets the bytes trickle into the
+ * RX buffer at 10 bits per byte, on a microsecond clock the test moves. It can
+ * corrupt a reply, stay silent or answer late. Every byte in either direction
+ * is counted, so bus time is measured on the wire and not taken from a formula.
+ */
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "pzem_snapshot.h"
+#include "metering_core.h"
+
+#define BYTE_US          1042     // 10 bits at 9600 baud
+#define DEVICE_LATENCY_US 10000   // request received -> first reply byte
+#define REPLY_LEN        25
+#define REQUEST_LEN      8
+#define LIBRARY_READS    6        // voltage(), current(), power(), energy(), frequency(), pf()
+
+static uint64_t nowUs;
+static uint32_t nowMs() { return (uint32_t)(nowUs / 1000); }
+
+enum ReplyMode { REPLY_OK, REPLY_CORRUPT, REPLY_SILENT, REPLY_LATE };
+
+class FakePzem : public HalSerial {
+ public:
+  FakePzem() { reset(); }
+  void reset() {
+    rxLen_ = rxPos_ = counted_ = 0;
+    firstByteUs_ = 0;
+    requests = badRequests = busBytes = 0;
+    energyWh = 123456;
+    mode = REPLY_OK;
+    lateUs = 0;
+  }
+
+  int available() override {
+    uint32_t arrived = arrivedBytes();
+    return arrived > rxPos_ ? (int)(arrived - rxPos_) : 0;
+  }
+  int read() override {
+    if (available() == 0) return -1;
+    return rx_[rxPos_++];
+  }
+  size_t write(const uint8_t* buf, size_t len) override {
+    busBytes += len;
+    const uint8_t expect[6] = {PZEM_DEFAULT_ADDR, 0x04, 0x00, 0x00, 0x00, 0x0A};
+    uint16_t crc = PzemSnapshot::crc16(buf, 6);
+    if (len != REQUEST_LEN || memcmp(buf, expect, 6) != 0 || buf[6] != (crc & 0xFF) || buf[7] != (crc >> 8)) {
+      badRequests++;
+      return len;
+    }
+    requests++;
+    ReplyMode m = mode;
+    mode = REPLY_OK;   // one-shot
+    if (m == REPLY_SILENT) return len;
+    buildReply();
+    if (m == REPLY_CORRUPT) rx_[10] ^= 0x40;
+    firstByteUs_ = nowUs + REQUEST_LEN * BYTE_US + DEVICE_LATENCY_US + (m == REPLY_LATE ? lateUs : 0);
+    return len;
+  }
+
+  // Set before the request it applies to
+  ReplyMode mode;
+  uint64_t lateUs;
+
+  uint32_t energyWh;     // register, +1 Wh per reply: tells a fresh reading from a stale one
+  uint32_t requests;
+  uint32_t badRequests;
+  uint32_t busBytes;     // request and reply bytes on the wire
+
+ private:
+  uint32_t arrivedBytes() {
+    if (rxLen_ == 0 || nowUs < firstByteUs_) return 0;
+    uint64_t n = (nowUs - firstByteUs_) / BYTE_US + 1;
+    uint32_t arrived = n < rxLen_ ? (uint32_t)n : rxLen_;
+    // Count reply bytes on the wire once they are out, read or not
+    while (counted_ < arrived) {
+      counted_++;
+      busBytes++;
+    }
+    return arrived;
+  }
+
+  void buildReply() {
+    energyWh++;
+    const uint32_t current_mA = 4350, power_dW = 10023;
+    const uint16_t reg[10] = {
+      2304,                                                        // 230.4 V
+      (uint16_t)(current_mA & 0xFFFF), (uint16_t)(current_mA >> 16),  // low word first
+      (uint16_t)(power_dW & 0xFFFF), (uint16_t)(power_dW >> 16),
+      (uint16_t)(energyWh & 0xFFFF), (uint16_t)(energyWh >> 16),
+      500, 95, 0,                                                   // 50.0 Hz, PF 0.95, no alarm
+    };
+    rx_[0] = PZEM_DEFAULT_ADDR;
+    rx_[1] = 0x04;
+    rx_[2] = 20;
+    for (int i = 0; i < 10; i++) {
+      rx_[3 + 2 * i] = reg[i] >> 8;
+      rx_[4 + 2 * i] = reg[i] & 0xFF;
+    }
+    uint16_t crc = PzemSnapshot::crc16(rx_, REPLY_LEN - 2);
+    rx_[23] = crc & 0xFF;
+    rx_[24] = crc >> 8;
+    rxLen_ = REPLY_LEN;
+    rxPos_ = 0;
+    counted_ = 0;
+  }
+
+  uint8_t rx_[REPLY_LEN];
+  uint32_t rxLen_;
+  uint32_t rxPos_;
+  uint32_t counted_;
+  uint64_t firstByteUs_;
+};
+
+static FakePzem pzem;
+
+// MeteringCore::poll(): collect the reply to last period's request, send the next one
+static int meteringCycle(PzemSnapshot& bus) {
+  int r = bus.collect(nowMs());
+  bus.request(nowMs());
+  return r;
+}
+
+void setUp() {
+  pzem.reset();
+  nowUs = 1000000;
+}
+void tearDown() {}
+
+static void test_one_frame_per_metering_cycle() {
+  PzemSnapshot bus(pzem);
+  const uint32_t cycles = 300;   // one minute
+  uint32_t ok = 0;
+  uint32_t lastEnergy = 0;
+  for (uint32_t i = 0; i < cycles; i++) {
+    int r = meteringCycle(bus);
+    if (r == PZEM_OK) {
+      ok++;
+      TEST_ASSERT_EQUAL_UINT32(lastEnergy == 0 ? bus.last().energy_wh : lastEnergy + 1, bus.last().energy_wh);
+      lastEnergy = bus.last().energy_wh;
+    } else {
+      TEST_ASSERT_EQUAL_INT(i == 0 ? PZEM_IDLE : PZEM_OK, r);
+    }
+    nowUs += METER_PERIOD_MS * 1000ULL;
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(cycles, pzem.requests);
+  TEST_ASSERT_EQUAL_UINT32(0, pzem.badRequests);
+  TEST_ASSERT_EQUAL_UINT32(cycles, bus.stats().requests);
+  TEST_ASSERT_EQUAL_UINT32(cycles - 1, bus.stats().transactions);
+  TEST_ASSERT_EQUAL_UINT32(cycles - 1, ok);
+  TEST_ASSERT_EQUAL_UINT32(0, bus.stats().crc_errors + bus.stats().timeouts + bus.stats().bad_frames);
+  TEST_ASSERT_EQUAL_UINT16(1000 / METER_PERIOD_MS, bus.stats().tx_per_sec);
+  TEST_ASSERT_EQUAL_UINT16(METER_PERIOD_MS, bus.stats().last_rtt_ms);
+
+  const PzemReading& r = bus.last();
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 230.4f, r.voltage);
+  TEST_ASSERT_FLOAT_WITHIN(0.0001f, 4.35f, r.current);
+  TEST_ASSERT_EQUAL_UINT32(10023, r.power_dw);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 1002.3f, r.power);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 50.0f, r.frequency);
+  TEST_ASSERT_FLOAT_WITHIN(0.0001f, 0.95f, r.pf);
+  TEST_ASSERT_EQUAL_UINT32(pzem.energyWh - 1, r.energy_wh);   // the last request is still out
+  TEST_ASSERT_EQUAL_UINT32(nowMs() - 2 * METER_PERIOD_MS, r.t_ms);
+}
+
+// The PZEM004Tv30 getters each run one blocking read-input-registers transaction
+static void test_bus_time_against_six_reads() {
+  PzemSnapshot bus(pzem);
+  uint32_t before = pzem.busBytes;
+  TEST_ASSERT_TRUE(bus.request(nowMs()));
+  nowUs += METER_PERIOD_MS * 1000ULL;
+  TEST_ASSERT_EQUAL_INT(PZEM_OK, bus.collect(nowMs()));
+  uint32_t snapshotBytes = pzem.busBytes - before;
+
+  // Six transactions back to back, each waited for in 1 ms steps
+  before = pzem.busBytes;
+  uint64_t blockedFrom = nowUs;
+  for (int i = 0; i < LIBRARY_READS; i++) {
+    TEST_ASSERT_TRUE(bus.request(nowMs()));
+    int r;
+    while ((r = bus.collect(nowMs())) == PZEM_PENDING) nowUs += 1000;
+    TEST_ASSERT_EQUAL_INT(PZEM_OK, r);
+  }
+  uint32_t libraryBytes = pzem.busBytes - before;
+  uint32_t libraryBlockedMs = (uint32_t)((nowUs - blockedFrom) / 1000);
+
+  uint32_t snapshotBusMs = snapshotBytes * BYTE_US / 1000;
+  uint32_t libraryBusMs = libraryBytes * BYTE_US / 1000;
+  TEST_ASSERT_EQUAL_UINT32(REQUEST_LEN + REPLY_LEN, snapshotBytes);
+  TEST_ASSERT_EQUAL_UINT32(LIBRARY_READS * snapshotBytes, libraryBytes);
+  // One frame leaves most of the period free; six do not fit in it at all
+  TEST_ASSERT_TRUE(snapshotBusMs < METER_PERIOD_MS / 4);
+  TEST_ASSERT_TRUE(libraryBusMs > METER_PERIOD_MS);
+  TEST_ASSERT_TRUE(libraryBlockedMs > libraryBusMs);
+
+  char msg[128];
+  snprintf(msg, sizeof(msg), "bus per cycle: snapshot %lu ms (%lu bytes), 6x RIR %lu ms (%lu bytes, %lu ms blocked)",
+           (unsigned long)snapshotBusMs, (unsigned long)snapshotBytes, (unsigned long)libraryBusMs,
+           (unsigned long)libraryBytes, (unsigned long)libraryBlockedMs);
+  TEST_MESSAGE(msg);
+}
+
+static void test_crc_failures_counted_and_skipped() {
+  PzemSnapshot bus(pzem);
+  const uint32_t cycles = 100;
+  uint32_t crcSeen = 0, ok = 0;
+  for (uint32_t i = 0; i < cycles; i++) {
+    PzemReading before = bus.last();
+    int r = bus.collect(nowMs());
+    if (r == PZEM_CRC_ERROR) {
+      crcSeen++;
+      // A failed frame never reaches the reading
+      TEST_ASSERT_EQUAL_UINT32(before.t_ms, bus.last().t_ms);
+      TEST_ASSERT_EQUAL_UINT32(before.energy_wh, bus.last().energy_wh);
+    } else if (r == PZEM_OK) {
+      ok++;
+    }
+    if (i % 10 == 5) pzem.mode = REPLY_CORRUPT;
+    TEST_ASSERT_TRUE(bus.request(nowMs()));
+    nowUs += METER_PERIOD_MS * 1000ULL;
+  }
+  TEST_ASSERT_EQUAL_UINT32(10, crcSeen);
+  TEST_ASSERT_EQUAL_UINT32(10, bus.stats().crc_errors);
+  TEST_ASSERT_EQUAL_UINT32(cycles - 1 - 10, ok);
+  TEST_ASSERT_EQUAL_UINT32(ok, bus.stats().transactions);
+  TEST_ASSERT_EQUAL_UINT32(0, bus.stats().timeouts + bus.stats().bad_frames);
+}
+
+static void test_timeout_then_late_reply_flushed() {
+  PzemSnapshot bus(pzem);
+
+  // Silent device: pending until PZEM_REPLY_TIMEOUT_MS, then one timeout
+  pzem.mode = REPLY_SILENT;
+  uint32_t sent = nowMs();
+  TEST_ASSERT_TRUE(bus.request(sent));
+  TEST_ASSERT_FALSE(bus.request(sent));   // one frame in flight
+  nowUs += (PZEM_REPLY_TIMEOUT_MS - 1) * 1000ULL;
+  TEST_ASSERT_EQUAL_INT(PZEM_PENDING, bus.collect(nowMs()));
+  nowUs += 1000;
+  TEST_ASSERT_EQUAL_INT(PZEM_TIMEOUT, bus.collect(nowMs()));
+  TEST_ASSERT_EQUAL_UINT32(1, bus.stats().timeouts);
+  TEST_ASSERT_EQUAL_INT(PZEM_IDLE, bus.collect(nowMs()));
+  TEST_ASSERT_TRUE(isnan(bus.last().voltage));
+
+  // Late device: the reply lands after the timeout, before the next period's request,
+  // which drops it so the next reading is the fresh one
+  nowUs += (METER_PERIOD_MS - PZEM_REPLY_TIMEOUT_MS) * 1000ULL;
+  pzem.mode = REPLY_LATE;
+  pzem.lateUs = (PZEM_REPLY_TIMEOUT_MS + 10) * 1000ULL - REQUEST_LEN * BYTE_US - DEVICE_LATENCY_US;
+  TEST_ASSERT_EQUAL_INT(PZEM_IDLE, meteringCycle(bus));
+  uint32_t staleEnergy = pzem.energyWh;
+  nowUs += PZEM_REPLY_TIMEOUT_MS * 1000ULL;
+  TEST_ASSERT_EQUAL_INT(PZEM_TIMEOUT, bus.collect(nowMs()));
+  nowUs += (METER_PERIOD_MS - PZEM_REPLY_TIMEOUT_MS) * 1000ULL;
+  TEST_ASSERT_EQUAL_INT(REPLY_LEN, pzem.available());   // complete, unread
+  TEST_ASSERT_EQUAL_INT(PZEM_IDLE, meteringCycle(bus));
+  TEST_ASSERT_EQUAL_INT(0, pzem.available());
+  nowUs += METER_PERIOD_MS * 1000ULL;
+  TEST_ASSERT_EQUAL_INT(PZEM_OK, meteringCycle(bus));
+  TEST_ASSERT_EQUAL_UINT32(staleEnergy + 1, bus.last().energy_wh);
+  TEST_ASSERT_EQUAL_UINT32(2, bus.stats().timeouts);
+  TEST_ASSERT_EQUAL_UINT32(1, bus.stats().transactions);
+  TEST_ASSERT_EQUAL_UINT32(0, bus.stats().crc_errors);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_one_frame_per_metering_cycle);
+  RUN_TEST(test_bus_time_against_six_reads);
+  RUN_TEST(test_crc_failures_counted_and_skipped);
+  RUN_TEST(test_timeout_then_late_reply_flushed);
+  return UNITY_END();
+}
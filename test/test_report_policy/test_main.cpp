@@ -0,0 +1,243 @@
+/**
+ * test_main.cpp - ReportPolicy: deadband crossings, latching under the minimum
+ * spacing, heartbeat back-off and reset
+ *
+ * The configuration has the shape of the shipped one (config.h REPORT_*): 20 W
+ * or 10%, 5 V, 0.02 kWh, 5 s spacing, heartbeat 30 s doubling up to 4 min.
+ *
+ * The trace replays run the shipped configuration itself over the load traces in
+ * test/golden/load/ (8 h of the loadgen "idle" and "home" profiles, one sample
+ * per 5 s, see loadgen --trace) against the fixed 30 s send interval it replaced:
+ * the idle meter must send at least 10x fewer messages, and whenever the spacing
+ * allowed a report the last reported power must stay within the deadband.
+ */
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "api_schedule.h"
+#include "report_policy.h"
+
+#define TRACE_STEP_MS       5000
+#define TRACE_MAX_SAMPLES   8000
+#define FIXED_INTERVAL_MS   30000   // API_SEND_INTERVAL_MS before the policy
+
+static const ReportPolicyConfig CFG = {
+    200,     // powerDeadbandDw: 20 W ...
+    10,      // ... or 10%
+    50,      // voltageDeadbandDv
+    20000,   // balanceDeadbandMwh
+    5000,    // minIntervalMs
+    30000,   // heartbeatMinMs
+    240000,  // heartbeatMaxMs
+};
+
+static ReportSample sample(uint32_t powerDw, uint16_t voltageDv = 2300, uint32_t remainingMwh = 10000000,
+                           bool sensorValid = true) {
+  ReportSample s;
+  s.sensorValid = sensorValid;
+  s.powerDw = powerDw;
+  s.voltageDv = voltageDv;
+  s.remainingMwh = remainingMwh;
+  return s;
+}
+
+// Evaluate and, when due, report - what loop() does
+static uint8_t step(ReportPolicy& p, uint32_t nowMs, const ReportSample& s) {
+  uint8_t r = p.evaluate(nowMs, s);
+  if (r) p.reported(nowMs, s, r);
+  return r;
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_first_sample_is_reported() {
+  ReportPolicy p(CFG);
+  TEST_ASSERT_EQUAL_HEX8(REPORT_FIRST, step(p, 1000, sample(1000)));
+  TEST_ASSERT_EQUAL_UINT32(1, p.reports());
+}
+
+static void test_power_deadband_absolute_and_relative() {
+  ReportPolicy p(CFG);
+  step(p, 0, sample(1000));  // 100 W: the 20 W floor applies
+  TEST_ASSERT_EQUAL_HEX8(0, p.evaluate(10000, sample(1200)));  // exactly on the band
+  TEST_ASSERT_EQUAL_HEX8(REPORT_POWER, p.evaluate(10000, sample(1201)));
+  TEST_ASSERT_EQUAL_HEX8(REPORT_POWER, step(p, 10000, sample(799)));  // downwards too
+
+  ReportPolicy q(CFG);
+  step(q, 0, sample(20000));  // 2 kW: 10% = 200 W beats the floor
+  TEST_ASSERT_EQUAL_HEX8(0, q.evaluate(10000, sample(21900)));
+  TEST_ASSERT_EQUAL_HEX8(0, q.evaluate(10000, sample(18000)));
+  TEST_ASSERT_EQUAL_HEX8(REPORT_POWER, q.evaluate(10000, sample(22001)));
+}
+
+static void test_voltage_balance_and_sensor_edges() {
+  ReportPolicy p(CFG);
+  step(p, 0, sample(1000));
+  TEST_ASSERT_EQUAL_HEX8(0, p.evaluate(10000, sample(1000, 2350)));
+  TEST_ASSERT_EQUAL_HEX8(REPORT_VOLTAGE, step(p, 10000, sample(1000, 2249)));
+  // Reported: 224.9 V is the baseline now
+  TEST_ASSERT_EQUAL_HEX8(0, p.evaluate(20000, sample(1000, 2249, 10000000 - 20000)));
+  TEST_ASSERT_EQUAL_HEX8(REPORT_BALANCE, p.evaluate(20000, sample(1000, 2249, 10000000 - 20001)));
+
+  // Sensor lost: power/voltage are not compared, the edge itself is reported
+  ReportPolicy q(CFG);
+  step(q, 0, sample(1000));
+  TEST_ASSERT_EQUAL_HEX8(REPORT_SENSOR, step(q, 10000, sample(0, 0, 10000000, false)));
+  TEST_ASSERT_EQUAL_HEX8(0, q.evaluate(20000, sample(0, 0, 10000000, false)));
+  TEST_ASSERT_EQUAL_HEX8(REPORT_SENSOR, q.evaluate(20000, sample(1000)));
+}
+
+static void test_event_inside_min_interval_is_latched() {
+  ReportPolicy p(CFG);
+  step(p, 0, sample(1000));
+  // A spike 1 s after the report is too soon, and gone again by the next sample
+  TEST_ASSERT_EQUAL_HEX8(0, step(p, 1000, sample(5000)));
+  TEST_ASSERT_EQUAL_HEX8(0, step(p, 2000, sample(1000)));
+  TEST_ASSERT_EQUAL_HEX8(0, step(p, 4999, sample(1000)));
+  // ... it is still reported once the spacing allows, then forgotten
+  TEST_ASSERT_EQUAL_HEX8(REPORT_POWER, step(p, 5000, sample(1000)));
+  TEST_ASSERT_EQUAL_HEX8(0, step(p, 10000, sample(1000)));
+
+  // force() latches the same way
+  p.force();
+  TEST_ASSERT_EQUAL_HEX8(REPORT_FORCED, step(p, 10000, sample(1000)));
+  p.force();
+  TEST_ASSERT_EQUAL_HEX8(0, step(p, 12000, sample(1000)));
+  TEST_ASSERT_EQUAL_HEX8(REPORT_FORCED, step(p, 15000, sample(1000)));
+}
+
+static void test_heartbeat_backs_off_and_resets() {
+  ReportPolicy p(CFG);
+  uint32_t t = 0;
+  step(p, t, sample(1000));
+  // Flat readings: 30 s, then 60, 120, 240 and capped there
+  const uint32_t expect[] = {30000, 60000, 120000, 240000, 240000, 240000};
+  for (unsigned i = 0; i < sizeof(expect) / sizeof(expect[0]); i++) {
+    TEST_ASSERT_EQUAL_UINT32(expect[i], p.heartbeatMs());
+    TEST_ASSERT_EQUAL_HEX8(0, step(p, t + expect[i] - 1, sample(1000)));
+    t += expect[i];
+    TEST_ASSERT_EQUAL_HEX8(REPORT_HEARTBEAT, step(p, t, sample(1000)));
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, p.eventReports());
+
+  // Any event brings the heartbeat back to its minimum
+  t += 5000;
+  TEST_ASSERT_EQUAL_HEX8(REPORT_POWER, step(p, t, sample(3000)));
+  TEST_ASSERT_EQUAL_UINT32(30000, p.heartbeatMs());
+  TEST_ASSERT_EQUAL_UINT32(2, p.eventReports());
+}
+
+static void test_millis_wrap() {
+  ReportPolicy p(CFG);
+  uint32_t t = 0xFFFFFFFFUL - 2000;
+  step(p, t, sample(1000));
+  TEST_ASSERT_EQUAL_HEX8(0, step(p, t + 4000, sample(5000)));       // across the wrap, still too soon
+  TEST_ASSERT_EQUAL_HEX8(REPORT_POWER, step(p, t + 5000, sample(5000)));
+  TEST_ASSERT_EQUAL_HEX8(REPORT_HEARTBEAT, step(p, t + 35000, sample(5000)));
+}
+
+struct TraceSample {
+  uint32_t powerDw;
+  uint16_t voltageDv;
+};
+static TraceSample trace[TRACE_MAX_SAMPLES];
+
+// test/golden/load/<name>, found next to this suite's directory; returns the sample count
+static uint32_t loadTrace(const char* name) {
+  const char* file = __FILE__;
+  const char* suite = strstr(file, "test_report_policy/");
+  char path[256];
+  snprintf(path, sizeof(path), "%.*sgolden/load/%s", suite ? (int)(suite - file) : 0, file, name);
+  FILE* f = fopen(path, "r");
+  TEST_ASSERT_NOT_NULL_MESSAGE(f, path);
+  char line[128];
+  uint32_t n = 0;
+  while (n < TRACE_MAX_SAMPLES && fgets(line, sizeof(line), f)) {
+    unsigned p, v;
+    if (line[0] == '#' || sscanf(line, "%u %u", &p, &v) != 2) continue;
+    trace[n].powerDw = p;
+    trace[n].voltageDv = (uint16_t)v;
+    n++;
+  }
+  fclose(f);
+  TEST_ASSERT_GREATER_THAN(1000, n);
+  return n;
+}
+
+struct ReplayResult {
+  uint32_t fixedMessages;
+  uint32_t policyMessages;
+  uint32_t maxErrorDw;        // max |P - last reported P| over the whole trace
+  uint32_t maxErrorOverBand;  // the same beyond the deadband, where a report was allowed
+  uint32_t maxPowerDw;
+};
+
+static ReplayResult replay(uint32_t n) {
+  ReportPolicy p(REPORT_POLICY_CONFIG);
+  ReplayResult r = {0, 0, 0, 0, 0};
+  int64_t remainingUwh = 10000000000LL;  // 10 kWh
+  uint32_t lastMs = 0;
+  uint32_t sentDw = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t now = (i + 1) * TRACE_STEP_MS;
+    remainingUwh -= (int64_t)trace[i].powerDw * TRACE_STEP_MS / 36;
+    ReportSample s = sample(trace[i].powerDw, trace[i].voltageDv, (uint32_t)(remainingUwh / 1000));
+    if (now % FIXED_INTERVAL_MS == 0) r.fixedMessages++;
+    if (step(p, now, s)) {
+      lastMs = now;
+      sentDw = s.powerDw;
+    }
+    if (s.powerDw > r.maxPowerDw) r.maxPowerDw = s.powerDw;
+    uint32_t err = s.powerDw > sentDw ? s.powerDw - sentDw : sentDw - s.powerDw;
+    if (err > r.maxErrorDw) r.maxErrorDw = err;
+    uint32_t band = sentDw * REPORT_POLICY_CONFIG.powerDeadbandPct / 100;
+    if (band < REPORT_POLICY_CONFIG.powerDeadbandDw) band = REPORT_POLICY_CONFIG.powerDeadbandDw;
+    if (now - lastMs >= REPORT_POLICY_CONFIG.minIntervalMs && err > band && err - band > r.maxErrorOverBand) {
+      r.maxErrorOverBand = err - band;
+    }
+  }
+  r.policyMessages = p.reports();
+  return r;
+}
+
+static void reportReplay(const char* name, const ReplayResult& r) {
+  char msg[160];
+  snprintf(msg, sizeof(msg), "%s: %u messages at a fixed 30 s, %u by the policy (%.1fx); max |P - sent P| %.1f W",
+           name, r.fixedMessages, r.policyMessages, (double)r.fixedMessages / r.policyMessages,
+           r.maxErrorDw / 10.0);
+  TEST_MESSAGE(msg);
+}
+
+static void test_idle_trace_sends_ten_times_less() {
+  uint32_t n = loadTrace("idle.trace");
+  ReplayResult r = replay(n);
+  reportReplay("idle.trace", r);
+  TEST_ASSERT_EQUAL_UINT32(n * TRACE_STEP_MS / FIXED_INTERVAL_MS, r.fixedMessages);
+  TEST_ASSERT_TRUE(r.policyMessages * 10 <= r.fixedMessages);
+  TEST_ASSERT_EQUAL_UINT32(0, r.maxErrorOverBand);
+}
+
+static void test_home_trace_error_stays_in_deadband() {
+  uint32_t n = loadTrace("home.trace");
+  ReplayResult r = replay(n);
+  reportReplay("home.trace", r);
+  TEST_ASSERT_TRUE(r.policyMessages < r.fixedMessages);
+  TEST_ASSERT_EQUAL_UINT32(0, r.maxErrorOverBand);
+  // Samples 5 s apart never wait for the spacing: the error is at most the band of the largest load
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(r.maxPowerDw * REPORT_POLICY_CONFIG.powerDeadbandPct / 100, r.maxErrorDw);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_sample_is_reported);
+  RUN_TEST(test_power_deadband_absolute_and_relative);
+  RUN_TEST(test_voltage_balance_and_sensor_edges);
+  RUN_TEST(test_event_inside_min_interval_is_latched);
+  RUN_TEST(test_heartbeat_backs_off_and_resets);
+  RUN_TEST(test_millis_wrap);
+  RUN_TEST(test_idle_trace_sends_ten_times_less);
+  RUN_TEST(test_home_trace_error_stays_in_deadband);
+  return UNITY_END();
+}
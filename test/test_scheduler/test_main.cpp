@@ -0,0 +1,279 @@
+/**
+ * test_main.cpp - Scheduler on a fake clock: timer wheel revolutions and the
+ * millis() wrap, budgets and yields, start/stop from inside a running task
+ *
+ * The clocks are plain variables: tasks "spend" CPU time by advancing the
+ * microsecond clock, the test advances the millisecond clock between run()
+ * calls. Every run is logged with its time, so phase, order and lateness are
+ * checked to the millisecond.
+ */
+#include <unity.h>
+#include <string.h>
+#include "scheduler.h"
+
+static uint32_t fakeMs;
+static uint32_t fakeUs;
+static uint32_t clockMs() { return fakeMs; }
+static uint32_t clockUs() { return fakeUs; }
+
+#define MAX_LOG  512
+
+struct RunLog {
+  uint8_t task[MAX_LOG];
+  uint32_t atMs[MAX_LOG];
+  uint16_t count;
+  uint16_t countOf(uint8_t id) const {
+    uint16_t n = 0;
+    for (uint16_t i = 0; i < count; i++) n += task[i] == id;
+    return n;
+  }
+};
+static RunLog runLog;
+
+// What a task does when it runs; arg points at one of these
+struct Probe {
+  uint8_t id;
+  uint32_t costUs;     // CPU time per run
+  SchedResult result;
+  Scheduler* sched;
+  // Optional side effect on another (or the same) task
+  enum { NOTHING, STOP, START, STOP_THEN_START } action;
+  uint8_t target;
+  uint32_t delayMs;
+};
+
+static SchedResult probeTask(void* arg) {
+  Probe& p = *(Probe*)arg;
+  if (runLog.count < MAX_LOG) {
+    runLog.task[runLog.count] = p.id;
+    runLog.atMs[runLog.count] = fakeMs;
+    runLog.count++;
+  }
+  fakeUs += p.costUs;
+  if (p.action == Probe::STOP || p.action == Probe::STOP_THEN_START) p.sched->stop(p.target);
+  if (p.action == Probe::START || p.action == Probe::STOP_THEN_START) p.sched->start(p.target, p.delayMs);
+  return p.result;
+}
+
+static Probe probe(Scheduler& s, uint8_t id, uint32_t costUs = 10) {
+  Probe p = {id, costUs, SCHED_DONE, &s, Probe::NOTHING, SCHED_NONE, 0};
+  return p;
+}
+
+// Call run() every stepMs until untilMs (wrap-safe), as loop() does
+static void runUntil(Scheduler& s, uint32_t untilMs, uint32_t stepMs) {
+  while ((int32_t)(untilMs - fakeMs) > 0) {
+    s.run();
+    fakeMs += stepMs;
+  }
+  s.run();
+}
+
+void setUp() {
+  fakeMs = 1000;
+  fakeUs = 0;
+  memset(&runLog, 0, sizeof(runLog));
+}
+void tearDown() {}
+
+// Periods longer than a wheel revolution wait in their slot; a late loop() keeps the phase
+static void test_phase_and_long_periods() {
+  Scheduler s(clockMs, clockUs);
+  Probe fast = probe(s, 0), slow = probe(s, 1);
+  uint8_t a = s.every("fast", 100, 1, 1000, probeTask, &fast);
+  uint8_t b = s.every("slow", 5000, 1, 1000, probeTask, &slow);
+  TEST_ASSERT_EQUAL_UINT8(0, a);
+  TEST_ASSERT_EQUAL_UINT8(1, b);
+  runUntil(s, 1000 + 10000, 1);
+  TEST_ASSERT_EQUAL_UINT16(100, runLog.countOf(0));
+  TEST_ASSERT_EQUAL_UINT16(2, runLog.countOf(1));
+  for (uint16_t i = 0; i < runLog.count; i++) {
+    TEST_ASSERT_EQUAL_UINT32(0, (runLog.atMs[i] - 1000) % (runLog.task[i] == 0 ? 100 : 5000));
+  }
+
+  // loop() stuck for 350 ms: one late run, then back on the 100 ms grid (no burst)
+  runLog.count = 0;
+  fakeMs += 350;
+  s.run();
+  runUntil(s, fakeMs + 300, 1);
+  TEST_ASSERT_EQUAL_UINT32(11350, runLog.atMs[0]);
+  TEST_ASSERT_EQUAL_UINT32(11400, runLog.atMs[1]);
+  TEST_ASSERT_EQUAL_UINT32(11500, runLog.atMs[2]);
+}
+
+// Across the 32-bit millis() wrap every due time is hit exactly when loop() calls every
+// millisecond, and as early as the call cadence allows otherwise (late runs skip, not burst)
+static void test_millis_wrap() {
+  const uint32_t steps[] = {1, 3, 7, 10, 11, 640, 700};
+  for (uint8_t k = 0; k < sizeof(steps) / sizeof(steps[0]); k++) {
+    uint32_t step = steps[k];
+    fakeMs = 0xFFFFFFFFUL - 1234;
+    memset(&runLog, 0, sizeof(runLog));
+    Scheduler s(clockMs, clockUs);
+    Probe p = probe(s, 0), q = probe(s, 1), o = probe(s, 2);
+    uint32_t t0 = fakeMs;
+    s.every("p", 100, 1, 1000, probeTask, &p);
+    s.every("q", 730, 1, 1000, probeTask, &q);
+    uint8_t one = s.once("o", 1, 1000, probeTask, &o);
+    s.start(one, 1500);  // due after the wrap
+    runUntil(s, t0 + 3000, step);
+
+    uint32_t gap = (step > 100 ? step : 100) + step;  // longest allowed between two runs of p
+    TEST_ASSERT_TRUE(runLog.countOf(0) >= 3000 / gap);
+    TEST_ASSERT_TRUE(runLog.countOf(1) >= 3);
+    TEST_ASSERT_EQUAL_UINT16(1, runLog.countOf(2));
+    uint32_t lastP = t0;
+    for (uint16_t i = 0; i < runLog.count; i++) {
+      uint32_t since = runLog.atMs[i] - t0;  // wrap-safe
+      uint32_t period = runLog.task[i] == 0 ? 100 : runLog.task[i] == 1 ? 730 : 1500;
+      if (step == 1) TEST_ASSERT_EQUAL_UINT32(0, since % period);
+      if (runLog.task[i] == 2) TEST_ASSERT_TRUE(since >= 1500 && since < 1500 + step);
+      if (runLog.task[i] == 0) {
+        TEST_ASSERT_TRUE(runLog.atMs[i] - lastP <= gap);  // never lost for a wheel revolution
+        lastP = runLog.atMs[i];
+      }
+    }
+    if (step == 1) {
+      TEST_ASSERT_EQUAL_UINT16(30, runLog.countOf(0));
+      TEST_ASSERT_EQUAL_UINT16(4, runLog.countOf(1));
+    }
+  }
+}
+
+// Over budget: counted, never interrupted; yieldDue() splits a long job over passes
+static void test_budget_overrun_and_yield() {
+  Scheduler s(clockMs, clockUs);
+  Probe heavy = probe(s, 0, 3000);
+  uint8_t h = s.every("heavy", 100, 1, 1000, probeTask, &heavy);
+
+  struct Job {
+    Scheduler* sched;
+    uint32_t stepsLeft;
+    uint32_t passes;
+  } job = {&s, 25, 0};
+  SchedFn jobFn = [](void* arg) -> SchedResult {
+    Job& j = *(Job*)arg;
+    j.passes++;
+    while (j.stepsLeft > 0) {
+      fakeUs += 400;  // one step
+      j.stepsLeft--;
+      if (j.sched->yieldDue()) return j.stepsLeft > 0 ? SCHED_YIELD : SCHED_DONE;
+    }
+    return SCHED_DONE;
+  };
+  uint8_t y = s.once("job", 0, 2000, jobFn, &job);
+  s.start(y, 0);
+
+  // The job yields after 5 steps (2000 us); run() reports more work right away
+  TEST_ASSERT_EQUAL_UINT32(0, s.run());
+  TEST_ASSERT_EQUAL_UINT32(1, job.passes);
+  TEST_ASSERT_EQUAL_UINT32(20, job.stepsLeft);
+  for (int pass = 0; pass < 10 && s.armed(y); pass++) s.run();
+  TEST_ASSERT_EQUAL_UINT32(5, job.passes);
+  TEST_ASSERT_EQUAL_UINT32(0, job.stepsLeft);
+  TEST_ASSERT_FALSE(s.armed(y));
+  TEST_ASSERT_EQUAL_UINT32(4, s.stats(y).yields);
+  TEST_ASSERT_EQUAL_UINT32(0, s.stats(y).overruns);
+
+  runUntil(s, fakeMs + 500, 5);
+  SchedTaskStats st = s.stats(h);
+  TEST_ASSERT_EQUAL_UINT32(5, st.runs);
+  TEST_ASSERT_EQUAL_UINT32(5, st.overruns);
+  TEST_ASSERT_EQUAL_UINT32(3000, st.maxUs);
+  TEST_ASSERT_EQUAL_UINT8(h, s.worstTask());
+  TEST_ASSERT_EQUAL_UINT32(3000, s.worstUs());
+  TEST_ASSERT_EQUAL_UINT32(5, s.latency(h).count());
+}
+
+// Same due time: higher priority first, then the one due earlier
+static void test_priority_then_due_order() {
+  Scheduler s(clockMs, clockUs);
+  Probe lo = probe(s, 0), hi = probe(s, 1), early = probe(s, 2);
+  uint8_t l = s.once("lo", 1, 1000, probeTask, &lo);
+  uint8_t h = s.once("hi", 5, 1000, probeTask, &hi);
+  uint8_t e = s.once("early", 1, 1000, probeTask, &early);
+  s.start(l, 30);
+  s.start(h, 30);
+  s.start(e, 25);
+  fakeMs += 40;  // all three due in one pass
+  s.run();
+  TEST_ASSERT_EQUAL_UINT16(3, runLog.count);
+  TEST_ASSERT_EQUAL_UINT8(1, runLog.task[0]);
+  TEST_ASSERT_EQUAL_UINT8(2, runLog.task[1]);
+  TEST_ASSERT_EQUAL_UINT8(0, runLog.task[2]);
+}
+
+// start()/stop() of itself and of tasks later in the same pass
+static void test_start_stop_from_inside_a_task() {
+  Scheduler s(clockMs, clockUs);
+  Probe killer = probe(s, 0), victim = probe(s, 1), self = probe(s, 2), restart = probe(s, 3),
+        bounce = probe(s, 4), kick = probe(s, 5), kicked = probe(s, 6);
+  s.every("killer", 100, 9, 1000, probeTask, &killer);
+  uint8_t v = s.every("victim", 100, 1, 1000, probeTask, &victim);
+  uint8_t sf = s.every("self-stop", 100, 5, 1000, probeTask, &self);
+  uint8_t rs = s.every("restart", 100, 5, 1000, probeTask, &restart);
+  uint8_t bo = s.every("stop-start", 100, 5, 1000, probeTask, &bounce);
+  s.every("kick", 100, 8, 1000, probeTask, &kick);
+  uint8_t kd = s.once("kicked", 1, 1000, probeTask, &kicked);
+  killer.action = Probe::STOP;              // victim: due in the same pass, never runs
+  killer.target = v;
+  self.action = Probe::STOP;                // stops itself: not rearmed
+  self.target = sf;
+  restart.action = Probe::START;            // rearms itself 30 ms out instead of its period
+  restart.target = rs;
+  restart.delayMs = 30;
+  bounce.action = Probe::STOP_THEN_START;   // stop() then start(): the start wins
+  bounce.target = bo;
+  bounce.delayMs = 50;
+  kick.action = Probe::START;               // arms a one-shot for the next pass
+  kick.target = kd;
+  kick.delayMs = 0;
+
+  fakeMs += 100;
+  s.run();
+  TEST_ASSERT_EQUAL_UINT16(0, runLog.countOf(1));
+  TEST_ASSERT_EQUAL_UINT16(1, runLog.countOf(2));
+  TEST_ASSERT_EQUAL_UINT16(0, runLog.countOf(6));  // armed during the pass: not in it
+  TEST_ASSERT_FALSE(s.armed(v));
+  TEST_ASSERT_FALSE(s.armed(sf));
+  TEST_ASSERT_TRUE(s.armed(rs));
+  TEST_ASSERT_TRUE(s.armed(bo));
+  TEST_ASSERT_TRUE(s.armed(kd));
+
+  runLog.count = 0;
+  runUntil(s, fakeMs + 99, 1);  // up to 1199
+  TEST_ASSERT_EQUAL_UINT16(0, runLog.countOf(1));
+  TEST_ASSERT_EQUAL_UINT16(0, runLog.countOf(2));
+  TEST_ASSERT_EQUAL_UINT16(1, runLog.countOf(6));
+  TEST_ASSERT_EQUAL_UINT16(3, runLog.countOf(3));  // 1130, 1160, 1190
+  TEST_ASSERT_EQUAL_UINT16(1, runLog.countOf(4));  // 1150
+  for (uint16_t i = 0; i < runLog.count; i++) {
+    if (runLog.task[i] == 3) TEST_ASSERT_EQUAL_UINT32(0, (runLog.atMs[i] - 1100) % 30);
+    if (runLog.task[i] == 4) TEST_ASSERT_EQUAL_UINT32(1150, runLog.atMs[i]);
+  }
+}
+
+// run()'s sleep hint: time to the earliest armed task, at most one wheel revolution
+static void test_sleep_hint() {
+  Scheduler s(clockMs, clockUs);
+  Probe p = probe(s, 0);
+  uint8_t o = s.once("o", 1, 1000, probeTask, &p);
+  TEST_ASSERT_EQUAL_UINT32(SCHED_TICK_MS * SCHED_WHEEL_SLOTS, s.run());
+  s.start(o, 2500);
+  TEST_ASSERT_EQUAL_UINT32(SCHED_TICK_MS * SCHED_WHEEL_SLOTS, s.run());  // capped at a revolution
+  fakeMs += 2000;
+  TEST_ASSERT_EQUAL_UINT32(500, s.run());
+  s.stop(o);
+  TEST_ASSERT_EQUAL_UINT32(SCHED_TICK_MS * SCHED_WHEEL_SLOTS, s.run());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_phase_and_long_periods);
+  RUN_TEST(test_millis_wrap);
+  RUN_TEST(test_budget_overrun_and_yield);
+  RUN_TEST(test_priority_then_due_order);
+  RUN_TEST(test_start_stop_from_inside_a_task);
+  RUN_TEST(test_sleep_hint);
+  return UNITY_END();
+}
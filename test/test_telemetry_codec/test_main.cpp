@@ -0,0 +1,198 @@
+/**
+ * test_main.cpp - TelemetryEncoder layout and the golden frames shared with the server
+ *
+ * The .bin files in test/golden/telemetry/ are frames this encoder produced from the records
+ * below. Here each one must come out byte for byte again; the server's test
+ * (smartmeter/server/test/telemetryFrame.test.js) decodes the same files and
+ * checks every field, so a layout change on either side fails one of the two.
+ * After an intended change (and a TCODEC_VERSION bump) rewrite them with
+ *
+ *   TCODEC_UPDATE_GOLDEN=1 pio test -e native -f test_telemetry_codec
+ *
+ * and update the expected values in the server test.
+ */
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "telemetry_codec.h"
+
+#define METER  "0215002079873"
+#define TOKEN  "18886583547834136861"
+
+void setUp() {}
+void tearDown() {}
+
+// test/golden/telemetry/<name>, found next to this suite's directory
+static void goldenPath(const char* name, char* out, size_t len) {
+  const char* file = __FILE__;
+  const char* suite = strstr(file, "test_telemetry_codec/");
+  int dirLen = suite ? (int)(suite - file) : 0;
+  snprintf(out, len, "%.*sgolden/telemetry/%s", dirLen, file, name);
+}
+
+static void checkGolden(const char* name, const uint8_t* frame, size_t len) {
+  char path[256];
+  goldenPath(name, path, sizeof(path));
+  if (getenv("TCODEC_UPDATE_GOLDEN")) {
+    FILE* f = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(len, fwrite(frame, 1, len, f));
+    fclose(f);
+    return;
+  }
+  uint8_t golden[TCODEC_HEADER_SIZE + 512];
+  FILE* f = fopen(path, "rb");
+  TEST_ASSERT_NOT_NULL_MESSAGE(f, path);
+  size_t n = fread(golden, 1, sizeof(golden), f);
+  fclose(f);
+  TEST_ASSERT_EQUAL(n, len);
+  TEST_ASSERT_EQUAL_MEMORY(golden, frame, len);
+}
+
+static TelemetryRecord reading() {
+  TelemetryRecord r;
+  memset(&r, 0, sizeof(r));
+  r.epoch = 1771443620UL;  // 2026-02-18T19:40:20 local
+  r.uptime_ms = 123456;
+  r.boot_seq = 7;
+  r.flags = TLOG_FLAG_SENSOR_VALID | TLOG_FLAG_TIME_SYNCED;
+  r.pf_pct = 95;
+  r.remaining_mwh = 39971000;
+  r.consumed_mwh = 29000;
+  r.energy_wh = 12345;
+  r.current_ma = 120;
+  r.power_dw = 278;
+  r.session_s = 120;
+  r.voltage_dv = 2324;
+  r.frequency_dhz = 502;
+  return r;
+}
+
+static void fillWindow(TelemetryRecord& r) {
+  TelemetryWindow& w = r.window;
+  const uint16_t v[TWIN_STATS] = {2281, 2342, 2318, 2337, 12};
+  const uint32_t i[TWIN_STATS] = {80, 5120, 1430, 4980, 1310};
+  const uint32_t p[TWIN_STATS] = {170, 11730, 3305, 11420, 3012};
+  const uint8_t pf[TWIN_STATS] = {88, 99, 95, 98, 3};
+  for (int k = 0; k < TWIN_STATS; k++) {
+    w.voltage_dv[k] = v[k];
+    w.current_ma[k] = i[k];
+    w.power_dw[k] = p[k];
+    w.pf_pct[k] = pf[k];
+  }
+  w.samples = 150;
+  w.span_s = 30;
+}
+
+static void test_header_packs_meter_digits() {
+  uint8_t buf[TCODEC_HEADER_SIZE];
+  TelemetryEncoder enc(buf, sizeof(buf));
+  enc.begin(METER);
+  TEST_ASSERT_FALSE(enc.overflowed());
+  TEST_ASSERT_EQUAL(TCODEC_HEADER_SIZE, enc.size());
+  const uint8_t expect[] = {'S', 'M', TCODEC_VERSION, 0x02, 0x15, 0x00, 0x20, 0x79, 0x87, 0x3F};
+  TEST_ASSERT_EQUAL_MEMORY(expect, buf, sizeof(expect));
+}
+
+static void test_block_sizes() {
+  uint8_t buf[512];
+  TelemetryEncoder enc(buf, sizeof(buf));
+  enc.begin(METER);
+  TelemetryRecord r = reading();
+  enc.addReading(r, r.epoch);
+  TEST_ASSERT_EQUAL(TCODEC_HEADER_SIZE + 1 + TCODEC_READING_SIZE, enc.size());
+  TEST_ASSERT_EQUAL_HEX8(TCODEC_BLOCK_READING, buf[TCODEC_HEADER_SIZE]);
+  fillWindow(r);
+  enc.addReading(r, r.epoch);
+  TEST_ASSERT_EQUAL(TCODEC_HEADER_SIZE + 2 + TCODEC_READING_SIZE + TCODEC_WINDOW_SIZE, enc.size());
+  TEST_ASSERT_EQUAL_HEX8(TCODEC_BLOCK_WINDOW, buf[TCODEC_HEADER_SIZE + 1 + TCODEC_READING_SIZE]);
+}
+
+static void test_overflow_is_reported() {
+  uint8_t buf[TCODEC_HEADER_SIZE + 20];
+  TelemetryEncoder enc(buf, sizeof(buf));
+  enc.begin(METER);
+  TelemetryRecord r = reading();
+  enc.addReading(r, r.epoch);
+  TEST_ASSERT_TRUE(enc.overflowed());
+  TEST_ASSERT_LESS_OR_EQUAL(sizeof(buf), enc.size());
+}
+
+// Identity, session, a valid and a sensor-less reading, latency summary
+static void test_golden_readings() {
+  uint8_t buf[512];
+  TelemetryEncoder enc(buf, sizeof(buf));
+  enc.begin(METER);
+  enc.addIdentity("YUMVUHORE", "1200000", "0782946444");
+  uint8_t token[10];
+  TelemetryEncoder::packDigits(TOKEN, token, sizeof(token));
+  enc.addSession(token);
+  TelemetryRecord r = reading();
+  enc.addReading(r, r.epoch);
+  r.flags = 0;  // sensor silent, clock not synced: dated from uptime
+  r.uptime_ms = 153456;
+  r.session_s = 150;
+  enc.addReading(r, 0);
+  enc.addLatency(98765, 12, 840, 15230, 15230, "telemetry-drain");
+  TEST_ASSERT_FALSE(enc.overflowed());
+  checkGolden("readings.bin", buf, enc.size());
+}
+
+// Window statistics: sensor valid, then a window whose reading lost the sensor
+static void test_golden_windows() {
+  uint8_t buf[512];
+  TelemetryEncoder enc(buf, sizeof(buf));
+  enc.begin(METER);
+  uint8_t token[10];
+  TelemetryEncoder::packDigits(TOKEN, token, sizeof(token));
+  enc.addSession(token);
+  TelemetryRecord r = reading();
+  fillWindow(r);
+  enc.addReading(r, r.epoch);
+  r.flags = TLOG_FLAG_TIME_SYNCED;
+  r.epoch += 30;
+  r.uptime_ms += 30000;
+  r.window.samples = 40;
+  enc.addReading(r, r.epoch);
+  TEST_ASSERT_FALSE(enc.overflowed());
+  checkGolden("windows.bin", buf, enc.size());
+}
+
+// Version 1 for a server that answered 415: the window record goes as a plain READING
+// of its capture-time values and the latency summary is left out
+static void test_golden_fallback_v1() {
+  uint8_t buf[512];
+  TelemetryEncoder enc(buf, sizeof(buf));
+  enc.begin(METER, 1);
+  uint8_t token[10];
+  TelemetryEncoder::packDigits(TOKEN, token, sizeof(token));
+  enc.addSession(token);
+  TelemetryRecord r = reading();
+  fillWindow(r);
+  enc.addReading(r, r.epoch);
+  enc.addLatency(98765, 12, 840, 15230, 15230, "telemetry-drain");
+  TEST_ASSERT_FALSE(enc.overflowed());
+  TEST_ASSERT_EQUAL(TCODEC_HEADER_SIZE + 1 + TCODEC_SESSION_SIZE + 1 + TCODEC_READING_SIZE, enc.size());
+  TEST_ASSERT_EQUAL_HEX8(1, buf[2]);
+  TEST_ASSERT_EQUAL_HEX8(TCODEC_BLOCK_READING, buf[TCODEC_HEADER_SIZE + 1 + TCODEC_SESSION_SIZE]);
+  checkGolden("fallback_v1.bin", buf, enc.size());
+
+  // Version 2 keeps the latency summary but still has no WINDOW block
+  enc.begin(METER, 2);
+  enc.addReading(r, r.epoch);
+  enc.addLatency(98765, 12, 840, 15230, 15230, "telemetry-drain");
+  TEST_ASSERT_EQUAL_HEX8(TCODEC_BLOCK_READING, buf[TCODEC_HEADER_SIZE]);
+  TEST_ASSERT_EQUAL_HEX8(TCODEC_BLOCK_LATENCY, buf[TCODEC_HEADER_SIZE + 1 + TCODEC_READING_SIZE]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_header_packs_meter_digits);
+  RUN_TEST(test_block_sizes);
+  RUN_TEST(test_overflow_is_reported);
+  RUN_TEST(test_golden_readings);
+  RUN_TEST(test_golden_windows);
+  RUN_TEST(test_golden_fallback_v1);
+  return UNITY_END();
+}
@@ -0,0 +1,305 @@
+/**
+ * test_main.cpp - TelemetryLog on a host directory: order, cursor, eviction,
+ * torn and corrupt records, open handles, and the import of the 52-byte log
+ *
+ * Each test starts from an empty directory standing for the LittleFS mount
+ * (src/native/FS.h); a "reboot" is a new TelemetryLog on the same files.
+ */
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "telemetry_log.h"
+
+#define SEG_BYTES  (TLOG_SEG_RECORDS * sizeof(TelemetryRecord))
+#define TOKEN      "18886583547834136861"
+
+static char root[64];
+
+void setUp() {
+  strcpy(root, "/tmp/tlogXXXXXX");
+  TEST_ASSERT_NOT_NULL(mkdtemp(root));
+}
+
+void tearDown() {
+  char cmd[96];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+  TEST_ASSERT_EQUAL(0, system(cmd));
+}
+
+static TelemetryRecord reading(uint32_t i) {
+  TelemetryRecord r;
+  memset(&r, 0, sizeof(r));
+  r.uptime_ms = i;
+  r.voltage_dv = 2300;
+  TelemetryLog::packToken(TOKEN, r.token_bcd);
+  return r;
+}
+
+static void appendRange(TelemetryLog& log, uint32_t from, uint32_t to) {
+  for (uint32_t i = from; i < to; i++) {
+    TelemetryRecord r = reading(i);
+    TEST_ASSERT_TRUE(log.append(r));
+  }
+}
+
+// Upload everything pending in batches; returns the count, checks order from first
+static uint32_t drain(TelemetryLog& log, uint32_t first) {
+  TelemetryRecord batch[8];
+  uint32_t n = 0;
+  while (size_t got = log.peek(batch, 8)) {
+    for (size_t k = 0; k < got; k++) TEST_ASSERT_EQUAL_UINT32(first + n + k, batch[k].uptime_ms);
+    n += got;
+    log.advance();
+  }
+  return n;
+}
+
+static void hostPath(const char* name, char* out, size_t len) {
+  snprintf(out, len, "%s/tlm/%s", root, name);
+}
+
+static void test_records_come_back_in_order() {
+  fs::FS flash(root);
+  TelemetryLog log;
+  TEST_ASSERT_TRUE(log.begin(flash, "/tlm", SEG_BYTES * 4));
+  TEST_ASSERT_EQUAL_UINT16(1, log.bootSeq());
+  appendRange(log, 0, 150);  // three segments
+  TEST_ASSERT_EQUAL_UINT32(150, log.pending());
+
+  TelemetryRecord r;
+  TEST_ASSERT_TRUE(log.peek(r));
+  TEST_ASSERT_EQUAL_UINT16(1, r.boot_seq);
+  char token[21];
+  TelemetryLog::unpackToken(r.token_bcd, token);
+  TEST_ASSERT_EQUAL_STRING(TOKEN, token);
+
+  TEST_ASSERT_EQUAL_UINT32(150, drain(log, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, log.pending());
+  TEST_ASSERT_FALSE(log.peek(r));
+  // Uploaded segments are gone, only the tail stays
+  TEST_ASSERT_EQUAL_UINT32((150 % TLOG_SEG_RECORDS) * sizeof(TelemetryRecord), log.bytesUsed());
+}
+
+static void test_cursor_survives_reboot() {
+  fs::FS flash(root);
+  {
+    TelemetryLog log;
+    TEST_ASSERT_TRUE(log.begin(flash, "/tlm", SEG_BYTES * 4));
+    appendRange(log, 0, 100);
+    TelemetryRecord r;
+    for (int i = 0; i < 30; i++) {
+      TEST_ASSERT_TRUE(log.peek(r));
+      log.advance();
+    }
+  }
+  // The cursor is saved every TLOG_CURSOR_SAVE_EVERY acks: at most that many go out twice
+  TelemetryLog log;
+  TEST_ASSERT_TRUE(log.begin(flash, "/tlm", SEG_BYTES * 4));
+  TEST_ASSERT_EQUAL_UINT16(2, log.bootSeq());
+  uint32_t resent = 30 - 30 / TLOG_CURSOR_SAVE_EVERY * TLOG_CURSOR_SAVE_EVERY;
+  TEST_ASSERT_EQUAL_UINT32(70 + resent, log.pending());
+  TEST_ASSERT_EQUAL_UINT32(70 + resent, drain(log, 30 - resent));
+
+  // Caught up: saved at once, nothing comes back after the next reboot
+  TelemetryLog again;
+  TEST_ASSERT_TRUE(again.begin(flash, "/tlm", SEG_BYTES * 4));
+  TEST_ASSERT_EQUAL_UINT32(0, again.pending());
+}
+
+static void test_budget_evicts_oldest_segments() {
+  fs::FS flash(root);
+  TelemetryLog log;
+  TEST_ASSERT_TRUE(log.begin(flash, "/tlm", SEG_BYTES * 4));
+  appendRange(log, 0, 10);
+  TelemetryRecord batch[8];
+  TEST_ASSERT_EQUAL(8, log.peek(batch, 8));  // upload in flight during the outage
+
+  appendRange(log, 10, 600);
+  TEST_ASSERT_LESS_OR_EQUAL(SEG_BYTES * 4, log.bytesUsed());
+  TEST_ASSERT_EQUAL_UINT32(600, log.pending() + log.dropped());
+  log.advance();  // the batch's segment was evicted: nothing more is skipped
+
+  uint32_t first = log.dropped();
+  TEST_ASSERT_EQUAL_UINT32(first % TLOG_SEG_RECORDS, 0);
+  TEST_ASSERT_EQUAL_UINT32(600 - first, drain(log, first));
+}
+
+static void test_torn_append_is_skipped() {
+  fs::FS flash(root);
+  {
+    TelemetryLog log;
+    TEST_ASSERT_TRUE(log.begin(flash, "/tlm", SEG_BYTES * 4));
+    appendRange(log, 0, 5);
+    flash.failWritesAfter(20);  // power fails 20 bytes into the next record
+    TelemetryRecord r = reading(5);
+    TEST_ASSERT_FALSE(log.append(r));
+    flash.failWritesAfter(-1);
+    appendRange(log, 6, 10);    // continues in a fresh segment
+    TEST_ASSERT_EQUAL_UINT32(9, log.pending());
+  }
+  char path[96];
+  hostPath("00000001.rec", path, sizeof(path));
+  FILE* f = fopen(path, "rb");
+  TEST_ASSERT_NOT_NULL(f);
+  fseek(f, 0, SEEK_END);
+  TEST_ASSERT_EQUAL(5 * sizeof(TelemetryRecord) + 20, ftell(f));
+  fclose(f);
+
+  TelemetryLog log;
+  TEST_ASSERT_TRUE(log.begin(flash, "/tlm", SEG_BYTES * 4));
+  TelemetryRecord batch[16];
+  size_t n = 0;
+  while (size_t got = log.peek(batch + n, 16 - n)) {
+    n += got;
+    log.advance();
+  }
+  TEST_ASSERT_EQUAL(9, n);
+  for (size_t k = 0; k < n; k++) TEST_ASSERT_EQUAL_UINT32(k < 5 ? k : k + 1, batch[k].uptime_ms);
+
+  // A torn tail found at boot is never appended behind
+  appendRange(log, 10, 11);
+  TEST_ASSERT_TRUE(log.peek(batch[0]));
+  TEST_ASSERT_EQUAL_UINT32(10, batch[0].uptime_ms);
+}
+
+static void test_corrupt_record_is_counted_and_skipped() {
+  fs::FS flash(root);
+  TelemetryLog log;
+  TEST_ASSERT_TRUE(log.begin(flash, "/tlm", SEG_BYTES * 4));
+  appendRange(log, 0, 10);
+
+  char path[96];
+  hostPath("00000001.rec", path, sizeof(path));
+  FILE* f = fopen(path, "r+b");
+  TEST_ASSERT_NOT_NULL(f);
+  fseek(f, 5 * sizeof(TelemetryRecord) + 10, SEEK_SET);
+  fputc(0x55, f);  // bit rot in record 5
+  fclose(f);
+
+  TelemetryRecord batch[8];
+  TEST_ASSERT_EQUAL(5, log.peek(batch, 8));  // stops before the bad record
+  log.advance();
+  TEST_ASSERT_EQUAL(4, log.peek(batch, 8));
+  TEST_ASSERT_EQUAL_UINT32(6, batch[0].uptime_ms);
+  TEST_ASSERT_EQUAL_UINT32(1, log.corrupt());
+  log.advance();
+  TEST_ASSERT_EQUAL_UINT32(0, log.pending());
+}
+
+static void test_files_stay_open() {
+  fs::FS flash(root);
+  TelemetryLog log;
+  TEST_ASSERT_TRUE(log.begin(flash, "/tlm", SEG_BYTES * 8));
+  uint32_t opens = flash.opens();
+  TelemetryRecord batch[8];
+  uint32_t next = 0;
+  for (uint32_t i = 0; i < 10 * TLOG_SEG_RECORDS; i++) {
+    TelemetryRecord r = reading(i);
+    TEST_ASSERT_TRUE(log.append(r));
+    if (i % 4 == 3) {
+      size_t n = log.peek(batch, 8);
+      for (size_t k = 0; k < n; k++) TEST_ASSERT_EQUAL_UINT32(next++, batch[k].uptime_ms);
+      log.advance();
+    }
+  }
+  // Uploads keep up: per segment its append handle, and a read handle for the few
+  // records still pending when it rolled over; plus the cursor file
+  TEST_ASSERT_LESS_OR_EQUAL(2 * 10 + 1, flash.opens() - opens);
+}
+
+// ------ Import of the log from before window statistics ------
+
+struct LegacyRecord {
+  uint8_t head[40];
+  uint8_t token_bcd[10];
+  uint16_t crc;
+};
+
+static uint16_t crc16(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+  return crc;
+}
+
+static void writeFile(const char* name, const void* data, size_t len) {
+  char path[96];
+  hostPath(name, path, sizeof(path));
+  FILE* f = fopen(path, "ab");
+  TEST_ASSERT_NOT_NULL(f);
+  TEST_ASSERT_EQUAL(len, fwrite(data, 1, len, f));
+  fclose(f);
+}
+
+static void test_legacy_log_is_imported() {
+  char dir[96];
+  snprintf(dir, sizeof(dir), "%s/tlm", root);
+  TEST_ASSERT_EQUAL(0, mkdir(dir, 0755));
+
+  // Segments 2..4 (64, 64, 20 records), cursor at 3:10, record 3:15 corrupt, boot 5
+  uint32_t up = 0;
+  for (uint32_t seg = 2; seg <= 4; seg++) {
+    char name[16];
+    snprintf(name, sizeof(name), "%08lx.seg", (unsigned long)seg);
+    for (uint32_t i = 0; i < (seg == 4 ? 20u : 64u); i++) {
+      TelemetryRecord r = reading(up++);
+      r.boot_seq = (uint16_t)(seg + 1);
+      LegacyRecord old;
+      memcpy(old.head, &r, sizeof(old.head));
+      memcpy(old.token_bcd, r.token_bcd, sizeof(old.token_bcd));
+      old.crc = crc16((const uint8_t*)&old, sizeof(old) - 2);
+      if (seg == 3 && i == 15) old.crc ^= 1;
+      writeFile(name, &old, sizeof(old));
+    }
+  }
+  uint32_t cursor[2] = {3, 10};
+  writeFile("cursor", cursor, sizeof(cursor));
+  uint16_t boot = 5;
+  writeFile("boot", &boot, sizeof(boot));
+
+  fs::FS flash(root);
+  {
+    TelemetryLog log;
+    TEST_ASSERT_TRUE(log.begin(flash, "/tlm", (SEG_BYTES * 8)));
+    TEST_ASSERT_EQUAL_UINT32(64 - 10 - 1 + 20, log.pending());
+    TEST_ASSERT_EQUAL_UINT32(1, log.corrupt());
+    TEST_ASSERT_EQUAL_UINT16(6, log.bootSeq());
+  }
+  TEST_ASSERT_FALSE(flash.exists("/tlm/00000002.seg"));
+  TEST_ASSERT_FALSE(flash.exists("/tlm/00000004.seg"));
+  TEST_ASSERT_FALSE(flash.exists("/tlm/cursor"));
+
+  // Imported once: the next boot finds the same records in the current layout
+  TelemetryLog log;
+  TEST_ASSERT_TRUE(log.begin(flash, "/tlm", (SEG_BYTES * 8)));
+  TEST_ASSERT_EQUAL_UINT32(73, log.pending());
+  TelemetryRecord batch[8];
+  uint32_t next = 64 + 10;
+  while (size_t n = log.peek(batch, 8)) {
+    for (size_t k = 0; k < n; k++, next++) {
+      if (next == 64 + 15) next++;
+      TEST_ASSERT_EQUAL_UINT32(next, batch[k].uptime_ms);
+      TEST_ASSERT_EQUAL_UINT16(next < 128 ? 4 : 5, batch[k].boot_seq);  // kept from the old record
+      TEST_ASSERT_EQUAL_UINT16(2300, batch[k].voltage_dv);
+      TEST_ASSERT_EQUAL_UINT16(0, batch[k].window.samples);
+    }
+    log.advance();
+  }
+  TEST_ASSERT_EQUAL_UINT32(148, next);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_records_come_back_in_order);
+  RUN_TEST(test_cursor_survives_reboot);
+  RUN_TEST(test_budget_evicts_oldest_segments);
+  RUN_TEST(test_torn_append_is_skipped);
+  RUN_TEST(test_corrupt_record_is_counted_and_skipped);
+  RUN_TEST(test_files_stay_open);
+  RUN_TEST(test_legacy_log_is_imported);
+  return UNITY_END();
+}
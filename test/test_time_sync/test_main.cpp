@@ -0,0 +1,305 @@
+/**
+ * test_main.cpp - TimeSync against fake NTP responders on a simulated clock
+ *
+ * FakeNet is the HalUdp: each server answers a request after its own uplink
+ * delay, timestamps it from the true UTC plus its own error, and the reply
+ * arrives after the downlink delay. The local microsecond clock is a variable
+ * the test advances to whatever comes first, the next poll() or the next reply,
+ * so with symmetric delays an honest server's offset is exact. Covered: the
+ * first sync, falsetickers and the no-majority case, kiss-o'-death, the NTP era
+ * rollover of 2036, and step vs slew of a later error.
+ */
+#include <unity.h>
+#include <string.h>
+#include "time_sync.h"
+
+#define NTP_UNIX_OFFSET_S  2208988800ULL
+#define MAX_SERVERS        4
+#define MAX_INFLIGHT       16
+#define ERA1_UNIX_S        2085978496ULL   // 2036-02-07T06:28:16Z, NTP seconds wrap to 0
+
+static uint64_t simUs;  // local clock, the injected 32-bit one is its low word
+static uint32_t clockUs() { return (uint32_t)simUs; }
+
+struct FakeServer {
+  const char* host;
+  int64_t errUs;        // server time - true UTC
+  uint32_t upUs;        // request transit
+  uint32_t downUs;      // reply transit
+  uint8_t stratum;
+  bool kodOnce;         // next request gets a kiss-o'-death (RATE)
+  bool silent;          // drops requests
+};
+
+struct InFlight {
+  uint64_t dueUs;
+  uint8_t pkt[NTP_PACKET_BYTES];
+};
+
+class FakeNet : public HalUdp {
+ public:
+  FakeNet() : serverCount(0), utc0Us(0), inflight_(0) { memset(servers, 0, sizeof(servers)); }
+
+  FakeServer& add(const char* host, int64_t errUs, uint32_t upUs, uint32_t downUs) {
+    FakeServer& s = servers[serverCount++];
+    s.host = host;
+    s.errUs = errUs;
+    s.upUs = upUs;
+    s.downUs = downUs;
+    s.stratum = 2;
+    return s;
+  }
+
+  // True UTC at a local clock reading
+  int64_t utcUs(uint64_t local) const { return utc0Us + (int64_t)local; }
+
+  bool send(const char* host, uint16_t port, const void* buf, size_t len) override {
+    TEST_ASSERT_EQUAL_UINT16(NTP_PORT, port);
+    TEST_ASSERT_EQUAL(NTP_PACKET_BYTES, len);
+    const uint8_t* req = (const uint8_t*)buf;
+    TEST_ASSERT_EQUAL_HEX8(0x23, req[0]);  // version 4, client
+    FakeServer* s = find(host);
+    TEST_ASSERT_NOT_NULL(s);
+    if (s->silent) return true;
+    TEST_ASSERT_TRUE(inflight_ < MAX_INFLIGHT);
+    InFlight& f = queue_[inflight_++];
+    uint64_t atServer = simUs + s->upUs;
+    f.dueUs = atServer + 50 + s->downUs;
+    uint8_t* p = f.pkt;
+    memset(p, 0, NTP_PACKET_BYTES);
+    p[0] = (0 << 6) | (4 << 3) | 4;  // no leap warning, version 4, server
+    p[1] = s->stratum;
+    memcpy(p + 24, req + 40, 8);     // origin = the request's transmit timestamp
+    if (s->kodOnce) {
+      s->kodOnce = false;
+      p[1] = 0;
+      memcpy(p + 12, "RATE", 4);
+      return true;
+    }
+    int64_t t2 = utcUs(atServer) + s->errUs;
+    putTs(p + 32, t2);
+    putTs(p + 40, t2 + 50);
+    return true;
+  }
+
+  size_t receive(void* buf, size_t cap) override {
+    for (uint8_t i = 0; i < inflight_; i++) {
+      if (queue_[i].dueUs > simUs) continue;
+      size_t n = cap < NTP_PACKET_BYTES ? cap : NTP_PACKET_BYTES;
+      memcpy(buf, queue_[i].pkt, n);
+      queue_[i] = queue_[--inflight_];
+      return n;
+    }
+    return 0;
+  }
+
+  uint64_t nextDueUs() const {
+    uint64_t next = UINT64_MAX;
+    for (uint8_t i = 0; i < inflight_; i++) {
+      if (queue_[i].dueUs < next) next = queue_[i].dueUs;
+    }
+    return next;
+  }
+
+  FakeServer servers[MAX_SERVERS];
+  uint8_t serverCount;
+  int64_t utc0Us;
+
+ private:
+  FakeServer* find(const char* host) {
+    for (uint8_t i = 0; i < serverCount; i++) {
+      if (strcmp(servers[i].host, host) == 0) return &servers[i];
+    }
+    return NULL;
+  }
+
+  // Unix microseconds -> 64-bit NTP timestamp; the seconds wrap at the era boundary
+  static void putTs(uint8_t* p, int64_t unixUs) {
+    uint32_t sec = (uint32_t)((uint64_t)(unixUs / 1000000) + NTP_UNIX_OFFSET_S);
+    uint32_t frac = (uint32_t)(((uint64_t)(unixUs % 1000000) << 32) / 1000000);
+    uint64_t ts = ((uint64_t)sec << 32) | frac;
+    for (int i = 7; i >= 0; i--) { p[i] = (uint8_t)ts; ts >>= 8; }
+  }
+
+  InFlight queue_[MAX_INFLIGHT];
+  uint8_t inflight_;
+};
+
+struct Rig {
+  FakeNet net;
+  TimeSync ts;
+
+  explicit Rig(uint64_t utcStartS) : ts(clockUs) {
+    simUs = 1000000;  // a second after boot
+    net.utc0Us = (int64_t)utcStartS * 1000000 - (int64_t)simUs;
+  }
+
+  void begin() {
+    for (uint8_t i = 0; i < net.serverCount; i++) ts.addServer(net.servers[i].host);
+    ts.begin(&net);
+  }
+
+  // Call poll() when it asks to be called, delivering replies on time in between
+  void run(uint64_t forUs) {
+    uint64_t end = simUs + forUs;
+    while (simUs < end) {
+      uint64_t wake = simUs + (uint64_t)ts.poll() * 1000;
+      uint64_t due = net.nextDueUs();
+      if (due < wake) wake = due > simUs ? due : simUs + 1;
+      simUs = wake < end ? wake : end;
+    }
+  }
+
+  int64_t errorUs() { return ts.utcMicros() - net.utcUs(simUs); }
+};
+
+static const uint64_t START_2026_S = 1771443620ULL;  // 2026-02-18T19:40:20Z
+
+static void test_first_sync_steps_to_the_closest_server() {
+  Rig rig(START_2026_S);
+  rig.net.add("a", 0, 12000, 12000);
+  rig.net.add("b", 0, 3000, 3000);
+  rig.net.add("c", 0, 30000, 30000);
+  rig.begin();
+  TEST_ASSERT_FALSE(rig.ts.synced());
+  rig.run(2500000);
+  TEST_ASSERT_TRUE(rig.ts.synced());
+  TEST_ASSERT_EQUAL_UINT32(1, rig.ts.steps());
+  TEST_ASSERT_EQUAL_UINT8(1, rig.ts.selected());  // smallest RTT
+  TEST_ASSERT_INT64_WITHIN(100, 0, rig.errorUs());
+  TEST_ASSERT_EQUAL_UINT32(START_2026_S + 2, rig.ts.utcEpoch());
+  TEST_ASSERT_EQUAL_UINT32(NTP_POLL_MIN_MS, rig.ts.pollIntervalMs());
+}
+
+// One server 3 s off: outvoted even though it is the closest
+static void test_falseticker_is_outvoted() {
+  Rig rig(START_2026_S);
+  rig.net.add("a", 0, 20000, 20000);
+  rig.net.add("b", 3000000, 1000, 1000);
+  rig.net.add("c", 400, 15000, 15000);
+  rig.begin();
+  rig.run(2000000);
+  TEST_ASSERT_TRUE(rig.ts.synced());
+  TEST_ASSERT_TRUE(rig.ts.server(1).falseticker);
+  TEST_ASSERT_FALSE(rig.ts.server(0).falseticker);
+  TEST_ASSERT_FALSE(rig.ts.server(2).falseticker);
+  TEST_ASSERT_EQUAL_UINT8(2, rig.ts.selected());
+  TEST_ASSERT_INT64_WITHIN(1000, 0, rig.errorUs());
+}
+
+// Three servers that all disagree: no majority, the clock stays unsynced and retries
+static void test_no_majority_is_not_trusted() {
+  Rig rig(START_2026_S);
+  rig.net.add("a", 0, 5000, 5000);
+  rig.net.add("b", 1000000, 5000, 5000);
+  rig.net.add("c", -2000000, 5000, 5000);
+  rig.begin();
+  rig.run(10000000);
+  TEST_ASSERT_FALSE(rig.ts.synced());
+  TEST_ASSERT_EQUAL_UINT32(0, rig.ts.syncs());
+  TEST_ASSERT_TRUE(rig.ts.server(0).sent >= 3);  // 2 s, 4 s, ... retries
+  TEST_ASSERT_EQUAL_STRING("1970-01-01T00:00:00", rig.ts.isoLocal());
+}
+
+// A kiss-o'-death silences that server for NTP_KOD_BACKOFF_MS; the others carry on
+static void test_kiss_of_death_backs_off() {
+  Rig rig(START_2026_S);
+  rig.net.add("a", 0, 8000, 8000);
+  FakeServer& b = rig.net.add("b", 0, 2000, 2000);
+  b.kodOnce = true;
+  rig.begin();
+  rig.run(2000000);
+  TEST_ASSERT_TRUE(rig.ts.synced());
+  TEST_ASSERT_EQUAL_UINT8(0, rig.ts.selected());
+  TEST_ASSERT_EQUAL_UINT32(1, rig.ts.server(1).rejected);
+  TEST_ASSERT_EQUAL_UINT32(0, rig.ts.server(1).lost);
+
+  rig.run((uint64_t)NTP_KOD_BACKOFF_MS * 1000 - 10000000);
+  TEST_ASSERT_TRUE(rig.ts.server(0).sent > 3);
+  TEST_ASSERT_EQUAL_UINT32(1, rig.ts.server(1).sent);
+
+  // Past the backoff the next round asks it again, and being closer it takes over
+  rig.run((uint64_t)NTP_POLL_MAX_MS * 1000 + 2000000);
+  TEST_ASSERT_EQUAL_UINT32(2, rig.ts.server(1).sent);
+  TEST_ASSERT_EQUAL_UINT32(1, rig.ts.server(1).replies);
+  TEST_ASSERT_EQUAL_UINT8(1, rig.ts.selected());
+  TEST_ASSERT_INT64_WITHIN(1000, 0, rig.errorUs());
+}
+
+// NTP seconds wrap to 0 on 2036-02-07T06:28:16Z; timestamps after it are era 1
+static void test_era_rollover_2036() {
+  Rig rig(ERA1_UNIX_S - 30);
+  rig.net.add("a", 0, 5000, 5000);
+  rig.net.add("b", 0, 9000, 9000);
+  rig.begin();
+  rig.run(2500000);
+  TEST_ASSERT_TRUE(rig.ts.synced());
+  TEST_ASSERT_EQUAL_UINT32(ERA1_UNIX_S - 28, rig.ts.utcEpoch());
+
+  // Next rounds are across the wrap: no step, still on time
+  rig.run(3 * (uint64_t)NTP_POLL_MIN_MS * 1000);
+  TEST_ASSERT_TRUE(rig.ts.syncs() >= 2);
+  TEST_ASSERT_EQUAL_UINT32(1, rig.ts.steps());
+  TEST_ASSERT_INT64_WITHIN(1000, 0, rig.errorUs());
+  char iso[NTP_ISO_LEN + 1];
+  TimeSync::formatIso(rig.ts.utcEpoch(), iso);
+  TEST_ASSERT_EQUAL_MEMORY("2036-02-07T06:3", iso, 15);
+
+  // First sync already in era 1
+  Rig late(ERA1_UNIX_S + 86400);
+  late.net.add("a", 0, 5000, 5000);
+  late.begin();
+  late.run(2500000);
+  TEST_ASSERT_TRUE(late.ts.synced());
+  TEST_ASSERT_INT64_WITHIN(1000, 0, late.errorUs());
+  TimeSync::formatIso(late.ts.utcEpoch(), iso);
+  TEST_ASSERT_EQUAL_STRING("2036-02-08T06:28:18", iso);
+}
+
+// 50 ms off: slewed in at NTP_SLEW_PPM without a jump; 1 s off: stepped
+static void test_small_error_slews_large_error_steps() {
+  Rig rig(START_2026_S);
+  rig.net.add("a", 0, 4000, 4000);
+  rig.net.add("b", 0, 6000, 6000);
+  rig.begin();
+  rig.run(2000000);
+  TEST_ASSERT_EQUAL_UINT32(1, rig.ts.steps());
+
+  rig.net.utc0Us += 50000;  // true time moves on without the device
+  rig.run((uint64_t)NTP_POLL_MIN_MS * 1000);
+  TEST_ASSERT_EQUAL_UINT32(2, rig.ts.syncs());
+  TEST_ASSERT_EQUAL_UINT32(1, rig.ts.steps());
+  TEST_ASSERT_INT32_WITHIN(100, 50000, rig.ts.lastErrorUs());
+
+  // Never faster than 1 + NTP_SLEW_PPM, never backwards, caught up after 50 ms / 500 ppm = 100 s
+  int64_t prev = rig.ts.utcMicros();
+  for (int i = 0; i < 120; i++) {
+    rig.run(1000000);
+    int64_t now = rig.ts.utcMicros();
+    TEST_ASSERT_TRUE(now - prev >= 1000000);
+    TEST_ASSERT_TRUE(now - prev <= 1000000 + NTP_SLEW_PPM + 1);
+    prev = now;
+  }
+  TEST_ASSERT_INT64_WITHIN(1000, 0, rig.errorUs());
+
+  rig.net.utc0Us -= 1000000;
+  rig.run(2 * (uint64_t)NTP_POLL_MIN_MS * 1000);
+  TEST_ASSERT_EQUAL_UINT32(2, rig.ts.steps());
+  TEST_ASSERT_INT32_WITHIN(100, -1000000, rig.ts.lastErrorUs());
+  TEST_ASSERT_INT64_WITHIN(1000, 0, rig.errorUs());
+  TEST_ASSERT_EQUAL_UINT32(NTP_POLL_MIN_MS, rig.ts.pollIntervalMs());
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_sync_steps_to_the_closest_server);
+  RUN_TEST(test_falseticker_is_outvoted);
+  RUN_TEST(test_no_majority_is_not_trusted);
+  RUN_TEST(test_kiss_of_death_backs_off);
+  RUN_TEST(test_era_rollover_2036);
+  RUN_TEST(test_small_error_slews_large_error_steps);
+  return UNITY_END();
+}
@@ -0,0 +1,189 @@
+/**
+ * test_main.cpp - TokenStore: binary search at the ends of the table and across
+ * flash sectors, used bitmap at byte boundaries, reboots, and the RAM fallback
+ *
+ * 301 seeds: the table (16 bytes a record) runs past the first 4 KB sector and
+ * the bitmap ends in a partial byte, so every boundary the layout has is hit.
+ */
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "token_store.h"
+
+#define SEEDS        301
+#define SEED_BASE    10000000000000000000ULL  // 20 digits
+#define SEED_STEP    7919ULL
+#define FLASH_BYTES  (64 * 1024)             // the "tokens" partition
+
+class NorFlash : public HalFlash {
+ public:
+  NorFlash() : writes_(0) { memset(mem_, 0xFF, sizeof(mem_)); }
+  uint32_t size() const override { return sizeof(mem_); }
+  bool read(uint32_t offset, void* buf, size_t len) override {
+    if (offset + len > sizeof(mem_)) return false;
+    memcpy(buf, mem_ + offset, len);
+    return true;
+  }
+  bool write(uint32_t offset, const void* buf, size_t len) override {
+    if (offset + len > sizeof(mem_)) return false;
+    const uint8_t* src = (const uint8_t*)buf;
+    for (size_t i = 0; i < len; i++) mem_[offset + i] &= src[i];
+    writes_++;
+    return true;
+  }
+  bool erase(uint32_t offset, size_t len) override {
+    if (offset % 4096 != 0 || len % 4096 != 0 || offset + len > sizeof(mem_)) return false;
+    memset(mem_ + offset, 0xFF, len);
+    return true;
+  }
+  const void* map(uint32_t offset, size_t len) override {
+    return offset + len <= sizeof(mem_) ? mem_ + offset : NULL;
+  }
+  void unmap(const void*) override {}
+
+  uint8_t* mem() { return mem_; }
+  uint32_t writes() const { return writes_; }
+
+ private:
+  uint8_t mem_[FLASH_BYTES];
+  uint32_t writes_;
+};
+
+static char codes[SEEDS][21];
+static TokenSeed seeds[SEEDS];
+
+// Seeds in scrambled order; code i is SEED_BASE + i * SEED_STEP, i kWh (+0.5)
+static void makeSeeds() {
+  for (int i = 0; i < SEEDS; i++) {
+    int k = (i * 113) % SEEDS;  // 113 is coprime to 301: a permutation
+    snprintf(codes[k], sizeof(codes[k]), "%020llu", (unsigned long long)(SEED_BASE + k * SEED_STEP));
+    seeds[i].code = codes[k];
+    seeds[i].kwh = k + 0.5f;
+  }
+}
+
+static const char* code(int i) {
+  return codes[i];
+}
+
+// Code between two seeds, or past either end (i = -1 / SEEDS)
+static void missingCode(int i, char out[21]) {
+  snprintf(out, 21, "%020llu", (unsigned long long)(SEED_BASE + i * SEED_STEP + 1));
+}
+
+void setUp() {
+  makeSeeds();
+}
+void tearDown() {}
+
+static void test_finds_every_token_and_nothing_else() {
+  static NorFlash flash;
+  TokenStore store;
+  TEST_ASSERT_TRUE(store.begin(&flash, seeds, SEEDS));
+  TEST_ASSERT_TRUE(store.persistent());
+  TEST_ASSERT_EQUAL_UINT32(SEEDS, store.count());
+  TEST_ASSERT_GREATER_THAN(4096, TS_TABLE_OFFSET + SEEDS * sizeof(TokenRecord));  // spans two sectors
+
+  for (int i = 0; i < SEEDS; i++) {
+    int32_t index = -1;
+    float kwh = 0;
+    TEST_ASSERT_EQUAL_INT(TOKEN_VALID, store.find(code(i), index, kwh));
+    TEST_ASSERT_EQUAL_INT32(i, index);  // sorted: table order is numeric order
+    TEST_ASSERT_EQUAL_FLOAT(i + 0.5f, kwh);
+  }
+
+  char missing[21];
+  int32_t index;
+  float kwh;
+  for (int i = -1; i < SEEDS; i++) {
+    missingCode(i, missing);
+    TEST_ASSERT_EQUAL_INT(TOKEN_UNKNOWN, store.find(missing, index, kwh));
+  }
+  TEST_ASSERT_EQUAL_INT(TOKEN_UNKNOWN, store.find("00000000000000000000", index, kwh));
+  TEST_ASSERT_EQUAL_INT(TOKEN_UNKNOWN, store.find("99999999999999999999", index, kwh));
+  TEST_ASSERT_EQUAL_INT(TOKEN_UNKNOWN, store.find("1000000000000000000", index, kwh));    // 19 digits
+  TEST_ASSERT_EQUAL_INT(TOKEN_UNKNOWN, store.find("100000000000000000000", index, kwh));  // 21 digits
+  TEST_ASSERT_EQUAL_INT(TOKEN_UNKNOWN, store.find("1000000000000000000a", index, kwh));
+}
+
+static void test_used_bits_at_byte_boundaries_survive_reboot() {
+  static NorFlash flash;
+  const int used[] = {0, 7, 8, 15, 16, 255, 256, 295, SEEDS - 1};
+  const int nUsed = sizeof(used) / sizeof(used[0]);
+  {
+    TokenStore store;
+    store.begin(&flash, seeds, SEEDS);
+    for (int u = 0; u < nUsed; u++) {
+      int32_t index;
+      float kwh;
+      TEST_ASSERT_EQUAL_INT(TOKEN_VALID, store.find(code(used[u]), index, kwh));
+      uint32_t writes = flash.writes();
+      TEST_ASSERT_TRUE(store.markUsed(index));
+      TEST_ASSERT_EQUAL_UINT32(writes + 1, flash.writes());  // one byte programmed, no erase
+      TEST_ASSERT_EQUAL_INT(TOKEN_USED, store.find(code(used[u]), index, kwh));
+    }
+    TEST_ASSERT_FALSE(store.markUsed(-1));
+    TEST_ASSERT_FALSE(store.markUsed(SEEDS));
+  }
+
+  // Reboot: the table is not provisioned again, the bits are where they were and only there
+  TokenStore store;
+  uint32_t writes = flash.writes();
+  TEST_ASSERT_TRUE(store.begin(&flash, seeds, SEEDS));
+  TEST_ASSERT_EQUAL_UINT32(writes, flash.writes());
+  for (int i = 0; i < SEEDS; i++) {
+    bool shouldBeUsed = false;
+    for (int u = 0; u < nUsed; u++) shouldBeUsed |= used[u] == i;
+    int32_t index;
+    float kwh;
+    TEST_ASSERT_EQUAL_INT(shouldBeUsed ? TOKEN_USED : TOKEN_VALID, store.find(code(i), index, kwh));
+  }
+}
+
+static void test_corrupt_table_falls_back_to_seeds_in_ram() {
+  static NorFlash flash;
+  {
+    TokenStore store;
+    store.begin(&flash, seeds, SEEDS);
+  }
+  // One bit of the record past the sector boundary
+  flash.mem()[4096 + 3] ^= 0x10;
+  uint8_t before[FLASH_BYTES];
+  memcpy(before, flash.mem(), sizeof(before));
+
+  TokenStore store;
+  TEST_ASSERT_FALSE(store.begin(&flash, seeds, SEEDS));
+  TEST_ASSERT_FALSE(store.persistent());
+  TEST_ASSERT_EQUAL_MEMORY(before, flash.mem(), sizeof(before));  // provisioned tokens never overwritten
+
+  // Same lookups and bitmap semantics, in RAM
+  int32_t index;
+  float kwh;
+  TEST_ASSERT_EQUAL_INT(TOKEN_VALID, store.find(code(SEEDS - 1), index, kwh));
+  TEST_ASSERT_TRUE(store.markUsed(index));
+  TEST_ASSERT_EQUAL_INT(TOKEN_USED, store.find(code(SEEDS - 1), index, kwh));
+  TEST_ASSERT_EQUAL_INT(TOKEN_VALID, store.find(code(SEEDS - 2), index, kwh));
+  TEST_ASSERT_EQUAL_INT(TOKEN_VALID, store.find(code(0), index, kwh));
+}
+
+static void test_without_partition_duplicates_and_bad_seeds_dropped() {
+  TokenSeed extra[] = {{"12345678901234567890", 5.0f}, {"12345678901234567890", 9.0f},
+                       {"1234", 1.0f}, {"55555555555555555555", 0.0f}};
+  TokenStore store;
+  TEST_ASSERT_FALSE(store.begin(NULL, extra, 4));
+  TEST_ASSERT_EQUAL_UINT32(1, store.count());
+  int32_t index;
+  float kwh;
+  TEST_ASSERT_EQUAL_INT(TOKEN_VALID, store.find("12345678901234567890", index, kwh));
+  TEST_ASSERT_EQUAL_FLOAT(5.0f, kwh);
+  TEST_ASSERT_EQUAL_INT(TOKEN_UNKNOWN, store.find("55555555555555555555", index, kwh));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_finds_every_token_and_nothing_else);
+  RUN_TEST(test_used_bits_at_byte_boundaries_survive_reboot);
+  RUN_TEST(test_corrupt_table_falls_back_to_seeds_in_ram);
+  RUN_TEST(test_without_partition_duplicates_and_bad_seeds_dropped);
+  return UNITY_END();
+}
@@ -0,0 +1,458 @@
+/**
+ * http_engine.cpp - epoll HTTP/1.1 client for the load generator (see http_engine.h)
+ */
+#include "http_engine.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define EVENT_BATCH 256
+
+HttpConn::HttpConn()
+    : fd_(-1), state_(CONN_IDLE), reused_(false), linkUp_(true), tracked_(false), outOff_(0), lastUseMs_(0),
+      attemptUs_(0) {}
+
+HttpConn::~HttpConn() {
+  if (fd_ >= 0) ::close(fd_);
+}
+
+HttpEngine::HttpEngine()
+    : epfd_(-1), clockMs_(NULL), clockUs_(NULL), open_(0), opened_(0), reusedCount_(0) {
+  memset(&addr_, 0, sizeof(addr_));
+  host_[0] = '\0';
+  base_[0] = '\0';
+  error_[0] = '\0';
+  for (uint8_t i = 0; i < HTTP_MAX_ENDPOINTS; i++) {
+    HttpEndpointStats& s = stats_[i];
+    s.requests = s.ok = s.clientErrors = s.serverErrors = s.transport = s.timeouts = s.queueFull = s.retries = 0;
+    s.bytesOut = s.bytesIn = 0;
+  }
+}
+
+HttpEngine::~HttpEngine() {
+  if (epfd_ >= 0) ::close(epfd_);
+}
+
+bool HttpEngine::begin(const char* url, Clock clockMs, Clock clockUs) {
+  clockMs_ = clockMs;
+  clockUs_ = clockUs;
+  if (strncmp(url, "http://", 7) != 0) {
+    snprintf(error_, sizeof(error_), "only http:// URLs are supported");
+    return false;
+  }
+  const char* host = url + 7;
+  const char* slash = strchr(host, '/');
+  size_t authLen = slash ? (size_t)(slash - host) : strlen(host);
+  if (authLen == 0 || authLen >= sizeof(host_) || (slash && strlen(slash) >= sizeof(base_))) {
+    snprintf(error_, sizeof(error_), "malformed URL");
+    return false;
+  }
+  memcpy(host_, host, authLen);
+  host_[authLen] = '\0';
+  snprintf(base_, sizeof(base_), "%s", slash ? slash : "");
+  size_t baseLen = strlen(base_);
+  if (baseLen > 0 && base_[baseLen - 1] == '/') base_[baseLen - 1] = '\0';
+
+  char name[64];
+  snprintf(name, sizeof(name), "%s", host_);
+  const char* port = "80";
+  char* colon = strrchr(name, ':');
+  if (colon) {
+    *colon = '\0';
+    port = colon + 1;
+  }
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = NULL;
+  int rc = getaddrinfo(name, port, &hints, &res);
+  if (rc != 0 || res == NULL) {
+    snprintf(error_, sizeof(error_), "cannot resolve %s: %s", name, gai_strerror(rc));
+    return false;
+  }
+  memcpy(&addr_, res->ai_addr, sizeof(addr_));
+  freeaddrinfo(res);
+
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd_ < 0) {
+    snprintf(error_, sizeof(error_), "epoll_create1: %s", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool HttpEngine::enqueue(HttpConn& c, uint8_t endpoint, const char* method, const char* path, const void* body,
+                         size_t len, const char* contentType, uint32_t deadlineMs, uint8_t retries,
+                         HttpDoneCallback cb, void* ctx, const char* bearer) {
+  if (endpoint >= HTTP_MAX_ENDPOINTS) return false;
+  if (c.queue_.size() >= HTTP_QUEUE_LEN || strlen(path) >= HTTP_MAX_PATH) {
+    stats_[endpoint].queueFull++;
+    return false;
+  }
+  // Same request head as AsyncHttp::startNext(), plus the customer's bearer token when given
+  char head[512];
+  int n = snprintf(head, sizeof(head), "%s %s%s HTTP/1.1\r\nHost: %s\r\nUser-Agent: SmartMeter-ESP32\r\n"
+                   "Connection: keep-alive\r\n", method, base_, path, host_);
+  if (len > 0 || strcmp(method, "GET") != 0) {
+    n += snprintf(head + n, sizeof(head) - n, "Content-Type: %s\r\nContent-Length: %u\r\n",
+                  contentType ? contentType : "application/json", (unsigned)len);
+  }
+  if (bearer) n += snprintf(head + n, sizeof(head) - n, "Authorization: Bearer %s\r\n", bearer);
+  if (n <= 0 || (size_t)n + 2 >= sizeof(head)) return false;
+
+  c.queue_.push_back(HttpConn::Request());
+  HttpConn::Request& r = c.queue_.back();
+  r.head.assign(head, n);
+  r.head += "\r\n";
+  if (len > 0) r.body.assign((const char*)body, len);
+  r.enqueuedMs = clockMs_();
+  r.deadlineMs = deadlineMs;
+  r.notBeforeMs = 0;
+  r.started = false;
+  r.idempotent = strcmp(method, "POST") != 0 && strcmp(method, "PATCH") != 0;
+  r.retriesLeft = retries;
+  r.endpoint = endpoint;
+  r.cb = cb;
+  r.ctx = ctx;
+  track(c);
+  return true;
+}
+
+void HttpEngine::setLink(HttpConn& c, bool up) {
+  if (c.linkUp_ == up) return;
+  c.linkUp_ = up;
+  if (up) return;
+  if (c.state_ != HttpConn::CONN_IDLE) {
+    c.reused_ = false;  // the link is gone, not a stale keep-alive: no free retry
+    finish(c, HTTP_ERR_CONN_LOST, std::string(), false);
+  } else {
+    close(c);
+  }
+}
+
+void HttpEngine::track(HttpConn& c) {
+  if (c.tracked_) return;
+  c.tracked_ = true;
+  tracked_.push_back(&c);
+}
+
+void HttpEngine::watch(HttpConn& c, uint32_t events) {
+  epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = &c;
+  epoll_ctl(epfd_, EPOLL_CTL_MOD, c.fd_, &ev);
+}
+
+void HttpEngine::close(HttpConn& c) {
+  if (c.fd_ >= 0) {
+    ::close(c.fd_);  // also leaves the epoll set
+    c.fd_ = -1;
+    open_--;
+  }
+  c.state_ = HttpConn::CONN_IDLE;
+  c.in_.clear();
+  c.out_.clear();
+  c.outOff_ = 0;
+}
+
+bool HttpEngine::connect(HttpConn& c) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return false;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (::connect(fd, (const sockaddr*)&addr_, sizeof(addr_)) < 0 && errno != EINPROGRESS) {
+    ::close(fd);
+    return false;
+  }
+  epoll_event ev;
+  ev.events = EPOLLOUT;
+  ev.data.ptr = &c;
+  if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    ::close(fd);
+    return false;
+  }
+  c.fd_ = fd;
+  open_++;
+  opened_++;
+  return true;
+}
+
+void HttpEngine::start(HttpConn& c) {
+  HttpConn::Request& r = c.queue_.front();
+  if (r.started) stats_[r.endpoint].retries++;
+  r.started = true;
+  c.attemptUs_ = clockUs_();
+  c.reused_ = false;
+  c.in_.clear();
+  c.out_ = r.head;
+  c.out_ += r.body;
+  c.outOff_ = 0;
+
+  if (!c.linkUp_) {
+    finish(c, HTTP_ERR_NOT_CONNECTED, std::string(), false);
+    return;
+  }
+  if (c.fd_ >= 0) {
+    // Kept alive and not closed by the server meanwhile (poll() reaps those)
+    c.reused_ = true;
+    reusedCount_++;
+    c.state_ = HttpConn::CONN_SENDING;
+    flush(c);
+    return;
+  }
+  if (!connect(c)) {
+    finish(c, HTTP_ERR_CONNECT, std::string(), false);
+    return;
+  }
+  c.state_ = HttpConn::CONN_CONNECTING;
+}
+
+void HttpEngine::flush(HttpConn& c) {
+  while (c.outOff_ < c.out_.size()) {
+    ssize_t n = send(c.fd_, c.out_.data() + c.outOff_, c.out_.size() - c.outOff_, MSG_NOSIGNAL);
+    if (n > 0) {
+      c.outOff_ += (size_t)n;
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      watch(c, EPOLLOUT);
+      return;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    finish(c, HTTP_ERR_SEND, std::string(), false);
+    return;
+  }
+  stats_[c.queue_.front().endpoint].bytesOut += c.out_.size();
+  c.state_ = HttpConn::CONN_RECEIVING;
+  watch(c, EPOLLIN | EPOLLRDHUP);
+}
+
+void HttpEngine::receive(HttpConn& c) {
+  char buf[4096];
+  bool eof = false;
+  for (;;) {
+    ssize_t n = recv(c.fd_, buf, sizeof(buf), 0);
+    if (n > 0) {
+      c.in_.append(buf, (size_t)n);
+      continue;
+    }
+    if (n == 0) {
+      eof = true;
+      break;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+    if (errno == EINTR) continue;
+    finish(c, HTTP_ERR_CONN_LOST, std::string(), false);
+    return;
+  }
+  int status;
+  std::string body;
+  bool keepAlive;
+  if (parse(c.in_, eof, status, body, keepAlive)) {
+    stats_[c.queue_.front().endpoint].bytesIn += c.in_.size();
+    finish(c, status, body, keepAlive && !eof);
+  } else if (eof) {
+    finish(c, HTTP_ERR_CONN_LOST, std::string(), false);
+  }
+}
+
+static bool headerIs(const char* line, size_t len, const char* name, const char** value) {
+  size_t nl = strlen(name);
+  if (len <= nl || strncasecmp(line, name, nl) != 0 || line[nl] != ':') return false;
+  const char* v = line + nl + 1;
+  while (*v == ' ') v++;
+  *value = v;
+  return true;
+}
+
+bool HttpEngine::parse(const std::string& in, bool eof, int& status, std::string& body, bool& keepAlive) {
+  size_t end = in.find("\r\n\r\n");
+  if (end == std::string::npos) return false;
+  if (in.compare(0, 5, "HTTP/") != 0 || in.size() < 12) {
+    status = HTTP_ERR_CONN_LOST;
+    keepAlive = false;
+    body.clear();
+    return true;  // garbage: give up on this connection
+  }
+  bool http10 = in.compare(0, 8, "HTTP/1.0") == 0;
+  status = atoi(in.c_str() + 9);
+  keepAlive = !http10;
+  long contentLength = -1;
+  bool chunked = false;
+
+  size_t pos = in.find("\r\n") + 2;
+  while (pos < end) {
+    size_t eol = in.find("\r\n", pos);
+    const char* line = in.c_str() + pos;
+    size_t len = eol - pos;
+    const char* v;
+    if (headerIs(line, len, "content-length", &v)) {
+      contentLength = strtol(v, NULL, 10);
+    } else if (headerIs(line, len, "transfer-encoding", &v)) {
+      chunked = strncasecmp(v, "chunked", 7) == 0;
+    } else if (headerIs(line, len, "connection", &v)) {
+      if (strncasecmp(v, "close", 5) == 0) keepAlive = false;
+      if (strncasecmp(v, "keep-alive", 10) == 0) keepAlive = true;
+    }
+    pos = eol + 2;
+  }
+
+  size_t bodyAt = end + 4;
+  if (status == 204 || status == 304 || (status >= 100 && status < 200)) {
+    body.clear();
+    return true;
+  }
+  if (chunked) {
+    body.clear();
+    size_t p = bodyAt;
+    for (;;) {
+      size_t eol = in.find("\r\n", p);
+      if (eol == std::string::npos) return false;
+      unsigned long size = strtoul(in.c_str() + p, NULL, 16);
+      if (size == 0) return in.find("\r\n", eol + 2) != std::string::npos;  // trailers end
+      if (in.size() < eol + 2 + size + 2) return false;
+      body.append(in, eol + 2, size);
+      p = eol + 2 + size + 2;
+    }
+  }
+  if (contentLength >= 0) {
+    if (in.size() < bodyAt + (size_t)contentLength) return false;
+    body.assign(in, bodyAt, (size_t)contentLength);
+    return true;
+  }
+  // Delimited by the close
+  if (!eof) return false;
+  body.assign(in, bodyAt, std::string::npos);
+  keepAlive = false;
+  return true;
+}
+
+void HttpEngine::finish(HttpConn& c, int status, const std::string& body, bool keepAlive) {
+  HttpConn::Request& r = c.queue_.front();
+  uint64_t now = clockMs_();
+  bool answered = !c.in_.empty();
+  // Same rule as AsyncHttp::finish(): a POST that went out in full is not sent again
+  bool mayResend = r.idempotent || c.state_ != HttpConn::CONN_RECEIVING;
+  if (status > 0 && keepAlive) {
+    c.state_ = HttpConn::CONN_IDLE;
+    c.in_.clear();
+    c.lastUseMs_ = now;
+    watch(c, EPOLLIN | EPOLLRDHUP);  // notice the server closing it while idle
+  } else {
+    close(c);
+  }
+
+  // The server dropped the kept-alive connection while it was idle: nothing was
+  // answered, so go again right away on a fresh connection without using a retry
+  if (c.reused_ && mayResend && (status == HTTP_ERR_SEND || status == HTTP_ERR_CONN_LOST) && !answered) {
+    c.reused_ = false;
+    r.started = false;
+    r.notBeforeMs = now;
+    return;
+  }
+
+  // Transport failures get retried (after a backoff) while the deadline allows it
+  bool transportError = status <= 0 && status != HTTP_ERR_TIMEOUT;
+  if (transportError && mayResend && r.retriesLeft > 0 &&
+      (int64_t)(r.enqueuedMs + r.deadlineMs) - (int64_t)now > (int64_t)HTTP_RETRY_BACKOFF_MS) {
+    r.retriesLeft--;
+    r.notBeforeMs = now + HTTP_RETRY_BACKOFF_MS;
+    return;
+  }
+
+  HttpEndpointStats& s = stats_[r.endpoint];
+  s.requests++;
+  if (status >= 200 && status < 300) {
+    s.ok++;
+  } else if (status >= 400 && status < 500) {
+    s.clientErrors++;
+  } else if (status >= 500) {
+    s.serverErrors++;
+  } else if (status == HTTP_ERR_TIMEOUT) {
+    s.timeouts++;
+  } else if (status <= 0) {
+    s.transport++;
+  }
+  if (status > 0) {
+    uint64_t us = clockUs_() - c.attemptUs_;
+    s.latency.record(us > 0xFFFFFFFFULL ? 0xFFFFFFFFU : (uint32_t)us);
+  }
+
+  // Pop before the callback so it may enqueue follow-up requests
+  HttpDoneCallback cb = r.cb;
+  void* ctx = r.ctx;
+  c.queue_.pop_front();
+  if (cb) cb(status, body.c_str(), body.size(), ctx);
+}
+
+void HttpEngine::onEvent(HttpConn& c, uint32_t events) {
+  if (c.fd_ < 0) return;  // closed earlier in this batch
+  switch (c.state_) {
+    case HttpConn::CONN_CONNECTING: {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      if ((events & (EPOLLERR | EPOLLHUP)) || getsockopt(c.fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+        finish(c, HTTP_ERR_CONNECT, std::string(), false);
+        return;
+      }
+      c.state_ = HttpConn::CONN_SENDING;
+      flush(c);
+      return;
+    }
+    case HttpConn::CONN_SENDING:
+      if (events & (EPOLLERR | EPOLLHUP)) {
+        finish(c, HTTP_ERR_SEND, std::string(), false);
+        return;
+      }
+      flush(c);
+      return;
+    case HttpConn::CONN_RECEIVING:
+      receive(c);
+      return;
+    case HttpConn::CONN_IDLE:
+      close(c);  // kept-alive connection closed (or written to) by the server
+      return;
+  }
+}
+
+void HttpEngine::poll(int timeoutMs) {
+  epoll_event events[EVENT_BATCH];
+  int n = epoll_wait(epfd_, events, EVENT_BATCH, timeoutMs);
+  for (int i = 0; i < n; i++) {
+    onEvent(*(HttpConn*)events[i].data.ptr, events[i].events);
+  }
+}
+
+void HttpEngine::service() {
+  uint64_t now = clockMs_();
+  for (size_t i = 0; i < tracked_.size();) {
+    HttpConn& c = *tracked_[i];
+    if (!c.queue_.empty()) {
+      HttpConn::Request& r = c.queue_.front();
+      if (now - r.enqueuedMs >= r.deadlineMs) {
+        finish(c, HTTP_ERR_TIMEOUT, std::string(), false);
+        continue;  // the next request may be due as well
+      }
+      if (c.state_ == HttpConn::CONN_IDLE && now >= r.notBeforeMs) start(c);
+    } else if (c.fd_ >= 0 && c.state_ == HttpConn::CONN_IDLE && now - c.lastUseMs_ >= HTTP_KEEPALIVE_IDLE_MS) {
+      close(c);
+    }
+    if (c.queue_.empty() && c.fd_ < 0) {
+      c.tracked_ = false;
+      tracked_[i] = tracked_.back();
+      tracked_.pop_back();
+      continue;
+    }
+    i++;
+  }
+}
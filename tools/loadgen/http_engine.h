@@ -0,0 +1,163 @@
+/**
+ * http_engine.h - epoll HTTP/1.1 client with the device's per-meter request rules
+ *
+ * Every virtual meter owns one HttpConn and uses it the way AsyncHttp
+ * (include/http_async.h) uses the meter's single connection: a FIFO of at most
+ * HTTP_QUEUE_LEN requests, one on the wire at a time, the connection kept alive
+ * after a delimited response and closed after HTTP_KEEPALIVE_IDLE_MS idle, a
+ * request that fails on a reused connection before any response byte retried
+ * at once on a fresh one, a deadline from enqueue and a retry count with
+ * HTTP_RETRY_BACKOFF_MS between attempts - neither for a POST that was already
+ * sent in full. Completion callbacks get the HTTP
+ * status or the same negative HTTP_ERR_* codes as the firmware.
+ *
+ * All connections share one non-blocking epoll loop: poll() waits for socket
+ * events, service() starts queued requests and enforces deadlines and idle
+ * timeouts. New sockets are only opened from service(), never while poll()
+ * dispatches events, so an event for a socket closed earlier in the same batch
+ * is recognised (fd_ < 0) and dropped. Plain HTTP only (point it at a local server).
+ *
+ * Per endpoint (a small tag given with each request) the engine counts outcomes
+ * and records latency - from the attempt's start, connect included, to the last
+ * response byte - in LatencyHistograms. Single-threaded.
+ */
+
+#ifndef LOADGEN_HTTP_ENGINE_H
+#define LOADGEN_HTTP_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include "latency_histogram.h"
+
+// Same values as http_async.h (which needs the Arduino core)
+#define HTTP_ERR_CONNECT       (-1)
+#define HTTP_ERR_SEND          (-3)
+#define HTTP_ERR_NOT_CONNECTED (-4)
+#define HTTP_ERR_CONN_LOST     (-5)
+#define HTTP_ERR_QUEUE_FULL    (-6)
+#define HTTP_ERR_TIMEOUT       (-11)
+
+#define HTTP_QUEUE_LEN         4
+#define HTTP_MAX_PATH          96
+#define HTTP_MAX_RESP          1024
+#define HTTP_RETRY_BACKOFF_MS  1000
+#define HTTP_KEEPALIVE_IDLE_MS 30000
+
+#define HTTP_MAX_ENDPOINTS     8
+
+typedef void (*HttpDoneCallback)(int status, const char* body, size_t len, void* ctx);
+
+struct HttpEndpointStats {
+  uint32_t requests;     // completed requests (retries are not extra requests)
+  uint32_t ok;           // 2xx
+  uint32_t clientErrors; // 4xx
+  uint32_t serverErrors; // 5xx
+  uint32_t transport;    // connect/send/lost
+  uint32_t timeouts;
+  uint32_t queueFull;    // refused by enqueue()
+  uint32_t retries;      // attempts after the first
+  uint64_t bytesOut;
+  uint64_t bytesIn;
+  LatencyHistogram latency;
+};
+
+class HttpConn {
+ public:
+  HttpConn();
+  ~HttpConn();
+  bool busy() const { return !queue_.empty(); }
+
+ private:
+  friend class HttpEngine;
+  enum State : uint8_t { CONN_IDLE, CONN_CONNECTING, CONN_SENDING, CONN_RECEIVING };
+
+  struct Request {
+    std::string head;      // request line + headers, built at enqueue
+    std::string body;
+    uint64_t enqueuedMs;
+    uint32_t deadlineMs;
+    uint64_t notBeforeMs;  // retry backoff
+    bool started;          // an attempt ran (later ones count as retries)
+    bool idempotent;       // may be sent again after it went out in full (not a POST)
+    uint8_t retriesLeft;
+    uint8_t endpoint;
+    HttpDoneCallback cb;
+    void* ctx;
+  };
+
+  std::deque<Request> queue_;
+  int fd_;
+  State state_;
+  bool reused_;          // this attempt runs on a kept-alive connection
+  bool linkUp_;
+  bool tracked_;         // in the engine's open/busy list
+  std::string out_;
+  size_t outOff_;
+  std::string in_;
+  uint64_t lastUseMs_;
+  uint64_t attemptUs_;
+};
+
+class HttpEngine {
+ public:
+  typedef uint64_t (*Clock)();
+
+  HttpEngine();
+  ~HttpEngine();
+
+  // url: http://host[:port][/base]; paths given to enqueue() are appended to base
+  bool begin(const char* url, Clock clockMs, Clock clockUs);
+  const char* error() const { return error_; }
+
+  // False (and counted as queue-full) when the connection already has HTTP_QUEUE_LEN requests
+  bool enqueue(HttpConn& c, uint8_t endpoint, const char* method, const char* path, const void* body,
+               size_t len, const char* contentType, uint32_t deadlineMs, uint8_t retries, HttpDoneCallback cb,
+               void* ctx, const char* bearer = NULL);
+  // WiFi of this meter up/down. Down closes the socket: the request on the wire fails with
+  // HTTP_ERR_CONN_LOST, later attempts with HTTP_ERR_NOT_CONNECTED (retried like on the device)
+  void setLink(HttpConn& c, bool up);
+
+  // Wait up to timeoutMs for socket events and advance the connections that have them
+  void poll(int timeoutMs);
+  // Start queued requests, fail expired ones, close idle connections
+  void service();
+
+  const HttpEndpointStats& stats(uint8_t endpoint) const { return stats_[endpoint]; }
+  HttpEndpointStats& stats(uint8_t endpoint) { return stats_[endpoint]; }
+  uint32_t openConnections() const { return open_; }
+  uint32_t connectsOpened() const { return opened_; }
+  uint32_t connectsReused() const { return reusedCount_; }
+
+ private:
+  void start(HttpConn& c);
+  bool connect(HttpConn& c);
+  void onEvent(HttpConn& c, uint32_t events);
+  void flush(HttpConn& c);
+  void receive(HttpConn& c);
+  // Complete response in c.in_ -> status, de-chunked body, keep-alive; false while incomplete
+  static bool parse(const std::string& in, bool eof, int& status, std::string& body, bool& keepAlive);
+  // End of an attempt (AsyncHttp::finish): complete, fast retry, or retry after the backoff
+  void finish(HttpConn& c, int status, const std::string& body, bool keepAlive);
+  void close(HttpConn& c);
+  void track(HttpConn& c);
+  void watch(HttpConn& c, uint32_t events);
+
+  int epfd_;
+  sockaddr_in addr_;
+  char host_[64];
+  char base_[48];
+  Clock clockMs_;
+  Clock clockUs_;
+  std::vector<HttpConn*> tracked_;  // connections with queued requests or an open socket
+  HttpEndpointStats stats_[HTTP_MAX_ENDPOINTS];
+  uint32_t open_;
+  uint32_t opened_;
+  uint32_t reusedCount_;
+  char error_[96];
+};
+
+#endif // LOADGEN_HTTP_ENGINE_H
@@ -0,0 +1,506 @@
+/**
+ * loadgen.cpp - Fleet load generator: thousands of virtual meters against a local API server
+ *
+ * Every meter runs the firmware's own request schedule (virtual_meter.h) and
+ * payload code (TelemetryEncoder, ReportPolicy, crypto tokens, the Scheduler),
+ * so what the backend sees is what N real meters would send - batching,
+ * heartbeats, backoff, outage backfill and token polling included. Linux only
+ * (epoll), one thread; plain HTTP.
+ *
+ *   g++ -std=gnu++17 -O2 -Iinclude tools/loadgen/loadgen.cpp tools/loadgen/virtual_meter.cpp \
+ *       tools/loadgen/http_engine.cpp src/report_policy.cpp src/telemetry_codec.cpp src/crypto_token.cpp \
+ *       src/scheduler.cpp src/latency_histogram.cpp -o loadgen
+ *   ./loadgen --url http://127.0.0.1:5000/api --meters 5000 --ramp 120 --duration 900
+ *
+ * Options (times in seconds):
+ *   --url U            API base, as apiBaseUrl on the device (default http://127.0.0.1:5000/api)
+ *   --meters N         fleet size (default 1000)
+ *   --ramp S           boot the meters evenly over S (default 60)
+ *   --duration S       run time including the ramp (default 300)
+ *   --profile P        load profile or mix: home, shop, idle, "home=70,shop=20,idle=10" (default mix)
+ *   --credit KWH       restored credit at boot, uniform in 1..100% of KWH (default 5)
+ *   --buy M            none | offline (typed crypto tokens) | api (POST /purchases/buy) (default offline)
+ *   --buy-every S      mean time between top-ups of a running meter, 0 = only when exhausted (default 3600)
+ *   --jwt T            customer bearer token for --buy api (default: register a new customer)
+ *   --outage-every S   mean time between WiFi drops per meter, 0 = none (default 0)
+ *   --outage-len S     mean WiFi drop length (default 60)
+ *   --blackout AT:LEN  every meter loses WiFi at AT for LEN (uplink outage, then the backfill surge)
+ *   --first-meter N    first 13-digit meter number (default 0299000000000)
+ *   --seed N           random seed (default 1)
+ *   --token-key HEX    crypto token key of the virtual meters (default LOADGEN_TOKEN_KEY, a test key)
+ *   --report-every S   progress line interval (default 10)
+ *   --json             final summary as one JSON object instead of the table
+ *   --trace            no fleet: write --duration of one --profile's load (seeded by --seed)
+ *                      to stdout as a trace, one "power_dw voltage_dv" line every
+ *                      LOADGEN_TRACE_STEP_MS (test/golden/load/ was made this way)
+ *
+ * The WebSocket push channel is not simulated: every meter polls pending-token,
+ * which is the request load with the channel down (the worst case for HTTP).
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <memory>
+#include <queue>
+#include <vector>
+#include "config.h"
+#include "virtual_meter.h"
+
+#define MAX_MIX          8
+#define POLL_MAX_MS      5
+#define LOADGEN_TOKEN_KEY "00112233445566778899aabbccddeeff"
+#define LOADGEN_TRACE_STEP_MS 5000   // REPORT_MIN_INTERVAL_MS: the policy cannot act faster
+
+// ------ Clock ------
+
+static struct timespec startTs;
+
+uint64_t fleetMicros64() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)(ts.tv_sec - startTs.tv_sec) * 1000000ULL + (ts.tv_nsec - startTs.tv_nsec) / 1000;
+}
+uint64_t fleetMillis64() { return fleetMicros64() / 1000; }
+uint32_t fleetMillis() { return (uint32_t)fleetMillis64(); }
+uint32_t fleetMicros() { return (uint32_t)fleetMicros64(); }
+
+// ------ Options ------
+
+struct Options {
+  const char* url;
+  uint32_t meters;
+  uint32_t rampS;
+  uint32_t durationS;
+  const char* profile;
+  float creditKwh;
+  const char* jwt;
+  uint32_t blackoutAtS;
+  uint32_t blackoutLenS;
+  uint32_t seed;
+  const char* tokenKey;
+  uint32_t reportEveryS;
+  bool json;
+  bool trace;
+};
+
+struct MixEntry {
+  const LoadProfile* profile;
+  uint32_t weight;
+};
+
+static int usage() {
+  fprintf(stderr,
+          "usage: loadgen [--url U] [--meters N] [--ramp S] [--duration S] [--profile P]\n"
+          "               [--credit KWH] [--buy none|offline|api] [--buy-every S] [--jwt T]\n"
+          "               [--outage-every S] [--outage-len S] [--blackout AT:LEN]\n"
+          "               [--first-meter N] [--seed N] [--token-key HEX]\n"
+          "               [--report-every S] [--json]\n"
+          "       loadgen --trace --profile P [--duration S] [--seed N]\n");
+  return 2;
+}
+
+// "home" or "home=70,shop=20,idle=10"; false on an unknown profile
+static bool parseMix(const char* spec, MixEntry* mix, uint8_t& count) {
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%s", strcmp(spec, "mix") == 0 ? "home=70,shop=20,idle=10" : spec);
+  count = 0;
+  for (char* item = strtok(buf, ","); item && count < MAX_MIX; item = strtok(NULL, ",")) {
+    char* eq = strchr(item, '=');
+    uint32_t weight = 1;
+    if (eq) {
+      *eq = '\0';
+      weight = (uint32_t)strtoul(eq + 1, NULL, 10);
+    }
+    const LoadProfile* p = findLoadProfile(item);
+    if (!p || weight == 0) return false;
+    mix[count].profile = p;
+    mix[count].weight = weight;
+    count++;
+  }
+  return count > 0;
+}
+
+// ------ Reporting ------
+
+// Percentile of the records added since prev (bucket snapshot), like LatencyHistogram::percentile()
+static uint32_t percentileSince(const LatencyHistogram& h, const uint32_t* prev, uint8_t pct) {
+  uint32_t total = 0;
+  for (uint8_t b = 0; b < LHIST_BUCKETS; b++) total += h.bucketCount(b) - prev[b];
+  if (total == 0) return 0;
+  uint32_t rank = (uint32_t)(((uint64_t)total * pct + 99) / 100);
+  uint32_t seen = 0;
+  for (uint8_t b = 0; b < LHIST_BUCKETS; b++) {
+    seen += h.bucketCount(b) - prev[b];
+    if (seen >= rank) return LatencyHistogram::bucketHigh(b);
+  }
+  return h.max();
+}
+
+static void snapshotBuckets(const LatencyHistogram& h, uint32_t* out) {
+  for (uint8_t b = 0; b < LHIST_BUCKETS; b++) out[b] = h.bucketCount(b);
+}
+
+struct Interval {
+  uint64_t atMs;
+  uint32_t requests[EP_COUNT];
+  uint32_t failed[EP_COUNT];
+  uint64_t accepted;
+  uint32_t buckets[LHIST_BUCKETS];  // energy-data/bin latency
+};
+
+static uint32_t failures(const HttpEndpointStats& s) {
+  return s.clientErrors + s.serverErrors + s.transport + s.timeouts + s.queueFull;
+}
+
+static void takeInterval(const Fleet& fleet, Interval& iv) {
+  iv.atMs = fleetMillis64();
+  for (uint8_t e = 0; e < EP_COUNT; e++) {
+    iv.requests[e] = fleet.http.stats(e).requests;
+    iv.failed[e] = failures(fleet.http.stats(e));
+  }
+  iv.accepted = fleet.counters.readingsAccepted;
+  snapshotBuckets(fleet.http.stats(EP_TELEMETRY).latency, iv.buckets);
+}
+
+static void printProgress(const Fleet& fleet, const std::vector<std::unique_ptr<VirtualMeter>>& meters,
+                          uint32_t booted, const Interval& prev) {
+  uint64_t now = fleetMillis64();
+  double secs = (now - prev.atMs) / 1000.0;
+  uint32_t reqs = 0;
+  uint32_t failed = 0;
+  for (uint8_t e = 0; e < EP_COUNT; e++) {
+    reqs += fleet.http.stats(e).requests - prev.requests[e];
+    failed += failures(fleet.http.stats(e)) - prev.failed[e];
+  }
+  uint32_t online = 0;
+  uint64_t backlog = 0;
+  for (uint32_t i = 0; i < booted; i++) {
+    online += meters[i]->online();
+    backlog += meters[i]->backlog();
+  }
+  const LatencyHistogram& bin = fleet.http.stats(EP_TELEMETRY).latency;
+  fprintf(stderr,
+          "[%5llus] meters %u online %u  req/s %.1f  err %.2f%%  bin p50 %.1fms p99 %.1fms  "
+          "readings/s %.1f  backlog %llu  conns %u\n",
+          (unsigned long long)(now / 1000), booted, online, secs > 0 ? reqs / secs : 0.0,
+          reqs ? 100.0 * failed / reqs : 0.0, percentileSince(bin, prev.buckets, 50) / 1000.0,
+          percentileSince(bin, prev.buckets, 99) / 1000.0,
+          secs > 0 ? (fleet.counters.readingsAccepted - prev.accepted) / secs : 0.0, (unsigned long long)backlog,
+          fleet.http.openConnections());
+}
+
+static void printSummary(const Fleet& fleet, const std::vector<std::unique_ptr<VirtualMeter>>& meters, double secs,
+                         bool json) {
+  const FleetCounters& c = fleet.counters;
+  uint32_t states[METER_STATES] = { 0 };
+  uint64_t backlog = 0;
+  for (size_t i = 0; i < meters.size(); i++) {
+    states[meters[i]->state()]++;
+    backlog += meters[i]->backlog();
+  }
+
+  if (json) {
+    printf("{\"seconds\":%.1f,\"meters\":%u,\"endpoints\":{", secs, (unsigned)meters.size());
+    for (uint8_t e = 0; e < EP_COUNT; e++) {
+      const HttpEndpointStats& s = fleet.http.stats(e);
+      printf("%s\"%s\":{\"requests\":%u,\"ok\":%u,\"4xx\":%u,\"5xx\":%u,\"transport\":%u,\"timeouts\":%u,"
+             "\"queue_full\":%u,\"retries\":%u,\"p50_us\":%u,\"p99_us\":%u,\"max_us\":%u}",
+             e ? "," : "", ENDPOINT_NAMES[e], s.requests, s.ok, s.clientErrors, s.serverErrors, s.transport,
+             s.timeouts, s.queueFull, s.retries, s.latency.percentile(50), s.latency.percentile(99), s.latency.max());
+    }
+    printf("},\"readings\":{\"logged\":%llu,\"accepted\":%llu,\"rejected\":%llu,\"evicted\":%llu,\"backlog\":%llu,"
+           "\"age_p50_ms\":%u,\"age_p99_ms\":%u},",
+           (unsigned long long)c.readingsLogged, (unsigned long long)c.readingsAccepted,
+           (unsigned long long)c.readingsRejected, (unsigned long long)c.readingsEvicted, (unsigned long long)backlog,
+           fleet.readingAgeMs.percentile(50), fleet.readingAgeMs.percentile(99));
+    printf("\"frames\":%llu,\"frame_bytes\":%llu,\"identity_resends\":%u,", (unsigned long long)c.framesSent,
+           (unsigned long long)c.frameBytes, c.identityResends);
+    printf("\"tokens\":{\"purchases\":%u,\"failed\":%u,\"applied\":%u,\"confirmed\":%u,\"bad\":%u,\"poll_hits\":%u,"
+           "\"delivery_p50_ms\":%u,\"delivery_p99_ms\":%u},",
+           c.purchases, c.purchaseFailures, c.tokensApplied, c.tokensConfirmed, c.badTokens, c.pollHits,
+           fleet.tokenDelayMs.percentile(50), fleet.tokenDelayMs.percentile(99));
+    printf("\"states\":{");
+    for (uint8_t s = 0; s < METER_STATES; s++) printf("%s\"%s\":%u", s ? "," : "", METER_STATE_NAMES[s], states[s]);
+    printf("},\"exhausted\":%u,\"outages\":%u,\"connects\":%u,\"reused\":%u}\n", c.exhausted, c.outages,
+           fleet.http.connectsOpened(), fleet.http.connectsReused());
+    return;
+  }
+
+  printf("\n%u meters, %.0f s\n\n", (unsigned)meters.size(), secs);
+  printf("%-16s %9s %8s %7s %6s %6s %9s %7s %6s %7s %8s %8s %8s\n", "endpoint", "requests", "req/s", "ok%", "4xx",
+         "5xx", "transport", "timeout", "qfull", "retries", "p50 ms", "p99 ms", "max ms");
+  for (uint8_t e = 0; e < EP_COUNT; e++) {
+    const HttpEndpointStats& s = fleet.http.stats(e);
+    if (s.requests == 0 && s.queueFull == 0) continue;
+    printf("%-16s %9u %8.1f %7.2f %6u %6u %9u %7u %6u %7u %8.1f %8.1f %8.1f\n", ENDPOINT_NAMES[e], s.requests,
+           s.requests / secs, s.requests ? 100.0 * s.ok / s.requests : 0.0, s.clientErrors, s.serverErrors,
+           s.transport, s.timeouts, s.queueFull, s.retries, s.latency.percentile(50) / 1000.0,
+           s.latency.percentile(99) / 1000.0, s.latency.max() / 1000.0);
+  }
+  printf("\nreadings  logged %llu  accepted %llu (%.1f/s)  rejected %llu  evicted %llu  backlog %llu\n",
+         (unsigned long long)c.readingsLogged, (unsigned long long)c.readingsAccepted, c.readingsAccepted / secs,
+         (unsigned long long)c.readingsRejected, (unsigned long long)c.readingsEvicted, (unsigned long long)backlog);
+  printf("          capture -> accepted p50 %.1f s  p99 %.1f s\n", fleet.readingAgeMs.percentile(50) / 1000.0,
+         fleet.readingAgeMs.percentile(99) / 1000.0);
+  printf("frames    %llu  avg %.0f bytes  identity resends %u\n", (unsigned long long)c.framesSent,
+         c.framesSent ? (double)c.frameBytes / c.framesSent : 0.0, c.identityResends);
+  printf("tokens    purchases %u  failed %u  applied %u  confirmed %u  bad %u  poll hits %u\n", c.purchases,
+         c.purchaseFailures, c.tokensApplied, c.tokensConfirmed, c.badTokens, c.pollHits);
+  if (fleet.tokenDelayMs.count()) {
+    printf("          purchase -> applied p50 %.1f s  p99 %.1f s\n", fleet.tokenDelayMs.percentile(50) / 1000.0,
+           fleet.tokenDelayMs.percentile(99) / 1000.0);
+  }
+  printf("meters   ");
+  for (uint8_t s = 0; s < METER_STATES; s++) printf(" %s %u", METER_STATE_NAMES[s], states[s]);
+  printf("  exhausted %u  outages %u\n", c.exhausted, c.outages);
+  printf("http      connects %u  reused %u\n", fleet.http.connectsOpened(), fleet.http.connectsReused());
+}
+
+// ------ Customer account for --buy api ------
+
+static bool registered;
+static bool registerDone;
+
+static void onRegistered(int status, const char* body, size_t /*len*/, void* ctx) {
+  Fleet& fleet = *(Fleet*)ctx;
+  registerDone = true;
+  const char* p = status == 200 ? strstr(body, "\"token\":\"") : NULL;
+  if (!p) {
+    fprintf(stderr, "register failed: %d %s\n", status, body);
+    return;
+  }
+  p += 9;
+  const char* end = strchr(p, '"');
+  if (!end) return;
+  fleet.jwt.assign(p, end - p);
+  registered = true;
+}
+
+static bool registerCustomer(Fleet& fleet) {
+  char body[256];
+  int n = snprintf(body, sizeof(body),
+                   "{\"fullName\":\"Load Test\",\"email\":\"loadgen-%ld-%d@example.com\","
+                   "\"phoneNumber\":\"0780000000\",\"password\":\"loadgen-password\"}",
+                   (long)time(NULL), (int)getpid());
+  if (!fleet.http.enqueue(fleet.customers[0], EP_REGISTER, "POST", "/auth/register", body, n, "application/json",
+                          15000, 1, onRegistered, &fleet)) {
+    return false;
+  }
+  while (!registerDone) {
+    fleet.http.service();
+    fleet.http.poll(POLL_MAX_MS);
+  }
+  return registered;
+}
+
+// ------ Load traces ------
+
+// The metering task's samples of one profile, the last one of every step written out
+static void writeTrace(const LoadProfile& profile, uint32_t durationS, uint32_t seed) {
+  LoadModel load(profile, seed);
+  load.begin(0);
+  uint32_t powerDw = 0;
+  uint16_t voltageDv = 0;
+  printf("# loadgen --trace --profile %s --duration %u --seed %u: power_dw voltage_dv every %u ms\n",
+         profile.name, durationS, seed, LOADGEN_TRACE_STEP_MS);
+  for (uint32_t t = LOADGEN_METERING_MS; t <= durationS * 1000; t += LOADGEN_METERING_MS) {
+    load.sample(t, powerDw, voltageDv);
+    if (t % LOADGEN_TRACE_STEP_MS == 0) printf("%u %u\n", powerDw, voltageDv);
+  }
+}
+
+// ------ Main loop ------
+
+struct Due {
+  uint64_t atMs;
+  uint32_t meter;
+  bool operator>(const Due& o) const { return atMs > o.atMs; }
+};
+
+int main(int argc, char** argv) {
+  clock_gettime(CLOCK_MONOTONIC, &startTs);
+  Options opt = { "http://127.0.0.1:5000/api", 1000, 60, 300, "mix", 5.0f, NULL, 0, 0, 1, LOADGEN_TOKEN_KEY, 10, false, false };
+  std::unique_ptr<Fleet> fleetPtr(new Fleet());
+  Fleet& fleet = *fleetPtr;
+  FleetConfig& cfg = fleet.cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  memset(&fleet.counters, 0, sizeof(fleet.counters));
+  cfg.buy = BUY_OFFLINE;
+  cfg.buyEveryS = 3600;
+  cfg.outageLenS = 60;
+  cfg.firstMeter = 299000000000ULL;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    const char* v = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(a, "--json") == 0) {
+      opt.json = true;
+      continue;
+    }
+    if (strcmp(a, "--trace") == 0) {
+      opt.trace = true;
+      continue;
+    }
+    if (!v) return usage();
+    i++;
+    if (strcmp(a, "--url") == 0) {
+      opt.url = v;
+    } else if (strcmp(a, "--meters") == 0) {
+      opt.meters = (uint32_t)strtoul(v, NULL, 10);
+    } else if (strcmp(a, "--ramp") == 0) {
+      opt.rampS = (uint32_t)strtoul(v, NULL, 10);
+    } else if (strcmp(a, "--duration") == 0) {
+      opt.durationS = (uint32_t)strtoul(v, NULL, 10);
+    } else if (strcmp(a, "--profile") == 0) {
+      opt.profile = v;
+    } else if (strcmp(a, "--credit") == 0) {
+      opt.creditKwh = strtof(v, NULL);
+    } else if (strcmp(a, "--buy") == 0) {
+      if (strcmp(v, "none") == 0) {
+        cfg.buy = BUY_NONE;
+      } else if (strcmp(v, "offline") == 0) {
+        cfg.buy = BUY_OFFLINE;
+      } else if (strcmp(v, "api") == 0) {
+        cfg.buy = BUY_API;
+      } else {
+        return usage();
+      }
+    } else if (strcmp(a, "--buy-every") == 0) {
+      cfg.buyEveryS = (uint32_t)strtoul(v, NULL, 10);
+    } else if (strcmp(a, "--jwt") == 0) {
+      opt.jwt = v;
+    } else if (strcmp(a, "--outage-every") == 0) {
+      cfg.outageEveryS = (uint32_t)strtoul(v, NULL, 10);
+    } else if (strcmp(a, "--outage-len") == 0) {
+      cfg.outageLenS = (uint32_t)strtoul(v, NULL, 10);
+    } else if (strcmp(a, "--blackout") == 0) {
+      if (sscanf(v, "%u:%u", &opt.blackoutAtS, &opt.blackoutLenS) != 2 || opt.blackoutLenS == 0) return usage();
+    } else if (strcmp(a, "--first-meter") == 0) {
+      cfg.firstMeter = strtoull(v, NULL, 10);
+    } else if (strcmp(a, "--seed") == 0) {
+      opt.seed = (uint32_t)strtoul(v, NULL, 10);
+    } else if (strcmp(a, "--token-key") == 0) {
+      opt.tokenKey = v;
+    } else if (strcmp(a, "--report-every") == 0) {
+      opt.reportEveryS = (uint32_t)strtoul(v, NULL, 10);
+    } else {
+      return usage();
+    }
+  }
+  if (opt.trace) {
+    const LoadProfile* profile = findLoadProfile(opt.profile);
+    if (!profile || opt.durationS == 0) return usage();
+    writeTrace(*profile, opt.durationS, opt.seed);
+    return 0;
+  }
+  MixEntry mix[MAX_MIX];
+  uint8_t mixCount;
+  if (opt.meters == 0 || opt.durationS == 0 || opt.creditKwh <= 0 || !parseMix(opt.profile, mix, mixCount)) {
+    return usage();
+  }
+  uint32_t mixTotal = 0;
+  for (uint8_t i = 0; i < mixCount; i++) mixTotal += mix[i].weight;
+  if (!cryptoTokenParseKey(opt.tokenKey, cfg.tokenKey)) {
+    fprintf(stderr, "--token-key: 32 hex characters expected\n");
+    return 1;
+  }
+
+  // One socket per meter plus the customers'
+  struct rlimit lim;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < opt.meters + LOADGEN_CUSTOMER_CONNS + 16) {
+    fprintf(stderr, "warning: open file limit %llu is below %u meters; raise it with ulimit -n\n",
+            (unsigned long long)lim.rlim_cur, opt.meters);
+  }
+
+  if (!fleet.http.begin(opt.url, fleetMillis64, fleetMicros64)) {
+    fprintf(stderr, "%s\n", fleet.http.error());
+    return 1;
+  }
+  if (cfg.buy == BUY_API) {
+    if (opt.jwt) {
+      fleet.jwt = opt.jwt;
+    } else if (!registerCustomer(fleet)) {
+      return 1;
+    }
+  }
+
+  // Profile and credit per meter, fixed by the seed
+  uint32_t rng = opt.seed ? opt.seed : 1;
+  std::vector<std::unique_ptr<VirtualMeter>> meters;
+  std::vector<float> credit;
+  meters.reserve(opt.meters);
+  for (uint32_t i = 0; i < opt.meters; i++) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    uint32_t pick = rng % mixTotal;
+    uint8_t p = 0;
+    while (pick >= mix[p].weight) pick -= mix[p++].weight;
+    meters.emplace_back(new VirtualMeter(fleet, i, *mix[p].profile, opt.seed));
+    credit.push_back(opt.creditKwh * (0.01f + 0.99f * (rng % 10000) / 10000.0f));
+  }
+
+  fprintf(stderr, "%u meters -> %s, ramp %u s, run %u s, buy %s\n", opt.meters, opt.url, opt.rampS, opt.durationS,
+          cfg.buy == BUY_API ? "api" : cfg.buy == BUY_OFFLINE ? "offline" : "none");
+
+  std::priority_queue<Due, std::vector<Due>, std::greater<Due>> due;
+  uint64_t startMs = fleetMillis64();
+  uint64_t endMs = startMs + (uint64_t)opt.durationS * 1000;
+  uint64_t rampMs = (uint64_t)opt.rampS * 1000;
+  uint64_t nextReportMs = startMs + (uint64_t)opt.reportEveryS * 1000;
+  bool blackoutDone = opt.blackoutLenS == 0;
+  uint32_t booted = 0;
+  Interval prev;
+  takeInterval(fleet, prev);
+
+  for (;;) {
+    uint64_t now = fleetMillis64();
+    if (now >= endMs) break;
+
+    while (booted < opt.meters && (uint64_t)booted * rampMs <= (now - startMs) * opt.meters) {
+      meters[booted]->boot(credit[booted]);
+      due.push(Due{ now, booted });
+      booted++;
+    }
+    if (!blackoutDone && now - startMs >= (uint64_t)opt.blackoutAtS * 1000) {
+      for (uint32_t i = 0; i < booted; i++) meters[i]->linkDown(opt.blackoutLenS * 1000);
+      blackoutDone = true;
+      fprintf(stderr, "blackout: all meters offline for %u s\n", opt.blackoutLenS);
+    }
+
+    // loop() of every meter that has a task due
+    while (!due.empty() && due.top().atMs <= now) {
+      Due d = due.top();
+      due.pop();
+      uint32_t idleMs = meters[d.meter]->run();
+      due.push(Due{ fleetMillis64() + (idleMs ? idleMs : 1), d.meter });
+    }
+    fleet.http.service();
+
+    uint64_t wait = POLL_MAX_MS;
+    if (!due.empty()) {
+      uint64_t t = fleetMillis64();
+      wait = due.top().atMs > t ? due.top().atMs - t : 0;
+      if (wait > POLL_MAX_MS) wait = POLL_MAX_MS;
+    }
+    fleet.http.poll((int)wait);
+    fleet.http.service();
+
+    if (opt.reportEveryS && fleetMillis64() >= nextReportMs) {
+      printProgress(fleet, meters, booted, prev);
+      takeInterval(fleet, prev);
+      nextReportMs += (uint64_t)opt.reportEveryS * 1000;
+    }
+  }
+
+  printSummary(fleet, meters, (fleetMillis64() - startMs) / 1000.0, opt.json);
+  return 0;
+}
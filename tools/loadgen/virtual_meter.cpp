@@ -0,0 +1,666 @@
+/**
+ * virtual_meter.cpp - Simulated meter running the firmware's API schedule (see virtual_meter.h)
+ *
+ * Function names follow main.cpp so the two can be read side by side.
+ */
+#include "virtual_meter.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "telemetry_codec.h"
+
+const char* const ENDPOINT_NAMES[EP_COUNT] = {
+  "energy-data/bin", "pending-token", "validate-token", "confirm-token", "purchases/buy", "auth/register",
+};
+
+const char* const METER_STATE_NAMES[METER_STATES] = { "ready", "running", "exhausted", "validating", "badtoken" };
+
+// ------ Load profiles ------
+// Appliances switch on at random (exponential gaps) on top of a base load
+
+static const LoadProfile PROFILES[] = {
+  // fridge, kettle, TV, iron
+  { "home", 60, 3, { { 150, 1800, 900 }, { 2000, 7200, 180 }, { 120, 5400, 3600 }, { 1200, 20000, 900 } } },
+  // freezer, lights, grinder, kettle
+  { "shop", 300, 3, { { 400, 1200, 900 }, { 500, 14400, 14400 }, { 1500, 3600, 60 }, { 2000, 10800, 180 } } },
+  // standby only, a fridge now and then
+  { "idle", 5, 2, { { 100, 3600, 600 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } } },
+};
+
+const LoadProfile* findLoadProfile(const char* name) {
+  for (size_t i = 0; i < sizeof(PROFILES) / sizeof(PROFILES[0]); i++) {
+    if (strcmp(PROFILES[i].name, name) == 0) return &PROFILES[i];
+  }
+  return NULL;
+}
+
+// xorshift32; the state must not be 0
+static uint32_t rand32(uint32_t& state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+static uint32_t uniform(uint32_t& state, uint32_t lo, uint32_t hi) {
+  return lo + rand32(state) % (hi - lo + 1);
+}
+
+static uint32_t exponentialMs(uint32_t& state, uint32_t meanS) {
+  double u = (rand32(state) + 1.0) / 4294967296.0;  // (0, 1]
+  double ms = -log(u) * meanS * 1000.0;
+  return ms > 2e9 ? 2000000000U : (uint32_t)ms;
+}
+
+LoadModel::LoadModel(const LoadProfile& profile, uint32_t seed)
+    : profile_(profile), rng_((seed * 0x9E3779B9U) | 1), voltageDv_(2300) {
+  memset(untilMs_, 0, sizeof(untilMs_));
+  memset(nextMs_, 0, sizeof(nextMs_));
+}
+
+void LoadModel::begin(uint32_t nowMs) {
+  for (uint8_t i = 0; i < LOADGEN_MAX_APPLIANCES; i++) {
+    if (profile_.appliances[i].watts) nextMs_[i] = nowMs + exponentialMs(rng_, profile_.appliances[i].meanGapS);
+  }
+}
+
+void LoadModel::sample(uint32_t nowMs, uint32_t& powerDw, uint16_t& voltageDv) {
+  uint32_t watts = profile_.baseW;
+  for (uint8_t i = 0; i < LOADGEN_MAX_APPLIANCES; i++) {
+    const Appliance& a = profile_.appliances[i];
+    if (a.watts == 0) continue;
+    if ((int32_t)(nowMs - nextMs_[i]) >= 0) {
+      untilMs_[i] = nowMs + a.onS * 1000;
+      nextMs_[i] = untilMs_[i] + exponentialMs(rng_, a.meanGapS);
+    }
+    if ((int32_t)(untilMs_[i] - nowMs) > 0) watts += a.watts;
+  }
+  int32_t jitter = (int32_t)uniform(rng_, 0, 2 * profile_.noisePct) - profile_.noisePct;
+  powerDw = watts * (100 + jitter) / 10;
+  // Random walk pulled back to 230 V (one step with probability |offset| / 64): about +-1 V
+  int32_t v = voltageDv_ + (int32_t)uniform(rng_, 0, 4) - 2;
+  int32_t offset = (int32_t)voltageDv_ - 2300;
+  if ((int32_t)(rand32(rng_) % 64) < (offset < 0 ? -offset : offset)) v += offset < 0 ? 1 : -1;
+  voltageDv_ = (uint16_t)(v < 2150 ? 2150 : v > 2450 ? 2450 : v);
+  voltageDv = voltageDv_;
+}
+
+static const uint32_t LOG_CAPACITY = TELEMETRY_LOG_BUDGET_BYTES / sizeof(TelemetryRecord);
+static const uint32_t PURCHASE_RWF[] = { 1000, 2000, 5000 };  // 8, 16, 40 kWh at 125 RWF/kWh
+static const uint32_t RWF_PER_KWH = 125;
+
+// ------ Minimal JSON field access for the few responses we read ------
+
+// Start of the value of "key" (first occurrence), NULL when absent
+static const char* jsonValue(const char* body, const char* key) {
+  char quoted[40];
+  snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+  const char* p = strstr(body, quoted);
+  if (!p) return NULL;
+  p += strlen(quoted);
+  while (*p == ' ' || *p == ':') p++;
+  return p;
+}
+
+static bool jsonTrue(const char* body, const char* key) {
+  const char* v = jsonValue(body, key);
+  return v && strncmp(v, "true", 4) == 0;
+}
+
+static double jsonNumber(const char* body, const char* key) {
+  const char* v = jsonValue(body, key);
+  return v ? strtod(v, NULL) : 0.0;
+}
+
+// String (or bare number) value into out; false when absent or too long
+static bool jsonString(const char* body, const char* key, char* out, size_t cap) {
+  const char* v = jsonValue(body, key);
+  if (!v) return false;
+  const char* end;
+  if (*v == '"') {
+    v++;
+    end = strchr(v, '"');
+  } else {
+    end = v;
+    while ((*end >= '0' && *end <= '9') || *end == '.' || *end == '-') end++;
+  }
+  if (!end || end == v || (size_t)(end - v) >= cap) return false;
+  memcpy(out, v, end - v);
+  out[end - v] = '\0';
+  return true;
+}
+
+// ------ VirtualMeter ------
+
+VirtualMeter::VirtualMeter(Fleet& fleet, uint32_t index, const LoadProfile& profile, uint32_t seed)
+    : fleet_(fleet), profile_(profile), scheduler_(fleetMillis, fleetMicros),
+      rng_((seed ^ (index * 0x9E3779B9U)) | 1), state_(METER_READY), load_(profile, ~rng_), powerDw_(0),
+      voltageDv_(2300), pfPct_(95),
+      frequencyDhz_(500), energyWh_(0), remainingUwh_(0), consumedUwh_(0), exhausted_(false), lastMeteringMs_(0),
+      sessionStartMs_(0), reportPolicy_(REPORT_POLICY_CONFIG), linkUp_(true), wifiConnected_(true),
+      outageUntilMs_(0), nextSeq_(1), inFlightLastSeq_(0), uploadInFlight_(false), flushRequested_(false),
+      identitySent_(false), frameHasIdentity_(false), tokenPollInFlight_(false), boughtAtMs_(0),
+      nextCryptoSeq_(1), tSession_(SCHED_NONE), tTelemetryDrain_(SCHED_NONE), tWiFiReconnect_(SCHED_NONE),
+      tBadTokenTimeout_(SCHED_NONE), tOutage_(SCHED_NONE), tCustomer_(SCHED_NONE) {
+  snprintf(meterNumber_, sizeof(meterNumber_), "%013llu",
+           (unsigned long long)((fleet.cfg.firstMeter + index) % 10000000000000ULL));
+  snprintf(clientName_, sizeof(clientName_), "LOADGEN %u", index);
+  snprintf(clientPhone_, sizeof(clientPhone_), "078%07u", index % 10000000);
+  token_[0] = '\0';
+  validatingToken_[0] = '\0';
+  boughtToken_[0] = '\0';
+  replay_.highest = 0;
+  replay_.seen = 0;
+}
+
+uint32_t VirtualMeter::uniform(uint32_t lo, uint32_t hi) {
+  return ::uniform(rng_, lo, hi);
+}
+
+uint32_t VirtualMeter::exponentialMs(uint32_t meanS) {
+  return ::exponentialMs(rng_, meanS);
+}
+
+void VirtualMeter::boot(float initialKwh) {
+  uint32_t now = fleetMillis();
+  load_.begin(now);
+  lastMeteringMs_ = now;
+
+  // Credit restored from the billing checkpoint: RUNNING right after boot, like a power cycle
+  for (uint8_t i = 0; i < 20; i++) token_[i] = (char)('0' + (i == 0 ? uniform(1, 9) : uniform(0, 9)));
+  token_[20] = '\0';
+  remainingUwh_ = (int64_t)(initialKwh * 1e9);
+  state_ = METER_RUNNING;
+  sessionStartMs_ = now;
+
+  // Same order, periods, priorities and budgets as registerLoopTasks()
+  scheduler_.every("metering", LOADGEN_METERING_MS, 5, 300, taskMetering, this);
+  tSession_ = scheduler_.every("session", SESSION_CHECK_MS, 3, 8000, taskSession, this);
+  scheduler_.every("wifi-watch", WIFI_WATCH_INTERVAL_MS, 1, 2000, taskWiFiWatch, this);
+  scheduler_.every("token-poll", TOKEN_CHECK_INTERVAL_MS, 1, 2000, taskTokenPoll, this);
+  tTelemetryDrain_ = scheduler_.every("telemetry-drain", TELEMETRY_DRAIN_INTERVAL_MS, 1, 10000, taskTelemetryDrain, this);
+  tWiFiReconnect_ = scheduler_.every("wifi-reconnect", WIFI_RECONNECT_INTERVAL_MS, 1, 2000, taskWiFiReconnect, this);
+  scheduler_.stop(tWiFiReconnect_);  // wifi-watch arms it when the link drops
+  tBadTokenTimeout_ = scheduler_.once("bad-token", 2, 5000, taskBadTokenTimeout, this);
+  tOutage_ = scheduler_.once("outage", 0, 1000, taskOutage, this);
+  tCustomer_ = scheduler_.once("customer", 0, 1000, taskCustomer, this);
+
+  scheduleCustomer();
+  scheduleOutage();
+}
+
+uint32_t VirtualMeter::run() {
+  uint32_t startUs = fleetMicros();
+  uint32_t idleMs = scheduler_.run();
+  loopLatency_.record(fleetMicros() - startUs);
+  return idleMs;
+}
+
+void VirtualMeter::linkDown(uint32_t ms) {
+  uint32_t until = fleetMillis() + ms;
+  if (!linkUp_ && (int32_t)(outageUntilMs_ - until) >= 0) return;  // already down for longer
+  if (linkUp_) fleet_.counters.outages++;
+  linkUp_ = false;
+  outageUntilMs_ = until;
+  fleet_.http.setLink(conn_, false);
+}
+
+// ------ Tasks ------
+
+SchedResult VirtualMeter::taskMetering(void* self) {
+  VirtualMeter& m = *(VirtualMeter*)self;
+  uint32_t now = fleetMillis();
+  m.meter(now - m.lastMeteringMs_);
+  m.lastMeteringMs_ = now;
+  return SCHED_DONE;
+}
+
+// The metering task: one PZEM sample and the ledger step, relay cut at zero balance
+void VirtualMeter::meter(uint32_t dtMs) {
+  uint32_t dw;
+  load_.sample(fleetMillis(), dw, voltageDv_);
+
+  bool relayOn = token_[0] != '\0' && remainingUwh_ > 0;
+  powerDw_ = relayOn ? dw : 0;
+  frequencyDhz_ = (uint16_t)uniform(498, 502);
+  pfPct_ = (uint8_t)uniform(88, 98);
+
+  // loop()'s refreshMeteringView(): every sample goes into the window statistics
+  PzemReading sample = {};
+  sample.voltage = voltageDv_ / 10.0f;
+  sample.power = powerDw_ / 10.0f;
+  sample.pf = pfPct_ / 100.0f;
+  sample.current = sample.power / (sample.voltage * sample.pf);
+  windowStats_.add(sample);
+
+  // 0.1 W * ms -> uWh: dw / 10 * ms / 3600 * 1000
+  int64_t uwh = (int64_t)powerDw_ * dtMs / 36;
+  energyWh_ += uwh / 1e6;
+  if (!relayOn) return;
+  consumedUwh_ += uwh;
+  remainingUwh_ -= uwh;
+  if (remainingUwh_ <= 0) {
+    remainingUwh_ = 0;
+    powerDw_ = 0;
+    exhausted_ = true;
+  }
+}
+
+ReportSample VirtualMeter::currentReportSample() const {
+  ReportSample s;
+  s.sensorValid = true;
+  s.powerDw = powerDw_;
+  s.voltageDv = voltageDv_;
+  s.remainingMwh = remainingUwh_ > 0 ? (uint32_t)(remainingUwh_ / 1000) : 0;
+  return s;
+}
+
+SchedResult VirtualMeter::taskSession(void* self) {
+  VirtualMeter& m = *(VirtualMeter*)self;
+  if (m.state_ != METER_RUNNING) return SCHED_DONE;
+  uint32_t now = fleetMillis();
+
+  if (m.exhausted_) {
+    m.sendEnergyData(true);
+    m.state_ = METER_EXHAUSTED;
+    m.fleet_.counters.exhausted++;
+    // The customer notices the dark house and buys (api: types the token, as the poll stops)
+    if (m.fleet_.cfg.buy != BUY_NONE) m.scheduler_.start(m.tCustomer_, m.uniform(30, 300) * 1000);
+    return SCHED_DONE;
+  }
+  ReportSample sample = m.currentReportSample();
+  uint8_t reasons = m.reportPolicy_.evaluate(now, sample);
+  if (reasons) {
+    m.sendEnergyData((reasons & REPORT_URGENT) != 0);
+    m.reportPolicy_.reported(now, sample, reasons);
+  }
+  return SCHED_DONE;
+}
+
+SchedResult VirtualMeter::taskWiFiWatch(void* self) {
+  VirtualMeter& m = *(VirtualMeter*)self;
+  if (!m.linkUp_) {
+    m.wifiConnected_ = false;
+    if (!m.scheduler_.armed(m.tWiFiReconnect_)) m.scheduler_.start(m.tWiFiReconnect_, 0);
+    return SCHED_DONE;
+  }
+  m.scheduler_.stop(m.tWiFiReconnect_);
+  m.wifiConnected_ = true;
+  return SCHED_DONE;
+}
+
+// WiFi.reconnect(): associates again once the access point / uplink is back
+SchedResult VirtualMeter::taskWiFiReconnect(void* self) {
+  VirtualMeter& m = *(VirtualMeter*)self;
+  if ((int32_t)(fleetMillis() - m.outageUntilMs_) >= 0) {
+    m.linkUp_ = true;
+    m.fleet_.http.setLink(m.conn_, true);
+  }
+  return SCHED_DONE;
+}
+
+// The push channel is not simulated: every meter polls, as when the socket is down
+SchedResult VirtualMeter::taskTokenPoll(void* self) {
+  VirtualMeter& m = *(VirtualMeter*)self;
+  if ((m.state_ == METER_READY || m.state_ == METER_RUNNING) && m.wifiConnected_ && m.linkUp_) {
+    m.checkForPendingToken();
+  }
+  return SCHED_DONE;
+}
+
+SchedResult VirtualMeter::taskTelemetryDrain(void* self) {
+  ((VirtualMeter*)self)->drainTelemetryLog();
+  return SCHED_DONE;
+}
+
+SchedResult VirtualMeter::taskBadTokenTimeout(void* self) {
+  VirtualMeter& m = *(VirtualMeter*)self;
+  if (m.state_ == METER_BADTOKEN) m.state_ = METER_READY;
+  return SCHED_DONE;
+}
+
+SchedResult VirtualMeter::taskOutage(void* self) {
+  VirtualMeter& m = *(VirtualMeter*)self;
+  uint32_t len = m.exponentialMs(m.fleet_.cfg.outageLenS);
+  m.linkDown(len);
+  m.scheduler_.start(m.tOutage_, len + m.exponentialMs(m.fleet_.cfg.outageEveryS));
+  return SCHED_DONE;
+}
+
+SchedResult VirtualMeter::taskCustomer(void* self) {
+  ((VirtualMeter*)self)->purchase();
+  return SCHED_DONE;
+}
+
+void VirtualMeter::scheduleOutage() {
+  if (fleet_.cfg.outageEveryS) scheduler_.start(tOutage_, exponentialMs(fleet_.cfg.outageEveryS));
+}
+
+void VirtualMeter::scheduleCustomer() {
+  if (fleet_.cfg.buy == BUY_NONE) return;
+  if (state_ == METER_EXHAUSTED || state_ == METER_READY) {
+    scheduler_.start(tCustomer_, uniform(30, 300) * 1000);
+  } else if (fleet_.cfg.buyEveryS) {
+    scheduler_.start(tCustomer_, exponentialMs(fleet_.cfg.buyEveryS));
+  } else {
+    scheduler_.stop(tCustomer_);  // next purchase when the credit runs out
+  }
+}
+
+// ------ Telemetry ------
+
+// sendEnergyDataToAPI(): capture into the log; the drain task uploads it
+void VirtualMeter::sendEnergyData(bool urgent) {
+  uint32_t now = fleetMillis();
+  if (token_[0] == '\0') {
+    windowStats_.reset(now);
+    return;
+  }
+
+  LoggedRecord lr;
+  lr.seq = nextSeq_++;
+  TelemetryRecord& rec = lr.rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.uptime_ms = now;
+  rec.boot_seq = 1;
+  rec.epoch = (uint32_t)time(NULL) + LOADGEN_GMT_OFFSET_S;  // NTP is not simulated: always synced
+  rec.flags = TLOG_FLAG_SENSOR_VALID | TLOG_FLAG_TIME_SYNCED;
+  rec.voltage_dv = voltageDv_;
+  rec.current_ma = (uint32_t)((uint64_t)powerDw_ * 100000 / ((uint32_t)voltageDv_ * pfPct_));
+  rec.power_dw = powerDw_;
+  rec.energy_wh = (uint32_t)energyWh_;
+  rec.frequency_dhz = frequencyDhz_;
+  rec.pf_pct = pfPct_;
+  rec.remaining_mwh = remainingUwh_ > 0 ? (uint32_t)(remainingUwh_ / 1000) : 0;
+  rec.consumed_mwh = (uint32_t)(consumedUwh_ / 1000);
+  rec.session_s = (now - sessionStartMs_) / 1000;
+  windowStats_.close(now, rec.window);
+  TelemetryEncoder::packDigits(token_, rec.token_bcd, sizeof(rec.token_bcd));
+
+  log_.push_back(lr);
+  fleet_.counters.readingsLogged++;
+  if (log_.size() > LOG_CAPACITY) {
+    // Over the flash budget: the oldest segment goes, uploaded or not
+    size_t evict = log_.size() < LOADGEN_SEG_RECORDS ? log_.size() : LOADGEN_SEG_RECORDS;
+    log_.erase(log_.begin(), log_.begin() + evict);
+    fleet_.counters.readingsEvicted += evict;
+  }
+  if (urgent) flushRequested_ = true;
+}
+
+void VirtualMeter::drainTelemetryLog() {
+  if (uploadInFlight_) return;
+  if (!wifiConnected_ || !linkUp_) return;
+  uint32_t now = fleetMillis();
+
+  if (log_.size() < TELEMETRY_BATCH_MIN && !flushRequested_) {
+    if (log_.empty()) return;  // caught up
+    // Oldest reading still young: wait for more
+    if (now - log_.front().rec.uptime_ms < TELEMETRY_BATCH_MAX_WAIT_MS) return;
+  }
+
+  size_t n = log_.size() < TELEMETRY_BATCH_MAX ? log_.size() : TELEMETRY_BATCH_MAX;
+  if (n == 0) return;
+  flushRequested_ = false;
+  if (postTelemetryFrame(n)) uploadInFlight_ = true;
+}
+
+bool VirtualMeter::postTelemetryFrame(size_t n) {
+  uint8_t frame[TELEMETRY_FRAME_MAX];
+  TelemetryEncoder enc(frame, sizeof(frame));
+  enc.begin(meterNumber_);
+  if (!identitySent_) enc.addIdentity(clientName_, "", clientPhone_);
+  uint8_t worst = scheduler_.worstTask();
+  enc.addLatency(loopLatency_.count(), loopLatency_.percentile(50), loopLatency_.percentile(99), loopLatency_.max(),
+                 scheduler_.worstUs(), worst == SCHED_NONE ? "" : scheduler_.stats(worst).name);
+  for (size_t i = 0; i < n; i++) {
+    const TelemetryRecord& rec = log_[i].rec;
+    if (i == 0 || memcmp(rec.token_bcd, log_[i - 1].rec.token_bcd, sizeof(rec.token_bcd)) != 0) {
+      enc.addSession(rec.token_bcd);
+    }
+    enc.addReading(rec, rec.epoch);
+  }
+  if (enc.overflowed()) return false;
+
+  if (!fleet_.http.enqueue(conn_, EP_TELEMETRY, "POST", "/energy-data/bin", frame, enc.size(),
+                           "application/octet-stream", API_SEND_DEADLINE_MS, 1, onEnergyBatchSent, this)) {
+    return false;
+  }
+  frameHasIdentity_ = !identitySent_;
+  inFlightLastSeq_ = log_[n - 1].seq;
+  fleet_.counters.framesSent++;
+  fleet_.counters.frameBytes += enc.size();
+  return true;
+}
+
+void VirtualMeter::onEnergyBatchSent(int status, const char* body, size_t /*len*/, void* ctx) {
+  VirtualMeter& m = *(VirtualMeter*)ctx;
+  FleetCounters& c = m.fleet_.counters;
+  m.uploadInFlight_ = false;
+  bool advance = false;
+  if (status == 200) {
+    c.readingsAccepted += (uint64_t)jsonNumber(body, "accepted");
+    c.readingsRejected += (uint64_t)jsonNumber(body, "rejected");
+    if (m.frameHasIdentity_) m.identitySent_ = true;
+    uint32_t now = fleetMillis();
+    for (size_t i = 0; i < m.log_.size() && m.log_[i].seq <= m.inFlightLastSeq_; i++) {
+      m.fleet_.readingAgeMs.record(now - m.log_[i].rec.uptime_ms);
+    }
+    advance = true;
+  } else if (status == 409) {
+    // Server has no identity for this meter: resend it with the next frame
+    m.identitySent_ = false;
+    c.identityResends++;
+  } else if (status >= 400 && status < 500) {
+    // Rejected (the device falls back to JSON on 404; this tool only speaks the binary frame)
+    advance = true;
+  } else {
+    m.scheduler_.start(m.tTelemetryDrain_, TELEMETRY_DRAIN_BACKOFF_MS);
+  }
+  if (advance) {
+    // Acknowledge what was sent (records evicted meanwhile are already gone)
+    while (!m.log_.empty() && m.log_.front().seq <= m.inFlightLastSeq_) m.log_.pop_front();
+  }
+}
+
+// ------ Tokens ------
+
+void VirtualMeter::checkForPendingToken() {
+  if (!linkUp_) {
+    wifiConnected_ = false;
+    return;
+  }
+  wifiConnected_ = true;
+  if (tokenPollInFlight_) return;  // previous poll still queued/active
+
+  char path[64];
+  snprintf(path, sizeof(path), "/purchases/pending-token/%s", meterNumber_);
+  tokenPollInFlight_ = fleet_.http.enqueue(conn_, EP_TOKEN_POLL, "GET", path, NULL, 0, NULL, TOKEN_POLL_DEADLINE_MS,
+                                           0, onPendingTokenResponse, this);
+}
+
+void VirtualMeter::onPendingTokenResponse(int status, const char* body, size_t /*len*/, void* ctx) {
+  VirtualMeter& m = *(VirtualMeter*)ctx;
+  m.tokenPollInFlight_ = false;
+  if (status != 200 || !jsonTrue(body, "success") || !jsonTrue(body, "hasToken")) return;
+  char tokenNumber[21];
+  char purchaseId[64];
+  if (!jsonString(body, "tokenNumber", tokenNumber, sizeof(tokenNumber)) ||
+      !jsonString(body, "purchaseId", purchaseId, sizeof(purchaseId))) {
+    return;
+  }
+  m.fleet_.counters.pollHits++;
+  // Only apply when idle or running; a keypad entry/validation in progress wins
+  if (m.state_ == METER_READY || m.state_ == METER_RUNNING) {
+    m.applyToken(tokenNumber, (float)jsonNumber(body, "kwhAmount"), purchaseId);
+  }
+}
+
+// applyTokenFromServer()
+bool VirtualMeter::applyToken(const char* tokenNumber, float kwh, const char* purchaseId) {
+  // Same purchase again (polled before our confirm got through): confirm only
+  if (purchaseId[0] != '\0' && lastAppliedPurchaseId_ == purchaseId) {
+    confirmTokenDelivery(purchaseId);
+    return true;
+  }
+  uint32_t now = fleetMillis();
+  bool freshSession = !(state_ == METER_RUNNING && remainingUwh_ > 0);
+  int64_t credit = (int64_t)(kwh * 1e9);
+  if (freshSession) {
+    remainingUwh_ = credit;
+    consumedUwh_ = 0;
+  } else {
+    remainingUwh_ += credit;
+  }
+  snprintf(token_, sizeof(token_), "%s", tokenNumber);
+  exhausted_ = false;
+  lastAppliedPurchaseId_ = purchaseId;
+  state_ = METER_RUNNING;
+  sessionStartMs_ = now;
+  reportPolicy_.force();  // report the new balance on the next session check
+  fleet_.counters.tokensApplied++;
+
+  if (boughtToken_[0] != '\0' && strcmp(boughtToken_, tokenNumber) == 0) {
+    fleet_.tokenDelayMs.record(now - boughtAtMs_);
+    boughtToken_[0] = '\0';
+    scheduleCustomer();
+  }
+  confirmTokenDelivery(purchaseId);
+  return true;
+}
+
+void VirtualMeter::confirmTokenDelivery(const char* purchaseId) {
+  char path[HTTP_MAX_PATH];
+  snprintf(path, sizeof(path), "/purchases/confirm-token/%s", purchaseId);
+  fleet_.http.enqueue(conn_, EP_TOKEN_CONFIRM, "POST", path, "{}", 2, "application/json", TOKEN_CONFIRM_DEADLINE_MS,
+                      2, onTokenConfirmed, this);
+}
+
+void VirtualMeter::onTokenConfirmed(int status, const char* /*body*/, size_t /*len*/, void* ctx) {
+  if (status >= 200 && status < 300) ((VirtualMeter*)ctx)->fleet_.counters.tokensConfirmed++;
+}
+
+void VirtualMeter::showBadToken() {
+  state_ = METER_BADTOKEN;
+  fleet_.counters.badTokens++;
+  scheduler_.start(tBadTokenTimeout_, LOADGEN_BAD_TOKEN_MS);
+}
+
+// submitToken() for a token the customer typed (no offline token partition here)
+void VirtualMeter::typeToken(const char* tokenNumber) {
+  CryptoToken crypto;
+  CryptoTokenResult decoded = cryptoTokenDecode(fleet_.cfg.tokenKey, meterNumber_, tokenNumber, crypto);
+  if (decoded == CRYPTO_TOKEN_BAD_FIELDS || (decoded == CRYPTO_TOKEN_OK && !replayWindowAllows(replay_, crypto.seq))) {
+    showBadToken();
+    return;
+  }
+  if (decoded == CRYPTO_TOKEN_OK) {
+    replayWindowAccept(replay_, crypto.seq);
+    int64_t credit = (int64_t)crypto.deciKwh * 100000000LL;  // 0.1 kWh in uWh
+    if (remainingUwh_ > 0) {
+      remainingUwh_ += credit;  // credit adds to the balance, like a server top-up
+    } else {
+      remainingUwh_ = credit;
+      consumedUwh_ = 0;
+    }
+    snprintf(token_, sizeof(token_), "%s", tokenNumber);
+    exhausted_ = false;
+    state_ = METER_RUNNING;
+    sessionStartMs_ = fleetMillis();
+    reportPolicy_.force();
+    fleet_.counters.tokensApplied++;
+    scheduleCustomer();
+    return;
+  }
+
+  // Not ours: ask the server whether it is this meter's pending purchase
+  if (!wifiConnected_ || !linkUp_) {
+    showBadToken();  // "No network"
+    return;
+  }
+  char path[64];
+  snprintf(path, sizeof(path), "/purchases/pending-token/%s", meterNumber_);
+  if (!fleet_.http.enqueue(conn_, EP_TOKEN_VALIDATE, "GET", path, NULL, 0, NULL, TOKEN_POLL_DEADLINE_MS, 1,
+                           onValidateTokenResponse, this)) {
+    showBadToken();  // "Server busy"
+    return;
+  }
+  snprintf(validatingToken_, sizeof(validatingToken_), "%s", tokenNumber);
+  state_ = METER_VALIDATING;
+}
+
+void VirtualMeter::onValidateTokenResponse(int status, const char* body, size_t /*len*/, void* ctx) {
+  VirtualMeter& m = *(VirtualMeter*)ctx;
+  if (m.state_ != METER_VALIDATING) return;
+  char tokenNumber[21];
+  char purchaseId[64];
+  if (status == 200 && jsonTrue(body, "success") && jsonTrue(body, "hasToken") &&
+      jsonString(body, "tokenNumber", tokenNumber, sizeof(tokenNumber)) &&
+      jsonString(body, "purchaseId", purchaseId, sizeof(purchaseId)) && strcmp(tokenNumber, m.validatingToken_) == 0) {
+    m.state_ = METER_READY;  // fresh session
+    m.validatingToken_[0] = '\0';
+    m.applyToken(tokenNumber, (float)jsonNumber(body, "kwhAmount"), purchaseId);
+    return;
+  }
+  m.validatingToken_[0] = '\0';
+  m.showBadToken();
+}
+
+// The customer's turn: buy, or type the token bought earlier
+void VirtualMeter::purchase() {
+  bool dark = state_ == METER_EXHAUSTED || state_ == METER_READY;
+  uint32_t rwf = PURCHASE_RWF[uniform(0, sizeof(PURCHASE_RWF) / sizeof(PURCHASE_RWF[0]) - 1)];
+
+  if (fleet_.cfg.buy == BUY_OFFLINE) {
+    if (state_ == METER_VALIDATING || state_ == METER_BADTOKEN) {
+      scheduler_.start(tCustomer_, 10000);  // keypad busy: try again shortly
+      return;
+    }
+    CryptoToken t;
+    t.tokenClass = CRYPTO_TOKEN_CLASS_CREDIT;
+    t.seq = nextCryptoSeq_++;
+    t.deciKwh = (uint16_t)(rwf * 10 / RWF_PER_KWH);
+    char digits[21];
+    if (t.seq == 0 || !cryptoTokenEncode(fleet_.cfg.tokenKey, meterNumber_, t, digits)) {
+      fleet_.counters.purchaseFailures++;
+      return;
+    }
+    fleet_.counters.purchases++;
+    typeToken(digits);
+    return;
+  }
+
+  if (boughtToken_[0] != '\0') {
+    // Bought but not delivered yet: type it when the meter is dark, otherwise wait for the poll
+    if (dark) typeToken(boughtToken_);
+    scheduler_.start(tCustomer_, uniform(60, 180) * 1000);
+    return;
+  }
+
+  char body[128];
+  int n = snprintf(body, sizeof(body), "{\"meterNumber\":\"%s\",\"amountRWF\":%u,\"paymentMethod\":\"MOBILE_MONEY\"}",
+                   meterNumber_, rwf);
+  HttpConn& c = fleet_.customers[fleet_.nextCustomer++ % LOADGEN_CUSTOMER_CONNS];
+  if (!fleet_.http.enqueue(c, EP_BUY, "POST", "/purchases/buy", body, n, "application/json", 10000, 0, onPurchased,
+                           this, fleet_.jwt.c_str())) {
+    fleet_.counters.purchaseFailures++;
+    scheduler_.start(tCustomer_, uniform(60, 180) * 1000);
+  }
+}
+
+void VirtualMeter::onPurchased(int status, const char* body, size_t /*len*/, void* ctx) {
+  VirtualMeter& m = *(VirtualMeter*)ctx;
+  if (status != 200 || !jsonString(body, "tokenNumber", m.boughtToken_, sizeof(m.boughtToken_))) {
+    m.boughtToken_[0] = '\0';
+    m.fleet_.counters.purchaseFailures++;
+    m.scheduler_.start(m.tCustomer_, m.uniform(60, 180) * 1000);
+    return;
+  }
+  m.fleet_.counters.purchases++;
+  m.boughtAtMs_ = fleetMillis();
+  bool dark = m.state_ == METER_EXHAUSTED || m.state_ == METER_READY;
+  // A dark meter does not poll: the customer reads the SMS and types the token
+  m.scheduler_.start(m.tCustomer_, dark ? m.uniform(20, 60) * 1000 : m.uniform(120, 300) * 1000);
+}
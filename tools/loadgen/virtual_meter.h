@@ -0,0 +1,271 @@
+/**
+ * virtual_meter.h - One simulated meter: the firmware's loop() tasks against the real API
+ *
+ * A VirtualMeter runs the parts of loop() that talk to the backend on its own
+ * Scheduler, with the periods, priorities and budgets of registerLoopTasks()
+ * and the constants of api_schedule.h:
+ *
+ *   metering         200 ms   load profile -> power, voltage, window statistics;
+ *                             credit integrated in uWh
+ *   session          SESSION_CHECK_MS: EXHAUSTED transition, ReportPolicy -> log a reading
+ *   wifi-watch       link state -> wifiConnected, arms wifi-reconnect while down
+ *   token-poll       GET /purchases/pending-token while READY/RUNNING (push channel down)
+ *   telemetry-drain  POST /energy-data/bin, batching and backoff as drainTelemetryLog()
+ *   wifi-reconnect   re-associates once the outage is over
+ *   bad-token        BAD TOKEN screen -> READY after 2 s
+ *   outage/customer  one-shots: link drops, purchases and typed tokens
+ *
+ * Readings go through the same IntervalStats, TelemetryRecord and TelemetryEncoder
+ * as on the device, and every completion callback makes the decision the firmware's makes
+ * (advance, keep and back off, resend identity on 409). The flash log is an
+ * in-memory queue holding TELEMETRY_LOG_BUDGET_BYTES of records, evicting whole
+ * segments of LOADGEN_SEG_RECORDS like TelemetryLog.
+ *
+ * Purchases (FleetConfig::buy):
+ *   BUY_OFFLINE  the customer types a crypto token (crypto_token.h) made for the
+ *                meter; applied locally, no request besides the forced report.
+ *   BUY_API      POST /purchases/buy as a logged-in customer. A running meter picks
+ *                the token up with its next poll; an exhausted one has it typed and
+ *                validates it with GET pending-token. Applied tokens are confirmed.
+ *
+ * Single-threaded, driven by the loop in loadgen.cpp.
+ */
+
+#ifndef LOADGEN_VIRTUAL_METER_H
+#define LOADGEN_VIRTUAL_METER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <string>
+#include "api_schedule.h"
+#include "crypto_token.h"
+#include "http_engine.h"
+#include "interval_stats.h"
+#include "latency_histogram.h"
+#include "scheduler.h"
+#include "telemetry_record.h"
+
+#define LOADGEN_SEG_RECORDS       64   // TLOG_SEG_RECORDS (telemetry_log.h needs LittleFS)
+#define LOADGEN_METERING_MS       200  // metering task period on core 0
+#define LOADGEN_BAD_TOKEN_MS      2000 // BAD_TOKEN_SCREEN_MS in main.cpp
+#define LOADGEN_CUSTOMER_CONNS    16   // shared connections for /purchases/buy (customers' phones)
+#define LOADGEN_MAX_APPLIANCES    4
+#define LOADGEN_GMT_OFFSET_S      7200 // gmtOffset_sec in main.cpp
+
+enum LoadgenEndpoint : uint8_t {
+  EP_TELEMETRY,        // POST /energy-data/bin
+  EP_TOKEN_POLL,       // GET /purchases/pending-token (periodic)
+  EP_TOKEN_VALIDATE,   // GET /purchases/pending-token (typed token)
+  EP_TOKEN_CONFIRM,    // POST /purchases/confirm-token
+  EP_BUY,              // POST /purchases/buy
+  EP_REGISTER,         // POST /auth/register
+  EP_COUNT
+};
+extern const char* const ENDPOINT_NAMES[EP_COUNT];
+
+enum BuyMode : uint8_t { BUY_NONE, BUY_OFFLINE, BUY_API };
+
+struct Appliance {
+  uint32_t watts;
+  uint32_t meanGapS;   // mean time between switch-ons (exponential)
+  uint32_t onS;        // how long it stays on
+};
+
+struct LoadProfile {
+  const char* name;
+  uint32_t baseW;
+  uint8_t noisePct;    // per-sample jitter, below the report deadband
+  Appliance appliances[LOADGEN_MAX_APPLIANCES];
+};
+
+// NULL when unknown: "home", "shop", "idle"
+const LoadProfile* findLoadProfile(const char* name);
+
+// A profile's load over time, one metering sample at a time: appliances switch on
+// at random (exponential gaps) on top of the base load, the power jitters by
+// noisePct and the voltage wanders around 230 V. It has its own random
+// stream, so a seed gives the same load with or without the network side
+// (loadgen --trace writes it out).
+class LoadModel {
+ public:
+  LoadModel(const LoadProfile& profile, uint32_t seed);
+
+  // First switch-on times, counted from nowMs
+  void begin(uint32_t nowMs);
+  // The sample at nowMs (0.1 W, 0.1 V)
+  void sample(uint32_t nowMs, uint32_t& powerDw, uint16_t& voltageDv);
+
+ private:
+  const LoadProfile& profile_;
+  uint32_t rng_;
+  uint16_t voltageDv_;
+  uint32_t untilMs_[LOADGEN_MAX_APPLIANCES];
+  uint32_t nextMs_[LOADGEN_MAX_APPLIANCES];
+};
+
+struct FleetConfig {
+  BuyMode buy;
+  uint32_t buyEveryS;     // mean time between top-ups of a running meter, 0 = only when exhausted
+  uint32_t outageEveryS;  // mean time between link drops per meter, 0 = none
+  uint32_t outageLenS;    // mean link drop length
+  uint64_t firstMeter;    // meter numbers count up from here (13 digits)
+  uint8_t tokenKey[CRYPTO_TOKEN_KEY_BYTES];
+};
+
+struct FleetCounters {
+  uint64_t readingsLogged;
+  uint64_t readingsEvicted;   // log over budget while offline
+  uint64_t readingsAccepted;  // server "accepted"
+  uint64_t readingsRejected;
+  uint64_t framesSent;
+  uint64_t frameBytes;
+  uint32_t identityResends;   // 409
+  uint32_t exhausted;
+  uint32_t purchases;         // bought (api) or made (offline)
+  uint32_t purchaseFailures;
+  uint32_t tokensApplied;
+  uint32_t tokensConfirmed;
+  uint32_t badTokens;
+  uint32_t pollHits;          // pending-token polls that found a token
+  uint32_t outages;
+};
+
+// Everything the meters share
+struct Fleet {
+  Fleet() : nextCustomer(0) {}
+
+  HttpEngine http;
+  FleetConfig cfg;
+  FleetCounters counters;
+  HttpConn customers[LOADGEN_CUSTOMER_CONNS];
+  uint32_t nextCustomer;
+  std::string jwt;                 // bearer token of the load-test customer (BUY_API)
+  LatencyHistogram readingAgeMs;   // capture -> accepted by the server, in ms
+  LatencyHistogram tokenDelayMs;   // purchase -> applied on the meter, in ms
+};
+
+// Clocks since the load generator started (the schedulers' and the engine's)
+uint32_t fleetMillis();
+uint32_t fleetMicros();
+uint64_t fleetMillis64();
+uint64_t fleetMicros64();
+
+enum MeterState : uint8_t { METER_READY, METER_RUNNING, METER_EXHAUSTED, METER_VALIDATING, METER_BADTOKEN, METER_STATES };
+extern const char* const METER_STATE_NAMES[METER_STATES];
+
+class VirtualMeter {
+ public:
+  VirtualMeter(Fleet& fleet, uint32_t index, const LoadProfile& profile, uint32_t seed);
+
+  // Register the tasks and start RUNNING on a restored credit of initialKwh
+  void boot(float initialKwh);
+  // One loop() pass; returns ms until a task is due
+  uint32_t run();
+  // Drop the link for ms (fleet-wide blackout); it comes back through wifi-reconnect
+  void linkDown(uint32_t ms);
+
+  MeterState state() const { return state_; }
+  size_t backlog() const { return log_.size(); }
+  bool online() const { return linkUp_; }
+
+ private:
+  struct LoggedRecord {
+    uint64_t seq;
+    TelemetryRecord rec;
+  };
+
+  static SchedResult taskMetering(void* self);
+  static SchedResult taskSession(void* self);
+  static SchedResult taskWiFiWatch(void* self);
+  static SchedResult taskTokenPoll(void* self);
+  static SchedResult taskTelemetryDrain(void* self);
+  static SchedResult taskWiFiReconnect(void* self);
+  static SchedResult taskBadTokenTimeout(void* self);
+  static SchedResult taskOutage(void* self);
+  static SchedResult taskCustomer(void* self);
+
+  static void onEnergyBatchSent(int status, const char* body, size_t len, void* ctx);
+  static void onPendingTokenResponse(int status, const char* body, size_t len, void* ctx);
+  static void onValidateTokenResponse(int status, const char* body, size_t len, void* ctx);
+  static void onTokenConfirmed(int status, const char* body, size_t len, void* ctx);
+  static void onPurchased(int status, const char* body, size_t len, void* ctx);
+
+  void meter(uint32_t dtMs);
+  ReportSample currentReportSample() const;
+  void sendEnergyData(bool urgent);
+  void drainTelemetryLog();
+  bool postTelemetryFrame(size_t n);
+  void checkForPendingToken();
+  bool applyToken(const char* tokenNumber, float kwh, const char* purchaseId);
+  void confirmTokenDelivery(const char* purchaseId);
+  void typeToken(const char* tokenNumber);
+  void showBadToken();
+  void purchase();
+  void scheduleCustomer();
+  void scheduleOutage();
+
+  uint32_t uniform(uint32_t lo, uint32_t hi);
+  uint32_t exponentialMs(uint32_t meanS);
+
+  Fleet& fleet_;
+  const LoadProfile& profile_;
+  Scheduler scheduler_;
+  HttpConn conn_;
+  LatencyHistogram loopLatency_;
+  uint32_t rng_;
+
+  char meterNumber_[14];
+  char clientName_[24];
+  char clientPhone_[11];
+  MeterState state_;
+
+  // Metering (the metering task's snapshot)
+  LoadModel load_;
+  uint32_t powerDw_;
+  uint16_t voltageDv_;
+  uint8_t pfPct_;
+  uint16_t frequencyDhz_;
+  double energyWh_;
+  int64_t remainingUwh_;
+  int64_t consumedUwh_;
+  bool exhausted_;
+  char token_[21];
+  uint32_t lastMeteringMs_;
+  uint32_t sessionStartMs_;
+  IntervalStats windowStats_;  // samples since the last logged reading
+
+  ReportPolicy reportPolicy_;
+
+  // Link
+  bool linkUp_;             // WiFi.status() == WL_CONNECTED
+  bool wifiConnected_;      // loop()'s view, refreshed by wifi-watch
+  uint32_t outageUntilMs_;
+
+  // Telemetry log and upload
+  std::deque<LoggedRecord> log_;
+  uint64_t nextSeq_;
+  uint64_t inFlightLastSeq_;
+  bool uploadInFlight_;
+  bool flushRequested_;
+  bool identitySent_;
+  bool frameHasIdentity_;
+
+  // Tokens
+  bool tokenPollInFlight_;
+  std::string lastAppliedPurchaseId_;
+  char validatingToken_[21];
+  char boughtToken_[21];     // api purchase the customer still has to see applied
+  uint32_t boughtAtMs_;
+  uint16_t nextCryptoSeq_;
+  TokenReplayWindow replay_;
+
+  uint8_t tSession_;
+  uint8_t tTelemetryDrain_;
+  uint8_t tWiFiReconnect_;
+  uint8_t tBadTokenTimeout_;
+  uint8_t tOutage_;
+  uint8_t tCustomer_;
+};
+
+#endif // LOADGEN_VIRTUAL_METER_H
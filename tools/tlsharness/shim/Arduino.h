@@ -0,0 +1,16 @@
+/**
+ * Arduino.h - The little of the Arduino core that tls_session_client.cpp uses,
+ * on a Linux host (tools/tlsharness)
+ */
+
+#ifndef TLSHARNESS_ARDUINO_H
+#define TLSHARNESS_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Host monotonic clock, defined in tlsharness.cpp
+uint32_t millis();
+
+#endif // TLSHARNESS_ARDUINO_H
@@ -0,0 +1,21 @@
+/**
+ * IPAddress.h - IPv4 address in network byte order, as the Arduino-ESP32 class
+ * stores it (tools/tlsharness)
+ */
+
+#ifndef TLSHARNESS_IPADDRESS_H
+#define TLSHARNESS_IPADDRESS_H
+
+#include <stdint.h>
+
+class IPAddress {
+ public:
+  IPAddress() : addr_(0) {}
+  IPAddress(uint32_t addr) : addr_(addr) {}
+  operator uint32_t() const { return addr_; }
+
+ private:
+  uint32_t addr_;
+};
+
+#endif // TLSHARNESS_IPADDRESS_H
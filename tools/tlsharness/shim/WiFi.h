@@ -0,0 +1,18 @@
+/**
+ * WiFi.h - WiFi.hostByName() on getaddrinfo() (tools/tlsharness)
+ */
+
+#ifndef TLSHARNESS_WIFI_H
+#define TLSHARNESS_WIFI_H
+
+#include "IPAddress.h"
+
+class HostWiFi {
+ public:
+  // 1 on success, like the Arduino-ESP32 call
+  int hostByName(const char* host, IPAddress& ip);
+};
+
+extern HostWiFi WiFi;
+
+#endif // TLSHARNESS_WIFI_H
@@ -0,0 +1,30 @@
+/**
+ * lwip/sockets.h - lwIP's socket calls on the host's BSD sockets (tools/tlsharness)
+ *
+ * Qualified (::connect): inside TlsSessionClient a bare connect() is the member.
+ * lwIP has no SIGPIPE: a send on a connection the peer has closed fails with an
+ * error, so lwip_send() does the same here.
+ */
+
+#ifndef TLSHARNESS_LWIP_SOCKETS_H
+#define TLSHARNESS_LWIP_SOCKETS_H
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define lwip_socket      ::socket
+#define lwip_fcntl       ::fcntl
+#define lwip_setsockopt  ::setsockopt
+#define lwip_getsockopt  ::getsockopt
+#define lwip_connect     ::connect
+#define lwip_select      ::select
+#define lwip_recv        ::recv
+#define lwip_close       ::close
+#define lwip_send(s, buf, len, flags) ::send(s, buf, len, (flags) | MSG_NOSIGNAL)
+
+#endif // TLSHARNESS_LWIP_SOCKETS_H
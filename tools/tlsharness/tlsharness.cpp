@@ -0,0 +1,351 @@
+/**
+ * tlsharness.cpp - TlsSessionClient against a local OpenSSL server: full vs
+ * resumed handshakes, and the API host's DNS cache
+ *
+ * The firmware's own src/tls_session_client.cpp (mbedTLS) runs on Linux through
+ * the shims in shim/ (lwIP sockets -> BSD sockets, millis(), Client, IPAddress).
+ * The server is OpenSSL in a thread on 127.0.0.1 with a throwaway P-256
+ * certificate. Every connection sends one line and gets one back, then the
+ * server closes it, which is how AsyncHttp's idle keep-alive connection ends.
+ *
+ * The client tells full from resumed handshakes by the direction of its last
+ * socket call, not by mbedTLS state. The server knows for sure
+ * (SSL_session_reused()), so each scenario checks the client's counters against
+ * the server's:
+ *   tickets     the server issues session tickets (the usual nginx/Node setup)
+ *   ids         session IDs only (SSL_OP_NO_TICKET)
+ *   restart     the client offers a session the server no longer knows (new
+ *               context: empty cache, new ticket keys), so it falls back to a
+ *               full handshake. The client must count that one as full.
+ *   cleared     clearSession(): the next connect is a full handshake
+ * Then "localhost" is resolved through HostCache (host_cache.h) on a fake clock,
+ * with getaddrinfo() as the resolver. It must hit the cache within
+ * HTTP_DNS_TTL_MS and look the name up again once the TTL has expired.
+ *
+ * Needs the mbedTLS (2.28 or 3.x) and OpenSSL 3 development packages
+ * (Debian/Ubuntu: libmbedtls-dev libssl-dev):
+ *   g++ -std=gnu++17 -O2 -Wall -Iinclude -Itools/tlsharness/shim tools/tlsharness/tlsharness.cpp \
+ *       src/tls_session_client.cpp src/host_cache.cpp -lmbedtls -lmbedx509 -lmbedcrypto -lssl -lcrypto \
+ *       -pthread -o tlsharness
+ *   ./tlsharness            # exit status 0 = every check passed
+ */
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include "Arduino.h"
+#include "WiFi.h"
+#include "lwip/sockets.h"
+#include "tls_session_client.h"
+#include "host_cache.h"
+
+#define HTTP_DNS_TTL_MS      300000UL   // http_async.h
+#define CONNECT_TIMEOUT_MS   5000
+#define REPLY_TIMEOUT_MS     5000
+#define CONNECTS_PER_RUN     5
+
+// ------ Shim backends ------
+
+uint32_t millis() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+
+HostWiFi WiFi;
+
+static uint32_t getaddrinfoCalls = 0;
+
+static bool hostResolve(const char* host, uint32_t& addr, void* /*ctx*/) {
+  getaddrinfoCalls++;
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* res = NULL;
+  if (getaddrinfo(host, NULL, &hints, &res) != 0 || res == NULL) return false;
+  addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr.s_addr;
+  freeaddrinfo(res);
+  return true;
+}
+
+int HostWiFi::hostByName(const char* host, IPAddress& ip) {
+  uint32_t addr = 0;
+  if (!hostResolve(host, addr, NULL)) return 0;
+  ip = IPAddress(addr);
+  return 1;
+}
+
+// ------ Checks ------
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                      \
+  do {                                        \
+    if (!(cond)) {                            \
+      failures++;                             \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+      printf(__VA_ARGS__);                    \
+      printf("\n");                           \
+    }                                         \
+  } while (0)
+
+// ------ OpenSSL server ------
+
+class TlsServer {
+ public:
+  TlsServer() : listen_(-1), port_(0), ctx_(NULL), key_(NULL), cert_(NULL), stopping_(false),
+                full_(0), resumed_(0), failed_(0) {}
+
+  bool start() {
+    key_ = EVP_EC_gen("P-256");
+    cert_ = X509_new();
+    if (key_ == NULL || cert_ == NULL) return false;
+    X509_set_version(cert_, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert_), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert_), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert_), 86400);
+    X509_set_pubkey(cert_, key_);
+    X509_NAME* name = X509_get_subject_name(cert_);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+    X509_set_issuer_name(cert_, name);
+    if (X509_sign(cert_, key_, EVP_sha256()) == 0) return false;
+
+    listen_ = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (listen_ < 0 || bind(listen_, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listen_, 4) != 0 || getsockname(listen_, (struct sockaddr*)&addr, &len) != 0) {
+      return false;
+    }
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread(&TlsServer::run, this);
+    return true;
+  }
+
+  // A fresh context, as after a server restart: empty session cache, new ticket keys
+  bool restart(bool tickets) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == NULL) return false;
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);  // the client caps at 1.2 as well
+    SSL_CTX_use_certificate(ctx, cert_);
+    SSL_CTX_use_PrivateKey(ctx, key_);
+    static const unsigned char sid[] = "tlsharness";
+    SSL_CTX_set_session_id_context(ctx, sid, sizeof(sid) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    if (!tickets) SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ctx_ != NULL) SSL_CTX_free(ctx_);
+    ctx_ = ctx;
+    full_ = resumed_ = failed_ = 0;
+    return true;
+  }
+
+  void stop() {
+    stopping_ = true;
+    shutdown(listen_, SHUT_RDWR);
+    close(listen_);
+    if (thread_.joinable()) thread_.join();
+    SSL_CTX_free(ctx_);
+    X509_free(cert_);
+    EVP_PKEY_free(key_);
+  }
+
+  uint16_t port() const { return port_; }
+  uint32_t full() const { return full_; }
+  uint32_t resumed() const { return resumed_; }
+  uint32_t failed() const { return failed_; }
+
+ private:
+  void run() {
+    while (!stopping_) {
+      int fd = accept(listen_, NULL, NULL);
+      if (fd < 0) continue;
+      std::lock_guard<std::mutex> lock(mutex_);
+      serve(fd);
+      close(fd);
+    }
+  }
+
+  // One request line, one reply line, then close (the idle keep-alive timeout)
+  void serve(int fd) {
+    SSL* ssl = SSL_new(ctx_);
+    SSL_set_fd(ssl, fd);
+    if (SSL_accept(ssl) != 1) {
+      failed_++;
+      ERR_clear_error();
+      SSL_free(ssl);
+      return;
+    }
+    if (SSL_session_reused(ssl)) resumed_++;
+    else full_++;
+    char line[64];
+    size_t n = 0;
+    while (n < sizeof(line) - 1) {
+      int r = SSL_read(ssl, line + n, 1);
+      if (r <= 0) break;
+      if (line[n++] == '\n') break;
+    }
+    line[n] = '\0';
+    SSL_write(ssl, "pong\n", 5);
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+  }
+
+  int listen_;
+  uint16_t port_;
+  SSL_CTX* ctx_;
+  EVP_PKEY* key_;
+  X509* cert_;
+  std::thread thread_;
+  std::mutex mutex_;          // ctx_: one connection at a time
+  std::atomic<bool> stopping_;
+  std::atomic<uint32_t> full_;    // read by the client side between connections
+  std::atomic<uint32_t> resumed_;
+  std::atomic<uint32_t> failed_;
+};
+
+// ------ Client side ------
+
+// Connect, send a line, wait for the reply and for the server's close, as one
+// AsyncHttp request on a connection that then times out idle
+static bool exchange(TlsSessionClient& tls, uint32_t ip, uint16_t port) {
+  if (tls.connect(IPAddress(ip), port, "localhost", CONNECT_TIMEOUT_MS) != 1) return false;
+  const uint8_t ping[] = "ping\n";
+  size_t sent = 0;
+  uint32_t t0 = millis();
+  while (sent < sizeof(ping) - 1 && millis() - t0 < REPLY_TIMEOUT_MS) {
+    sent += tls.write(ping + sent, sizeof(ping) - 1 - sent);
+  }
+  char reply[8];
+  size_t n = 0;
+  while (n < 5 && millis() - t0 < REPLY_TIMEOUT_MS) {
+    if (tls.available() > 0) {
+      int c = tls.read();
+      if (c >= 0) reply[n++] = (char)c;
+    } else {
+      usleep(1000);
+    }
+  }
+  bool ok = n == 5 && memcmp(reply, "pong\n", 5) == 0;
+  while (tls.connected() && millis() - t0 < REPLY_TIMEOUT_MS) usleep(1000);
+  ok = ok && !tls.connected();
+  tls.stop();
+  return ok;
+}
+
+struct Run {
+  const char* name;
+  uint32_t full;
+  uint32_t resumed;
+  uint32_t fullMs;      // last full / resumed handshake time
+  uint32_t resumedMs;
+};
+
+static Run connectSeries(const char* name, TlsSessionClient& tls, TlsServer& server, uint32_t ip,
+                         uint32_t connects) {
+  Run r = {name, 0, 0, 0, 0};
+  uint32_t full0 = tls.fullHandshakes(), resumed0 = tls.resumedHandshakes();
+  uint32_t serverFull0 = server.full(), serverResumed0 = server.resumed();
+  for (uint32_t i = 0; i < connects; i++) {
+    uint32_t resumedBefore = tls.resumedHandshakes();
+    CHECK(exchange(tls, ip, server.port()), "%s: exchange %u failed", name, (unsigned)i);
+    if (tls.resumedHandshakes() != resumedBefore) r.resumedMs = tls.lastHandshakeMs();
+    else r.fullMs = tls.lastHandshakeMs();
+  }
+  r.full = tls.fullHandshakes() - full0;
+  r.resumed = tls.resumedHandshakes() - resumed0;
+  CHECK(r.full == server.full() - serverFull0, "%s: client counted %u full, server saw %u", name,
+        (unsigned)r.full, (unsigned)(server.full() - serverFull0));
+  CHECK(r.resumed == server.resumed() - serverResumed0, "%s: client counted %u resumed, server saw %u",
+        name, (unsigned)r.resumed, (unsigned)(server.resumed() - serverResumed0));
+  CHECK(server.failed() == 0, "%s: %u handshakes failed on the server", name, (unsigned)server.failed());
+  printf("%-8s  full %u (%u ms)  resumed %u (%u ms)\n", name, (unsigned)r.full, (unsigned)r.fullMs,
+         (unsigned)r.resumed, (unsigned)r.resumedMs);
+  return r;
+}
+
+static void testHandshakes(TlsServer& server, uint32_t ip) {
+  // Sessions with tickets: one full handshake, every reconnect resumed
+  {
+    TlsSessionClient tls;
+    CHECK(server.restart(true), "server context");
+    Run r = connectSeries("tickets", tls, server, ip, CONNECTS_PER_RUN);
+    CHECK(r.full == 1 && r.resumed == CONNECTS_PER_RUN - 1, "tickets: %u full, %u resumed",
+          (unsigned)r.full, (unsigned)r.resumed);
+  }
+  // Session IDs only, from the server's cache
+  TlsSessionClient tls;
+  CHECK(server.restart(false), "server context");
+  Run r = connectSeries("ids", tls, server, ip, CONNECTS_PER_RUN);
+  CHECK(r.full == 1 && r.resumed == CONNECTS_PER_RUN - 1, "ids: %u full, %u resumed", (unsigned)r.full,
+        (unsigned)r.resumed);
+
+  // Server restarted: the offered session is refused, a full handshake, then resumed again
+  CHECK(server.restart(true), "server context");
+  r = connectSeries("restart", tls, server, ip, 2);
+  CHECK(r.full == 1 && r.resumed == 1, "restart: %u full, %u resumed", (unsigned)r.full, (unsigned)r.resumed);
+
+  tls.clearSession();
+  r = connectSeries("cleared", tls, server, ip, 2);
+  CHECK(r.full == 1 && r.resumed == 1, "cleared: %u full, %u resumed", (unsigned)r.full, (unsigned)r.resumed);
+}
+
+// AsyncHttp's cache in front of the real resolver, on a fake clock
+static void testDnsTtl(TlsServer& server) {
+  HostCache dns(HTTP_DNS_TTL_MS, hostResolve);
+  TlsSessionClient tls;
+  uint32_t calls0 = getaddrinfoCalls;
+  uint32_t addr = 0;
+  uint32_t now = 1000;
+  CHECK(dns.lookup("localhost", now, addr) && addr == htonl(INADDR_LOOPBACK), "localhost lookup");
+  CHECK(exchange(tls, addr, server.port()), "connect to the resolved address");
+
+  for (now = 1000; now < 1000 + HTTP_DNS_TTL_MS; now += 30000) {
+    CHECK(dns.lookup("localhost", now, addr), "cached lookup at %u ms", (unsigned)now);
+  }
+  CHECK(getaddrinfoCalls - calls0 == 1, "%u resolver calls within the TTL", (unsigned)(getaddrinfoCalls - calls0));
+
+  now = 1000 + HTTP_DNS_TTL_MS;
+  CHECK(dns.lookup("localhost", now, addr), "lookup after the TTL");
+  CHECK(getaddrinfoCalls - calls0 == 2, "TTL expired: %u resolver calls", (unsigned)(getaddrinfoCalls - calls0));
+
+  dns.invalidate();  // AsyncHttp after a failed connect
+  CHECK(dns.lookup("localhost", now + 1, addr), "lookup after invalidate");
+  CHECK(getaddrinfoCalls - calls0 == 3, "invalidated: %u resolver calls", (unsigned)(getaddrinfoCalls - calls0));
+  CHECK(exchange(tls, addr, server.port()), "connect after re-resolving");
+  printf("dns       %u lookups, %u cache hits over %lu s\n", (unsigned)dns.lookups(), (unsigned)dns.hits(),
+         (unsigned long)(HTTP_DNS_TTL_MS / 1000));
+}
+
+int main() {
+  TlsServer server;
+  if (!server.start() || !server.restart(true)) {
+    fprintf(stderr, "tlsharness: cannot start the local TLS server\n");
+    return 2;
+  }
+  uint32_t ip = htonl(INADDR_LOOPBACK);
+  testHandshakes(server, ip);
+  testDnsTtl(server);
+  server.stop();
+
+  if (failures > 0) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
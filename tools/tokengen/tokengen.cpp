@@ -0,0 +1,61 @@
+/**
+ * tokengen.cpp - Host encoder/decoder for offline credit tokens (see include/crypto_token.h)
+ *
+ * Uses the firmware's own codec, so tokens made here are exactly what the meter accepts.
+ *
+ *   g++ -O2 -Iinclude tools/tokengen/tokengen.cpp src/crypto_token.cpp -o tokengen
+ *   ./tokengen encode <key hex> <meter number> <sequence> <kWh>
+ *   ./tokengen decode <key hex> <meter number> <20 digits>
+ *
+ * encode prints the 20-digit token; decode prints "seq kWh" or fails with exit code 1.
+ */
+#include "crypto_token.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int usage() {
+  fprintf(stderr,
+          "usage: tokengen encode <key hex> <meter number> <sequence> <kWh>\n"
+          "       tokengen decode <key hex> <meter number> <20 digits>\n");
+  return 2;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 5) return usage();
+  uint8_t key[CRYPTO_TOKEN_KEY_BYTES];
+  if (!cryptoTokenParseKey(argv[2], key)) {
+    fprintf(stderr, "key must be %d hex characters\n", CRYPTO_TOKEN_KEY_BYTES * 2);
+    return 2;
+  }
+  const char* meter = argv[3];
+
+  if (strcmp(argv[1], "encode") == 0 && argc == 6) {
+    CryptoToken t;
+    t.tokenClass = CRYPTO_TOKEN_CLASS_CREDIT;
+    long seq = strtol(argv[4], NULL, 10);
+    double deci = strtod(argv[5], NULL) * 10.0 + 0.5;
+    if (seq < 1 || seq > 0xFFFF || deci < 1.0 || deci > CRYPTO_TOKEN_MAX_DECI_KWH + 0.5) {
+      fprintf(stderr, "sequence must be 1..65535, kWh 0.1..%.1f\n", CRYPTO_TOKEN_MAX_DECI_KWH / 10.0);
+      return 2;
+    }
+    t.seq = (uint16_t)seq;
+    t.deciKwh = (uint16_t)deci;
+    char out[21];
+    if (!cryptoTokenEncode(key, meter, t, out)) return 1;
+    printf("%s\n", out);
+    return 0;
+  }
+
+  if (strcmp(argv[1], "decode") == 0 && argc == 5) {
+    CryptoToken t;
+    CryptoTokenResult r = cryptoTokenDecode(key, meter, argv[4], t);
+    if (r != CRYPTO_TOKEN_OK) {
+      fprintf(stderr, r == CRYPTO_TOKEN_BAD_FIELDS ? "authentic but malformed\n" : "not a token for this meter\n");
+      return 1;
+    }
+    printf("%u %.1f\n", t.seq, t.deciKwh / 10.0);
+    return 0;
+  }
+  return usage();
+}